@@ -1516,6 +1516,10 @@
 #define VERR_VD_CACHE_NOT_FOUND                     (-3275)
 /** The cache is not up to date with the image. */
 #define VERR_VD_CACHE_NOT_UP_TO_DATE                (-3276)
+/** The discard request doesn't cover whole allocation units of the image. */
+#define VERR_VD_DISCARD_ALIGNMENT_NOT_MET           (-3277)
+/** Cache: No free blocks left in the cache image. */
+#define VERR_VD_CACHE_FULL                          (-3278)
 /** @} */
 
 
@@ -131,8 +131,10 @@ typedef struct INTNETBUF
     STAMCOUNTER     cStatLost;
     /** Number of bad frames (both rings). */
     STAMCOUNTER     cStatBadFrames;
+    /** Number of times the receiver was woken up for new frames. */
+    STAMCOUNTER     cStatWakeups;
     /** Reserved for future use. */
-    STAMCOUNTER     aStatReserved[2];
+    STAMCOUNTER     aStatReserved[1];
     /** Reserved for future send profiling. */
     STAMPROFILE     StatSend1;
     /** Reserved for future send profiling. */
@@ -1120,6 +1122,34 @@ typedef INTNETIFSETACTIVEREQ *PINTNETIFSETACTIVEREQ;
 INTNETR0DECL(int) IntNetR0IfSetActiveReq(PSUPDRVSESSION pSession, PINTNETIFSETACTIVEREQ pReq);
 
 
+/**
+ * Request buffer for IntNetR0IfSetWakeupPolicyReq /
+ * VMMR0_DO_INTNET_IF_SET_WAKEUP_POLICY.
+ * @see IntNetR0IfSetWakeupPolicy.
+ */
+typedef struct INTNETIFSETWAKEUPPOLICYREQ
+{
+    /** The request header. */
+    SUPVMMR0REQHDR  Hdr;
+    /** Alternative to passing the taking the session from the VM handle.
+     * Either use this member or use the VM handle, don't do both. */
+    PSUPDRVSESSION  pSession;
+    /** Handle to the interface. */
+    INTNETIFHANDLE  hIf;
+    /** The max number of frames to queue up before waking up the receiver.
+     * 0 and 1 means waking it up for every frame. */
+    uint32_t        cMaxFrames;
+    /** The max number of microseconds a frame may wait for the receiver to be
+     * woken up, 0 for no limit. */
+    uint32_t        cMicrosMaxLatency;
+} INTNETIFSETWAKEUPPOLICYREQ;
+/** Pointer to an IntNetR0IfSetWakeupPolicyReq /
+ *  VMMR0_DO_INTNET_IF_SET_WAKEUP_POLICY request buffer. */
+typedef INTNETIFSETWAKEUPPOLICYREQ *PINTNETIFSETWAKEUPPOLICYREQ;
+
+INTNETR0DECL(int) IntNetR0IfSetWakeupPolicyReq(PSUPDRVSESSION pSession, PINTNETIFSETWAKEUPPOLICYREQ pReq);
+
+
 /**
  * Request buffer for IntNetR0IfSendReq / VMMR0_DO_INTNET_IF_SEND.
  * @see IntNetR0IfSend.
@@ -1203,6 +1233,8 @@ INTNETR0DECL(int)       IntNetR0IfGetBufferPtrs(INTNETIFHANDLE hIf, PSUPDRVSESSI
 INTNETR0DECL(int)       IntNetR0IfSetPromiscuousMode(INTNETIFHANDLE hIf, PSUPDRVSESSION pSession, bool fPromiscuous);
 INTNETR0DECL(int)       IntNetR0IfSetMacAddress(INTNETIFHANDLE hIf, PSUPDRVSESSION pSession, PCRTMAC pMac);
 INTNETR0DECL(int)       IntNetR0IfSetActive(INTNETIFHANDLE hIf, PSUPDRVSESSION pSession, bool fActive);
+INTNETR0DECL(int)       IntNetR0IfSetWakeupPolicy(INTNETIFHANDLE hIf, PSUPDRVSESSION pSession,
+                                                  uint32_t cMaxFrames, uint32_t cMicrosMaxLatency);
 INTNETR0DECL(int)       IntNetR0IfSend(INTNETIFHANDLE hIf, PSUPDRVSESSION pSession);
 INTNETR0DECL(int)       IntNetR0IfWait(INTNETIFHANDLE hIf, PSUPDRVSESSION pSession, uint32_t cMillies);
 INTNETR0DECL(int)       IntNetR0IfAbortWait(INTNETIFHANDLE hIf, PSUPDRVSESSION pSession);
@@ -115,7 +115,9 @@ typedef enum SCSICMD
     SCSI_WRITE_16                       = 0x8a,
     SCSI_READ_6                         = 0x08,
     SCSI_WRITE_6                        = 0x0a,
-    SCSI_LOG_SENSE                      = 0x4d
+    SCSI_LOG_SENSE                      = 0x4d,
+    /** Unmap command (SBC), shares the opcode with READ SUBCHANNEL (MMC). */
+    SCSI_UNMAP                          = 0x42
 } SCSICMD;
 
 /**
@@ -183,6 +185,7 @@ typedef enum SCSISVCACTIONIN
 #define SCSI_ASC_ILLEGAL_OPCODE                     0x20
 #define SCSI_ASC_LOGICAL_BLOCK_OOR                  0x21
 #define SCSI_ASC_INV_FIELD_IN_CMD_PACKET            0x24
+#define SCSI_ASC_INV_FIELD_IN_PARAM_LIST            0x26
 #define SCSI_ASC_MEDIUM_MAY_HAVE_CHANGED            0x28
 #define SCSI_ASC_MEDIUM_NOT_PRESENT                 0x3a
 #define SCSI_ASC_SAVING_PARAMETERS_NOT_SUPPORTED    0x39
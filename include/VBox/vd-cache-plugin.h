@@ -335,6 +335,60 @@ typedef struct VDCACHEBACKEND
      *  VD_CAP_FILE and NULL otherwise. */
     DECLR3CALLBACKMEMBER(int, pfnComposeName, (PVDINTERFACE pConfig, char **pszName));
 
+    /**
+     * Write data to a cache image which is not yet in the cached image
+     * (write-back mode). The data stays in the cache until it was written
+     * back and marked clean with pfnMarkClean. Optional, a cache without it
+     * supports write-through mode only.
+     *
+     * @returns VBox status code.
+     * @retval  VERR_DISK_FULL if the cache ran out of space for dirty data.
+     *          pcbWriteProcess holds the number of bytes stored.
+     * @param   pBackendData    Opaque state data for this image.
+     * @param   uOffset         The offset of the virtual disk to write to.
+     * @param   pvBuf           Pointer to the buffer containing the data.
+     * @param   cbWrite         How many bytes to write.
+     * @param   pcbWriteProcess Pointer to returned number of bytes stored.
+     */
+    DECLR3CALLBACKMEMBER(int, pfnWriteDirty, (void *pBackendData, uint64_t uOffset,
+                                              const void *pvBuf, size_t cbWrite,
+                                              size_t *pcbWriteProcess));
+
+    /**
+     * Find the first dirty range at or after the given offset. Optional,
+     * required if pfnWriteDirty is implemented.
+     *
+     * @returns VBox status code.
+     * @retval  VERR_NOT_FOUND if there is no dirty data at or after uOffset.
+     * @param   pBackendData    Opaque state data for this image.
+     * @param   uOffset         The offset of the virtual disk to start searching at.
+     * @param   puOffsetDirty   Where to store the start of the dirty range.
+     * @param   pcbDirty        Where to store the size of the dirty range.
+     */
+    DECLR3CALLBACKMEMBER(int, pfnQueryDirty, (void *pBackendData, uint64_t uOffset,
+                                              uint64_t *puOffsetDirty, size_t *pcbDirty));
+
+    /**
+     * Mark a range as clean after the data was written to the cached image.
+     * Optional, required if pfnWriteDirty is implemented.
+     *
+     * @returns VBox status code.
+     * @param   pBackendData    Opaque state data for this image.
+     * @param   uOffset         The offset of the virtual disk.
+     * @param   cbClean         Size of the range.
+     */
+    DECLR3CALLBACKMEMBER(int, pfnMarkClean, (void *pBackendData, uint64_t uOffset, size_t cbClean));
+
+    /**
+     * Drop any cached data for the given range, dirty or not. Optional.
+     *
+     * @returns VBox status code.
+     * @param   pBackendData    Opaque state data for this image.
+     * @param   uOffset         The offset of the virtual disk.
+     * @param   cbDiscard       Size of the range.
+     */
+    DECLR3CALLBACKMEMBER(int, pfnDiscard, (void *pBackendData, uint64_t uOffset, size_t cbDiscard));
+
 } VDCACHEBACKEND;
 
 /** Pointer to VD backend. */
@@ -558,6 +558,58 @@ typedef struct VBOXHDDBACKEND
                                           PVDINTERFACE pVDIfsImage,
                                           PVDINTERFACE pVDIfsOperation));
 
+    /**
+     * Discards the given range of the image. The pointer may be NULL,
+     * indicating that discarding is not supported by the backend.
+     *
+     * Like pfnWrite the range is clipped to the allocation unit (block)
+     * of the image containing uOffset.
+     *
+     * @returns VBox status code.
+     * @returns VERR_VD_DISCARD_ALIGNMENT_NOT_MET if the range doesn't cover the
+     *          whole allocated block. Nothing was changed in that case and
+     *          pcbPreAllocated and pcbPostAllocated give the amount of data of the
+     *          block before and after the range, so the caller can keep track of
+     *          it until the rest of the block is discarded as well.
+     * @param   pBackendData     Opaque state data for this image.
+     * @param   uOffset          The offset of the first byte to discard.
+     * @param   cbDiscard        How many bytes to discard.
+     * @param   pcbPreAllocated  Where to store the number of bytes of the block
+     *                           in front of the range.
+     * @param   pcbPostAllocated Where to store the number of bytes of the block
+     *                           after the range.
+     * @param   pcbDiscarded     Where to store the number of bytes of the range
+     *                           which were processed.
+     */
+    DECLR3CALLBACKMEMBER(int, pfnDiscard, (void *pBackendData,
+                                           uint64_t uOffset, size_t cbDiscard,
+                                           size_t *pcbPreAllocated,
+                                           size_t *pcbPostAllocated,
+                                           size_t *pcbDiscarded));
+
+    /**
+     * Start an asynchronous discard request. The pointer may be NULL,
+     * indicating that discarding is not supported by the backend.
+     *
+     * @returns VBox status code.
+     * @returns VERR_VD_DISCARD_ALIGNMENT_NOT_MET see pfnDiscard.
+     * @param   pBackendData     Opaque state data for this image.
+     * @param   pIoCtx           I/O context associated with this request.
+     * @param   uOffset          The offset of the first byte to discard.
+     * @param   cbDiscard        How many bytes to discard.
+     * @param   pcbPreAllocated  Where to store the number of bytes of the block
+     *                           in front of the range.
+     * @param   pcbPostAllocated Where to store the number of bytes of the block
+     *                           after the range.
+     * @param   pcbDiscarded     Where to store the number of bytes of the range
+     *                           which were processed.
+     */
+    DECLR3CALLBACKMEMBER(int, pfnAsyncDiscard, (void *pBackendData, PVDIOCTX pIoCtx,
+                                                uint64_t uOffset, size_t cbDiscard,
+                                                size_t *pcbPreAllocated,
+                                                size_t *pcbPostAllocated,
+                                                size_t *pcbDiscarded));
+
 } VBOXHDDBACKEND;
 
 /** Pointer to VD backend. */
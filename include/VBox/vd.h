@@ -67,6 +67,20 @@ RT_C_DECLS_BEGIN
 /** Placeholder for VDCopyEx to indicate that the image content is unknown. */
 #define VD_IMAGE_CONTENT_UNKNOWN    0xffffffffU
 
+/** @name VDCopyEx flags
+ * @{
+ */
+/** No special copy options. */
+#define VD_COPY_FLAGS_NONE          0
+/** Read the source on a separate thread while the destination is written. */
+#define VD_COPY_FLAGS_PIPELINE      RT_BIT(0)
+/** Don't write blocks containing only zeroes. Only honored if the destination
+ * is a newly created dynamic base image, ignored otherwise. */
+#define VD_COPY_FLAGS_SKIP_ZEROES   RT_BIT(1)
+/** Mask of valid copy flags. */
+#define VD_COPY_FLAGS_MASK          (VD_COPY_FLAGS_PIPELINE | VD_COPY_FLAGS_SKIP_ZEROES)
+/** @}*/
+
 /** @name VBox HDD container image flags
  * @{
  */
@@ -184,8 +198,22 @@ typedef struct VBOXHDDRAW
  * unusable images.
  */
 #define VD_OPEN_FLAGS_IGNORE_FLUSH  RT_BIT(7)
+/** Turn writes consisting only of zeroes to blocks which are not allocated in
+ * the image into no-ops if the parent images don't have data for the range
+ * either, before the block is allocated. This is handled generically and is
+ * ignored together with VD_OPEN_FLAGS_HONOR_ZEROES. */
+#define VD_OPEN_FLAGS_SKIP_ZEROES   RT_BIT(8)
+/** Operate the cache image in write-back mode, only valid for VDCacheOpen and
+ * VDCreateCache. Writes complete once the data is in the cache and are written
+ * to the image later, on flush or when the cache runs out of space. Only
+ * supported for synchronous I/O. */
+#define VD_OPEN_FLAGS_CACHE_WRITEBACK RT_BIT(9)
+/** Allow discarding of unused ranges with VDDiscardRanges and
+ * VDAsyncDiscardRanges, only available if VD_CAP_DISCARD is set.
+ * The backend frees blocks which don't contain any used data anymore. */
+#define VD_OPEN_FLAGS_DISCARD       RT_BIT(10)
 /** Mask of valid flags. */
-#define VD_OPEN_FLAGS_MASK          (VD_OPEN_FLAGS_NORMAL | VD_OPEN_FLAGS_READONLY | VD_OPEN_FLAGS_HONOR_ZEROES | VD_OPEN_FLAGS_HONOR_SAME | VD_OPEN_FLAGS_INFO | VD_OPEN_FLAGS_ASYNC_IO | VD_OPEN_FLAGS_SHAREABLE | VD_OPEN_FLAGS_SEQUENTIAL | VD_OPEN_FLAGS_IGNORE_FLUSH)
+#define VD_OPEN_FLAGS_MASK          (VD_OPEN_FLAGS_NORMAL | VD_OPEN_FLAGS_READONLY | VD_OPEN_FLAGS_HONOR_ZEROES | VD_OPEN_FLAGS_HONOR_SAME | VD_OPEN_FLAGS_INFO | VD_OPEN_FLAGS_ASYNC_IO | VD_OPEN_FLAGS_SHAREABLE | VD_OPEN_FLAGS_SEQUENTIAL | VD_OPEN_FLAGS_IGNORE_FLUSH | VD_OPEN_FLAGS_SKIP_ZEROES | VD_OPEN_FLAGS_CACHE_WRITEBACK | VD_OPEN_FLAGS_DISCARD)
 /** @}*/
 
 /**
@@ -253,6 +281,8 @@ DECLINLINE(uint32_t) VDOpenFlagsToFileOpenFlags(unsigned uOpenFlags, bool fCreat
 /** The backend supports VFS (virtual filesystem) functionality since it uses
  * VDINTERFACEIO exclusively for all file operations. */
 #define VD_CAP_VFS                  RT_BIT(9)
+/** The backend supports discarding blocks. */
+#define VD_CAP_DISCARD              RT_BIT(10)
 /** @}*/
 
 /** @name VBox HDD container type.
@@ -2184,6 +2214,9 @@ VBOXDDU_DECL(int) VDCreateCache(PVBOXHDD pDisk, const char *pszBackend,
  * are also merged to the destination are deleted from both the disk and the
  * images in the HDD container.
  *
+ * The data to merge is read ahead on a separate thread, the container is only
+ * locked for writing while the data is written to the destination.
+ *
  * @return  VBox status code.
  * @return  VERR_VD_IMAGE_NOT_FOUND if image with specified number was not opened.
  * @param   pDisk           Pointer to HDD container.
@@ -2233,6 +2266,7 @@ VBOXDDU_DECL(int) VDMerge(PVBOXHDD pDisk, unsigned nImageFrom,
  *                          In all rename/move cases or copy to existing image cases the modification UUIDs are copied over.
  * @param   uOpenFlags      Image file open mode, see VD_OPEN_FLAGS_* constants.
  *                          Only used if the destination image is created.
+ * @param   uCopyFlags      Copy options, see VD_COPY_FLAGS_* constants.
  * @param   pVDIfsOperation Pointer to the per-operation VD interface list.
  * @param   pDstVDIfsImage  Pointer to the per-image VD interface list, for the
  *                          destination image.
@@ -2263,7 +2297,8 @@ VBOXDDU_DECL(int) VDCopyEx(PVBOXHDD pDiskFrom, unsigned nImage, PVBOXHDD pDiskTo
                            bool fMoveByRename, uint64_t cbSize,
                            unsigned nImageFromSame, unsigned nImageToSame,
                            unsigned uImageFlags, PCRTUUID pDstUuid,
-                           unsigned uOpenFlags, PVDINTERFACE pVDIfsOperation,
+                           unsigned uOpenFlags, unsigned uCopyFlags,
+                           PVDINTERFACE pVDIfsOperation,
                            PVDINTERFACE pDstVDIfsImage,
                            PVDINTERFACE pDstVDIfsOperation);
 
@@ -2422,6 +2457,25 @@ VBOXDDU_DECL(int) VDWrite(PVBOXHDD pDisk, uint64_t uOffset, const void *pvBuffer
  */
 VBOXDDU_DECL(int) VDFlush(PVBOXHDD pDisk);
 
+/**
+ * Discards unused ranges given as a list.
+ *
+ * Whole blocks are freed in the last image right away, partially discarded
+ * blocks are tracked and freed once they are discarded completely. Data in a
+ * discarded range reads back as zeroes once the containing block is freed and
+ * is undefined before.
+ *
+ * @return  VBox status code.
+ * @return  VERR_VD_NOT_OPENED if no image is opened in HDD container.
+ * @return  VERR_NOT_SUPPORTED if the last image doesn't support discarding or
+ *          wasn't opened with VD_OPEN_FLAGS_DISCARD.
+ * @param   pDisk           Pointer to HDD container.
+ * @param   paRanges        The array of ranges to discard.
+ *                          Offset and size must be aligned to a sector boundary.
+ * @param   cRanges         Number of entries in the array.
+ */
+VBOXDDU_DECL(int) VDDiscardRanges(PVBOXHDD pDisk, PCRTRANGE paRanges, unsigned cRanges);
+
 /**
  * Get number of opened images in HDD container.
  *
@@ -2682,6 +2736,53 @@ VBOXDDU_DECL(int) VDSetParentUuid(PVBOXHDD pDisk, unsigned nImage,
                                   PCRTUUID pUuid);
 
 
+/**
+ * Enables or disables the chain index of the HDD container.
+ *
+ * The index remembers which image of the chain holds the data for the ranges
+ * read so far, so reads through deep snapshot chains go directly to the right
+ * image instead of asking every image from the top down. It is built lazily
+ * from the reads and discarded when the image chain changes.
+ *
+ * @return  VBox status code.
+ * @param   pDisk           Pointer to HDD container.
+ * @param   fEnable         Flag whether to enable or disable the index.
+ */
+VBOXDDU_DECL(int) VDSetChainIndex(PVBOXHDD pDisk, bool fEnable);
+
+/**
+ * Cache statistics, updated by the HDD container while a cache image is
+ * attached. The members can be registered with STAM directly.
+ */
+typedef struct VDCACHESTATS
+{
+    /** Number of reads served from the cache. */
+    uint64_t volatile   cReadHits;
+    /** Number of reads which went to the image. */
+    uint64_t volatile   cReadMisses;
+    /** Number of bytes read from the cache. */
+    uint64_t volatile   cbReadHit;
+    /** Number of bytes read from the image. */
+    uint64_t volatile   cbReadMiss;
+    /** Number of bytes written to the cache only (write-back mode). */
+    uint64_t volatile   cbWriteBackDeferred;
+    /** Number of bytes written back from the cache to the image. */
+    uint64_t volatile   cbWrittenBack;
+} VDCACHESTATS;
+/** Pointer to cache statistics. */
+typedef VDCACHESTATS *PVDCACHESTATS;
+
+/**
+ * Sets the statistics structure the HDD container updates for the cache.
+ *
+ * @return  VBox status code.
+ * @param   pDisk           Pointer to HDD container.
+ * @param   pStats          The statistics to update, NULL to stop updating them.
+ *                          Must stay valid until replaced or the container is
+ *                          destroyed.
+ */
+VBOXDDU_DECL(int) VDCacheSetStatistics(PVBOXHDD pDisk, PVDCACHESTATS pStats);
+
 /**
  * Debug helper - dumps all opened images in HDD container into the log file.
  *
@@ -2735,6 +2836,22 @@ VBOXDDU_DECL(int) VDAsyncWrite(PVBOXHDD pDisk, uint64_t uOffset, size_t cbWrite,
 VBOXDDU_DECL(int) VDAsyncFlush(PVBOXHDD pDisk,
                                PFNVDASYNCTRANSFERCOMPLETE pfnComplete,
                                void *pvUser1, void *pvUser2);
+
+/**
+ * Start an asynchronous discard request.
+ *
+ * @return  VBox status code.
+ * @param   pDisk           Pointer to the HDD container.
+ * @param   paRanges        The array of ranges to discard. The array must stay
+ *                          valid until the request completes.
+ * @param   cRanges         Number of entries in the array.
+ * @param   pfnComplete     Completion callback.
+ * @param   pvUser1         User data which is passed on completion.
+ * @param   pvUser2         User data which is passed on completion.
+ */
+VBOXDDU_DECL(int) VDAsyncDiscardRanges(PVBOXHDD pDisk, PCRTRANGE paRanges, unsigned cRanges,
+                                       PFNVDASYNCTRANSFERCOMPLETE pfnComplete,
+                                       void *pvUser1, void *pvUser2);
 RT_C_DECLS_END
 
 /** @} */
@@ -247,6 +247,8 @@ typedef enum EMEXECPOLICY
 } EMEXECPOLICY;
 
 VMMR3DECL(int)      EMR3SetExecutionPolicy(PVM pVM, EMEXECPOLICY enmPolicy, bool fEnforce);
+VMMR3DECL(int)      EMR3SetExecutionThrottle(PVM pVM, uint32_t uThrottle);
+VMMR3DECL(uint32_t) EMR3GetExecutionThrottle(PVM pVM);
 /** @} */
 #endif /* IN_RING3 */
 
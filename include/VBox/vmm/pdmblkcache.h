@@ -337,6 +337,28 @@ VMMR3DECL(int) PDMR3BlkCacheResume(PPDMBLKCACHE pBlkCache);
  */
 VMMR3DECL(int) PDMR3BlkCacheClear(PPDMBLKCACHE pBlkCache);
 
+/**
+ * Sets the amount of data the given user can keep in the cache.
+ * Other users can't evict data of this user if it has less than the minimum
+ * amount cached, the user evicts its own data when exceeding the maximum.
+ *
+ * @returns VBox status code.
+ * @param   pBlkCache       The cache instance.
+ * @param   cbMin           Minimum number of bytes kept for this user.
+ * @param   cbMax           Maximum number of bytes this user can have cached.
+ */
+VMMR3DECL(int) PDMR3BlkCacheSetQuota(PPDMBLKCACHE pBlkCache, uint32_t cbMin, uint32_t cbMax);
+
+/**
+ * Tells the cache the size of the medium. Read-ahead is only done for users
+ * which set the size because prefetches must not go past the end.
+ *
+ * @returns VBox status code.
+ * @param   pBlkCache       The cache instance.
+ * @param   cbMedium        Size of the medium in bytes, 0 to disable read-ahead.
+ */
+VMMR3DECL(int) PDMR3BlkCacheSetMediumSize(PPDMBLKCACHE pBlkCache, uint64_t cbMedium);
+
 /** @} */
 
 RT_C_DECLS_END
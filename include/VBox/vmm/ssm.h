@@ -1123,6 +1123,11 @@ typedef struct SSMSTRMOPS
 /** Struct magic + version (SSMSTRMOPS_VERSION). */
 #define SSMSTRMOPS_VERSION      UINT32_C(0x55aa0001)
 
+/** Handle to a striped TCP stream, see SSMR3TcpStripeCreate. */
+typedef struct SSMTCPSTRIPE *PSSMTCPSTRIPE;
+/** The max number of sockets a striped TCP stream can use. */
+#define SSM_TCP_STRIPE_MAX_STREAMS  16
+
 
 VMMR3_INT_DECL(void)    SSMR3Term(PVM pVM);
 VMMR3DECL(int)          SSMR3RegisterDevice(PVM pVM, PPDMDEVINS pDevIns, const char *pszName, uint32_t uInstance, uint32_t uVersion, size_t cbGuess, const char *pszBefore,
@@ -1168,10 +1173,19 @@ VMMR3DECL(uint32_t)     SSMR3HandleHostBits(PSSMHANDLE pSSM);
 VMMR3DECL(uint32_t)     SSMR3HandleRevision(PSSMHANDLE pSSM);
 VMMR3DECL(uint32_t)     SSMR3HandleVersion(PSSMHANDLE pSSM);
 VMMR3DECL(const char *) SSMR3HandleHostOSAndArch(PSSMHANDLE pSSM);
+VMMR3DECL(const char *) SSMR3HandleGetFilename(PSSMHANDLE pSSM);
 VMMR3_INT_DECL(int)     SSMR3HandleSetGCPtrSize(PSSMHANDLE pSSM, unsigned cbGCPtr);
 VMMR3DECL(void)         SSMR3HandleReportLivePercent(PSSMHANDLE pSSM, unsigned uPercent);
 VMMR3DECL(int)          SSMR3Cancel(PVM pVM);
 
+VMMR3DECL(int)          SSMR3TcpStripeCreate(PRTSOCKET pahSockets, uint32_t cSockets, bool fWriter, PSSMTCPSTRIPE *ppStripe);
+VMMR3DECL(int)          SSMR3TcpStripeDestroy(PSSMTCPSTRIPE pStripe);
+VMMR3DECL(int)          SSMR3TcpStripeWrite(PSSMTCPSTRIPE pStripe, const void *pvBuf, size_t cbToWrite);
+VMMR3DECL(int)          SSMR3TcpStripeRead(PSSMTCPSTRIPE pStripe, void *pvBuf, size_t cbToRead, size_t *pcbRead);
+VMMR3DECL(int)          SSMR3TcpStripeClose(PSSMTCPSTRIPE pStripe, bool fCanceled);
+VMMR3DECL(void)         SSMR3TcpStripeSetStopReading(PSSMTCPSTRIPE pStripe, bool fStop);
+VMMR3DECL(bool)         SSMR3TcpStripeCanReuseSockets(PSSMTCPSTRIPE pStripe);
+
 
 /** Save operations.
  * @{
@@ -1203,6 +1217,7 @@ VMMR3DECL(int) SSMR3PutIOPort(PSSMHANDLE pSSM, RTIOPORT IOPort);
 VMMR3DECL(int) SSMR3PutSel(PSSMHANDLE pSSM, RTSEL Sel);
 VMMR3DECL(int) SSMR3PutMem(PSSMHANDLE pSSM, const void *pv, size_t cb);
 VMMR3DECL(int) SSMR3PutStrZ(PSSMHANDLE pSSM, const char *psz);
+VMMR3DECL(int) SSMR3TellRecord(PSSMHANDLE pSSM, uint64_t *poffRecord);
 /** @} */
 
 
@@ -1241,6 +1256,7 @@ VMMR3DECL(int) SSMR3GetStrZEx(PSSMHANDLE pSSM, char *psz, size_t cbMax, size_t *
 VMMR3DECL(int) SSMR3GetTimer(PSSMHANDLE pSSM, PTMTIMER pTimer);
 VMMR3DECL(int) SSMR3Skip(PSSMHANDLE pSSM, size_t cb);
 VMMR3DECL(int) SSMR3SkipToEndOfUnit(PSSMHANDLE pSSM);
+VMMR3DECL(int) SSMR3SeekRecord(PSSMHANDLE pSSM, uint64_t offRecord);
 VMMR3DECL(int) SSMR3SetLoadError(PSSMHANDLE pSSM, int rc, RT_SRC_POS_DECL, const char *pszFormat, ...);
 VMMR3DECL(int) SSMR3SetLoadErrorV(PSSMHANDLE pSSM, int rc, RT_SRC_POS_DECL, const char *pszFormat, va_list va);
 VMMR3DECL(int) SSMR3SetCfgError(PSSMHANDLE pSSM, RT_SRC_POS_DECL, const char *pszFormat, ...);
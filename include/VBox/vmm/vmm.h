@@ -434,6 +434,8 @@ typedef enum VMMR0OPERATION
     VMMR0_DO_INTNET_IF_WAIT,
     /** Call IntNetR0IfAbortWait(). */
     VMMR0_DO_INTNET_IF_ABORT_WAIT,
+    /** Call IntNetR0IfSetWakeupPolicy(). */
+    VMMR0_DO_INTNET_IF_SET_WAKEUP_POLICY,
 
     /** Forward call to the PCI driver */
     VMMR0_DO_PCIRAW_REQ,
@@ -67,6 +67,8 @@ typedef enum VSCSIIOREQTXDIR
     VSCSIIOREQTXDIR_WRITE,
     /** Flush */
     VSCSIIOREQTXDIR_FLUSH,
+    /** Unmap */
+    VSCSIIOREQTXDIR_UNMAP,
     /** 32bit hack */
     VSCSIIOREQTXDIR_32BIT_HACK = 0x7fffffff
 } VSCSIIOREQTXDIR;
@@ -92,6 +94,12 @@ typedef enum VSCSILUNTYPE
 /** Pointer to a SCSI LUN type */
 typedef VSCSILUNTYPE *PVSCSILUNTYPE;
 
+/** @name Virtual SCSI LUN feature flags.
+ * @{ */
+/** The medium can discard (unmap) blocks. */
+#define VSCSI_LUN_FEATURE_UNMAP  RT_BIT_64(0)
+/** @} */
+
 /**
  * Virtual SCSI LUN I/O Callback table.
  */
@@ -124,6 +132,21 @@ typedef struct VSCSILUNIOCALLBACKS
                                                               void *pvScsiLunUser,
                                                               VSCSIIOREQ hVScsiIoReq));
 
+    /**
+     * Returns the features of the underlying medium. Optional, may be NULL
+     * if the medium has no special features.
+     *
+     * @returns VBox status status code.
+     * @param   hVScsiLun        Virtual SCSI LUN handle.
+     * @param   pvScsiLunUser    Opaque user data which may
+     *                           be used to identify the medium.
+     * @param   pfFeatures       Where to store the supported
+     *                           features, combination of VSCSI_LUN_FEATURE_*.
+     */
+    DECLR3CALLBACKMEMBER(int, pfnVScsiLunGetFeatureFlags, (VSCSILUN hVScsiLun,
+                                                           void *pvScsiLunUser,
+                                                           uint64_t *pfFeatures));
+
 } VSCSILUNIOCALLBACKS;
 /** Pointer to a virtual SCSI LUN I/O callback table. */
 typedef VSCSILUNIOCALLBACKS *PVSCSILUNIOCALLBACKS;
@@ -283,6 +306,17 @@ VBOXDDU_DECL(int) VSCSIIoReqParamsGet(VSCSIIOREQ hVScsiIoReq, uint64_t *puOffset
                                       size_t *pcbTransfer, unsigned *pcSeg,
                                       size_t *pcbSeg, PCRTSGSEG *ppaSeg);
 
+/**
+ * Query unmap parameters.
+ *
+ * @returns VBox status code.
+ * @param   hVScsiIoReq    The SCSI I/O request handle.
+ * @param   ppaRanges      Where to store the pointer to the range array.
+ * @param   pcRanges       Where to store the number of ranges in the array.
+ */
+VBOXDDU_DECL(int) VSCSIIoReqUnmapParamsGet(VSCSIIOREQ hVScsiIoReq, PCRTRANGE *ppaRanges,
+                                           unsigned *pcRanges);
+
 RT_C_DECLS_END
 
 #endif /* ___VBox_vscsi_h */
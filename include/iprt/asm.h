@@ -3335,6 +3335,42 @@ DECLINLINE(bool) ASMMemIsZeroPage(void const *pvPage)
 }
 
 
+/**
+ * Checks if a memory block is all zeros.
+ *
+ * Unlike ASMMemIsZeroPage() the block can be of any size and alignment. The
+ * bulk of the block is checked 8 words at a time.  RTMemIsZero() does the
+ * same check with SSE2 where available.
+ *
+ * @returns true / false.
+ *
+ * @param   pv      Pointer to the memory block.
+ * @param   cb      Number of bytes in the block.
+ */
+DECLINLINE(bool) ASMMemIsZero(void const *pv, size_t cb)
+{
+    uint8_t const *pb = (uint8_t const *)pv;
+
+    /* Align the pointer for the bulk checks. */
+    for (; cb && ((uintptr_t)pb & (sizeof(uintptr_t) - 1)); cb--, pb++)
+        if (*pb)
+            return false;
+
+    for (; cb >= 8 * sizeof(uintptr_t); cb -= 8 * sizeof(uintptr_t), pb += 8 * sizeof(uintptr_t))
+    {
+        uintptr_t const *puPtr = (uintptr_t const *)pb;
+        if (  puPtr[0] | puPtr[1] | puPtr[2] | puPtr[3]
+            | puPtr[4] | puPtr[5] | puPtr[6] | puPtr[7])
+            return false;
+    }
+
+    for (; cb; cb--, pb++)
+        if (*pb)
+            return false;
+    return true;
+}
+
+
 /**
  * Checks if a memory block is filled with the specified byte.
  *
@@ -1032,6 +1032,10 @@ typedef struct RTFILEAIOLIMITS
     /** The alignment data buffers need to have.
      * 0 means no alignment restrictions. */
     uint32_t cbBufferAlignment;
+    /** Whether requests for files opened without RTFILE_O_NO_CACHE are
+     * processed asynchronously. If false such requests might block the
+     * submitting thread or fail. */
+    bool     fBufferedIo;
 } RTFILEAIOLIMITS;
 /** A pointer to a AIO limits structure. */
 typedef RTFILEAIOLIMITS *PRTFILEAIOLIMITS;
@@ -1205,6 +1209,26 @@ RTDECL(uint32_t) RTFileAioCtxGetMaxReqCount(RTFILEAIOCTX hAioCtx);
  */
 RTDECL(int) RTFileAioCtxAssociateWithFile(RTFILEAIOCTX hAioCtx, RTFILE hFile);
 
+/**
+ * Registers a data buffer with an async I/O context.
+ *
+ * Requests whose data buffer lies completely inside a registered buffer can
+ * skip pinning and unpinning the pages for every transfer on hosts which
+ * support it. The buffer stays registered until the context is destroyed
+ * and must not be freed before that.
+ *
+ * @returns IPRT status code.
+ * @retval  VERR_NOT_SUPPORTED if the host or the selected backend doesn't
+ *          support registered buffers. Requests work as usual in that case.
+ * @retval  VERR_FILE_AIO_BUSY if there are requests active on the context.
+ * @retval  VERR_FILE_AIO_LIMIT_EXCEEDED if no more buffers can be registered.
+ *
+ * @param   hAioCtx         The async I/O context handle.
+ * @param   pvBuf           The start of the buffer.
+ * @param   cbBuf           The size of the buffer.
+ */
+RTDECL(int) RTFileAioCtxRegisterBuffer(RTFILEAIOCTX hAioCtx, void *pvBuf, size_t cbBuf);
+
 /**
  * Submits a set of requests to an async I/O context for processing.
  *
@@ -445,6 +445,7 @@
 # define RTFileAioCtxCreate                             RT_MANGLER(RTFileAioCtxCreate)
 # define RTFileAioCtxDestroy                            RT_MANGLER(RTFileAioCtxDestroy)
 # define RTFileAioCtxGetMaxReqCount                     RT_MANGLER(RTFileAioCtxGetMaxReqCount)
+# define RTFileAioCtxRegisterBuffer                     RT_MANGLER(RTFileAioCtxRegisterBuffer)
 # define RTFileAioCtxSubmit                             RT_MANGLER(RTFileAioCtxSubmit)
 # define RTFileAioCtxWait                               RT_MANGLER(RTFileAioCtxWait)
 # define RTFileAioCtxWakeup                             RT_MANGLER(RTFileAioCtxWakeup)
@@ -766,6 +767,7 @@
 # define RTMemExecFree                                  RT_MANGLER(RTMemExecFree)
 # define RTMemFree                                      RT_MANGLER(RTMemFree)
 # define RTMemFreeEx                                    RT_MANGLER(RTMemFreeEx)     /* r0drv */
+# define RTMemIsZero                                    RT_MANGLER(RTMemIsZero)
 # define RTMemPageAllocTag                              RT_MANGLER(RTMemPageAllocTag)
 # define RTMemPageAllocZTag                             RT_MANGLER(RTMemPageAllocZTag)
 # define RTMemPageFree                                  RT_MANGLER(RTMemPageFree)
@@ -1123,6 +1125,7 @@
 # define RTSgBufCopyFromBuf                             RT_MANGLER(RTSgBufCopyFromBuf)
 # define RTSgBufCopyToBuf                               RT_MANGLER(RTSgBufCopyToBuf)
 # define RTSgBufInit                                    RT_MANGLER(RTSgBufInit)
+# define RTSgBufIsZero                                  RT_MANGLER(RTSgBufIsZero)
 # define RTSgBufReset                                   RT_MANGLER(RTSgBufReset)
 # define RTSgBufSegArrayCreate                          RT_MANGLER(RTSgBufSegArrayCreate)
 # define RTSgBufSet                                     RT_MANGLER(RTSgBufSet)
@@ -1153,6 +1156,7 @@
 # define RTSocketParseInetAddress                       RT_MANGLER(RTSocketParseInetAddress)
 # define RTSocketRead                                   RT_MANGLER(RTSocketRead)
 # define RTSocketReadFrom                               RT_MANGLER(RTSocketReadFrom)
+# define RTSocketReadFromMulti                          RT_MANGLER(RTSocketReadFromMulti)
 # define RTSocketReadNB                                 RT_MANGLER(RTSocketReadNB)
 # define RTSocketRelease                                RT_MANGLER(RTSocketRelease)
 # define RTSocketRetain                                 RT_MANGLER(RTSocketRetain)
@@ -1170,6 +1174,7 @@
 # define RTSocketWrite                                  RT_MANGLER(RTSocketWrite)
 # define RTSocketWriteNB                                RT_MANGLER(RTSocketWriteNB)
 # define RTSocketWriteTo                                RT_MANGLER(RTSocketWriteTo)
+# define RTSocketWriteToMulti                           RT_MANGLER(RTSocketWriteToMulti)
 # define RTSortApvIsSorted                              RT_MANGLER(RTSortApvIsSorted)
 # define RTSortApvShell                                 RT_MANGLER(RTSortApvShell)
 # define RTSortIsSorted                                 RT_MANGLER(RTSortIsSorted)
@@ -1363,6 +1368,7 @@
 # define RTTcpReadNB                                    RT_MANGLER(RTTcpReadNB)
 # define RTTcpSelectOne                                 RT_MANGLER(RTTcpSelectOne)
 # define RTTcpSelectOneEx                               RT_MANGLER(RTTcpSelectOneEx)
+# define RTTcpServerAcceptExtra                         RT_MANGLER(RTTcpServerAcceptExtra)
 # define RTTcpServerCreate                              RT_MANGLER(RTTcpServerCreate)
 # define RTTcpServerCreateEx                            RT_MANGLER(RTTcpServerCreateEx)
 # define RTTcpServerDestroy                             RT_MANGLER(RTTcpServerDestroy)
@@ -1550,12 +1556,14 @@
 # define RTTraceGetDefaultBuf                           RT_MANGLER(RTTraceGetDefaultBuf)
 # define RTTraceSetDefaultBuf                           RT_MANGLER(RTTraceSetDefaultBuf)
 # define RTUdpRead                                      RT_MANGLER(RTUdpRead)
+# define RTUdpReadMulti                                 RT_MANGLER(RTUdpReadMulti)
 # define RTUdpServerCreate                              RT_MANGLER(RTUdpServerCreate)
 # define RTUdpServerCreateEx                            RT_MANGLER(RTUdpServerCreateEx)
 # define RTUdpServerDestroy                             RT_MANGLER(RTUdpServerDestroy)
 # define RTUdpServerListen                              RT_MANGLER(RTUdpServerListen)
 # define RTUdpServerShutdown                            RT_MANGLER(RTUdpServerShutdown)
 # define RTUdpWrite                                     RT_MANGLER(RTUdpWrite)
+# define RTUdpWriteMulti                                RT_MANGLER(RTUdpWriteMulti)
 # define RTUniFree                                      RT_MANGLER(RTUniFree)
 # define RTUtf16CalcLatin1Len                           RT_MANGLER(RTUtf16CalcLatin1Len)
 # define RTUtf16CalcLatin1LenEx                         RT_MANGLER(RTUtf16CalcLatin1LenEx)
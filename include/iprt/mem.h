@@ -502,6 +502,18 @@ RTDECL(int) RTMemProtect(void *pv, size_t cb, unsigned fProtect) RT_NO_THROW;
  */
 RTDECL(void) RTMemWipeThoroughly(void *pv, size_t cb, size_t cMinPasses) RT_NO_THROW;
 
+/**
+ * Checks if a memory block is all zeros.
+ *
+ * This is ASMMemIsZero() using SSE2 where the host has it, for checking large
+ * blocks like disk image data.
+ *
+ * @returns true / false.
+ * @param   pv          The start of the memory block, any alignment.
+ * @param   cb          The size of the memory block.
+ */
+RTDECL(bool) RTMemIsZero(void const *pv, size_t cb) RT_NO_THROW;
+
 #ifdef IN_RING0
 
 /**
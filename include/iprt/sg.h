@@ -155,6 +155,17 @@ RTDECL(int) RTSgBufCmpEx(PRTSGBUF pSgBuf1, PRTSGBUF pSgBuf2, size_t cbCmp,
  */
 RTDECL(size_t) RTSgBufSet(PRTSGBUF pSgBuf, uint8_t ubFill, size_t cbSet);
 
+/**
+ * Checks whether the given number of bytes of an S/G buffer are all zero.
+ *
+ * @returns true if all bytes are zero, false otherwise.
+ * @param   pSgBuf       The S/G buffer.
+ * @param   cbCheck      How many bytes to check.
+ *
+ * @note This operation doesn't change the internal position of the S/G buffer.
+ */
+RTDECL(bool) RTSgBufIsZero(PCRTSGBUF pSgBuf, size_t cbCheck);
+
 /**
  * Copies data from an S/G buffer into a given non scattered buffer.
  *
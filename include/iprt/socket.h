@@ -175,6 +175,40 @@ RTDECL(int) RTSocketWrite(RTSOCKET hSocket, const void *pvBuffer, size_t cbBuffe
  */
 RTDECL(int) RTSocketWriteTo(RTSOCKET hSocket, const void *pvBuffer, size_t cbBuffer, PCRTNETADDR pDstAddr);
 
+/**
+ * Sends a number of datagrams to the same destination, using as few system
+ * calls as the host permits (sendmmsg on Linux).
+ *
+ * @returns IPRT status code.  On failure @a pcSent tells how many of the
+ *          datagrams made it.
+ *
+ * @param   hSocket         The socket handle.
+ * @param   paDatagrams     Array of S/G buffers, one per datagram.  Only the
+ *                          segment arrays are used, not the current position.
+ * @param   cDatagrams      Number of datagrams to send.
+ * @param   pDstAddr        Pointer to destination address. May be NULL.
+ * @param   pcSent          Where to return the number of datagrams sent.
+ *                          Optional.
+ */
+RTDECL(int) RTSocketWriteToMulti(RTSOCKET hSocket, PCRTSGBUF paDatagrams, size_t cDatagrams, PCRTNETADDR pDstAddr,
+                                 size_t *pcSent);
+
+/**
+ * Receives the datagrams queued on a socket, up to @a cBuffers of them,
+ * without blocking (recvmmsg on Linux).
+ *
+ * @returns IPRT status code.
+ * @retval  VERR_TRY_AGAIN if there was nothing to receive.
+ *
+ * @param   hSocket         The socket handle.
+ * @param   paBuffers       Array of receive buffers, one per datagram.
+ * @param   cBuffers        Number of receive buffers.
+ * @param   pacbRead        Where to return the size of each datagram received.
+ *                          Must have room for @a cBuffers entries.
+ * @param   pcRead          Where to return the number of datagrams received.
+ */
+RTDECL(int) RTSocketReadFromMulti(RTSOCKET hSocket, PCRTSGSEG paBuffers, size_t cBuffers, size_t *pacbRead, size_t *pcRead);
+
 /**
  * Checks if the socket is ready for reading (for I/O multiplexing).
  *
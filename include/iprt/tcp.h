@@ -134,6 +134,26 @@ RTR3DECL(int) RTTcpServerListen(PRTTCPSERVER pServer, PFNRTTCPSERVE pfnServe, vo
  */
 RTR3DECL(int) RTTcpServerListen2(PRTTCPSERVER pServer, PRTSOCKET phClientSocket);
 
+/**
+ * Accepts an additional incoming connection while serving a client.
+ *
+ * This is for protocols using more than one connection per session.  It can
+ * only be called while a client is being served, i.e. from the pfnServe
+ * callback or after RTTcpServerListen2 returned, and before the server is
+ * shut down.
+ *
+ * @returns IPRT status code.
+ * @retval  VERR_TIMEOUT if no connection came in within @a cMillies.
+ * @retval  VERR_INVALID_STATE if not serving or the server was shut down.
+ *
+ * @param   pServer         The server handle as returned from RTTcpServerCreateEx().
+ * @param   cMillies        How long to wait for the connection.
+ * @param   phClientSocket  Where to return the socket handle to the client
+ *                          connection (on success only).  This must be closed
+ *                          by calling RTTcpServerDisconnectClient2().
+ */
+RTR3DECL(int) RTTcpServerAcceptExtra(PRTTCPSERVER pServer, RTMSINTERVAL cMillies, PRTSOCKET phClientSocket);
+
 /**
  * Terminate the open connection to the server.
  *
@@ -2225,6 +2225,22 @@ typedef RTRECTSIZE *PRTRECTSIZE;
 typedef const RTRECTSIZE *PCRTRECTSIZE;
 
 
+/**
+ * A range, e.g. of bytes in a file or on a disk.
+ */
+typedef struct RTRANGE
+{
+    /** Start offset. */
+    uint64_t    offStart;
+    /** Size of the range. */
+    size_t      cbRange;
+} RTRANGE;
+/** Pointer to a range. */
+typedef RTRANGE *PRTRANGE;
+/** Pointer to a const range. */
+typedef const RTRANGE *PCRTRANGE;
+
+
 /**
  * Ethernet MAC address.
  *
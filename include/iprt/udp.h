@@ -148,6 +148,38 @@ RTR3DECL(int)  RTUdpRead(RTSOCKET Sock, void *pvBuffer, size_t cbBuffer, size_t
 RTR3DECL(int)  RTUdpWrite(PRTUDPSERVER pServer, const void *pvBuffer,
                           size_t cbBuffer, PCRTNETADDR pDstAddr);
 
+/**
+ * Receive the queued datagrams from a socket without blocking.
+ *
+ * @returns iprt status code.
+ * @retval  VERR_TRY_AGAIN if there was nothing to receive.
+ *
+ * @param   Sock        Socket descriptor.
+ * @param   paBuffers   Array of receive buffers, one per datagram.
+ * @param   cBuffers    Number of receive buffers.
+ * @param   pacbRead    Where to return the size of each datagram received.
+ * @param   pcRead      Where to return the number of datagrams received.
+ *
+ * @sa      RTSocketReadFromMulti
+ */
+RTR3DECL(int)  RTUdpReadMulti(RTSOCKET Sock, PCRTSGSEG paBuffers, size_t cBuffers, size_t *pacbRead, size_t *pcRead);
+
+/**
+ * Send a number of datagrams to the same destination.
+ *
+ * @returns iprt status code.
+ *
+ * @param   pServer     Handle to the server.
+ * @param   paDatagrams Array of S/G buffers, one per datagram.
+ * @param   cDatagrams  Number of datagrams.
+ * @param   pDstAddr    Destination address.
+ * @param   pcSent      Where to return the number of datagrams sent. Optional.
+ *
+ * @sa      RTSocketWriteToMulti
+ */
+RTR3DECL(int)  RTUdpWriteMulti(PRTUDPSERVER pServer, PCRTSGBUF paDatagrams, size_t cDatagrams,
+                               PCRTNETADDR pDstAddr, size_t *pcSent);
+
 /** @} */
 RT_C_DECLS_END
 
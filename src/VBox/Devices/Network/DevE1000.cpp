@@ -1557,6 +1557,11 @@ static void e1kHardReset(E1KSTATE *pState)
  */
 static uint16_t e1kCSum16(const void *pvBuf, size_t cb)
 {
+#ifdef IN_RING3
+    /* IPRT sums up several words at a time, this matters for TSE frames. */
+    bool fOdd = false;
+    return RTNetIPv4FinalizeChecksum(RTNetIPv4AddDataChecksum(pvBuf, cb, 0, &fOdd));
+#else
     uint32_t  csum = 0;
     uint16_t *pu16 = (uint16_t *)pvBuf;
 
@@ -1570,6 +1575,7 @@ static uint16_t e1kCSum16(const void *pvBuf, size_t cb)
     while (csum >> 16)
         csum = (csum >> 16) + (csum & 0xFFFF);
     return ~csum;
+#endif
 }
 
 /**
@@ -28,6 +28,8 @@
 #include <iprt/semaphore.h>
 #ifdef IN_RING3
 # include <iprt/mem.h>
+# include <iprt/string.h>
+# include <iprt/thread.h>
 # include <iprt/uuid.h>
 #endif /* IN_RING3 */
 #include "VBoxDD.h"
@@ -43,7 +45,7 @@
 
 #define VNET_PCI_SUBSYSTEM_ID        1 + VIRTIO_NET_ID
 #define VNET_PCI_CLASS               0x0200
-#define VNET_N_QUEUES                3
+#define VNET_N_QUEUES(cPairs)        (2 * (cPairs) + 1) /* RX+TX per pair, CTL */
 #define VNET_NAME_FMT                "VNet%d"
 
 #if 0
@@ -69,6 +71,8 @@ RT_C_DECLS_END
 #define VNET_MAX_FRAME_SIZE     65536  // TODO: Is it the right limit?
 #define VNET_MAC_FILTER_LEN     32
 #define VNET_MAX_VID            (1 << 12)
+#define VNET_MAX_QUEUE_PAIRS    8
+#define VNET_FLOW_TABLE_SIZE    256
 
 /* Virtio net features */
 #define VNET_F_CSUM       0x00000001  /* Host handles pkts w/ partial csum */
@@ -88,6 +92,7 @@ RT_C_DECLS_END
 #define VNET_F_CTRL_VQ    0x00020000  /* Control channel available */
 #define VNET_F_CTRL_RX    0x00040000  /* Control channel RX mode support */
 #define VNET_F_CTRL_VLAN  0x00080000  /* Control channel VLAN filtering */
+#define VNET_F_MQ         0x00400000  /* Multiple queue pairs with automatic RX steering */
 
 #define VNET_S_LINK_UP    1
 
@@ -100,8 +105,45 @@ struct __attribute__ ((__packed__)) VNetPCIConfig
 {
     RTMAC    mac;
     uint16_t uStatus;
+    uint16_t uMaxVirtqueuePairs;
 };
 AssertCompileMemberOffset(struct VNetPCIConfig, uStatus, 6);
+AssertCompileMemberOffset(struct VNetPCIConfig, uMaxVirtqueuePairs, 8);
+
+/**
+ * A receive/transmit queue pair.
+ *
+ * The guest uses one pair per vCPU when VNET_F_MQ has been negotiated, each
+ * transmit queue gets drained by its own worker thread then.
+ */
+struct VNetQueuePair
+{
+    R3PTRTYPE(PVQUEUE)      pRxQueue;
+    R3PTRTYPE(PVQUEUE)      pTxQueue;
+    /** The transmit worker, NULL if transmission happens on EMT. */
+    R3PTRTYPE(PPDMTHREAD)   pTxThread;
+    /** Transmit worker: Gets signalled when the guest kicks the TX queue. */
+    RTSEMEVENT              hEventTxKick;
+    /** Transmit worker: Held while the worker walks the TX vring. Resets and
+     *  queue (re-)initialisation take it so the ring can't change underneath. */
+    PDMCRITSECT             CritSectTx;
+    /** Indicates transmission in progress -- only one thread is allowed. */
+    uint32_t volatile       uIsTransmitting;
+    /** Transmit worker: Set while waiting for another pair to release the
+     *  driver, the pair releasing it kicks us. */
+    bool volatile           fTxWaitForDrv;
+    /** The index of this pair. */
+    uint32_t                iPair;
+    /** Queue names, vpciAddQueue() keeps the pointers. */
+    char                    szRxName[8];
+    char                    szTxName[8];
+
+    STAMCOUNTER             StatReceivePackets;
+    STAMCOUNTER             StatTransmitPackets;
+    STAMCOUNTER             StatTxKicks;
+};
+typedef struct VNetQueuePair VNETQUEUEPAIR;
+typedef VNETQUEUEPAIR *PVNETQUEUEPAIR;
 
 /**
  * Device state structure. Holds the current state of device.
@@ -151,8 +193,10 @@ struct VNetState_st
     uint64_t                u64NanoTS;
 #endif /* VNET_TX_DELAY */
 
-    /** Indicates transmission in progress -- only one thread is allowed. */
-    uint32_t                uIsTransmitting;
+    /** Number of configured queue pairs (max_virtqueue_pairs). */
+    uint16_t                cQueuePairs;
+    /** Number of queue pairs enabled by the guest (VNET_CTRL_CMD_MQ_VQ_PAIRS_SET). */
+    uint16_t                cQueuePairsActive;
 
     /** PCI config area holding MAC address as well as TBD. */
     struct VNetPCIConfig    config;
@@ -178,14 +222,21 @@ struct VNetState_st
     /** Bit array of VLAN filter, one bit per VLAN ID. */
     uint8_t                 aVlanFilter[VNET_MAX_VID / sizeof(uint8_t)];
 
-    R3PTRTYPE(PVQUEUE)      pRxQueue;
-    R3PTRTYPE(PVQUEUE)      pTxQueue;
+    /** The control queue when VNET_F_MQ is negotiated (see vnetGetCtlQueue). */
     R3PTRTYPE(PVQUEUE)      pCtlQueue;
     /* Receive-blocking-related fields ***************************************/
 
     /** EMT: Gets signalled when more RX descriptors become available. */
     RTSEMEVENT              hEventMoreRxDescAvail;
 
+    /* Multiqueue fields *****************************************************/
+
+    /** The queue pairs, cQueuePairs are used. */
+    VNETQUEUEPAIR           aQueuePairs[VNET_MAX_QUEUE_PAIRS];
+    /** Flow steering table, indexed by flow hash. Holds the number of the pair
+     * the flow was last transmitted on, plus one (zero means unknown). */
+    uint8_t volatile        au8FlowTable[VNET_FLOW_TABLE_SIZE];
+
     /* Statistic fields ******************************************************/
 
     STAMCOUNTER             StatReceiveBytes;
@@ -240,6 +291,7 @@ typedef VNETHDRMRX *PVNETHDRMRX;
 AssertCompileSize(VNETHDRMRX, 12);
 
 AssertCompileMemberOffset(VNETSTATE, VPCI, 0);
+AssertCompile(2 * VNET_MAX_QUEUE_PAIRS + 1 <= VIRTIO_MAX_NQUEUES);
 
 #define VNET_OK                    0
 #define VNET_ERROR                 1
@@ -256,6 +308,9 @@ typedef uint8_t VNETCTLACK;
 #define VNET_CTRL_CMD_VLAN_ADD         0
 #define VNET_CTRL_CMD_VLAN_DEL         1
 
+#define VNET_CTRL_CLS_MQ               4
+#define VNET_CTRL_CMD_MQ_VQ_PAIRS_SET  0
+
 
 struct VNetCtlHdr
 {
@@ -296,6 +351,30 @@ DECLINLINE(void) vnetCsRxLeave(PVNETSTATE pState)
     // PDMCritSectLeave(&pState->csRx);
 }
 
+#ifdef IN_RING3
+/**
+ * Keeps the transmit workers away from the vrings.
+ *
+ * The workers drop their lock before going to sleep, so this waits for the
+ * current transmit run at most.
+ *
+ * @param   pState      The device state structure.
+ */
+static void vnetCsTxWorkersEnter(PVNETSTATE pState)
+{
+    for (unsigned i = 0; i < pState->cQueuePairs; i++)
+        if (PDMCritSectIsInitialized(&pState->aQueuePairs[i].CritSectTx))
+            PDMCritSectEnter(&pState->aQueuePairs[i].CritSectTx, VERR_IGNORED);
+}
+
+static void vnetCsTxWorkersLeave(PVNETSTATE pState)
+{
+    for (unsigned i = pState->cQueuePairs; i-- > 0; )
+        if (PDMCritSectIsInitialized(&pState->aQueuePairs[i].CritSectTx))
+            PDMCritSectLeave(&pState->aQueuePairs[i].CritSectTx);
+}
+#endif /* IN_RING3 */
+
 /**
  * Dump a packet to debug log.
  *
@@ -317,6 +396,7 @@ DECLINLINE(void) vnetPacketDump(PVNETSTATE pState, const uint8_t *cpPacket, size
 
 PDMBOTHCBDECL(uint32_t) vnetGetHostFeatures(void *pvState)
 {
+    VNETSTATE *pState = (VNETSTATE *)pvState;
     /* We support:
      * - Host-provided MAC address
      * - Link status reporting in config space
@@ -324,8 +404,9 @@ PDMBOTHCBDECL(uint32_t) vnetGetHostFeatures(void *pvState)
      * - RX mode setting
      * - MAC filter table
      * - VLAN filter
+     * - Multiple queue pairs (if configured)
      */
-    return VNET_F_MAC
+    uint32_t uFeatures = VNET_F_MAC
         | VNET_F_STATUS
         | VNET_F_CTRL_VQ
         | VNET_F_CTRL_RX
@@ -340,6 +421,9 @@ PDMBOTHCBDECL(uint32_t) vnetGetHostFeatures(void *pvState)
         | VNET_F_MRG_RXBUF
 #endif
         ;
+    if (pState->cQueuePairs > 1)
+        uFeatures |= VNET_F_MQ;
+    return uFeatures;
 }
 
 PDMBOTHCBDECL(uint32_t) vnetGetHostMinimalFeatures(void *pvState)
@@ -415,10 +499,14 @@ PDMBOTHCBDECL(int) vnetReset(void *pvState)
     pState->nMacFilterEntries = 0;
     memset(pState->aMacFilter,  0, VNET_MAC_FILTER_LEN * sizeof(RTMAC));
     memset(pState->aVlanFilter, 0, sizeof(pState->aVlanFilter));
-    pState->uIsTransmitting   = 0;
+    /* Only the first pair is used until the guest enables more. */
+    pState->cQueuePairsActive = 1;
 #ifndef IN_RING3
     return VINF_IOM_HC_IOPORT_WRITE;
 #else
+    for (unsigned i = 0; i < pState->cQueuePairs; i++)
+        ASMAtomicWriteU32(&pState->aQueuePairs[i].uIsTransmitting, 0);
+    memset((void *)pState->au8FlowTable, 0, sizeof(pState->au8FlowTable));
     if (pState->pDrv)
         pState->pDrv->pfnSetPromiscuousMode(pState->pDrv, true);
     return VINF_SUCCESS;
@@ -531,13 +619,39 @@ PDMBOTHCBDECL(int) vnetIOPortIn(PPDMDEVINS pDevIns, void *pvUser,
 PDMBOTHCBDECL(int) vnetIOPortOut(PPDMDEVINS pDevIns, void *pvUser,
                                  RTIOPORT port, uint32_t u32, unsigned cb)
 {
-    return vpciIOPortOut(pDevIns, pvUser, port, u32, cb,
-                         vnetGetHostMinimalFeatures,
-                         vnetGetHostFeatures,
-                         vnetSetHostFeatures,
-                         vnetReset,
-                         vnetReady,
-                         vnetSetConfig);
+    VNETSTATE *pState  = PDMINS_2_DATA(pDevIns, VNETSTATE *);
+    RTIOPORT   offPort = port - pState->VPCI.addrIOPort;
+    int        rc;
+
+    /*
+     * Status writes (reset, DRV_OK) and queue (re-)initialisation change the
+     * vrings under the transmit workers. Do them in ring-3 with the workers
+     * locked out.
+     */
+    bool fTxWorkers =    pState->cQueuePairs > 1
+                      && (offPort == VPCI_STATUS || offPort == VPCI_QUEUE_PFN);
+    if (fTxWorkers)
+    {
+#ifndef IN_RING3
+        return VINF_IOM_HC_IOPORT_WRITE;
+#else
+        vnetCsTxWorkersEnter(pState);
+#endif
+    }
+
+    rc = vpciIOPortOut(pDevIns, pvUser, port, u32, cb,
+                       vnetGetHostMinimalFeatures,
+                       vnetGetHostFeatures,
+                       vnetSetHostFeatures,
+                       vnetReset,
+                       vnetReady,
+                       vnetSetConfig);
+
+#ifdef IN_RING3
+    if (fTxWorkers)
+        vnetCsTxWorkersLeave(pState);
+#endif
+    return rc;
 }
 
 
@@ -561,19 +675,26 @@ static int vnetCanReceive(VNETSTATE *pState)
     AssertRCReturn(rc, rc);
 
     LogFlow(("%s vnetCanReceive\n", INSTANCE(pState)));
-    if (!(pState->VPCI.uStatus & VPCI_STATUS_DRV_OK))
-        rc = VERR_NET_NO_BUFFER_SPACE;
-    else if (!vqueueIsReady(&pState->VPCI, pState->pRxQueue))
-        rc = VERR_NET_NO_BUFFER_SPACE;
-    else if (vqueueIsEmpty(&pState->VPCI, pState->pRxQueue))
+    rc = VERR_NET_NO_BUFFER_SPACE;
+    if (pState->VPCI.uStatus & VPCI_STATUS_DRV_OK)
     {
-        vringSetNotification(&pState->VPCI, &pState->pRxQueue->VRing, true);
-        rc = VERR_NET_NO_BUFFER_SPACE;
-    }
-    else
-    {
-        vringSetNotification(&pState->VPCI, &pState->pRxQueue->VRing, false);
-        rc = VINF_SUCCESS;
+        /*
+         * Any active receive queue with buffers will do, vnetSelectRxPair()
+         * falls back to it if the queue a frame is steered to is empty.
+         */
+        for (unsigned i = 0; i < pState->cQueuePairsActive; i++)
+        {
+            PVQUEUE pRxQueue = pState->aQueuePairs[i].pRxQueue;
+            if (!vqueueIsReady(&pState->VPCI, pRxQueue))
+                continue;
+            if (vqueueIsEmpty(&pState->VPCI, pRxQueue))
+                vringSetNotification(&pState->VPCI, &pRxQueue->VRing, true);
+            else
+            {
+                vringSetNotification(&pState->VPCI, &pRxQueue->VRing, false);
+                rc = VINF_SUCCESS;
+            }
+        }
     }
 
     LogFlow(("%s vnetCanReceive -> %Rrc\n", INSTANCE(pState), rc));
@@ -702,6 +823,140 @@ static bool vnetAddressFilter(PVNETSTATE pState, const void *pvBuf, size_t cb)
     return false;
 }
 
+/**
+ * Calculates the flow hash of a frame.
+ *
+ * The hash covers IP addresses, protocol and TCP/UDP ports and is symmetric,
+ * i.e. both directions of a connection produce the same value. This is what
+ * lets the receive side find the pair a flow was last transmitted on.
+ *
+ * @returns The hash, 0 if the frame does not carry IP.
+ * @param   pbFrame         The ethernet frame.
+ * @param   cb              The size of the frame.
+ */
+static uint32_t vnetFlowHash(const uint8_t *pbFrame, size_t cb)
+{
+    size_t off = sizeof(RTNETETHERHDR);
+    if (cb < off)
+        return 0;
+    uint16_t uEtherType = RT_BE2H_U16(((PCRTNETETHERHDR)pbFrame)->EtherType);
+    if (uEtherType == RTNET_ETHERTYPE_VLAN)
+    {
+        if (cb < off + 4)
+            return 0;
+        uEtherType = RT_MAKE_U16(pbFrame[off + 3], pbFrame[off + 2]);
+        off += 4;
+    }
+
+    uint32_t uHash;
+    uint8_t  bProto;
+    if (uEtherType == RTNET_ETHERTYPE_IPV4)
+    {
+        if (cb < off + RTNETIPV4_MIN_LEN)
+            return 0;
+        PCRTNETIPV4 pIpHdr = (PCRTNETIPV4)(pbFrame + off);
+        uHash  = pIpHdr->ip_src.u ^ pIpHdr->ip_dst.u;
+        bProto = pIpHdr->ip_p;
+        off   += pIpHdr->ip_hl * 4;
+        /* Only the first fragment has the ports (MF flag and offset). */
+        if (RT_BE2H_U16(pIpHdr->ip_off) & 0x3fff)
+            off = cb;
+    }
+    else if (uEtherType == RTNET_ETHERTYPE_IPV6)
+    {
+        if (cb < off + RTNETIPV6_MIN_LEN)
+            return 0;
+        PCRTNETIPV6 pIpHdr = (PCRTNETIPV6)(pbFrame + off);
+        uHash = 0;
+        for (unsigned i = 0; i < RT_ELEMENTS(pIpHdr->ip6_src.au32); i++)
+            uHash ^= pIpHdr->ip6_src.au32[i] ^ pIpHdr->ip6_dst.au32[i];
+        bProto = pIpHdr->ip6_nxt;
+        off   += RTNETIPV6_MIN_LEN;
+    }
+    else
+        return 0;
+
+    if (   (bProto == RTNETIPV4_PROT_TCP || bProto == RTNETIPV4_PROT_UDP)
+        && cb >= off + 2 * sizeof(uint16_t))
+    {
+        const uint16_t *pu16Ports = (const uint16_t *)(pbFrame + off);
+        uHash ^= (uint32_t)(pu16Ports[0] ^ pu16Ports[1]) << 8;
+    }
+    uHash ^= bProto;
+
+    /* Mix the bits so that the low ones can be used for indexing. */
+    uHash ^= uHash >> 16;
+    uHash *= UINT32_C(0x85ebca6b);
+    uHash ^= uHash >> 13;
+    uHash *= UINT32_C(0xc2b2ae35);
+    uHash ^= uHash >> 16;
+    return uHash ? uHash : 1;
+}
+
+/**
+ * Remembers the pair a flow is being transmitted on.
+ *
+ * @param   pState          The device state structure.
+ * @param   pPair           The transmitting queue pair.
+ * @param   pbFrame         The outgoing ethernet frame.
+ * @param   cb              The size of the frame.
+ * @thread  TX
+ */
+DECLINLINE(void) vnetFlowRecordTx(PVNETSTATE pState, PVNETQUEUEPAIR pPair, const uint8_t *pbFrame, size_t cb)
+{
+    uint32_t uHash = vnetFlowHash(pbFrame, cb);
+    if (uHash)
+        ASMAtomicUoWriteU8(&pState->au8FlowTable[uHash % VNET_FLOW_TABLE_SIZE], (uint8_t)(pPair->iPair + 1));
+}
+
+/**
+ * Picks the queue pair to deliver a received frame to.
+ *
+ * Frames of a flow go to the pair the flow was last transmitted on, unknown
+ * flows are spread over the active pairs by hash. If the chosen receive queue
+ * has no buffers we fall back to the first one that has.
+ *
+ * @returns The queue pair.
+ * @param   pState          The device state structure.
+ * @param   pvBuf           The ethernet frame.
+ * @param   cb              The size of the frame.
+ * @thread  RX
+ */
+static PVNETQUEUEPAIR vnetSelectRxPair(PVNETSTATE pState, const void *pvBuf, size_t cb)
+{
+    unsigned cPairs = pState->cQueuePairsActive;
+    if (cPairs <= 1)
+        return &pState->aQueuePairs[0];
+
+    unsigned iPair = 0;
+    uint32_t uHash = vnetFlowHash((const uint8_t *)pvBuf, cb);
+    if (uHash)
+    {
+        uint8_t u8Entry = ASMAtomicUoReadU8(&pState->au8FlowTable[uHash % VNET_FLOW_TABLE_SIZE]);
+        if (u8Entry && u8Entry <= cPairs)
+            iPair = u8Entry - 1;
+        else
+            iPair = uHash % cPairs;
+    }
+
+    PVQUEUE pRxQueue = pState->aQueuePairs[iPair].pRxQueue;
+    if (   !vqueueIsReady(&pState->VPCI, pRxQueue)
+        || vqueueIsEmpty(&pState->VPCI, pRxQueue))
+    {
+        for (unsigned i = 0; i < cPairs; i++)
+        {
+            pRxQueue = pState->aQueuePairs[i].pRxQueue;
+            if (   vqueueIsReady(&pState->VPCI, pRxQueue)
+                && !vqueueIsEmpty(&pState->VPCI, pRxQueue))
+            {
+                iPair = i;
+                break;
+            }
+        }
+    }
+    return &pState->aQueuePairs[iPair];
+}
+
 /**
  * Pad and store received packet.
  *
@@ -710,11 +965,12 @@ static bool vnetAddressFilter(PVNETSTATE pState, const void *pvBuf, size_t cb)
  *
  * @returns VBox status code.
  * @param   pState          The device state structure.
+ * @param   pRxQueue        The receive queue to store the packet in.
  * @param   pvBuf           The available data.
  * @param   cb              Number of bytes available in the buffer.
  * @thread  RX
  */
-static int vnetHandleRxPacket(PVNETSTATE pState, const void *pvBuf, size_t cb,
+static int vnetHandleRxPacket(PVNETSTATE pState, PVQUEUE pRxQueue, const void *pvBuf, size_t cb,
                               PCPDMNETWORKGSO pGso)
 {
     VNETHDRMRX   Hdr;
@@ -770,7 +1026,7 @@ static int vnetHandleRxPacket(PVNETSTATE pState, const void *pvBuf, size_t cb,
         VQUEUEELEM elem;
         unsigned int nSeg = 0, uElemSize = 0, cbReserved = 0;
 
-        if (!vqueueGet(&pState->VPCI, pState->pRxQueue, &elem))
+        if (!vqueueGet(&pState->VPCI, pRxQueue, &elem))
         {
             /*
              * @todo: It is possible to run out of RX buffers if only a few
@@ -814,7 +1070,7 @@ static int vnetHandleRxPacket(PVNETSTATE pState, const void *pvBuf, size_t cb,
             uElemSize += uSize;
         }
         STAM_PROFILE_START(&pState->StatReceiveStore, a);
-        vqueuePut(&pState->VPCI, pState->pRxQueue, &elem, uElemSize, cbReserved);
+        vqueuePut(&pState->VPCI, pRxQueue, &elem, uElemSize, cbReserved);
         STAM_PROFILE_STOP(&pState->StatReceiveStore, a);
         if (!vnetMergeableRxBuffers(pState))
             break;
@@ -832,7 +1088,7 @@ static int vnetHandleRxPacket(PVNETSTATE pState, const void *pvBuf, size_t cb,
             return rc;
         }
     }
-    vqueueSync(&pState->VPCI, pState->pRxQueue);
+    vqueueSync(&pState->VPCI, pRxQueue);
     if (uOffset < cb)
     {
         Log(("%s vnetHandleRxPacket: Packet did not fit into RX queue (packet size=%u)!\n",
@@ -872,8 +1128,10 @@ static DECLCALLBACK(int) vnetNetworkDown_ReceiveGso(PPDMINETWORKDOWN pInterface,
         rc = vnetCsRxEnter(pState, VERR_SEM_BUSY);
         if (RT_SUCCESS(rc))
         {
-            rc = vnetHandleRxPacket(pState, pvBuf, cb, pGso);
+            PVNETQUEUEPAIR pPair = vnetSelectRxPair(pState, pvBuf, cb);
+            rc = vnetHandleRxPacket(pState, pPair->pRxQueue, pvBuf, cb, pGso);
             STAM_REL_COUNTER_ADD(&pState->StatReceiveBytes, cb);
+            STAM_REL_COUNTER_INC(&pPair->StatReceivePackets);
             vnetCsRxLeave(pState);
         }
     }
@@ -954,9 +1212,46 @@ static DECLCALLBACK(int) vnetSetLinkState(PPDMINETWORKCONFIG pInterface, PDMNETW
     return VINF_SUCCESS;
 }
 
+/**
+ * Returns the control queue.
+ *
+ * The control queue follows the last queue pair if VNET_F_MQ has been
+ * negotiated, otherwise it follows the first pair (i.e. it takes the slot of
+ * the second receive queue).
+ *
+ * @param   pState      The device state structure.
+ */
+DECLINLINE(PVQUEUE) vnetGetCtlQueue(PVNETSTATE pState)
+{
+    if (pState->VPCI.uGuestFeatures & VNET_F_MQ)
+        return pState->pCtlQueue;
+    return &pState->VPCI.Queues[2];
+}
+
+/**
+ * Returns the queue pair a receive or transmit queue belongs to.
+ *
+ * @param   pState      The device state structure.
+ * @param   pQueue      The receive or transmit queue.
+ */
+DECLINLINE(PVNETQUEUEPAIR) vnetGetQueuePair(PVNETSTATE pState, PVQUEUE pQueue)
+{
+    unsigned iPair = (unsigned)(pQueue - &pState->VPCI.Queues[0]) / 2;
+    Assert(iPair < pState->cQueuePairs);
+    return &pState->aQueuePairs[iPair];
+}
+
+static DECLCALLBACK(void) vnetQueueControl(void *pvState, PVQUEUE pQueue);
+
 static DECLCALLBACK(void) vnetQueueReceive(void *pvState, PVQUEUE pQueue)
 {
     VNETSTATE *pState = (VNETSTATE*)pvState;
+    if (RT_UNLIKELY(pQueue == vnetGetCtlQueue(pState)))
+    {
+        /* The guest did not negotiate VNET_F_MQ, the second RX slot holds the control queue. */
+        vnetQueueControl(pvState, pQueue);
+        return;
+    }
     Log(("%s Receive buffers has been added, waking up receive thread.\n", INSTANCE(pState)));
     vnetWakeupReceive(pState->VPCI.CTX_SUFF(pDevIns));
 }
@@ -1025,21 +1320,35 @@ DECLINLINE(void) vnetCompleteChecksum(uint8_t *pBuf, unsigned cbSize, uint16_t u
     *(uint16_t*)(pBuf + uStart + uOffset) = vnetCSum16(pBuf + uStart, cbSize - uStart);
 }
 
-static void vnetTransmitPendingPackets(PVNETSTATE pState, PVQUEUE pQueue, bool fOnWorkerThread)
+/**
+ * Transmits the frames pending in the transmit queue of a pair.
+ *
+ * Pairs transmit independently of each other, the only thing they share is
+ * the transmit lock of the attached driver taken by pfnBeginXmit.
+ *
+ * @returns VINF_SUCCESS, or VERR_TRY_AGAIN if the driver is busy.
+ * @param   pState          The device state structure.
+ * @param   pPair           The queue pair to transmit from.
+ * @param   fOnWorkerThread Whether we're on a worker thread or an EMT.
+ */
+static int vnetTransmitPendingPackets(PVNETSTATE pState, PVNETQUEUEPAIR pPair, bool fOnWorkerThread)
 {
+    PVQUEUE pQueue = pPair->pTxQueue;
+
     /*
      * Only one thread is allowed to transmit at a time, others should skip
      * transmission as the packets will be picked up by the transmitting
      * thread.
      */
-    if (!ASMAtomicCmpXchgU32(&pState->uIsTransmitting, 1, 0))
-        return;
+    if (!ASMAtomicCmpXchgU32(&pPair->uIsTransmitting, 1, 0))
+        return VINF_SUCCESS;
 
     if ((pState->VPCI.uStatus & VPCI_STATUS_DRV_OK) == 0)
     {
         Log(("%s Ignoring transmit requests from non-existent driver (status=0x%x).\n",
              INSTANCE(pState), pState->VPCI.uStatus));
-        return;
+        ASMAtomicWriteU32(&pPair->uIsTransmitting, 0);
+        return VINF_SUCCESS;
     }
 
     PPDMINETWORKUP pDrv = pState->pDrv;
@@ -1049,8 +1358,8 @@ static void vnetTransmitPendingPackets(PVNETSTATE pState, PVQUEUE pQueue, bool f
         Assert(rc == VINF_SUCCESS || rc == VERR_TRY_AGAIN);
         if (rc == VERR_TRY_AGAIN)
         {
-            ASMAtomicWriteU32(&pState->uIsTransmitting, 0);
-            return;
+            ASMAtomicWriteU32(&pPair->uIsTransmitting, 0);
+            return rc;
         }
     }
 
@@ -1060,8 +1369,8 @@ static void vnetTransmitPendingPackets(PVNETSTATE pState, PVQUEUE pQueue, bool f
     else
         uHdrLen = sizeof(VNETHDR);
 
-    Log3(("%s vnetTransmitPendingPackets: About to transmit %d pending packets\n", INSTANCE(pState),
-          vringReadAvailIndex(&pState->VPCI, &pState->pTxQueue->VRing) - pState->pTxQueue->uNextAvailIndex));
+    Log3(("%s vnetTransmitPendingPackets: About to transmit %d pending packets on %s\n", INSTANCE(pState),
+          vringReadAvailIndex(&pState->VPCI, &pQueue->VRing) - pQueue->uNextAvailIndex, pQueue->pcszName));
 
     vpciSetWriteLed(&pState->VPCI, true);
 
@@ -1092,6 +1401,7 @@ static void vnetTransmitPendingPackets(PVNETSTATE pState, PVQUEUE pQueue, bool f
                                   &Hdr, sizeof(Hdr));
 
                 STAM_REL_COUNTER_INC(&pState->StatTransmitPackets);
+                STAM_REL_COUNTER_INC(&pPair->StatTransmitPackets);
 
                 STAM_PROFILE_START(&pState->StatTransmitSend, a);
 
@@ -1112,6 +1422,8 @@ static void vnetTransmitPendingPackets(PVNETSTATE pState, PVQUEUE pQueue, bool f
                     }
                     pSgBuf->cbUsed = uSize;
                     vnetPacketDump(pState, (uint8_t*)pSgBuf->aSegs[0].pvSeg, uSize, "--> Outgoing");
+                    if (pState->cQueuePairsActive > 1)
+                        vnetFlowRecordTx(pState, pPair, (uint8_t*)pSgBuf->aSegs[0].pvSeg, uSize);
                     if (pGso)
                     {
                         /* Some guests (RHEL) may report HdrLen excluding transport layer header! */
@@ -1154,7 +1466,7 @@ static void vnetTransmitPendingPackets(PVNETSTATE pState, PVQUEUE pQueue, bool f
                                              Hdr.u16CSumStart, Hdr.u16CSumOffset);
                     }
 
-                    rc = pState->pDrv->pfnSendBuf(pState->pDrv, pSgBuf, false);
+                    rc = pState->pDrv->pfnSendBuf(pState->pDrv, pSgBuf, fOnWorkerThread);
                 }
                 else
                     LogRel(("virtio-net: failed to allocate SG buffer: size=%u rc=%Rrc\n", uSize, rc));
@@ -1170,8 +1482,20 @@ static void vnetTransmitPendingPackets(PVNETSTATE pState, PVQUEUE pQueue, bool f
     vpciSetWriteLed(&pState->VPCI, false);
 
     if (pDrv)
+    {
         pDrv->pfnEndXmit(pDrv);
-    ASMAtomicWriteU32(&pState->uIsTransmitting, 0);
+
+        /* Wake up the workers which found the driver busy. */
+        for (unsigned i = 0; i < pState->cQueuePairs; i++)
+        {
+            PVNETQUEUEPAIR pOther = &pState->aQueuePairs[i];
+            if (   pOther != pPair
+                && ASMAtomicXchgBool(&pOther->fTxWaitForDrv, false))
+                RTSemEventSignal(pOther->hEventTxKick);
+        }
+    }
+    ASMAtomicWriteU32(&pPair->uIsTransmitting, 0);
+    return VINF_SUCCESS;
 }
 
 /**
@@ -1180,7 +1504,109 @@ static void vnetTransmitPendingPackets(PVNETSTATE pState, PVQUEUE pQueue, bool f
 static DECLCALLBACK(void) vnetNetworkDown_XmitPending(PPDMINETWORKDOWN pInterface)
 {
     VNETSTATE *pThis = RT_FROM_MEMBER(pInterface, VNETSTATE, INetworkDown);
-    vnetTransmitPendingPackets(pThis, pThis->pTxQueue, false /*fOnWorkerThread*/);
+    for (unsigned i = 0; i < pThis->cQueuePairs; i++)
+    {
+        PVNETQUEUEPAIR pPair = &pThis->aQueuePairs[i];
+        if (pPair->pTxThread)
+            RTSemEventSignal(pPair->hEventTxKick);
+        else
+            vnetTransmitPendingPackets(pThis, pPair, false /*fOnWorkerThread*/);
+    }
+}
+
+/**
+ * The transmit worker of a queue pair.
+ *
+ * Drains the transmit queue with guest notifications disabled and goes to
+ * sleep once it is empty, so a busy guest does not exit on every frame.
+ *
+ * @returns VBox status code.
+ * @param   pDevIns     The device instance.
+ * @param   pThread     The thread.
+ */
+static DECLCALLBACK(int) vnetTxThread(PPDMDEVINS pDevIns, PPDMTHREAD pThread)
+{
+    VNETSTATE     *pState = PDMINS_2_DATA(pDevIns, VNETSTATE *);
+    PVNETQUEUEPAIR pPair  = (PVNETQUEUEPAIR)pThread->pvUser;
+    PVQUEUE        pQueue = pPair->pTxQueue;
+
+    if (pThread->enmState == PDMTHREADSTATE_INITIALIZING)
+        return VINF_SUCCESS;
+
+    while (pThread->enmState == PDMTHREADSTATE_RUNNING)
+    {
+        /* Never sleep with the lock held, vnetIOPortOut waits for it. */
+        PDMCritSectEnter(&pPair->CritSectTx, VERR_IGNORED);
+        if (   (pState->VPCI.uStatus & VPCI_STATUS_DRV_OK)
+            && vqueueIsReady(&pState->VPCI, pQueue))
+        {
+            uint16_t uAvailIdxOld = pQueue->uNextAvailIndex;
+
+            vringSetNotification(&pState->VPCI, &pQueue->VRing, false);
+            int rc = vnetTransmitPendingPackets(pState, pPair, true /*fOnWorkerThread*/);
+            if (rc == VERR_TRY_AGAIN)
+            {
+                /* Another pair owns the driver and kicks us when it is done.
+                   The timeout covers the window where it finished before the
+                   flag was set. */
+                PDMCritSectLeave(&pPair->CritSectTx);
+                ASMAtomicWriteBool(&pPair->fTxWaitForDrv, true);
+                rc = RTSemEventWait(pPair->hEventTxKick, 10 /* ms */);
+                ASMAtomicWriteBool(&pPair->fTxWaitForDrv, false);
+                if (RT_FAILURE(rc) && rc != VERR_TIMEOUT && rc != VERR_INTERRUPTED)
+                    break;
+                continue;
+            }
+            vringSetNotification(&pState->VPCI, &pQueue->VRing, true);
+
+            /* Pick up whatever the guest queued before it saw notifications
+               re-enabled, but don't spin on a queue we make no progress on. */
+            if (   pQueue->uNextAvailIndex != uAvailIdxOld
+                && !vqueueIsEmpty(&pState->VPCI, pQueue))
+            {
+                PDMCritSectLeave(&pPair->CritSectTx);
+                continue;
+            }
+        }
+        PDMCritSectLeave(&pPair->CritSectTx);
+
+        int rc = RTSemEventWait(pPair->hEventTxKick, RT_INDEFINITE_WAIT);
+        if (RT_FAILURE(rc) && rc != VERR_INTERRUPTED)
+            break;
+    }
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Unblock the transmit worker so it can respond to a state change.
+ *
+ * @returns VBox status code.
+ * @param   pDevIns     The device instance.
+ * @param   pThread     The transmit thread.
+ */
+static DECLCALLBACK(int) vnetTxThreadWakeUp(PPDMDEVINS pDevIns, PPDMTHREAD pThread)
+{
+    PVNETQUEUEPAIR pPair = (PVNETQUEUEPAIR)pThread->pvUser;
+    return RTSemEventSignal(pPair->hEventTxKick);
+}
+
+/**
+ * Kicks the transmit worker of the pair the queue belongs to.
+ *
+ * @returns true if the pair has a worker, false if the caller has to transmit.
+ * @param   pState      The device state structure.
+ * @param   pQueue      The transmit queue the guest notified us about.
+ */
+DECLINLINE(bool) vnetKickTxThread(PVNETSTATE pState, PVQUEUE pQueue)
+{
+    PVNETQUEUEPAIR pPair = vnetGetQueuePair(pState, pQueue);
+    if (!pPair->pTxThread)
+        return false;
+    STAM_REL_COUNTER_INC(&pPair->StatTxKicks);
+    int rc = RTSemEventSignal(pPair->hEventTxKick);
+    AssertRC(rc);
+    return true;
 }
 
 #ifdef VNET_TX_DELAY
@@ -1189,17 +1615,20 @@ static DECLCALLBACK(void) vnetQueueTransmit(void *pvState, PVQUEUE pQueue)
 {
     VNETSTATE *pState = (VNETSTATE*)pvState;
 
+    if (vnetKickTxThread(pState, pQueue))
+        return;
+
     if (TMTimerIsActive(pState->CTX_SUFF(pTxTimer)))
     {
         int rc = TMTimerStop(pState->CTX_SUFF(pTxTimer));
         Log3(("%s vnetQueueTransmit: Got kicked with notification disabled, "
               "re-enable notification and flush TX queue\n", INSTANCE(pState)));
-        vnetTransmitPendingPackets(pState, pQueue, false /*fOnWorkerThread*/);
+        vnetTransmitPendingPackets(pState, &pState->aQueuePairs[0], false /*fOnWorkerThread*/);
         if (RT_FAILURE(vnetCsEnter(pState, VERR_SEM_BUSY)))
             LogRel(("vnetQueueTransmit: Failed to enter critical section!/n"));
         else
         {
-            vringSetNotification(&pState->VPCI, &pState->pTxQueue->VRing, true);
+            vringSetNotification(&pState->VPCI, &pQueue->VRing, true);
             vnetCsLeave(pState);
         }
     }
@@ -1209,7 +1638,7 @@ static DECLCALLBACK(void) vnetQueueTransmit(void *pvState, PVQUEUE pQueue)
             LogRel(("vnetQueueTransmit: Failed to enter critical section!/n"));
         else
         {
-            vringSetNotification(&pState->VPCI, &pState->pTxQueue->VRing, false);
+            vringSetNotification(&pState->VPCI, &pQueue->VRing, false);
             TMTimerSetMicro(pState->CTX_SUFF(pTxTimer), VNET_TX_DELAY);
             pState->u64NanoTS = RTTimeNanoTS();
             vnetCsLeave(pState);
@@ -1242,13 +1671,13 @@ static DECLCALLBACK(void) vnetTxTimer(PPDMDEVINS pDevIns, PTMTIMER pTimer, void
             u32MicroDiff, pState->u32AvgDiff, pState->u32MinDiff, pState->u32MaxDiff));
 
 //    Log3(("%s vnetTxTimer: Expired\n", INSTANCE(pState)));
-    vnetTransmitPendingPackets(pState, pState->pTxQueue, false /*fOnWorkerThread*/);
+    vnetTransmitPendingPackets(pState, &pState->aQueuePairs[0], false /*fOnWorkerThread*/);
     if (RT_FAILURE(vnetCsEnter(pState, VERR_SEM_BUSY)))
     {
         LogRel(("vnetTxTimer: Failed to enter critical section!/n"));
         return;
     }
-    vringSetNotification(&pState->VPCI, &pState->pTxQueue->VRing, true);
+    vringSetNotification(&pState->VPCI, &pState->aQueuePairs[0].pTxQueue->VRing, true);
     vnetCsLeave(pState);
 }
 
@@ -1258,7 +1687,8 @@ static DECLCALLBACK(void) vnetQueueTransmit(void *pvState, PVQUEUE pQueue)
 {
     VNETSTATE *pState = (VNETSTATE*)pvState;
 
-    vnetTransmitPendingPackets(pState, pQueue, false /*fOnWorkerThread*/);
+    if (!vnetKickTxThread(pState, pQueue))
+        vnetTransmitPendingPackets(pState, vnetGetQueuePair(pState, pQueue), false /*fOnWorkerThread*/);
 }
 
 #endif /* !VNET_TX_DELAY */
@@ -1416,6 +1846,40 @@ static uint8_t vnetControlVlan(PVNETSTATE pState, PVNETCTLHDR pCtlHdr, PVQUEUEEL
     return u8Ack;
 }
 
+static uint8_t vnetControlMq(PVNETSTATE pState, PVNETCTLHDR pCtlHdr, PVQUEUEELEM pElem)
+{
+    uint16_t cPairs;
+
+    if (   pCtlHdr->u8Command != VNET_CTRL_CMD_MQ_VQ_PAIRS_SET
+        || pElem->nOut != 2
+        || pElem->aSegsOut[1].cb != sizeof(cPairs))
+    {
+        Log(("%s vnetControlMq: Segment layout is wrong "
+             "(u8Command=%u nOut=%u cb=%u)\n", INSTANCE(pState),
+             pCtlHdr->u8Command, pElem->nOut, pElem->aSegsOut[1].cb));
+        return VNET_ERROR;
+    }
+
+    PDMDevHlpPhysRead(pState->VPCI.CTX_SUFF(pDevIns),
+                      pElem->aSegsOut[1].addr,
+                      &cPairs, sizeof(cPairs));
+
+    if (   !(pState->VPCI.uGuestFeatures & VNET_F_MQ)
+        || cPairs < 1
+        || cPairs > pState->cQueuePairs)
+    {
+        Log(("%s vnetControlMq: Invalid number of queue pairs "
+             "(cPairs=%u max=%u)\n", INSTANCE(pState), cPairs, pState->cQueuePairs));
+        return VNET_ERROR;
+    }
+
+    Log(("%s vnetControlMq: cPairs=%u\n", INSTANCE(pState), cPairs));
+    pState->cQueuePairsActive = cPairs;
+    /* The flows get re-learned from the transmit side. */
+    memset((void *)pState->au8FlowTable, 0, sizeof(pState->au8FlowTable));
+    return VNET_OK;
+}
+
 
 static DECLCALLBACK(void) vnetQueueControl(void *pvState, PVQUEUE pQueue)
 {
@@ -1458,6 +1922,9 @@ static DECLCALLBACK(void) vnetQueueControl(void *pvState, PVQUEUE pQueue)
                 case VNET_CTRL_CLS_VLAN:
                     u8Ack = vnetControlVlan(pState, &CtlHdr, &elem);
                     break;
+                case VNET_CTRL_CLS_MQ:
+                    u8Ack = vnetControlMq(pState, &CtlHdr, &elem);
+                    break;
                 default:
                     u8Ack = VNET_ERROR;
             }
@@ -1481,6 +1948,7 @@ static DECLCALLBACK(void) vnetQueueControl(void *pvState, PVQUEUE pQueue)
 static void vnetSaveConfig(VNETSTATE *pState, PSSMHANDLE pSSM)
 {
     SSMR3PutMem(pSSM, &pState->macConfigured, sizeof(pState->macConfigured));
+    SSMR3PutU16(pSSM, pState->cQueuePairs);
 }
 
 /**
@@ -1547,6 +2015,8 @@ static DECLCALLBACK(int) vnetSaveExec(PPDMDEVINS pDevIns, PSSMHANDLE pSSM)
     AssertRCReturn(rc, rc);
     rc = SSMR3PutMem( pSSM, pState->aVlanFilter, sizeof(pState->aVlanFilter));
     AssertRCReturn(rc, rc);
+    rc = SSMR3PutU16( pSSM, pState->cQueuePairsActive);
+    AssertRCReturn(rc, rc);
     Log(("%s State has been saved\n", INSTANCE(pState)));
     return VINF_SUCCESS;
 }
@@ -1615,8 +2085,17 @@ static DECLCALLBACK(int) vnetLoadExec(PPDMDEVINS pDevIns, PSSMHANDLE pSSM, uint3
     if (memcmp(&macConfigured, &pState->macConfigured, sizeof(macConfigured))
         && (uPass == 0 || !PDMDevHlpVMTeleportedAndNotFullyResumedYet(pDevIns)))
         LogRel(("%s: The mac address differs: config=%RTmac saved=%RTmac\n", INSTANCE(pState), &pState->macConfigured, &macConfigured));
+    uint16_t cQueuePairs = 1;
+    if (uVersion > VIRTIO_SAVEDSTATE_VERSION_PRE_MQ)
+    {
+        rc = SSMR3GetU16(pSSM, &cQueuePairs);
+        AssertRCReturn(rc, rc);
+    }
+    if (cQueuePairs != pState->cQueuePairs)
+        return SSMR3SetCfgError(pSSM, RT_SRC_POS, N_("The number of queue pairs differs: config=%u saved=%u"),
+                                pState->cQueuePairs, cQueuePairs);
 
-    rc = vpciLoadExec(&pState->VPCI, pSSM, uVersion, uPass, VNET_N_QUEUES);
+    rc = vpciLoadExec(&pState->VPCI, pSSM, uVersion, uPass, VNET_N_QUEUES(1));
     AssertRCReturn(rc, rc);
 
     if (uPass == SSM_PASS_FINAL)
@@ -1645,6 +2124,18 @@ static DECLCALLBACK(int) vnetLoadExec(PPDMDEVINS pDevIns, PSSMHANDLE pSSM, uint3
             rc = SSMR3GetMem(pSSM, pState->aVlanFilter,
                              sizeof(pState->aVlanFilter));
             AssertRCReturn(rc, rc);
+            if (uVersion > VIRTIO_SAVEDSTATE_VERSION_PRE_MQ)
+            {
+                rc = SSMR3GetU16(pSSM, &pState->cQueuePairsActive);
+                AssertRCReturn(rc, rc);
+                AssertLogRelMsgReturn(   pState->cQueuePairsActive >= 1
+                                      && pState->cQueuePairsActive <= pState->cQueuePairs,
+                                      ("cQueuePairsActive=%u\n", pState->cQueuePairsActive),
+                                      VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+            }
+            else
+                pState->cQueuePairsActive = 1;
+            memset((void *)pState->au8FlowTable, 0, sizeof(pState->au8FlowTable));
         }
         else
         {
@@ -1653,6 +2144,7 @@ static DECLCALLBACK(int) vnetLoadExec(PPDMDEVINS pDevIns, PSSMHANDLE pSSM, uint3
             pState->nMacFilterEntries = 0;
             memset(pState->aMacFilter, 0, VNET_MAC_FILTER_LEN * sizeof(RTMAC));
             memset(pState->aVlanFilter, 0, sizeof(pState->aVlanFilter));
+            pState->cQueuePairsActive = 1;
             if (pState->pDrv)
                 pState->pDrv->pfnSetPromiscuousMode(pState->pDrv, true);
         }
@@ -1893,6 +2385,26 @@ static DECLCALLBACK(int) vnetDestruct(PPDMDEVINS pDevIns)
     LogRel(("TxTimer stats (avg/min/max): %7d usec %7d usec %7d usec\n",
             pState->u32AvgDiff, pState->u32MinDiff, pState->u32MaxDiff));
     Log(("%s Destroying instance\n", INSTANCE(pState)));
+    for (unsigned i = 0; i < pState->cQueuePairs; i++)
+    {
+        PVNETQUEUEPAIR pPair = &pState->aQueuePairs[i];
+        if (pPair->pTxThread)
+        {
+            int rcThread;
+            int rc = PDMR3ThreadDestroy(pPair->pTxThread, &rcThread);
+            if (RT_FAILURE(rc) || RT_FAILURE(rcThread))
+                AssertMsgFailed(("%s Failed to destroy TX thread rc=%Rrc rcThread=%Rrc\n",
+                                 INSTANCE(pState), rc, rcThread));
+            pPair->pTxThread = NULL;
+        }
+        if (pPair->hEventTxKick != NIL_RTSEMEVENT)
+        {
+            RTSemEventDestroy(pPair->hEventTxKick);
+            pPair->hEventTxKick = NIL_RTSEMEVENT;
+        }
+        if (PDMCritSectIsInitialized(&pPair->CritSectTx))
+            PDMR3CritSectDelete(&pPair->CritSectTx);
+    }
     if (pState->hEventMoreRxDescAvail != NIL_RTSEMEVENT)
     {
         RTSemEventSignal(pState->hEventMoreRxDescAvail);
@@ -1915,23 +2427,43 @@ static DECLCALLBACK(int) vnetConstruct(PPDMDEVINS pDevIns, int iInstance, PCFGMN
     int        rc;
     PDMDEV_CHECK_VERSIONS_RETURN(pDevIns);
 
+    for (unsigned i = 0; i < RT_ELEMENTS(pState->aQueuePairs); i++)
+        pState->aQueuePairs[i].hEventTxKick = NIL_RTSEMEVENT;
+    pState->hEventMoreRxDescAvail = NIL_RTSEMEVENT;
+
+    /* The number of queue pairs determines the number of queues, get it first. */
+    rc = CFGMR3QueryU16Def(pCfg, "QueuePairs", &pState->cQueuePairs, 1);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("Configuration error: Failed to get the value of 'QueuePairs'"));
+    if (pState->cQueuePairs < 1 || pState->cQueuePairs > VNET_MAX_QUEUE_PAIRS)
+        return PDMDevHlpVMSetError(pDevIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("Configuration error: 'QueuePairs' must be between 1 and %u"),
+                                   VNET_MAX_QUEUE_PAIRS);
+
     /* Initialize PCI part first. */
     pState->VPCI.IBase.pfnQueryInterface    = vnetQueryInterface;
     rc = vpciConstruct(pDevIns, &pState->VPCI, iInstance,
                        VNET_NAME_FMT, VNET_PCI_SUBSYSTEM_ID,
-                       VNET_PCI_CLASS, VNET_N_QUEUES);
-    pState->pRxQueue  = vpciAddQueue(&pState->VPCI, 256, vnetQueueReceive,  "RX ");
-    pState->pTxQueue  = vpciAddQueue(&pState->VPCI, 256, vnetQueueTransmit, "TX ");
+                       VNET_PCI_CLASS, VNET_N_QUEUES(pState->cQueuePairs));
+    /* RX0, TX0, RX1, TX1, ..., CTL -- the layout VNET_F_MQ guests expect. */
+    for (unsigned i = 0; i < pState->cQueuePairs; i++)
+    {
+        PVNETQUEUEPAIR pPair = &pState->aQueuePairs[i];
+        pPair->iPair = i;
+        RTStrPrintf(pPair->szRxName, sizeof(pPair->szRxName), "RX%u", i);
+        RTStrPrintf(pPair->szTxName, sizeof(pPair->szTxName), "TX%u", i);
+        pPair->pRxQueue = vpciAddQueue(&pState->VPCI, 256, vnetQueueReceive,  pPair->szRxName);
+        pPair->pTxQueue = vpciAddQueue(&pState->VPCI, 256, vnetQueueTransmit, pPair->szTxName);
+    }
     pState->pCtlQueue = vpciAddQueue(&pState->VPCI, 16,  vnetQueueControl,  "CTL");
 
     Log(("%s Constructing new instance\n", INSTANCE(pState)));
 
-    pState->hEventMoreRxDescAvail = NIL_RTSEMEVENT;
-
     /*
      * Validate configuration.
      */
-    if (!CFGMR3AreValuesValid(pCfg, "MAC\0" "CableConnected\0" "LineSpeed\0"))
+    if (!CFGMR3AreValuesValid(pCfg, "MAC\0" "CableConnected\0" "LineSpeed\0" "QueuePairs\0"))
                     return PDMDEV_SET_ERROR(pDevIns, VERR_PDM_DEVINS_UNKNOWN_CFG_VALUES,
                                             N_("Invalid configuration for VirtioNet device"));
 
@@ -1949,6 +2481,7 @@ static DECLCALLBACK(int) vnetConstruct(PPDMDEVINS pDevIns, int iInstance, PCFGMN
     /* Initialize PCI config space */
     memcpy(pState->config.mac.au8, pState->macConfigured.au8, sizeof(pState->config.mac.au8));
     pState->config.uStatus = 0;
+    pState->config.uMaxVirtqueuePairs = pState->cQueuePairs;
 
     /* Initialize state structure */
     pState->u32PktNo     = 1;
@@ -2040,6 +2573,31 @@ static DECLCALLBACK(int) vnetConstruct(PPDMDEVINS pDevIns, int iInstance, PCFGMN
     if (RT_FAILURE(rc))
         return rc;
 
+    /*
+     * With several pairs each transmit queue is drained by its own worker,
+     * EMTs only kick it. A single pair keeps transmitting on EMT.
+     */
+    if (pState->cQueuePairs > 1)
+    {
+        for (unsigned i = 0; i < pState->cQueuePairs; i++)
+        {
+            PVNETQUEUEPAIR pPair = &pState->aQueuePairs[i];
+            char szName[24];
+
+            rc = RTSemEventCreate(&pPair->hEventTxKick);
+            if (RT_FAILURE(rc))
+                return rc;
+            rc = PDMDevHlpCritSectInit(pDevIns, &pPair->CritSectTx, RT_SRC_POS, "VNet%dTx%u", iInstance, i);
+            if (RT_FAILURE(rc))
+                return rc;
+            RTStrPrintf(szName, sizeof(szName), "VNet%dTx%u", iInstance, i);
+            rc = PDMDevHlpThreadCreate(pDevIns, &pPair->pTxThread, pPair, vnetTxThread,
+                                       vnetTxThreadWakeUp, 0, RTTHREADTYPE_IO, szName);
+            if (RT_FAILURE(rc))
+                return PDMDEV_SET_ERROR(pDevIns, rc, N_("Failed to create the transmit thread"));
+        }
+    }
+
     rc = vnetReset(pState);
     AssertRC(rc);
 
@@ -2049,6 +2607,13 @@ static DECLCALLBACK(int) vnetConstruct(PPDMDEVINS pDevIns, int iInstance, PCFGMN
     PDMDevHlpSTAMRegisterF(pDevIns, &pState->StatTransmitPackets,    STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,          "Number of sent packets",             "/Devices/VNet%d/Packets/Transmit", iInstance);
     PDMDevHlpSTAMRegisterF(pDevIns, &pState->StatTransmitGSO,        STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,          "Number of sent GSO packets",         "/Devices/VNet%d/Packets/Transmit-Gso", iInstance);
     PDMDevHlpSTAMRegisterF(pDevIns, &pState->StatTransmitCSum,       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,          "Number of completed TX checksums",   "/Devices/VNet%d/Packets/Transmit-Csum", iInstance);
+    for (unsigned i = 0; i < pState->cQueuePairs; i++)
+    {
+        PVNETQUEUEPAIR pPair = &pState->aQueuePairs[i];
+        PDMDevHlpSTAMRegisterF(pDevIns, &pPair->StatReceivePackets,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,          "Number of packets received on the pair", "/Devices/VNet%d/Queue%u/ReceivePackets", iInstance, i);
+        PDMDevHlpSTAMRegisterF(pDevIns, &pPair->StatTransmitPackets, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,          "Number of packets sent from the pair",   "/Devices/VNet%d/Queue%u/TransmitPackets", iInstance, i);
+        PDMDevHlpSTAMRegisterF(pDevIns, &pPair->StatTxKicks,         STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,          "Number of TX worker kicks by the guest", "/Devices/VNet%d/Queue%u/TxKicks", iInstance, i);
+    }
 #if defined(VBOX_WITH_STATISTICS)
     PDMDevHlpSTAMRegisterF(pDevIns, &pState->StatReceive,            STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL, "Profiling receive",                  "/Devices/VNet%d/Receive/Total", iInstance);
     PDMDevHlpSTAMRegisterF(pDevIns, &pState->StatReceiveStore,       STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL, "Profiling receive storing",          "/Devices/VNet%d/Receive/Store", iInstance);
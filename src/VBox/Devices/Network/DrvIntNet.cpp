@@ -114,6 +114,12 @@ typedef struct DRVINTNET
     PDMCRITSECT                     XmitLock;
     /** Interface handle. */
     INTNETIFHANDLE                  hIf;
+    /** The max number of frames to queue up in the send buffer before pushing
+     * them thru the switch.  The rest is pushed at pfnEndXmit time. */
+    uint32_t                        cXmitBatchMax;
+    /** The number of frames committed to the send buffer that hasn't been
+     * pushed thru the switch yet.  Protected by XmitLock. */
+    uint32_t                        cXmitPending;
     /** The receive thread state. */
     RECVSTATE volatile              enmRecvState;
     /** The receive thread. */
@@ -167,6 +173,8 @@ typedef struct DRVINTNET
     STAMCOUNTER                     StatXmitWakeupR3;
     /** The times the xmit thread has been told to process the ring. */
     STAMCOUNTER                     StatXmitProcessRing;
+    /** The number of frame batches pushed thru the switch by pfnEndXmit. */
+    STAMCOUNTER                     StatXmitBatches;
 #ifdef VBOX_WITH_STATISTICS
     /** Profiling packet transmit runs. */
     STAMPROFILE                     StatTransmit;
@@ -289,6 +297,7 @@ DECLINLINE(int) drvIntNetSignalXmit(PDRVINTNET pThis)
 DECLINLINE(int) drvIntNetProcessXmit(PDRVINTNET pThis)
 {
     Assert(PDMCritSectIsOwner(&pThis->XmitLock));
+    pThis->cXmitPending = 0;
 
 #ifdef IN_RING3
     INTNETIFSENDREQ SendReq;
@@ -385,7 +394,8 @@ PDMBOTHCBDECL(int) drvIntNetUp_AllocBuf(PPDMINETWORKUP pInterface, size_t cbMin,
      *
      * In ring-3 we may have to process the xmit ring before there is
      * sufficient buffer space since we might have stacked up a few frames to the
-     * trunk while in ring-0.  (There is not point of doing this in ring-0.)
+     * trunk while in ring-0.  In ring-0 only the frames held back for batching
+     * (cXmitPending) can be pushed out, anything else has to wait for ring-3.
      */
     PINTNETHDR pHdr = NULL;             /* gcc silliness */
     if (pGso)
@@ -394,9 +404,13 @@ PDMBOTHCBDECL(int) drvIntNetUp_AllocBuf(PPDMINETWORKUP pInterface, size_t cbMin,
     else
         rc = IntNetRingAllocateFrame(&pThis->CTX_SUFF(pBuf)->Send, (uint32_t)cbMin,
                                      &pHdr, &pSgBuf->aSegs[0].pvSeg);
-#ifdef IN_RING3
     if (    RT_FAILURE(rc)
-        &&  pThis->CTX_SUFF(pBuf)->cbSend >= cbMin * 2 + sizeof(INTNETHDR))
+#ifdef IN_RING3
+        &&  pThis->CTX_SUFF(pBuf)->cbSend >= cbMin * 2 + sizeof(INTNETHDR)
+#else
+        &&  pThis->cXmitPending /* only the frames we're holding back. */
+#endif
+       )
     {
         drvIntNetProcessXmit(pThis);
         if (pGso)
@@ -406,7 +420,6 @@ PDMBOTHCBDECL(int) drvIntNetUp_AllocBuf(PPDMINETWORKUP pInterface, size_t cbMin,
             rc = IntNetRingAllocateFrame(&pThis->CTX_SUFF(pBuf)->Send, (uint32_t)cbMin,
                                          &pHdr, &pSgBuf->aSegs[0].pvSeg);
     }
-#endif
     if (RT_SUCCESS(rc))
     {
         /*
@@ -499,11 +512,14 @@ PDMBOTHCBDECL(int) drvIntNetUp_SendBuf(PPDMINETWORKUP pInterface, PPDMSCATTERGAT
     PDMDrvHlpFTSetCheckpoint(pThis->CTX_SUFF(pDrvIns), FTMCHECKPOINTTYPE_NETWORK);
 
     /*
-     * Commit the frame and push it thru the switch.
+     * Commit the frame and push it thru the switch, unless we're batching
+     * them up for pfnEndXmit.
      */
     PINTNETHDR pHdr = (PINTNETHDR)pSgBuf->pvAllocator;
     IntNetRingCommitFrameEx(&pThis->CTX_SUFF(pBuf)->Send, pHdr, pSgBuf->cbUsed);
-    int rc = drvIntNetProcessXmit(pThis);
+    int rc = VINF_SUCCESS;
+    if (++pThis->cXmitPending >= pThis->cXmitBatchMax)
+        rc = drvIntNetProcessXmit(pThis);
     STAM_PROFILE_STOP(&pThis->StatTransmit, a);
 
     /*
@@ -525,6 +541,14 @@ PDMBOTHCBDECL(int) drvIntNetUp_SendBuf(PPDMINETWORKUP pInterface, PPDMSCATTERGAT
 PDMBOTHCBDECL(void) drvIntNetUp_EndXmit(PPDMINETWORKUP pInterface)
 {
     PDRVINTNET pThis = RT_FROM_MEMBER(pInterface, DRVINTNET, CTX_SUFF(INetworkUp));
+
+    /* Push the frames we've batched up thru the switch in one go. */
+    if (pThis->cXmitPending)
+    {
+        STAM_COUNTER_INC(&pThis->StatXmitBatches);
+        drvIntNetProcessXmit(pThis);
+    }
+
     ASMAtomicUoWriteBool(&pThis->fXmitOnXmitThread, false);
     PDMCritSectLeave(&pThis->XmitLock);
 }
@@ -1184,6 +1208,7 @@ static DECLCALLBACK(void) drvR3IntNetDestruct(PPDMDRVINS pDrvIns)
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->cStatYieldsNok);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->cStatLost);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->cStatBadFrames);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->cStatWakeups);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->StatSend1);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->StatSend2);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->StatRecv1);
@@ -1318,6 +1343,7 @@ static DECLCALLBACK(int) drvR3IntNetConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg
     pThis->pDrvInsR0                                = PDMDRVINS_2_R0PTR(pDrvIns);
 #endif
     pThis->hIf                                      = INTNET_HANDLE_INVALID;
+    pThis->cXmitBatchMax                            = 1;
     pThis->hRecvThread                              = NIL_RTTHREAD;
     pThis->hRecvEvt                                 = NIL_RTSEMEVENT;
     pThis->pXmitThread                              = NULL;
@@ -1361,7 +1387,10 @@ static DECLCALLBACK(int) drvR3IntNetConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg
                                   "|TrunkPolicyWire"
                                   "|IsService"
                                   "|IgnoreConnectFailure"
-                                  "|Workaround1",
+                                  "|Workaround1"
+                                  "|SendBatchFrames"
+                                  "|ReceiveWakeupFrames"
+                                  "|ReceiveWakeupLatency",
                                   "");
 
     /*
@@ -1594,6 +1623,42 @@ static DECLCALLBACK(int) drvR3IntNetConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg
         return PDMDRV_SET_ERROR(pDrvIns, rc,
                                 N_("Configuration error: Failed to get the \"IsService\" value"));
 
+    /** @cfgm{SendBatchFrames, uint32_t, 32}
+     * The max number of frames the device may queue up in the send buffer
+     * before they are pushed thru the switch.  Whatever is queued is pushed
+     * when the device is done transmitting.  1 pushes every frame
+     * individually.
+     */
+    rc = CFGMR3QueryU32Def(pCfg, "SendBatchFrames", &pThis->cXmitBatchMax, 32);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc,
+                                N_("Configuration error: Failed to get the \"SendBatchFrames\" value"));
+    if (!pThis->cXmitBatchMax)
+        pThis->cXmitBatchMax = 1;
+
+    /** @cfgm{ReceiveWakeupFrames, uint32_t, 32}
+     * The max number of frames other interfaces on the network may queue up in
+     * our receive buffer before waking up the receive thread.  The receive
+     * thread is always woken up when the sender is done with its batch.
+     * 1 wakes it up for every frame.
+     */
+    uint32_t cRecvWakeupFrames;
+    rc = CFGMR3QueryU32Def(pCfg, "ReceiveWakeupFrames", &cRecvWakeupFrames, 32);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc,
+                                N_("Configuration error: Failed to get the \"ReceiveWakeupFrames\" value"));
+
+    /** @cfgm{ReceiveWakeupLatency, uint32_t, 100}
+     * The max number of microseconds a received frame may be held back before
+     * waking up the receive thread.  0 means no limit other than the end of
+     * the sender's batch.
+     */
+    uint32_t cMicrosRecvWakeupLatency;
+    rc = CFGMR3QueryU32Def(pCfg, "ReceiveWakeupLatency", &cMicrosRecvWakeupLatency, 100);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc,
+                                N_("Configuration error: Failed to get the \"ReceiveWakeupLatency\" value"));
+
 
     /** @cfgm{IgnoreConnectFailure, boolean, false}
      * When set only raise a runtime error if we cannot connect to the internal
@@ -1717,6 +1782,26 @@ static DECLCALLBACK(int) drvR3IntNetConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg
     pThis->pBufR3 = GetBufferPtrsReq.pRing3Buf;
     pThis->pBufR0 = GetBufferPtrsReq.pRing0Buf;
 
+    /*
+     * Set the receive wakeup policy.  The receive thread always drains the
+     * buffer before waiting again, so there is no need to be woken up for
+     * every single frame.
+     */
+    if (cRecvWakeupFrames > 1)
+    {
+        INTNETIFSETWAKEUPPOLICYREQ WakeupPolicyReq;
+        WakeupPolicyReq.Hdr.u32Magic        = SUPVMMR0REQHDR_MAGIC;
+        WakeupPolicyReq.Hdr.cbReq           = sizeof(WakeupPolicyReq);
+        WakeupPolicyReq.pSession            = NIL_RTR0PTR;
+        WakeupPolicyReq.hIf                 = pThis->hIf;
+        WakeupPolicyReq.cMaxFrames          = cRecvWakeupFrames;
+        WakeupPolicyReq.cMicrosMaxLatency   = cMicrosRecvWakeupLatency;
+        rc = PDMDrvHlpSUPCallVMMR0Ex(pDrvIns, VMMR0_DO_INTNET_IF_SET_WAKEUP_POLICY, &WakeupPolicyReq, sizeof(WakeupPolicyReq));
+        if (RT_FAILURE(rc))
+            return PDMDrvHlpVMSetError(pDrvIns, rc, RT_SRC_POS,
+                                       N_("Failed to set the receive wakeup policy of the interface to '%s'"), pThis->szNetwork);
+    }
+
     /*
      * Register statistics.
      */
@@ -1734,6 +1819,7 @@ static DECLCALLBACK(int) drvR3IntNetConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg
     PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->pBufR3->cStatYieldsNok,     "YieldOk",              "Number of times yielding helped fix an overflow.");
     PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->pBufR3->cStatYieldsOk,      "YieldNok",             "Number of times yielding didn't help fix an overflow.");
     PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->pBufR3->cStatBadFrames,     "BadFrames",            "Number of bad frames seed by the consumers.");
+    PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->pBufR3->cStatWakeups,       "Wakeups",              "Number of times the receive thread was woken up for new frames.");
     PDMDrvHlpSTAMRegProfile(pDrvIns, &pThis->pBufR3->StatSend1,          "Send1",                "Profiling IntNetR0IfSend.");
     PDMDrvHlpSTAMRegProfile(pDrvIns, &pThis->pBufR3->StatSend2,          "Send2",                "Profiling sending to the trunk.");
     PDMDrvHlpSTAMRegProfile(pDrvIns, &pThis->pBufR3->StatRecv1,          "Recv1",                "Reserved for future receive profiling.");
@@ -1746,6 +1832,7 @@ static DECLCALLBACK(int) drvR3IntNetConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg
     PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->StatXmitWakeupR0,           "XmitWakeup-R0",        "Xmit thread wakeups from ring-0.");
     PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->StatXmitWakeupR3,           "XmitWakeup-R3",        "Xmit thread wakeups from ring-3.");
     PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->StatXmitProcessRing,        "XmitProcessRing",      "Time xmit thread was told to process the ring.");
+    PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->StatXmitBatches,            "XmitBatches",          "Frame batches pushed thru the switch at the end of a transmit run.");
 
     /*
      * Create the async I/O threads.
@@ -28,11 +28,13 @@
 #include <VBox/vmm/pdmnetifs.h>
 #include <VBox/vmm/pdmnetinline.h>
 
+#include <iprt/asm.h>
 #include <iprt/assert.h>
 #include <iprt/critsect.h>
 #include <iprt/cidr.h>
 #include <iprt/file.h>
 #include <iprt/mem.h>
+#include <iprt/net.h>
 #include <iprt/pipe.h>
 #include <iprt/string.h>
 #include <iprt/stream.h>
@@ -46,6 +48,9 @@
 # include <poll.h>
 # include <errno.h>
 #endif
+#ifdef RT_OS_LINUX
+# include <sys/epoll.h>
+#endif
 #ifdef RT_OS_FREEBSD
 # include <netinet/in.h>
 #endif
@@ -66,6 +71,9 @@
  */
 #define VBOX_NAT_DELAY_HACK
 
+/** The maximum number of NAT workers (slirp engines) per instance. */
+#define DRVNAT_MAX_WORKERS  8
+
 #define GET_EXTRADATA(pthis, node, name, rc, type, type_name, var)                                  \
 do {                                                                                                \
     (rc) = CFGMR3Query ## type((node), name, &(var));                                               \
@@ -123,6 +131,40 @@ do                                                      \
 /*******************************************************************************
 *   Structures and Typedefs                                                    *
 *******************************************************************************/
+/**
+ * A NAT worker, i.e. a slirp engine and the thread driving it.
+ *
+ * Worker 0 is the primary engine. It owns DHCP, DNS, TFTP, ICMP and the port
+ * forwarding rules and is the only one unless sharding is configured, in
+ * which case TCP and UDP flows to the outside are spread over all workers.
+ */
+typedef struct DRVNATWORKER
+{
+    /** Pointer to the NAT instance. */
+    struct DRVNAT          *pThis;
+    /** The slirp engine of this worker. */
+    PNATState               pNATState;
+    /** Polling thread. */
+    PPDMTHREAD              pSlirpThread;
+    /** Queue for NAT-thread-external events. */
+    PRTREQQUEUE             pSlirpReqQueue;
+#ifndef RT_OS_WINDOWS
+    /** The write end of the control pipe. */
+    RTPIPE                  hPipeWrite;
+    /** The read end of the control pipe. */
+    RTPIPE                  hPipeRead;
+#else
+    /** for external notification */
+    HANDLE                  hWakeupEvent;
+#endif
+    /** Link state of this engine. */
+    PDMNETWORKLINKSTATE     enmLinkState;
+    /** The worker index. */
+    uint32_t                iWorker;
+} DRVNATWORKER;
+/** Pointer to a NAT worker. */
+typedef DRVNATWORKER *PDRVNATWORKER;
+
 /**
  * NAT network transport driver instance data.
  *
@@ -142,7 +184,7 @@ typedef struct DRVNAT
     PPDMDRVINS              pDrvIns;
     /** Link state */
     PDMNETWORKLINKSTATE     enmLinkState;
-    /** NAT state for this instance. */
+    /** NAT state for this instance, the engine of the primary worker. */
     PNATState               pNATState;
     /** TFTP directory prefix. */
     char                   *pszTFTPPrefix;
@@ -150,10 +192,6 @@ typedef struct DRVNAT
     char                   *pszBootFile;
     /** tftp server name to provide in the DHCP server response. */
     char                   *pszNextServer;
-    /** Polling thread. */
-    PPDMTHREAD              pSlirpThread;
-    /** Queue for NAT-thread-external events. */
-    PRTREQQUEUE             pSlirpReqQueue;
     /** The guest IP for port-forwarding. */
     uint32_t                GuestIP;
     /** Link state set when the VM is suspended. */
@@ -162,19 +200,42 @@ typedef struct DRVNAT
 #ifdef VBOX_WITH_SLIRP_MT
     PPDMTHREAD              pGuestThread;
 #endif
-#ifndef RT_OS_WINDOWS
-    /** The write end of the control pipe. */
-    RTPIPE                  hPipeWrite;
-    /** The read end of the control pipe. */
-    RTPIPE                  hPipeRead;
-#else
-    /** for external notification */
-    HANDLE                  hWakeupEvent;
-#endif
+
+    /** Number of workers, 1 unless flows are sharded. */
+    uint32_t                cWorkers;
+    /** The NAT network address (network byte order). */
+    uint32_t                u32Network;
+    /** The NAT network mask (network byte order). */
+    uint32_t                u32Netmask;
+    /** The workers, the primary one first. */
+    DRVNATWORKER            aWorkers[DRVNAT_MAX_WORKERS];
+    /** Guest TCP ports with port forwarding rules, these flows stay on the
+     * primary worker. */
+    uint32_t                bmTcpForwarded[_64K / 32];
+    /** Guest UDP ports with port forwarding rules. */
+    uint32_t                bmUdpForwarded[_64K / 32];
+    /** The workers of fragmented datagrams, indexed by a hash of the IP
+     * identification.  The later fragments don't carry the ports and have to
+     * follow the first one.  u8Proto is 0 in unused entries.  Protected by
+     * XmitLock. */
+    struct
+    {
+        uint32_t            u32Src;
+        uint32_t            u32Dst;
+        uint16_t            u16Id;
+        uint8_t             u8Proto;
+        uint8_t             iWorker;
+    }                       aFrags[64];
 
 #define DRV_PROFILE_COUNTER(name, dsc)     STAMPROFILE Stat ## name
 #define DRV_COUNTING_COUNTER(name, dsc)    STAMCOUNTER Stat ## name
 #include "counters.h"
+    /** Frames from the guest handled by each worker. */
+    STAMCOUNTER             aStatWorkerFramesIn[DRVNAT_MAX_WORKERS];
+    /** Frames to the guest produced by each worker. */
+    STAMCOUNTER             aStatWorkerFramesOut[DRVNAT_MAX_WORKERS];
+    /** Time each worker spends in the slirp engine. */
+    STAMPROFILE             aStatWorkerBusy[DRVNAT_MAX_WORKERS];
     /** thread delivering packets for receiving by the guest */
     PPDMTHREAD              pRecvThread;
     /** thread delivering urg packets for receiving by the guest */
@@ -199,6 +260,7 @@ typedef struct DRVNAT
     RTCRITSECT              XmitLock;
 } DRVNAT;
 AssertCompileMemberAlignment(DRVNAT, StatNATRecvWakeups, 8);
+AssertCompileMemberAlignment(DRVNAT, aStatWorkerFramesIn, 8);
 /** Pointer the NAT driver instance data. */
 typedef DRVNAT *PDRVNAT;
 
@@ -206,7 +268,7 @@ typedef DRVNAT *PDRVNAT;
 /*******************************************************************************
 *   Internal Functions                                                         *
 *******************************************************************************/
-static void drvNATNotifyNATThread(PDRVNAT pThis, const char *pszWho);
+static void drvNATNotifyNATThread(PDRVNATWORKER pWorker, const char *pszWho);
 
 
 static DECLCALLBACK(int) drvNATRecv(PPDMDRVINS pDrvIns, PPDMTHREAD pThread)
@@ -264,8 +326,9 @@ static DECLCALLBACK(int) drvNATUrgRecvWakeup(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
     return VINF_SUCCESS;
 }
 
-static DECLCALLBACK(void) drvNATUrgRecvWorker(PDRVNAT pThis, uint8_t *pu8Buf, int cb, struct mbuf *m)
+static DECLCALLBACK(void) drvNATUrgRecvWorker(PDRVNATWORKER pWorker, uint8_t *pu8Buf, int cb, struct mbuf *m)
 {
+    PDRVNAT pThis = pWorker->pThis;
     int rc = RTCritSectEnter(&pThis->DevAccessLock);
     AssertRC(rc);
     rc = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, RT_INDEFINITE_WAIT);
@@ -283,17 +346,18 @@ static DECLCALLBACK(void) drvNATUrgRecvWorker(PDRVNAT pThis, uint8_t *pu8Buf, in
     rc = RTCritSectLeave(&pThis->DevAccessLock);
     AssertRC(rc);
 
-    slirp_ext_m_free(pThis->pNATState, m, pu8Buf);
+    slirp_ext_m_free(pWorker->pNATState, m, pu8Buf);
     if (ASMAtomicDecU32(&pThis->cUrgPkts) == 0)
     {
         drvNATRecvWakeup(pThis->pDrvIns, pThis->pRecvThread);
-        drvNATNotifyNATThread(pThis, "drvNATUrgRecvWorker");
+        drvNATNotifyNATThread(pWorker, "drvNATUrgRecvWorker");
     }
 }
 
 
-static DECLCALLBACK(void) drvNATRecvWorker(PDRVNAT pThis, uint8_t *pu8Buf, int cb, struct mbuf *m)
+static DECLCALLBACK(void) drvNATRecvWorker(PDRVNATWORKER pWorker, uint8_t *pu8Buf, int cb, struct mbuf *m)
 {
+    PDRVNAT pThis = pWorker->pThis;
     int rc;
     STAM_PROFILE_START(&pThis->StatNATRecv, a);
 
@@ -329,10 +393,10 @@ static DECLCALLBACK(void) drvNATRecvWorker(PDRVNAT pThis, uint8_t *pu8Buf, int c
     AssertRC(rc);
 
 done_unlocked:
-    slirp_ext_m_free(pThis->pNATState, m, pu8Buf);
+    slirp_ext_m_free(pWorker->pNATState, m, pu8Buf);
     ASMAtomicDecU32(&pThis->cPkts);
 
-    drvNATNotifyNATThread(pThis, "drvNATRecvWorker");
+    drvNATNotifyNATThread(pWorker, "drvNATRecvWorker");
 
     STAM_PROFILE_STOP(&pThis->StatNATRecv, a);
 }
@@ -364,25 +428,168 @@ static void drvNATFreeSgBuf(PDRVNAT pThis, PPDMSCATTERGATHER pSgBuf)
 }
 
 /**
- * Worker function for drvNATSend().
+ * Copies a frame into an mbuf of the given worker's engine.
+ *
+ * @returns The mbuf, NULL if out of buffers.
+ * @param   pWorker             The worker.
+ * @param   pvFrame             The frame.
+ * @param   cbFrame             The frame size.
+ */
+static struct mbuf *drvNATWorkerDupFrame(PDRVNATWORKER pWorker, const void *pvFrame, size_t cbFrame)
+{
+    void  *pvSeg;
+    size_t cbSeg;
+    struct mbuf *m = slirp_ext_m_get(pWorker->pNATState, cbFrame, &pvSeg, &cbSeg);
+    if (m)
+    {
+        Assert(cbSeg >= cbFrame);
+        memcpy(pvSeg, pvFrame, cbFrame);
+    }
+    return m;
+}
+
+/**
+ * Picks the worker which handles a frame from the guest.
+ *
+ * Everything addressed to the NAT network itself (DHCP, DNS proxy, TFTP, the
+ * host alias), broadcasts, multicasts, non-TCP/UDP traffic and replies from
+ * forwarded guest ports stays on the primary worker.  TCP and UDP traffic is
+ * distributed by the addresses, protocol and ports.
+ *
+ * Only the first fragment of a datagram carries the ports, so it records the
+ * worker in DRVNAT::aFrags for the others.  A later fragment arriving before
+ * the first one goes to every worker, the engines which don't get the rest
+ * drop it when reassembly times out.
  *
+ * @returns The worker index, UINT32_MAX if every worker needs to see the frame.
  * @param   pThis               Pointer to the NAT instance.
+ * @param   pbFrame             The frame.
+ * @param   cbFrame             The frame size.
+ */
+static uint32_t drvNATFrameWorker(PDRVNAT pThis, uint8_t const *pbFrame, size_t cbFrame)
+{
+    if (   pThis->cWorkers == 1
+        || cbFrame < sizeof(RTNETETHERHDR))
+        return 0;
+
+    PCRTNETETHERHDR pEthHdr = (PCRTNETETHERHDR)pbFrame;
+    if (pEthHdr->EtherType == RT_H2N_U16_C(RTNET_ETHERTYPE_ARP))
+    {
+        /* Replies teach the engines the guest's MAC address. */
+        PCRTNETARPHDR pArpHdr = (PCRTNETARPHDR)(pEthHdr + 1);
+        if (   cbFrame >= sizeof(*pEthHdr) + sizeof(*pArpHdr)
+            && pArpHdr->ar_oper == RT_H2N_U16_C(RTNET_ARPOP_REPLY))
+            return UINT32_MAX;
+        return 0;
+    }
+    if (   pEthHdr->EtherType != RT_H2N_U16_C(RTNET_ETHERTYPE_IPV4)
+        || cbFrame < sizeof(*pEthHdr) + RTNETIPV4_MIN_LEN)
+        return 0;
+
+    PCRTNETIPV4 pIpHdr = (PCRTNETIPV4)(pEthHdr + 1);
+    uint32_t const cbIpHdr = pIpHdr->ip_hl * 4;
+    uint32_t const u32Dst  = RT_N2H_U32(pIpHdr->ip_dst.u);
+    if (   cbIpHdr < RTNETIPV4_MIN_LEN
+        || cbFrame < sizeof(*pEthHdr) + cbIpHdr
+        || (pIpHdr->ip_dst.u & pThis->u32Netmask) == pThis->u32Network
+        || u32Dst == UINT32_MAX
+        || (u32Dst & UINT32_C(0xf0000000)) == UINT32_C(0xe0000000))
+        return 0;
+
+    if (   pIpHdr->ip_p != RTNETIPV4_PROT_TCP
+        && pIpHdr->ip_p != RTNETIPV4_PROT_UDP)
+        return 0;
+
+    uint16_t const  u16Off     = RT_N2H_U16(pIpHdr->ip_off);
+    bool const      fFirstFrag = (u16Off & UINT16_C(0x1fff)) == 0;
+    bool const      fMoreFrags = RT_BOOL(u16Off & UINT16_C(0x2000) /* MF */);
+    uint32_t const  iFrag      = (RT_N2H_U16(pIpHdr->ip_id) ^ (pIpHdr->ip_src.u >> 24)) % RT_ELEMENTS(pThis->aFrags);
+    if (!fFirstFrag)
+    {
+        if (   pThis->aFrags[iFrag].u16Id   != pIpHdr->ip_id
+            || pThis->aFrags[iFrag].u32Src  != pIpHdr->ip_src.u
+            || pThis->aFrags[iFrag].u32Dst  != pIpHdr->ip_dst.u
+            || pThis->aFrags[iFrag].u8Proto != pIpHdr->ip_p)
+            return UINT32_MAX;
+        uint32_t const iWorker = pThis->aFrags[iFrag].iWorker;
+        if (!fMoreFrags)
+            pThis->aFrags[iFrag].u8Proto = 0; /* the last one */
+        return iWorker;
+    }
+    if (cbFrame < sizeof(*pEthHdr) + cbIpHdr + 4 /* ports */)
+        return 0;
+
+    /* TCP and UDP both start with the source and destination ports. */
+    uint16_t const *pu16Ports = (uint16_t const *)((uint8_t const *)pIpHdr + cbIpHdr);
+    uint32_t const *pbmForwarded = pIpHdr->ip_p == RTNETIPV4_PROT_TCP ? &pThis->bmTcpForwarded[0] : &pThis->bmUdpForwarded[0];
+    uint32_t iWorker = 0;
+    if (!ASMBitTest(pbmForwarded, RT_N2H_U16(pu16Ports[0])))
+    {
+        uint32_t uHash = pIpHdr->ip_src.u
+                       ^ (pIpHdr->ip_dst.u << 16 | pIpHdr->ip_dst.u >> 16)
+                       ^ ((uint32_t)pu16Ports[0] << 16 | pu16Ports[1])
+                       ^ pIpHdr->ip_p;
+        uHash *= UINT32_C(0x9e3779b1);
+        iWorker = (uHash ^ (uHash >> 16)) % pThis->cWorkers;
+    }
+
+    if (fMoreFrags)
+    {
+        pThis->aFrags[iFrag].u32Src  = pIpHdr->ip_src.u;
+        pThis->aFrags[iFrag].u32Dst  = pIpHdr->ip_dst.u;
+        pThis->aFrags[iFrag].u16Id   = pIpHdr->ip_id;
+        pThis->aFrags[iFrag].u8Proto = pIpHdr->ip_p;
+        pThis->aFrags[iFrag].iWorker = (uint8_t)iWorker;
+    }
+    return iWorker;
+}
+
+/**
+ * Feeds a copy of a guest frame to a secondary worker.
+ *
+ * @param   pWorker             The worker.
+ * @param   m                   The mbuf, allocated from the worker's engine.
+ * @param   cbFrame             The frame size.
+ * @thread  NAT
+ */
+static void drvNATInputWorker(PDRVNATWORKER pWorker, struct mbuf *m, size_t cbFrame)
+{
+    if (pWorker->enmLinkState == PDMNETWORKLINKSTATE_UP)
+        slirp_input(pWorker->pNATState, m, cbFrame);
+    else
+        slirp_ext_m_free(pWorker->pNATState, m, NULL);
+}
+
+/**
+ * Worker function for drvNATSend().
+ *
+ * @param   pWorker             The worker the frame was routed to.
  * @param   pSgBuf              The scatter/gather buffer.
  * @thread  NAT
  */
-static void drvNATSendWorker(PDRVNAT pThis, PPDMSCATTERGATHER pSgBuf)
+static void drvNATSendWorker(PDRVNATWORKER pWorker, PPDMSCATTERGATHER pSgBuf)
 {
-    Assert(pThis->enmLinkState == PDMNETWORKLINKSTATE_UP);
-    if (pThis->enmLinkState == PDMNETWORKLINKSTATE_UP)
+    PDRVNAT pThis = pWorker->pThis;
+    STAM_COUNTER_INC(&pThis->aStatWorkerFramesIn[pWorker->iWorker]);
+    Assert(pWorker->enmLinkState == PDMNETWORKLINKSTATE_UP);
+    if (pWorker->enmLinkState == PDMNETWORKLINKSTATE_UP)
     {
         struct mbuf *m = (struct mbuf *)pSgBuf->pvAllocator;
         if (m)
         {
             /*
-             * A normal frame.
+             * A normal frame.  The buffer comes from the primary engine, the
+             * other workers have to take a copy as mbufs can't change zones.
              */
             pSgBuf->pvAllocator = NULL;
-            slirp_input(pThis->pNATState, m, pSgBuf->cbUsed);
+            if (pWorker->iWorker != 0)
+            {
+                struct mbuf *mPrimary = m;
+                m = drvNATWorkerDupFrame(pWorker, pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed);
+                slirp_ext_m_free(pThis->pNATState, mPrimary, NULL);
+            }
+            if (m)
+                slirp_input(pWorker->pNATState, m, pSgBuf->cbUsed);
         }
         else
         {
@@ -400,7 +607,7 @@ static void drvNATSendWorker(PDRVNAT pThis, PPDMSCATTERGATHER pSgBuf)
             {
                 size_t cbSeg;
                 void  *pvSeg;
-                m = slirp_ext_m_get(pThis->pNATState, pGso->cbHdrs + pGso->cbMaxSeg, &pvSeg, &cbSeg);
+                m = slirp_ext_m_get(pWorker->pNATState, pGso->cbHdrs + pGso->cbMaxSeg, &pvSeg, &cbSeg);
                 if (!m)
                     break;
 
@@ -410,14 +617,14 @@ static void drvNATSendWorker(PDRVNAT pThis, PPDMSCATTERGATHER pSgBuf)
                                                             iSeg, cSegs, (uint8_t *)pvSeg, &cbPayload);
                 memcpy((uint8_t *)pvSeg + pGso->cbHdrs, pbFrame + offPayload, cbPayload);
 
-                slirp_input(pThis->pNATState, m, cbPayload + pGso->cbHdrs);
+                slirp_input(pWorker->pNATState, m, cbPayload + pGso->cbHdrs);
 #else
                 uint32_t cbSegFrame;
                 void *pvSegFrame = PDMNetGsoCarveSegmentQD(pGso, (uint8_t *)pbFrame, pSgBuf->cbUsed, abHdrScratch,
                                                            iSeg, cSegs, &cbSegFrame);
                 memcpy((uint8_t *)pvSeg, pvSegFrame, cbSegFrame);
 
-                slirp_input(pThis->pNATState, m, cbSegFrame);
+                slirp_input(pWorker->pNATState, m, cbSegFrame);
 #endif
             }
         }
@@ -454,7 +661,7 @@ static DECLCALLBACK(int) drvNATNetworkUp_AllocBuf(PPDMINETWORKUP pInterface, siz
     /*
      * Drop the incoming frame if the NAT thread isn't running.
      */
-    if (pThis->pSlirpThread->enmState != PDMTHREADSTATE_RUNNING)
+    if (pThis->aWorkers[0].pSlirpThread->enmState != PDMTHREADSTATE_RUNNING)
     {
         Log(("drvNATNetowrkUp_AllocBuf: returns VERR_NET_NO_NETWORK\n"));
         return VERR_NET_NO_NETWORK;
@@ -528,21 +735,42 @@ static DECLCALLBACK(int) drvNATNetworkUp_SendBuf(PPDMINETWORKUP pInterface, PPDM
     Assert(RTCritSectIsOwner(&pThis->XmitLock));
 
     int rc;
-    if (pThis->pSlirpThread->enmState == PDMTHREADSTATE_RUNNING)
+    if (pThis->aWorkers[0].pSlirpThread->enmState == PDMTHREADSTATE_RUNNING)
     {
         /* Set an FTM checkpoint as this operation changes the state permanently. */
         PDMDrvHlpFTSetCheckpoint(pThis->pDrvIns, FTMCHECKPOINTTYPE_NETWORK);
 
+        uint32_t iWorker = drvNATFrameWorker(pThis, (uint8_t const *)pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed);
+        if (iWorker == UINT32_MAX)
+        {
+            /* The secondary engines get copies, the original goes to the primary. */
+            for (uint32_t i = 1; i < pThis->cWorkers; i++)
+            {
+                PDRVNATWORKER pOther = &pThis->aWorkers[i];
+                struct mbuf  *m      = drvNATWorkerDupFrame(pOther, pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed);
+                if (!m)
+                    continue;
+                rc = RTReqCallEx(pOther->pSlirpReqQueue, NULL /*ppReq*/, 0 /*cMillies*/, RTREQFLAGS_VOID | RTREQFLAGS_NO_WAIT,
+                                 (PFNRT)drvNATInputWorker, 3, pOther, m, pSgBuf->cbUsed);
+                if (RT_SUCCESS(rc))
+                    drvNATNotifyNATThread(pOther, "drvNATNetworkUp_SendBuf");
+                else
+                    slirp_ext_m_free(pOther->pNATState, m, NULL);
+            }
+            iWorker = 0;
+        }
+        PDRVNATWORKER pWorker = &pThis->aWorkers[iWorker];
+
 #ifdef VBOX_WITH_SLIRP_MT
-        PRTREQQUEUE pQueue = (PRTREQQUEUE)slirp_get_queue(pThis->pNATState);
+        PRTREQQUEUE pQueue = (PRTREQQUEUE)slirp_get_queue(pWorker->pNATState);
 #else
-        PRTREQQUEUE pQueue = pThis->pSlirpReqQueue;
+        PRTREQQUEUE pQueue = pWorker->pSlirpReqQueue;
 #endif
         rc = RTReqCallEx(pQueue, NULL /*ppReq*/, 0 /*cMillies*/, RTREQFLAGS_VOID | RTREQFLAGS_NO_WAIT,
-                         (PFNRT)drvNATSendWorker, 2, pThis, pSgBuf);
+                         (PFNRT)drvNATSendWorker, 2, pWorker, pSgBuf);
         if (RT_SUCCESS(rc))
         {
-            drvNATNotifyNATThread(pThis, "drvNATNetworkUp_SendBuf");
+            drvNATNotifyNATThread(pWorker, "drvNATNetworkUp_SendBuf");
             return VINF_SUCCESS;
         }
 
@@ -566,16 +794,16 @@ static DECLCALLBACK(void) drvNATNetworkUp_EndXmit(PPDMINETWORKUP pInterface)
 /**
  * Get the NAT thread out of poll/WSAWaitForMultipleEvents
  */
-static void drvNATNotifyNATThread(PDRVNAT pThis, const char *pszWho)
+static void drvNATNotifyNATThread(PDRVNATWORKER pWorker, const char *pszWho)
 {
     int rc;
 #ifndef RT_OS_WINDOWS
     /* kick poll() */
     size_t cbIgnored;
-    rc = RTPipeWrite(pThis->hPipeWrite, "", 1, &cbIgnored);
+    rc = RTPipeWrite(pWorker->hPipeWrite, "", 1, &cbIgnored);
 #else
     /* kick WSAWaitForMultipleEvents */
-    rc = WSASetEvent(pThis->hWakeupEvent);
+    rc = WSASetEvent(pWorker->hWakeupEvent);
 #endif
     AssertRC(rc);
 }
@@ -593,20 +821,25 @@ static DECLCALLBACK(void) drvNATNetworkUp_SetPromiscuousMode(PPDMINETWORKUP pInt
  * Worker function for drvNATNetworkUp_NotifyLinkChanged().
  * @thread "NAT" thread.
  */
-static void drvNATNotifyLinkChangedWorker(PDRVNAT pThis, PDMNETWORKLINKSTATE enmLinkState)
+static void drvNATNotifyLinkChangedWorker(PDRVNATWORKER pWorker, PDMNETWORKLINKSTATE enmLinkState)
 {
-    pThis->enmLinkState = pThis->enmLinkStateWant = enmLinkState;
+    PDRVNAT pThis = pWorker->pThis;
+    pWorker->enmLinkState = enmLinkState;
+    if (pWorker->iWorker == 0)
+        pThis->enmLinkState = pThis->enmLinkStateWant = enmLinkState;
     switch (enmLinkState)
     {
         case PDMNETWORKLINKSTATE_UP:
-            LogRel(("NAT: link up\n"));
-            slirp_link_up(pThis->pNATState);
+            if (pWorker->iWorker == 0)
+                LogRel(("NAT: link up\n"));
+            slirp_link_up(pWorker->pNATState);
             break;
 
         case PDMNETWORKLINKSTATE_DOWN:
         case PDMNETWORKLINKSTATE_DOWN_RESUME:
-            LogRel(("NAT: link down\n"));
-            slirp_link_down(pThis->pNATState);
+            if (pWorker->iWorker == 0)
+                LogRel(("NAT: link down\n"));
+            slirp_link_down(pWorker->pNATState);
             break;
 
         default:
@@ -629,24 +862,29 @@ static DECLCALLBACK(void) drvNATNetworkUp_NotifyLinkChanged(PPDMINETWORKUP pInte
 
     /* Don't queue new requests when the NAT thread is about to stop.
      * But the VM could also be paused. So memorize the desired state. */
-    if (pThis->pSlirpThread->enmState != PDMTHREADSTATE_RUNNING)
+    if (pThis->aWorkers[0].pSlirpThread->enmState != PDMTHREADSTATE_RUNNING)
     {
         pThis->enmLinkStateWant = enmLinkState;
         return;
     }
 
-    PRTREQ pReq;
-    int rc = RTReqCallEx(pThis->pSlirpReqQueue, &pReq, 0 /*cMillies*/, RTREQFLAGS_VOID,
-                         (PFNRT)drvNATNotifyLinkChangedWorker, 2, pThis, enmLinkState);
-    if (RT_LIKELY(rc == VERR_TIMEOUT))
+    /* Secondaries first so the primary's link-up log line comes last. */
+    for (uint32_t iWorker = pThis->cWorkers; iWorker-- > 0;)
     {
-        drvNATNotifyNATThread(pThis, "drvNATNetworkUp_NotifyLinkChanged");
-        rc = RTReqWait(pReq, RT_INDEFINITE_WAIT);
-        AssertRC(rc);
+        PDRVNATWORKER pWorker = &pThis->aWorkers[iWorker];
+        PRTREQ pReq;
+        int rc = RTReqCallEx(pWorker->pSlirpReqQueue, &pReq, 0 /*cMillies*/, RTREQFLAGS_VOID,
+                             (PFNRT)drvNATNotifyLinkChangedWorker, 2, pWorker, enmLinkState);
+        if (RT_LIKELY(rc == VERR_TIMEOUT))
+        {
+            drvNATNotifyNATThread(pWorker, "drvNATNetworkUp_NotifyLinkChanged");
+            rc = RTReqWait(pReq, RT_INDEFINITE_WAIT);
+            AssertRC(rc);
+        }
+        else
+            AssertRC(rc);
+        RTReqFree(pReq);
     }
-    else
-        AssertRC(rc);
-    RTReqFree(pReq);
 }
 
 static void drvNATNotifyApplyPortForwardCommand(PDRVNAT pThis, bool fRemove,
@@ -671,7 +909,12 @@ static void drvNATNotifyApplyPortForwardCommand(PDRVNAT pThis, bool fRemove,
     if (fRemove)
         slirp_remove_redirect(pThis->pNATState, fUdp, hostIp, u16HostPort, guestIp, u16GuestPort);
     else
+    {
+        /* Keep the flows of this port on the primary worker which owns the rules.
+         * The bit isn't cleared on removal, another rule may use the same port. */
+        ASMAtomicBitSet(fUdp ? &pThis->bmUdpForwarded[0] : &pThis->bmTcpForwarded[0], u16GuestPort);
         slirp_add_redirect(pThis->pNATState, fUdp, hostIp, u16HostPort, guestIp, u16GuestPort, Mac.au8);
+    }
 }
 
 DECLCALLBACK(int) drvNATNetworkNatConfig_RedirectRuleCommand(PPDMINETWORKNATCONFIG pInterface, bool fRemove,
@@ -683,12 +926,12 @@ DECLCALLBACK(int) drvNATNetworkNatConfig_RedirectRuleCommand(PPDMINETWORKNATCONF
                  u16GuestPort));
     PDRVNAT pThis = RT_FROM_MEMBER(pInterface, DRVNAT, INetworkNATCfg);
     PRTREQ pReq;
-    int rc = RTReqCallEx(pThis->pSlirpReqQueue, &pReq, 0 /*cMillies*/, RTREQFLAGS_VOID,
+    int rc = RTReqCallEx(pThis->aWorkers[0].pSlirpReqQueue, &pReq, 0 /*cMillies*/, RTREQFLAGS_VOID,
                          (PFNRT)drvNATNotifyApplyPortForwardCommand, 7, pThis, fRemove,
                          fUdp, pHostIp, u16HostPort, pGuestIp, u16GuestPort);
     if (RT_LIKELY(rc == VERR_TIMEOUT))
     {
-        drvNATNotifyNATThread(pThis, "drvNATNetworkNatConfig_RedirectRuleCommand");
+        drvNATNotifyNATThread(&pThis->aWorkers[0], "drvNATNetworkNatConfig_RedirectRuleCommand");
         rc = RTReqWait(pReq, RT_INDEFINITE_WAIT);
         AssertRC(rc);
     }
@@ -712,22 +955,27 @@ DECLCALLBACK(int) drvNATNetworkNatConfig_RedirectRuleCommand(PPDMINETWORKNATCONF
  */
 static DECLCALLBACK(int) drvNATAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThread)
 {
-    PDRVNAT pThis = PDMINS_2_DATA(pDrvIns, PDRVNAT);
+    PDRVNATWORKER pWorker = (PDRVNATWORKER)pThread->pvUser;
+    PDRVNAT pThis = pWorker->pThis;
     int     nFDs = -1;
 #ifdef RT_OS_WINDOWS
-    HANDLE  *phEvents = slirp_get_events(pThis->pNATState);
+    HANDLE  *phEvents = slirp_get_events(pWorker->pNATState);
     unsigned int cBreak = 0;
 #else /* RT_OS_WINDOWS */
     unsigned int cPollNegRet = 0;
 #endif /* !RT_OS_WINDOWS */
+#ifdef RT_OS_LINUX
+    struct epoll_event aEvents[SLIRP_EPOLL_MAX_EVENTS];
+    int iEpollFd = slirp_get_epoll_fd(pWorker->pNATState);
+#endif
 
-    LogFlow(("drvNATAsyncIoThread: pThis=%p\n", pThis));
+    LogFlow(("drvNATAsyncIoThread: pThis=%p iWorker=%u\n", pThis, pWorker->iWorker));
 
     if (pThread->enmState == PDMTHREADSTATE_INITIALIZING)
         return VINF_SUCCESS;
 
-    if (pThis->enmLinkStateWant != pThis->enmLinkState)
-        drvNATNotifyLinkChangedWorker(pThis, pThis->enmLinkStateWant);
+    if (pThis->enmLinkStateWant != pWorker->enmLinkState)
+        drvNATNotifyLinkChangedWorker(pWorker, pThis->enmLinkStateWant);
 
     /*
      * Polling loop.
@@ -737,22 +985,64 @@ static DECLCALLBACK(int) drvNATAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
         /*
          * To prevent concurrent execution of sending/receiving threads
          */
+#ifdef RT_OS_LINUX
+        if (iEpollFd != -1)
+        {
+            /* only registration changes, the wakeup pipe is part of the set */
+            slirp_select_fill_epoll(pWorker->pNATState);
+
+            int cEvents = epoll_wait(iEpollFd, &aEvents[0], RT_ELEMENTS(aEvents),
+                                     slirp_get_timeout_ms(pWorker->pNATState));
+            if (cEvents < 0)
+            {
+                if (errno == EINTR)
+                {
+                    Log2(("NAT: signal was caught while sleep on epoll_wait\n"));
+                    cEvents = 0;
+                }
+                else if (cPollNegRet++ > 128)
+                {
+                    LogRel(("NAT:epoll_wait returns (%s) suppressed %d\n", strerror(errno), cPollNegRet));
+                    cPollNegRet = 0;
+                }
+            }
+
+            STAM_PROFILE_START(&pThis->aStatWorkerBusy[pWorker->iWorker], a);
+            if (cEvents >= 0)
+            {
+                slirp_select_poll_epoll(pWorker->pNATState, &aEvents[0], cEvents);
+                for (int i = 0; i < cEvents; i++)
+                    if (aEvents[i].data.ptr == NULL)
+                    {
+                        /* drain the pipe, see below */
+                        char ch;
+                        size_t cbRead;
+                        RTPipeRead(pWorker->hPipeRead, &ch, 1, &cbRead);
+                        break;
+                    }
+            }
+            /* process _all_ outstanding requests but don't wait */
+            RTReqProcess(pWorker->pSlirpReqQueue, 0);
+            STAM_PROFILE_STOP(&pThis->aStatWorkerBusy[pWorker->iWorker], a);
+            continue;
+        }
+#endif
 #ifndef RT_OS_WINDOWS
-        nFDs = slirp_get_nsock(pThis->pNATState);
+        nFDs = slirp_get_nsock(pWorker->pNATState);
         /* allocation for all sockets + Management pipe */
         struct pollfd *polls = (struct pollfd *)RTMemAlloc((1 + nFDs) * sizeof(struct pollfd) + sizeof(uint32_t));
         if (polls == NULL)
             return VERR_NO_MEMORY;
 
         /* don't pass the management pipe */
-        slirp_select_fill(pThis->pNATState, &nFDs, &polls[1]);
+        slirp_select_fill(pWorker->pNATState, &nFDs, &polls[1]);
 
-        polls[0].fd = RTPipeToNative(pThis->hPipeRead);
+        polls[0].fd = RTPipeToNative(pWorker->hPipeRead);
         /* POLLRDBAND usually doesn't used on Linux but seems used on Solaris */
         polls[0].events = POLLRDNORM | POLLPRI | POLLRDBAND;
         polls[0].revents = 0;
 
-        int cChangedFDs = poll(polls, nFDs + 1, slirp_get_timeout_ms(pThis->pNATState));
+        int cChangedFDs = poll(polls, nFDs + 1, slirp_get_timeout_ms(pWorker->pNATState));
         if (cChangedFDs < 0)
         {
             if (errno == EINTR)
@@ -768,9 +1058,10 @@ static DECLCALLBACK(int) drvNATAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
             }
         }
 
+        STAM_PROFILE_START(&pThis->aStatWorkerBusy[pWorker->iWorker], a);
         if (cChangedFDs >= 0)
         {
-            slirp_select_poll(pThis->pNATState, &polls[1], nFDs);
+            slirp_select_poll(pWorker->pNATState, &polls[1], nFDs);
             if (polls[0].revents & (POLLRDNORM|POLLPRI|POLLRDBAND))
             {
                 /* drain the pipe
@@ -787,18 +1078,19 @@ static DECLCALLBACK(int) drvNATAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
                  * pipe.*/
                 char ch;
                 size_t cbRead;
-                RTPipeRead(pThis->hPipeRead, &ch, 1, &cbRead);
+                RTPipeRead(pWorker->hPipeRead, &ch, 1, &cbRead);
             }
         }
         /* process _all_ outstanding requests but don't wait */
-        RTReqProcess(pThis->pSlirpReqQueue, 0);
+        RTReqProcess(pWorker->pSlirpReqQueue, 0);
+        STAM_PROFILE_STOP(&pThis->aStatWorkerBusy[pWorker->iWorker], a);
         RTMemFree(polls);
 
 #else /* RT_OS_WINDOWS */
         nFDs = -1;
-        slirp_select_fill(pThis->pNATState, &nFDs);
+        slirp_select_fill(pWorker->pNATState, &nFDs);
         DWORD dwEvent = WSAWaitForMultipleEvents(nFDs, phEvents, FALSE,
-                                                 slirp_get_timeout_ms(pThis->pNATState),
+                                                 slirp_get_timeout_ms(pWorker->pNATState),
                                                  FALSE);
         if (   (dwEvent < WSA_WAIT_EVENT_0 || dwEvent > WSA_WAIT_EVENT_0 + nFDs - 1)
             && dwEvent != WSA_WAIT_TIMEOUT)
@@ -811,14 +1103,16 @@ static DECLCALLBACK(int) drvNATAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
         if (dwEvent == WSA_WAIT_TIMEOUT)
         {
             /* only check for slow/fast timers */
-            slirp_select_poll(pThis->pNATState, /* fTimeout=*/true, /*fIcmp=*/false);
+            slirp_select_poll(pWorker->pNATState, /* fTimeout=*/true, /*fIcmp=*/false);
             continue;
         }
         /* poll the sockets in any case */
         Log2(("%s: poll\n", __FUNCTION__));
-        slirp_select_poll(pThis->pNATState, /* fTimeout=*/false, /* fIcmp=*/(dwEvent == WSA_WAIT_EVENT_0));
+        STAM_PROFILE_START(&pThis->aStatWorkerBusy[pWorker->iWorker], a);
+        slirp_select_poll(pWorker->pNATState, /* fTimeout=*/false, /* fIcmp=*/(dwEvent == WSA_WAIT_EVENT_0));
         /* process _all_ outstanding requests but don't wait */
-        RTReqProcess(pThis->pSlirpReqQueue, 0);
+        RTReqProcess(pWorker->pSlirpReqQueue, 0);
+        STAM_PROFILE_STOP(&pThis->aStatWorkerBusy[pWorker->iWorker], a);
 # ifdef VBOX_NAT_DELAY_HACK
         if (cBreak++ > 128)
         {
@@ -842,9 +1136,9 @@ static DECLCALLBACK(int) drvNATAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
  */
 static DECLCALLBACK(int) drvNATAsyncIoWakeup(PPDMDRVINS pDrvIns, PPDMTHREAD pThread)
 {
-    PDRVNAT pThis = PDMINS_2_DATA(pDrvIns, PDRVNAT);
+    PDRVNATWORKER pWorker = (PDRVNATWORKER)pThread->pvUser;
 
-    drvNATNotifyNATThread(pThis, "drvNATAsyncIoWakeup");
+    drvNATNotifyNATThread(pWorker, "drvNATAsyncIoWakeup");
     return VINF_SUCCESS;
 }
 
@@ -885,25 +1179,27 @@ int slirp_can_output(void *pvUser)
 
 void slirp_push_recv_thread(void *pvUser)
 {
-    PDRVNAT pThis = (PDRVNAT)pvUser;
+    PDRVNAT pThis = ((PDRVNATWORKER)pvUser)->pThis;
     Assert(pThis);
     drvNATUrgRecvWakeup(pThis->pDrvIns, pThis->pUrgRecvThread);
 }
 
 void slirp_urg_output(void *pvUser, struct mbuf *m, const uint8_t *pu8Buf, int cb)
 {
-    PDRVNAT pThis = (PDRVNAT)pvUser;
-    Assert(pThis);
+    PDRVNATWORKER pWorker = (PDRVNATWORKER)pvUser;
+    Assert(pWorker);
+    PDRVNAT pThis = pWorker->pThis;
 
     PRTREQ pReq = NULL;
 
     /* don't queue new requests when the NAT thread is about to stop */
-    if (pThis->pSlirpThread->enmState != PDMTHREADSTATE_RUNNING)
+    if (pWorker->pSlirpThread->enmState != PDMTHREADSTATE_RUNNING)
         return;
 
+    STAM_COUNTER_INC(&pThis->aStatWorkerFramesOut[pWorker->iWorker]);
     ASMAtomicIncU32(&pThis->cUrgPkts);
     int rc = RTReqCallEx(pThis->pUrgRecvReqQueue, NULL /*ppReq*/, 0 /*cMillies*/, RTREQFLAGS_VOID | RTREQFLAGS_NO_WAIT,
-                         (PFNRT)drvNATUrgRecvWorker, 4, pThis, pu8Buf, cb, m);
+                         (PFNRT)drvNATUrgRecvWorker, 4, pWorker, pu8Buf, cb, m);
     AssertRC(rc);
     drvNATUrgRecvWakeup(pThis->pDrvIns, pThis->pUrgRecvThread);
 }
@@ -913,7 +1209,7 @@ void slirp_urg_output(void *pvUser, struct mbuf *m, const uint8_t *pu8Buf, int c
  */
 void slirp_output_pending(void *pvUser)
 {
-    PDRVNAT pThis = (PDRVNAT)pvUser;
+    PDRVNAT pThis = ((PDRVNATWORKER)pvUser)->pThis;
     Assert(pThis);
     pThis->pIAboveNet->pfnXmitPending(pThis->pIAboveNet);
 }
@@ -923,8 +1219,9 @@ void slirp_output_pending(void *pvUser)
  */
 void slirp_output(void *pvUser, struct mbuf *m, const uint8_t *pu8Buf, int cb)
 {
-    PDRVNAT pThis = (PDRVNAT)pvUser;
-    Assert(pThis);
+    PDRVNATWORKER pWorker = (PDRVNATWORKER)pvUser;
+    Assert(pWorker);
+    PDRVNAT pThis = pWorker->pThis;
 
     LogFlow(("slirp_output BEGIN %x %d\n", pu8Buf, cb));
     Log2(("slirp_output: pu8Buf=%p cb=%#x (pThis=%p)\n%.*Rhxd\n", pu8Buf, cb, pThis, cb, pu8Buf));
@@ -932,12 +1229,13 @@ void slirp_output(void *pvUser, struct mbuf *m, const uint8_t *pu8Buf, int cb)
     PRTREQ pReq = NULL;
 
     /* don't queue new requests when the NAT thread is about to stop */
-    if (pThis->pSlirpThread->enmState != PDMTHREADSTATE_RUNNING)
+    if (pWorker->pSlirpThread->enmState != PDMTHREADSTATE_RUNNING)
         return;
 
+    STAM_COUNTER_INC(&pThis->aStatWorkerFramesOut[pWorker->iWorker]);
     ASMAtomicIncU32(&pThis->cPkts);
     int rc = RTReqCallEx(pThis->pRecvReqQueue, NULL /*ppReq*/, 0 /*cMillies*/, RTREQFLAGS_VOID | RTREQFLAGS_NO_WAIT,
-                         (PFNRT)drvNATRecvWorker, 4, pThis, pu8Buf, cb, m);
+                         (PFNRT)drvNATRecvWorker, 4, pWorker, pu8Buf, cb, m);
     AssertRC(rc);
     drvNATRecvWakeup(pThis->pDrvIns, pThis->pRecvThread);
     STAM_COUNTER_INC(&pThis->StatQueuePktSent);
@@ -971,7 +1269,8 @@ static void drvNATSetMac(PDRVNAT pThis)
         RTMAC Mac;
         pThis->pIAboveConfig->pfnGetMac(pThis->pIAboveConfig, &Mac);
         /* Re-activate the port forwarding. If  */
-        slirp_set_ethaddr_and_activate_port_forwarding(pThis->pNATState, Mac.au8, pThis->GuestIP);
+        for (uint32_t iWorker = 0; iWorker < pThis->cWorkers; iWorker++)
+            slirp_set_ethaddr_and_activate_port_forwarding(pThis->aWorkers[iWorker].pNATState, Mac.au8, pThis->GuestIP);
     }
 }
 
@@ -1009,7 +1308,7 @@ static DECLCALLBACK(void) drvNATInfo(PPDMDRVINS pDrvIns, PCDBGFINFOHLP pHlp, con
 }
 
 #ifdef VBOX_WITH_DNSMAPPING_IN_HOSTRESOLVER
-static int drvNATConstructDNSMappings(unsigned iInstance, PDRVNAT pThis, PCFGMNODE pMappingsCfg)
+static int drvNATConstructDNSMappings(unsigned iInstance, PDRVNAT pThis, PNATState pNATState, PCFGMNODE pMappingsCfg)
 {
     int rc = VINF_SUCCESS;
     LogFlowFunc(("ENTER: iInstance:%d\n", iInstance));
@@ -1043,7 +1342,7 @@ static int drvNATConstructDNSMappings(unsigned iInstance, PDRVNAT pThis, PCFGMNO
             LogRel(("NAT: DNS mapping %s is ignored (address not pointed)\n", szHostNameOrPattern));
             continue;
         }
-        slirp_add_host_resolver_mapping(pThis->pNATState, fMatch ? NULL : szHostNameOrPattern, fMatch ? szHostNameOrPattern : NULL, HostIP.s_addr);
+        slirp_add_host_resolver_mapping(pNATState, fMatch ? NULL : szHostNameOrPattern, fMatch ? szHostNameOrPattern : NULL, HostIP.s_addr);
     }
     LogFlowFunc(("LEAVE: %Rrc\n", rc));
     return rc;
@@ -1129,6 +1428,7 @@ static int drvNATConstructRedir(unsigned iInstance, PDRVNAT pThis, PCFGMNODE pCf
          */
         struct in_addr BindIP;
         GETIP_DEF(rc, pThis, pNode, BindIP, INADDR_ANY);
+        ASMAtomicBitSet(fUDP ? &pThis->bmUdpForwarded[0] : &pThis->bmTcpForwarded[0], (uint16_t)iGuestPort);
         if (slirp_add_redirect(pThis->pNATState, fUDP, BindIP, iHostPort, GuestIP, iGuestPort, Mac.au8) < 0)
             return PDMDrvHlpVMSetError(pThis->pDrvIns, VERR_NAT_REDIR_SETUP, RT_SRC_POS,
                                        N_("NAT#%d: configuration error: failed to set up "
@@ -1155,6 +1455,13 @@ static DECLCALLBACK(void) drvNATDestruct(PPDMDRVINS pDrvIns)
     LogFlow(("drvNATDestruct:\n"));
     PDMDRV_CHECK_VERSIONS_RETURN_VOID(pDrvIns);
 
+    for (uint32_t iWorker = 1; iWorker < RT_ELEMENTS(pThis->aWorkers); iWorker++)
+        if (pThis->aWorkers[iWorker].pNATState)
+        {
+            slirp_term(pThis->aWorkers[iWorker].pNATState);
+            pThis->aWorkers[iWorker].pNATState = NULL;
+        }
+
     if (pThis->pNATState)
     {
         slirp_term(pThis->pNATState);
@@ -1163,12 +1470,22 @@ static DECLCALLBACK(void) drvNATDestruct(PPDMDRVINS pDrvIns)
 # define DRV_PROFILE_COUNTER(name, dsc)     DEREGISTER_COUNTER(name, pThis)
 # define DRV_COUNTING_COUNTER(name, dsc)    DEREGISTER_COUNTER(name, pThis)
 # include "counters.h"
+        for (uint32_t iWorker = 0; iWorker < pThis->cWorkers; iWorker++)
+        {
+            PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->aStatWorkerFramesIn[iWorker]);
+            PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->aStatWorkerFramesOut[iWorker]);
+            PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->aStatWorkerBusy[iWorker]);
+        }
 #endif
         pThis->pNATState = NULL;
+        pThis->aWorkers[0].pNATState = NULL;
     }
 
-    RTReqDestroyQueue(pThis->pSlirpReqQueue);
-    pThis->pSlirpReqQueue = NULL;
+    for (uint32_t iWorker = 0; iWorker < RT_ELEMENTS(pThis->aWorkers); iWorker++)
+    {
+        RTReqDestroyQueue(pThis->aWorkers[iWorker].pSlirpReqQueue);
+        pThis->aWorkers[iWorker].pSlirpReqQueue = NULL;
+    }
 
     RTReqDestroyQueue(pThis->pUrgRecvReqQueue);
     pThis->pUrgRecvReqQueue = NULL;
@@ -1208,6 +1525,8 @@ static DECLCALLBACK(int) drvNATConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
                               "SockRcv\0SockSnd\0TcpRcv\0TcpSnd\0"
                               "ICMPCacheLimit\0"
                               "SoMaxConnection\0"
+                              "UseEpoll\0"
+                              "Workers\0"
 #ifdef VBOX_WITH_DNSMAPPING_IN_HOSTRESOLVER
                               "HostResolverMappings\0"
 #endif
@@ -1224,7 +1543,6 @@ static DECLCALLBACK(int) drvNATConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
     pThis->pszTFTPPrefix                = NULL;
     pThis->pszBootFile                  = NULL;
     pThis->pszNextServer                = NULL;
-    pThis->pSlirpReqQueue               = NULL;
     pThis->pUrgRecvReqQueue             = NULL;
     pThis->EventRecv                    = NIL_RTSEMEVENT;
     pThis->EventUrgRecv                 = NIL_RTSEMEVENT;
@@ -1272,6 +1590,37 @@ static DECLCALLBACK(int) drvNATConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
     i32AliasMode |= (i32MainAliasMode & 0x4 ? 0x4 : 0);
     int i32SoMaxConn = 10;
     GET_S32(rc, pThis, pCfg, "SoMaxConnection", i32SoMaxConn);
+    /** @cfgm{UseEpoll, boolean, true}
+     * Whether the NAT thread waits on an epoll set with persistent socket
+     * registrations instead of rebuilding a pollfd array each round (Linux only). */
+    bool fUseEpoll = true;
+    GET_BOOL(rc, pThis, pCfg, "UseEpoll", fUseEpoll);
+    /** @cfgm{Workers, integer, 1}
+     * Number of NAT threads, each with its own slirp engine.  TCP and UDP flows
+     * to the outside are spread over them by connection hash, everything else
+     * is handled by the first one. */
+    int32_t cWorkers = 1;
+    GET_S32(rc, pThis, pCfg, "Workers", cWorkers);
+    if (cWorkers < 1 || cWorkers > DRVNAT_MAX_WORKERS)
+        return PDMDrvHlpVMSetError(pDrvIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("NAT#%d: configuration error: \"Workers\" must be between 1 and %u"),
+                                   pDrvIns->iInstance, DRVNAT_MAX_WORKERS);
+#ifdef VBOX_WITH_SLIRP_MT
+    cWorkers = 1;
+#endif
+    pThis->cWorkers = cWorkers;
+    for (uint32_t iWorker = 0; iWorker < RT_ELEMENTS(pThis->aWorkers); iWorker++)
+    {
+        PDRVNATWORKER pWorker = &pThis->aWorkers[iWorker];
+        pWorker->pThis          = pThis;
+        pWorker->iWorker        = iWorker;
+        pWorker->pNATState      = NULL;
+        pWorker->pSlirpReqQueue = NULL;
+#ifndef RT_OS_WINDOWS
+        pWorker->hPipeRead      = NIL_RTPIPE;
+        pWorker->hPipeWrite     = NIL_RTPIPE;
+#endif
+    }
     /*
      * Query the network port interface.
      */
@@ -1301,25 +1650,35 @@ static DECLCALLBACK(int) drvNATConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
         return PDMDrvHlpVMSetError(pDrvIns, rc, RT_SRC_POS, N_("NAT#%d: Configuration error: "
                                    "network '%s' describes not a valid IPv4 network"),
                                    pDrvIns->iInstance, szNetwork);
+    pThis->u32Network = RT_H2N_U32(Network);
+    pThis->u32Netmask = RT_H2N_U32(Netmask);
 
     /*
-     * Initialize slirp.
+     * Initialize slirp, one engine per worker.  The primary one is also
+     * known as pThis->pNATState and is the only one with port forwarding.
      */
-    rc = slirp_init(&pThis->pNATState, RT_H2N_U32(Network), Netmask,
-                    fPassDomain, !!fUseHostResolver, i32AliasMode,
-                    iIcmpCacheLimit, pThis);
-    if (RT_SUCCESS(rc))
+    rc = VINF_SUCCESS;
+    for (uint32_t iWorker = 0; iWorker < pThis->cWorkers && RT_SUCCESS(rc); iWorker++)
     {
-        slirp_set_dhcp_TFTP_prefix(pThis->pNATState, pThis->pszTFTPPrefix);
-        slirp_set_dhcp_TFTP_bootfile(pThis->pNATState, pThis->pszBootFile);
-        slirp_set_dhcp_next_server(pThis->pNATState, pThis->pszNextServer);
-        slirp_set_dhcp_dns_proxy(pThis->pNATState, !!fDNSProxy);
-        slirp_set_mtu(pThis->pNATState, MTU);
-        slirp_set_somaxconn(pThis->pNATState, i32SoMaxConn);
+        PDRVNATWORKER pWorker = &pThis->aWorkers[iWorker];
+        rc = slirp_init(&pWorker->pNATState, RT_H2N_U32(Network), Netmask,
+                        fPassDomain, !!fUseHostResolver, i32AliasMode,
+                        iIcmpCacheLimit, pWorker);
+        if (RT_FAILURE(rc))
+            break;
+        if (iWorker == 0)
+            pThis->pNATState = pWorker->pNATState;
+
+        slirp_set_dhcp_TFTP_prefix(pWorker->pNATState, pThis->pszTFTPPrefix);
+        slirp_set_dhcp_TFTP_bootfile(pWorker->pNATState, pThis->pszBootFile);
+        slirp_set_dhcp_next_server(pWorker->pNATState, pThis->pszNextServer);
+        slirp_set_dhcp_dns_proxy(pWorker->pNATState, !!fDNSProxy);
+        slirp_set_mtu(pWorker->pNATState, MTU);
+        slirp_set_somaxconn(pWorker->pNATState, i32SoMaxConn);
         char *pszBindIP = NULL;
         GET_STRING_ALLOC(rc, pThis, pCfg, "BindIP", pszBindIP);
-        rc = slirp_set_binding_address(pThis->pNATState, pszBindIP);
-        if (rc != 0)
+        rc = slirp_set_binding_address(pWorker->pNATState, pszBindIP);
+        if (rc != 0 && iWorker == 0)
             LogRel(("NAT: value of BindIP has been ignored\n"));
 
         if(pszBindIP != NULL)
@@ -1330,7 +1689,7 @@ static DECLCALLBACK(int) drvNATConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
                 int len = 0;                                    \
                 rc = CFGMR3QueryS32(pCfg, name, &len);    \
                 if (RT_SUCCESS(rc))                             \
-                    setter(pThis->pNATState, len);              \
+                    setter(pWorker->pNATState, len);            \
             } while(0)
 
         SLIRP_SET_TUNING_VALUE("SockRcv", slirp_set_rcvbuf);
@@ -1338,22 +1697,38 @@ static DECLCALLBACK(int) drvNATConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
         SLIRP_SET_TUNING_VALUE("TcpRcv", slirp_set_tcp_rcvspace);
         SLIRP_SET_TUNING_VALUE("TcpSnd", slirp_set_tcp_sndspace);
 
-        slirp_register_statistics(pThis->pNATState, pDrvIns);
-#ifdef VBOX_WITH_STATISTICS
-# define DRV_PROFILE_COUNTER(name, dsc)     REGISTER_COUNTER(name, pThis, STAMTYPE_PROFILE, STAMUNIT_TICKS_PER_CALL, dsc)
-# define DRV_COUNTING_COUNTER(name, dsc)    REGISTER_COUNTER(name, pThis, STAMTYPE_COUNTER, STAMUNIT_COUNT,          dsc)
-# include "counters.h"
-#endif
-
 #ifdef VBOX_WITH_DNSMAPPING_IN_HOSTRESOLVER
         PCFGMNODE pMappingsCfg = CFGMR3GetChild(pCfg, "HostResolverMappings");
 
         if (pMappingsCfg)
         {
-            rc = drvNATConstructDNSMappings(pDrvIns->iInstance, pThis, pMappingsCfg);
+            rc = drvNATConstructDNSMappings(pDrvIns->iInstance, pThis, pWorker->pNATState, pMappingsCfg);
             AssertRC(rc);
         }
 #endif
+        rc = VINF_SUCCESS;
+    }
+    if (RT_SUCCESS(rc))
+    {
+        slirp_register_statistics(pThis->pNATState, pDrvIns);
+#ifdef VBOX_WITH_STATISTICS
+# define DRV_PROFILE_COUNTER(name, dsc)     REGISTER_COUNTER(name, pThis, STAMTYPE_PROFILE, STAMUNIT_TICKS_PER_CALL, dsc)
+# define DRV_COUNTING_COUNTER(name, dsc)    REGISTER_COUNTER(name, pThis, STAMTYPE_COUNTER, STAMUNIT_COUNT,          dsc)
+# include "counters.h"
+        for (uint32_t iWorker = 0; iWorker < pThis->cWorkers; iWorker++)
+        {
+            PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->aStatWorkerFramesIn[iWorker], STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                                   STAMUNIT_COUNT, "Frames from the guest handled by this worker",
+                                   "/Drivers/NAT%u/Worker%u/FramesIn", pDrvIns->iInstance, iWorker);
+            PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->aStatWorkerFramesOut[iWorker], STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                                   STAMUNIT_COUNT, "Frames to the guest produced by this worker",
+                                   "/Drivers/NAT%u/Worker%u/FramesOut", pDrvIns->iInstance, iWorker);
+            PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->aStatWorkerBusy[iWorker], STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS,
+                                   STAMUNIT_TICKS_PER_CALL, "Time spent on socket events and requests",
+                                   "/Drivers/NAT%u/Worker%u/Busy", pDrvIns->iInstance, iWorker);
+        }
+#endif
+
         rc = drvNATConstructRedir(pDrvIns->iInstance, pThis, pCfg, Network);
         if (RT_SUCCESS(rc))
         {
@@ -1364,13 +1739,6 @@ static DECLCALLBACK(int) drvNATConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
             rc = PDMDrvHlpSSMRegisterLoadDone(pDrvIns, drvNATLoadDone);
             AssertRCReturn(rc, rc);
 
-            rc = RTReqCreateQueue(&pThis->pSlirpReqQueue);
-            if (RT_FAILURE(rc))
-            {
-                LogRel(("NAT: Can't create request queue\n"));
-                return rc;
-            }
-
             rc = RTReqCreateQueue(&pThis->pRecvReqQueue);
             if (RT_FAILURE(rc))
             {
@@ -1412,21 +1780,51 @@ static DECLCALLBACK(int) drvNATConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
             RTStrPrintf(szTmp, sizeof(szTmp), "nat%d", pDrvIns->iInstance);
             PDMDrvHlpDBGFInfoRegister(pDrvIns, szTmp, "NAT info.", drvNATInfo);
 
+            for (uint32_t iWorker = 0; iWorker < pThis->cWorkers; iWorker++)
+            {
+                PDRVNATWORKER pWorker = &pThis->aWorkers[iWorker];
+
+                rc = RTReqCreateQueue(&pWorker->pSlirpReqQueue);
+                if (RT_FAILURE(rc))
+                {
+                    LogRel(("NAT: Can't create request queue\n"));
+                    return rc;
+                }
+
 #ifndef RT_OS_WINDOWS
-            /*
-             * Create the control pipe.
-             */
-            rc = RTPipeCreate(&pThis->hPipeRead, &pThis->hPipeWrite, 0 /*fFlags*/);
-            AssertRCReturn(rc, rc);
+                /*
+                 * Create the control pipe.
+                 */
+                rc = RTPipeCreate(&pWorker->hPipeRead, &pWorker->hPipeWrite, 0 /*fFlags*/);
+                AssertRCReturn(rc, rc);
+# ifdef RT_OS_LINUX
+                if (fUseEpoll)
+                {
+                    int rc2 = slirp_epoll_enable(pWorker->pNATState, (int)RTPipeToNative(pWorker->hPipeRead));
+                    if (RT_FAILURE(rc2))
+                        LogRel(("NAT: epoll isn't available (%Rrc), falling back to poll\n", rc2));
+                }
+# endif
 #else
-            pThis->hWakeupEvent = CreateEvent(NULL, FALSE, FALSE, NULL); /* auto-reset event */
-            slirp_register_external_event(pThis->pNATState, pThis->hWakeupEvent,
-                                          VBOX_WAKEUP_EVENT_INDEX);
+                pWorker->hWakeupEvent = CreateEvent(NULL, FALSE, FALSE, NULL); /* auto-reset event */
+                slirp_register_external_event(pWorker->pNATState, pWorker->hWakeupEvent,
+                                              VBOX_WAKEUP_EVENT_INDEX);
 #endif
 
-            rc = PDMDrvHlpThreadCreate(pDrvIns, &pThis->pSlirpThread, pThis, drvNATAsyncIoThread,
-                                       drvNATAsyncIoWakeup, 128 * _1K, RTTHREADTYPE_IO, "NAT");
-            AssertRCReturn(rc, rc);
+                if (iWorker == 0)
+                    rc = PDMDrvHlpThreadCreate(pDrvIns, &pWorker->pSlirpThread, pWorker, drvNATAsyncIoThread,
+                                               drvNATAsyncIoWakeup, 128 * _1K, RTTHREADTYPE_IO, "NAT");
+                else
+                {
+                    char szName[16];
+                    RTStrPrintf(szName, sizeof(szName), "NAT%u", iWorker);
+                    rc = PDMDrvHlpThreadCreate(pDrvIns, &pWorker->pSlirpThread, pWorker, drvNATAsyncIoThread,
+                                               drvNATAsyncIoWakeup, 128 * _1K, RTTHREADTYPE_IO, szName);
+                }
+                AssertRCReturn(rc, rc);
+            }
+            if (pThis->cWorkers > 1)
+                LogRel(("NAT: sharding flows over %u workers\n", pThis->cWorkers));
 
 #ifdef VBOX_WITH_SLIRP_MT
             rc = PDMDrvHlpThreadCreate(pDrvIns, &pThis->pGuestThread, pThis, drvNATAsyncIoGuest,
@@ -1435,6 +1833,8 @@ static DECLCALLBACK(int) drvNATConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
 #endif
 
             pThis->enmLinkState = pThis->enmLinkStateWant = PDMNETWORKLINKSTATE_UP;
+            for (uint32_t iWorker = 0; iWorker < pThis->cWorkers; iWorker++)
+                pThis->aWorkers[iWorker].enmLinkState = PDMNETWORKLINKSTATE_UP;
 
             /* might return VINF_NAT_DNS */
             return rc;
@@ -1443,6 +1843,7 @@ static DECLCALLBACK(int) drvNATConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
         /* failure path */
         slirp_term(pThis->pNATState);
         pThis->pNATState = NULL;
+        pThis->aWorkers[0].pNATState = NULL;
     }
     else
     {
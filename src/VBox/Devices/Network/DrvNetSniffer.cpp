@@ -22,13 +22,19 @@
 #define LOG_GROUP LOG_GROUP_DRV_NAT
 #include <VBox/vmm/pdmdrv.h>
 #include <VBox/vmm/pdmnetifs.h>
+#include <VBox/vmm/pdmnetinline.h>
 
 #include <VBox/log.h>
+#include <iprt/asm.h>
 #include <iprt/assert.h>
 #include <iprt/critsect.h>
-#include <iprt/file.h>
+#include <iprt/mem.h>
+#include <iprt/path.h>
 #include <iprt/process.h>
+#include <iprt/semaphore.h>
+#include <iprt/stream.h>
 #include <iprt/string.h>
+#include <iprt/thread.h>
 #include <iprt/time.h>
 #include <iprt/uuid.h>
 #include <VBox/param.h>
@@ -37,9 +43,60 @@
 #include "VBoxDD.h"
 
 
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** The default size of the capture ring. */
+#define DRVNETSNIFFER_RING_DEFAULT      (4 * _1M)
+/** The smallest capture ring, must hold a full size GSO frame. */
+#define DRVNETSNIFFER_RING_MIN          (256 * _1K)
+/** The largest capture ring. */
+#define DRVNETSNIFFER_RING_MAX          (256 * _1M)
+
+/** @name Ring record states.
+ * @{ */
+/** The space is free or the producer is still copying (must be zero). */
+#define DRVNETSNIFFERREC_FREE           UINT32_C(0)
+/** A plain frame. */
+#define DRVNETSNIFFERREC_FRAME          UINT32_C(1)
+/** A GSO frame, to be carved into segments by the writer. */
+#define DRVNETSNIFFERREC_GSO            UINT32_C(2)
+/** Padding up to the end of the ring. */
+#define DRVNETSNIFFERREC_PAD            UINT32_C(3)
+/** @} */
+
+
 /*******************************************************************************
 *   Structures and Typedefs                                                    *
 *******************************************************************************/
+/**
+ * A frame record in the capture ring.
+ *
+ * Records are 8 byte aligned and never wrap around the end of the ring, a
+ * padding record fills the gap instead.  The writer zeros every record it
+ * has consumed, so a record becomes visible to it exactly when the producer
+ * sets u32State.
+ */
+typedef struct DRVNETSNIFFERREC
+{
+    /** The record state (DRVNETSNIFFERREC_XXX), written last. */
+    uint32_t volatile       u32State;
+    /** The size of the record including this header. */
+    uint32_t                cbRec;
+    /** The capture time relative to the start of the capture. */
+    uint64_t                u64NanoTS;
+    /** The size of the frame on the wire. */
+    uint32_t                cbFrame;
+    /** The number of frame bytes following the header. */
+    uint32_t                cbData;
+    /** The GSO context, DRVNETSNIFFERREC_GSO only. */
+    PDMNETWORKGSO           Gso;
+} DRVNETSNIFFERREC;
+AssertCompileSize(DRVNETSNIFFERREC, 32);
+/** Pointer to a capture ring record. */
+typedef DRVNETSNIFFERREC *PDRVNETSNIFFERREC;
+
+
 /**
  * Block driver instance data.
  *
@@ -64,10 +121,8 @@ typedef struct DRVNETSNIFFER
     PPDMINETWORKUP          pIBelowNet;
     /** The filename. */
     char                    szFilename[RTPATH_MAX];
-    /** The filehandle. */
-    RTFILE                  hFile;
-    /** The lock serializing the file access. */
-    RTCRITSECT              Lock;
+    /** The output stream, only accessed by the writer thread after construction. */
+    PRTSTREAM               pStream;
     /** The NanoTS delta we pass to the pcap writers. */
     uint64_t                StartNanoTS;
     /** Pointer to the driver instance. */
@@ -75,10 +130,275 @@ typedef struct DRVNETSNIFFER
     /** For when we're the leaf driver. */
     RTCRITSECT              XmitLock;
 
+    /** The max number of bytes recorded for each frame (or GSO segment). */
+    uint32_t                cbSnapLen;
+    /** The size of the current file after which a new one is started, 0 for
+     *  no rotation. */
+    uint64_t                cbMaxFile;
+    /** The number of files to rotate through, 0 for no limit. */
+    uint32_t                cMaxFiles;
+    /** The number of the current file. */
+    uint32_t                iFile;
+    /** The number of bytes written to the current file. */
+    uint64_t                cbFile;
+
+    /** The capture ring (power of two sized). */
+    uint8_t                *pbRing;
+    /** The size of the capture ring. */
+    uint32_t                cbRing;
+    /** The producer position, bytes reserved since the start. */
+    uint64_t volatile       offRingWrite;
+    /** The consumer position, bytes released by the writer since the start. */
+    uint64_t volatile       offRingRead;
+    /** The writer thread. */
+    PPDMTHREAD              pWriterThread;
+    /** The event the writer thread waits on when the ring is empty. */
+    RTSEMEVENT              hEvtWriter;
+    /** Set when the writer thread is about to wait for hEvtWriter. */
+    bool volatile           fWriterSleeping;
+
+    /** Frames put into the capture ring. */
+    STAMCOUNTER             StatFramesCaptured;
+    /** Frames dropped because the ring was full. */
+    STAMCOUNTER             StatFramesDropped;
+    /** Bytes written to the capture files. */
+    STAMCOUNTER             StatBytesWritten;
+    /** Number of times a new capture file was started. */
+    STAMCOUNTER             StatRotations;
+
 } DRVNETSNIFFER, *PDRVNETSNIFFER;
 
 
 
+/**
+ * Copies a frame into the capture ring.
+ *
+ * This is called on the transmit and receive paths, possibly at the same
+ * time, and never blocks: when the writer thread can't keep up the frame is
+ * dropped and counted.
+ *
+ * @param   pThis           The sniffer instance.
+ * @param   pGso            The GSO context, NULL for a plain frame.
+ * @param   pvFrame         The start of the frame.
+ * @param   cbFrame         The size of the frame.
+ * @param   cbAvail         The number of contiguous bytes at @a pvFrame.
+ */
+static void drvNetSnifferCapture(PDRVNETSNIFFER pThis, PCPDMNETWORKGSO pGso, const void *pvFrame, size_t cbFrame,
+                                 size_t cbAvail)
+{
+    uint64_t const u64NanoTS = RTTimeNanoTS() - pThis->StartNanoTS;
+
+    /* GSO frames are carved up by the writer, so they need all of the data. */
+    uint32_t const cbData = (uint32_t)(pGso ? RT_MIN(cbAvail, cbFrame) : RT_MIN(RT_MIN(cbAvail, cbFrame), pThis->cbSnapLen));
+    uint32_t const cbRec  = RT_ALIGN_32(sizeof(DRVNETSNIFFERREC) + cbData, 8);
+    uint32_t const cbRing = pThis->cbRing;
+
+    /*
+     * Reserve space, including padding up to the end of the ring when the
+     * record doesn't fit in front of it.
+     */
+    uint64_t offWrite;
+    uint32_t cbPad;
+    for (;;)
+    {
+        offWrite = ASMAtomicReadU64(&pThis->offRingWrite);
+        uint64_t const offRead = ASMAtomicReadU64(&pThis->offRingRead);
+        uint32_t const cbToEnd = cbRing - (uint32_t)(offWrite & (cbRing - 1));
+        cbPad = cbRec > cbToEnd ? cbToEnd : 0;
+        if (RT_UNLIKELY(offWrite - offRead + cbPad + cbRec > cbRing))
+        {
+            ASMAtomicIncU64(&pThis->StatFramesDropped.c);
+            return;
+        }
+        if (ASMAtomicCmpXchgU64(&pThis->offRingWrite, offWrite + cbPad + cbRec, offWrite))
+            break;
+    }
+
+    if (cbPad)
+    {
+        PDRVNETSNIFFERREC pPad = (PDRVNETSNIFFERREC)&pThis->pbRing[offWrite & (cbRing - 1)];
+        pPad->cbRec = cbPad;
+        ASMAtomicWriteU32(&pPad->u32State, DRVNETSNIFFERREC_PAD);
+        offWrite += cbPad;
+    }
+
+    PDRVNETSNIFFERREC pRec = (PDRVNETSNIFFERREC)&pThis->pbRing[offWrite & (cbRing - 1)];
+    pRec->cbRec     = cbRec;
+    pRec->u64NanoTS = u64NanoTS;
+    pRec->cbFrame   = (uint32_t)cbFrame;
+    pRec->cbData    = cbData;
+    if (pGso)
+        pRec->Gso   = *pGso;
+    memcpy(pRec + 1, pvFrame, cbData);
+    ASMAtomicWriteU32(&pRec->u32State, pGso ? DRVNETSNIFFERREC_GSO : DRVNETSNIFFERREC_FRAME);
+    ASMAtomicIncU64(&pThis->StatFramesCaptured.c);
+
+    if (   ASMAtomicReadBool(&pThis->fWriterSleeping)
+        && ASMAtomicXchgBool(&pThis->fWriterSleeping, false))
+        RTSemEventSignal(pThis->hEvtWriter);
+}
+
+
+/**
+ * Opens the current capture file and writes the pcap header.
+ *
+ * @returns VBox status code.
+ * @param   pThis           The sniffer instance.
+ */
+static int drvNetSnifferOpenFile(PDRVNETSNIFFER pThis)
+{
+    /* file.pcap, file.1.pcap, file.2.pcap, ... */
+    char        szFilename[RTPATH_MAX];
+    const char *pszName = pThis->szFilename;
+    if (pThis->iFile)
+    {
+        const char *pszExt = RTPathExt(pThis->szFilename);
+        if (pszExt)
+            RTStrPrintf(szFilename, sizeof(szFilename), "%.*s.%u%s",
+                        (int)(pszExt - pThis->szFilename), pThis->szFilename, pThis->iFile, pszExt);
+        else
+            RTStrPrintf(szFilename, sizeof(szFilename), "%s.%u", pThis->szFilename, pThis->iFile);
+        pszName = szFilename;
+    }
+
+    int rc = RTStrmOpen(pszName, "wb", &pThis->pStream);
+    if (RT_FAILURE(rc))
+    {
+        pThis->pStream = NULL;
+        return rc;
+    }
+
+    /*
+     * The header frame goes at the current time on the same time base as
+     * the captured frames, the previous file (if any) already covers
+     * everything before it.
+     */
+    rc = PcapStreamHdrEx(pThis->pStream, pThis->StartNanoTS, pThis->cbSnapLen);
+    pThis->cbFile = 24 + 16 + 4; /* file header, dummy frame record */
+    return rc;
+}
+
+
+/**
+ * Closes the current capture file and starts the next one.
+ *
+ * @param   pThis           The sniffer instance.
+ */
+static void drvNetSnifferRotate(PDRVNETSNIFFER pThis)
+{
+    RTStrmClose(pThis->pStream);
+    pThis->pStream = NULL;
+
+    pThis->iFile++;
+    if (pThis->cMaxFiles && pThis->iFile >= pThis->cMaxFiles)
+        pThis->iFile = 0;
+    STAM_REL_COUNTER_INC(&pThis->StatRotations);
+
+    int rc = drvNetSnifferOpenFile(pThis);
+    if (RT_FAILURE(rc))
+        LogRel(("NetSniffer#%u: failed to start capture file #%u: %Rrc, capture stopped\n",
+                pThis->pDrvIns->iInstance, pThis->iFile, rc));
+}
+
+
+/**
+ * Writes out everything the producers have finished copying into the ring.
+ *
+ * @returns true if any records were consumed, false if not.
+ * @param   pThis           The sniffer instance.
+ */
+static bool drvNetSnifferDrain(PDRVNETSNIFFER pThis)
+{
+    bool     fProgress = false;
+    uint64_t offRead   = pThis->offRingRead;
+    while (offRead != ASMAtomicReadU64(&pThis->offRingWrite))
+    {
+        PDRVNETSNIFFERREC pRec   = (PDRVNETSNIFFERREC)&pThis->pbRing[offRead & (pThis->cbRing - 1)];
+        uint32_t const    uState = ASMAtomicReadU32(&pRec->u32State);
+        if (uState == DRVNETSNIFFERREC_FREE)
+            break; /* the producer is still copying */
+
+        if (uState != DRVNETSNIFFERREC_PAD && pThis->pStream)
+        {
+            uint64_t cbWritten;
+            if (uState == DRVNETSNIFFERREC_FRAME)
+            {
+                PcapStreamFrameAt(pThis->pStream, pRec->u64NanoTS, pRec + 1, pRec->cbFrame, pRec->cbData);
+                cbWritten = 16 + pRec->cbData;
+            }
+            else
+            {
+                PcapStreamGsoFrameAt(pThis->pStream, pRec->u64NanoTS, &pRec->Gso, pRec + 1, pRec->cbData, pThis->cbSnapLen);
+                uint32_t const cSegs = PDMNetGsoCalcSegmentCount(&pRec->Gso, pRec->cbData);
+                cbWritten = cSegs * 16
+                          + RT_MIN(pRec->cbData + (cSegs - 1) * pRec->Gso.cbHdrs, (uint64_t)cSegs * pThis->cbSnapLen);
+            }
+            pThis->cbFile += cbWritten;
+            STAM_REL_COUNTER_ADD(&pThis->StatBytesWritten, cbWritten);
+
+            if (pThis->cbMaxFile && pThis->cbFile >= pThis->cbMaxFile)
+                drvNetSnifferRotate(pThis);
+        }
+
+        /* Hand the space back zeroed, see DRVNETSNIFFERREC. */
+        uint32_t const cbRec = pRec->cbRec;
+        memset(pRec, 0, cbRec);
+        offRead += cbRec;
+        ASMAtomicWriteU64(&pThis->offRingRead, offRead);
+        fProgress = true;
+    }
+    return fProgress;
+}
+
+
+/**
+ * @callback_method_impl{FNPDMTHREADDRV, The capture writer thread.}
+ */
+static DECLCALLBACK(int) drvNetSnifferWriterThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThread)
+{
+    PDRVNETSNIFFER pThis = PDMINS_2_DATA(pDrvIns, PDRVNETSNIFFER);
+
+    if (pThread->enmState == PDMTHREADSTATE_INITIALIZING)
+        return VINF_SUCCESS;
+
+    while (pThread->enmState == PDMTHREADSTATE_RUNNING)
+    {
+        if (drvNetSnifferDrain(pThis))
+            continue;
+
+        if (ASMAtomicReadU64(&pThis->offRingRead) != ASMAtomicReadU64(&pThis->offRingWrite))
+        {
+            /* A producer reserved space but hasn't filled it in yet. */
+            RTThreadYield();
+            continue;
+        }
+
+        /*
+         * The ring is empty, flush and wait.  The producers check the flag
+         * after committing, so re-check the ring after setting it.
+         */
+        if (pThis->pStream)
+            RTStrmFlush(pThis->pStream);
+        ASMAtomicWriteBool(&pThis->fWriterSleeping, true);
+        if (ASMAtomicReadU64(&pThis->offRingRead) == ASMAtomicReadU64(&pThis->offRingWrite))
+            RTSemEventWait(pThis->hEvtWriter, RT_INDEFINITE_WAIT);
+        ASMAtomicWriteBool(&pThis->fWriterSleeping, false);
+    }
+
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * @callback_method_impl{FNPDMTHREADWAKEUPDRV, Wakes up the capture writer thread.}
+ */
+static DECLCALLBACK(int) drvNetSnifferWriterWakeup(PPDMDRVINS pDrvIns, PPDMTHREAD pThread)
+{
+    PDRVNETSNIFFER pThis = PDMINS_2_DATA(pDrvIns, PDRVNETSNIFFER);
+    return RTSemEventSignal(pThis->hEvtWriter);
+}
+
+
 /**
  * @interface_method_impl{PDMINETWORKUP,pfnBeginXmit}
  */
@@ -131,18 +451,10 @@ static DECLCALLBACK(int) drvNetSnifferUp_SendBuf(PPDMINETWORKUP pInterface, PPDM
         return VERR_NET_DOWN;
 
     /* output to sniffer */
-    RTCritSectEnter(&pThis->Lock);
-    if (!pSgBuf->pvUser)
-        PcapFileFrame(pThis->hFile, pThis->StartNanoTS,
-                      pSgBuf->aSegs[0].pvSeg,
-                      pSgBuf->cbUsed,
-                      RT_MIN(pSgBuf->cbUsed, pSgBuf->aSegs[0].cbSeg));
-    else
-        PcapFileGsoFrame(pThis->hFile, pThis->StartNanoTS, (PCPDMNETWORKGSO)pSgBuf->pvUser,
+    drvNetSnifferCapture(pThis, (PCPDMNETWORKGSO)pSgBuf->pvUser,
                          pSgBuf->aSegs[0].pvSeg,
                          pSgBuf->cbUsed,
                          RT_MIN(pSgBuf->cbUsed, pSgBuf->aSegs[0].cbSeg));
-    RTCritSectLeave(&pThis->Lock);
 
     return pThis->pIBelowNet->pfnSendBuf(pThis->pIBelowNet, pSgBuf, fOnWorkerThread);
 }
@@ -204,9 +516,7 @@ static DECLCALLBACK(int) drvNetSnifferDown_Receive(PPDMINETWORKDOWN pInterface,
     PDRVNETSNIFFER pThis = RT_FROM_MEMBER(pInterface, DRVNETSNIFFER, INetworkDown);
 
     /* output to sniffer */
-    RTCritSectEnter(&pThis->Lock);
-    PcapFileFrame(pThis->hFile, pThis->StartNanoTS, pvBuf, cb, cb);
-    RTCritSectLeave(&pThis->Lock);
+    drvNetSnifferCapture(pThis, NULL, pvBuf, cb, cb);
 
     /* pass up */
     int rc = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pvBuf, cb);
@@ -351,14 +661,46 @@ static DECLCALLBACK(void) drvNetSnifferDestruct(PPDMDRVINS pDrvIns)
     PDRVNETSNIFFER pThis = PDMINS_2_DATA(pDrvIns, PDRVNETSNIFFER);
     PDMDRV_CHECK_VERSIONS_RETURN_VOID(pDrvIns);
 
-    if (RTCritSectIsInitialized(&pThis->Lock))
-        RTCritSectDelete(&pThis->Lock);
+    /*
+     * Stop the writer thread (PDM would only do it after we return) and
+     * write out whatever is left in the ring.
+     */
+    if (pThis->pWriterThread)
+    {
+        int rc = PDMR3ThreadDestroy(pThis->pWriterThread, NULL);
+        AssertRC(rc);
+        pThis->pWriterThread = NULL;
+    }
+    if (pThis->pbRing)
+    {
+        drvNetSnifferDrain(pThis);
+        RTMemFree(pThis->pbRing);
+        pThis->pbRing = NULL;
+    }
+
+    if (pThis->hEvtWriter != NIL_RTSEMEVENT)
+    {
+        RTSemEventDestroy(pThis->hEvtWriter);
+        pThis->hEvtWriter = NIL_RTSEMEVENT;
+    }
 
     if (RTCritSectIsInitialized(&pThis->XmitLock))
         RTCritSectDelete(&pThis->XmitLock);
 
-    RTFileClose(pThis->hFile);
-    pThis->hFile = NIL_RTFILE;
+    if (pThis->StatFramesDropped.c)
+        LogRel(("NetSniffer#%u: dropped %RU64 of %RU64 frames, the capture file could not keep up\n", pDrvIns->iInstance,
+                pThis->StatFramesDropped.c, pThis->StatFramesDropped.c + pThis->StatFramesCaptured.c));
+
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatFramesCaptured);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatFramesDropped);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatBytesWritten);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatRotations);
+
+    if (pThis->pStream)
+    {
+        RTStrmClose(pThis->pStream);
+        pThis->pStream = NULL;
+    }
 }
 
 
@@ -376,7 +718,8 @@ static DECLCALLBACK(int) drvNetSnifferConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pC
      * Init the static parts.
      */
     pThis->pDrvIns                                  = pDrvIns;
-    pThis->hFile                                    = NIL_RTFILE;
+    pThis->pStream                                  = NULL;
+    pThis->hEvtWriter                               = NIL_RTSEMEVENT;
     /* The pcap file *must* start at time offset 0,0. */
     pThis->StartNanoTS                              = RTTimeNanoTS() - RTTimeProgramNanoTS();
     /* IBase */
@@ -401,15 +744,13 @@ static DECLCALLBACK(int) drvNetSnifferConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pC
     /*
      * Create the locks.
      */
-    int rc = RTCritSectInit(&pThis->Lock);
-    AssertRCReturn(rc, rc);
-    rc = RTCritSectInit(&pThis->XmitLock);
+    int rc = RTCritSectInit(&pThis->XmitLock);
     AssertRCReturn(rc, rc);
 
     /*
      * Validate the config.
      */
-    if (!CFGMR3AreValuesValid(pCfg, "File\0"))
+    if (!CFGMR3AreValuesValid(pCfg, "File\0" "SnapLen\0" "RingSize\0" "MaxFileSize\0" "MaxFiles\0"))
         return VERR_PDM_DRVINS_UNKNOWN_CFG_VALUES;
 
     if (CFGMR3GetFirstChild(pCfg))
@@ -433,6 +774,44 @@ static DECLCALLBACK(int) drvNetSnifferConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pC
         return rc;
     }
 
+    /** @cfgm{SnapLen, integer, 65535}
+     * The max number of bytes recorded for each frame, the rest is cut off. */
+    rc = CFGMR3QueryU32Def(pCfg, "SnapLen", &pThis->cbSnapLen, 0xffff);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"SnapLen\" value"));
+    if (pThis->cbSnapLen < 14 || pThis->cbSnapLen > 0xffff)
+        return PDMDrvHlpVMSetError(pDrvIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("NetSniffer#%d: configuration error: \"SnapLen\" must be between 14 and 65535"),
+                                   pDrvIns->iInstance);
+
+    /** @cfgm{RingSize, integer, 4MB}
+     * The size of the buffer frames are copied to on their way to the capture
+     * file.  Frames are dropped when it is full.  Must be a power of two. */
+    rc = CFGMR3QueryU32Def(pCfg, "RingSize", &pThis->cbRing, DRVNETSNIFFER_RING_DEFAULT);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"RingSize\" value"));
+    if (   pThis->cbRing < DRVNETSNIFFER_RING_MIN
+        || pThis->cbRing > DRVNETSNIFFER_RING_MAX
+        || !RT_IS_POWER_OF_TWO(pThis->cbRing))
+        return PDMDrvHlpVMSetError(pDrvIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("NetSniffer#%d: configuration error: \"RingSize\" must be a power of two between %u and %u"),
+                                   pDrvIns->iInstance, DRVNETSNIFFER_RING_MIN, DRVNETSNIFFER_RING_MAX);
+
+    /** @cfgm{MaxFileSize, integer, 0}
+     * The size after which a new capture file is started, 0 to never do that.
+     * The files following the first one get a running number inserted in front
+     * of the extension (VBox.pcap, VBox.1.pcap, VBox.2.pcap...). */
+    rc = CFGMR3QueryU64Def(pCfg, "MaxFileSize", &pThis->cbMaxFile, 0);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"MaxFileSize\" value"));
+
+    /** @cfgm{MaxFiles, integer, 0}
+     * The number of capture files to rotate through when MaxFileSize is set,
+     * the oldest one is overwritten.  0 means no limit. */
+    rc = CFGMR3QueryU32Def(pCfg, "MaxFiles", &pThis->cMaxFiles, 0);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"MaxFiles\" value"));
+
     /*
      * Query the network port interface.
      */
@@ -477,20 +856,35 @@ static DECLCALLBACK(int) drvNetSnifferConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pC
     }
 
     /*
-     * Open output file / pipe.
+     * Open output file / pipe and write the pcap header.
      */
-    rc = RTFileOpen(&pThis->hFile, pThis->szFilename,
-                    RTFILE_O_WRITE | RTFILE_O_CREATE_REPLACE | RTFILE_O_DENY_WRITE);
+    rc = drvNetSnifferOpenFile(pThis);
     if (RT_FAILURE(rc))
         return PDMDrvHlpVMSetError(pDrvIns, rc, RT_SRC_POS,
                                    N_("Netsniffer cannot open '%s' for writing. The directory must exist and it must be writable for the current user"), pThis->szFilename);
 
     /*
-     * Write pcap header.
-     * Some time has gone by since capturing pThis->StartNanoTS so get the
-     * current time again.
+     * The capture ring and the thread writing it to the file.
      */
-    PcapFileHdr(pThis->hFile, RTTimeNanoTS());
+    pThis->pbRing = (uint8_t *)RTMemAllocZ(pThis->cbRing);
+    if (!pThis->pbRing)
+        return VERR_NO_MEMORY;
+
+    rc = RTSemEventCreate(&pThis->hEvtWriter);
+    AssertRCReturn(rc, rc);
+
+    rc = PDMDrvHlpThreadCreate(pDrvIns, &pThis->pWriterThread, pThis, drvNetSnifferWriterThread,
+                               drvNetSnifferWriterWakeup, 0, RTTHREADTYPE_IO, "NetSniff");
+    AssertRCReturn(rc, rc);
+
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatFramesCaptured, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                           "Frames copied into the capture ring.", "/Drivers/NetSniffer%u/FramesCaptured", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatFramesDropped, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                           "Frames dropped because the capture ring was full.", "/Drivers/NetSniffer%u/FramesDropped", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatBytesWritten, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,
+                           "Bytes written to the capture files.", "/Drivers/NetSniffer%u/BytesWritten", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatRotations, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                           "Capture files started after the first one.", "/Drivers/NetSniffer%u/Rotations", pDrvIns->iInstance);
 
     return VINF_SUCCESS;
 }
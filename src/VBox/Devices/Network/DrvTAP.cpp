@@ -29,6 +29,7 @@
 #include <iprt/ctype.h>
 #include <iprt/file.h>
 #include <iprt/mem.h>
+#include <iprt/net.h>
 #include <iprt/path.h>
 #include <iprt/pipe.h>
 #include <iprt/semaphore.h>
@@ -66,6 +67,11 @@
 #else
 # include <sys/fcntl.h>
 #endif
+#ifdef RT_OS_LINUX
+# include <sys/uio.h>
+# include <net/if.h>
+# include <linux/if_tun.h>
+#endif
 #include <errno.h>
 #include <unistd.h>
 
@@ -76,9 +82,52 @@
 #include "VBoxDD.h"
 
 
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** The max number of frames to read per poll() wakeup before looking at the
+ * control pipe again. */
+#define DRVTAP_MAX_RECV_BATCH           64
+/** The size of the receive buffer, a 64KB GSO frame plus the virtio-net header
+ * must fit. */
+#define DRVTAP_RECV_BUF_SIZE            (_64K + 256)
+
+/** @name DRVTAPVNETHDR::u8Flags
+ * @{ */
+#define DRVTAP_VNETHDR_F_NEEDS_CSUM     1       /**< Use u16CSumStart and u16CSumOffset. */
+/** @} */
+/** @name DRVTAPVNETHDR::u8GsoType
+ * @{ */
+#define DRVTAP_VNETHDR_GSO_NONE         0
+#define DRVTAP_VNETHDR_GSO_TCPV4        1
+#define DRVTAP_VNETHDR_GSO_UDP          3
+#define DRVTAP_VNETHDR_GSO_TCPV6        4
+#define DRVTAP_VNETHDR_GSO_ECN          0x80
+/** @} */
+
+
 /*******************************************************************************
 *   Structures and Typedefs                                                    *
 *******************************************************************************/
+/**
+ * The virtio-net header preceding each frame read from or written to a Linux
+ * TAP device in IFF_VNET_HDR mode.
+ */
+typedef struct DRVTAPVNETHDR
+{
+    uint8_t                 u8Flags;
+    uint8_t                 u8GsoType;
+    uint16_t                u16HdrLen;
+    uint16_t                u16GsoSize;
+    uint16_t                u16CSumStart;
+    uint16_t                u16CSumOffset;
+} DRVTAPVNETHDR;
+AssertCompileSize(DRVTAPVNETHDR, 10);
+/** Pointer to a virtio-net header. */
+typedef DRVTAPVNETHDR *PDRVTAPVNETHDR;
+/** Pointer to a const virtio-net header. */
+typedef DRVTAPVNETHDR const *PCDRVTAPVNETHDR;
+
 /**
  * TAP driver instance data.
  *
@@ -119,6 +168,11 @@ typedef struct DRVTAP
     RTPIPE                  hPipeRead;
     /** Reader thread. */
     PPDMTHREAD              pThread;
+    /** The receive buffer. */
+    uint8_t                *pbRecvBuf;
+    /** Whether each frame is preceded by a virtio-net header (Linux IFF_VNET_HDR),
+     * which allows exchanging GSO frames with the host. */
+    bool                    fVNetHdr;
 
     /** @todo The transmit thread. */
     /** Transmit lock used by drvTAPNetworkUp_BeginXmit. */
@@ -133,6 +187,12 @@ typedef struct DRVTAP
     STAMCOUNTER             StatPktRecv;
     /** Number of received bytes. */
     STAMCOUNTER             StatPktRecvBytes;
+    /** Number of GSO frames sent to the host in one piece. */
+    STAMCOUNTER             StatPktSentGso;
+    /** Number of GSO frames received from the host. */
+    STAMCOUNTER             StatPktRecvGso;
+    /** Number of poll() wakeups with frames to read. */
+    STAMCOUNTER             StatRecvWakeups;
     /** Profiling packet transmit runs. */
     STAMPROFILE             StatTransmit;
     /** Profiling packet receive runs. */
@@ -166,6 +226,68 @@ static int              SolarisTAPAttach(PDRVTAP pThis);
 
 
 
+/**
+ * Writes a frame to the TAP device.
+ *
+ * @returns IPRT status code.
+ * @param   pThis           The instance data.
+ * @param   pHdr            The virtio-net header to put in front of the frame
+ *                          if the device uses them, NULL for an all zero one.
+ * @param   pvFrame         The frame.
+ * @param   cbFrame         The frame size.
+ */
+static int drvTAPWriteFrame(PDRVTAP pThis, PCDRVTAPVNETHDR pHdr, const void *pvFrame, size_t cbFrame)
+{
+#ifdef RT_OS_LINUX
+    if (pThis->fVNetHdr)
+    {
+        static DRVTAPVNETHDR const s_NoGsoHdr = { 0, DRVTAP_VNETHDR_GSO_NONE, 0, 0, 0, 0 };
+        struct iovec aIov[2];
+        aIov[0].iov_base = (void *)(pHdr ? pHdr : &s_NoGsoHdr);
+        aIov[0].iov_len  = sizeof(DRVTAPVNETHDR);
+        aIov[1].iov_base = (void *)pvFrame;
+        aIov[1].iov_len  = cbFrame;
+        if (writev(RTFileToNative(pThis->hFileDevice), &aIov[0], RT_ELEMENTS(aIov)) < 0)
+            return RTErrConvertFromErrno(errno);
+        return VINF_SUCCESS;
+    }
+#endif
+    Assert(!pHdr);
+    return RTFileWrite(pThis->hFileDevice, pvFrame, cbFrame, NULL);
+}
+
+
+/**
+ * Translates a GSO context into a virtio-net header for the host.
+ *
+ * @returns true if the host can take the frame in one piece, false if it must
+ *          be segmented here.
+ * @param   pGso            The GSO context.
+ * @param   pHdr            Where to return the header.
+ */
+static bool drvTAPGsoToVNetHdr(PCPDMNETWORKGSO pGso, PDRVTAPVNETHDR pHdr)
+{
+    switch ((PDMNETWORKGSOTYPE)pGso->u8Type)
+    {
+        case PDMNETWORKGSOTYPE_IPV4_TCP:
+            pHdr->u8GsoType = DRVTAP_VNETHDR_GSO_TCPV4;
+            break;
+        case PDMNETWORKGSOTYPE_IPV6_TCP:
+            pHdr->u8GsoType = DRVTAP_VNETHDR_GSO_TCPV6;
+            break;
+        default:
+            /* UFO is not reliably supported by the host, neither are the tunneled types. */
+            return false;
+    }
+    pHdr->u8Flags       = DRVTAP_VNETHDR_F_NEEDS_CSUM;
+    pHdr->u16HdrLen     = pGso->cbHdrs;
+    pHdr->u16GsoSize    = pGso->cbMaxSeg;
+    pHdr->u16CSumStart  = pGso->offHdr2;
+    pHdr->u16CSumOffset = RT_OFFSETOF(RTNETTCP, th_sum);
+    return true;
+}
+
+
 /**
  * @interface_method_impl{PDMINETWORKUP,pfnBeginXmit}
  */
@@ -275,23 +397,37 @@ static DECLCALLBACK(int) drvTAPNetworkUp_SendBuf(PPDMINETWORKUP pInterface, PPDM
               "%.*Rhxd\n",
               pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed, pSgBuf->cbUsed, pSgBuf->aSegs[0].pvSeg));
 
-        rc = RTFileWrite(pThis->hFileDevice, pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed, NULL);
+        rc = drvTAPWriteFrame(pThis, NULL, pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed);
     }
     else
     {
-        uint8_t         abHdrScratch[256];
-        uint8_t const  *pbFrame = (uint8_t const *)pSgBuf->aSegs[0].pvSeg;
-        PCPDMNETWORKGSO pGso    = (PCPDMNETWORKGSO)pSgBuf->pvUser;
-        uint32_t const  cSegs   = PDMNetGsoCalcSegmentCount(pGso, pSgBuf->cbUsed);  Assert(cSegs > 1);
-        rc = VINF_SUCCESS;
-        for (size_t iSeg = 0; iSeg < cSegs; iSeg++)
+        DRVTAPVNETHDR   VNetHdr;
+        PCPDMNETWORKGSO pGso = (PCPDMNETWORKGSO)pSgBuf->pvUser;
+        if (pThis->fVNetHdr && drvTAPGsoToVNetHdr(pGso, &VNetHdr))
         {
-            uint32_t cbSegFrame;
-            void *pvSegFrame = PDMNetGsoCarveSegmentQD(pGso, (uint8_t *)pbFrame, pSgBuf->cbUsed, abHdrScratch,
-                                                       iSeg, cSegs, &cbSegFrame);
-            rc = RTFileWrite(pThis->hFileDevice, pvSegFrame, cbSegFrame, NULL);
-            if (RT_FAILURE(rc))
-                break;
+            /*
+             * The host segments it (or passes it on whole), we only have to
+             * provide the pseudo header checksum like for any partial checksum.
+             */
+            STAM_COUNTER_INC(&pThis->StatPktSentGso);
+            PDMNetGsoPrepForDirectUse(pGso, pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed, PDMNETCSUMTYPE_PSEUDO);
+            rc = drvTAPWriteFrame(pThis, &VNetHdr, pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed);
+        }
+        else
+        {
+            uint8_t         abHdrScratch[256];
+            uint8_t const  *pbFrame = (uint8_t const *)pSgBuf->aSegs[0].pvSeg;
+            uint32_t const  cSegs   = PDMNetGsoCalcSegmentCount(pGso, pSgBuf->cbUsed);  Assert(cSegs > 1);
+            rc = VINF_SUCCESS;
+            for (size_t iSeg = 0; iSeg < cSegs; iSeg++)
+            {
+                uint32_t cbSegFrame;
+                void *pvSegFrame = PDMNetGsoCarveSegmentQD(pGso, (uint8_t *)pbFrame, pSgBuf->cbUsed, abHdrScratch,
+                                                           iSeg, cSegs, &cbSegFrame);
+                rc = drvTAPWriteFrame(pThis, NULL, pvSegFrame, cbSegFrame);
+                if (RT_FAILURE(rc))
+                    break;
+            }
         }
     }
 
@@ -340,6 +476,213 @@ static DECLCALLBACK(void) drvTAPNetworkUp_NotifyLinkChanged(PPDMINETWORKUP pInte
 }
 
 
+/**
+ * Waits for receive buffer space and passes a plain frame up to the device.
+ *
+ * @returns VBox status code. Failure means we were woken up during a VM state
+ *          transition and the frame has been dropped.
+ * @param   pThis           The instance data.
+ * @param   pvFrame         The frame.
+ * @param   cbFrame         The frame size.
+ */
+static int drvTAPRecvPassUp(PDRVTAP pThis, const void *pvFrame, size_t cbFrame)
+{
+    /*
+     * Wait for the device to have space for this frame.
+     * Most guests use frame-sized receive buffers, hence non-zero cbMax
+     * automatically means there is enough room for entire frame. Some
+     * guests (eg. Solaris) use large chains of small receive buffers
+     * (each 128 or so bytes large). We will still start receiving as soon
+     * as cbMax is non-zero because:
+     *  - it would be quite expensive for pfnCanReceive to accurately
+     *    determine free receive buffer space
+     *  - if we were waiting for enough free buffers, there is a risk
+     *    of deadlocking because the guest could be waiting for a receive
+     *    overflow error to allocate more receive buffers
+     */
+    STAM_PROFILE_ADV_STOP(&pThis->StatReceive, a);
+    int rc = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, RT_INDEFINITE_WAIT);
+    STAM_PROFILE_ADV_START(&pThis->StatReceive, a);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    /*
+     * Pass the data up.
+     */
+#ifdef LOG_ENABLED
+    uint64_t u64Now = RTTimeProgramNanoTS();
+    LogFlow(("drvTAPAsyncIoThread: %-4d bytes at %llu ns  deltas: r=%llu t=%llu\n",
+             cbFrame, u64Now, u64Now - pThis->u64LastReceiveTS, u64Now - pThis->u64LastTransferTS));
+    pThis->u64LastReceiveTS = u64Now;
+#endif
+    Log2(("drvTAPAsyncIoThread: cbFrame=%#x\n" "%.*Rhxd\n", cbFrame, cbFrame, pvFrame));
+    STAM_COUNTER_INC(&pThis->StatPktRecv);
+    STAM_COUNTER_ADD(&pThis->StatPktRecvBytes, cbFrame);
+    rc = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pvFrame, cbFrame);
+    AssertRC(rc);
+    return VINF_SUCCESS;
+}
+
+#ifdef RT_OS_LINUX
+
+/**
+ * Translates the virtio-net header of a GSO frame from the host into a GSO
+ * context.
+ *
+ * We calculate the header size ourselves since the host only gives us a hint
+ * (the size of the linear part of its buffer).
+ *
+ * @returns true on success, false if the frame is malformed or of an unknown
+ *          type and should be dropped.
+ * @param   pHdr            The virtio-net header.
+ * @param   pbFrame         The frame following the header.
+ * @param   cbFrame         The frame size.
+ * @param   pGso            Where to return the GSO context.
+ */
+static bool drvTAPVNetHdrToGso(PCDRVTAPVNETHDR pHdr, uint8_t const *pbFrame, size_t cbFrame, PPDMNETWORKGSO pGso)
+{
+    if (   !(pHdr->u8Flags & DRVTAP_VNETHDR_F_NEEDS_CSUM)
+        || cbFrame < sizeof(RTNETETHERHDR) + sizeof(uint32_t))
+        return false;
+
+    uint8_t offHdr1 = sizeof(RTNETETHERHDR);
+    if (((PCRTNETETHERHDR)pbFrame)->EtherType == RT_H2BE_U16_C(RTNET_ETHERTYPE_VLAN))
+        offHdr1 += sizeof(uint32_t);
+    uint32_t offHdr2 = pHdr->u16CSumStart;
+    if (offHdr2 <= offHdr1 || offHdr2 >= cbFrame)
+        return false;
+
+    uint32_t cbHdrs;
+    switch (pHdr->u8GsoType & ~DRVTAP_VNETHDR_GSO_ECN)
+    {
+        case DRVTAP_VNETHDR_GSO_TCPV4:
+        case DRVTAP_VNETHDR_GSO_TCPV6:
+            if (offHdr2 + sizeof(RTNETTCP) > cbFrame)
+                return false;
+            pGso->u8Type = (pHdr->u8GsoType & ~DRVTAP_VNETHDR_GSO_ECN) == DRVTAP_VNETHDR_GSO_TCPV4
+                         ? PDMNETWORKGSOTYPE_IPV4_TCP : PDMNETWORKGSOTYPE_IPV6_TCP;
+            cbHdrs = offHdr2 + ((PCRTNETTCP)(pbFrame + offHdr2))->th_off * 4;
+            break;
+        case DRVTAP_VNETHDR_GSO_UDP:
+            pGso->u8Type = (pbFrame[offHdr1] >> 4) == 6 ? PDMNETWORKGSOTYPE_IPV6_UDP : PDMNETWORKGSOTYPE_IPV4_UDP;
+            cbHdrs = offHdr2 + sizeof(RTNETUDP);
+            break;
+        default:
+            return false;
+    }
+    if (cbHdrs > UINT8_MAX)
+        return false;
+
+    pGso->cbHdrs      = (uint8_t)cbHdrs;
+    pGso->cbMaxSeg    = pHdr->u16GsoSize;
+    pGso->offHdr1     = offHdr1;
+    pGso->offHdr2     = (uint8_t)offHdr2;
+    pGso->au8Unused[0] = 0;
+    pGso->au8Unused[1] = 0;
+    return PDMNetGsoIsValid(pGso, sizeof(*pGso), cbFrame);
+}
+
+
+/**
+ * Completes the checksum of a frame the host left for us to finish (no GSO,
+ * but DRVTAP_VNETHDR_F_NEEDS_CSUM set).
+ *
+ * The checksum field contains the pseudo header sum, so all we have to do is
+ * to sum up everything from u16CSumStart to the end of the frame.
+ *
+ * @param   pHdr            The virtio-net header.
+ * @param   pbFrame         The frame following the header.
+ * @param   cbFrame         The frame size.
+ */
+static void drvTAPCompleteChecksum(PCDRVTAPVNETHDR pHdr, uint8_t *pbFrame, size_t cbFrame)
+{
+    size_t const offStart = pHdr->u16CSumStart;
+    size_t const offField = offStart + pHdr->u16CSumOffset;
+    if (offField + sizeof(uint16_t) > cbFrame)
+    {
+        Log(("drvTAPCompleteChecksum: bogus checksum location %#x+%#x, cbFrame=%#zx\n",
+             pHdr->u16CSumStart, pHdr->u16CSumOffset, cbFrame));
+        return;
+    }
+    bool     fOdd   = false;
+    uint32_t u32Sum = RTNetIPv4AddDataChecksum(pbFrame + offStart, cbFrame - offStart, 0, &fOdd);
+    uint16_t u16Sum = RTNetIPv4FinalizeChecksum(u32Sum);
+    memcpy(pbFrame + offField, &u16Sum, sizeof(u16Sum));
+}
+
+#endif /* RT_OS_LINUX */
+
+/**
+ * Processes a frame read from the TAP device.
+ *
+ * @returns VBox status code. Failure means we were woken up during a VM state
+ *          transition and the frame (or the rest of it) has been dropped.
+ * @param   pThis           The instance data.
+ * @param   pbFrame         The frame, including the virtio-net header if used.
+ * @param   cbFrame         The number of bytes read.
+ */
+static int drvTAPRecvFrame(PDRVTAP pThis, uint8_t *pbFrame, size_t cbFrame)
+{
+#ifdef RT_OS_LINUX
+    if (pThis->fVNetHdr)
+    {
+        DRVTAPVNETHDR VNetHdr;
+        if (cbFrame < sizeof(VNetHdr))
+            return VINF_SUCCESS;
+        memcpy(&VNetHdr, pbFrame, sizeof(VNetHdr));
+        pbFrame += sizeof(VNetHdr);
+        cbFrame -= sizeof(VNetHdr);
+
+        if ((VNetHdr.u8GsoType & ~DRVTAP_VNETHDR_GSO_ECN) != DRVTAP_VNETHDR_GSO_NONE)
+        {
+            PDMNETWORKGSO Gso;
+            if (!drvTAPVNetHdrToGso(&VNetHdr, pbFrame, cbFrame, &Gso))
+            {
+                Log(("drvTAPRecvFrame: Dropping bad GSO frame: type=%#x flags=%#x start=%#x size=%#x cbFrame=%#zx\n",
+                     VNetHdr.u8GsoType, VNetHdr.u8Flags, VNetHdr.u16CSumStart, VNetHdr.u16GsoSize, cbFrame));
+                return VINF_SUCCESS;
+            }
+            STAM_COUNTER_INC(&pThis->StatPktRecvGso);
+
+            if (pThis->pIAboveNet->pfnReceiveGso)
+            {
+                STAM_PROFILE_ADV_STOP(&pThis->StatReceive, a);
+                int rc = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, RT_INDEFINITE_WAIT);
+                STAM_PROFILE_ADV_START(&pThis->StatReceive, a);
+                if (RT_FAILURE(rc))
+                    return rc;
+                if (RT_SUCCESS(pThis->pIAboveNet->pfnReceiveGso(pThis->pIAboveNet, pbFrame, cbFrame, &Gso)))
+                {
+                    STAM_COUNTER_INC(&pThis->StatPktRecv);
+                    STAM_COUNTER_ADD(&pThis->StatPktRecvBytes, cbFrame);
+                    return VINF_SUCCESS;
+                }
+            }
+
+            /*
+             * The device cannot take it whole, so segment it here.
+             */
+            uint8_t         abHdrScratch[256];
+            uint32_t const  cSegs = PDMNetGsoCalcSegmentCount(&Gso, cbFrame);
+            for (uint32_t iSeg = 0; iSeg < cSegs; iSeg++)
+            {
+                uint32_t cbSegFrame;
+                void *pvSegFrame = PDMNetGsoCarveSegmentQD(&Gso, pbFrame, cbFrame, abHdrScratch, iSeg, cSegs, &cbSegFrame);
+                int rc = drvTAPRecvPassUp(pThis, pvSegFrame, cbSegFrame);
+                if (RT_FAILURE(rc))
+                    return rc;
+            }
+            return VINF_SUCCESS;
+        }
+
+        if (VNetHdr.u8Flags & DRVTAP_VNETHDR_F_NEEDS_CSUM)
+            drvTAPCompleteChecksum(&VNetHdr, pbFrame, cbFrame);
+    }
+#endif
+    return drvTAPRecvPassUp(pThis, pbFrame, cbFrame);
+}
+
+
 /**
  * Asynchronous I/O thread for handling receive.
  *
@@ -386,62 +729,41 @@ static DECLCALLBACK(int) drvTAPAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
             &&  !aFDs[1].revents)
         {
             /*
-             * Read the frame.
+             * Read and process frames until the device runs dry, so that a
+             * burst from the host costs a single poll() wakeup.  The device is
+             * non-blocking, the final read fails with VERR_TRY_AGAIN.
              */
-            char achBuf[16384];
-            size_t cbRead = 0;
+            STAM_COUNTER_INC(&pThis->StatRecvWakeups);
+            unsigned cFrames = 0;
+            while (cFrames < DRVTAP_MAX_RECV_BATCH)
+            {
+                size_t cbRead = 0;
 #ifdef VBOX_WITH_CROSSBOW
-            cbRead = sizeof(achBuf);
-            rc = g_pfnLibDlpiRecv(pThis->pDeviceHandle, NULL, NULL, achBuf, &cbRead, -1, NULL);
-            rc = RT_LIKELY(rc == DLPI_SUCCESS) ? VINF_SUCCESS : SolarisDLPIErr2VBoxErr(rc);
+                cbRead = DRVTAP_RECV_BUF_SIZE;
+                rc = g_pfnLibDlpiRecv(pThis->pDeviceHandle, NULL, NULL, pThis->pbRecvBuf, &cbRead, -1, NULL);
+                rc = RT_LIKELY(rc == DLPI_SUCCESS) ? VINF_SUCCESS : SolarisDLPIErr2VBoxErr(rc);
 #else
-            /** @note At least on Linux we will never receive more than one network packet
-             *        after poll() returned successfully. I don't know why but a second
-             *        RTFileRead() operation will return with VERR_TRY_AGAIN in any case. */
-            rc = RTFileRead(pThis->hFileDevice, achBuf, sizeof(achBuf), &cbRead);
+                rc = RTFileRead(pThis->hFileDevice, pThis->pbRecvBuf, DRVTAP_RECV_BUF_SIZE, &cbRead);
 #endif
-            if (RT_SUCCESS(rc))
-            {
-                /*
-                 * Wait for the device to have space for this frame.
-                 * Most guests use frame-sized receive buffers, hence non-zero cbMax
-                 * automatically means there is enough room for entire frame. Some
-                 * guests (eg. Solaris) use large chains of small receive buffers
-                 * (each 128 or so bytes large). We will still start receiving as soon
-                 * as cbMax is non-zero because:
-                 *  - it would be quite expensive for pfnCanReceive to accurately
-                 *    determine free receive buffer space
-                 *  - if we were waiting for enough free buffers, there is a risk
-                 *    of deadlocking because the guest could be waiting for a receive
-                 *    overflow error to allocate more receive buffers
-                 */
-                STAM_PROFILE_ADV_STOP(&pThis->StatReceive, a);
-                int rc1 = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, RT_INDEFINITE_WAIT);
-                STAM_PROFILE_ADV_START(&pThis->StatReceive, a);
-
-                /*
-                 * A return code != VINF_SUCCESS means that we were woken up during a VM
-                 * state transition. Drop the packet and wait for the next one.
-                 */
-                if (RT_FAILURE(rc1))
-                    continue;
+                if (RT_FAILURE(rc))
+                    break;
+                cFrames++;
 
                 /*
-                 * Pass the data up.
+                 * A failure means that we were woken up during a VM state
+                 * transition. Drop the rest and wait for the next one.
                  */
-#ifdef LOG_ENABLED
-                uint64_t u64Now = RTTimeProgramNanoTS();
-                LogFlow(("drvTAPAsyncIoThread: %-4d bytes at %llu ns  deltas: r=%llu t=%llu\n",
-                         cbRead, u64Now, u64Now - pThis->u64LastReceiveTS, u64Now - pThis->u64LastTransferTS));
-                pThis->u64LastReceiveTS = u64Now;
+                rc = drvTAPRecvFrame(pThis, pThis->pbRecvBuf, cbRead);
+                if (RT_FAILURE(rc))
+                    break;
+#ifdef VBOX_WITH_CROSSBOW
+                /* dlpi_recv() blocks, so stick to one frame per wakeup. */
+                break;
 #endif
-                Log2(("drvTAPAsyncIoThread: cbRead=%#x\n" "%.*Rhxd\n", cbRead, cbRead, achBuf));
-                STAM_COUNTER_INC(&pThis->StatPktRecv);
-                STAM_COUNTER_ADD(&pThis->StatPktRecvBytes, cbRead);
-                rc1 = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, achBuf, cbRead);
-                AssertRC(rc1);
             }
-            else
+
+            if (   RT_FAILURE(rc)
+                && cFrames == 0)
             {
                 LogFlow(("drvTAPAsyncIoThread: RTFileRead -> %Rrc\n", rc));
                 if (rc == VERR_INVALID_HANDLE)
@@ -931,9 +1253,20 @@ static DECLCALLBACK(void) drvTAPDestruct(PPDMDRVINS pDrvIns)
     PDMDRV_CHECK_VERSIONS_RETURN_VOID(pDrvIns);
 
     /*
-     * Terminate the control pipe.
+     * Stop the receive thread before we pull the pipe and the buffer
+     * from under it (PDM would only destroy it after we return).
      */
     int rc;
+    if (pThis->pThread)
+    {
+        rc = PDMR3ThreadDestroy(pThis->pThread, NULL);
+        AssertRC(rc);
+        pThis->pThread = NULL;
+    }
+
+    /*
+     * Terminate the control pipe.
+     */
     rc = RTPipeClose(pThis->hPipeWrite); AssertRC(rc);
     pThis->hPipeWrite = NIL_RTPIPE;
     rc = RTPipeClose(pThis->hPipeRead); AssertRC(rc);
@@ -976,6 +1309,9 @@ static DECLCALLBACK(void) drvTAPDestruct(PPDMDRVINS pDrvIns)
     MMR3HeapFree(pThis->pszSetupApplication);
     MMR3HeapFree(pThis->pszTerminateApplication);
 
+    RTMemFree(pThis->pbRecvBuf);
+    pThis->pbRecvBuf = NULL;
+
     /*
      * Kill the xmit lock.
      */
@@ -990,6 +1326,9 @@ static DECLCALLBACK(void) drvTAPDestruct(PPDMDRVINS pDrvIns)
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktSentBytes);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktRecv);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktRecvBytes);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktSentGso);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktRecvGso);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatRecvWakeups);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatTransmit);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatReceive);
 #endif /* VBOX_WITH_STATISTICS */
@@ -1022,6 +1361,8 @@ static DECLCALLBACK(int) drvTAPConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
 #endif
     pThis->pszSetupApplication          = NULL;
     pThis->pszTerminateApplication      = NULL;
+    pThis->pbRecvBuf                    = NULL;
+    pThis->fVNetHdr                     = false;
 
     /* IBase */
     pDrvIns->IBase.pfnQueryInterface    = drvTAPQueryInterface;
@@ -1042,6 +1383,9 @@ static DECLCALLBACK(int) drvTAPConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktSentBytes,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,             "Number of sent bytes.",            "/Drivers/TAP%d/Bytes/Sent", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecv,       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of received packets.",      "/Drivers/TAP%d/Packets/Received", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecvBytes,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,             "Number of received bytes.",        "/Drivers/TAP%d/Bytes/Received", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktSentGso,    STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of GSO frames passed to the host whole.", "/Drivers/TAP%d/Packets/SentGso", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecvGso,    STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of GSO frames received from the host.",   "/Drivers/TAP%d/Packets/ReceivedGso", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatRecvWakeups,   STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of receive wakeups.",       "/Drivers/TAP%d/RecvWakeups", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatTransmit,      STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL,    "Profiling packet transmit runs.",  "/Drivers/TAP%d/Transmit", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatReceive,       STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL,    "Profiling packet receive runs.",   "/Drivers/TAP%d/Receive", pDrvIns->iInstance);
 #endif /* VBOX_WITH_STATISTICS */
@@ -1159,6 +1503,36 @@ static DECLCALLBACK(int) drvTAPConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
     Log(("drvTAPContruct: %d (from fd)\n", pThis->hFileDevice));
     rc = VINF_SUCCESS;
 
+#ifdef RT_OS_LINUX
+    /*
+     * If Main opened the device with IFF_VNET_HDR we can exchange unsegmented
+     * TCP frames and frames with partial checksums with the host.  Only ask
+     * the host for such frames if the device above can take them whole,
+     * otherwise we would just have to segment them ourselves.
+     */
+    struct ifreq IfReq;
+    RT_ZERO(IfReq);
+    if (   ioctl(RTFileToNative(pThis->hFileDevice), TUNGETIFF, &IfReq) == 0
+        && (IfReq.ifr_flags & IFF_VNET_HDR))
+    {
+        unsigned uOffloads = pThis->pIAboveNet->pfnReceiveGso ? TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6 : 0;
+        if (ioctl(RTFileToNative(pThis->hFileDevice), TUNSETOFFLOAD, uOffloads) != 0)
+        {
+            LogRel(("TAP#%d: TUNSETOFFLOAD(%#x) failed, errno=%d\n", pDrvIns->iInstance, uOffloads, errno));
+            uOffloads = 0;
+        }
+        pThis->fVNetHdr = true;
+        LogRel(("TAP#%d: Using virtio-net headers, offloads %#x\n", pDrvIns->iInstance, uOffloads));
+    }
+#endif
+
+    /*
+     * Allocate the receive buffer.
+     */
+    pThis->pbRecvBuf = (uint8_t *)RTMemAlloc(DRVTAP_RECV_BUF_SIZE);
+    if (!pThis->pbRecvBuf)
+        return VERR_NO_MEMORY;
+
     /*
      * Create the control pipe.
      */
@@ -39,6 +39,19 @@
 #include "VBoxDD.h"
 
 
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** The max number of datagrams queued for one transmit batch. */
+#define DRVUDPTUNNEL_MAX_XMIT_BATCH     32
+/** The max number of datagrams read per receive wakeup. */
+#define DRVUDPTUNNEL_MAX_RECV_BATCH     32
+/** The size of each receive buffer. */
+#define DRVUDPTUNNEL_RECV_BUF_SIZE      16384
+/** The max time datagrams may be held back (XmitWindow), in microseconds. */
+#define DRVUDPTUNNEL_MAX_XMIT_WINDOW    10000
+
+
 /*******************************************************************************
 *   Structures and Typedefs                                                    *
 *******************************************************************************/
@@ -74,6 +87,37 @@ typedef struct DRVUDPTUNNEL
     /** Flag whether the link is down. */
     bool volatile           fLinkDown;
 
+    /** Whether GSO frames are segmented into the transmit batch (BatchGso),
+     * otherwise they are segmented in place and sent one segment at a time. */
+    bool                    fBatchGso;
+    /** The max number of datagrams per transmit batch (XmitBatch). */
+    uint32_t                cMaxXmitBatch;
+    /** How long the datagrams of a batch may be held back after the transmit
+     * run ended, in microseconds (XmitWindow). 0 sends at the end of the run. */
+    uint32_t                cUsXmitWindow;
+    /** The number of queued bytes which sends the batch right away
+     * (XmitWindowSize). 0 if only XmitBatch limits the batch. */
+    uint32_t                cbXmitWindow;
+    /** Sends the held back batch once the window has passed. */
+    PTMTIMERR3              pXmitWindowTimer;
+    /** The number of datagrams queued in aXmitDgrams. */
+    uint32_t                cXmitDgrams;
+    /** The number of bytes queued in aXmitDgrams. */
+    size_t                  cbXmitDgrams;
+    /** The number of S/G buffers in apXmitSgBufs. */
+    uint32_t                cXmitSgBufs;
+    /** The datagrams queued for sending when the transmit run ends. */
+    RTSGBUF                 aXmitDgrams[DRVUDPTUNNEL_MAX_XMIT_BATCH];
+    /** The segments of the queued datagrams, the headers and payload of a
+     * carved GSO segment or just the frame. */
+    RTSGSEG                 aXmitSegs[DRVUDPTUNNEL_MAX_XMIT_BATCH][2];
+    /** The S/G buffers holding the queued frames, freed after sending. */
+    PPDMSCATTERGATHER       apXmitSgBufs[DRVUDPTUNNEL_MAX_XMIT_BATCH];
+    /** The headers of the carved GSO segments. */
+    uint8_t                 abXmitHdrs[DRVUDPTUNNEL_MAX_XMIT_BATCH][256];
+    /** The receive buffers (heap). */
+    RTSGSEG                 aRecvSegs[DRVUDPTUNNEL_MAX_RECV_BATCH];
+
 #ifdef VBOX_WITH_STATISTICS
     /** Number of sent packets. */
     STAMCOUNTER             StatPktSent;
@@ -83,6 +127,10 @@ typedef struct DRVUDPTUNNEL
     STAMCOUNTER             StatPktRecv;
     /** Number of received bytes. */
     STAMCOUNTER             StatPktRecvBytes;
+    /** Number of transmit batches sent. */
+    STAMCOUNTER             StatXmitBatches;
+    /** Number of receive batches read. */
+    STAMCOUNTER             StatRecvBatches;
     /** Profiling packet transmit runs. */
     STAMPROFILE             StatTransmit;
     /** Profiling packet receive runs. */
@@ -183,6 +231,92 @@ static DECLCALLBACK(int) drvUDPTunnelUp_FreeBuf(PPDMINETWORKUP pInterface, PPDMS
 }
 
 
+/**
+ * Sends the queued datagrams and frees the S/G buffers holding them.
+ *
+ * @returns IPRT status code.
+ * @param   pThis           The instance data.
+ */
+static int drvUDPTunnelXmitFlush(PDRVUDPTUNNEL pThis)
+{
+    Assert(RTCritSectIsOwner(&pThis->XmitLock));
+    int rc = VINF_SUCCESS;
+    if (pThis->cXmitDgrams && pThis->pServer)
+    {
+        STAM_COUNTER_INC(&pThis->StatXmitBatches);
+        size_t cSent = 0;
+        rc = RTUdpWriteMulti(pThis->pServer, &pThis->aXmitDgrams[0], pThis->cXmitDgrams, &pThis->DestAddress, &cSent);
+        if (RT_FAILURE(rc))
+            LogFunc(("RTUdpWriteMulti -> %Rrc, %zu of %u sent\n", rc, cSent, pThis->cXmitDgrams));
+    }
+    pThis->cXmitDgrams  = 0;
+    pThis->cbXmitDgrams = 0;
+
+    for (uint32_t i = 0; i < pThis->cXmitSgBufs; i++)
+    {
+        pThis->apXmitSgBufs[i]->fFlags = 0;
+        RTMemFree(pThis->apXmitSgBufs[i]);
+    }
+    pThis->cXmitSgBufs = 0;
+    return rc;
+}
+
+
+/**
+ * Queues a datagram for sending, flushing the queue if it is full.
+ *
+ * The memory must stay valid until the next flush, if the datagram is part of
+ * a frame in an S/G buffer that one must be queued before the flush frees the
+ * other buffers.
+ *
+ * @returns IPRT status code of the flush.
+ * @param   pThis           The instance data.
+ * @param   pvHdrs          The headers (of a carved GSO segment), NULL if none.
+ * @param   cbHdrs          The size of the headers.
+ * @param   pvPayload       The frame or segment payload.
+ * @param   cbPayload       The size of the payload.
+ */
+static int drvUDPTunnelXmitQueue(PDRVUDPTUNNEL pThis, void *pvHdrs, size_t cbHdrs, void *pvPayload, size_t cbPayload)
+{
+    uint32_t const i     = pThis->cXmitDgrams;
+    PRTSGSEG       paSegs = &pThis->aXmitSegs[i][0];
+    unsigned       cSegs  = 0;
+    if (pvHdrs)
+    {
+        paSegs[cSegs].pvSeg = pvHdrs;
+        paSegs[cSegs].cbSeg = cbHdrs;
+        cSegs++;
+    }
+    paSegs[cSegs].pvSeg = pvPayload;
+    paSegs[cSegs].cbSeg = cbPayload;
+    cSegs++;
+    RTSgBufInit(&pThis->aXmitDgrams[i], paSegs, cSegs);
+
+    pThis->cXmitDgrams   = i + 1;
+    pThis->cbXmitDgrams += cbHdrs + cbPayload;
+    if (   pThis->cXmitDgrams >= pThis->cMaxXmitBatch
+        || (pThis->cbXmitWindow && pThis->cbXmitDgrams >= pThis->cbXmitWindow))
+        return drvUDPTunnelXmitFlush(pThis);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Timer callback sending the batch held back by the transmit window.
+ *
+ * @param   pDrvIns         The driver instance.
+ * @param   pTimer          The timer.
+ * @param   pvUser          The instance data.
+ */
+static DECLCALLBACK(void) drvUDPTunnelXmitWindowTimer(PPDMDRVINS pDrvIns, PTMTIMER pTimer, void *pvUser)
+{
+    PDRVUDPTUNNEL pThis = (PDRVUDPTUNNEL)pvUser;
+    RTCritSectEnter(&pThis->XmitLock);
+    drvUDPTunnelXmitFlush(pThis);
+    RTCritSectLeave(&pThis->XmitLock);
+}
+
+
 /**
  * @interface_method_impl{PDMINETWORKUP,pfnSendBuf}
  */
@@ -200,6 +334,11 @@ static DECLCALLBACK(int) drvUDPTunnelUp_SendBuf(PPDMINETWORKUP pInterface, PPDMS
     /* Set an FTM checkpoint as this operation changes the state permanently. */
     PDMDrvHlpFTSetCheckpoint(pThis->pDrvIns, FTMCHECKPOINTTYPE_NETWORK);
 
+    /*
+     * Queue the frame, or the segments of a GSO frame, for sending at the end
+     * of the transmit run (or when the batch is full) so a burst from the
+     * guest goes out with a few system calls.
+     */
     int rc;
     if (!pSgBuf->pvUser)
     {
@@ -212,26 +351,56 @@ static DECLCALLBACK(int) drvUDPTunnelUp_SendBuf(PPDMINETWORKUP pInterface, PPDMS
         Log2(("pSgBuf->aSegs[0].pvSeg=%p pSgBuf->cbUsed=%#x\n%.*Rhxd\n",
               pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed, pSgBuf->cbUsed, pSgBuf->aSegs[0].pvSeg));
 
-        rc = RTUdpWrite(pThis->pServer, pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed, &pThis->DestAddress);
+        rc = drvUDPTunnelXmitQueue(pThis, NULL, 0, pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed);
     }
-    else
+    else if (!pThis->fBatchGso)
     {
+        /* Keep the order, then carve the segments in place and send them one
+           by one. */
         uint8_t         abHdrScratch[256];
         uint8_t const  *pbFrame = (uint8_t const *)pSgBuf->aSegs[0].pvSeg;
         PCPDMNETWORKGSO pGso    = (PCPDMNETWORKGSO)pSgBuf->pvUser;
         uint32_t const  cSegs   = PDMNetGsoCalcSegmentCount(pGso, pSgBuf->cbUsed);  Assert(cSegs > 1);
-        rc = VINF_SUCCESS;
-        for (size_t iSeg = 0; iSeg < cSegs; iSeg++)
+        rc = drvUDPTunnelXmitFlush(pThis);
+        for (uint32_t iSeg = 0; iSeg < cSegs; iSeg++)
         {
             uint32_t cbSegFrame;
             void *pvSegFrame = PDMNetGsoCarveSegmentQD(pGso, (uint8_t *)pbFrame, pSgBuf->cbUsed, abHdrScratch,
                                                        iSeg, cSegs, &cbSegFrame);
-            rc = RTUdpWrite(pThis->pServer, pvSegFrame, cbSegFrame, &pThis->DestAddress);
+            int rc2 = RTUdpWrite(pThis->pServer, pvSegFrame, cbSegFrame, &pThis->DestAddress);
+            if (RT_FAILURE(rc2))
+                rc = rc2;
+        }
+    }
+    else
+    {
+        /* The segments are carved into separate header buffers so the frame
+           stays intact until they have all been sent. */
+        uint8_t const  *pbFrame = (uint8_t const *)pSgBuf->aSegs[0].pvSeg;
+        PCPDMNETWORKGSO pGso    = (PCPDMNETWORKGSO)pSgBuf->pvUser;
+        uint32_t const  cSegs   = PDMNetGsoCalcSegmentCount(pGso, pSgBuf->cbUsed);  Assert(cSegs > 1);
+        rc = VINF_SUCCESS;
+        for (uint32_t iSeg = 0; iSeg < cSegs; iSeg++)
+        {
+            uint8_t *pbSegHdrs = &pThis->abXmitHdrs[pThis->cXmitDgrams][0];
+            uint32_t cbSegPayload;
+            uint32_t offSegPayload = PDMNetGsoCarveSegment(pGso, pbFrame, pSgBuf->cbUsed, iSeg, cSegs,
+                                                           pbSegHdrs, &cbSegPayload);
+            int rc2 = drvUDPTunnelXmitQueue(pThis, pbSegHdrs, pGso->cbHdrs,
+                                            (uint8_t *)pbFrame + offSegPayload, cbSegPayload);
+            if (RT_FAILURE(rc2))
+                rc = rc2;
         }
     }
 
-    pSgBuf->fFlags = 0;
-    RTMemFree(pSgBuf);
+    /* The buffer is freed by the flush which sends the last of it. */
+    if (pThis->cXmitDgrams)
+        pThis->apXmitSgBufs[pThis->cXmitSgBufs++] = pSgBuf;
+    else
+    {
+        pSgBuf->fFlags = 0;
+        RTMemFree(pSgBuf);
+    }
 
     STAM_PROFILE_STOP(&pThis->StatTransmit, a);
     AssertRC(rc);
@@ -252,6 +421,12 @@ static DECLCALLBACK(int) drvUDPTunnelUp_SendBuf(PPDMINETWORKUP pInterface, PPDMS
 static DECLCALLBACK(void) drvUDPTunnelUp_EndXmit(PPDMINETWORKUP pInterface)
 {
     PDRVUDPTUNNEL pThis = PDMINETWORKUP_2_DRVUDPTUNNEL(pInterface);
+
+    /* Within the window the batch may still fill up from the next runs. */
+    if (!pThis->cUsXmitWindow)
+        drvUDPTunnelXmitFlush(pThis);
+    else if (pThis->cXmitDgrams && !TMTimerIsActive(pThis->pXmitWindowTimer))
+        TMTimerSetMicro(pThis->pXmitWindowTimer, pThis->cUsXmitWindow);
     RTCritSectLeave(&pThis->XmitLock);
 }
 
@@ -295,6 +470,10 @@ static DECLCALLBACK(void) drvUDPTunnelUp_NotifyLinkChanged(PPDMINETWORKUP pInter
 }
 
 
+/**
+ * UDP server callback, reads the queued datagrams (up to a batch) and passes
+ * them up.
+ */
 static DECLCALLBACK(int) drvUDPTunnelReceive(RTSOCKET Sock, void *pvUser)
 {
     PDRVUDPTUNNEL pThis = PDMINS_2_DATA((PPDMDRVINS)pvUser, PDRVUDPTUNNEL);
@@ -303,15 +482,19 @@ static DECLCALLBACK(int) drvUDPTunnelReceive(RTSOCKET Sock, void *pvUser)
     STAM_PROFILE_ADV_START(&pThis->StatReceive, a);
 
     /*
-     * Read the frame.
+     * Read the frames.
      */
-    char achBuf[16384];
-    size_t cbRead = 0;
-    int rc = RTUdpRead(Sock, achBuf, sizeof(achBuf), &cbRead, NULL);
+    size_t acbRead[DRVUDPTUNNEL_MAX_RECV_BATCH];
+    size_t cRead = 0;
+    int rc = RTUdpReadMulti(Sock, &pThis->aRecvSegs[0], RT_ELEMENTS(pThis->aRecvSegs), &acbRead[0], &cRead);
     if (RT_SUCCESS(rc))
     {
-        if (!pThis->fLinkDown)
+        STAM_COUNTER_INC(&pThis->StatRecvBatches);
+        for (size_t iFrame = 0; iFrame < cRead && !pThis->fLinkDown; iFrame++)
         {
+            void const  *pvFrame = pThis->aRecvSegs[iFrame].pvSeg;
+            size_t const cbRead  = acbRead[iFrame];
+
             /*
              * Wait for the device to have space for this frame.
              * Most guests use frame-sized receive buffers, hence non-zero cbMax
@@ -331,13 +514,10 @@ static DECLCALLBACK(int) drvUDPTunnelReceive(RTSOCKET Sock, void *pvUser)
 
             /*
              * A return code != VINF_SUCCESS means that we were woken up during a VM
-             * state transition. Drop the packet and wait for the next one.
+             * state transition. Drop the packets and wait for the next ones.
              */
             if (RT_FAILURE(rc))
-            {
-                STAM_PROFILE_ADV_STOP(&pThis->StatReceive, a);
-                return VINF_SUCCESS;
-            }
+                break;
 
             /*
              * Pass the data up.
@@ -348,17 +528,17 @@ static DECLCALLBACK(int) drvUDPTunnelReceive(RTSOCKET Sock, void *pvUser)
                      cbRead, u64Now, u64Now - pThis->u64LastReceiveTS, u64Now - pThis->u64LastTransferTS));
             pThis->u64LastReceiveTS = u64Now;
 #endif
-            Log2(("cbRead=%#x\n" "%.*Rhxd\n", cbRead, cbRead, achBuf));
+            Log2(("cbRead=%#x\n" "%.*Rhxd\n", cbRead, cbRead, pvFrame));
             STAM_COUNTER_INC(&pThis->StatPktRecv);
             STAM_COUNTER_ADD(&pThis->StatPktRecvBytes, cbRead);
-            rc = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, achBuf, cbRead);
+            rc = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pvFrame, cbRead);
             AssertRC(rc);
         }
     }
     else
     {
         STAM_PROFILE_ADV_STOP(&pThis->StatReceive, a);
-        LogFunc(("RTUdpRead -> %Rrc\n", rc));
+        LogFunc(("RTUdpReadMulti -> %Rrc\n", rc));
         if (rc == VERR_INVALID_HANDLE)
             return VERR_UDP_SERVER_STOP;
     }
@@ -415,10 +595,19 @@ static DECLCALLBACK(void) drvUDPTunnelDestruct(PPDMDRVINS pDrvIns)
     }
 
     /*
-     * Kill the xmit lock.
+     * Drop what the transmit window still holds and kill the xmit lock.
      */
     if (RTCritSectIsInitialized(&pThis->XmitLock))
+    {
+        RTCritSectEnter(&pThis->XmitLock);
+        drvUDPTunnelXmitFlush(pThis);
+        RTCritSectLeave(&pThis->XmitLock);
         RTCritSectDelete(&pThis->XmitLock);
+    }
+
+    /* The server is gone, so is the receive thread. */
+    RTMemFree(pThis->aRecvSegs[0].pvSeg);
+    pThis->aRecvSegs[0].pvSeg = NULL;
 
 #ifdef VBOX_WITH_STATISTICS
     /*
@@ -428,6 +617,8 @@ static DECLCALLBACK(void) drvUDPTunnelDestruct(PPDMDRVINS pDrvIns)
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktSentBytes);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktRecv);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktRecvBytes);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatXmitBatches);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatRecvBatches);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatTransmit);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatReceive);
 #endif /* VBOX_WITH_STATISTICS */
@@ -470,6 +661,8 @@ static DECLCALLBACK(int) drvUDPTunnelConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCf
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktSentBytes,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,             "Number of sent bytes.",            "/Drivers/UDPTunnel%d/Bytes/Sent", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecv,       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of received packets.",      "/Drivers/UDPTunnel%d/Packets/Received", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecvBytes,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,             "Number of received bytes.",        "/Drivers/UDPTunnel%d/Bytes/Received", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatXmitBatches,   STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of transmit batches.",      "/Drivers/UDPTunnel%d/XmitBatches", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatRecvBatches,   STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of receive batches.",       "/Drivers/UDPTunnel%d/RecvBatches", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatTransmit,      STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL,    "Profiling packet transmit runs.",  "/Drivers/UDPTunnel%d/Transmit", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatReceive,       STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL,    "Profiling packet receive runs.",   "/Drivers/UDPTunnel%d/Receive", pDrvIns->iInstance);
 #endif /* VBOX_WITH_STATISTICS */
@@ -477,7 +670,7 @@ static DECLCALLBACK(int) drvUDPTunnelConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCf
     /*
      * Validate the config.
      */
-    if (!CFGMR3AreValuesValid(pCfg, "sport\0dest\0dport"))
+    if (!CFGMR3AreValuesValid(pCfg, "sport\0dest\0dport\0XmitBatch\0XmitWindow\0XmitWindowSize\0BatchGso"))
         return PDMDRV_SET_ERROR(pDrvIns, VERR_PDM_DRVINS_UNKNOWN_CFG_VALUES, "");
 
     /*
@@ -527,7 +720,45 @@ static DECLCALLBACK(int) drvUDPTunnelConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCf
         rc = PDMDRV_SET_ERROR(pDrvIns, rc,
                               N_("DrvUDPTunnel: Configuration error: Querying \"dest\" as string failed"));
 
-    LogRel(("UDPTunnel#%d: sport=%d;dest=%s;dport=%d\n", pDrvIns->iInstance, pThis->uSrcPort, pThis->pszDestIP, pThis->uDestPort));
+    rc = CFGMR3QueryU32Def(pCfg, "XmitBatch", &pThis->cMaxXmitBatch, DRVUDPTUNNEL_MAX_XMIT_BATCH);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc,
+                                N_("DrvUDPTunnel: Configuration error: Querying \"XmitBatch\" as integer failed"));
+    if (pThis->cMaxXmitBatch < 1 || pThis->cMaxXmitBatch > DRVUDPTUNNEL_MAX_XMIT_BATCH)
+        return PDMDrvHlpVMSetError(pDrvIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("DrvUDPTunnel: Configuration error: \"XmitBatch\" must be between 1 and %u"),
+                                   DRVUDPTUNNEL_MAX_XMIT_BATCH);
+
+    rc = CFGMR3QueryU32Def(pCfg, "XmitWindow", &pThis->cUsXmitWindow, 0);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc,
+                                N_("DrvUDPTunnel: Configuration error: Querying \"XmitWindow\" as integer failed"));
+    if (pThis->cUsXmitWindow > DRVUDPTUNNEL_MAX_XMIT_WINDOW)
+        return PDMDrvHlpVMSetError(pDrvIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("DrvUDPTunnel: Configuration error: \"XmitWindow\" must not exceed %u microseconds"),
+                                   DRVUDPTUNNEL_MAX_XMIT_WINDOW);
+
+    rc = CFGMR3QueryU32Def(pCfg, "XmitWindowSize", &pThis->cbXmitWindow, 0);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc,
+                                N_("DrvUDPTunnel: Configuration error: Querying \"XmitWindowSize\" as integer failed"));
+
+    rc = CFGMR3QueryBoolDef(pCfg, "BatchGso", &pThis->fBatchGso, true);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc,
+                                N_("DrvUDPTunnel: Configuration error: Querying \"BatchGso\" as boolean failed"));
+
+    LogRel(("UDPTunnel#%d: sport=%d;dest=%s;dport=%d;xmitbatch=%u;xmitwindow=%uus/%u bytes;batchgso=%RTbool\n",
+            pDrvIns->iInstance, pThis->uSrcPort, pThis->pszDestIP, pThis->uDestPort, pThis->cMaxXmitBatch,
+            pThis->cUsXmitWindow, pThis->cbXmitWindow, pThis->fBatchGso));
+
+    if (pThis->cUsXmitWindow)
+    {
+        rc = PDMDrvHlpTMTimerCreate(pDrvIns, TMCLOCK_VIRTUAL, drvUDPTunnelXmitWindowTimer, pThis,
+                                    TMTIMER_FLAGS_NO_CRIT_SECT, "UDPTunnel Xmit Window", &pThis->pXmitWindowTimer);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
 
     /*
      * Set up destination address for UDP.
@@ -541,6 +772,18 @@ static DECLCALLBACK(int) drvUDPTunnelConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCf
     rc = RTStrAPrintf(&pThis->pszInstance, "UDPTunnel%d", pDrvIns->iInstance);
     AssertRC(rc);
 
+    /*
+     * Allocate the receive buffers in one go.
+     */
+    uint8_t *pbRecvBufs = (uint8_t *)RTMemAlloc(DRVUDPTUNNEL_MAX_RECV_BATCH * DRVUDPTUNNEL_RECV_BUF_SIZE);
+    if (!pbRecvBufs)
+        return VERR_NO_MEMORY;
+    for (unsigned i = 0; i < RT_ELEMENTS(pThis->aRecvSegs); i++)
+    {
+        pThis->aRecvSegs[i].pvSeg = pbRecvBufs + i * DRVUDPTUNNEL_RECV_BUF_SIZE;
+        pThis->aRecvSegs[i].cbSeg = DRVUDPTUNNEL_RECV_BUF_SIZE;
+    }
+
     /*
      * Start the UDP receiving thread.
      */
@@ -570,6 +813,11 @@ static DECLCALLBACK(void) drvUDPTunnelSuspend(PPDMDRVINS pDrvIns)
     LogFlowFunc(("\n"));
     PDRVUDPTUNNEL pThis = PDMINS_2_DATA(pDrvIns, PDRVUDPTUNNEL);
 
+    /* Send what the transmit window holds back while we still can. */
+    RTCritSectEnter(&pThis->XmitLock);
+    drvUDPTunnelXmitFlush(pThis);
+    RTCritSectLeave(&pThis->XmitLock);
+
     if (pThis->pServer)
     {
         RTUdpServerDestroy(pThis->pServer);
@@ -75,9 +75,8 @@ static const char s_szDummyData[] = { 0, 0, 0, 0 };
 /**
  * Internal helper.
  */
-static void pcapCalcHeader(struct pcaprec_hdr *pHdr, uint64_t StartNanoTS, size_t cbFrame, size_t cbMax)
+static void pcapCalcHeader(struct pcaprec_hdr *pHdr, uint64_t u64TS, size_t cbFrame, size_t cbMax)
 {
-    uint64_t u64TS = RTTimeNanoTS() - StartNanoTS;
     pHdr->ts_sec   = (uint32_t)(u64TS / 1000000000);
     pHdr->ts_usec  = (uint32_t)((u64TS / 1000) % 1000000);
     pHdr->incl_len = (uint32_t)RT_MIN(cbFrame, cbMax);
@@ -105,7 +104,24 @@ static void pcapUpdateHeader(struct pcaprec_hdr *pHdr, size_t cbFrame, size_t cb
  */
 int PcapStreamHdr(PRTSTREAM pStream, uint64_t StartNanoTS)
 {
-    int rc1 = RTStrmWrite(pStream, &s_Hdr, sizeof(s_Hdr));
+    return PcapStreamHdrEx(pStream, StartNanoTS, s_Hdr.pcap.snaplen);
+}
+
+
+/**
+ * Writes the stream header with a custom snapshot length.
+ *
+ * @returns IPRT status code, @see RTStrmWrite.
+ *
+ * @param   pStream         The stream handle.
+ * @param   StartNanoTS     What to subtract from the RTTimeNanoTS output.
+ * @param   cbSnapLen       The max number of bytes recorded for each frame.
+ */
+int PcapStreamHdrEx(PRTSTREAM pStream, uint64_t StartNanoTS, uint32_t cbSnapLen)
+{
+    pcaprec_hdr_init Hdr = s_Hdr;
+    Hdr.pcap.snaplen = cbSnapLen;
+    int rc1 = RTStrmWrite(pStream, &Hdr, sizeof(Hdr));
     int rc2 = PcapStreamFrame(pStream, StartNanoTS, s_szDummyData, 60, sizeof(s_szDummyData));
     return RT_SUCCESS(rc1) ? rc2 : rc1;
 }
@@ -123,9 +139,27 @@ int PcapStreamHdr(PRTSTREAM pStream, uint64_t StartNanoTS)
  * @param   cbMax           The max number of bytes to include in the file.
  */
 int PcapStreamFrame(PRTSTREAM pStream, uint64_t StartNanoTS, const void *pvFrame, size_t cbFrame, size_t cbMax)
+{
+    return PcapStreamFrameAt(pStream, RTTimeNanoTS() - StartNanoTS, pvFrame, cbFrame, cbMax);
+}
+
+
+/**
+ * Writes a frame captured at a given time to a stream.
+ *
+ * @returns IPRT status code, @see RTStrmWrite.
+ *
+ * @param   pStream         The stream handle.
+ * @param   NanoTS          The capture time relative to the start of the
+ *                          capture.
+ * @param   pvFrame         The start of the frame.
+ * @param   cbFrame         The size of the frame.
+ * @param   cbMax           The max number of bytes to include in the file.
+ */
+int PcapStreamFrameAt(PRTSTREAM pStream, uint64_t NanoTS, const void *pvFrame, size_t cbFrame, size_t cbMax)
 {
     struct pcaprec_hdr Hdr;
-    pcapCalcHeader(&Hdr, StartNanoTS, cbFrame, cbMax);
+    pcapCalcHeader(&Hdr, NanoTS, cbFrame, cbMax);
     int rc1 = RTStrmWrite(pStream, &Hdr, sizeof(Hdr));
     int rc2 = RTStrmWrite(pStream, pvFrame, Hdr.incl_len);
     return RT_SUCCESS(rc1) ? rc2 : rc1;
@@ -147,9 +181,30 @@ int PcapStreamFrame(PRTSTREAM pStream, uint64_t StartNanoTS, const void *pvFrame
  */
 int PcapStreamGsoFrame(PRTSTREAM pStream, uint64_t StartNanoTS, PCPDMNETWORKGSO pGso,
                        const void *pvFrame, size_t cbFrame, size_t cbSegMax)
+{
+    return PcapStreamGsoFrameAt(pStream, RTTimeNanoTS() - StartNanoTS, pGso, pvFrame, cbFrame, cbSegMax);
+}
+
+
+/**
+ * Writes a GSO frame captured at a given time to a stream.
+ *
+ * @returns IPRT status code, @see RTStrmWrite.
+ *
+ * @param   pStream         The stream handle.
+ * @param   NanoTS          The capture time relative to the start of the
+ *                          capture.
+ * @param   pGso            Pointer to the GSO context.
+ * @param   pvFrame         The start of the GSO frame.
+ * @param   cbFrame         The size of the GSO frame.
+ * @param   cbSegMax        The max number of bytes to include in the file for
+ *                          each segment.
+ */
+int PcapStreamGsoFrameAt(PRTSTREAM pStream, uint64_t NanoTS, PCPDMNETWORKGSO pGso,
+                         const void *pvFrame, size_t cbFrame, size_t cbSegMax)
 {
     struct pcaprec_hdr Hdr;
-    pcapCalcHeader(&Hdr, StartNanoTS, 0, 0);
+    pcapCalcHeader(&Hdr, NanoTS, 0, 0);
 
     uint8_t const  *pbFrame = (uint8_t const *)pvFrame;
     uint8_t         abHdrs[256];
@@ -205,7 +260,7 @@ int PcapFileHdr(RTFILE File, uint64_t StartNanoTS)
 int PcapFileFrame(RTFILE File, uint64_t StartNanoTS, const void *pvFrame, size_t cbFrame, size_t cbMax)
 {
     struct pcaprec_hdr  Hdr;
-    pcapCalcHeader(&Hdr, StartNanoTS, cbFrame, cbMax);
+    pcapCalcHeader(&Hdr, RTTimeNanoTS() - StartNanoTS, cbFrame, cbMax);
     int rc1 = RTFileWrite(File, &Hdr, sizeof(Hdr), NULL);
     int rc2 = RTFileWrite(File, pvFrame, Hdr.incl_len, NULL);
     return RT_SUCCESS(rc1) ? rc2 : rc1;
@@ -229,7 +284,7 @@ int PcapFileGsoFrame(RTFILE File, uint64_t StartNanoTS, PCPDMNETWORKGSO pGso,
                      const void *pvFrame, size_t cbFrame, size_t cbSegMax)
 {
     struct pcaprec_hdr Hdr;
-    pcapCalcHeader(&Hdr, StartNanoTS, 0, 0);
+    pcapCalcHeader(&Hdr, RTTimeNanoTS() - StartNanoTS, 0, 0);
 
     uint8_t const  *pbFrame = (uint8_t const *)pvFrame;
     uint8_t         abHdrs[256];
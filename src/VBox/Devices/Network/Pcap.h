@@ -24,9 +24,13 @@
 RT_C_DECLS_BEGIN
 
 int PcapStreamHdr(PRTSTREAM pStream, uint64_t StartNanoTS);
+int PcapStreamHdrEx(PRTSTREAM pStream, uint64_t StartNanoTS, uint32_t cbSnapLen);
 int PcapStreamFrame(PRTSTREAM pStream, uint64_t StartNanoTS, const void *pvFrame, size_t cbFrame, size_t cbMax);
+int PcapStreamFrameAt(PRTSTREAM pStream, uint64_t NanoTS, const void *pvFrame, size_t cbFrame, size_t cbMax);
 int PcapStreamGsoFrame(PRTSTREAM pStream, uint64_t StartNanoTS, PCPDMNETWORKGSO pGso,
                        const void *pvFrame, size_t cbFrame, size_t cbMax);
+int PcapStreamGsoFrameAt(PRTSTREAM pStream, uint64_t NanoTS, PCPDMNETWORKGSO pGso,
+                         const void *pvFrame, size_t cbFrame, size_t cbSegMax);
 
 int PcapFileHdr(RTFILE File, uint64_t StartNanoTS);
 int PcapFileFrame(RTFILE File, uint64_t StartNanoTS, const void *pvFrame, size_t cbFrame, size_t cbMax);
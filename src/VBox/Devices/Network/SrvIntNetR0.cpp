@@ -57,6 +57,22 @@
 # define INTNET_GROW_DSTTAB_SIZE    1
 #endif
 
+/** The number of MAC address hash buckets (INTNETMACTAB::aiHashHeads).
+ * Must be a power of two. */
+#define INTNET_MACTAB_HASH_SIZE     256
+/** The shift count for reducing a 32-bit hash to a bucket index. */
+#define INTNET_MACTAB_HASH_SHIFT    (32 - 8)
+AssertCompile(RT_BIT_32(32 - INTNET_MACTAB_HASH_SHIFT) == INTNET_MACTAB_HASH_SIZE);
+/** End of a hash chain / invalid table index. */
+#define INTNET_MACTAB_NIL           UINT16_MAX
+AssertCompile(INTNET_MAX_IFS < INTNET_MACTAB_NIL);
+
+/** The max number of receivers a sending interface can hold back wakeups for
+ * while processing its send ring (INTNETIF::apPendingWakeups). */
+#define INTNET_MAX_PENDING_WAKEUPS  16
+/** The max frame count threshold of the receive wakeup policy. */
+#define INTNET_MAX_WAKEUP_FRAMES    _4K
+
 /** The wakeup bit in the INTNETIF::cBusy and INTNETRUNKIF::cBusy counters. */
 #define INTNET_BUSY_WAKEUP_MASK     RT_BIT_32(30)
 
@@ -80,6 +96,10 @@ typedef struct INTNETMACTABENTRY
      * to this interface onto the trunk.  The reasoning for this is that this could
      * be the interface of a VM that just has been teleported to a different host. */
     bool                    fActive;
+    /** The index of the next entry in the same hash chain, INTNET_MACTAB_NIL
+     * if last.  Only valid while the entry is hashed, see
+     * intnetR0MacTabReindex. */
+    uint16_t                iHashNext;
     /** Pointer to the network interface. */
     struct INTNETIF        *pIf;
 } INTNETMACTABENTRY;
@@ -100,6 +120,17 @@ typedef struct INTNETMACTAB
     uint32_t                cEntriesAllocated;
     /** Table entries. */
     PINTNETMACTABENTRY      paEntries;
+    /** Indexes of the active entries that must be considered for every unicast
+     * frame, i.e. those with a dummy MAC address or in effective promiscuous
+     * mode.  Lives in the same heap block as paEntries and has room for
+     * cEntriesAllocated indexes. */
+    uint16_t               *paiSpecial;
+    /** The number of valid indexes in paiSpecial. */
+    uint32_t                cSpecial;
+    /** MAC address hash table heads.  Each bucket chains the active entries with
+     * a real (non-dummy) MAC address through INTNETMACTABENTRY::iHashNext.
+     * INTNET_MACTAB_NIL if empty. */
+    uint16_t                aiHashHeads[INTNET_MACTAB_HASH_SIZE];
 
     /** The number of interface entries currently in promicuous mode. */
     uint32_t                cPromiscuousEntries;
@@ -282,6 +313,31 @@ typedef struct INTNETIF
     PINTNETDSTTAB volatile  pDstTab;
     /** Pointer to the trunk's per interface data.  Can be NULL. */
     void                   *pvIfData;
+
+    /** @name Receive wakeup coalescing, protected by hRecvInSpinlock.
+     * @{ */
+    /** The max number of frames to queue before signalling hRecvEvent.  0 and
+     * 1 means signalling it for every frame (default). */
+    uint32_t                cWakeupMaxFrames;
+    /** The number of frames queued since hRecvEvent was last signalled.  Only
+     * maintained when wakeups are being held back. */
+    uint32_t                cWakeupPendingFrames;
+    /** The max time (ns) the first of the pending frames may wait for the
+     * wakeup, 0 if no limit other than the end of the send batch. */
+    uint64_t                cNsWakeupMaxLatency;
+    /** The RTTimeSystemNanoTS of the first pending frame. */
+    uint64_t                u64WakeupPendingTS;
+    /** Set if some sender has the interface in its apPendingWakeups. */
+    bool                    fWakeupPending;
+    /** @} */
+
+    /** The number of entries in apPendingWakeups.
+     * Only accessed by the thread owning pDstTab, i.e. while sending. */
+    uint32_t                cPendingWakeups;
+    /** The receivers we're holding back wakeups for while processing the send
+     * ring.  Each entry holds a busy reference to the interface. */
+    struct INTNETIF        *apPendingWakeups[INTNET_MAX_PENDING_WAKEUPS];
+
     /** Header buffer for when we're carving GSO frames. */
     uint8_t                 abGsoHdrs[256];
 } INTNETIF;
@@ -1424,6 +1480,74 @@ DECL_FORCE_INLINE(bool) intnetR0AreMacAddrsEqual(PCRTMAC pDstAddr1, PCRTMAC pDst
 }
 
 
+/**
+ * Calculates the hash bucket of a MAC address.
+ *
+ * @returns Index into INTNETMACTAB::aiHashHeads.
+ * @param   pMacAddr            The address.
+ */
+DECL_FORCE_INLINE(uint32_t) intnetR0MacTabHash(PCRTMAC pMacAddr)
+{
+    /* The interfaces on a network usually share the OUI, so mix the NIC
+       specific part in properly (Fibonacci hashing). */
+    uint32_t u32 = RT_MAKE_U32(pMacAddr->au16[1], pMacAddr->au16[2]) ^ pMacAddr->au16[0];
+    return (u32 * UINT32_C(0x9e3779b1)) >> INTNET_MACTAB_HASH_SHIFT;
+}
+
+
+/**
+ * Allocates a MAC address table entry array together with the special entry
+ * index array.
+ *
+ * @returns Pointer to the entries, NULL on failure.  Free with RTMemFree.
+ * @param   cEntries            The number of entries to allocate room for.
+ */
+static PINTNETMACTABENTRY intnetR0MacTabAllocEntries(uint32_t cEntries)
+{
+    AssertCompile(!(sizeof(INTNETMACTABENTRY) % sizeof(uint16_t)));
+    return (PINTNETMACTABENTRY)RTMemAlloc((sizeof(INTNETMACTABENTRY) + sizeof(uint16_t)) * cEntries);
+}
+
+
+/**
+ * Rebuilds the MAC address hash and the special entry list.
+ *
+ * This must be called after changing the set of entries, or the address,
+ * active or promiscuous state of any entry.  The caller must own the network
+ * address spinlock.  The cost is linear, but these are rare events compared
+ * to the frames being switched.
+ *
+ * @param   pTab                The MAC address table.
+ */
+static void intnetR0MacTabReindex(PINTNETMACTAB pTab)
+{
+    for (uint32_t iHash = 0; iHash < RT_ELEMENTS(pTab->aiHashHeads); iHash++)
+        pTab->aiHashHeads[iHash] = INTNET_MACTAB_NIL;
+
+    /* Inserting in reverse order keeps the chains in ascending index order. */
+    uint32_t cSpecial = 0;
+    uint32_t iIfMac   = pTab->cEntries;
+    while (iIfMac-- > 0)
+    {
+        PINTNETMACTABENTRY pEntry = &pTab->paEntries[iIfMac];
+        pEntry->iHashNext = INTNET_MACTAB_NIL;
+        if (!pEntry->fActive)
+            continue;
+
+        bool const fDummy = intnetR0IsMacAddrDummy(&pEntry->MacAddr);
+        if (fDummy || pEntry->fPromiscuousEff)
+            pTab->paiSpecial[cSpecial++] = (uint16_t)iIfMac;
+        if (!fDummy)
+        {
+            uint32_t const iHash = intnetR0MacTabHash(&pEntry->MacAddr);
+            pEntry->iHashNext = pTab->aiHashHeads[iHash];
+            pTab->aiHashHeads[iHash] = (uint16_t)iIfMac;
+        }
+    }
+    pTab->cSpecial = cSpecial;
+}
+
+
 /**
  * Switch a unicast frame based on the network layer address (OSI level 3) and
  * return a destination table.
@@ -1563,37 +1687,47 @@ static INTNETSWDECISION intnetR0NetworkPreSwitchUnicast(PINTNETNETWORK pNetwork,
     RTSPINLOCKTMP       Tmp             = RTSPINLOCKTMP_INITIALIZER;
     RTSpinlockAcquireNoInts(pNetwork->hAddrSpinlock, &Tmp);
 
-    /* Iterate the internal network interfaces and look for matching source and
-       destination addresses. */
-    uint32_t cExactHits = 0;
-    uint32_t iIfMac     = pTab->cEntries;
-    while (iIfMac-- > 0)
+    /* Interfaces with unknown addresses or which want to see all trunk
+       traffic require the full switching treatment. */
+    bool fBroadcast = false;
+    for (uint32_t iSpecial = 0; iSpecial < pTab->cSpecial; iSpecial++)
     {
-        if (pTab->paEntries[iIfMac].fActive)
+        PINTNETMACTABENTRY pEntry = &pTab->paEntries[pTab->paiSpecial[iSpecial]];
+        Assert(pEntry->fActive);
+        if (   pEntry->fPromiscuousSeeTrunk
+            || intnetR0IsMacAddrDummy(&pEntry->MacAddr))
         {
-            /* Unknown interface address? */
-            if (intnetR0IsMacAddrDummy(&pTab->paEntries[iIfMac].MacAddr))
-                break;
-
-            /* Promiscuous mode? */
-            if (pTab->paEntries[iIfMac].fPromiscuousSeeTrunk)
-                break;
+            fBroadcast = true;
+            break;
+        }
+    }
 
-            /* Paranoia - this shouldn't happen, right? */
-            if (    pSrcAddr
-                &&  intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pSrcAddr))
+    /* Paranoia - the source address shouldn't belong to an internal
+       network interface, right? */
+    if (   !fBroadcast
+        && pSrcAddr)
+        for (uint32_t iIfMac = pTab->aiHashHeads[intnetR0MacTabHash(pSrcAddr)];
+             iIfMac != INTNET_MACTAB_NIL;
+             iIfMac = pTab->paEntries[iIfMac].iHashNext)
+            if (intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pSrcAddr))
+            {
+                fBroadcast = true;
                 break;
+            }
 
-            /* Exact match? */
+    /* Exact match? */
+    if (!fBroadcast)
+        for (uint32_t iIfMac = pTab->aiHashHeads[intnetR0MacTabHash(pDstAddr)];
+             iIfMac != INTNET_MACTAB_NIL;
+             iIfMac = pTab->paEntries[iIfMac].iHashNext)
             if (intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pDstAddr))
             {
+                Assert(pTab->paEntries[iIfMac].fActive);
                 enmSwDecision = pTab->fHostPromiscuousEff && fSrc == INTNETTRUNKDIR_WIRE
                               ? INTNETSWDECISION_BROADCAST
                               : INTNETSWDECISION_INTNET;
                 break;
             }
-        }
-    }
 
     RTSpinlockReleaseNoInts(pNetwork->hAddrSpinlock, &Tmp);
     return enmSwDecision;
@@ -1629,30 +1763,52 @@ static INTNETSWDECISION intnetR0NetworkSwitchUnicast(PINTNETNETWORK pNetwork, ui
     pDstTab->pTrunk     = 0;
     pDstTab->cIfs       = 0;
 
-    /* Find exactly matching or promiscuous interfaces. */
+    /* Find exactly matching interfaces using the hash. */
     uint32_t cExactHits = 0;
-    uint32_t iIfMac     = pTab->cEntries;
-    while (iIfMac-- > 0)
+    for (uint32_t iIfMac = pTab->aiHashHeads[intnetR0MacTabHash(pDstAddr)];
+         iIfMac != INTNET_MACTAB_NIL;
+         iIfMac = pTab->paEntries[iIfMac].iHashNext)
     {
-        if (pTab->paEntries[iIfMac].fActive)
+        PINTNETMACTABENTRY pEntry = &pTab->paEntries[iIfMac];
+        Assert(pEntry->fActive);
+        if (intnetR0AreMacAddrsEqual(&pEntry->MacAddr, pDstAddr))
         {
-            bool fExact = intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pDstAddr);
-            if (   fExact
-                || intnetR0IsMacAddrDummy(&pTab->paEntries[iIfMac].MacAddr)
-                || (   pTab->paEntries[iIfMac].fPromiscuousSeeTrunk
-                    || (!fSrc && pTab->paEntries[iIfMac].fPromiscuousEff) )
-               )
+            cExactHits++;
+
+            PINTNETIF pIf = pEntry->pIf;                            AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
+            if (RT_LIKELY(pIf != pIfSender)) /* paranoia */
             {
-                cExactHits += fExact;
+                uint32_t iIfDst = pDstTab->cIfs++;
+                pDstTab->aIfs[iIfDst].pIf            = pIf;
+                pDstTab->aIfs[iIfDst].fReplaceDstMac = false;
+                intnetR0BusyIncIf(pIf);
+            }
+        }
+    }
 
-                PINTNETIF pIf = pTab->paEntries[iIfMac].pIf;        AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
-                if (RT_LIKELY(pIf != pIfSender)) /* paranoia */
-                {
-                    uint32_t iIfDst = pDstTab->cIfs++;
-                    pDstTab->aIfs[iIfDst].pIf            = pIf;
-                    pDstTab->aIfs[iIfDst].fReplaceDstMac = false;
-                    intnetR0BusyIncIf(pIf);
-                }
+    /* Add interfaces with unknown addresses and promiscuous ones.  The
+       special list is usually short or empty. */
+    for (uint32_t iSpecial = 0; iSpecial < pTab->cSpecial; iSpecial++)
+    {
+        PINTNETMACTABENTRY pEntry = &pTab->paEntries[pTab->paiSpecial[iSpecial]];
+        Assert(pEntry->fActive);
+        bool const fDummy = intnetR0IsMacAddrDummy(&pEntry->MacAddr);
+        bool const fExact = intnetR0AreMacAddrsEqual(&pEntry->MacAddr, pDstAddr);
+        if (fExact && !fDummy)
+            continue; /* hashed, already added above. */
+        if (   fDummy
+            || pEntry->fPromiscuousSeeTrunk
+            || (!fSrc && pEntry->fPromiscuousEff) )
+        {
+            cExactHits += fExact;
+
+            PINTNETIF pIf = pEntry->pIf;                            AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
+            if (RT_LIKELY(pIf != pIfSender)) /* paranoia */
+            {
+                uint32_t iIfDst = pDstTab->cIfs++;
+                pDstTab->aIfs[iIfDst].pIf            = pIf;
+                pDstTab->aIfs[iIfDst].fReplaceDstMac = false;
+                intnetR0BusyIncIf(pIf);
             }
         }
     }
@@ -1662,16 +1818,15 @@ static INTNETSWDECISION intnetR0NetworkSwitchUnicast(PINTNETNETWORK pNetwork, ui
         && fSrc
         && pNetwork->MacTab.cPromiscuousNoTrunkEntries)
     {
-        iIfMac = pTab->cEntries;
-        while (iIfMac-- > 0)
+        for (uint32_t iSpecial = 0; iSpecial < pTab->cSpecial; iSpecial++)
         {
-            if (   pTab->paEntries[iIfMac].fPromiscuousEff
-                && !pTab->paEntries[iIfMac].fPromiscuousSeeTrunk
-                && pTab->paEntries[iIfMac].fActive
-                && !intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pDstAddr)
-                && !intnetR0IsMacAddrDummy(&pTab->paEntries[iIfMac].MacAddr) )
+            PINTNETMACTABENTRY pEntry = &pTab->paEntries[pTab->paiSpecial[iSpecial]];
+            if (   pEntry->fPromiscuousEff
+                && !pEntry->fPromiscuousSeeTrunk
+                && !intnetR0AreMacAddrsEqual(&pEntry->MacAddr, pDstAddr)
+                && !intnetR0IsMacAddrDummy(&pEntry->MacAddr) )
             {
-                PINTNETIF pIf    = pTab->paEntries[iIfMac].pIf;     AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
+                PINTNETIF pIf    = pEntry->pIf;                     AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
                 uint32_t  iIfDst = pDstTab->cIfs++;
                 pDstTab->aIfs[iIfDst].pIf            = pIf;
                 pDstTab->aIfs[iIfDst].fReplaceDstMac = false;
@@ -1989,7 +2144,7 @@ static int intnetR0NetworkEnsureTabSpace(PINTNETNETWORK pNetwork)
              */
             if (RT_SUCCESS(rc))
             {
-                PINTNETMACTABENTRY paNew = (PINTNETMACTABENTRY)RTMemAlloc(sizeof(INTNETMACTABENTRY) * cAllocated);
+                PINTNETMACTABENTRY paNew = intnetR0MacTabAllocEntries(cAllocated);
                 if (paNew)
                 {
                     RTSpinlockAcquireNoInts(pNetwork->hAddrSpinlock, &Tmp);
@@ -2005,7 +2160,9 @@ static int intnetR0NetworkEnsureTabSpace(PINTNETNETWORK pNetwork)
                     }
 
                     pTab->paEntries         = paNew;
+                    pTab->paiSpecial        = (uint16_t *)&paNew[cAllocated];
                     pTab->cEntriesAllocated = cAllocated;
+                    intnetR0MacTabReindex(pTab);
 
                     RTSpinlockReleaseNoInts(pNetwork->hAddrSpinlock, &Tmp);
 
@@ -2575,6 +2732,84 @@ static int intnetR0RingWriteFrame(PINTNETRINGBUF pRingBuf, PCINTNETSG pSG, PCRTM
 }
 
 
+/**
+ * Tries to hold back the receive wakeup of an interface until the sender is
+ * done processing its send ring.
+ *
+ * The caller owns the receive/producer spinlock of @a pIf and has just
+ * queued a frame on it.
+ *
+ * @returns true if held back, false if the caller should signal the receiver
+ *          right away.
+ * @param   pIf             The receiving interface.
+ * @param   pIfSender       The sending interface.
+ */
+static bool intnetR0IfDeferWakeup(PINTNETIF pIf, PINTNETIF pIfSender)
+{
+    uint64_t const u64Now = pIf->cNsWakeupMaxLatency ? RTTimeSystemNanoTS() : 0;
+    if (!pIf->cWakeupPendingFrames)
+        pIf->u64WakeupPendingTS = u64Now;
+    pIf->cWakeupPendingFrames++;
+
+    /* Enough frames queued up or has the first one been waiting for too long? */
+    if (    pIf->cWakeupPendingFrames >= pIf->cWakeupMaxFrames
+        ||  (   pIf->cNsWakeupMaxLatency
+             && u64Now - pIf->u64WakeupPendingTS >= pIf->cNsWakeupMaxLatency))
+    {
+        pIf->cWakeupPendingFrames = 0;
+        return false;
+    }
+
+    /* Make sure someone will signal it.  If another sender has already
+       taken it upon itself, we're done. */
+    if (!pIf->fWakeupPending)
+    {
+        if (pIfSender->cPendingWakeups >= RT_ELEMENTS(pIfSender->apPendingWakeups))
+        {
+            pIf->cWakeupPendingFrames = 0;
+            return false;
+        }
+        pIf->fWakeupPending = true;
+        intnetR0BusyIncIf(pIf);
+        pIfSender->apPendingWakeups[pIfSender->cPendingWakeups++] = pIf;
+    }
+    return true;
+}
+
+
+/**
+ * Signals the receivers that intnetR0IfDeferWakeup held back wakeups for.
+ *
+ * Called by the sender when it is done processing its send ring.
+ *
+ * @param   pIfSender       The sending interface.
+ */
+static void intnetR0IfFlushWakeups(PINTNETIF pIfSender)
+{
+    RTSPINLOCKTMP Tmp = RTSPINLOCKTMP_INITIALIZER;
+    uint32_t      i   = pIfSender->cPendingWakeups;
+    while (i-- > 0)
+    {
+        PINTNETIF pIf = pIfSender->apPendingWakeups[i];
+        pIfSender->apPendingWakeups[i] = NULL;
+
+        RTSpinlockAcquireNoInts(pIf->hRecvInSpinlock, &Tmp);
+        bool const fSignal = pIf->cWakeupPendingFrames != 0;
+        pIf->cWakeupPendingFrames = 0;
+        pIf->fWakeupPending       = false;
+        RTSpinlockReleaseNoInts(pIf->hRecvInSpinlock, &Tmp);
+
+        if (fSignal)
+        {
+            STAM_REL_COUNTER_INC(&pIf->pIntBuf->cStatWakeups);
+            RTSemEventSignal(pIf->hRecvEvent);
+        }
+        intnetR0BusyDecIf(pIf);
+    }
+    pIfSender->cPendingWakeups = 0;
+}
+
+
 /**
  * Sends a frame to a specific interface.
  *
@@ -2590,12 +2825,21 @@ static void intnetR0IfSend(PINTNETIF pIf, PINTNETIF pIfSender, PINTNETSG pSG, PC
      */
     RTSPINLOCKTMP Tmp = RTSPINLOCKTMP_INITIALIZER;
     RTSpinlockAcquireNoInts(pIf->hRecvInSpinlock, &Tmp);
-    int rc = intnetR0RingWriteFrame(&pIf->pIntBuf->Recv, pSG, pNewDstMac);
+    int  rc      = intnetR0RingWriteFrame(&pIf->pIntBuf->Recv, pSG, pNewDstMac);
+    bool fSignal = true;
+    if (   RT_SUCCESS(rc)
+        && pIf->cWakeupMaxFrames > 1
+        && pIfSender)
+        fSignal = !intnetR0IfDeferWakeup(pIf, pIfSender);
     RTSpinlockReleaseNoInts(pIf->hRecvInSpinlock, &Tmp);
     if (RT_SUCCESS(rc))
     {
         pIf->cYields = 0;
-        RTSemEventSignal(pIf->hRecvEvent);
+        if (fSignal)
+        {
+            STAM_REL_COUNTER_INC(&pIf->pIntBuf->cStatWakeups);
+            RTSemEventSignal(pIf->hRecvEvent);
+        }
         return;
     }
 
@@ -3409,7 +3653,10 @@ static INTNETSWDECISION intnetR0NetworkSend(PINTNETNETWORK pNetwork, PINTNETIF p
 
         PINTNETMACTABENTRY pIfEntry = intnetR0NetworkFindMacAddrEntry(pNetwork, pIfSender);
         if (pIfEntry)
+        {
             pIfEntry->MacAddr = EthHdr.SrcMac;
+            intnetR0MacTabReindex(&pNetwork->MacTab);
+        }
         pIfSender->MacAddr    = EthHdr.SrcMac;
 
         RTSpinlockReleaseNoInts(pNetwork->hAddrSpinlock, &Tmp);
@@ -3553,6 +3800,12 @@ INTNETR0DECL(int) IntNetR0IfSend(INTNETIFHANDLE hIf, PSUPDRVSESSION pSession)
                 IntNetRingSkipFrame(&pIf->pIntBuf->Send);
             }
 
+            /*
+             * Wake up the receivers we've been holding back.
+             */
+            if (pIf->cPendingWakeups)
+                intnetR0IfFlushWakeups(pIf);
+
             /*
              * Put back the destination table.
              */
@@ -3776,6 +4029,8 @@ INTNETR0DECL(int) IntNetR0IfSetPromiscuousMode(INTNETIFHANDLE hIf, PSUPDRVSESSIO
                 }
                 Assert(pNetwork->MacTab.cPromiscuousEntries        <= pNetwork->MacTab.cEntries);
                 Assert(pNetwork->MacTab.cPromiscuousNoTrunkEntries <= pNetwork->MacTab.cEntries);
+
+                intnetR0MacTabReindex(&pNetwork->MacTab);
             }
         }
 
@@ -3854,7 +4109,10 @@ INTNETR0DECL(int) IntNetR0IfSetMacAddress(INTNETIFHANDLE hIf, PSUPDRVSESSION pSe
             /* Update the two copies. */
             PINTNETMACTABENTRY pEntry = intnetR0NetworkFindMacAddrEntry(pNetwork, pIf); Assert(pEntry);
             if (RT_LIKELY(pEntry))
+            {
                 pEntry->MacAddr = *pMac;
+                intnetR0MacTabReindex(&pNetwork->MacTab);
+            }
             pIf->MacAddr        = *pMac;
             pIf->fMacSet        = true;
 
@@ -3937,6 +4195,7 @@ static int intnetR0NetworkSetIfActive(PINTNETNETWORK pNetwork, PINTNETIF pIf, bo
         {
             pEntry->fActive = fActive;
             pIf->fActive    = fActive;
+            intnetR0MacTabReindex(&pNetwork->MacTab);
 
             if (fActive)
             {
@@ -4058,6 +4317,76 @@ INTNETR0DECL(int) IntNetR0IfSetActiveReq(PSUPDRVSESSION pSession, PINTNETIFSETAC
 }
 
 
+/**
+ * Sets the receive wakeup policy of an interface.
+ *
+ * By default the receiver is woken up for every frame put into its receive
+ * buffer.  With a frame threshold larger than one, the wakeups for frames sent
+ * by other interfaces on the network are held back until the sender is done
+ * with its send buffer, the threshold is reached or the first frame has
+ * been waiting for longer than the latency threshold.  Frames from the trunk
+ * always wake up the receiver immediately.
+ *
+ * The consumer must drain the receive buffer before waiting again.
+ *
+ * @returns VBox status code.
+ * @param   hIf                 The interface handle.
+ * @param   pSession            The caller's session.
+ * @param   cMaxFrames          The frame threshold.  0 and 1 restores the
+ *                              default behaviour.
+ * @param   cMicrosMaxLatency   The latency threshold in microseconds, 0 for
+ *                              none.
+ */
+INTNETR0DECL(int) IntNetR0IfSetWakeupPolicy(INTNETIFHANDLE hIf, PSUPDRVSESSION pSession,
+                                            uint32_t cMaxFrames, uint32_t cMicrosMaxLatency)
+{
+    LogFlow(("IntNetR0IfSetWakeupPolicy: hIf=%RX32 cMaxFrames=%u cMicrosMaxLatency=%u\n", hIf, cMaxFrames, cMicrosMaxLatency));
+
+    /*
+     * Validate & translate input.
+     */
+    PINTNET pIntNet = g_pIntNet;
+    AssertPtrReturn(pIntNet, VERR_INVALID_PARAMETER);
+    AssertReturn(pIntNet->u32Magic, VERR_INVALID_MAGIC);
+    AssertMsgReturn(cMaxFrames <= INTNET_MAX_WAKEUP_FRAMES, ("%u\n", cMaxFrames), VERR_OUT_OF_RANGE);
+    AssertMsgReturn(cMicrosMaxLatency <= RT_US_1SEC, ("%u\n", cMicrosMaxLatency), VERR_OUT_OF_RANGE);
+
+    PINTNETIF pIf = (PINTNETIF)RTHandleTableLookupWithCtx(pIntNet->hHtIfs, hIf, pSession);
+    if (!pIf)
+    {
+        Log(("IntNetR0IfSetWakeupPolicy: returns VERR_INVALID_HANDLE\n"));
+        return VERR_INVALID_HANDLE;
+    }
+
+    /*
+     * Update the policy.  Pending wakeups are taken care of by the senders.
+     */
+    RTSPINLOCKTMP Tmp = RTSPINLOCKTMP_INITIALIZER;
+    RTSpinlockAcquireNoInts(pIf->hRecvInSpinlock, &Tmp);
+    pIf->cWakeupMaxFrames    = cMaxFrames;
+    pIf->cNsWakeupMaxLatency = cMicrosMaxLatency * UINT64_C(1000);
+    RTSpinlockReleaseNoInts(pIf->hRecvInSpinlock, &Tmp);
+
+    intnetR0IfRelease(pIf, pSession);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * VMMR0 request wrapper for IntNetR0IfSetWakeupPolicy.
+ *
+ * @returns see IntNetR0IfSetWakeupPolicy.
+ * @param   pSession        The caller's session.
+ * @param   pReq            The request packet.
+ */
+INTNETR0DECL(int) IntNetR0IfSetWakeupPolicyReq(PSUPDRVSESSION pSession, PINTNETIFSETWAKEUPPOLICYREQ pReq)
+{
+    if (RT_UNLIKELY(pReq->Hdr.cbReq != sizeof(*pReq)))
+        return VERR_INVALID_PARAMETER;
+    return IntNetR0IfSetWakeupPolicy(pReq->hIf, pSession, pReq->cMaxFrames, pReq->cMicrosMaxLatency);
+}
+
+
 /**
  * Wait for the interface to get signaled.
  * The interface will be signaled when is put into the receive buffer.
@@ -4350,6 +4679,7 @@ static DECLCALLBACK(void) intnetR0IfDestruct(void *pvObj, void *pvUser1, void *p
                             &pNetwork->MacTab.paEntries[iIf + 1],
                             (pNetwork->MacTab.cEntries - iIf - 1) * sizeof(pNetwork->MacTab.paEntries[0]));
                 pNetwork->MacTab.cEntries--;
+                intnetR0MacTabReindex(&pNetwork->MacTab);
                 break;
             }
 
@@ -4532,6 +4862,8 @@ static int intnetR0NetworkCreateIf(PINTNETNETWORK pNetwork, PSUPDRVSESSION pSess
     pIf->cBusy              = 0;
     //pIf->pDstTab          = NULL;
     //pIf->pvIfData         = NULL;
+    //pIf->cWakeupMaxFrames = 0;
+    //pIf->cPendingWakeups  = 0;
 
     for (int i = kIntNetAddrType_Invalid + 1; i < kIntNetAddrType_End && RT_SUCCESS(rc); i++)
         rc = intnetR0IfAddrCacheInit(&pIf->aAddrCache[i], (INTNETADDRTYPE)i,
@@ -4584,6 +4916,7 @@ static int intnetR0NetworkCreateIf(PINTNETNETWORK pNetwork, PSUPDRVSESSION pSess
                     pNetwork->MacTab.paEntries[iIf].fActive              = false;
                     pNetwork->MacTab.paEntries[iIf].fPromiscuousEff      = false;
                     pNetwork->MacTab.paEntries[iIf].fPromiscuousSeeTrunk = false;
+                    pNetwork->MacTab.paEntries[iIf].iHashNext            = INTNET_MACTAB_NIL; /* inactive, not hashed. */
                     pNetwork->MacTab.paEntries[iIf].pIf                  = pIf;
 
                     pNetwork->MacTab.cEntries = iIf + 1;
@@ -5254,6 +5587,7 @@ static DECLCALLBACK(void) intnetR0NetworkDestruct(void *pvObj, void *pvUser1, vo
         pNetwork->MacTab.paEntries[iIf].fActive      = false;
         pNetwork->MacTab.paEntries[iIf].pIf->fActive = false;
     }
+    intnetR0MacTabReindex(&pNetwork->MacTab);
 
     pNetwork->MacTab.fHostActive = false;
     pNetwork->MacTab.fWireActive = false;
@@ -5326,7 +5660,8 @@ static DECLCALLBACK(void) intnetR0NetworkDestruct(void *pvObj, void *pvUser1, vo
     RTSpinlockDestroy(pNetwork->hAddrSpinlock);
     pNetwork->hAddrSpinlock = NIL_RTSPINLOCK;
     RTMemFree(pNetwork->MacTab.paEntries);
-    pNetwork->MacTab.paEntries = NULL;
+    pNetwork->MacTab.paEntries  = NULL;
+    pNetwork->MacTab.paiSpecial = NULL;
     RTMemFree(pNetwork);
 
     /* Release the create/destroy sem. */
@@ -5485,6 +5820,8 @@ static int intnetR0AdaptOpenNetworkFlags(PINTNETNETWORK pNetwork, uint32_t fFlag
                     }
                 }
             }
+
+            intnetR0MacTabReindex(&pNetwork->MacTab);
         }
 
         RTSpinlockReleaseNoInts(pNetwork->hAddrSpinlock, &Tmp);
@@ -5662,6 +5999,8 @@ static int intnetR0CreateNetwork(PINTNET pIntNet, PSUPDRVSESSION pSession, const
     //pNetwork->MacTab.cPromiscuousEntries  = 0;
     //pNetwork->MacTab.cPromiscuousNoTrunkEntries = 0;
     pNetwork->MacTab.paEntries              = NULL;
+    pNetwork->MacTab.paiSpecial             = NULL;
+    //pNetwork->MacTab.cSpecial             = 0;
     pNetwork->MacTab.fHostPromiscuousReal   = false;
     pNetwork->MacTab.fHostPromiscuousEff    = false;
     pNetwork->MacTab.fHostActive            = false;
@@ -5695,8 +6034,13 @@ static int intnetR0CreateNetwork(PINTNET pIntNet, PSUPDRVSESSION pSession, const
         rc = RTSpinlockCreate(&pNetwork->hAddrSpinlock);
     if (RT_SUCCESS(rc))
     {
-        pNetwork->MacTab.paEntries = (PINTNETMACTABENTRY)RTMemAlloc(sizeof(INTNETMACTABENTRY) * pNetwork->MacTab.cEntriesAllocated);
-        if (!pNetwork->MacTab.paEntries)
+        pNetwork->MacTab.paEntries = intnetR0MacTabAllocEntries(pNetwork->MacTab.cEntriesAllocated);
+        if (pNetwork->MacTab.paEntries)
+        {
+            pNetwork->MacTab.paiSpecial = (uint16_t *)&pNetwork->MacTab.paEntries[pNetwork->MacTab.cEntriesAllocated];
+            intnetR0MacTabReindex(&pNetwork->MacTab);
+        }
+        else
             rc = VERR_NO_MEMORY;
     }
     if (RT_SUCCESS(rc))
@@ -5745,7 +6089,8 @@ static int intnetR0CreateNetwork(PINTNET pIntNet, PSUPDRVSESSION pSession, const
     RTSpinlockDestroy(pNetwork->hAddrSpinlock);
     pNetwork->hAddrSpinlock = NIL_RTSPINLOCK;
     RTMemFree(pNetwork->MacTab.paEntries);
-    pNetwork->MacTab.paEntries = NULL;
+    pNetwork->MacTab.paEntries  = NULL;
+    pNetwork->MacTab.paiSpecial = NULL;
     RTMemFree(pNetwork);
 
     LogFlow(("intnetR0CreateNetwork: returns %Rrc\n", rc));
@@ -49,6 +49,7 @@ __FBSDID("$FreeBSD: src/sys/amd64/amd64/in_cksum.c,v 1.5.20.1 2009/04/15 03:14:2
 #include <netinet/ip.h>
 #include <machine/in_cksum.h>
 #else
+# include <iprt/net.h>
 # include "in_cksum.h"
 # include "slirp.h"
 #endif
@@ -75,6 +76,7 @@ __FBSDID("$FreeBSD: src/sys/amd64/amd64/in_cksum.c,v 1.5.20.1 2009/04/15 03:14:2
 	ADDCARRY(sum);							  \
     }
 
+#ifndef VBOX
 static const u_int32_t in_masks[] = {
 	/*0 bytes*/ /*1 byte*/	/*2 bytes*/ /*3 bytes*/
 	0x00000000, 0x000000FF, 0x0000FFFF, 0x00FFFFFF,	/* offset 0 */
@@ -82,6 +84,7 @@ static const u_int32_t in_masks[] = {
 	0x00000000, 0x00FF0000, 0xFFFF0000, 0xFFFF0000,	/* offset 2 */
 	0x00000000, 0xFF000000, 0xFF000000, 0xFF000000,	/* offset 3 */
 };
+#endif
 
 union l_util {
 	u_int16_t s[2];
@@ -98,8 +101,10 @@ in_cksumdata(const void *buf, int len)
 {
 	const u_int32_t *lw = (const u_int32_t *) buf;
 	u_int64_t sum = 0;
+#ifndef VBOX
 	u_int64_t prefilled;
 	int offset;
+#endif
 	union q_util q_util;
 
 	if ((3 & (long) lw) == 0 && len == 20) {
@@ -107,7 +112,13 @@ in_cksumdata(const void *buf, int len)
 	     REDUCE32;
 	     return sum;
 	}
-
+#ifdef VBOX
+	{
+	     /* IPRT sums up several words at a time (SSE2 in ring-3 on AMD64). */
+	     bool fOdd = false;
+	     return RTNetIPv4AddDataChecksum(lw, len, 0, &fOdd);
+	}
+#else
 	if ((offset = 3 & (long) lw) != 0) {
 		const u_int32_t *masks = in_masks + (offset << 2);
 		lw = (u_int32_t *) (((long) lw) - offset);
@@ -172,6 +183,7 @@ in_cksumdata(const void *buf, int len)
 		sum += (u_int64_t) (in_masks[len] & *lw);
 	REDUCE32;
 	return sum;
+#endif /* !VBOX */
 }
 
 u_short
@@ -224,7 +236,12 @@ in_cksum_skip(struct mbuf *m, int len, int skip)
 skip_start:
 		if (len < mlen)
 			mlen = len;
+#ifdef VBOX
+		/* in_cksumdata sums relative to the start of the buffer. */
+		if (clen & 1)
+#else
 		if ((clen ^ (long) addr) & 1)
+#endif
 		    sum += in_cksumdata(addr, mlen) << 8;
 		else
 		    sum += in_cksumdata(addr, mlen);
@@ -34,6 +34,9 @@ int inet_aton(const char *cp, struct in_addr *ia);
 # include <sys/select.h>
 # include <poll.h>
 # include <arpa/inet.h>
+# ifdef RT_OS_LINUX
+#  include <sys/epoll.h>
+# endif
 #endif
 
 #include <VBox/types.h>
@@ -62,6 +65,26 @@ void slirp_select_fill(PNATState pData, int *pnfds, struct pollfd *polls);
 void slirp_select_poll(PNATState pData, struct pollfd *polls, int ndfs);
 #endif /* !RT_OS_WINDOWS */
 
+#ifdef RT_OS_LINUX
+/*
+ * The maximum number of events slirp_select_poll_epoll() accepts per call.
+ */
+# define SLIRP_EPOLL_MAX_EVENTS        256
+
+/*
+ * Switches the engine from poll() to epoll. Once enabled, the caller uses
+ * slirp_select_fill_epoll() instead of slirp_select_fill() to bring the
+ * registrations up to date and passes the ready list from epoll_wait() to
+ * slirp_select_poll_epoll() instead of calling slirp_select_poll().
+ * fdWakeup is registered for reading with a NULL data.ptr, which is how the
+ * caller recognizes its own events. On failure the engine stays with poll().
+ */
+int slirp_epoll_enable(PNATState pData, int fdWakeup);
+int slirp_get_epoll_fd(PNATState pData);
+void slirp_select_fill_epoll(PNATState pData);
+void slirp_select_poll_epoll(PNATState pData, struct epoll_event *paEvents, int cEvents);
+#endif
+
 void slirp_input(PNATState pData, struct mbuf *m, size_t cbBuf);
 void slirp_set_ethaddr_and_activate_port_forwarding(PNATState pData, const uint8_t *ethaddr, uint32_t GuestIP);
 
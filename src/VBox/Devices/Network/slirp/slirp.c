@@ -53,6 +53,9 @@
 #ifndef RT_OS_WINDOWS
 # include <sys/ioctl.h>
 # include <poll.h>
+# ifdef RT_OS_LINUX
+#  include <sys/epoll.h>
+# endif
 #else
 # include <Winnls.h>
 # define _WINSOCK2API_
@@ -613,6 +616,11 @@ int slirp_init(PNATState *ppData, uint32_t u32NetAddr, uint32_t u32Netmask,
      * default value 10 (xTracker/5983) in case value for the key wasn't found.
      */
     pData->soMaxConn = 10;
+#ifdef RT_OS_LINUX
+    pData->iEpollFd = -1;
+    pData->icmp_socket.so_epoll_s = -1;
+    LIST_INIT(&pData->EpollTouchedHead);
+#endif
 
 #ifdef RT_OS_WINDOWS
     {
@@ -729,6 +737,9 @@ void slirp_link_up(PNATState pData)
 {
     struct arp_cache_entry *ac;
     link_up = 1;
+#ifdef RT_OS_LINUX
+    pData->fEpollResync = true;
+#endif
 
     if (LIST_EMPTY(&pData->arp_cache))
         return;
@@ -769,6 +780,9 @@ void slirp_link_down(PNATState pData)
     pData->cRedirectionsActive = 0;
 
     link_up = 0;
+#ifdef RT_OS_LINUX
+    pData->fEpollResync = true;
+#endif
 }
 
 /**
@@ -814,6 +828,10 @@ void slirp_term(PNATState pData)
 #ifdef RT_OS_WINDOWS
     WSACleanup();
 #endif
+#ifdef RT_OS_LINUX
+    if (pData->iEpollFd != -1)
+        close(pData->iEpollFd);
+#endif
 #ifndef VBOX_WITH_SLIRP_BSD_SBUF
 #ifdef LOG_ENABLED
     Log(("\n"
@@ -1429,6 +1447,366 @@ done:
     STAM_PROFILE_STOP(&pData->StatPoll, a);
 }
 
+#ifdef RT_OS_LINUX
+/*
+ * The epoll engine.
+ *
+ * Unlike slirp_select_fill/slirp_select_poll nothing here walks the socket
+ * queues on a regular wakeup: the registrations are only brought up to date
+ * for sockets whose state may have changed since the last round (see
+ * slirp_epoll_touch), only the sockets epoll reported are processed, and the
+ * timers plus the UDP expiry run from a separate pass driven by the slow
+ * timer interval.  That pass also resynchronizes every registration, which
+ * covers state changes made by the timers themselves.
+ */
+
+/**
+ * Returns the events a socket has to be registered for, the epoll
+ * equivalent of the per socket checks in slirp_select_fill.
+ */
+static uint32_t slirp_epoll_want(PNATState pData, struct socket *so)
+{
+    uint32_t fWant = 0;
+
+    if (!link_up || so->s == -1)
+        return 0;
+
+    if (so == &pData->icmp_socket)
+        return EPOLLIN;
+
+    if (so->so_type == IPPROTO_UDP)
+    {
+        if (so->so_state & SS_ISFCONNECTED)
+            fWant |= EPOLLIN;
+        return fWant;
+    }
+
+    /* See if we need a tcp_fasttimo */
+    if (   time_fasttimo == 0
+        && so->so_tcpcb != NULL
+        && so->so_tcpcb->t_flags & TF_DELACK)
+        time_fasttimo = curtime;
+
+    if (so->so_state & SS_NOFDREF)
+        return 0;
+
+    if (so->so_state & SS_FACCEPTCONN)
+        return EPOLLIN;
+
+    if (so->so_state & SS_ISFCONNECTING)
+        fWant |= EPOLLOUT;
+    if (CONN_CANFSEND(so) && SBUF_LEN(&so->so_rcv))
+        fWant |= EPOLLOUT;
+    if (   CONN_CANFRCV(so)
+        && (SBUF_LEN(&so->so_snd) < (SBUF_SIZE(&so->so_snd)/2)))
+        fWant |= EPOLLIN | EPOLLPRI;
+    return fWant;
+}
+
+/**
+ * Brings the epoll registration of a socket in line with the events
+ * it currently wants.
+ *
+ * Registrations are level-triggered and persistent, so a socket which keeps
+ * its interest from one round to the next costs no system call.  Sockets
+ * nobody waits for are removed from the set, otherwise a pending POLLHUP
+ * would keep waking us up.
+ */
+static void slirp_epoll_sync(PNATState pData, struct socket *so)
+{
+    struct epoll_event Event;
+    uint32_t fWant = slirp_epoll_want(pData, so);
+    int op;
+
+    if (so->so_epoll_s != so->s)
+    {
+        /* closing the descriptor dropped it from the set, it was replaced */
+        so->so_epoll_s = so->s;
+        so->so_epoll_events = 0;
+    }
+    if (so->s == -1 || fWant == so->so_epoll_events)
+        return;
+
+    if (!fWant)
+        op = EPOLL_CTL_DEL;
+    else if (!so->so_epoll_events)
+        op = EPOLL_CTL_ADD;
+    else
+        op = EPOLL_CTL_MOD;
+    Event.events = fWant;
+    Event.data.ptr = so;
+    STAM_COUNTER_INC(&pData->StatEpollCtl);
+    if (epoll_ctl(pData->iEpollFd, op, so->s, &Event) != 0)
+    {
+        /* the kernel forgot about the descriptor behind our back or it
+         * was reused for a socket we still have registered */
+        if (op == EPOLL_CTL_MOD && errno == ENOENT)
+            op = EPOLL_CTL_ADD;
+        else if (op == EPOLL_CTL_ADD && errno == EEXIST)
+            op = EPOLL_CTL_MOD;
+        else
+            op = -1;
+        if (   op == -1
+            || epoll_ctl(pData->iEpollFd, op, so->s, &Event) != 0)
+        {
+            if (fWant)
+                LogRel(("NAT: epoll_ctl failed for %R[natsock] (%s)\n", so, strerror(errno)));
+            so->so_epoll_events = 0;
+            return;
+        }
+    }
+    so->so_epoll_events = fWant;
+}
+
+/**
+ * Queues a socket for a registration update at the next
+ * slirp_select_fill_epoll.
+ *
+ * Called for every socket entering the TCP/UDP queues, for the sockets
+ * guest traffic is delivered to and for the sockets epoll reported.
+ */
+void slirp_epoll_touch(PNATState pData, struct socket *so)
+{
+    if (   pData->iEpollFd == -1
+        || so->so_epoll_touched)
+        return;
+    so->so_epoll_touched = 1;
+    LIST_INSERT_HEAD(&pData->EpollTouchedHead, so, so_epoll_list);
+}
+
+/**
+ * Drops all references the epoll engine holds to a socket being freed.
+ */
+void slirp_epoll_forget(PNATState pData, struct socket *so)
+{
+    int i;
+
+    if (so->so_epoll_touched)
+    {
+        LIST_REMOVE(so, so_epoll_list);
+        so->so_epoll_touched = 0;
+    }
+    if (pData->pEpollDraining == so)
+        pData->pEpollDraining = NULL;
+    /* processing one ready socket may free another one further down */
+    for (i = pData->iEpollReady; i < pData->cEpollReady; i++)
+        if (pData->paEpollReady[i].data.ptr == so)
+            pData->paEpollReady[i].data.ptr = NULL;
+}
+
+/**
+ * Processes a ready TCP socket, see the TCP loop in slirp_select_poll.
+ */
+static void slirp_epoll_poll_tcp(PNATState pData, struct socket *so, uint32_t fEvents)
+{
+    int ret;
+
+    if (so->so_state & SS_NOFDREF || so->s == -1)
+        return;
+
+    /* out-of-band data, this will soread as well */
+    if (fEvents & EPOLLPRI)
+        sorecvoob(pData, so);
+    else if (fEvents & EPOLLIN)
+    {
+        /* Check for incoming connections */
+        if (so->so_state & SS_FACCEPTCONN)
+        {
+            TCP_CONNECT(pData, so);
+            if (!(fEvents & EPOLLHUP))
+                return;
+        }
+
+        ret = soread(pData, so);
+        /* Output it if we read something */
+        if (RT_LIKELY(ret > 0))
+            TCP_OUTPUT(pData, sototcpcb(so));
+    }
+
+    if (   (fEvents & EPOLLHUP)
+        || so->so_close == 1)
+    {
+        /* drain the socket */
+        for (;;)
+        {
+            ret = soread(pData, so);
+            if (ret > 0)
+                TCP_OUTPUT(pData, sototcpcb(so));
+            else
+            {
+                Log2(("%R[natsock] errno %d (%s)\n", so, errno, strerror(errno)));
+                break;
+            }
+        }
+        /* mark the socket for termination _after_ it was drained */
+        so->so_close = 1;
+        if (fEvents & EPOLLERR)
+            sofcantsendmore(so);
+        return;
+    }
+
+    if (fEvents & EPOLLOUT)
+        slirpConnectOrWrite(pData, so, false);
+}
+
+/**
+ * The timer pass of the epoll engine: runs the TCP and IP timers and
+ * expires idle UDP sockets.
+ *
+ * slirp_select_fill is where the poll() path does the UDP expiry and
+ * figures out whether the slow timer is needed.  Here both happen at the
+ * slow timer interval instead, which is also when all registrations are
+ * resynchronized.
+ */
+static void slirp_epoll_timers(PNATState pData)
+{
+    struct socket *so, *so_next;
+
+    if (time_fasttimo && ((curtime - time_fasttimo) >= 2))
+    {
+        STAM_PROFILE_START(&pData->StatFastTimer, b);
+        tcp_fasttimo(pData);
+        time_fasttimo = 0;
+        STAM_PROFILE_STOP(&pData->StatFastTimer, b);
+    }
+    if (!do_slowtimo || (curtime - last_slowtimo) < 499)
+        return;
+
+    STAM_PROFILE_START(&pData->StatSlowTimer, c);
+    ip_slowtimo(pData);
+    tcp_slowtimo(pData);
+    last_slowtimo = curtime;
+
+    QSOCKET_FOREACH(so, so_next, udp)
+    /* { */
+        if (so->so_expire && so->so_expire <= curtime)
+        {
+            Log2(("NAT: %R[natsock] expired\n", so));
+            if (so->so_timeout != NULL)
+                so->so_timeout(pData, so, so->so_timeout_arg);
+#ifdef VBOX_WITH_SLIRP_MT
+            /* we need so_next for continue our cycle*/
+            so_next = so->so_next;
+#endif
+            UDP_DETACH(pData, so, so_next);
+            CONTINUE_NO_UNLOCK(udp);
+        }
+        LOOP_LABEL(udp, so, so_next);
+    }
+
+    do_slowtimo =    tcb.so_next != &tcb
+                  || udb.so_next != &udb
+                  || nipq != 0;
+    pData->fEpollResync = true;
+    STAM_PROFILE_STOP(&pData->StatSlowTimer, c);
+}
+
+/**
+ * Brings the registrations of the sockets touched since the last round up
+ * to date, the epoll counterpart of slirp_select_fill.
+ */
+void slirp_select_fill_epoll(PNATState pData)
+{
+    struct socket *so, *so_next;
+
+    STAM_PROFILE_START(&pData->StatFill, a);
+
+    while ((so = LIST_FIRST(&pData->EpollTouchedHead)) != NULL)
+    {
+        LIST_REMOVE(so, so_epoll_list);
+        so->so_epoll_touched = 0;
+        /*
+         * slirp_select_poll keeps draining closing sockets on every round,
+         * here that happens when the guest made room for more data.
+         */
+        if (   link_up
+            && so->so_type == IPPROTO_TCP
+            && so->so_close == 1)
+        {
+            pData->pEpollDraining = so;
+            slirp_epoll_poll_tcp(pData, so, 0);
+            if (pData->pEpollDraining == NULL)
+                continue; /* freed */
+            pData->pEpollDraining = NULL;
+        }
+        slirp_epoll_sync(pData, so);
+    }
+
+    /* new sockets need the timers, see slirp_epoll_timers for the rest */
+    if (   link_up
+        && !do_slowtimo
+        && (tcb.so_next != &tcb || udb.so_next != &udb))
+        do_slowtimo = 1;
+
+    if (pData->fEpollResync)
+    {
+        pData->fEpollResync = false;
+        slirp_epoll_sync(pData, &pData->icmp_socket);
+        QSOCKET_FOREACH(so, so_next, tcp)
+        /* { */
+            slirp_epoll_sync(pData, so);
+            LOOP_LABEL(tcp, so, so_next);
+        }
+        QSOCKET_FOREACH(so, so_next, udp)
+        /* { */
+            slirp_epoll_sync(pData, so);
+            LOOP_LABEL(udp, so, so_next);
+        }
+    }
+
+    STAM_PROFILE_STOP(&pData->StatFill, a);
+}
+
+/**
+ * Processes the ready list returned by epoll_wait.
+ *
+ * Only the reported sockets are looked at, each one is queued for a
+ * registration update since processing it may change what it waits for.
+ */
+void slirp_select_poll_epoll(PNATState pData, struct epoll_event *paEvents, int cEvents)
+{
+    STAM_PROFILE_START(&pData->StatPoll, a);
+
+    /* Update time */
+    updtime(pData);
+
+    if (link_up)
+    {
+        pData->paEpollReady = paEvents;
+        pData->cEpollReady  = cEvents;
+        for (pData->iEpollReady = 0; pData->iEpollReady < cEvents; pData->iEpollReady++)
+        {
+            struct epoll_event *pEvent = &paEvents[pData->iEpollReady];
+            struct socket *so = (struct socket *)pEvent->data.ptr;
+            /* descriptors of the caller or freed while processing the list */
+            if (so == NULL)
+                continue;
+
+            slirp_epoll_touch(pData, so);
+            if (so == &pData->icmp_socket)
+            {
+                if (pEvent->events & EPOLLIN)
+                    sorecvfrom(pData, so);
+            }
+            else if (so->so_type == IPPROTO_UDP)
+            {
+                if (so->s != -1 && (pEvent->events & EPOLLIN))
+                    SORECVFROM(pData, so);
+            }
+            else
+                slirp_epoll_poll_tcp(pData, so, pEvent->events);
+        }
+        pData->paEpollReady = NULL;
+        pData->cEpollReady  = 0;
+        pData->iEpollReady  = 0;
+
+        slirp_epoll_timers(pData);
+    }
+
+    STAM_PROFILE_STOP(&pData->StatPoll, a);
+}
+#endif /* RT_OS_LINUX */
+
 
 struct arphdr
 {
@@ -1930,6 +2308,39 @@ int slirp_get_nsock(PNATState pData)
 }
 #endif
 
+#ifdef RT_OS_LINUX
+int slirp_epoll_enable(PNATState pData, int fdWakeup)
+{
+    struct epoll_event Event;
+    int iEpollFd;
+    int rc;
+
+    AssertReturn(pData->iEpollFd == -1, VERR_WRONG_ORDER);
+    iEpollFd = epoll_create(SLIRP_EPOLL_MAX_EVENTS);
+    if (iEpollFd == -1)
+        return RTErrConvertFromErrno(errno);
+    fcntl(iEpollFd, F_SETFD, FD_CLOEXEC);
+
+    memset(&Event, 0, sizeof(Event));
+    Event.events = EPOLLIN | EPOLLPRI;
+    Event.data.ptr = NULL;
+    if (epoll_ctl(iEpollFd, EPOLL_CTL_ADD, fdWakeup, &Event) != 0)
+    {
+        rc = RTErrConvertFromErrno(errno);
+        close(iEpollFd);
+        return rc;
+    }
+    pData->iEpollFd = iEpollFd;
+    pData->fEpollResync = true;
+    return VINF_SUCCESS;
+}
+
+int slirp_get_epoll_fd(PNATState pData)
+{
+    return pData->iEpollFd;
+}
+#endif
+
 /*
  * this function called from NAT thread
  */
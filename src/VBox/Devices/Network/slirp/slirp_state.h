@@ -229,6 +229,21 @@ typedef struct NATState
 # define VBOX_SOCKET_EVENT (pData->phEvents[VBOX_SOCKET_EVENT_INDEX])
     HANDLE phEvents[VBOX_EVENT_COUNT];
 #endif
+#ifdef RT_OS_LINUX
+    /* epoll set holding the persistent registrations of all sockets, -1 if
+     * the engine is driven by poll(). See slirp_epoll_enable(). */
+    int iEpollFd;
+    /* sockets waiting for a registration update, see slirp_epoll_touch() */
+    LIST_HEAD(RT_NOTHING, socket) EpollTouchedHead;
+    /* set when every registration has to be checked at the next fill */
+    bool fEpollResync;
+    /* the ready list being processed by slirp_select_poll_epoll() */
+    struct epoll_event *paEpollReady;
+    int cEpollReady;
+    int iEpollReady;
+    /* the closing socket slirp_select_fill_epoll() is draining */
+    struct socket *pEpollDraining;
+#endif
 #ifdef zone_mbuf
 # undef zone_mbuf
 #endif
@@ -85,6 +85,9 @@ socreate()
         so->s = -1;
 #if !defined(RT_OS_WINDOWS)
         so->so_poll_index = -1;
+#endif
+#ifdef RT_OS_LINUX
+        so->so_epoll_s = -1;
 #endif
     }
     return so;
@@ -107,6 +110,9 @@ sofree(PNATState pData, struct socket *so)
     /* check if mbuf haven't been already freed  */
     if (so->so_m != NULL)
         m_freem(pData, so->so_m);
+#ifdef RT_OS_LINUX
+    slirp_epoll_forget(pData, so);
+#endif
 #ifndef VBOX_WITH_SLIRP_MT
     if (so->so_next && so->so_prev)
     {
@@ -991,12 +997,14 @@ solisten(PNATState pData, u_int32_t bind_addr, u_int port, u_int32_t laddr, u_in
         return NULL;
     }
 
+    so->so_type = IPPROTO_TCP;
     SOCKET_LOCK_CREATE(so);
     SOCKET_LOCK(so);
     QSOCKET_LOCK(tcb);
     insque(pData, so,&tcb);
     NSOCK_INC();
     QSOCKET_UNLOCK(tcb);
+    SOCKET_EPOLL_TOUCH(pData, so);
 
     /*
      * SS_FACCEPTONCE sockets must time out.
@@ -91,6 +91,16 @@ struct socket
 #ifndef RT_OS_WINDOWS
     int so_poll_index;
 #endif /* !RT_OS_WINDOWS */
+#ifdef RT_OS_LINUX
+    /*
+     * epoll bookkeeping: the events so_epoll_s is registered for and the
+     * link in the list of sockets waiting for a registration update.
+     */
+    uint32_t so_epoll_events;
+    int so_epoll_s;
+    int so_epoll_touched;
+    LIST_ENTRY(socket) so_epoll_list;
+#endif /* RT_OS_LINUX */
     /*
      * FD_CLOSE/POLLHUP event has been occurred on socket
      */
@@ -172,6 +182,13 @@ void so_init (void);
 struct socket * solookup (struct socket *, struct in_addr, u_int, struct in_addr, u_int);
 struct socket * socreate (void);
 void sofree (PNATState, struct socket *);
+#ifdef RT_OS_LINUX
+void slirp_epoll_touch (PNATState, struct socket *);
+void slirp_epoll_forget (PNATState, struct socket *);
+# define SOCKET_EPOLL_TOUCH(data, so) slirp_epoll_touch((data), (so))
+#else
+# define SOCKET_EPOLL_TOUCH(data, so) do {} while (0)
+#endif
 #ifdef VBOX_WITH_SLIRP_MT
 void soread_queue (PNATState, struct socket *, int *);
 #endif
@@ -495,6 +495,9 @@ findso:
         QSOCKET_UNLOCK(tcb);
     }
     LogFlowFunc(("(leave) findso: %R[natsock]\n", so));
+    /* whatever happens below may change the events the socket waits for */
+    if (so != NULL && so != &tcb)
+        SOCKET_EPOLL_TOUCH(pData, so);
 
     /*
      * If the state is CLOSED (i.e., TCB does not exist) then
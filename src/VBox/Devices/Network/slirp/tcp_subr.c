@@ -600,10 +600,12 @@ tcp_attach(PNATState pData, struct socket *so)
     if ((so->so_tcpcb = tcp_newtcpcb(pData, so)) == NULL)
         return -1;
 
+    so->so_type = IPPROTO_TCP;
     SOCKET_LOCK_CREATE(so);
     QSOCKET_LOCK(tcb);
     insque(pData, so, &tcb);
     NSOCK_INC();
     QSOCKET_UNLOCK(tcb);
+    SOCKET_EPOLL_TOUCH(pData, so);
     return 0;
 }
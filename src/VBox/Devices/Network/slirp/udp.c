@@ -269,6 +269,7 @@ udp_input(PNATState pData, register struct mbuf *m, int iphlen)
 
     so->so_faddr = ip->ip_dst;   /* XXX */
     so->so_fport = uh->uh_dport; /* XXX */
+    SOCKET_EPOLL_TOUCH(pData, so);
 
     /*
      * DNS proxy
@@ -460,11 +461,13 @@ udp_attach(PNATState pData, struct socket *so, int service_port)
     Assert(status == 0 && sa_addr.sa_family == AF_INET);
     so->so_hlport = ((struct sockaddr_in *)&sa_addr)->sin_port;
     so->so_hladdr.s_addr = ((struct sockaddr_in *)&sa_addr)->sin_addr.s_addr;
+    so->so_type = IPPROTO_UDP;
     SOCKET_LOCK_CREATE(so);
     QSOCKET_LOCK(udb);
     insque(pData, so, &udb);
     NSOCK_INC();
     QSOCKET_UNLOCK(udb);
+    SOCKET_EPOLL_TOUCH(pData, so);
     return so->s;
 error:
     Log2(("NAT: can't create datagramm socket\n"));
@@ -511,11 +514,13 @@ udp_listen(PNATState pData, u_int32_t bind_addr, u_int port, u_int32_t laddr, u_
     }
     so->so_expire = curtime + SO_EXPIRE;
     fd_nonblock(so->s);
+    so->so_type = IPPROTO_UDP;
     SOCKET_LOCK_CREATE(so);
     QSOCKET_LOCK(udb);
     insque(pData, so, &udb);
     NSOCK_INC();
     QSOCKET_UNLOCK(udb);
+    SOCKET_EPOLL_TOUCH(pData, so);
 
     memset(&addr, 0, sizeof(addr));
 #ifdef RT_OS_DARWIN
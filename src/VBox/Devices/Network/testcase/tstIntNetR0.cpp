@@ -99,6 +99,10 @@ typedef struct OBJREF
 static RTTEST           g_hTest      = NIL_RTTEST;
 /** The size (in bytes) of the large transfer tests. */
 static uint32_t         g_cbTransfer = _1M * 384;
+/** The number of interfaces for the switching benchmark. */
+static uint32_t         g_cSwitchIfs = 128;
+/** The number of frames to switch in the switching benchmark. */
+static uint32_t         g_cSwitchFrames = _4M;
 /** Fake session handle. */
 const PSUPDRVSESSION    g_pSession   = (PSUPDRVSESSION)0xdeadface;
 
@@ -203,6 +207,8 @@ typedef struct MYARGS
     INTNETIFHANDLE  hIf;
     RTMAC           Mac;
     uint32_t        cbFrame;
+    /** The number of frames to queue up before calling IntNetR0IfSend. */
+    uint32_t        cBatch;
     uint64_t        u64Start;
     uint64_t        u64End;
 } MYARGS, *PMYARGS;
@@ -238,6 +244,8 @@ DECLCALLBACK(int) SendThread(RTTHREAD Thread, void *pvArg)
     uint32_t        iFrame  = 0;
     uint32_t        cbSent  = 0;
     uint32_t        cSend   = 0;
+    uint32_t const  cBatch  = RT_MAX(pArgs->cBatch, 1);
+    uint32_t        cQueued = 0;
 
     pHdr->SrcMac            = pArgs->Mac;
     pHdr->DstMac            = pArgs->Mac;
@@ -253,11 +261,25 @@ DECLCALLBACK(int) SendThread(RTTHREAD Thread, void *pvArg)
 
         INTNETSG Sg;
         IntNetSgInitTemp(&Sg, abBuf, cb);
-        RTTEST_CHECK_RC_OK(g_hTest, rc = intnetR0RingWriteFrame(&pArgs->pBuf->Send, &Sg, NULL));
-        if (RT_SUCCESS(rc))
+        rc = intnetR0RingWriteFrame(&pArgs->pBuf->Send, &Sg, NULL);
+        if (rc == VERR_BUFFER_OVERFLOW && cQueued)
+        {
+            /* Send buffer full, push what we've got and retry. */
+            RTTEST_CHECK_RC_OK(g_hTest, rc = IntNetR0IfSend(pArgs->hIf, g_pSession));
+            cQueued = 0;
+            if (RT_SUCCESS(rc))
+                rc = intnetR0RingWriteFrame(&pArgs->pBuf->Send, &Sg, NULL);
+        }
+        RTTEST_CHECK_RC_OK(g_hTest, rc);
+        if (RT_SUCCESS(rc) && ++cQueued >= cBatch)
+        {
             RTTEST_CHECK_RC_OK(g_hTest, rc = IntNetR0IfSend(pArgs->hIf, g_pSession));
+            cQueued = 0;
+        }
         cbSent += cb;
     }
+    if (cQueued)
+        RTTEST_CHECK_RC_OK(g_hTest, rc = IntNetR0IfSend(pArgs->hIf, g_pSession));
 
     /*
      * Termination frames.
@@ -450,9 +472,16 @@ static void tstCloseInterfaces(PTSTSTATE pThis)
 
 /**
  * Do the bi-directional transfer test.
+ *
+ * @param   pThis               The test instance.
+ * @param   cbFrame             The frame size, 0 for varying sizes.
+ * @param   cBatch              The number of frames the senders queue up
+ *                              before calling IntNetR0IfSend.
  */
-static void tstBidirectionalTransfer(PTSTSTATE pThis, uint32_t cbFrame)
+static void tstBidirectionalTransfer(PTSTSTATE pThis, uint32_t cbFrame, uint32_t cBatch = 1)
 {
+    uint64_t const cFramesStart = pThis->pBuf0->Recv.cStatFrames.c + pThis->pBuf1->Recv.cStatFrames.c;
+
     MYARGS Args0;
     RT_ZERO(Args0);
     Args0.hIf         = pThis->hIf0;
@@ -461,6 +490,7 @@ static void tstBidirectionalTransfer(PTSTSTATE pThis, uint32_t cbFrame)
     Args0.Mac.au16[1] = 0;
     Args0.Mac.au16[2] = 0;
     Args0.cbFrame     = cbFrame;
+    Args0.cBatch      = cBatch;
 
     MYARGS Args1;
     RT_ZERO(Args1);
@@ -470,6 +500,7 @@ static void tstBidirectionalTransfer(PTSTSTATE pThis, uint32_t cbFrame)
     Args1.Mac.au16[1] = 0;
     Args1.Mac.au16[2] = 1;
     Args1.cbFrame     = cbFrame;
+    Args1.cBatch      = cBatch;
 
     RTTHREAD ThreadRecv0 = NIL_RTTHREAD;
     RTTHREAD ThreadRecv1 = NIL_RTTHREAD;
@@ -507,9 +538,12 @@ static void tstBidirectionalTransfer(PTSTSTATE pThis, uint32_t cbFrame)
 
         uint64_t u64Elapsed = RT_MAX(Args0.u64End, Args1.u64End) - RT_MIN(Args0.u64Start, Args1.u64Start);
         uint64_t u64Speed = (uint64_t)((2 * g_cbTransfer / 1024) / (u64Elapsed / 1000000000.0));
+        uint64_t cFrames = pThis->pBuf0->Recv.cStatFrames.c + pThis->pBuf1->Recv.cStatFrames.c - cFramesStart;
+        uint64_t cPps    = (uint64_t)(cFrames / (u64Elapsed / 1000000000.0));
         RTTestPrintf(g_hTest, RTTESTLVL_ALWAYS,
-                     "transferred %u bytes in %'RU64 ns (%'RU64 KB/s)\n",
-                     2 * g_cbTransfer, u64Elapsed, u64Speed);
+                     "transferred %u bytes in %'RU64 ns (%'RU64 KB/s, %'RU64 packets/s)\n",
+                     2 * g_cbTransfer, u64Elapsed, u64Speed, cPps);
+        RTTestIValue("packets/s", cPps, RTTESTUNIT_PACKETS_PER_SEC);
 
         /*
          * Wait for the threads to finish up...
@@ -655,6 +689,69 @@ static void doUnicastTest(PTSTSTATE pThis, bool fHeadGuard)
                       cb, pvBuf, sizeof(s_au16Frame), s_au16Frame);
 }
 
+/**
+ * Checks that batched frames to a receiver with a wakeup policy result in a
+ * single wakeup.
+ *
+ * @param   pThis               The test instance.
+ */
+static void doCoalescedWakeupTest(PTSTSTATE pThis)
+{
+    static uint16_t const s_au16Frame[7] = { /* dst:*/ 0x8086, 0, 0,      /*src:*/0x8086, 0, 1, 0x0800 };
+
+    RTTESTI_CHECK_RC_RETV(IntNetR0IfSetWakeupPolicy(pThis->hIf0, g_pSession, 32, 0), VINF_SUCCESS);
+
+    /* The wakeups are counted in the receive buffer statistics. */
+    uint64_t cWakeups = pThis->pBuf0->cStatWakeups.c;
+
+    /* Queue up a few frames and push them thru the switch with one call. */
+    INTNETSG Sg;
+    IntNetSgInitTemp(&Sg, (void *)&s_au16Frame[0], sizeof(s_au16Frame));
+    for (unsigned i = 0; i < 3; i++)
+        RTTESTI_CHECK_RC_OK_RETV(intnetR0RingWriteFrame(&pThis->pBuf1->Send, &Sg, NULL));
+    RTTESTI_CHECK_RC_OK_RETV(IntNetR0IfSend(pThis->hIf1, g_pSession));
+
+    /* One wakeup for all three. */
+    RTTESTI_CHECK_MSG(pThis->pBuf0->cStatWakeups.c - cWakeups == 1,
+                      ("%llu wakeups\n", pThis->pBuf0->cStatWakeups.c - cWakeups));
+    cWakeups = pThis->pBuf0->cStatWakeups.c;
+    RTTESTI_CHECK_RC(IntNetR0IfWait(pThis->hIf0, g_pSession, 1), VINF_SUCCESS);
+    RTTESTI_CHECK_RC(IntNetR0IfWait(pThis->hIf0, g_pSession, 0), VERR_TIMEOUT);
+    const unsigned cbExpect = RT_ALIGN(sizeof(s_au16Frame) + sizeof(INTNETHDR), sizeof(INTNETHDR));
+    RTTESTI_CHECK_MSG(IntNetRingGetReadable(&pThis->pBuf0->Recv) == cbExpect * 3,
+                      ("%#x vs. %#x\n", IntNetRingGetReadable(&pThis->pBuf0->Recv), cbExpect * 3));
+    while (IntNetRingHasMoreToRead(&pThis->pBuf0->Recv))
+        IntNetRingSkipFrame(&pThis->pBuf0->Recv);
+
+    /* The frame threshold wakes up the receiver before the sender is done:
+       once after the 2nd frame and once for the 3rd at the end of the batch. */
+    RTTESTI_CHECK_RC_RETV(IntNetR0IfSetWakeupPolicy(pThis->hIf0, g_pSession, 2, 0), VINF_SUCCESS);
+    for (unsigned i = 0; i < 3; i++)
+        RTTESTI_CHECK_RC_OK_RETV(intnetR0RingWriteFrame(&pThis->pBuf1->Send, &Sg, NULL));
+    RTTESTI_CHECK_RC_OK_RETV(IntNetR0IfSend(pThis->hIf1, g_pSession));
+    RTTESTI_CHECK_MSG(pThis->pBuf0->cStatWakeups.c - cWakeups == 2,
+                      ("%llu wakeups\n", pThis->pBuf0->cStatWakeups.c - cWakeups));
+    cWakeups = pThis->pBuf0->cStatWakeups.c;
+    RTTESTI_CHECK_RC(IntNetR0IfWait(pThis->hIf0, g_pSession, 1), VINF_SUCCESS);
+    RTTESTI_CHECK_RC(IntNetR0IfWait(pThis->hIf0, g_pSession, 0), VERR_TIMEOUT);
+    while (IntNetRingHasMoreToRead(&pThis->pBuf0->Recv))
+        IntNetRingSkipFrame(&pThis->pBuf0->Recv);
+
+    /* Back to the default policy, one wakeup per frame. */
+    RTTESTI_CHECK_RC(IntNetR0IfSetWakeupPolicy(pThis->hIf0, g_pSession, 0, 0), VINF_SUCCESS);
+    for (unsigned i = 0; i < 3; i++)
+        RTTESTI_CHECK_RC_OK_RETV(intnetR0RingWriteFrame(&pThis->pBuf1->Send, &Sg, NULL));
+    RTTESTI_CHECK_RC_OK_RETV(IntNetR0IfSend(pThis->hIf1, g_pSession));
+    RTTESTI_CHECK_MSG(pThis->pBuf0->cStatWakeups.c - cWakeups == 3,
+                      ("%llu wakeups\n", pThis->pBuf0->cStatWakeups.c - cWakeups));
+    RTTESTI_CHECK_RC(IntNetR0IfWait(pThis->hIf0, g_pSession, 1), VINF_SUCCESS);
+    RTTESTI_CHECK_RC(IntNetR0IfWait(pThis->hIf0, g_pSession, 0), VERR_TIMEOUT);
+    while (IntNetRingHasMoreToRead(&pThis->pBuf0->Recv))
+        IntNetRingSkipFrame(&pThis->pBuf0->Recv);
+
+    RTTESTI_CHECK_RC(IntNetR0IfSetWakeupPolicy(pThis->hIf0, g_pSession, _1M, 0), VERR_OUT_OF_RANGE);
+}
+
 static void doTest(PTSTSTATE pThis, uint32_t cbRecv, uint32_t cbSend)
 {
 
@@ -699,6 +796,12 @@ static void doTest(PTSTSTATE pThis, uint32_t cbRecv, uint32_t cbSend)
     doUnicastTest(pThis, false /*fHeadGuard*/);
     doUnicastTest(pThis, true /*fHeadGuard*/);
 
+    /*
+     * Coalesced receive wakeups.
+     */
+    RTTestISub("Coalesced wakeups");
+    doCoalescedWakeupTest(pThis);
+
     /*
      * Do the big bi-directional transfer test if the basics worked out.
      */
@@ -708,6 +811,20 @@ static void doTest(PTSTSTATE pThis, uint32_t cbRecv, uint32_t cbSend)
                     pThis->pBuf0->cbSend, pThis->pBuf0->cbRecv, g_cbTransfer);
         tstBidirectionalTransfer(pThis, 256);
 
+        /*
+         * Small packets: one frame per send call and wakeup vs. batched sends
+         * with coalesced receive wakeups.
+         */
+        RTTestISubF("small packets, cbFrame=64, cbTransfer=%u, unbatched", g_cbTransfer);
+        tstBidirectionalTransfer(pThis, 64, 1);
+
+        RTTESTI_CHECK_RC(IntNetR0IfSetWakeupPolicy(pThis->hIf0, g_pSession, 32, 100), VINF_SUCCESS);
+        RTTESTI_CHECK_RC(IntNetR0IfSetWakeupPolicy(pThis->hIf1, g_pSession, 32, 100), VINF_SUCCESS);
+        RTTestISubF("small packets, cbFrame=64, cbTransfer=%u, batches of 32", g_cbTransfer);
+        tstBidirectionalTransfer(pThis, 64, 32);
+        RTTESTI_CHECK_RC(IntNetR0IfSetWakeupPolicy(pThis->hIf0, g_pSession, 0, 0), VINF_SUCCESS);
+        RTTESTI_CHECK_RC(IntNetR0IfSetWakeupPolicy(pThis->hIf1, g_pSession, 0, 0), VINF_SUCCESS);
+
         for (uint32_t cbFrame = 64; cbFrame < cbSend - 64; cbFrame += 8)
         {
             RTTestISubF("bi-directional benchmark, cbSend=%u, cbRecv=%u, cbTransfer=%u, cbFrame=%u",
@@ -724,6 +841,169 @@ static void doTest(PTSTSTATE pThis, uint32_t cbRecv, uint32_t cbSend)
 }
 
 
+/**
+ * Makes up the MAC address of a switching benchmark interface.
+ *
+ * @param   pMac                Where to return the address.
+ * @param   iIf                 The interface number.
+ */
+static void tstSwitchMakeMac(PRTMAC pMac, uint32_t iIf)
+{
+    pMac->au8[0] = 0x08;
+    pMac->au8[1] = 0x00;
+    pMac->au8[2] = 0x27;
+    pMac->au8[3] = (uint8_t)(iIf >> 16);
+    pMac->au8[4] = (uint8_t)(iIf >> 8);
+    pMac->au8[5] = (uint8_t)iIf;
+}
+
+/**
+ * Unicast switching test and benchmark.
+ *
+ * This opens a bunch of interfaces on a separate network, gives them distinct
+ * MAC addresses and then drives the unicast switching code directly, so the
+ * per frame cost can be measured without the ring buffer copying getting in
+ * the way.
+ *
+ * @param   cIfs                The number of interfaces.
+ * @param   cbRecv              The receive buffer size.
+ * @param   cbSend              The send buffer size.
+ */
+static void doSwitchTest(uint32_t cIfs, uint32_t cbRecv, uint32_t cbSend)
+{
+    RTTestISubF("Unicast switching, %u interfaces", cIfs);
+    if (cIfs < 2 || cIfs >= INTNET_MAX_IFS)
+    {
+        RTTestIFailed("Interface count %u is out of range.\n", cIfs);
+        return;
+    }
+
+    INTNETIFHANDLE *pahIfs = (INTNETIFHANDLE *)RTMemAllocZ(sizeof(pahIfs[0]) * cIfs);
+    RTTESTI_CHECK_RETV(pahIfs);
+    RTTESTI_CHECK_RC_RETV(IntNetR0Init(), VINF_SUCCESS);
+
+    /*
+     * Open the interfaces, set the addresses and activate them.
+     */
+    bool     fSetupOk = true;
+    uint32_t cOpened  = 0;
+    for (; cOpened < cIfs; cOpened++)
+    {
+        RTMAC Mac;
+        tstSwitchMakeMac(&Mac, cOpened);
+        pahIfs[cOpened] = INTNET_HANDLE_INVALID;
+        int rc = IntNetR0Open(g_pSession, "switch", kIntNetTrunkType_None, "",
+                              0/*fFlags*/, cbSend, cbRecv, &pahIfs[cOpened]);
+        if (RT_SUCCESS(rc))
+            rc = IntNetR0IfSetMacAddress(pahIfs[cOpened], g_pSession, &Mac);
+        if (RT_SUCCESS(rc))
+            rc = IntNetR0IfSetActive(pahIfs[cOpened], g_pSession, true);
+        if (RT_FAILURE(rc))
+        {
+            RTTestIFailed("Setting up interface #%u failed: %Rrc\n", cOpened, rc);
+            if (pahIfs[cOpened] != INTNET_HANDLE_INVALID)
+                cOpened++;
+            fSetupOk = false;
+            break;
+        }
+    }
+
+    PINTNETNETWORK pNetwork = g_pIntNet ? g_pIntNet->pNetworks : NULL;
+    PINTNETDSTTAB  pDstTab  = NULL;
+    if (   fSetupOk
+        && pNetwork
+        && RT_SUCCESS(intnetR0AllocDstTab(cIfs + 1, &pDstTab)))
+    {
+        /*
+         * Every address must get to its owner and nobody else.
+         */
+        RTMAC               Mac;
+        INTNETSWDECISION    enmSwDecision;
+        for (uint32_t iIf = 0; iIf < cIfs; iIf++)
+        {
+            tstSwitchMakeMac(&Mac, iIf);
+            enmSwDecision = intnetR0NetworkSwitchUnicast(pNetwork, 0 /*fSrc*/, NULL /*pIfSender*/, &Mac, pDstTab);
+            RTTESTI_CHECK(enmSwDecision == INTNETSWDECISION_INTNET);
+            RTTESTI_CHECK(pDstTab->cIfs == 1);
+            if (pDstTab->cIfs == 1)
+                RTTESTI_CHECK_MSG(pDstTab->aIfs[0].pIf->hIf == pahIfs[iIf],
+                                  ("iIf=%u: %#x vs. %#x\n", iIf, pDstTab->aIfs[0].pIf->hIf, pahIfs[iIf]));
+            intnetR0NetworkReleaseDstTab(pNetwork, pDstTab);
+
+            enmSwDecision = intnetR0NetworkPreSwitchUnicast(pNetwork, INTNETTRUNKDIR_WIRE, NULL /*pSrcAddr*/, &Mac);
+            RTTESTI_CHECK(enmSwDecision == INTNETSWDECISION_INTNET);
+        }
+
+        tstSwitchMakeMac(&Mac, cIfs);
+        RTTESTI_CHECK(intnetR0NetworkSwitchUnicast(pNetwork, 0 /*fSrc*/, NULL /*pIfSender*/, &Mac, pDstTab)
+                      == INTNETSWDECISION_DROP);
+        intnetR0NetworkReleaseDstTab(pNetwork, pDstTab);
+
+        /*
+         * An active interface which address we don't know yet gets everything.
+         */
+        INTNETIFHANDLE hIfDummy = INTNET_HANDLE_INVALID;
+        RTTESTI_CHECK_RC_OK(IntNetR0Open(g_pSession, "switch", kIntNetTrunkType_None, "",
+                                         0/*fFlags*/, cbSend, cbRecv, &hIfDummy));
+        if (hIfDummy != INTNET_HANDLE_INVALID)
+        {
+            RTTESTI_CHECK_RC_OK(IntNetR0IfSetActive(hIfDummy, g_pSession, true));
+            tstSwitchMakeMac(&Mac, cIfs / 2);
+            RTTESTI_CHECK(intnetR0NetworkSwitchUnicast(pNetwork, 0 /*fSrc*/, NULL /*pIfSender*/, &Mac, pDstTab)
+                          == INTNETSWDECISION_INTNET);
+            RTTESTI_CHECK(pDstTab->cIfs == 2);
+            intnetR0NetworkReleaseDstTab(pNetwork, pDstTab);
+            RTTESTI_CHECK(intnetR0NetworkPreSwitchUnicast(pNetwork, INTNETTRUNKDIR_WIRE, NULL /*pSrcAddr*/, &Mac)
+                          == INTNETSWDECISION_BROADCAST);
+
+            /* Once the address is known, it's just another interface. */
+            tstSwitchMakeMac(&Mac, cIfs);
+            RTTESTI_CHECK_RC_OK(IntNetR0IfSetMacAddress(hIfDummy, g_pSession, &Mac));
+            RTTESTI_CHECK(intnetR0NetworkSwitchUnicast(pNetwork, 0 /*fSrc*/, NULL /*pIfSender*/, &Mac, pDstTab)
+                          == INTNETSWDECISION_INTNET);
+            RTTESTI_CHECK(pDstTab->cIfs == 1 && pDstTab->aIfs[0].pIf->hIf == hIfDummy);
+            intnetR0NetworkReleaseDstTab(pNetwork, pDstTab);
+
+            RTTESTI_CHECK_RC_OK(IntNetR0IfClose(hIfDummy, g_pSession));
+        }
+
+        /*
+         * The benchmark.  Stride through the interfaces so consecutive frames
+         * don't go to neighbouring table entries.
+         */
+        if (!RTTestIErrorCount())
+        {
+            uint32_t const cFrames  = g_cSwitchFrames;
+            uint32_t       iIf      = 0;
+            uint64_t const u64Start = RTTimeNanoTS();
+            for (uint32_t iFrame = 0; iFrame < cFrames; iFrame++)
+            {
+                tstSwitchMakeMac(&Mac, iIf);
+                intnetR0NetworkSwitchUnicast(pNetwork, 0 /*fSrc*/, NULL /*pIfSender*/, &Mac, pDstTab);
+                intnetR0NetworkReleaseDstTab(pNetwork, pDstTab);
+                iIf = (iIf + 7919) % cIfs;
+            }
+            uint64_t const cNsElapsed = RTTimeNanoTS() - u64Start;
+            RTTestIValue("unicast switching", cNsElapsed / RT_MAX(cFrames, 1), RTTESTUNIT_NS_PER_FRAME);
+        }
+
+        RTMemFree(pDstTab);
+    }
+    else
+        RTTestIFailed("Failed to set up the switching network (%u of %u interfaces)\n", cOpened, cIfs);
+
+    /*
+     * Cleanup.
+     */
+    while (cOpened-- > 0)
+        if (pahIfs[cOpened] != INTNET_HANDLE_INVALID)
+            RTTESTI_CHECK_RC_OK(IntNetR0IfClose(pahIfs[cOpened], g_pSession));
+    RTTESTI_CHECK(IntNetR0GetNetworkCount() == 0);
+    IntNetR0Term();
+    RTMemFree(pahIfs);
+}
+
+
 int main(int argc, char **argv)
 {
     int rc = RTTestInitAndCreate("tstIntNetR0", &g_hTest);
@@ -738,6 +1018,8 @@ int main(int argc, char **argv)
         { "--recv-buffer",   'r', RTGETOPT_REQ_UINT32 },
         { "--send-buffer",   's', RTGETOPT_REQ_UINT32 },
         { "--transfer-size", 'l', RTGETOPT_REQ_UINT32 },
+        { "--switch-ifs",    'i', RTGETOPT_REQ_UINT32 },
+        { "--switch-frames", 'f', RTGETOPT_REQ_UINT32 },
     };
 
     uint32_t cbSend = 1536*2 + 4;
@@ -762,6 +1044,14 @@ int main(int argc, char **argv)
                 cbSend = Value.u32;
                 break;
 
+            case 'i':
+                g_cSwitchIfs = Value.u32;
+                break;
+
+            case 'f':
+                g_cSwitchFrames = Value.u32;
+                break;
+
             default:
                 return RTGetOptPrintError(ch, &Value);
         }
@@ -772,6 +1062,7 @@ int main(int argc, char **argv)
     TSTSTATE This;
     RT_ZERO(This);
     doTest(&This, cbRecv, cbSend);
+    doSwitchTest(g_cSwitchIfs, cbRecv, cbSend);
 
     return RTTestSummaryAndDestroy(g_hTest);
 }
@@ -0,0 +1,321 @@
+/* $Id: tstNATEpoll.cpp $ */
+/** @file
+ * NAT - Connection scaling benchmark for the poll() and epoll wakeup paths.
+ *
+ * Runs the slirp engine the way the NAT thread does with a number of idle
+ * sockets (forwarded TCP ports nobody connects to) and a single active one
+ * (a forwarded UDP port receiving one datagram per round).  The poll() path
+ * goes thru slirp_select_fill/slirp_select_poll, the epoll path thru
+ * slirp_select_fill_epoll/slirp_select_poll_epoll.  The cost of a wakeup is
+ * reported for both.
+ */
+
+/*
+ * Copyright (C) 2012 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include "slirp/libslirp.h"
+
+#include <iprt/mem.h>
+#include <iprt/string.h>
+#include <iprt/test.h>
+#include <iprt/time.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** The number of datagrams pushed thru the active socket per run. */
+#define TST_ROUNDS              2000
+/** The largest number of idle sockets tried.  Each forwarded port comes with
+ * its own libalias instance (64KB), so don't go overboard. */
+#define TST_MAX_IDLE            1024
+/** The NAT network, 10.0.2.0/24 like the default configuration. */
+#define TST_NETWORK             UINT32_C(0x0a000200)
+/** The NAT netmask. */
+#define TST_NETMASK             UINT32_C(0xffffff00)
+/** The guest address, host byte order. */
+#define TST_GUEST_IP            (TST_NETWORK | 15)
+/** The first guest port the idle sockets are forwarded to. */
+#define TST_IDLE_GUEST_PORT     1024
+/** The guest port the active socket is forwarded to. */
+#define TST_ACTIVE_GUEST_PORT   1000
+
+
+/*******************************************************************************
+*   Structures and Typedefs                                                    *
+*******************************************************************************/
+/**
+ * A NAT engine instance, the user argument of the slirp callbacks.
+ */
+typedef struct TSTNAT
+{
+    /** The slirp engine. */
+    PNATState       pNATState;
+    /** Number of frames slirp handed to the guest. */
+    uint32_t        cFramesOut;
+} TSTNAT;
+typedef TSTNAT *PTSTNAT;
+
+
+/*******************************************************************************
+*   Global Variables                                                           *
+*******************************************************************************/
+static RTTEST g_hTest;
+/** The guest MAC address. */
+static const uint8_t g_abGuestMac[6] = { 0x08, 0x00, 0x27, 0x01, 0x02, 0x03 };
+
+
+/*
+ * The slirp callbacks normally provided by DrvNAT.  Frames for the guest are
+ * counted and dropped.
+ */
+
+void slirp_output(void *pvUser, struct mbuf *m, const uint8_t *pu8Buf, int cb)
+{
+    PTSTNAT pNat = (PTSTNAT)pvUser;
+    NOREF(cb);
+    pNat->cFramesOut++;
+    slirp_ext_m_free(pNat->pNATState, m, (uint8_t *)pu8Buf);
+}
+
+void slirp_urg_output(void *pvUser, struct mbuf *m, const uint8_t *pu8Buf, int cb)
+{
+    slirp_output(pvUser, m, pu8Buf, cb);
+}
+
+void slirp_output_pending(void *pvUser)
+{
+    NOREF(pvUser);
+}
+
+
+/**
+ * Finds a free UDP port on the loopback interface.
+ *
+ * @returns The port number in host byte order, 0 on failure.
+ */
+static uint16_t tstFindFreeUdpPort(void)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == -1)
+        return 0;
+
+    struct sockaddr_in Addr;
+    RT_ZERO(Addr);
+    Addr.sin_family      = AF_INET;
+    Addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t cbAddr = sizeof(Addr);
+    uint16_t uPort = 0;
+    if (   bind(fd, (struct sockaddr *)&Addr, sizeof(Addr)) == 0
+        && getsockname(fd, (struct sockaddr *)&Addr, &cbAddr) == 0)
+        uPort = ntohs(Addr.sin_port);
+    close(fd);
+    return uPort;
+}
+
+
+/**
+ * Runs the NAT loop until the guest got a frame, like drvNATAsyncIoThread.
+ *
+ * @returns The number of wakeups it took, 0 on failure.
+ * @param   pNat                The NAT instance.
+ * @param   fEpoll              Whether to use the epoll path.
+ * @param   paPolls             The pollfd array for the poll() path.
+ * @param   cPolls              The size of the array.
+ */
+static unsigned tstNatWaitForFrame(PTSTNAT pNat, bool fEpoll, struct pollfd *paPolls, int cPolls)
+{
+    uint32_t const cFramesStart = pNat->cFramesOut;
+    unsigned       cWakeups     = 0;
+    while (pNat->cFramesOut == cFramesStart)
+    {
+        if (cWakeups++ > 100)
+            return 0;
+
+        if (fEpoll)
+        {
+            struct epoll_event aEvents[SLIRP_EPOLL_MAX_EVENTS];
+            slirp_select_fill_epoll(pNat->pNATState);
+            int cEvents = epoll_wait(slirp_get_epoll_fd(pNat->pNATState), &aEvents[0], RT_ELEMENTS(aEvents),
+                                     slirp_get_timeout_ms(pNat->pNATState));
+            if (cEvents < 0)
+                return 0;
+            slirp_select_poll_epoll(pNat->pNATState, &aEvents[0], cEvents);
+        }
+        else
+        {
+            int nFDs = slirp_get_nsock(pNat->pNATState);
+            if (nFDs > cPolls)
+                return 0;
+            slirp_select_fill(pNat->pNATState, &nFDs, paPolls);
+            int cChangedFDs = poll(paPolls, nFDs, slirp_get_timeout_ms(pNat->pNATState));
+            if (cChangedFDs < 0)
+                return 0;
+            slirp_select_poll(pNat->pNATState, paPolls, nFDs);
+        }
+    }
+    return cWakeups;
+}
+
+
+/**
+ * Sets up a NAT instance with the given number of idle sockets, pushes
+ * datagrams thru the active one and measures the wakeups.
+ *
+ * @returns Nanoseconds per wakeup, 0 on failure.
+ * @param   cIdle               The number of idle sockets.
+ * @param   fEpoll              Whether to use the epoll path.
+ */
+static uint64_t tstNatRun(unsigned cIdle, bool fEpoll)
+{
+    TSTNAT Nat;
+    RT_ZERO(Nat);
+    int rc = slirp_init(&Nat.pNATState, RT_H2N_U32(TST_NETWORK), TST_NETMASK,
+                        false /*fPassDomain*/, false /*fUseHostResolver*/, 0 /*i32AliasMode*/,
+                        100 /*iIcmpCacheLimit*/, &Nat);
+    RTTESTI_CHECK_RC_OK_RET(rc, 0);
+
+    int      afdWakeup[2] = { -1, -1 };
+    uint16_t uHostPort    = tstFindFreeUdpPort();
+    int      fdPeer       = socket(AF_INET, SOCK_DGRAM, 0);
+    struct pollfd *paPolls = NULL;
+    uint64_t cNsPerWakeup = 0;
+    do
+    {
+        RTTESTI_CHECK_BREAK(uHostPort != 0 && fdPeer != -1);
+
+        /*
+         * The forwarded ports, activated once the guest address is known.
+         */
+        struct in_addr HostAddr;
+        struct in_addr GuestAddr;
+        HostAddr.s_addr  = htonl(INADDR_LOOPBACK);
+        GuestAddr.s_addr = INADDR_ANY;
+        unsigned i = 0;
+        for (; i < cIdle; i++)
+            if (slirp_add_redirect(Nat.pNATState, 0 /*is_udp*/, HostAddr, 0 /*any host port*/,
+                                   GuestAddr, TST_IDLE_GUEST_PORT + i, g_abGuestMac) != 0)
+                break;
+        RTTESTI_CHECK_BREAK(i == cIdle);
+        RTTESTI_CHECK_BREAK(slirp_add_redirect(Nat.pNATState, 1 /*is_udp*/, HostAddr, uHostPort,
+                                               GuestAddr, TST_ACTIVE_GUEST_PORT, g_abGuestMac) == 0);
+        slirp_link_up(Nat.pNATState);
+        slirp_set_ethaddr_and_activate_port_forwarding(Nat.pNATState, g_abGuestMac, RT_H2N_U32(TST_GUEST_IP));
+        RTTESTI_CHECK_BREAK(slirp_get_nsock(Nat.pNATState) >= (int)cIdle + 1);
+
+        if (fEpoll)
+        {
+            RTTESTI_CHECK_BREAK(pipe(afdWakeup) == 0);
+            RTTESTI_CHECK_RC_BREAK(slirp_epoll_enable(Nat.pNATState, afdWakeup[0]), VINF_SUCCESS);
+        }
+        else
+        {
+            paPolls = (struct pollfd *)RTMemAlloc((cIdle + 64) * sizeof(struct pollfd));
+            RTTESTI_CHECK_BREAK(paPolls);
+        }
+
+        /*
+         * Settle: the first round registers everything with epoll.
+         */
+        struct sockaddr_in Addr;
+        RT_ZERO(Addr);
+        Addr.sin_family      = AF_INET;
+        Addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        Addr.sin_port        = htons(uHostPort);
+        RTTESTI_CHECK_BREAK(sendto(fdPeer, "x", 1, 0, (struct sockaddr *)&Addr, sizeof(Addr)) == 1);
+        RTTESTI_CHECK_BREAK(tstNatWaitForFrame(&Nat, fEpoll, paPolls, cIdle + 64) != 0);
+
+        /*
+         * The measurement.
+         */
+        unsigned       cWakeups = 0;
+        unsigned       iRound   = 0;
+        uint64_t const nsStart  = RTTimeNanoTS();
+        for (; iRound < TST_ROUNDS; iRound++)
+        {
+            if (sendto(fdPeer, "x", 1, 0, (struct sockaddr *)&Addr, sizeof(Addr)) != 1)
+                break;
+            unsigned cThisRound = tstNatWaitForFrame(&Nat, fEpoll, paPolls, cIdle + 64);
+            if (!cThisRound)
+                break;
+            cWakeups += cThisRound;
+        }
+        uint64_t const nsElapsed = RTTimeNanoTS() - nsStart;
+        if (iRound != TST_ROUNDS)
+        {
+            RTTestIFailed("%s: only %u of %u datagrams arrived", fEpoll ? "epoll" : "poll", iRound, TST_ROUNDS);
+            break;
+        }
+        cNsPerWakeup = nsElapsed / cWakeups;
+    } while (0);
+
+    RTMemFree(paPolls);
+    if (fdPeer != -1)
+        close(fdPeer);
+    slirp_term(Nat.pNATState);
+    if (afdWakeup[0] != -1)
+    {
+        close(afdWakeup[0]);
+        close(afdWakeup[1]);
+    }
+    return cNsPerWakeup;
+}
+
+
+int main()
+{
+    RTEXITCODE rcExit = RTTestInitAndCreate("tstNATEpoll", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+    /*
+     * Raise the descriptor limit as far as we're allowed to and scale down
+     * the largest run if needed.
+     */
+    struct rlimit Limit;
+    unsigned cMaxIdle = TST_MAX_IDLE;
+    if (getrlimit(RLIMIT_NOFILE, &Limit) == 0)
+    {
+        if (Limit.rlim_cur < Limit.rlim_max)
+        {
+            Limit.rlim_cur = Limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &Limit);
+            getrlimit(RLIMIT_NOFILE, &Limit);
+        }
+        if (Limit.rlim_cur != RLIM_INFINITY && Limit.rlim_cur < 64 + cMaxIdle)
+            cMaxIdle = Limit.rlim_cur > 64 + 16 ? (unsigned)(Limit.rlim_cur - 64) : 16;
+    }
+
+    for (unsigned cIdle = 16; cIdle <= cMaxIdle; cIdle *= 4)
+    {
+        RTTestSubF(g_hTest, "%u idle sockets", cIdle);
+        uint64_t nsPoll  = tstNatRun(cIdle, false /*fEpoll*/);
+        uint64_t nsEpoll = tstNatRun(cIdle, true /*fEpoll*/);
+        RTTestValue(g_hTest, "poll", nsPoll, RTTESTUNIT_NS_PER_CALL);
+        RTTestValue(g_hTest, "epoll", nsEpoll, RTTESTUNIT_NS_PER_CALL);
+    }
+
+    return RTTestSummaryAndDestroy(g_hTest);
+}
@@ -62,6 +62,14 @@
 #define AHCI_NR_COMMAND_SLOTS 32
 #define AHCI_NR_OF_ALLOWED_BIGGER_LISTS 100
 
+/**
+ * Maximum number of 512 byte blocks with LBA range entries the guest may
+ * pass in one DATA SET MANAGEMENT command (reported in IDENTIFY word 105).
+ */
+#define AHCI_TRIM_BLOCKS_MAX 8
+/** Number of LBA range entries in one 512 byte block. */
+#define AHCI_TRIM_RANGES_PER_BLOCK (512 / sizeof(uint64_t))
+
 /** The current saved state version. */
 #define AHCI_SAVED_STATE_VERSION                5
 /** Saved state version before ATAPI support was added. */
@@ -251,7 +259,9 @@ typedef enum AHCITXDIR
     /** Write */
     AHCITXDIR_WRITE,
     /** Flush */
-    AHCITXDIR_FLUSH
+    AHCITXDIR_FLUSH,
+    /** Trim */
+    AHCITXDIR_TRIM
 } AHCITXDIR;
 
 /**
@@ -298,6 +308,10 @@ typedef struct AHCIPORTTASKSTATE
     uint64_t                   uOffset;
     /** Number of bytes to transfer. */
     uint32_t                   cbTransfer;
+    /** Ranges to discard for a trim request. */
+    PRTRANGE                   paRanges;
+    /** Number of entries in the range array. */
+    unsigned                   cRanges;
     /** ATA error register */
     uint8_t                    uATARegError;
     /** ATA status register */
@@ -3009,6 +3023,20 @@ static uint32_t ataChecksum(void* ptr, size_t count)
     return (uint8_t)-(int32_t)u8Sum;
 }
 
+/**
+ * Checks whether the medium attached to the port can discard blocks.
+ *
+ * @returns true if TRIM can be offered to the guest, false otherwise.
+ * @param   pAhciPort    The port to check.
+ */
+static bool ahciIsTrimSupported(PAHCIPort pAhciPort)
+{
+    if (pAhciPort->fAsyncInterface)
+        return pAhciPort->pDrvBlockAsync && pAhciPort->pDrvBlockAsync->pfnStartDiscard;
+
+    return pAhciPort->pDrvBlock && pAhciPort->pDrvBlock->pfnDiscard;
+}
+
 static int ahciIdentifySS(PAHCIPort pAhciPort, void *pvBuf)
 {
     uint16_t *p;
@@ -3075,6 +3103,11 @@ static int ahciIdentifySS(PAHCIPort pAhciPort, void *pvBuf)
     p[101] = RT_H2LE_U16(pAhciPort->cTotalSectors >> 16);
     p[102] = RT_H2LE_U16(pAhciPort->cTotalSectors >> 32);
     p[103] = RT_H2LE_U16(pAhciPort->cTotalSectors >> 48);
+    if (ahciIsTrimSupported(pAhciPort))
+    {
+        p[105] = RT_H2LE_U16(AHCI_TRIM_BLOCKS_MAX); /* Maximum number of LBA range blocks for DATA SET MANAGEMENT */
+        p[169] = RT_H2LE_U16(1); /* DATA SET MANAGEMENT with TRIM supported */
+    }
     if (pAhciPort->fNonRotational)
         p[217] = RT_H2LE_U16(1); /* Non-rotational medium */
 
@@ -5104,6 +5137,121 @@ DECLINLINE(uint8_t) ahciGetTagQueued(uint8_t *pCmdFis)
     return pCmdFis[AHCI_CMDFIS_SECTC] >> 3;
 }
 
+/**
+ * Reads the LBA range entries of a DATA SET MANAGEMENT command from guest
+ * memory and converts them into a range array for the block driver.
+ *
+ * @returns VBox status code.
+ * @param   pAhciPort             The port the request is for.
+ * @param   pAhciPortTaskState    The task state of the trim request.
+ */
+static int ahciTrimRangesCreate(PAHCIPort pAhciPort, PAHCIPORTTASKSTATE pAhciPortTaskState)
+{
+    CmdHdr    *pCmdHdr = &pAhciPortTaskState->cmdHdr;
+    PPDMDEVINS pDevIns = pAhciPort->CTX_SUFF(pDevIns);
+    SGLEntry   aSGLEntry[32];
+    uint64_t   aRanges[AHCI_TRIM_RANGES_PER_BLOCK];
+    unsigned   cSGLEntriesGCRead;
+    unsigned   cSGLEntriesGCLeft;
+    RTGCPHYS   GCPhysAddrPRDTLEntryStart;
+    unsigned   cBlocks;
+    uint32_t   cbLeft;
+    unsigned   cRanges = 0;
+    int        rc = VINF_SUCCESS;
+
+    Assert(!pAhciPortTaskState->paRanges);
+
+    cBlocks = (pAhciPortTaskState->cmdFis[AHCI_CMDFIS_SECTCEXP] << 8) | pAhciPortTaskState->cmdFis[AHCI_CMDFIS_SECTC];
+    if (!cBlocks || cBlocks > AHCI_TRIM_BLOCKS_MAX)
+        return VERR_INVALID_PARAMETER;
+
+    pAhciPortTaskState->paRanges = (PRTRANGE)RTMemAllocZ(cBlocks * AHCI_TRIM_RANGES_PER_BLOCK * sizeof(RTRANGE));
+    if (!pAhciPortTaskState->paRanges)
+        return VERR_NO_MEMORY;
+
+    cbLeft = cBlocks * 512;
+    cSGLEntriesGCLeft = AHCI_CMDHDR_PRDTL_ENTRIES(pCmdHdr->u32DescInf);
+    GCPhysAddrPRDTLEntryStart = AHCI_RTGCPHYS_FROM_U32(pCmdHdr->u32CmdTblAddrUp, pCmdHdr->u32CmdTblAddr) + AHCI_CMDHDR_PRDT_OFFSET;
+
+    while (   cSGLEntriesGCLeft
+           && cbLeft
+           && RT_SUCCESS(rc))
+    {
+        cSGLEntriesGCRead = RT_MIN(cSGLEntriesGCLeft, RT_ELEMENTS(aSGLEntry));
+        cSGLEntriesGCLeft -= cSGLEntriesGCRead;
+
+        PDMDevHlpPhysRead(pDevIns, GCPhysAddrPRDTLEntryStart, &aSGLEntry[0], cSGLEntriesGCRead * sizeof(SGLEntry));
+        GCPhysAddrPRDTLEntryStart += cSGLEntriesGCRead * sizeof(SGLEntry);
+
+        for (unsigned i = 0; i < cSGLEntriesGCRead && cbLeft && RT_SUCCESS(rc); i++)
+        {
+            RTGCPHYS GCPhysAddrData = AHCI_RTGCPHYS_FROM_U32(aSGLEntry[i].u32DBAUp, aSGLEntry[i].u32DBA);
+            uint32_t cbData = RT_MIN((aSGLEntry[i].u32DescInf & SGLENTRY_DESCINF_DBC) + 1, cbLeft);
+
+            /* Range entries are 8 bytes each, ignore a trailing partial one. */
+            cbData &= ~(uint32_t)(sizeof(uint64_t) - 1);
+            cbLeft -= cbData;
+
+            while (cbData)
+            {
+                uint32_t cbThisRead = RT_MIN(cbData, sizeof(aRanges));
+
+                PDMDevHlpPhysRead(pDevIns, GCPhysAddrData, &aRanges[0], cbThisRead);
+                GCPhysAddrData += cbThisRead;
+                cbData         -= cbThisRead;
+
+                for (unsigned iRange = 0; iRange < cbThisRead / sizeof(uint64_t); iRange++)
+                {
+                    uint64_t u64Range = RT_LE2H_U64(aRanges[iRange]);
+                    uint64_t uLba     = u64Range & UINT64_C(0x0000ffffffffffff);
+                    uint32_t cSectors = (uint32_t)(u64Range >> 48);
+
+                    /* Entries with a zero length are padding. */
+                    if (!cSectors)
+                        continue;
+
+                    if (   uLba >= pAhciPort->cTotalSectors
+                        || cSectors > pAhciPort->cTotalSectors - uLba)
+                    {
+                        rc = VERR_OUT_OF_RANGE;
+                        break;
+                    }
+
+                    pAhciPortTaskState->paRanges[cRanges].offStart = uLba * 512;
+                    pAhciPortTaskState->paRanges[cRanges].cbRange  = cSectors * 512;
+                    cRanges++;
+                }
+            }
+        }
+    }
+
+    pAhciPortTaskState->cRanges = cRanges;
+    if (RT_FAILURE(rc))
+    {
+        RTMemFree(pAhciPortTaskState->paRanges);
+        pAhciPortTaskState->paRanges = NULL;
+        pAhciPortTaskState->cRanges  = 0;
+    }
+
+    return rc;
+}
+
+/**
+ * Frees the range array of a trim request.
+ *
+ * @returns nothing.
+ * @param   pAhciPortTaskState    The task state of the trim request.
+ */
+static void ahciTrimRangesDestroy(PAHCIPORTTASKSTATE pAhciPortTaskState)
+{
+    if (pAhciPortTaskState->paRanges)
+    {
+        RTMemFree(pAhciPortTaskState->paRanges);
+        pAhciPortTaskState->paRanges = NULL;
+    }
+    pAhciPortTaskState->cRanges = 0;
+}
+
 static void ahciScatterGatherListGetTotalBufferSize(PAHCIPort pAhciPort, PAHCIPORTTASKSTATE pAhciPortTaskState)
 {
     CmdHdr    *pCmdHdr = &pAhciPortTaskState->cmdHdr;
@@ -6070,7 +6218,9 @@ static int ahciTransferComplete(PAHCIPort pAhciPort, PAHCIPORTTASKSTATE pAhciPor
     if (fXchg)
     {
         /* Free system resources occupied by the scatter gather list. */
-        if (pAhciPortTaskState->enmTxDir != AHCITXDIR_FLUSH)
+        if (pAhciPortTaskState->enmTxDir == AHCITXDIR_TRIM)
+            ahciTrimRangesDestroy(pAhciPortTaskState);
+        else if (pAhciPortTaskState->enmTxDir != AHCITXDIR_FLUSH)
             ahciScatterGatherListDestroy(pAhciPort, pAhciPortTaskState);
 
         if (pAhciPortTaskState->enmTxDir == AHCITXDIR_READ)
@@ -6092,6 +6242,9 @@ static int ahciTransferComplete(PAHCIPort pAhciPort, PAHCIPORTTASKSTATE pAhciPor
                 if (pAhciPortTaskState->enmTxDir == AHCITXDIR_FLUSH)
                     LogRel(("AHCI#%u: Flush returned rc=%Rrc\n",
                             pAhciPort->iLUN, rcReq));
+                else if (pAhciPortTaskState->enmTxDir == AHCITXDIR_TRIM)
+                    LogRel(("AHCI#%u: Trim returned rc=%Rrc\n",
+                            pAhciPort->iLUN, rcReq));
                 else
                     LogRel(("AHCI#%u: %s at offset %llu (%u bytes left) returned rc=%Rrc\n",
                             pAhciPort->iLUN,
@@ -6157,6 +6310,7 @@ static int ahciTransferComplete(PAHCIPort pAhciPort, PAHCIPORTTASKSTATE pAhciPor
                   ("Task is not active but wasn't canceled!\n"));
 
         ahciScatterGatherListFree(pAhciPortTaskState);
+        ahciTrimRangesDestroy(pAhciPortTaskState);
 
         /* Leave a log message about the canceled request. */
         if (pAhciPort->cErrors++ < MAX_LOG_REL_ERRORS)
@@ -6164,6 +6318,9 @@ static int ahciTransferComplete(PAHCIPort pAhciPort, PAHCIPORTTASKSTATE pAhciPor
             if (pAhciPortTaskState->enmTxDir == AHCITXDIR_FLUSH)
                 LogRel(("AHCI#%u: Canceled flush returned rc=%Rrc\n",
                         pAhciPort->iLUN, rcReq));
+            else if (pAhciPortTaskState->enmTxDir == AHCITXDIR_TRIM)
+                LogRel(("AHCI#%u: Canceled trim returned rc=%Rrc\n",
+                        pAhciPort->iLUN, rcReq));
             else
                 LogRel(("AHCI#%u: Canceled %s at offset %llu (%u bytes left) returned rc=%Rrc\n",
                         pAhciPort->iLUN,
@@ -6317,6 +6474,31 @@ static AHCITXDIR ahciProcessCmd(PAHCIPort pAhciPort, PAHCIPORTTASKSTATE pAhciPor
         case ATA_FLUSH_CACHE:
             rc = AHCITXDIR_FLUSH;
             break;
+        case ATA_DATA_SET_MANAGEMENT:
+        {
+            /* Only TRIM is defined and only if the medium can discard blocks. */
+            if (   (pCmdFis[AHCI_CMDFIS_FET] & 0x01)
+                && !pAhciPort->fATAPI
+                && ahciIsTrimSupported(pAhciPort)
+                && RT_SUCCESS(ahciTrimRangesCreate(pAhciPort, pAhciPortTaskState)))
+            {
+                if (pAhciPortTaskState->cRanges)
+                    rc = AHCITXDIR_TRIM;
+                else
+                {
+                    /* Nothing but padding entries, complete right away. */
+                    ahciTrimRangesDestroy(pAhciPortTaskState);
+                    pAhciPortTaskState->uATARegError = 0;
+                    pAhciPortTaskState->uATARegStatus = ATA_STAT_READY | ATA_STAT_SEEK;
+                }
+            }
+            else
+            {
+                pAhciPortTaskState->uATARegError = ABRT_ERR;
+                pAhciPortTaskState->uATARegStatus = ATA_STAT_READY | ATA_STAT_ERR;
+            }
+            break;
+        }
         case ATA_PACKET:
             if (!pAhciPort->fATAPI)
             {
@@ -6685,7 +6867,8 @@ static DECLCALLBACK(bool) ahciNotifyQueueConsumer(PPDMDEVINS pDevIns, PPDMQUEUEI
 
                     ASMAtomicIncU32(&pAhciPort->cTasksActive);
 
-                    if (enmTxDir != AHCITXDIR_FLUSH)
+                    if (   enmTxDir != AHCITXDIR_FLUSH
+                        && enmTxDir != AHCITXDIR_TRIM)
                     {
                         STAM_REL_COUNTER_INC(&pAhciPort->StatDMA);
 
@@ -6699,6 +6882,13 @@ static DECLCALLBACK(bool) ahciNotifyQueueConsumer(PPDMDEVINS pDevIns, PPDMQUEUEI
                         rc = pAhciPort->pDrvBlockAsync->pfnStartFlush(pAhciPort->pDrvBlockAsync,
                                                                       pAhciPortTaskState);
                     }
+                    else if (enmTxDir == AHCITXDIR_TRIM)
+                    {
+                        rc = pAhciPort->pDrvBlockAsync->pfnStartDiscard(pAhciPort->pDrvBlockAsync,
+                                                                        pAhciPortTaskState->paRanges,
+                                                                        pAhciPortTaskState->cRanges,
+                                                                        pAhciPortTaskState);
+                    }
                     else if (enmTxDir == AHCITXDIR_READ)
                     {
                         pAhciPort->Led.Asserted.s.fReading = pAhciPort->Led.Actual.s.fReading = 1;
@@ -6848,16 +7038,25 @@ static DECLCALLBACK(int) ahciAsyncIOLoop(PPDMDEVINS pDevIns, PPDMTHREAD pThread)
             {
                 enmTxDir = ahciProcessCmd(pAhciPort, pAhciPortTaskState, &pAhciPortTaskState->cmdFis[0]);
 
-                if (enmTxDir == AHCITXDIR_FLUSH)
+                if (   enmTxDir == AHCITXDIR_FLUSH
+                    || enmTxDir == AHCITXDIR_TRIM)
                 {
-                    rc = pAhciPort->pDrvBlock->pfnFlush(pAhciPort->pDrvBlock);
+                    if (enmTxDir == AHCITXDIR_FLUSH)
+                        rc = pAhciPort->pDrvBlock->pfnFlush(pAhciPort->pDrvBlock);
+                    else
+                    {
+                        rc = pAhciPort->pDrvBlock->pfnDiscard(pAhciPort->pDrvBlock,
+                                                              pAhciPortTaskState->paRanges,
+                                                              pAhciPortTaskState->cRanges);
+                        ahciTrimRangesDestroy(pAhciPortTaskState);
+                    }
 
                     /* Log the error. */
                     if (   RT_FAILURE(rc)
                         && pAhciPort->cErrors++ < MAX_LOG_REL_ERRORS)
                     {
-                        LogRel(("AHCI#%u: Flush returned rc=%Rrc\n",
-                                pAhciPort->iLUN, rc));
+                        LogRel(("AHCI#%u: %s returned rc=%Rrc\n",
+                                pAhciPort->iLUN, enmTxDir == AHCITXDIR_FLUSH ? "Flush" : "Trim", rc));
                     }
 
                     if (RT_FAILURE(rc))
@@ -0,0 +1,1289 @@
+/* $Id: DevVirtioBlk.cpp $ */
+/** @file
+ * DevVirtioBlk - Virtio Block Device
+ */
+
+/*
+ * Copyright (C) 2012 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+#define LOG_GROUP LOG_GROUP_DEV_VIRTIO
+
+#include <VBox/vmm/pdmdev.h>
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/string.h>
+#ifdef IN_RING3
+# include <iprt/mem.h>
+# include <iprt/time.h>
+# include <iprt/uuid.h>
+#endif /* IN_RING3 */
+#include "VBoxDD.h"
+#include "../VirtIO/Virtio.h"
+
+
+#ifndef VBOX_DEVICE_STRUCT_TESTCASE
+
+#define INSTANCE(pState) pState->VPCI.szInstance
+
+#define VBLK_PCI_SUBSYSTEM_ID        1 + VIRTIO_BLK_ID
+#define VBLK_PCI_CLASS               0x0180
+#define VBLK_N_QUEUES                1
+#define VBLK_NAME_FMT                "VBlk%d"
+
+#endif /* VBOX_DEVICE_STRUCT_TESTCASE */
+
+
+/** The size of the request queue, also limits the number of requests in flight. */
+#define VBLK_QUEUE_SIZE         128
+/** The sector size reported to the guest. */
+#define VBLK_SECTOR_SIZE        512
+/** The largest transfer we accept in a single request. */
+#define VBLK_MAX_TRANSFER_SIZE  (16 * _1M)
+/** The length of the device ID returned by VBLK_T_GET_ID. */
+#define VBLK_ID_BYTES           20
+/** Maximum number of I/O errors to put into the release log. */
+#define VBLK_MAX_LOG_REL_ERRORS 1024
+
+/* Virtio block features */
+#define VBLK_F_SIZE_MAX   0x00000002  /* Max size of any single segment is in size_max */
+#define VBLK_F_SEG_MAX    0x00000004  /* Max number of segments in a request is in seg_max */
+#define VBLK_F_GEOMETRY   0x00000010  /* Legacy geometry available */
+#define VBLK_F_RO         0x00000020  /* Disk is read-only */
+#define VBLK_F_BLK_SIZE   0x00000040  /* Block size of disk is in blk_size */
+#define VBLK_F_FLUSH      0x00000200  /* Cache flush command support */
+
+/* Request types */
+#define VBLK_T_IN         0
+#define VBLK_T_OUT        1
+#define VBLK_T_FLUSH      4
+#define VBLK_T_GET_ID     8
+
+/* Request status, the last byte the device writes for each request */
+#define VBLK_S_OK         0
+#define VBLK_S_IOERR      1
+#define VBLK_S_UNSUPP     2
+
+
+#ifdef _MSC_VER
+struct VBlkPCIConfig
+#else /* !_MSC_VER */
+struct __attribute__ ((__packed__)) VBlkPCIConfig
+#endif /* !_MSC_VER */
+{
+    uint64_t uCapacity;                 /**< In 512-byte sectors. */
+    uint32_t uSizeMax;
+    uint32_t uSegMax;
+    uint16_t uCylinders;
+    uint8_t  uHeads;
+    uint8_t  uSectors;
+    uint32_t uBlkSize;
+};
+AssertCompileMemberOffset(struct VBlkPCIConfig, uSegMax, 12);
+AssertCompileMemberOffset(struct VBlkPCIConfig, uCylinders, 16);
+AssertCompileMemberOffset(struct VBlkPCIConfig, uBlkSize, 20);
+
+/**
+ * Device state structure. Holds the current state of device.
+ *
+ * @extends     VPCISTATE
+ * @implements  PDMIBLOCKPORT
+ * @implements  PDMIBLOCKASYNCPORT
+ */
+struct VBlkState_st
+{
+    /* VPCISTATE must be the first member! */
+    VPCISTATE               VPCI;
+
+    /** The block port interface. */
+    PDMIBLOCKPORT           IPort;
+    /** The optional block async port interface. */
+    PDMIBLOCKASYNCPORT      IPortAsync;
+    /** Attached block driver. */
+    R3PTRTYPE(PPDMIBASE)    pDrvBase;
+    /** The block interface of the attached driver. */
+    R3PTRTYPE(PPDMIBLOCK)   pDrvBlock;
+    /** The block BIOS interface of the attached driver. */
+    R3PTRTYPE(PPDMIBLOCKBIOS) pDrvBlockBios;
+    /** The async block interface, NULL if the driver only does synchronous I/O. */
+    R3PTRTYPE(PPDMIBLOCKASYNC) pDrvBlockAsync;
+
+    /** The request queue. */
+    R3PTRTYPE(PVQUEUE)      pReqQueue;
+    /** Element the available ring gets parsed into, protected by the critsect.
+     * It is too big to live on the stack of the I/O threads completing requests. */
+    R3PTRTYPE(PVQUEUEELEM)  pElem;
+
+    /** PCI config area holding capacity and geometry. */
+    struct VBlkPCIConfig    config;
+    /** Size of the medium in 512-byte sectors. */
+    uint64_t                cTotalSectors;
+    /** Whether the medium is read-only. */
+    bool                    fReadOnly;
+    /** Set when the used index must be published after completing inline. */
+    bool                    fSyncPending;
+    /** Set when suspend/power off waits for all requests to complete. */
+    bool volatile           fSignalIdle;
+    /** Device ID returned for VBLK_T_GET_ID, not necessarily terminated. */
+    char                    szSerialNumber[VBLK_ID_BYTES + 1];
+    /** Incremented on every reset, requests from before a reset are dropped. */
+    uint32_t volatile       uGeneration;
+    /** Number of requests submitted but not completed yet. */
+    uint32_t volatile       cRequestsActive;
+    /** Number of I/O errors logged so far. */
+    uint32_t volatile       cErrors;
+
+    /* Statistic fields ******************************************************/
+
+    STAMCOUNTER             StatReads;
+    STAMCOUNTER             StatWrites;
+    STAMCOUNTER             StatFlushes;
+    STAMCOUNTER             StatBytesRead;
+    STAMCOUNTER             StatBytesWritten;
+    STAMCOUNTER             StatNotifies;
+    STAMCOUNTER             StatRequests;
+    STAMCOUNTER             StatCompletedInline;
+    STAMPROFILE             StatReqLatency;
+};
+typedef struct VBlkState_st VBLKSTATE;
+typedef VBLKSTATE *PVBLKSTATE;
+
+#ifndef VBOX_DEVICE_STRUCT_TESTCASE
+
+/** The request header, first read-only buffer of each request. */
+struct VBlkReqHdr
+{
+    uint32_t u32Type;
+    uint32_t u32IoPrio;
+    uint64_t u64Sector;
+};
+AssertCompileSize(struct VBlkReqHdr, 16);
+typedef struct VBlkReqHdr VBLKREQHDR;
+
+/** A piece of guest memory a request transfers data to or from. */
+struct VBlkReqSeg
+{
+    RTGCPHYS GCPhys;
+    uint32_t cb;
+};
+typedef struct VBlkReqSeg VBLKREQSEG;
+
+/**
+ * A request in flight.
+ *
+ * Requests are copied out of the shared VQUEUEELEM so that the queue can be
+ * drained and all of its requests submitted in one go. The data goes through
+ * a bounce buffer since the guest segments need not be sector aligned.
+ */
+struct VBlkReq
+{
+    /** Next request in the batch being submitted. */
+    struct VBlkReq         *pNext;
+    /** Head descriptor index which is returned in the used ring. */
+    uint32_t                uIndex;
+    /** The reset generation the request was started in. */
+    uint32_t                uGeneration;
+    /** Request type (VBLK_T_XXX). */
+    uint32_t                u32Type;
+    /** Number of guest data segments. */
+    uint32_t                cSegs;
+    /** The start sector as given by the guest. */
+    uint64_t                u64Sector;
+    /** Byte offset on the medium, set once u64Sector has been validated. */
+    uint64_t                uOffset;
+    /** Where the status byte goes. */
+    RTGCPHYS                GCPhysStatus;
+    /** Start timestamp for the latency statistics. */
+    uint64_t                u64TsStart;
+    /** The bounce buffer passed to the driver. */
+    RTSGSEG                 SgSeg;
+    /** The guest data segments. */
+    VBLKREQSEG              aSegs[1];
+};
+typedef struct VBlkReq VBLKREQ;
+typedef VBLKREQ *PVBLKREQ;
+
+#define PDMIBLOCKPORT_2_VBLKSTATE(pInterface)      ( (PVBLKSTATE)((uintptr_t)(pInterface) - RT_OFFSETOF(VBLKSTATE, IPort)) )
+#define PDMIBLOCKASYNCPORT_2_VBLKSTATE(pInterface) ( (PVBLKSTATE)((uintptr_t)(pInterface) - RT_OFFSETOF(VBLKSTATE, IPortAsync)) )
+
+#ifdef IN_RING3
+
+DECLINLINE(int) vblkCsEnter(PVBLKSTATE pState, int rcBusy)
+{
+    return vpciCsEnter(&pState->VPCI, rcBusy);
+}
+
+DECLINLINE(void) vblkCsLeave(PVBLKSTATE pState)
+{
+    vpciCsLeave(&pState->VPCI);
+}
+
+
+static uint32_t vblkGetHostFeatures(void *pvState)
+{
+    VBLKSTATE *pState = (VBLKSTATE *)pvState;
+    /* We support:
+     * - Segment count limit
+     * - Legacy geometry
+     * - Block size
+     * - Cache flush
+     */
+    uint32_t uFeatures = VBLK_F_SEG_MAX
+        | VBLK_F_GEOMETRY
+        | VBLK_F_BLK_SIZE
+        | VBLK_F_FLUSH;
+    if (pState->fReadOnly)
+        uFeatures |= VBLK_F_RO;
+    return uFeatures;
+}
+
+static uint32_t vblkGetHostMinimalFeatures(void *pvState)
+{
+    return 0;
+}
+
+static void vblkSetHostFeatures(void *pvState, uint32_t uFeatures)
+{
+    VBLKSTATE *pState = (VBLKSTATE *)pvState;
+    LogFlow(("%s vblkSetHostFeatures: uFeatures=%x\n", INSTANCE(pState), uFeatures));
+}
+
+static int vblkGetConfig(void *pvState, uint32_t port, uint32_t cb, void *data)
+{
+    VBLKSTATE *pState = (VBLKSTATE *)pvState;
+    if (port + cb > sizeof(struct VBlkPCIConfig))
+    {
+        Log(("%s vblkGetConfig: Read beyond the config structure is attempted (port=%RTiop cb=%x).\n", INSTANCE(pState), port, cb));
+        return VERR_IOM_IOPORT_UNUSED;
+    }
+    memcpy(data, ((uint8_t*)&pState->config) + port, cb);
+    return VINF_SUCCESS;
+}
+
+static int vblkSetConfig(void *pvState, uint32_t port, uint32_t cb, void *data)
+{
+    /* The whole config space is read-only for legacy virtio-blk. */
+    VBLKSTATE *pState = (VBLKSTATE *)pvState;
+    Log(("%s vblkSetConfig: Ignoring write to config space (port=%RTiop cb=%x).\n", INSTANCE(pState), port, cb));
+    return VINF_SUCCESS;
+}
+
+/**
+ * Hardware reset. Revert all registers to initial values.
+ *
+ * Requests still in flight complete later on but do not touch the rings any
+ * more, see vblkReqComplete().
+ *
+ * @param   pState      The device state structure.
+ */
+static int vblkReset(void *pvState)
+{
+    VBLKSTATE *pState = (VBLKSTATE*)pvState;
+    Log(("%s Reset triggered\n", INSTANCE(pState)));
+
+    int rc = vblkCsEnter(pState, VERR_SEM_BUSY);
+    if (RT_UNLIKELY(rc != VINF_SUCCESS))
+    {
+        LogRel(("vblkReset failed to enter critical section!\n"));
+        return rc;
+    }
+    vpciReset(&pState->VPCI);
+    ASMAtomicIncU32(&pState->uGeneration);
+    pState->fSyncPending = false;
+    vblkCsLeave(pState);
+    return VINF_SUCCESS;
+}
+
+/**
+ * This function is called when the driver becomes ready.
+ *
+ * @param   pState      The device state structure.
+ */
+static void vblkReady(void *pvState)
+{
+    VBLKSTATE *pState = (VBLKSTATE*)pvState;
+    Log(("%s Driver became ready\n", INSTANCE(pState)));
+}
+
+/**
+ * Port I/O Handler for IN operations.
+ *
+ * @returns VBox status code.
+ *
+ * @param   pDevIns     The device instance.
+ * @param   pvUser      Pointer to the device state structure.
+ * @param   port        Port number used for the IN operation.
+ * @param   pu32        Where to store the result.
+ * @param   cb          Number of bytes read.
+ * @thread  EMT
+ */
+static DECLCALLBACK(int) vblkIOPortIn(PPDMDEVINS pDevIns, void *pvUser,
+                                      RTIOPORT port, uint32_t *pu32, unsigned cb)
+{
+    return vpciIOPortIn(pDevIns, pvUser, port, pu32, cb,
+                        vblkGetHostFeatures,
+                        vblkGetConfig);
+}
+
+
+/**
+ * Port I/O Handler for OUT operations.
+ *
+ * @returns VBox status code.
+ *
+ * @param   pDevIns     The device instance.
+ * @param   pvUser      User argument.
+ * @param   Port        Port number used for the IN operation.
+ * @param   u32         The value to output.
+ * @param   cb          The value size in bytes.
+ * @thread  EMT
+ */
+static DECLCALLBACK(int) vblkIOPortOut(PPDMDEVINS pDevIns, void *pvUser,
+                                       RTIOPORT port, uint32_t u32, unsigned cb)
+{
+    return vpciIOPortOut(pDevIns, pvUser, port, u32, cb,
+                         vblkGetHostMinimalFeatures,
+                         vblkGetHostFeatures,
+                         vblkSetHostFeatures,
+                         vblkReset,
+                         vblkReady,
+                         vblkSetConfig);
+}
+
+
+/**
+ * Copies the data of a finished read into guest memory.
+ *
+ * @returns Number of bytes written.
+ * @param   pState      The device state structure.
+ * @param   pReq        The request.
+ * @param   cbData      Number of valid bytes in the bounce buffer.
+ */
+static uint32_t vblkReqCopyToGuest(PVBLKSTATE pState, PVBLKREQ pReq, size_t cbData)
+{
+    uint8_t *pbBuf = (uint8_t *)pReq->SgSeg.pvSeg;
+    size_t   cbLeft = cbData;
+
+    for (uint32_t i = 0; i < pReq->cSegs && cbLeft; i++)
+    {
+        size_t cbSeg = RT_MIN(pReq->aSegs[i].cb, cbLeft);
+        PDMDevHlpPhysWrite(pState->VPCI.CTX_SUFF(pDevIns), pReq->aSegs[i].GCPhys, pbBuf, cbSeg);
+        pbBuf  += cbSeg;
+        cbLeft -= cbSeg;
+    }
+    return (uint32_t)(cbData - cbLeft);
+}
+
+/**
+ * Returns a descriptor chain to the guest.
+ *
+ * @param   pState      The device state structure.
+ * @param   uIndex      The head descriptor index.
+ * @param   cbWritten   Number of bytes written into the chain, including status.
+ * @param   fSync       Whether to publish the used index and notify the guest
+ *                      right away. Otherwise fSyncPending is set and the caller
+ *                      publishes it once for a whole batch.
+ * @remarks Caller must own the critical section.
+ */
+static void vblkReturnChain(PVBLKSTATE pState, uint32_t uIndex, uint32_t cbWritten, bool fSync)
+{
+    PVQUEUEELEM pElem = pState->pElem;
+
+    pElem->uIndex = uIndex;
+    pElem->nIn    = 0;
+    pElem->nOut   = 0;
+    vqueuePut(&pState->VPCI, pState->pReqQueue, pElem, cbWritten);
+    if (fSync)
+        vqueueSync(&pState->VPCI, pState->pReqQueue);
+    else
+        pState->fSyncPending = true;
+}
+
+/**
+ * Completes a request, either inline or from the async completion callback.
+ *
+ * @param   pState      The device state structure.
+ * @param   pReq        The request, freed on return.
+ * @param   rcReq       Status of the request.
+ * @param   fSync       See vblkReturnChain().
+ */
+static void vblkReqComplete(PVBLKSTATE pState, PVBLKREQ pReq, int rcReq, bool fSync)
+{
+    uint8_t  u8Status;
+    uint32_t cbWritten = 0;
+    bool     fCurrent  = ASMAtomicReadU32(&pState->uGeneration) == pReq->uGeneration;
+
+    if (RT_SUCCESS(rcReq))
+    {
+        u8Status = VBLK_S_OK;
+        switch (pReq->u32Type)
+        {
+            case VBLK_T_IN:
+                if (fCurrent)
+                    cbWritten = vblkReqCopyToGuest(pState, pReq, pReq->SgSeg.cbSeg);
+                STAM_REL_COUNTER_ADD(&pState->StatBytesRead, pReq->SgSeg.cbSeg);
+                vpciSetReadLed(&pState->VPCI, false);
+                break;
+            case VBLK_T_OUT:
+                STAM_REL_COUNTER_ADD(&pState->StatBytesWritten, pReq->SgSeg.cbSeg);
+                vpciSetWriteLed(&pState->VPCI, false);
+                break;
+            case VBLK_T_GET_ID:
+                if (fCurrent)
+                    cbWritten = vblkReqCopyToGuest(pState, pReq, RT_MIN(pReq->SgSeg.cbSeg, VBLK_ID_BYTES));
+                break;
+            default:
+                break;
+        }
+    }
+    else
+    {
+        if (rcReq == VERR_NOT_SUPPORTED)
+            u8Status = VBLK_S_UNSUPP;
+        else
+        {
+            u8Status = VBLK_S_IOERR;
+            if (ASMAtomicIncU32(&pState->cErrors) < VBLK_MAX_LOG_REL_ERRORS)
+                LogRel(("%s: Request type %u at offset %llu (%zu bytes) failed with %Rrc\n",
+                        INSTANCE(pState), pReq->u32Type, pReq->uOffset, pReq->SgSeg.cbSeg, rcReq));
+        }
+        if (pReq->u32Type == VBLK_T_IN)
+            vpciSetReadLed(&pState->VPCI, false);
+        else if (pReq->u32Type == VBLK_T_OUT)
+            vpciSetWriteLed(&pState->VPCI, false);
+    }
+
+    if (fCurrent)
+        PDMDevHlpPhysWrite(pState->VPCI.CTX_SUFF(pDevIns), pReq->GCPhysStatus, &u8Status, sizeof(u8Status));
+
+    STAM_REL_PROFILE_ADD_PERIOD(&pState->StatReqLatency, RTTimeNanoTS() - pReq->u64TsStart);
+
+    int rc = vblkCsEnter(pState, VERR_SEM_BUSY);
+    AssertRC(rc);
+    /* The guest may have reset the device meanwhile, the rings are gone then. */
+    if (   pReq->uGeneration == pState->uGeneration
+        && vqueueIsReady(&pState->VPCI, pState->pReqQueue))
+        vblkReturnChain(pState, pReq->uIndex, cbWritten + sizeof(u8Status), fSync);
+    vblkCsLeave(pState);
+
+    if (pReq->SgSeg.pvSeg)
+        RTMemFree(pReq->SgSeg.pvSeg);
+    RTMemFree(pReq);
+
+    if (   ASMAtomicDecU32(&pState->cRequestsActive) == 0
+        && ASMAtomicReadBool(&pState->fSignalIdle))
+        PDMDevHlpAsyncNotificationCompleted(pState->VPCI.pDevInsR3);
+}
+
+/**
+ * Turns the descriptor chain in pState->pElem into a request.
+ *
+ * Malformed chains are returned to the guest right away with an error status
+ * (if there is a place to put it).
+ *
+ * @returns The new request, NULL if there is nothing to submit.
+ * @param   pState      The device state structure.
+ * @remarks Caller must own the critical section.
+ */
+static PVBLKREQ vblkReqCreate(PVBLKSTATE pState)
+{
+    PVQUEUEELEM pElem = pState->pElem;
+    PPDMDEVINS  pDevIns = pState->VPCI.CTX_SUFF(pDevIns);
+    uint8_t     u8Status = VBLK_S_IOERR;
+    VBLKREQHDR  Hdr;
+
+    /* The header is read-only, the status byte write-only, data in between. */
+    if (   pElem->nOut < 1
+        || pElem->aSegsOut[0].cb < sizeof(Hdr)
+        || pElem->nIn < 1
+        || pElem->aSegsIn[pElem->nIn - 1].cb < 1)
+    {
+        Log(("%s vblkReqCreate: Malformed request nIn=%u nOut=%u\n", INSTANCE(pState), pElem->nIn, pElem->nOut));
+        if (pElem->nIn >= 1 && pElem->aSegsIn[pElem->nIn - 1].cb >= 1)
+            PDMDevHlpPhysWrite(pDevIns, pElem->aSegsIn[pElem->nIn - 1].addr + pElem->aSegsIn[pElem->nIn - 1].cb - 1,
+                               &u8Status, sizeof(u8Status));
+        vblkReturnChain(pState, pElem->uIndex, 0, false);
+        return NULL;
+    }
+    PDMDevHlpPhysRead(pDevIns, pElem->aSegsOut[0].addr, &Hdr, sizeof(Hdr));
+
+    /* Pick the data segments, the status byte is the last byte of the last IN segment. */
+    VQUEUESEG *paSegs;
+    uint32_t   cSegs;
+    RTGCPHYS   GCPhysStatus = pElem->aSegsIn[pElem->nIn - 1].addr + pElem->aSegsIn[pElem->nIn - 1].cb - 1;
+    if (Hdr.u32Type == VBLK_T_OUT)
+    {
+        paSegs = &pElem->aSegsOut[1];
+        cSegs  = pElem->nOut - 1;
+    }
+    else
+    {
+        paSegs = &pElem->aSegsIn[0];
+        cSegs  = pElem->nIn;
+    }
+
+    PVBLKREQ pReq = (PVBLKREQ)RTMemAlloc(RT_OFFSETOF(VBLKREQ, aSegs) + RT_MAX(cSegs, 1) * sizeof(VBLKREQSEG));
+    if (!pReq)
+    {
+        PDMDevHlpPhysWrite(pDevIns, GCPhysStatus, &u8Status, sizeof(u8Status));
+        vblkReturnChain(pState, pElem->uIndex, sizeof(u8Status), false);
+        return NULL;
+    }
+    pReq->pNext        = NULL;
+    pReq->uIndex       = pElem->uIndex;
+    pReq->uGeneration  = pState->uGeneration;
+    pReq->u32Type      = Hdr.u32Type;
+    pReq->u64Sector    = Hdr.u64Sector;
+    pReq->uOffset      = 0;
+    pReq->GCPhysStatus = GCPhysStatus;
+    pReq->u64TsStart   = RTTimeNanoTS();
+    pReq->SgSeg.pvSeg  = NULL;
+
+    size_t cbData = 0;
+    for (uint32_t i = 0; i < cSegs; i++)
+    {
+        pReq->aSegs[i].GCPhys = paSegs[i].addr;
+        pReq->aSegs[i].cb     = paSegs[i].cb;
+        cbData += paSegs[i].cb;
+    }
+    /* Exclude the status byte. */
+    if (Hdr.u32Type != VBLK_T_OUT)
+    {
+        pReq->aSegs[cSegs - 1].cb--;
+        cbData--;
+    }
+    pReq->cSegs       = cSegs;
+    pReq->SgSeg.cbSeg = cbData;
+    return pReq;
+}
+
+/**
+ * Validates a request and hands it to the driver.
+ *
+ * @param   pState      The device state structure.
+ * @param   pReq        The request.
+ * @thread  EMT
+ */
+static void vblkReqSubmit(PVBLKSTATE pState, PVBLKREQ pReq)
+{
+    PPDMDEVINS pDevIns = pState->VPCI.CTX_SUFF(pDevIns);
+    size_t     cbData  = pReq->SgSeg.cbSeg;
+    bool       fAsync  = false;
+    int        rc;
+
+    ASMAtomicIncU32(&pState->cRequestsActive);
+    STAM_REL_COUNTER_INC(&pState->StatRequests);
+
+    switch (pReq->u32Type)
+    {
+        case VBLK_T_IN:
+        case VBLK_T_OUT:
+            if (   (cbData % VBLK_SECTOR_SIZE)
+                || cbData > VBLK_MAX_TRANSFER_SIZE
+                || pReq->u64Sector > pState->cTotalSectors
+                || cbData / VBLK_SECTOR_SIZE > pState->cTotalSectors - pReq->u64Sector)
+            {
+                Log(("%s vblkReqSubmit: Invalid transfer sector=%llu cb=%zu\n", INSTANCE(pState), pReq->u64Sector, cbData));
+                rc = VERR_OUT_OF_RANGE;
+                break;
+            }
+            /* Can't overflow, the sector is within the medium. */
+            pReq->uOffset = pReq->u64Sector * VBLK_SECTOR_SIZE;
+            if (pReq->u32Type == VBLK_T_OUT && pState->fReadOnly)
+            {
+                rc = VERR_WRITE_PROTECT;
+                break;
+            }
+            if (!cbData)
+            {
+                rc = VINF_SUCCESS;
+                break;
+            }
+            pReq->SgSeg.pvSeg = RTMemAlloc(cbData);
+            if (!pReq->SgSeg.pvSeg)
+            {
+                rc = VERR_NO_MEMORY;
+                break;
+            }
+
+            if (pReq->u32Type == VBLK_T_IN)
+            {
+                STAM_REL_COUNTER_INC(&pState->StatReads);
+                vpciSetReadLed(&pState->VPCI, true);
+                fAsync = pState->pDrvBlockAsync != NULL;
+                if (fAsync)
+                    rc = pState->pDrvBlockAsync->pfnStartRead(pState->pDrvBlockAsync, pReq->uOffset,
+                                                              &pReq->SgSeg, 1, cbData, pReq);
+                else
+                    rc = pState->pDrvBlock->pfnRead(pState->pDrvBlock, pReq->uOffset, pReq->SgSeg.pvSeg, cbData);
+            }
+            else
+            {
+                uint8_t *pbBuf = (uint8_t *)pReq->SgSeg.pvSeg;
+                for (uint32_t i = 0; i < pReq->cSegs; i++)
+                {
+                    PDMDevHlpPhysRead(pDevIns, pReq->aSegs[i].GCPhys, pbBuf, pReq->aSegs[i].cb);
+                    pbBuf += pReq->aSegs[i].cb;
+                }
+
+                STAM_REL_COUNTER_INC(&pState->StatWrites);
+                vpciSetWriteLed(&pState->VPCI, true);
+                fAsync = pState->pDrvBlockAsync != NULL;
+                if (fAsync)
+                    rc = pState->pDrvBlockAsync->pfnStartWrite(pState->pDrvBlockAsync, pReq->uOffset,
+                                                               &pReq->SgSeg, 1, cbData, pReq);
+                else
+                    rc = pState->pDrvBlock->pfnWrite(pState->pDrvBlock, pReq->uOffset, pReq->SgSeg.pvSeg, cbData);
+            }
+            break;
+
+        case VBLK_T_FLUSH:
+            STAM_REL_COUNTER_INC(&pState->StatFlushes);
+            fAsync = pState->pDrvBlockAsync != NULL;
+            if (fAsync)
+                rc = pState->pDrvBlockAsync->pfnStartFlush(pState->pDrvBlockAsync, pReq);
+            else
+                rc = pState->pDrvBlock->pfnFlush(pState->pDrvBlock);
+            break;
+
+        case VBLK_T_GET_ID:
+            pReq->SgSeg.cbSeg = RT_MIN(cbData, VBLK_ID_BYTES);
+            pReq->SgSeg.pvSeg = RTMemAllocZ(VBLK_ID_BYTES);
+            if (!pReq->SgSeg.pvSeg)
+            {
+                rc = VERR_NO_MEMORY;
+                break;
+            }
+            memcpy(pReq->SgSeg.pvSeg, pState->szSerialNumber, strlen(pState->szSerialNumber));
+            rc = VINF_SUCCESS;
+            break;
+
+        default:
+            Log(("%s vblkReqSubmit: Unsupported request type %u\n", INSTANCE(pState), pReq->u32Type));
+            rc = VERR_NOT_SUPPORTED;
+            break;
+    }
+
+    /* Requests which are done already get completed here, the guest is notified once for the batch. */
+    if (fAsync)
+    {
+        if (rc == VINF_VD_ASYNC_IO_FINISHED)
+            rc = VINF_SUCCESS;
+        else if (RT_SUCCESS(rc) || rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+            return; /* vblkTransferCompleteNotify() takes it from here. */
+    }
+    STAM_REL_COUNTER_INC(&pState->StatCompletedInline);
+    vblkReqComplete(pState, pReq, rc, false /*fSync*/);
+}
+
+/**
+ * Request queue notification callback, processes all requests available.
+ *
+ * The whole ring is parsed while guest notifications are disabled and the
+ * requests are then handed to the driver back to back, so a guest queueing
+ * many requests costs one exit instead of one per request. Requests which
+ * complete synchronously are published to the guest with a single interrupt
+ * at the end.
+ *
+ * @param   pvState     The device state structure.
+ * @param   pQueue      The request queue.
+ * @thread  EMT
+ */
+static DECLCALLBACK(void) vblkQueueNotify(void *pvState, PVQUEUE pQueue)
+{
+    VBLKSTATE *pState = (VBLKSTATE*)pvState;
+    PVBLKREQ   pHead = NULL;
+    PVBLKREQ  *ppTail = &pHead;
+
+    if (!(pState->VPCI.uStatus & VPCI_STATUS_DRV_OK))
+    {
+        Log(("%s Ignoring request queue notification as the driver is not ready (status=0x%x)\n",
+             INSTANCE(pState), pState->VPCI.uStatus));
+        return;
+    }
+    if (!pState->pDrvBlock)
+    {
+        Log(("%s Ignoring request queue notification, no medium attached\n", INSTANCE(pState)));
+        return;
+    }
+    STAM_REL_COUNTER_INC(&pState->StatNotifies);
+
+    int rc = vblkCsEnter(pState, VERR_SEM_BUSY);
+    AssertRCReturnVoid(rc);
+    for (;;)
+    {
+        vringSetNotification(&pState->VPCI, &pQueue->VRing, false);
+        while (vqueueGet(&pState->VPCI, pQueue, pState->pElem))
+        {
+            PVBLKREQ pReq = vblkReqCreate(pState);
+            if (pReq)
+            {
+                *ppTail = pReq;
+                ppTail = &pReq->pNext;
+            }
+        }
+        /* Re-enable notifications and make sure nothing slipped in meanwhile. */
+        vringSetNotification(&pState->VPCI, &pQueue->VRing, true);
+        if (vqueueIsEmpty(&pState->VPCI, pQueue))
+            break;
+    }
+    vblkCsLeave(pState);
+
+    while (pHead)
+    {
+        PVBLKREQ pReq = pHead;
+        pHead = pReq->pNext;
+        vblkReqSubmit(pState, pReq);
+    }
+
+    rc = vblkCsEnter(pState, VERR_SEM_BUSY);
+    AssertRCReturnVoid(rc);
+    if (pState->fSyncPending)
+    {
+        pState->fSyncPending = false;
+        if (vqueueIsReady(&pState->VPCI, pQueue))
+            vqueueSync(&pState->VPCI, pQueue);
+    }
+    vblkCsLeave(pState);
+}
+
+
+/* -=-=-=-=- PDMIBLOCKPORT / PDMIBLOCKASYNCPORT -=-=-=-=- */
+
+/**
+ * @interface_method_impl{PDMIBLOCKPORT,pfnQueryDeviceLocation}
+ */
+static DECLCALLBACK(int) vblkQueryDeviceLocation(PPDMIBLOCKPORT pInterface, const char **ppcszController,
+                                                 uint32_t *piInstance, uint32_t *piLUN)
+{
+    PVBLKSTATE pState  = PDMIBLOCKPORT_2_VBLKSTATE(pInterface);
+    PPDMDEVINS pDevIns = pState->VPCI.pDevInsR3;
+
+    AssertPtrReturn(ppcszController, VERR_INVALID_POINTER);
+    AssertPtrReturn(piInstance, VERR_INVALID_POINTER);
+    AssertPtrReturn(piLUN, VERR_INVALID_POINTER);
+
+    *ppcszController = pDevIns->pReg->szName;
+    *piInstance = pDevIns->iInstance;
+    *piLUN = 0;
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * @interface_method_impl{PDMIBLOCKASYNCPORT,pfnTransferCompleteNotify}
+ */
+static DECLCALLBACK(int) vblkTransferCompleteNotify(PPDMIBLOCKASYNCPORT pInterface, void *pvUser, int rcReq)
+{
+    PVBLKSTATE pState = PDMIBLOCKASYNCPORT_2_VBLKSTATE(pInterface);
+    PVBLKREQ   pReq = (PVBLKREQ)pvUser;
+
+    vblkReqComplete(pState, pReq, rcReq, true /*fSync*/);
+    return VINF_SUCCESS;
+}
+
+/**
+ * @interface_method_impl{PDMIBASE,pfnQueryInterface}
+ */
+static DECLCALLBACK(void *) vblkQueryInterface(struct PDMIBASE *pInterface, const char *pszIID)
+{
+    VBLKSTATE *pThis = RT_FROM_MEMBER(pInterface, VBLKSTATE, VPCI.IBase);
+    Assert(&pThis->VPCI.IBase == pInterface);
+
+    PDMIBASE_RETURN_INTERFACE(pszIID, PDMIBLOCKPORT, &pThis->IPort);
+    PDMIBASE_RETURN_INTERFACE(pszIID, PDMIBLOCKASYNCPORT, &pThis->IPortAsync);
+    return vpciQueryInterface(pInterface, pszIID);
+}
+
+
+/* -=-=-=-=- Saved state -=-=-=-=- */
+
+/**
+ * Saves the configuration.
+ *
+ * @param   pState      The VBLK state.
+ * @param   pSSM        The handle to the saved state.
+ */
+static void vblkSaveConfig(VBLKSTATE *pState, PSSMHANDLE pSSM)
+{
+    SSMR3PutU64(pSSM, pState->cTotalSectors);
+    SSMR3PutBool(pSSM, pState->fReadOnly);
+}
+
+/**
+ * Live save - save basic configuration.
+ *
+ * @returns VBox status code.
+ * @param   pDevIns     The device instance.
+ * @param   pSSM        The handle to the saved state.
+ * @param   uPass
+ */
+static DECLCALLBACK(int) vblkLiveExec(PPDMDEVINS pDevIns, PSSMHANDLE pSSM, uint32_t uPass)
+{
+    VBLKSTATE *pState = PDMINS_2_DATA(pDevIns, VBLKSTATE*);
+    vblkSaveConfig(pState, pSSM);
+    return VINF_SSM_DONT_CALL_AGAIN;
+}
+
+/**
+ * Saves the state of device.
+ *
+ * Nothing is in flight here, suspend waits for all requests to complete.
+ *
+ * @returns VBox status code.
+ * @param   pDevIns     The device instance.
+ * @param   pSSM        The handle to the saved state.
+ */
+static DECLCALLBACK(int) vblkSaveExec(PPDMDEVINS pDevIns, PSSMHANDLE pSSM)
+{
+    VBLKSTATE *pState = PDMINS_2_DATA(pDevIns, VBLKSTATE*);
+
+    Assert(!pState->cRequestsActive);
+    vblkSaveConfig(pState, pSSM);
+    int rc = vpciSaveExec(&pState->VPCI, pSSM);
+    AssertRCReturn(rc, rc);
+    Log(("%s State has been saved\n", INSTANCE(pState)));
+    return VINF_SUCCESS;
+}
+
+/**
+ * Restore previously saved state of device.
+ *
+ * @returns VBox status code.
+ * @param   pDevIns     The device instance.
+ * @param   pSSM        The handle to the saved state.
+ * @param   uVersion    The data unit version number.
+ * @param   uPass       The data pass.
+ */
+static DECLCALLBACK(int) vblkLoadExec(PPDMDEVINS pDevIns, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t uPass)
+{
+    VBLKSTATE *pState = PDMINS_2_DATA(pDevIns, VBLKSTATE*);
+
+    /* config checks */
+    uint64_t cTotalSectors;
+    bool     fReadOnly;
+    int rc = SSMR3GetU64(pSSM, &cTotalSectors);
+    AssertRCReturn(rc, rc);
+    rc = SSMR3GetBool(pSSM, &fReadOnly);
+    AssertRCReturn(rc, rc);
+    if (cTotalSectors != pState->cTotalSectors)
+        return SSMR3SetCfgError(pSSM, RT_SRC_POS, N_("The disk size differs: config=%llu saved=%llu"),
+                                pState->cTotalSectors, cTotalSectors);
+    if (fReadOnly != pState->fReadOnly)
+        LogRel(("%s: The read-only setting differs: config=%RTbool saved=%RTbool\n",
+                INSTANCE(pState), pState->fReadOnly, fReadOnly));
+
+    if (uPass != SSM_PASS_FINAL)
+        return VINF_SUCCESS;
+    return vpciLoadExec(&pState->VPCI, pSSM, uVersion, uPass, VBLK_N_QUEUES);
+}
+
+/**
+ * Map PCI I/O region.
+ *
+ * @return  VBox status code.
+ * @param   pPciDev         Pointer to PCI device. Use pPciDev->pDevIns to get the device instance.
+ * @param   iRegion         The region number.
+ * @param   GCPhysAddress   Physical address of the region. If iType is PCI_ADDRESS_SPACE_IO, this is an
+ *                          I/O port, else it's a physical address.
+ *                          This address is *NOT* relative to pci_mem_base like earlier!
+ * @param   cb              Region size.
+ * @param   enmType         One of the PCI_ADDRESS_SPACE_* values.
+ * @thread  EMT
+ */
+static DECLCALLBACK(int) vblkMap(PPCIDEVICE pPciDev, int iRegion,
+                                 RTGCPHYS GCPhysAddress, uint32_t cb, PCIADDRESSSPACE enmType)
+{
+    VBLKSTATE *pState = PDMINS_2_DATA(pPciDev->pDevIns, VBLKSTATE*);
+
+    if (enmType != PCI_ADDRESS_SPACE_IO)
+    {
+        /* We should never get here */
+        AssertMsgFailed(("Invalid PCI address space param in map callback"));
+        return VERR_INTERNAL_ERROR;
+    }
+
+    /* Requests are processed in ring-3 only, so are the ports. */
+    pState->VPCI.addrIOPort = (RTIOPORT)GCPhysAddress;
+    int rc = PDMDevHlpIOPortRegister(pPciDev->pDevIns, pState->VPCI.addrIOPort,
+                                     cb, 0, vblkIOPortOut, vblkIOPortIn,
+                                     NULL, NULL, "VirtioBlk");
+    AssertRC(rc);
+    return rc;
+}
+
+
+/* -=-=-=-=- PDMDEVREG -=-=-=-=- */
+
+/**
+ * Configures the attached medium.
+ *
+ * @returns VBox status code.
+ * @param   pDevIns     The device instance.
+ * @param   pState      The device state structure.
+ */
+static int vblkConfigureLUN(PPDMDEVINS pDevIns, PVBLKSTATE pState)
+{
+    /*
+     * Query the block and blockbios interfaces.
+     */
+    pState->pDrvBlock = PDMIBASE_QUERY_INTERFACE(pState->pDrvBase, PDMIBLOCK);
+    if (!pState->pDrvBlock)
+    {
+        AssertMsgFailed(("Configuration error: LUN#0 hasn't a block interface!\n"));
+        return VERR_PDM_MISSING_INTERFACE;
+    }
+    pState->pDrvBlockBios = PDMIBASE_QUERY_INTERFACE(pState->pDrvBase, PDMIBLOCKBIOS);
+    if (!pState->pDrvBlockBios)
+    {
+        AssertMsgFailed(("Configuration error: LUN#0 hasn't a block BIOS interface!\n"));
+        return VERR_PDM_MISSING_INTERFACE;
+    }
+
+    /* Try to get the optional async block interface. */
+    pState->pDrvBlockAsync = PDMIBASE_QUERY_INTERFACE(pState->pDrvBase, PDMIBLOCKASYNC);
+
+    if (pState->pDrvBlock->pfnGetType(pState->pDrvBlock) != PDMBLOCKTYPE_HARD_DISK)
+    {
+        AssertMsgFailed(("Configuration error: LUN#0 isn't a disk\n"));
+        return VERR_PDM_UNSUPPORTED_BLOCK_TYPE;
+    }
+
+    pState->cTotalSectors = pState->pDrvBlock->pfnGetSize(pState->pDrvBlock) / VBLK_SECTOR_SIZE;
+    pState->fReadOnly     = pState->pDrvBlock->pfnIsReadOnly(pState->pDrvBlock);
+
+    PDMMEDIAGEOMETRY PCHSGeometry;
+    int rc = pState->pDrvBlockBios->pfnGetPCHSGeometry(pState->pDrvBlockBios, &PCHSGeometry);
+    if (   RT_FAILURE(rc)
+        || PCHSGeometry.cCylinders == 0
+        || PCHSGeometry.cHeads == 0
+        || PCHSGeometry.cSectors == 0)
+    {
+        uint64_t cCylinders = pState->cTotalSectors / (16 * 63);
+        PCHSGeometry.cCylinders = RT_MAX(RT_MIN(cCylinders, 16383), 1);
+        PCHSGeometry.cHeads     = 16;
+        PCHSGeometry.cSectors   = 63;
+        /* Set the disk geometry information. Ignore errors. */
+        pState->pDrvBlockBios->pfnSetPCHSGeometry(pState->pDrvBlockBios, &PCHSGeometry);
+    }
+
+    pState->config.uCapacity  = pState->cTotalSectors;
+    pState->config.uSizeMax   = 0;
+    pState->config.uSegMax    = VBLK_QUEUE_SIZE - 2;
+    pState->config.uCylinders = (uint16_t)PCHSGeometry.cCylinders;
+    pState->config.uHeads     = (uint8_t)PCHSGeometry.cHeads;
+    pState->config.uSectors   = (uint8_t)PCHSGeometry.cSectors;
+    pState->config.uBlkSize   = VBLK_SECTOR_SIZE;
+
+    LogRel(("%s: disk, PCHS=%u/%u/%u, total number of sectors %Ld, %s, %s I/O\n",
+            INSTANCE(pState), PCHSGeometry.cCylinders, PCHSGeometry.cHeads, PCHSGeometry.cSectors,
+            pState->cTotalSectors, pState->fReadOnly ? "read-only" : "read-write",
+            pState->pDrvBlockAsync ? "async" : "sync"));
+    return VINF_SUCCESS;
+}
+
+/**
+ * Callback employed by vblkSuspend and vblkPowerOff.
+ *
+ * @returns true if we've quiesced, false if we're still working.
+ * @param   pDevIns     The device instance.
+ */
+static DECLCALLBACK(bool) vblkIsAsyncSuspendOrPowerOffDone(PPDMDEVINS pDevIns)
+{
+    VBLKSTATE *pState = PDMINS_2_DATA(pDevIns, VBLKSTATE*);
+
+    if (ASMAtomicReadU32(&pState->cRequestsActive))
+        return false;
+    ASMAtomicWriteBool(&pState->fSignalIdle, false);
+    return true;
+}
+
+/**
+ * Common worker for vblkSuspend and vblkPowerOff.
+ */
+static void vblkSuspendOrPowerOff(PPDMDEVINS pDevIns)
+{
+    VBLKSTATE *pState = PDMINS_2_DATA(pDevIns, VBLKSTATE*);
+
+    ASMAtomicWriteBool(&pState->fSignalIdle, true);
+    if (ASMAtomicReadU32(&pState->cRequestsActive))
+        PDMDevHlpSetAsyncNotification(pDevIns, vblkIsAsyncSuspendOrPowerOffDone);
+    else
+        ASMAtomicWriteBool(&pState->fSignalIdle, false);
+}
+
+/**
+ * @copydoc FNPDMDEVSUSPEND
+ */
+static DECLCALLBACK(void) vblkSuspend(PPDMDEVINS pDevIns)
+{
+    vblkSuspendOrPowerOff(pDevIns);
+}
+
+/**
+ * @copydoc FNPDMDEVPOWEROFF
+ */
+static DECLCALLBACK(void) vblkPowerOff(PPDMDEVINS pDevIns)
+{
+    vblkSuspendOrPowerOff(pDevIns);
+}
+
+/**
+ * Detach notification.
+ *
+ * @param   pDevIns     The device instance.
+ * @param   iLUN        The logical unit which is being detached.
+ * @param   fFlags      Flags, combination of the PDMDEVATT_FLAGS_* \#defines.
+ */
+static DECLCALLBACK(void) vblkDetach(PPDMDEVINS pDevIns, unsigned iLUN, uint32_t fFlags)
+{
+    VBLKSTATE *pState = PDMINS_2_DATA(pDevIns, VBLKSTATE*);
+    Log(("%s vblkDetach:\n", INSTANCE(pState)));
+
+    AssertLogRelReturnVoid(iLUN == 0);
+    AssertMsg(!pState->cRequestsActive, ("Detaching with requests in flight\n"));
+
+    /*
+     * Zero some important members.
+     */
+    pState->pDrvBase       = NULL;
+    pState->pDrvBlock      = NULL;
+    pState->pDrvBlockBios  = NULL;
+    pState->pDrvBlockAsync = NULL;
+}
+
+/**
+ * Attach command.
+ *
+ * @returns VBox status code.
+ * @param   pDevIns     The device instance.
+ * @param   iLUN        The logical unit which is being attached.
+ * @param   fFlags      Flags, combination of the PDMDEVATT_FLAGS_* \#defines.
+ *
+ * @remarks This code path is not used during construction.
+ */
+static DECLCALLBACK(int) vblkAttach(PPDMDEVINS pDevIns, unsigned iLUN, uint32_t fFlags)
+{
+    VBLKSTATE *pState = PDMINS_2_DATA(pDevIns, VBLKSTATE*);
+    LogFlow(("%s vblkAttach:\n",  INSTANCE(pState)));
+
+    AssertLogRelReturn(iLUN == 0, VERR_PDM_NO_SUCH_LUN);
+
+    uint64_t cTotalSectorsOld = pState->cTotalSectors;
+    int rc = PDMDevHlpDriverAttach(pDevIns, 0, &pState->VPCI.IBase, &pState->pDrvBase, "Block Port");
+    if (RT_SUCCESS(rc))
+        rc = vblkConfigureLUN(pDevIns, pState);
+    if (RT_FAILURE(rc))
+    {
+        pState->pDrvBase       = NULL;
+        pState->pDrvBlock      = NULL;
+        pState->pDrvBlockBios  = NULL;
+        pState->pDrvBlockAsync = NULL;
+    }
+    else if (pState->cTotalSectors != cTotalSectorsOld)
+    {
+        /* Tell the guest about the new capacity. */
+        vpciRaiseInterrupt(&pState->VPCI, VERR_SEM_BUSY, VPCI_ISR_CONFIG);
+    }
+    return rc;
+}
+
+/**
+ * Destruct a device instance.
+ *
+ * We need to free non-VM resources only.
+ *
+ * @returns VBox status.
+ * @param   pDevIns     The device instance data.
+ * @thread  EMT
+ */
+static DECLCALLBACK(int) vblkDestruct(PPDMDEVINS pDevIns)
+{
+    VBLKSTATE *pState = PDMINS_2_DATA(pDevIns, VBLKSTATE*);
+    PDMDEV_CHECK_VERSIONS_RETURN_QUIET(pDevIns);
+
+    Log(("%s Destroying instance\n", INSTANCE(pState)));
+    if (pState->pElem)
+    {
+        RTMemFree(pState->pElem);
+        pState->pElem = NULL;
+    }
+    return vpciDestruct(&pState->VPCI);
+}
+
+/**
+ * @interface_method_impl{PDMDEVREG,pfnConstruct}
+ */
+static DECLCALLBACK(int) vblkConstruct(PPDMDEVINS pDevIns, int iInstance, PCFGMNODE pCfg)
+{
+    VBLKSTATE *pState = PDMINS_2_DATA(pDevIns, VBLKSTATE*);
+    int        rc;
+    PDMDEV_CHECK_VERSIONS_RETURN(pDevIns);
+
+    /* Initialize PCI part first. */
+    pState->VPCI.IBase.pfnQueryInterface    = vblkQueryInterface;
+    rc = vpciConstruct(pDevIns, &pState->VPCI, iInstance,
+                       VBLK_NAME_FMT, VBLK_PCI_SUBSYSTEM_ID,
+                       VBLK_PCI_CLASS, VBLK_N_QUEUES);
+    if (RT_FAILURE(rc))
+        return rc;
+    pState->pReqQueue = vpciAddQueue(&pState->VPCI, VBLK_QUEUE_SIZE, vblkQueueNotify, "REQ");
+
+    Log(("%s Constructing new instance\n", INSTANCE(pState)));
+
+    /*
+     * Validate configuration.
+     */
+    if (!CFGMR3AreValuesValid(pCfg, "SerialNumber\0"))
+        return PDMDEV_SET_ERROR(pDevIns, VERR_PDM_DEVINS_UNKNOWN_CFG_VALUES,
+                                N_("Invalid configuration for VirtioBlk device"));
+
+    pState->pElem = (PVQUEUEELEM)RTMemAllocZ(sizeof(VQUEUEELEM));
+    if (!pState->pElem)
+        return VERR_NO_MEMORY;
+
+    /* Interfaces */
+    pState->IPort.pfnQueryDeviceLocation         = vblkQueryDeviceLocation;
+    pState->IPortAsync.pfnTransferCompleteNotify = vblkTransferCompleteNotify;
+
+    /* Map our ports to IO space. */
+    rc = PDMDevHlpPCIIORegionRegister(pDevIns, 0,
+                                      VPCI_CONFIG + sizeof(VBlkPCIConfig),
+                                      PCI_ADDRESS_SPACE_IO, vblkMap);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    /* Register save/restore state handlers. */
+    rc = PDMDevHlpSSMRegisterEx(pDevIns, VIRTIO_SAVEDSTATE_VERSION, sizeof(VBLKSTATE), NULL,
+                                NULL, vblkLiveExec, NULL,
+                                NULL, vblkSaveExec, NULL,
+                                NULL, vblkLoadExec, NULL);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    rc = PDMDevHlpDriverAttach(pDevIns, 0, &pState->VPCI.IBase, &pState->pDrvBase, "Block Port");
+    if (RT_SUCCESS(rc))
+    {
+        rc = vblkConfigureLUN(pDevIns, pState);
+        if (RT_FAILURE(rc))
+            return PDMDEV_SET_ERROR(pDevIns, rc, N_("Failed to configure the disk LUN"));
+    }
+    else if (   rc == VERR_PDM_NO_ATTACHED_DRIVER
+             || rc == VERR_PDM_CFG_MISSING_DRIVER_NAME)
+    {
+        /* No error! */
+        Log(("%s No medium attached\n", INSTANCE(pState)));
+        pState->pDrvBase = NULL;
+    }
+    else
+        return PDMDEV_SET_ERROR(pDevIns, rc, N_("Failed to attach the disk LUN"));
+
+    /* Generate a default serial number the same way AHCI does. */
+    char   szSerial[VBLK_ID_BYTES + 1];
+    RTUUID Uuid;
+    if (pState->pDrvBlock)
+        rc = pState->pDrvBlock->pfnGetUuid(pState->pDrvBlock, &Uuid);
+    else
+        RTUuidClear(&Uuid);
+    if (RT_FAILURE(rc) || RTUuidIsNull(&Uuid))
+        RTStrPrintf(szSerial, sizeof(szSerial), "VB%x-1a2b3c4d", iInstance);
+    else
+        RTStrPrintf(szSerial, sizeof(szSerial), "VB%08x-%08x", Uuid.au32[0], Uuid.au32[3]);
+    rc = CFGMR3QueryStringDef(pCfg, "SerialNumber", pState->szSerialNumber, sizeof(pState->szSerialNumber),
+                              szSerial);
+    if (RT_FAILURE(rc))
+    {
+        if (rc == VERR_CFGM_NOT_ENOUGH_SPACE)
+            return PDMDEV_SET_ERROR(pDevIns, VERR_INVALID_PARAMETER,
+                                    N_("VirtioBlk configuration error: \"SerialNumber\" is longer than 20 bytes"));
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("VirtioBlk configuration error: failed to read \"SerialNumber\" as string"));
+    }
+
+    rc = vblkReset(pState);
+    AssertRC(rc);
+
+    PDMDevHlpSTAMRegisterF(pDevIns, &pState->StatReads,              STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,          "Number of read requests",            "/Devices/VBlk%d/Requests/Read", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pState->StatWrites,             STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,          "Number of write requests",           "/Devices/VBlk%d/Requests/Write", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pState->StatFlushes,            STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,          "Number of flush requests",           "/Devices/VBlk%d/Requests/Flush", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pState->StatRequests,           STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,          "Number of requests of any type",     "/Devices/VBlk%d/Requests/Total", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pState->StatCompletedInline,    STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,          "Number of requests completed without going async", "/Devices/VBlk%d/Requests/CompletedInline", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pState->StatNotifies,           STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,     "Number of queue notifications, Requests/Total per notification is the batch size", "/Devices/VBlk%d/Notifies", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pState->StatBytesRead,          STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,          "Amount of data read",                "/Devices/VBlk%d/Bytes/Read", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pState->StatBytesWritten,       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,          "Amount of data written",             "/Devices/VBlk%d/Bytes/Write", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pState->StatReqLatency,         STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_NS_PER_CALL,    "Request latency from submission to completion", "/Devices/VBlk%d/Latency", iInstance);
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * The device registration structure.
+ */
+const PDMDEVREG g_DeviceVirtioBlk =
+{
+    /* Structure version. PDM_DEVREG_VERSION defines the current version. */
+    PDM_DEVREG_VERSION,
+    /* Device name. */
+    "virtio-blk",
+    /* Name of guest context module (no path).
+     * Only evalutated if PDM_DEVREG_FLAGS_RC is set. */
+    "",
+    /* Name of ring-0 module (no path).
+     * Only evalutated if PDM_DEVREG_FLAGS_RC is set. */
+    "",
+    /* The description of the device. The UTF-8 string pointed to shall, like this structure,
+     * remain unchanged from registration till VM destruction. */
+    "Virtio Block Device.\n",
+
+    /* Flags, combination of the PDM_DEVREG_FLAGS_* \#defines. */
+    PDM_DEVREG_FLAGS_DEFAULT_BITS,
+    /* Device class(es), combination of the PDM_DEVREG_CLASS_* \#defines. */
+    PDM_DEVREG_CLASS_STORAGE,
+    /* Maximum number of instances (per VM). */
+    8,
+    /* Size of the instance data. */
+    sizeof(VBLKSTATE),
+
+    /* Construct instance - required. */
+    vblkConstruct,
+    /* Destruct instance - optional. */
+    vblkDestruct,
+    /* Relocation command - optional. */
+    NULL,
+    /* I/O Control interface - optional. */
+    NULL,
+    /* Power on notification - optional. */
+    NULL,
+    /* Reset notification - optional. */
+    NULL,
+    /* Suspend notification  - optional. */
+    vblkSuspend,
+    /* Resume notification - optional. */
+    NULL,
+    /* Attach command - optional. */
+    vblkAttach,
+    /* Detach notification - optional. */
+    vblkDetach,
+    /* Query a LUN base interface - optional. */
+    NULL,
+    /* Init complete notification - optional. */
+    NULL,
+    /* Power off notification - optional. */
+    vblkPowerOff,
+    /* pfnSoftReset */
+    NULL,
+    /* u32VersionEnd */
+    PDM_DEVREG_VERSION
+};
+
+#endif /* IN_RING3 */
+#endif /* VBOX_DEVICE_STRUCT_TESTCASE */
@@ -285,6 +285,24 @@ static DECLCALLBACK(int) drvblockGetUuid(PPDMIBLOCK pInterface, PRTUUID pUuid)
     return VINF_SUCCESS;
 }
 
+
+/** @copydoc PDMIBLOCK::pfnDiscard */
+static DECLCALLBACK(int) drvblockDiscard(PPDMIBLOCK pInterface, PCRTRANGE paRanges, unsigned cRanges)
+{
+    PDRVBLOCK pThis = PDMIBLOCK_2_DRVBLOCK(pInterface);
+
+    /*
+     * Check the state.
+     */
+    if (!pThis->pDrvMedia)
+    {
+        AssertMsgFailed(("Invalid state! Not mounted!\n"));
+        return VERR_PDM_MEDIA_NOT_MOUNTED;
+    }
+
+    return pThis->pDrvMedia->pfnDiscard(pThis->pDrvMedia, paRanges, cRanges);
+}
+
 /* -=-=-=-=- IBlockAsync -=-=-=-=- */
 
 /** Makes a PDRVBLOCK out of a PPDMIBLOCKASYNC. */
@@ -353,6 +371,24 @@ static DECLCALLBACK(int) drvblockAsyncFlushStart(PPDMIBLOCKASYNC pInterface, voi
     return rc;
 }
 
+
+/** @copydoc PDMIBLOCKASYNC::pfnStartDiscard */
+static DECLCALLBACK(int) drvblockAsyncDiscardStart(PPDMIBLOCKASYNC pInterface, PCRTRANGE paRanges, unsigned cRanges, void *pvUser)
+{
+    PDRVBLOCK pThis = PDMIBLOCKASYNC_2_DRVBLOCK(pInterface);
+
+    /*
+     * Check the state.
+     */
+    if (!pThis->pDrvMediaAsync)
+    {
+        AssertMsgFailed(("Invalid state! Not mounted!\n"));
+        return VERR_PDM_MEDIA_NOT_MOUNTED;
+    }
+
+    return pThis->pDrvMediaAsync->pfnStartDiscard(pThis->pDrvMediaAsync, paRanges, cRanges, pvUser);
+}
+
 /* -=-=-=-=- IMediaAsyncPort -=-=-=-=- */
 
 /** Makes a PDRVBLOCKASYNC out of a PPDMIMEDIAASYNCPORT. */
@@ -971,6 +1007,13 @@ static DECLCALLBACK(int) drvblockConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, u
     /* Try to get the optional async interface. */
     pThis->pDrvMediaAsync = PDMIBASE_QUERY_INTERFACE(pBase, PDMIMEDIAASYNC);
 
+    /* Discarding is only offered to the device if the media supports it. */
+    if (pThis->pDrvMedia->pfnDiscard)
+        pThis->IBlock.pfnDiscard = drvblockDiscard;
+    if (   pThis->pDrvMediaAsync
+        && pThis->pDrvMediaAsync->pfnStartDiscard)
+        pThis->IBlockAsync.pfnStartDiscard = drvblockAsyncDiscardStart;
+
     if (RTUuidIsNull(&pThis->Uuid))
     {
         if (pThis->enmType == PDMBLOCKTYPE_HARD_DISK)
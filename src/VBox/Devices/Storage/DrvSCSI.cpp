@@ -138,6 +138,19 @@ static int drvscsiProcessRequestOne(PDRVSCSI pThis, VSCSIIOREQ hVScsiIoReq)
             rc = pThis->pDrvBlock->pfnFlush(pThis->pDrvBlock);
             break;
         }
+        case VSCSIIOREQTXDIR_UNMAP:
+        {
+            PCRTRANGE paRanges = NULL;
+            unsigned  cRanges  = 0;
+
+            rc = VSCSIIoReqUnmapParamsGet(hVScsiIoReq, &paRanges, &cRanges);
+            AssertRC(rc);
+
+            pThis->pLed->Asserted.s.fWriting = pThis->pLed->Actual.s.fWriting = 1;
+            rc = pThis->pDrvBlock->pfnDiscard(pThis->pDrvBlock, paRanges, cRanges);
+            pThis->pLed->Actual.s.fWriting = 0;
+            break;
+        }
         case VSCSIIOREQTXDIR_READ:
         case VSCSIIOREQTXDIR_WRITE:
         {
@@ -208,6 +221,19 @@ static int drvscsiGetSize(VSCSILUN hVScsiLun, void *pvScsiLunUser, uint64_t *pcb
     return VINF_SUCCESS;
 }
 
+static int drvscsiGetFeatureFlags(VSCSILUN hVScsiLun, void *pvScsiLunUser, uint64_t *pfFeatures)
+{
+    PDRVSCSI pThis = (PDRVSCSI)pvScsiLunUser;
+
+    *pfFeatures = 0;
+
+    if (   (pThis->pDrvBlockAsync && pThis->pDrvBlockAsync->pfnStartDiscard)
+        || (!pThis->pDrvBlockAsync && pThis->pDrvBlock->pfnDiscard))
+        *pfFeatures |= VSCSI_LUN_FEATURE_UNMAP;
+
+    return VINF_SUCCESS;
+}
+
 static int drvscsiTransferCompleteNotify(PPDMIBLOCKASYNCPORT pInterface, void *pvUser, int rc)
 {
     PDRVSCSI pThis = PDMIBLOCKASYNCPORT_2_DRVSCSI(pInterface);
@@ -218,7 +244,8 @@ static int drvscsiTransferCompleteNotify(PPDMIBLOCKASYNCPORT pInterface, void *p
 
     if (enmTxDir == VSCSIIOREQTXDIR_READ)
         pThis->pLed->Actual.s.fReading = 0;
-    else if (enmTxDir == VSCSIIOREQTXDIR_WRITE)
+    else if (   enmTxDir == VSCSIIOREQTXDIR_WRITE
+             || enmTxDir == VSCSIIOREQTXDIR_UNMAP)
         pThis->pLed->Actual.s.fWriting = 0;
     else
         AssertMsg(enmTxDir == VSCSIIOREQTXDIR_FLUSH, ("Invalid transfer direction %u\n", enmTxDir));
@@ -228,10 +255,17 @@ static int drvscsiTransferCompleteNotify(PPDMIBLOCKASYNCPORT pInterface, void *p
     else
     {
         pThis->cErrors++;
-        if (   pThis->cErrors < MAX_LOG_REL_ERRORS
-            && enmTxDir == VSCSIIOREQTXDIR_FLUSH)
-            LogRel(("SCSI#%u: Flush returned rc=%Rrc\n",
-                    pThis->pDrvIns->iInstance, rc));
+        if (   enmTxDir == VSCSIIOREQTXDIR_FLUSH
+            || enmTxDir == VSCSIIOREQTXDIR_UNMAP)
+        {
+            if (pThis->cErrors < MAX_LOG_REL_ERRORS)
+                LogRel(("SCSI#%u: %s returned rc=%Rrc\n",
+                        pThis->pDrvIns->iInstance,
+                        enmTxDir == VSCSIIOREQTXDIR_FLUSH
+                        ? "Flush"
+                        : "Unmap",
+                        rc));
+        }
         else
         {
             uint64_t  uOffset    = 0;
@@ -286,6 +320,24 @@ static int drvscsiReqTransferEnqueue(VSCSILUN hVScsiLun,
                             pThis->pDrvIns->iInstance, rc));
                 break;
             }
+            case VSCSIIOREQTXDIR_UNMAP:
+            {
+                PCRTRANGE paRanges = NULL;
+                unsigned  cRanges  = 0;
+
+                rc = VSCSIIoReqUnmapParamsGet(hVScsiIoReq, &paRanges, &cRanges);
+                AssertRC(rc);
+
+                pThis->pLed->Asserted.s.fWriting = pThis->pLed->Actual.s.fWriting = 1;
+                rc = pThis->pDrvBlockAsync->pfnStartDiscard(pThis->pDrvBlockAsync, paRanges, cRanges,
+                                                            hVScsiIoReq);
+                if (   RT_FAILURE(rc)
+                    && rc != VERR_VD_ASYNC_IO_IN_PROGRESS
+                    && pThis->cErrors++ < MAX_LOG_REL_ERRORS)
+                    LogRel(("SCSI#%u: Unmap returned rc=%Rrc\n",
+                            pThis->pDrvIns->iInstance, rc));
+                break;
+            }
             case VSCSIIOREQTXDIR_READ:
             case VSCSIIOREQTXDIR_WRITE:
             {
@@ -336,7 +388,8 @@ static int drvscsiReqTransferEnqueue(VSCSILUN hVScsiLun,
         {
             if (enmTxDir == VSCSIIOREQTXDIR_READ)
                 pThis->pLed->Actual.s.fReading = 0;
-            else if (enmTxDir == VSCSIIOREQTXDIR_WRITE)
+            else if (   enmTxDir == VSCSIIOREQTXDIR_WRITE
+                     || enmTxDir == VSCSIIOREQTXDIR_UNMAP)
                 pThis->pLed->Actual.s.fWriting = 0;
             else
                 AssertMsg(enmTxDir == VSCSIIOREQTXDIR_FLUSH, ("Invalid transfer direction %u\n", enmTxDir));
@@ -350,7 +403,8 @@ static int drvscsiReqTransferEnqueue(VSCSILUN hVScsiLun,
         {
             if (enmTxDir == VSCSIIOREQTXDIR_READ)
                 pThis->pLed->Actual.s.fReading = 0;
-            else if (enmTxDir == VSCSIIOREQTXDIR_WRITE)
+            else if (   enmTxDir == VSCSIIOREQTXDIR_WRITE
+                     || enmTxDir == VSCSIIOREQTXDIR_UNMAP)
                 pThis->pLed->Actual.s.fWriting = 0;
             else
                 AssertMsg(enmTxDir == VSCSIIOREQTXDIR_FLUSH, ("Invalid transfer direction %u\n", enmTxDir));
@@ -802,6 +856,7 @@ static DECLCALLBACK(int) drvscsiConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, ui
     /* Create VSCSI device and LUN. */
     pThis->VScsiIoCallbacks.pfnVScsiLunMediumGetSize      = drvscsiGetSize;
     pThis->VScsiIoCallbacks.pfnVScsiLunReqTransferEnqueue = drvscsiReqTransferEnqueue;
+    pThis->VScsiIoCallbacks.pfnVScsiLunGetFeatureFlags    = drvscsiGetFeatureFlags;
 
     rc = VSCSIDeviceCreate(&pThis->hVScsiDevice, drvscsiVScsiReqCompleted, pThis);
     AssertMsgReturn(RT_SUCCESS(rc), ("Failed to create VSCSI device rc=%Rrc\n"), rc);
@@ -197,6 +197,10 @@ typedef struct VBOXDISK
     VDINTERFACE         VDIIOCache;
     /** Interface list for the cache image. */
     PVDINTERFACE        pVDIfsCache;
+    /** Flag whether the cache statistics are registered. */
+    bool                fCacheStats;
+    /** Statistics of the cache image. */
+    VDCACHESTATS        CacheStats;
 
     /** The block cache handle if configured. */
     PPDMBLKCACHE        pBlkCache;
@@ -1535,6 +1539,24 @@ static DECLCALLBACK(int) drvvdFlush(PPDMIMEDIA pInterface)
     return rc;
 }
 
+/** @copydoc PDMIMEDIA::pfnDiscard */
+static DECLCALLBACK(int) drvvdDiscard(PPDMIMEDIA pInterface, PCRTRANGE paRanges, unsigned cRanges)
+{
+    LogFlowFunc(("paRanges=%#p cRanges=%u\n", paRanges, cRanges));
+    PVBOXDISK pThis = PDMIMEDIA_2_VBOXDISK(pInterface);
+
+    /* Invalidate any buffer if boot acceleration is enabled. */
+    if (pThis->fBootAccelActive)
+    {
+        pThis->cbDataValid = 0;
+        pThis->offDisk     = 0;
+    }
+
+    int rc = VDDiscardRanges(pThis->pDisk, paRanges, cRanges);
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
 /** @copydoc PDMIMEDIA::pfnMerge */
 static DECLCALLBACK(int) drvvdMerge(PPDMIMEDIA pInterface,
                                     PFNSIMPLEPROGRESS pfnProgress,
@@ -1784,6 +1806,22 @@ static DECLCALLBACK(int) drvvdStartFlush(PPDMIMEDIAASYNC pInterface, void *pvUse
     return rc;
 }
 
+static DECLCALLBACK(int) drvvdStartDiscard(PPDMIMEDIAASYNC pInterface, PCRTRANGE paRanges,
+                                           unsigned cRanges, void *pvUser)
+{
+    LogFlowFunc(("paRanges=%#p cRanges=%u pvUser=%#p\n", paRanges, cRanges, pvUser));
+    PVBOXDISK pThis = PDMIMEDIAASYNC_2_VBOXDISK(pInterface);
+
+    pThis->fBootAccelActive = false;
+
+    /* Not offered with the block cache, see drvvdConstruct. */
+    Assert(!pThis->pBlkCache);
+    int rc = VDAsyncDiscardRanges(pThis->pDisk, paRanges, cRanges,
+                                  drvvdAsyncReqComplete, pThis, pvUser);
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
 /** @copydoc FNPDMBLKCACHEXFERCOMPLETEDRV */
 static void drvvdBlkCacheXferComplete(PPDMDRVINS pDrvIns, void *pvUser, int rcReq)
 {
@@ -2016,6 +2054,17 @@ static DECLCALLBACK(void) drvvdDestruct(PPDMDRVINS pDrvIns)
     }
     drvvdFreeImages(pThis);
 
+    if (pThis->fCacheStats)
+    {
+        PDMDrvHlpSTAMDeregister(pDrvIns, (void *)&pThis->CacheStats.cReadHits);
+        PDMDrvHlpSTAMDeregister(pDrvIns, (void *)&pThis->CacheStats.cReadMisses);
+        PDMDrvHlpSTAMDeregister(pDrvIns, (void *)&pThis->CacheStats.cbReadHit);
+        PDMDrvHlpSTAMDeregister(pDrvIns, (void *)&pThis->CacheStats.cbReadMiss);
+        PDMDrvHlpSTAMDeregister(pDrvIns, (void *)&pThis->CacheStats.cbWriteBackDeferred);
+        PDMDrvHlpSTAMDeregister(pDrvIns, (void *)&pThis->CacheStats.cbWrittenBack);
+        pThis->fCacheStats = false;
+    }
+
     if (pThis->MergeLock != NIL_RTSEMRW)
     {
         int rc = RTSemRWDestroy(pThis->MergeLock);
@@ -2047,9 +2096,13 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns,
     char *pszFormat = NULL;      /**< The format backed to use for this image. */
     char *pszCachePath = NULL;   /**< The path to the cache image. */
     char *pszCacheFormat = NULL; /**< The format backend to use for the cache image. */
+    uint64_t cbCache = 0;        /**< Size of the cache image to create if it doesn't exist. */
+    bool fCacheWriteBack = false; /**< Whether to use the cache image in write-back mode. */
     bool fReadOnly;              /**< True if the media is read-only. */
     bool fMaybeReadOnly;         /**< True if the media may or may not be read-only. */
     bool fHonorZeroWrites;       /**< True if zero blocks should be written. */
+    bool fSkipZeroWrites;        /**< True if zero writes to unallocated blocks should be skipped. */
+    bool fDiscard = false;       /**< True if the guest may discard blocks. */
     PDMDRV_CHECK_VERSIONS_RETURN(pDrvIns);
 
     /*
@@ -2122,6 +2175,9 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns,
     bool        fHostIP = false;
     bool        fUseNewIo = false;
     bool        fUseBlockCache = false;
+    uint32_t    cbBlkCacheMin = 0;
+    uint32_t    cbBlkCacheMax = 0;
+    bool        fChainIdx = false;
     unsigned    iLevel = 0;
     PCFGMNODE   pCurNode = pCfg;
     VDTYPE      enmType = VDTYPE_HDD;
@@ -2136,10 +2192,10 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns,
              * open flags. Some might be converted to per-image flags later. */
             fValid = CFGMR3AreValuesValid(pCurNode,
                                           "Format\0Path\0"
-                                          "ReadOnly\0MaybeReadOnly\0TempReadOnly\0Shareable\0HonorZeroWrites\0"
+                                          "ReadOnly\0MaybeReadOnly\0TempReadOnly\0Shareable\0HonorZeroWrites\0SkipZeroWrites\0"
                                           "HostIPStack\0UseNewIo\0BootAcceleration\0BootAccelerationBuffer\0"
-                                          "SetupMerge\0MergeSource\0MergeTarget\0BwGroup\0Type\0BlockCache\0"
-                                          "CachePath\0CacheFormat\0");
+                                          "SetupMerge\0MergeSource\0MergeTarget\0BwGroup\0Type\0BlockCache\0BlockCacheMinSize\0BlockCacheMaxSize\0"
+                                          "CachePath\0CacheFormat\0CacheSize\0CacheWriteBack\0ChainIndex\0Discard\0");
         }
         else
         {
@@ -2173,6 +2229,14 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns,
                 break;
             }
 
+            rc = CFGMR3QueryBoolDef(pCurNode, "SkipZeroWrites", &fSkipZeroWrites, false);
+            if (RT_FAILURE(rc))
+            {
+                rc = PDMDRV_SET_ERROR(pDrvIns, rc,
+                                      N_("DrvVD: Configuration error: Querying \"SkipZeroWrites\" as boolean failed"));
+                break;
+            }
+
             rc = CFGMR3QueryBoolDef(pCurNode, "ReadOnly", &fReadOnly, false);
             if (RT_FAILURE(rc))
             {
@@ -2252,6 +2316,34 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns,
                                       N_("DrvVD: Configuration error: Querying \"BlockCache\" as boolean failed"));
                 break;
             }
+            rc = CFGMR3QueryU32Def(pCurNode, "BlockCacheMinSize", &cbBlkCacheMin, 0);
+            if (RT_FAILURE(rc))
+            {
+                rc = PDMDRV_SET_ERROR(pDrvIns, rc,
+                                      N_("DrvVD: Configuration error: Querying \"BlockCacheMinSize\" as integer failed"));
+                break;
+            }
+            rc = CFGMR3QueryU32Def(pCurNode, "BlockCacheMaxSize", &cbBlkCacheMax, 0);
+            if (RT_FAILURE(rc))
+            {
+                rc = PDMDRV_SET_ERROR(pDrvIns, rc,
+                                      N_("DrvVD: Configuration error: Querying \"BlockCacheMaxSize\" as integer failed"));
+                break;
+            }
+            rc = CFGMR3QueryBoolDef(pCurNode, "ChainIndex", &fChainIdx, false);
+            if (RT_FAILURE(rc))
+            {
+                rc = PDMDRV_SET_ERROR(pDrvIns, rc,
+                                      N_("DrvVD: Configuration error: Querying \"ChainIndex\" as boolean failed"));
+                break;
+            }
+            rc = CFGMR3QueryBoolDef(pCurNode, "Discard", &fDiscard, false);
+            if (RT_FAILURE(rc))
+            {
+                rc = PDMDRV_SET_ERROR(pDrvIns, rc,
+                                      N_("DrvVD: Configuration error: Querying \"Discard\" as boolean failed"));
+                break;
+            }
             rc = CFGMR3QueryStringAlloc(pCurNode, "BwGroup", &pThis->pszBwGroup);
             if (RT_FAILURE(rc) && rc != VERR_CFGM_VALUE_NOT_FOUND)
             {
@@ -2303,6 +2395,22 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns,
                                           N_("DrvVD: Configuration error: Querying \"CacheFormat\" as string failed"));
                     break;
                 }
+
+                rc = CFGMR3QueryU64Def(pCurNode, "CacheSize", &cbCache, 0);
+                if (RT_FAILURE(rc))
+                {
+                    rc = PDMDRV_SET_ERROR(pDrvIns, rc,
+                                          N_("DrvVD: Configuration error: Querying \"CacheSize\" as integer failed"));
+                    break;
+                }
+
+                rc = CFGMR3QueryBoolDef(pCurNode, "CacheWriteBack", &fCacheWriteBack, false);
+                if (RT_FAILURE(rc))
+                {
+                    rc = PDMDRV_SET_ERROR(pDrvIns, rc,
+                                          N_("DrvVD: Configuration error: Querying \"CacheWriteBack\" as boolean failed"));
+                    break;
+                }
             }
         }
 
@@ -2455,6 +2563,9 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns,
             rc = VDCreate(pThis->pVDIfsDisk, enmType, &pThis->pDisk);
             /* Error message is already set correctly. */
         }
+
+        if (RT_SUCCESS(rc) && fChainIdx)
+            rc = VDSetChainIndex(pThis->pDisk, true);
     }
 
     if (pThis->pDrvMediaAsyncPort && fUseNewIo)
@@ -2565,10 +2676,14 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns,
             uOpenFlags = VD_OPEN_FLAGS_NORMAL;
         if (fHonorZeroWrites)
             uOpenFlags |= VD_OPEN_FLAGS_HONOR_ZEROES;
+        else if (fSkipZeroWrites)
+            uOpenFlags |= VD_OPEN_FLAGS_SKIP_ZEROES;
         if (pThis->fAsyncIOSupported)
             uOpenFlags |= VD_OPEN_FLAGS_ASYNC_IO;
         if (pThis->fShareable)
             uOpenFlags |= VD_OPEN_FLAGS_SHAREABLE;
+        if (fDiscard && iLevel == 0)
+            uOpenFlags |= VD_OPEN_FLAGS_DISCARD;
 
         /* Try to open backend in async I/O mode first. */
         rc = VDOpen(pThis->pDisk, pszFormat, pszName, uOpenFlags, pImage->pVDIfsImage);
@@ -2631,9 +2746,57 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns,
             AssertRC(rc);
         }
 
-        rc = VDCacheOpen(pThis->pDisk, pszCacheFormat, pszCachePath, VD_OPEN_FLAGS_NORMAL, pThis->pVDIfsCache);
-        if (RT_FAILURE(rc))
-            rc = PDMDRV_SET_ERROR(pDrvIns, rc, N_("DrvVD: Could not open cache image"));
+        unsigned uCacheOpenFlags = VD_OPEN_FLAGS_NORMAL;
+
+        /* Data held back by a write-back cache is only visible to the
+         * synchronous I/O path. */
+        if (fCacheWriteBack)
+        {
+            if (fUseNewIo || fUseBlockCache)
+                rc = PDMDRV_SET_ERROR(pDrvIns, VERR_PDM_DRIVER_INVALID_PROPERTIES,
+                                      N_("DrvVD: Configuration error: The cache can't be used in write-back mode with asynchronous I/O"));
+            else
+                uCacheOpenFlags |= VD_OPEN_FLAGS_CACHE_WRITEBACK;
+        }
+
+        if (RT_SUCCESS(rc))
+        {
+            if (   cbCache
+                && !RTFileExists(pszCachePath))
+                rc = VDCreateCache(pThis->pDisk, pszCacheFormat, pszCachePath, cbCache,
+                                   VD_IMAGE_FLAGS_NONE, NULL, NULL, uCacheOpenFlags,
+                                   pThis->pVDIfsCache, NULL);
+            else
+                rc = VDCacheOpen(pThis->pDisk, pszCacheFormat, pszCachePath, uCacheOpenFlags, pThis->pVDIfsCache);
+            if (RT_FAILURE(rc))
+                rc = PDMDRV_SET_ERROR(pDrvIns, rc, N_("DrvVD: Could not open cache image"));
+        }
+
+        if (RT_SUCCESS(rc))
+        {
+            PDMDrvHlpSTAMRegisterF(pDrvIns, (void *)&pThis->CacheStats.cReadHits, STAMTYPE_U64, STAMVISIBILITY_ALWAYS,
+                                   STAMUNIT_OCCURENCES, "Number of reads served from the cache image.",
+                                   "/Devices/VD%d/Cache/ReadHits", pDrvIns->iInstance);
+            PDMDrvHlpSTAMRegisterF(pDrvIns, (void *)&pThis->CacheStats.cReadMisses, STAMTYPE_U64, STAMVISIBILITY_ALWAYS,
+                                   STAMUNIT_OCCURENCES, "Number of reads which went to the image.",
+                                   "/Devices/VD%d/Cache/ReadMisses", pDrvIns->iInstance);
+            PDMDrvHlpSTAMRegisterF(pDrvIns, (void *)&pThis->CacheStats.cbReadHit, STAMTYPE_U64, STAMVISIBILITY_ALWAYS,
+                                   STAMUNIT_BYTES, "Amount of data read from the cache image.",
+                                   "/Devices/VD%d/Cache/ReadHitBytes", pDrvIns->iInstance);
+            PDMDrvHlpSTAMRegisterF(pDrvIns, (void *)&pThis->CacheStats.cbReadMiss, STAMTYPE_U64, STAMVISIBILITY_ALWAYS,
+                                   STAMUNIT_BYTES, "Amount of data read from the image.",
+                                   "/Devices/VD%d/Cache/ReadMissBytes", pDrvIns->iInstance);
+            PDMDrvHlpSTAMRegisterF(pDrvIns, (void *)&pThis->CacheStats.cbWriteBackDeferred, STAMTYPE_U64, STAMVISIBILITY_ALWAYS,
+                                   STAMUNIT_BYTES, "Amount of data written to the cache image only.",
+                                   "/Devices/VD%d/Cache/WriteBackDeferredBytes", pDrvIns->iInstance);
+            PDMDrvHlpSTAMRegisterF(pDrvIns, (void *)&pThis->CacheStats.cbWrittenBack, STAMTYPE_U64, STAMVISIBILITY_ALWAYS,
+                                   STAMUNIT_BYTES, "Amount of data written back from the cache image.",
+                                   "/Devices/VD%d/Cache/WrittenBackBytes", pDrvIns->iInstance);
+            pThis->fCacheStats = true;
+
+            rc = VDCacheSetStatistics(pThis->pDisk, &pThis->CacheStats);
+            AssertRC(rc);
+        }
     }
 
     if (VALID_PTR(pszCachePath))
@@ -2691,6 +2854,26 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns,
                 else
                     AssertRC(rc);
 
+                /* Keep the share of this disk in the cache within the configured bounds. */
+                if (   RT_SUCCESS(rc)
+                    && pThis->pBlkCache
+                    && (cbBlkCacheMin || cbBlkCacheMax))
+                {
+                    rc = PDMR3BlkCacheSetQuota(pThis->pBlkCache, cbBlkCacheMin,
+                                               cbBlkCacheMax ? cbBlkCacheMax : UINT32_MAX);
+                    if (RT_FAILURE(rc))
+                        rc = PDMDRV_SET_ERROR(pDrvIns, rc,
+                                              N_("DrvVD: Configuration error: Invalid block cache quota"));
+                }
+
+                /* Enables read-ahead. */
+                if (   RT_SUCCESS(rc)
+                    && pThis->pBlkCache)
+                {
+                    rc = PDMR3BlkCacheSetMediumSize(pThis->pBlkCache, VDGetSize(pThis->pDisk, VD_LAST_IMAGE));
+                    AssertRC(rc);
+                }
+
                 RTStrFree(pszId);
             }
             else
@@ -2709,6 +2892,31 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns,
                                     NULL /*pfnSavePrep*/, NULL /*pfnSaveExec*/, NULL /*pfnSaveDone*/,
                                     NULL /*pfnDonePrep*/, NULL /*pfnLoadExec*/, drvvdLoadDone);
 
+    /* Offer discarding to the device if the image format supports it. The
+     * block cache doesn't know about discarded ranges, so the async path is
+     * only available without it. */
+    if (   RT_SUCCESS(rc)
+        && fDiscard
+        && !VDIsReadOnly(pThis->pDisk))
+    {
+        VDBACKENDINFO BackendInfo;
+
+        rc = VDBackendInfoSingle(pThis->pDisk, VD_LAST_IMAGE, &BackendInfo);
+        if (   RT_SUCCESS(rc)
+            && (BackendInfo.uBackendCaps & VD_CAP_DISCARD))
+        {
+            pThis->IMedia.pfnDiscard = drvvdDiscard;
+            if (!pThis->pBlkCache)
+                pThis->IMediaAsync.pfnStartDiscard = drvvdStartDiscard;
+            LogRel(("VD: Discarding blocks is enabled\n"));
+        }
+        else
+        {
+            LogRel(("VD: The image format doesn't support discarding blocks\n"));
+            rc = VINF_SUCCESS;
+        }
+    }
+
     /* Setup the boot acceleration stuff if enabled. */
     if (RT_SUCCESS(rc) && pThis->fBootAccelEnabled)
     {
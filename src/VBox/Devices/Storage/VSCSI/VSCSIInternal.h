@@ -138,6 +138,10 @@ typedef struct VSCSIIOREQINT
     unsigned            cSeg;
     /** Segment array. */
     PCRTSGSEG           paSeg;
+    /** Ranges to unmap, owned by the I/O request. */
+    PRTRANGE            paRanges;
+    /** Number of ranges to unmap. */
+    unsigned            cRanges;
 } VSCSIIOREQINT;
 
 /**
@@ -280,6 +284,19 @@ int vscsiIoReqTransferEnqueue(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq,
                               VSCSIIOREQTXDIR enmTxDir, uint64_t uOffset,
                               size_t cbTransfer);
 
+/**
+ * Enqueue a new unmap request.
+ *
+ * @returns VBox status code.
+ * @param   pVScsiLun   The LUN instance which issued the request.
+ * @param   pVScsiReq   The virtual SCSI request associated with the unmap.
+ * @param   paRanges    The ranges to unmap. The I/O request takes ownership
+ *                      of the array and frees it on completion or failure.
+ * @param   cRanges     Number of ranges in the array.
+ */
+int vscsiIoReqUnmapEnqueue(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq,
+                           PRTRANGE paRanges, unsigned cRanges);
+
 /**
  * Returns the current number of outstanding tasks on the given LUN.
  *
@@ -295,6 +312,19 @@ DECLINLINE(int) vscsiLunMediumGetSize(PVSCSILUNINT pVScsiLun, uint64_t *pcbSize)
                                                                      pcbSize);
 }
 
+DECLINLINE(int) vscsiLunGetFeatureFlags(PVSCSILUNINT pVScsiLun, uint64_t *pfFeatures)
+{
+    if (!pVScsiLun->pVScsiLunIoCallbacks->pfnVScsiLunGetFeatureFlags)
+    {
+        *pfFeatures = 0;
+        return VINF_SUCCESS;
+    }
+
+    return pVScsiLun->pVScsiLunIoCallbacks->pfnVScsiLunGetFeatureFlags(pVScsiLun,
+                                                                       pVScsiLun->pvVScsiLunUser,
+                                                                       pfFeatures);
+}
+
 DECLINLINE(int) vscsiLunReqTransferEnqueue(PVSCSILUNINT pVScsiLun, PVSCSIIOREQINT pVScsiIoReq)
 {
     return pVScsiLun->pVScsiLunIoCallbacks->pfnVScsiLunReqTransferEnqueue(pVScsiLun,
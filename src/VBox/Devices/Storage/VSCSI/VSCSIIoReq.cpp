@@ -86,6 +86,42 @@ int vscsiIoReqTransferEnqueue(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq,
 }
 
 
+int vscsiIoReqUnmapEnqueue(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq,
+                           PRTRANGE paRanges, unsigned cRanges)
+{
+    int rc = VINF_SUCCESS;
+    PVSCSIIOREQINT pVScsiIoReq = NULL;
+
+    LogFlowFunc(("pVScsiLun=%#p pVScsiReq=%#p paRanges=%#p cRanges=%u\n",
+                 pVScsiLun, pVScsiReq, paRanges, cRanges));
+
+    pVScsiIoReq = (PVSCSIIOREQINT)RTMemAllocZ(sizeof(VSCSIIOREQINT));
+    if (!pVScsiIoReq)
+    {
+        RTMemFree(paRanges);
+        return VERR_NO_MEMORY;
+    }
+
+    pVScsiIoReq->pVScsiReq = pVScsiReq;
+    pVScsiIoReq->pVScsiLun = pVScsiLun;
+    pVScsiIoReq->enmTxDir  = VSCSIIOREQTXDIR_UNMAP;
+    pVScsiIoReq->paRanges  = paRanges;
+    pVScsiIoReq->cRanges   = cRanges;
+
+    ASMAtomicIncU32(&pVScsiLun->IoReq.cReqOutstanding);
+
+    rc = vscsiLunReqTransferEnqueue(pVScsiLun, pVScsiIoReq);
+    if (RT_FAILURE(rc))
+    {
+        ASMAtomicDecU32(&pVScsiLun->IoReq.cReqOutstanding);
+        RTMemFree(pVScsiIoReq->paRanges);
+        RTMemFree(pVScsiIoReq);
+    }
+
+    return rc;
+}
+
+
 uint32_t vscsiIoReqOutstandingCountGet(PVSCSILUNINT pVScsiLun)
 {
     return ASMAtomicReadU32(&pVScsiLun->IoReq.cReqOutstanding);
@@ -127,6 +163,8 @@ VBOXDDU_DECL(int) VSCSIIoReqCompleted(VSCSIIOREQ hVScsiIoReq, int rcIoReq, bool
         rcReq = SCSI_STATUS_CHECK_CONDITION;
 
     /* Free the I/O request */
+    if (pVScsiIoReq->paRanges)
+        RTMemFree(pVScsiIoReq->paRanges);
     RTMemFree(pVScsiIoReq);
 
     /* Notify completion of the SCSI request. */
@@ -153,7 +191,9 @@ VBOXDDU_DECL(int) VSCSIIoReqParamsGet(VSCSIIOREQ hVScsiIoReq, uint64_t *puOffset
     PVSCSIIOREQINT pVScsiIoReq = hVScsiIoReq;
 
     AssertPtrReturn(pVScsiIoReq, VERR_INVALID_HANDLE);
-    AssertReturn(pVScsiIoReq->enmTxDir != VSCSIIOREQTXDIR_FLUSH, VERR_NOT_SUPPORTED);
+    AssertReturn(   pVScsiIoReq->enmTxDir != VSCSIIOREQTXDIR_FLUSH
+                 && pVScsiIoReq->enmTxDir != VSCSIIOREQTXDIR_UNMAP,
+                 VERR_NOT_SUPPORTED);
 
     *puOffset    = pVScsiIoReq->uOffset;
     *pcbTransfer = pVScsiIoReq->cbTransfer;
@@ -164,3 +204,18 @@ VBOXDDU_DECL(int) VSCSIIoReqParamsGet(VSCSIIOREQ hVScsiIoReq, uint64_t *puOffset
     return VINF_SUCCESS;
 }
 
+
+VBOXDDU_DECL(int) VSCSIIoReqUnmapParamsGet(VSCSIIOREQ hVScsiIoReq, PCRTRANGE *ppaRanges,
+                                           unsigned *pcRanges)
+{
+    PVSCSIIOREQINT pVScsiIoReq = hVScsiIoReq;
+
+    AssertPtrReturn(pVScsiIoReq, VERR_INVALID_HANDLE);
+    AssertReturn(pVScsiIoReq->enmTxDir == VSCSIIOREQTXDIR_UNMAP, VERR_NOT_SUPPORTED);
+
+    *ppaRanges = pVScsiIoReq->paRanges;
+    *pcRanges  = pVScsiIoReq->cRanges;
+
+    return VINF_SUCCESS;
+}
+
@@ -29,6 +29,12 @@
 
 #include "VSCSIInternal.h"
 
+/** Maximum number of block descriptors accepted in one UNMAP command. */
+#define VSCSI_LUN_SBC_UNMAP_DESC_MAX 256
+/** Maximum number of sectors in one UNMAP block descriptor, the range size
+ * must fit into a size_t on 32-bit hosts. */
+#define VSCSI_LUN_SBC_UNMAP_LBA_MAX  ((uint32_t)RT_MIN(UINT32_MAX, ~(size_t)0 / 512))
+
 /**
  * SBC LUN instance
  */
@@ -38,6 +44,8 @@ typedef struct VSCSILUNSBC
     VSCSILUNINT    Core;
     /** Size of the virtual disk. */
     uint64_t       cSectors;
+    /** Features of the medium, VSCSI_LUN_FEATURE_*. */
+    uint64_t       fFeatures;
 } VSCSILUNSBC;
 /** Pointer to a SBC LUN instance */
 typedef VSCSILUNSBC *PVSCSILUNSBC;
@@ -50,7 +58,10 @@ static int vscsiLunSbcInit(PVSCSILUNINT pVScsiLun)
 
     rc = vscsiLunMediumGetSize(pVScsiLun, &cbDisk);
     if (RT_SUCCESS(rc))
+    {
         pVScsiLunSbc->cSectors = cbDisk / 512; /* Fixed sector size */
+        rc = vscsiLunGetFeatureFlags(pVScsiLun, &pVScsiLunSbc->fFeatures);
+    }
 
     return rc;
 }
@@ -62,6 +73,160 @@ static int vscsiLunSbcDestroy(PVSCSILUNINT pVScsiLun)
     return VINF_SUCCESS;
 }
 
+/**
+ * Returns the vital product data page requested by the guest.
+ *
+ * @returns SCSI status code.
+ * @param   pVScsiLunSbc    The SBC LUN instance.
+ * @param   pVScsiReq       The INQUIRY request with the EVPD bit set.
+ */
+static int vscsiLunSbcInquiryVpd(PVSCSILUNSBC pVScsiLunSbc, PVSCSIREQINT pVScsiReq)
+{
+    bool fUnmap = RT_BOOL(pVScsiLunSbc->fFeatures & VSCSI_LUN_FEATURE_UNMAP);
+    uint8_t aReply[64];
+    size_t cbReply = 0;
+
+    memset(aReply, 0, sizeof(aReply));
+    aReply[0] = SCSI_INQUIRY_DATA_PERIPHERAL_DEVICE_TYPE_DIRECT_ACCESS;
+    aReply[1] = pVScsiReq->pbCDB[2];
+
+    switch (pVScsiReq->pbCDB[2])
+    {
+        case 0x00: /* Supported VPD pages */
+        {
+            unsigned cPages = 0;
+
+            aReply[4 + cPages++] = 0x00;
+            if (fUnmap)
+            {
+                aReply[4 + cPages++] = 0xb0;
+                aReply[4 + cPages++] = 0xb2;
+            }
+            vscsiH2BEU16(&aReply[2], cPages);
+            cbReply = 4 + cPages;
+            break;
+        }
+        case 0xb0: /* Block limits */
+        {
+            if (!fUnmap)
+                break;
+
+            vscsiH2BEU16(&aReply[2], 0x3c);
+            vscsiH2BEU32(&aReply[20], VSCSI_LUN_SBC_UNMAP_LBA_MAX);      /* Maximum unmap LBA count */
+            vscsiH2BEU32(&aReply[24], VSCSI_LUN_SBC_UNMAP_DESC_MAX);     /* Maximum unmap block descriptor count */
+            cbReply = 4 + 0x3c;
+            break;
+        }
+        case 0xb2: /* Logical block provisioning */
+        {
+            if (!fUnmap)
+                break;
+
+            vscsiH2BEU16(&aReply[2], 4);
+            aReply[5] = RT_BIT(7); /* LBPU: UNMAP supported */
+            aReply[6] = 0x02;      /* Thin provisioned */
+            cbReply = 4 + 4;
+            break;
+        }
+        default:
+            break;
+    }
+
+    if (!cbReply)
+        return vscsiReqSenseErrorSet(pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INV_FIELD_IN_CMD_PACKET);
+
+    vscsiCopyToIoMemCtx(&pVScsiReq->IoMemCtx, aReply, cbReply);
+    return vscsiReqSenseOkSet(pVScsiReq);
+}
+
+/**
+ * Parses the parameter list of an UNMAP command into a range array.
+ *
+ * @returns SCSI status code, SCSI_STATUS_OK without setting any sense data
+ *          if the list could be parsed.
+ * @param   pVScsiLunSbc    The SBC LUN instance.
+ * @param   pVScsiReq       The UNMAP request.
+ * @param   ppaRanges       Where to store the range array on success,
+ *                          NULL if there is nothing to unmap.
+ * @param   pcRanges        Where to store the number of ranges.
+ */
+static int vscsiLunSbcUnmapRangesGet(PVSCSILUNSBC pVScsiLunSbc, PVSCSIREQINT pVScsiReq,
+                                     PRTRANGE *ppaRanges, unsigned *pcRanges)
+{
+    uint16_t cbList = vscsiBE2HU16(&pVScsiReq->pbCDB[7]);
+    uint8_t abHdr[8];
+    unsigned cBlkDesc;
+    PRTRANGE paRanges;
+    unsigned cRanges = 0;
+
+    *ppaRanges = NULL;
+    *pcRanges  = 0;
+
+    /* A parameter list length of zero is not an error. */
+    if (cbList < sizeof(abHdr))
+        return SCSI_STATUS_OK;
+
+    if (vscsiCopyFromIoMemCtx(&pVScsiReq->IoMemCtx, abHdr, sizeof(abHdr)) != sizeof(abHdr))
+        return vscsiReqSenseErrorSet(pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INV_FIELD_IN_PARAM_LIST);
+
+    cBlkDesc = RT_MIN(vscsiBE2HU16(&abHdr[2]), cbList - sizeof(abHdr)) / 16;
+    if (!cBlkDesc)
+        return SCSI_STATUS_OK;
+    if (cBlkDesc > VSCSI_LUN_SBC_UNMAP_DESC_MAX)
+        return vscsiReqSenseErrorSet(pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INV_FIELD_IN_PARAM_LIST);
+
+    paRanges = (PRTRANGE)RTMemAllocZ(cBlkDesc * sizeof(RTRANGE));
+    if (!paRanges)
+        return vscsiReqSenseErrorSet(pVScsiReq, SCSI_SENSE_HARDWARE_ERROR, SCSI_ASC_NONE);
+
+    for (unsigned i = 0; i < cBlkDesc; i++)
+    {
+        uint8_t abDesc[16];
+        uint64_t uLbaStart;
+        uint32_t cSectors;
+
+        if (vscsiCopyFromIoMemCtx(&pVScsiReq->IoMemCtx, abDesc, sizeof(abDesc)) != sizeof(abDesc))
+        {
+            RTMemFree(paRanges);
+            return vscsiReqSenseErrorSet(pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INV_FIELD_IN_PARAM_LIST);
+        }
+
+        uLbaStart = vscsiBE2HU64(&abDesc[0]);
+        cSectors  = vscsiBE2HU32(&abDesc[8]);
+        if (!cSectors)
+            continue;
+
+        if (   uLbaStart >= pVScsiLunSbc->cSectors
+            || cSectors > pVScsiLunSbc->cSectors - uLbaStart)
+        {
+            RTMemFree(paRanges);
+            return vscsiReqSenseErrorSet(pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_LOGICAL_BLOCK_OOR);
+        }
+
+        uint64_t cbRange = (uint64_t)cSectors * 512;
+        if (cbRange > ~(size_t)0)
+        {
+            /* More than the maximum unmap LBA count we report. */
+            RTMemFree(paRanges);
+            return vscsiReqSenseErrorSet(pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INV_FIELD_IN_PARAM_LIST);
+        }
+
+        paRanges[cRanges].offStart = uLbaStart * 512;
+        paRanges[cRanges].cbRange  = (size_t)cbRange;
+        cRanges++;
+    }
+
+    if (!cRanges)
+    {
+        RTMemFree(paRanges);
+        return SCSI_STATUS_OK;
+    }
+
+    *ppaRanges = paRanges;
+    *pcRanges  = cRanges;
+    return SCSI_STATUS_OK;
+}
+
 static int vscsiLunSbcReqProcess(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq)
 {
     PVSCSILUNSBC pVScsiLunSbc = (PVSCSILUNSBC)pVScsiLun;
@@ -70,6 +235,8 @@ static int vscsiLunSbcReqProcess(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq)
     uint64_t uLbaStart = 0;
     uint32_t cSectorTransfer = 0;
     VSCSIIOREQTXDIR enmTxDir = VSCSIIOREQTXDIR_INVALID;
+    PRTRANGE paRanges = NULL;
+    unsigned cRanges = 0;
 
     switch(pVScsiReq->pbCDB[0])
     {
@@ -77,6 +244,13 @@ static int vscsiLunSbcReqProcess(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq)
         {
             SCSIINQUIRYDATA ScsiInquiryReply;
 
+            /* Vital product data requested? */
+            if (pVScsiReq->pbCDB[1] & 0x01)
+            {
+                rcReq = vscsiLunSbcInquiryVpd(pVScsiLunSbc, pVScsiReq);
+                break;
+            }
+
             memset(&ScsiInquiryReply, 0, sizeof(ScsiInquiryReply));
 
             ScsiInquiryReply.cbAdditional           = 31;
@@ -277,6 +451,8 @@ static int vscsiLunSbcReqProcess(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq)
                     memset(aReply, 0, sizeof(aReply));
                     vscsiH2BEU64(aReply, pVScsiLunSbc->cSectors - 1);
                     vscsiH2BEU32(&aReply[8], 512);
+                    if (pVScsiLunSbc->fFeatures & VSCSI_LUN_FEATURE_UNMAP)
+                        aReply[14] = RT_BIT(7); /* LBPME: Logical block provisioning enabled */
                     /* Leave the rest 0 */
 
                     vscsiCopyToIoMemCtx(&pVScsiReq->IoMemCtx, aReply, sizeof(aReply));
@@ -288,6 +464,18 @@ static int vscsiLunSbcReqProcess(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq)
             }
             break;
         }
+        case SCSI_UNMAP:
+        {
+            if (pVScsiLunSbc->fFeatures & VSCSI_LUN_FEATURE_UNMAP)
+            {
+                rcReq = vscsiLunSbcUnmapRangesGet(pVScsiLunSbc, pVScsiReq, &paRanges, &cRanges);
+                if (rcReq == SCSI_STATUS_OK && !paRanges)
+                    rcReq = vscsiReqSenseOkSet(pVScsiReq); /* Nothing to unmap. */
+            }
+            else
+                rcReq = vscsiReqSenseErrorSet(pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_ILLEGAL_OPCODE);
+            break;
+        }
         default:
             //AssertMsgFailed(("Command %#x [%s] not implemented\n", pRequest->pbCDB[0], SCSICmdText(pRequest->pbCDB[0])));
             rcReq = vscsiReqSenseErrorSet(pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_ILLEGAL_OPCODE);
@@ -321,6 +509,11 @@ static int vscsiLunSbcReqProcess(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq)
         /* Enqueue flush */
         rc = vscsiIoReqFlushEnqueue(pVScsiLun, pVScsiReq);
     }
+    else if (paRanges)
+    {
+        /* Enqueue unmap, the I/O request takes ownership of the ranges. */
+        rc = vscsiIoReqUnmapEnqueue(pVScsiLun, pVScsiReq, paRanges, cRanges);
+    }
     else /* Request completed */
         vscsiDeviceReqComplete(pVScsiLun->pVScsiDevice, pVScsiReq, rcReq, false, VINF_SUCCESS);
 
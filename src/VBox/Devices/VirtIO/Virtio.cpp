@@ -733,6 +733,9 @@ int vpciLoadExec(PVPCISTATE pState, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t
         {
             rc = SSMR3GetU32(pSSM, &pState->nQueues);
             AssertRCReturn(rc, rc);
+            AssertMsgReturn(pState->nQueues <= VIRTIO_MAX_NQUEUES,
+                            ("%s: nQueues=%u\n", INSTANCE(pState), pState->nQueues),
+                            VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
         }
         else
             pState->nQueues = nQueues;
@@ -29,13 +29,15 @@
  * for example.
  */
 #define VIRTIO_SAVEDSTATE_VERSION_3_1_BETA1 1
-#define VIRTIO_SAVEDSTATE_VERSION           2
+#define VIRTIO_SAVEDSTATE_VERSION_PRE_MQ    2
+#define VIRTIO_SAVEDSTATE_VERSION           3
 
 #define DEVICE_PCI_VENDOR_ID                0x1AF4
 #define DEVICE_PCI_DEVICE_ID                0x1000
 #define DEVICE_PCI_SUBSYSTEM_VENDOR_ID      0x1AF4
 
-#define VIRTIO_MAX_NQUEUES                  3
+/* Enough for 8 virtio-net queue pairs plus the control queue. */
+#define VIRTIO_MAX_NQUEUES                  17
 
 #define VPCI_HOST_FEATURES                  0x0
 #define VPCI_GUEST_FEATURES                 0x4
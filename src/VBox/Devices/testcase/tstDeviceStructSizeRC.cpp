@@ -1465,8 +1465,8 @@ int main()
     GEN_CHECK_OFF(VNETSTATE, u32PktNo);
     GEN_CHECK_OFF(VNETSTATE, fPromiscuous);
     GEN_CHECK_OFF(VNETSTATE, fAllMulti);
-    GEN_CHECK_OFF(VNETSTATE, pRxQueue);
-    GEN_CHECK_OFF(VNETSTATE, pTxQueue);
+    GEN_CHECK_OFF(VNETSTATE, cQueuePairs);
+    GEN_CHECK_OFF(VNETSTATE, cQueuePairsActive);
     GEN_CHECK_OFF(VNETSTATE, pCtlQueue);
     GEN_CHECK_OFF(VNETSTATE, fMaybeOutOfSpace);
     GEN_CHECK_OFF(VNETSTATE, hEventMoreRxDescAvail);
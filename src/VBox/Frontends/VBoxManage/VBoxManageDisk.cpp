@@ -548,6 +548,7 @@ static const RTGETOPTDEF g_aCloneHardDiskOptions[] =
     { "--existing",     'E', RTGETOPT_REQ_NOTHING },
     { "--variant",      'm', RTGETOPT_REQ_STRING },
     { "-variant",       'm', RTGETOPT_REQ_STRING },
+    { "--skipzeroes",   'z', RTGETOPT_REQ_NOTHING },
 };
 
 int handleCloneHardDisk(HandlerArg *a)
@@ -559,6 +560,7 @@ int handleCloneHardDisk(HandlerArg *a)
     Bstr format;
     MediumVariant_T DiskVariant = MediumVariant_Standard;
     bool fExisting = false;
+    bool fSkipZeroes = false;
 
     int c;
     RTGETOPTUNION ValueUnion;
@@ -592,6 +594,10 @@ int handleCloneHardDisk(HandlerArg *a)
                     return errorArgument("Invalid hard disk variant '%s'", ValueUnion.psz);
                 break;
 
+            case 'z':   // --skipzeroes
+                fSkipZeroes = true;
+                break;
+
             case VINF_GETOPT_NOT_OPTION:
                 if (!pszSrc)
                     pszSrc = ValueUnion.psz;
@@ -660,6 +666,13 @@ int handleCloneHardDisk(HandlerArg *a)
                 break;
         }
 
+        if (fSkipZeroes)
+        {
+            unsigned uDiskVariant = (unsigned)DiskVariant;
+            uDiskVariant |= MediumVariant_SkipZeroes;
+            DiskVariant = (MediumVariant_T)uDiskVariant;
+        }
+
         ComPtr<IProgress> progress;
         CHECK_ERROR_BREAK(srcDisk, CloneTo(dstDisk, DiskVariant, NULL, progress.asOutParam()));
 
@@ -535,7 +535,7 @@ void printUsage(USAGECATEGORY u64Cmd, PRTSTREAM pStrm)
                      "VBoxManage clonehd          <uuid>|<filename> <uuid>|<outputfile>\n"
                      "                            [--format VDI|VMDK|VHD|RAW|<other>]\n"
                      "                            [--variant Standard,Fixed,Split2G,Stream,ESX]\n"
-                     "                            [--existing]\n"
+                     "                            [--existing] [--skipzeroes]\n"
                      "\n");
 
     if (u64Cmd & USAGE_CONVERTFROMRAW)
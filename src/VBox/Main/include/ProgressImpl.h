@@ -263,6 +263,7 @@ public:
                             const char *aText,
                             va_list va);
     bool notifyPointOfNoReturn(void);
+    HRESULT setCurrentOperationDescription(CBSTR bstrDescription);
 
 private:
 
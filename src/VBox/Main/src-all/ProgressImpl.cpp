@@ -1321,6 +1321,29 @@ bool Progress::notifyPointOfNoReturn(void)
     return true;
 }
 
+/**
+ * Changes the description of the current operation without advancing to the
+ * next one, for reporting the state of long running operations.
+ *
+ * @param bstrDescription   The new description of the current operation.
+ */
+HRESULT Progress::setCurrentOperationDescription(CBSTR bstrDescription)
+{
+    AssertReturn(bstrDescription, E_INVALIDARG);
+
+    AutoCaller autoCaller(this);
+    AssertComRCReturnRC(autoCaller.rc());
+
+    AutoWriteLock alock(this COMMA_LOCKVAL_SRC_POS);
+
+    if (mCanceled)
+        return E_FAIL;
+    AssertReturn(!mCompleted, E_FAIL);
+
+    m_bstrOperationDescription = bstrDescription;
+    return S_OK;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // CombinedProgress class
 ////////////////////////////////////////////////////////////////////////////////
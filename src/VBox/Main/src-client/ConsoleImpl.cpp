@@ -7904,6 +7904,14 @@ HRESULT Console::attachToTapInterface(INetworkAdapter *networkAdapter)
             else
                 memcpy(IfReq.ifr_name, str.c_str(), sizeof(IfReq.ifr_name) - 1); /** @todo bitch about names which are too long... */
             IfReq.ifr_flags = IFF_TAP | IFF_NO_PI;
+#  ifdef IFF_VNET_HDR
+            /* Let the TAP driver exchange GSO frames with the host if the kernel
+               supports it; the driver checks the flag with TUNGETIFF. */
+            unsigned int fTunFeatures = 0;
+            if (   ioctl(maTapFD[slot], TUNGETFEATURES, &fTunFeatures) == 0
+                && (fTunFeatures & IFF_VNET_HDR))
+                IfReq.ifr_flags |= IFF_VNET_HDR;
+#  endif
             rcVBox = ioctl(maTapFD[slot], TUNSETIFF, &IfReq);
             if (rcVBox != 0)
             {
@@ -34,6 +34,7 @@
 #include <iprt/timer.h>
 
 #include <VBox/vmm/vmapi.h>
+#include <VBox/vmm/em.h>
 #include <VBox/vmm/ssm.h>
 #include <VBox/err.h>
 #include <VBox/version.h>
@@ -68,6 +69,16 @@ public:
     bool volatile       mfIOError;
     /** @} */
 
+    /** @name striped stream stuff (VBoxInternal2/TeleporterStreams)
+     * @{  */
+    /** The number of data connections, 0 if the state goes over mhSocket. */
+    uint32_t            mcStreams;
+    /** The data connections. */
+    RTSOCKET            mahStreams[SSM_TCP_STRIPE_MAX_STREAMS];
+    /** The stripe on top of mahStreams while the state is transferred. */
+    PSSMTCPSTRIPE       mpStripe;
+    /** @} */
+
     TeleporterState(Console *pConsole, PUVM pUVM, Progress *pProgress, bool fIsSource)
         : mptrConsole(pConsole)
         , mpUVM(pUVM)
@@ -79,7 +90,11 @@ public:
         , mfStopReading(false)
         , mfEndOfStream(false)
         , mfIOError(false)
+        , mcStreams(0)
+        , mpStripe(NULL)
     {
+        for (unsigned i = 0; i < RT_ELEMENTS(mahStreams); i++)
+            mahStreams[i] = NIL_RTSOCKET;
         VMR3RetainUVM(mpUVM);
     }
 
@@ -100,6 +115,8 @@ public:
     Utf8Str             mstrHostname;
     uint32_t            muPort;
     uint32_t            mcMsMaxDowntime;
+    /** The guest execution throttle last reported thru the progress object. */
+    uint32_t            muThrottle;
     MachineState_T      menmOldMachineState;
     bool                mfSuspendedByUs;
     bool                mfUnlockedMedia;
@@ -108,6 +125,7 @@ public:
         : TeleporterState(pConsole, pUVM, pProgress, true /*fIsSource*/)
         , muPort(UINT32_MAX)
         , mcMsMaxDowntime(250)
+        , muThrottle(0)
         , menmOldMachineState(enmOldMachineState)
         , mfSuspendedByUs(false)
         , mfUnlockedMedia(false)
@@ -174,19 +192,18 @@ static const char g_szWelcome[] = "VirtualBox-Teleporter-1.0\n";
 
 
 /**
- * Reads a string from the socket.
+ * Reads a string from a socket.
  *
  * @returns VBox status code.
  *
- * @param   pState      The teleporter state structure.
+ * @param   Sock        The socket.
  * @param   pszBuf      The output buffer.
  * @param   cchBuf      The size of the output buffer.
  *
  */
-static int teleporterTcpReadLine(TeleporterState *pState, char *pszBuf, size_t cchBuf)
+static int teleporterTcpReadLineEx(RTSOCKET Sock, char *pszBuf, size_t cchBuf)
 {
     char       *pszStart = pszBuf;
-    RTSOCKET    Sock     = pState->mhSocket;
 
     AssertReturn(cchBuf > 1, VERR_INTERNAL_ERROR);
     *pszBuf = '\0';
@@ -216,6 +233,22 @@ static int teleporterTcpReadLine(TeleporterState *pState, char *pszBuf, size_t c
 }
 
 
+/**
+ * Reads a string from the control socket.
+ *
+ * @returns VBox status code.
+ *
+ * @param   pState      The teleporter state structure.
+ * @param   pszBuf      The output buffer.
+ * @param   cchBuf      The size of the output buffer.
+ *
+ */
+static int teleporterTcpReadLine(TeleporterState *pState, char *pszBuf, size_t cchBuf)
+{
+    return teleporterTcpReadLineEx(pState->mhSocket, pszBuf, cchBuf);
+}
+
+
 /**
  * Reads an ACK or NACK.
  *
@@ -314,6 +347,18 @@ static DECLCALLBACK(int) teleporterTcpOpWrite(void *pvUser, uint64_t offStream,
     AssertReturn(cbToWrite < UINT32_MAX, VERR_OUT_OF_RANGE);
     AssertReturn(pState->mfIsSource, VERR_INVALID_HANDLE);
 
+    if (pState->mpStripe)
+    {
+        int rc = SSMR3TcpStripeWrite(pState->mpStripe, pvBuf, cbToWrite);
+        if (RT_FAILURE(rc))
+        {
+            LogRel(("Teleporter/TCP: Striped write error: %Rrc (cb=%#zx)\n", rc, cbToWrite));
+            return rc;
+        }
+        pState->moffStream += cbToWrite;
+        return VINF_SUCCESS;
+    }
+
     for (;;)
     {
         TELEPORTERTCPHDR Hdr;
@@ -369,6 +414,43 @@ static int teleporterTcpReadSelect(TeleporterState *pState)
 }
 
 
+/**
+ * Worker for teleporterTcpOpRead that reads from the data connections.
+ *
+ * @returns VBox status code.
+ * @param   pState          The teleporter state data.
+ * @param   pvBuf           Where to return the data.
+ * @param   cbToRead        How much to read.
+ * @param   pcbRead         Where to return the amount read, optional.
+ */
+static int teleporterTcpStripeRead(TeleporterState *pState, void *pvBuf, size_t cbToRead, size_t *pcbRead)
+{
+    if (pState->mfEndOfStream)
+        return VERR_EOF;
+    if (pState->mfStopReading)
+        return VERR_EOF;
+    if (pState->mfIOError)
+        return VERR_IO_GEN_FAILURE;
+
+    int rc = SSMR3TcpStripeRead(pState->mpStripe, pvBuf, cbToRead, pcbRead);
+    if (RT_SUCCESS(rc))
+    {
+        pState->moffStream += pcbRead ? *pcbRead : cbToRead;
+        return rc;
+    }
+    if (rc == VERR_INTERRUPTED)
+        return VERR_EOF;        /* mfStopReading */
+    if (rc == VERR_EOF || rc == VERR_SSM_CANCELLED)
+        pState->mfEndOfStream = true;
+    else
+    {
+        pState->mfIOError = true;
+        LogRel(("Teleporter/TCP: Striped read error: %Rrc (cb=%#zx)\n", rc, cbToRead));
+    }
+    return rc;
+}
+
+
 /**
  * @copydoc SSMSTRMOPS::pfnRead
  */
@@ -377,6 +459,9 @@ static DECLCALLBACK(int) teleporterTcpOpRead(void *pvUser, uint64_t offStream, v
     TeleporterState *pState = (TeleporterState *)pvUser;
     AssertReturn(!pState->mfIsSource, VERR_INVALID_HANDLE);
 
+    if (pState->mpStripe)
+        return teleporterTcpStripeRead(pState, pvBuf, cbToRead, pcbRead);
+
     for (;;)
     {
         int rc;
@@ -530,6 +615,17 @@ static DECLCALLBACK(int) teleporterTcpOpClose(void *pvUser, bool fCanceled)
 
     if (pState->mfIsSource)
     {
+        if (pState->mpStripe)
+        {
+            int rc = SSMR3TcpStripeClose(pState->mpStripe, fCanceled);
+            if (RT_FAILURE(rc))
+            {
+                LogRel(("Teleporter/TCP: Striped stream close error: %Rrc\n", rc));
+                return rc;
+            }
+            return VINF_SUCCESS;
+        }
+
         TELEPORTERTCPHDR EofHdr;
         EofHdr.u32Magic = TELEPORTERTCPHDR_MAGIC;
         EofHdr.cb       = fCanceled ? UINT32_MAX : 0;
@@ -543,6 +639,8 @@ static DECLCALLBACK(int) teleporterTcpOpClose(void *pvUser, bool fCanceled)
     else
     {
         ASMAtomicWriteBool(&pState->mfStopReading, true);
+        if (pState->mpStripe)
+            SSMR3TcpStripeSetStopReading(pState->mpStripe, true);
     }
 
     return VINF_SUCCESS;
@@ -566,6 +664,63 @@ static SSMSTRMOPS const g_teleporterTcpOps =
 };
 
 
+/**
+ * Destroys the stripe and closes the data connections.
+ *
+ * The target closes its end first and without lingering, the source then
+ * does a graceful close which completes right away.
+ *
+ * @param   pState          The teleporter state data.
+ */
+static void teleporterTcpCloseStreams(TeleporterState *pState)
+{
+    if (pState->mpStripe)
+    {
+        SSMR3TcpStripeDestroy(pState->mpStripe);
+        pState->mpStripe = NULL;
+    }
+    for (unsigned i = 0; i < RT_ELEMENTS(pState->mahStreams); i++)
+        if (pState->mahStreams[i] != NIL_RTSOCKET)
+        {
+            if (pState->mfIsSource)
+                RTTcpClientClose(pState->mahStreams[i]);
+            else
+                RTSocketClose(pState->mahStreams[i]);
+            pState->mahStreams[i] = NIL_RTSOCKET;
+        }
+}
+
+
+/**
+ * Opens and authenticates one data connection to the target.
+ *
+ * @returns VBox status code.
+ * @param   pState          The teleporter state data.
+ * @param   phSocket        Where to return the socket.  Set on failure too
+ *                          if the connection was established.
+ */
+static int teleporterSrcConnectStream(TeleporterStateSrc *pState, PRTSOCKET phSocket)
+{
+    int vrc = RTTcpClientConnect(pState->mstrHostname.c_str(), pState->muPort, phSocket);
+    if (RT_FAILURE(vrc))
+        return vrc;
+
+    /* Same welcome, password and ACK sequence as the control connection. */
+    char szLine[RT_MAX(128, sizeof(g_szWelcome))];
+    RT_ZERO(szLine);
+    vrc = RTTcpRead(*phSocket, szLine, sizeof(g_szWelcome) - 1, NULL);
+    if (RT_SUCCESS(vrc) && strcmp(szLine, g_szWelcome))
+        vrc = VERR_INVALID_MAGIC;
+    if (RT_SUCCESS(vrc))
+        vrc = RTTcpWrite(*phSocket, pState->mstrPassword.c_str(), pState->mstrPassword.length());
+    if (RT_SUCCESS(vrc))
+        vrc = teleporterTcpReadLineEx(*phSocket, szLine, sizeof(szLine));
+    if (RT_SUCCESS(vrc) && strcmp(szLine, "ACK"))
+        vrc = VERR_AUTHENTICATION_FAILURE;
+    return vrc;
+}
+
+
 /**
  * Progress cancelation callback.
  */
@@ -600,6 +755,26 @@ static DECLCALLBACK(int) teleporterProgressCallback(PVM pVM, unsigned uPercent,
                 return VERR_SSM_CANCELLED;
             }
         }
+
+        /*
+         * Tell the user when the guest is slowed down to make the live
+         * phase converge (/PGM/LiveSaveAutoConverge).
+         */
+        if (pState->mfIsSource)
+        {
+            TeleporterStateSrc *pStateSrc = (TeleporterStateSrc *)pState;
+            uint32_t uThrottle = EMR3GetExecutionThrottle(pVM);
+            if (uThrottle != pStateSrc->muThrottle)
+            {
+                pStateSrc->muThrottle = uThrottle;
+                Bstr bstrDesc;
+                if (uThrottle)
+                    bstrDesc = BstrFmt(Console::tr("Teleporter (guest throttled by %u%%)"), uThrottle);
+                else
+                    bstrDesc = Bstr(Console::tr("Teleporter"));
+                pState->mptrProgress->setCurrentOperationDescription(bstrDesc.raw());
+            }
+        }
     }
 
     return VINF_SUCCESS;
@@ -671,6 +846,42 @@ Console::teleporterSrc(TeleporterStateSrc *pState)
     if (FAILED(hrc))
         return hrc;
 
+    /*
+     * Open the data connections for striping the state stream if so
+     * configured.  The control connection then only carries the commands.
+     */
+    Bstr bstrStreams;
+    hrc = mMachine->GetExtraData(Bstr("VBoxInternal2/TeleporterStreams").raw(), bstrStreams.asOutParam());
+    if (SUCCEEDED(hrc) && !bstrStreams.isEmpty())
+    {
+        uint32_t cStreams = Utf8Str(bstrStreams).toUInt32();
+        pState->mcStreams = cStreams > 1 ? RT_MIN(cStreams, SSM_TCP_STRIPE_MAX_STREAMS) : 0;
+    }
+    if (pState->mcStreams)
+    {
+        char szCmd[32];
+        RTStrPrintf(szCmd, sizeof(szCmd), "streams=%u", pState->mcStreams);
+        hrc = teleporterSrcSubmitCommand(pState, szCmd, false /*fWaitForAck*/);
+        if (FAILED(hrc))
+            return hrc;
+
+        /* Don't connect before the target says it is listening for them, a
+           target without striping support NACKs the command and hangs up. */
+        hrc = teleporterSrcReadACK(pState, "streams",
+                                   tr("The target does not support multiple data connections, clear the "
+                                      "VBoxInternal2/TeleporterStreams extra data setting"));
+        if (FAILED(hrc))
+            return hrc;
+        for (uint32_t i = 0; i < pState->mcStreams; i++)
+        {
+            vrc = teleporterSrcConnectStream(pState, &pState->mahStreams[i]);
+            if (RT_FAILURE(vrc))
+                return setError(E_FAIL, tr("Failed to open data connection #%u to port %u on '%s': %Rrc"),
+                                i, pState->muPort, pState->mstrHostname.c_str(), vrc);
+        }
+        LogRel(("Teleporter: Striping the state over %u connections\n", pState->mcStreams));
+    }
+
     /*
      * Start loading the state.
      *
@@ -682,6 +893,13 @@ Console::teleporterSrc(TeleporterStateSrc *pState)
     if (FAILED(hrc))
         return hrc;
 
+    if (pState->mcStreams)
+    {
+        vrc = SSMR3TcpStripeCreate(pState->mahStreams, pState->mcStreams, true /*fWriter*/, &pState->mpStripe);
+        if (RT_FAILURE(vrc))
+            return setError(E_FAIL, tr("SSMR3TcpStripeCreate -> %Rrc"), vrc);
+    }
+
     RTSocketRetain(pState->mhSocket);
     void *pvUser = static_cast<void *>(static_cast<TeleporterState *>(pState));
     vrc = VMR3Teleport(VMR3GetVM(pState->mpUVM),
@@ -690,6 +908,11 @@ Console::teleporterSrc(TeleporterStateSrc *pState)
                        teleporterProgressCallback,  pvUser,
                        &pState->mfSuspendedByUs);
     RTSocketRelease(pState->mhSocket);
+    if (pState->mpStripe)
+    {
+        SSMR3TcpStripeDestroy(pState->mpStripe);
+        pState->mpStripe = NULL;
+    }
     if (RT_FAILURE(vrc))
     {
         if (   vrc == VERR_SSM_CANCELLED
@@ -706,6 +929,9 @@ Console::teleporterSrc(TeleporterStateSrc *pState)
     if (FAILED(hrc))
         return hrc;
 
+    /* The target has closed its end of the data connections by now. */
+    teleporterTcpCloseStreams(pState);
+
     /*
      * We're at the point of no return.
      */
@@ -772,6 +998,7 @@ Console::teleporterSrcThreadWrapper(RTTHREAD hThread, void *pvUser)
         hrc = pState->mptrConsole->teleporterSrc(pState);
 
     /* Close the connection ASAP on so that the other side can complete. */
+    teleporterTcpCloseStreams(pState);
     if (pState->mhSocket != NIL_RTSOCKET)
     {
         RTTcpClientClose(pState->mhSocket);
@@ -1235,6 +1462,74 @@ static int teleporterTcpWriteNACK(TeleporterStateTrg *pState, int32_t rc2, const
 }
 
 
+/**
+ * Accepts and authenticates the data connections announced by the source
+ * with a "streams=N" command.
+ *
+ * The command is ACKed (or NACKed) before accepting anything; the source
+ * waits for this before connecting.  The connections are made in order and
+ * each is authenticated before the next is made, so the order is the same on
+ * both sides.
+ *
+ * @returns VBox status code.
+ * @param   pState          The teleporter state.
+ * @param   pszCount        The stream count from the command.
+ */
+static int teleporterTrgAcceptStreams(TeleporterStateTrg *pState, const char *pszCount)
+{
+    uint32_t cStreams;
+    int vrc = RTStrToUInt32Full(pszCount, 10, &cStreams);
+    if (   vrc != VINF_SUCCESS
+        || cStreams < 2
+        || cStreams > SSM_TCP_STRIPE_MAX_STREAMS)
+    {
+        LogRel(("Teleporter: Invalid stream count '%s'\n", pszCount));
+        teleporterTcpWriteNACK(pState, VERR_OUT_OF_RANGE, "Invalid data connection count");
+        return VERR_OUT_OF_RANGE;
+    }
+
+    vrc = teleporterTcpWriteACK(pState);
+    if (RT_FAILURE(vrc))
+        return vrc;
+
+    const char *pszPassword = pState->mstrPassword.c_str();
+    for (uint32_t i = 0; i < cStreams; i++)
+    {
+        RTSOCKET hSocket;
+        vrc = RTTcpServerAcceptExtra(pState->mhServer, 30000, &hSocket);
+        if (RT_FAILURE(vrc))
+        {
+            LogRel(("Teleporter: Failed to accept data connection #%u: %Rrc\n", i, vrc));
+            return vrc;
+        }
+        pState->mahStreams[i] = hSocket;
+        pState->mcStreams     = i + 1;
+
+        vrc = RTTcpWrite(hSocket, g_szWelcome, sizeof(g_szWelcome) - 1);
+        for (unsigned off = 0; RT_SUCCESS(vrc) && pszPassword[off]; off++)
+        {
+            char ch;
+            vrc = RTTcpRead(hSocket, &ch, sizeof(ch), NULL);
+            if (RT_SUCCESS(vrc) && pszPassword[off] != ch)
+                vrc = VERR_AUTHENTICATION_FAILURE;
+        }
+        if (RT_FAILURE(vrc))
+        {
+            LogRel(("Teleporter: Data connection #%u handshake failed: %Rrc\n", i, vrc));
+            if (vrc == VERR_AUTHENTICATION_FAILURE)
+                RTTcpWrite(hSocket, "NACK\n", sizeof("NACK\n") - 1);
+            return vrc;
+        }
+        vrc = RTTcpWrite(hSocket, "ACK\n", sizeof("ACK\n") - 1);
+        if (RT_FAILURE(vrc))
+            return vrc;
+    }
+
+    LogRel(("Teleporter: Receiving the state over %u connections\n", cStreams));
+    return VINF_SUCCESS;
+}
+
+
 /**
  * @copydoc FNRTTCPSERVE
  *
@@ -1301,6 +1596,27 @@ Console::teleporterTrgServeConnection(RTSOCKET Sock, void *pvUser)
     }
     AssertMsg(SUCCEEDED(hrc) || hrc == E_FAIL, ("%Rhrc\n", hrc));
 
+    /*
+     * Accept the data connections if the source wants to stripe the state
+     * stream.  This has to be done while the server is still listening, so
+     * the first command is read here.
+     */
+    char szCmd[128];
+    vrc = teleporterTcpReadLine(pState, szCmd, sizeof(szCmd));
+    if (RT_FAILURE(vrc))
+        return VINF_SUCCESS;
+    bool fHaveCmd = true;
+    if (!strncmp(szCmd, "streams=", sizeof("streams=") - 1))
+    {
+        vrc = teleporterTrgAcceptStreams(pState, &szCmd[sizeof("streams=") - 1]);
+        if (RT_FAILURE(vrc))
+        {
+            teleporterTcpCloseStreams(pState);
+            return VINF_SUCCESS;
+        }
+        fHaveCmd = false;
+    }
+
     /*
      * Stop the server and cancel the timeout timer.
      *
@@ -1317,10 +1633,13 @@ Console::teleporterTrgServeConnection(RTSOCKET Sock, void *pvUser)
     bool fDone = false;
     for (;;)
     {
-        char szCmd[128];
-        vrc = teleporterTcpReadLine(pState, szCmd, sizeof(szCmd));
-        if (RT_FAILURE(vrc))
-            break;
+        if (!fHaveCmd)
+        {
+            vrc = teleporterTcpReadLine(pState, szCmd, sizeof(szCmd));
+            if (RT_FAILURE(vrc))
+                break;
+        }
+        fHaveCmd = false;
 
         if (!strcmp(szCmd, "load"))
         {
@@ -1328,6 +1647,17 @@ Console::teleporterTrgServeConnection(RTSOCKET Sock, void *pvUser)
             if (RT_FAILURE(vrc))
                 break;
 
+            if (pState->mcStreams)
+            {
+                vrc = SSMR3TcpStripeCreate(pState->mahStreams, pState->mcStreams, false /*fWriter*/, &pState->mpStripe);
+                if (RT_FAILURE(vrc))
+                {
+                    LogRel(("Teleporter: SSMR3TcpStripeCreate -> %Rrc\n", vrc));
+                    teleporterTcpWriteNACK(pState, vrc);
+                    break;
+                }
+            }
+
             int vrc2 = VMR3AtErrorRegisterU(pState->mpUVM,
                                             Console::genericVMSetErrorCallback, &pState->mErrorText); AssertRC(vrc2);
             RTSocketRetain(pState->mhSocket); /* For concurrent access by I/O thread and EMT. */
@@ -1350,6 +1680,8 @@ Console::teleporterTrgServeConnection(RTSOCKET Sock, void *pvUser)
 
             /* The EOS might not have been read, make sure it is. */
             pState->mfStopReading = false;
+            if (pState->mpStripe)
+                SSMR3TcpStripeSetStopReading(pState->mpStripe, false);
             size_t cbRead;
             vrc = teleporterTcpOpRead(pvUser2, pState->moffStream, szCmd, 1, &cbRead);
             if (vrc != VERR_EOF)
@@ -1359,6 +1691,8 @@ Console::teleporterTrgServeConnection(RTSOCKET Sock, void *pvUser)
                 break;
             }
 
+            /* Done with the data connections, let the source close its end. */
+            teleporterTcpCloseStreams(pState);
             vrc = teleporterTcpWriteACK(pState);
         }
         else if (!strcmp(szCmd, "cancel"))
@@ -1430,6 +1764,7 @@ Console::teleporterTrgServeConnection(RTSOCKET Sock, void *pvUser)
         vrc = VERR_WRONG_ORDER;
     if (RT_FAILURE(vrc))
         teleporterTrgUnlockMedia(pState);
+    teleporterTcpCloseStreams(pState);
 
     pState->mRc = vrc;
     pState->mhSocket = NIL_RTSOCKET;
@@ -6434,7 +6434,7 @@ HRESULT Medium::taskCreateBaseHandler(Medium::CreateBaseTask &task)
                                format.c_str(),
                                location.c_str(),
                                task.mSize,
-                               task.mVariant & ~MediumVariant_NoCreateDir,
+                               task.mVariant & ~(MediumVariant_NoCreateDir | MediumVariant_SkipZeroes),
                                NULL,
                                &geo,
                                &geo,
@@ -6598,7 +6598,7 @@ HRESULT Medium::taskCreateDiffHandler(Medium::CreateDiffTask &task)
             vrc = VDCreateDiff(hdd,
                                targetFormat.c_str(),
                                targetLocation.c_str(),
-                               (task.mVariant & ~MediumVariant_NoCreateDir) | VD_IMAGE_FLAGS_DIFF,
+                               (task.mVariant & ~(MediumVariant_NoCreateDir | MediumVariant_SkipZeroes)) | VD_IMAGE_FLAGS_DIFF,
                                NULL,
                                targetId.raw(),
                                id.raw(),
@@ -7147,40 +7147,29 @@ HRESULT Medium::taskCloneHandler(Medium::CloneTask &task)
                 }
 
                 /** @todo r=klaus target isn't locked, race getting the state */
-                if (task.midxSrcImageSame == UINT32_MAX)
-                {
-                    vrc = VDCopy(hdd,
-                                 VD_LAST_IMAGE,
-                                 targetHdd,
-                                 targetFormat.c_str(),
-                                 (fCreatingTarget) ? targetLocation.c_str() : (char *)NULL,
-                                 false /* fMoveByRename */,
-                                 0 /* cbSize */,
-                                 task.mVariant & ~MediumVariant_NoCreateDir,
-                                 targetId.raw(),
-                                 VD_OPEN_FLAGS_NORMAL | m->uOpenFlagsDef,
-                                 NULL /* pVDIfsOperation */,
-                                 pTarget->m->vdImageIfaces,
-                                 task.mVDOperationIfaces);
-                }
-                else
-                {
-                    vrc = VDCopyEx(hdd,
-                                   VD_LAST_IMAGE,
-                                   targetHdd,
-                                   targetFormat.c_str(),
-                                   (fCreatingTarget) ? targetLocation.c_str() : (char *)NULL,
-                                   false /* fMoveByRename */,
-                                   0 /* cbSize */,
-                                   task.midxSrcImageSame,
-                                   task.midxDstImageSame,
-                                   task.mVariant & ~MediumVariant_NoCreateDir,
-                                   targetId.raw(),
-                                   VD_OPEN_FLAGS_NORMAL | m->uOpenFlagsDef,
-                                   NULL /* pVDIfsOperation */,
-                                   pTarget->m->vdImageIfaces,
-                                   task.mVDOperationIfaces);
-                }
+                /* Overlap reading the source chain with writing (and possibly
+                 * compressing) the target. Zero blocks are left out only if
+                 * the caller asked for it, and VDCopyEx ignores the request
+                 * unless a new dynamic base image is created. */
+                unsigned uCopyFlags = VD_COPY_FLAGS_PIPELINE;
+                if (task.mVariant & MediumVariant_SkipZeroes)
+                    uCopyFlags |= VD_COPY_FLAGS_SKIP_ZEROES;
+                vrc = VDCopyEx(hdd,
+                               VD_LAST_IMAGE,
+                               targetHdd,
+                               targetFormat.c_str(),
+                               (fCreatingTarget) ? targetLocation.c_str() : (char *)NULL,
+                               false /* fMoveByRename */,
+                               0 /* cbSize */,
+                               task.midxSrcImageSame == UINT32_MAX ? VD_IMAGE_CONTENT_UNKNOWN : task.midxSrcImageSame,
+                               task.midxSrcImageSame == UINT32_MAX ? VD_IMAGE_CONTENT_UNKNOWN : task.midxDstImageSame,
+                               task.mVariant & ~(MediumVariant_NoCreateDir | MediumVariant_SkipZeroes),
+                               targetId.raw(),
+                               VD_OPEN_FLAGS_NORMAL | m->uOpenFlagsDef,
+                               uCopyFlags,
+                               NULL /* pVDIfsOperation */,
+                               pTarget->m->vdImageIfaces,
+                               task.mVDOperationIfaces);
                 if (RT_FAILURE(vrc))
                     throw setError(VBOX_E_FILE_ERROR,
                                    tr("Could not create the clone medium '%s'%s"),
@@ -7782,7 +7771,7 @@ HRESULT Medium::taskExportHandler(Medium::ExportTask &task)
                              targetLocation.c_str(),
                              false /* fMoveByRename */,
                              0 /* cbSize */,
-                             task.mVariant & ~MediumVariant_NoCreateDir,
+                             task.mVariant & ~(MediumVariant_NoCreateDir | MediumVariant_SkipZeroes),
                              NULL /* pDstUuid */,
                              VD_OPEN_FLAGS_NORMAL | VD_OPEN_FLAGS_SEQUENTIAL,
                              NULL /* pVDIfsOperation */,
@@ -7950,7 +7939,7 @@ HRESULT Medium::taskImportHandler(Medium::ImportTask &task)
                              (fCreatingTarget) ? targetLocation.c_str() : (char *)NULL,
                              false /* fMoveByRename */,
                              0 /* cbSize */,
-                             task.mVariant & ~MediumVariant_NoCreateDir,
+                             task.mVariant & ~(MediumVariant_NoCreateDir | MediumVariant_SkipZeroes),
                              targetId.raw(),
                              VD_OPEN_FLAGS_NORMAL,
                              NULL /* pVDIfsOperation */,
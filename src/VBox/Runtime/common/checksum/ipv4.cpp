@@ -33,6 +33,9 @@
 
 #include <iprt/asm.h>
 #include <iprt/assert.h>
+#if defined(IN_RING3) && defined(RT_ARCH_AMD64)
+# include <emmintrin.h>
+#endif
 
 
 /**
@@ -285,6 +288,86 @@ RTDECL(uint32_t) RTNetIPv4AddTCPChecksum(PCRTNETTCP pTcpHdr, uint32_t u32Sum)
 RT_EXPORT_SYMBOL(RTNetIPv4AddTCPChecksum);
 
 
+/**
+ * Sums up a block of 16-bit words [inlined].
+ *
+ * On x86 and AMD64 the words are added eight bytes at a time with end-around
+ * carry, which yields the same ones' complement sum as adding them one by one.
+ * In ring-3 on AMD64, where SSE2 is always present, larger blocks are summed
+ * as zero extended dwords in four vector accumulators first.  The other
+ * contexts must not touch the FPU/SSE state.
+ *
+ * @returns The sum folded to 16 bits.
+ * @param   pb              The data, no alignment requirements.
+ * @param   cb              The number of bytes, must be even.
+ */
+DECLINLINE(uint32_t) rtNetIPv4SumWords(uint8_t const *pb, size_t cb)
+{
+    uint64_t u64Sum = 0;
+    Assert(!(cb & 1));
+
+#if defined(IN_RING3) && defined(RT_ARCH_AMD64)
+    if (cb >= 64)
+    {
+        __m128i const uZero = _mm_setzero_si128();
+        __m128i       uSum0 = uZero;
+        __m128i       uSum1 = uZero;
+        __m128i       uSum2 = uZero;
+        __m128i       uSum3 = uZero;
+        do
+        {
+            __m128i const u0 = _mm_loadu_si128((__m128i const *)pb);
+            __m128i const u1 = _mm_loadu_si128((__m128i const *)(pb + 16));
+            __m128i const u2 = _mm_loadu_si128((__m128i const *)(pb + 32));
+            __m128i const u3 = _mm_loadu_si128((__m128i const *)(pb + 48));
+            uSum0 = _mm_add_epi64(uSum0, _mm_unpacklo_epi32(u0, uZero));
+            uSum1 = _mm_add_epi64(uSum1, _mm_unpackhi_epi32(u0, uZero));
+            uSum2 = _mm_add_epi64(uSum2, _mm_unpacklo_epi32(u1, uZero));
+            uSum3 = _mm_add_epi64(uSum3, _mm_unpackhi_epi32(u1, uZero));
+            uSum0 = _mm_add_epi64(uSum0, _mm_unpacklo_epi32(u2, uZero));
+            uSum1 = _mm_add_epi64(uSum1, _mm_unpackhi_epi32(u2, uZero));
+            uSum2 = _mm_add_epi64(uSum2, _mm_unpacklo_epi32(u3, uZero));
+            uSum3 = _mm_add_epi64(uSum3, _mm_unpackhi_epi32(u3, uZero));
+            pb += 64;
+            cb -= 64;
+        } while (cb >= 64);
+
+        /* No carries so far, each lane would need 4G rounds to overflow. */
+        uSum0 = _mm_add_epi64(_mm_add_epi64(uSum0, uSum1), _mm_add_epi64(uSum2, uSum3));
+        u64Sum = (uint64_t)_mm_cvtsi128_si64(uSum0)
+               + (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(uSum0, uSum0));
+    }
+#endif
+
+#if defined(RT_ARCH_AMD64) || defined(RT_ARCH_X86)
+    while (cb >= 8)
+    {
+        uint64_t const u64 = *(uint64_t const *)pb;
+        u64Sum += u64;
+        u64Sum += u64Sum < u64;     /* end-around carry */
+        pb += 8;
+        cb -= 8;
+    }
+#endif
+    while (cb >= 2)
+    {
+        uint16_t const u16 = *(uint16_t const *)pb;
+        u64Sum += u16;
+        u64Sum += u64Sum < u16;
+        pb += 2;
+        cb -= 2;
+    }
+
+    /* fold it to 16 bits so the callers can keep adding without carry worries */
+    u64Sum = (u64Sum >> 32) + (uint32_t)u64Sum;
+    u64Sum = (u64Sum >> 32) + (uint32_t)u64Sum;
+    uint32_t u32Sum = (uint32_t)u64Sum;
+    u32Sum = (u32Sum >> 16) + (u32Sum & 0xffff);
+    u32Sum = (u32Sum >> 16) + (u32Sum & 0xffff);
+    return u32Sum;
+}
+
+
 /**
  * Adds the checksum of the specified data segment to the intermediate checksum value [inlined].
  *
@@ -298,8 +381,7 @@ RT_EXPORT_SYMBOL(RTNetIPv4AddTCPChecksum);
  */
 DECLINLINE(uint32_t) rtNetIPv4AddDataChecksum(void const *pvData, size_t cbData, uint32_t u32Sum, bool *pfOdd)
 {
-    uint16_t const *pw = (uint16_t const *)pvData;
-    if (*pfOdd)
+    if (*pfOdd && cbData)
     {
 #ifdef RT_BIG_ENDIAN
         /* there was an odd byte in the previous chunk, add the lower byte. */
@@ -309,6 +391,7 @@ DECLINLINE(uint32_t) rtNetIPv4AddDataChecksum(void const *pvData, size_t cbData,
         u32Sum += (uint32_t)*(uint8_t *)pvData << 8;
 #endif
         /* skip the byte. */
+        *pfOdd = false;
         cbData--;
         if (!cbData)
             return u32Sum;
@@ -316,20 +399,23 @@ DECLINLINE(uint32_t) rtNetIPv4AddDataChecksum(void const *pvData, size_t cbData,
     }
 
     /* iterate the data. */
-    while (cbData > 1)
+    uint8_t const *pb = (uint8_t const *)pvData;
+    if (cbData > 1)
     {
-        u32Sum += *pw;
-        pw++;
-        cbData -= 2;
+        uint32_t const u32Words = rtNetIPv4SumWords(pb, cbData & ~(size_t)1);
+        u32Sum += u32Words;
+        u32Sum += u32Sum < u32Words; /* end-around carry */
+        pb     += cbData & ~(size_t)1;
+        cbData &= 1;
     }
 
     /* handle odd byte. */
     if (cbData)
     {
 #ifdef RT_BIG_ENDIAN
-        u32Sum += (uint32_t)*(uint8_t *)pw << 8;
+        u32Sum += (uint32_t)*pb << 8;
 #else
-        u32Sum += *(uint8_t *)pw;
+        u32Sum += *pb;
 #endif
         *pfOdd = true;
     }
@@ -0,0 +1,63 @@
+/* $Id: RTMemIsZero.cpp $ */
+/** @file
+ * IPRT - RTMemIsZero.
+ */
+
+/*
+ * Copyright (C) 2012 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ *
+ * The contents of this file may alternatively be used under the terms
+ * of the Common Development and Distribution License Version 1.0
+ * (CDDL) only, as it comes in the "COPYING.CDDL" file of the
+ * VirtualBox OSE distribution, in which case the provisions of the
+ * CDDL are applicable instead of those of the GPL.
+ *
+ * You may elect to license modified versions of this file under the
+ * terms and conditions of either the GPL or the CDDL or both.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include <iprt/mem.h>
+#include "internal/iprt.h"
+
+#include <iprt/asm.h>
+#if defined(RT_ARCH_AMD64) && defined(IN_RING3)
+# include <emmintrin.h>
+#endif
+
+
+RTDECL(bool) RTMemIsZero(void const *pv, size_t cb) RT_NO_THROW
+{
+#if defined(RT_ARCH_AMD64) && defined(IN_RING3)
+    /* SSE2 is always there on AMD64. Align the pointer, check the bulk of the
+       block 64 bytes at a time and leave the tail to ASMMemIsZero. */
+    uint8_t const *pb = (uint8_t const *)pv;
+    for (; cb && ((uintptr_t)pb & 15); cb--, pb++)
+        if (*pb)
+            return false;
+
+    for (; cb >= 64; cb -= 64, pb += 64)
+    {
+        __m128i const *pu128 = (__m128i const *)pb;
+        __m128i u128 = _mm_or_si128(_mm_or_si128(_mm_load_si128(&pu128[0]), _mm_load_si128(&pu128[1])),
+                                    _mm_or_si128(_mm_load_si128(&pu128[2]), _mm_load_si128(&pu128[3])));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(u128, _mm_setzero_si128())) != 0xffff)
+            return false;
+    }
+    return ASMMemIsZero(pb, cb);
+#else
+    return ASMMemIsZero(pv, cb);
+#endif
+}
+RT_EXPORT_SYMBOL(RTMemIsZero);
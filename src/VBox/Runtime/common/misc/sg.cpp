@@ -31,6 +31,8 @@
 #include <iprt/sg.h>
 #include <iprt/string.h>
 #include <iprt/assert.h>
+#include <iprt/asm.h>
+#include <iprt/mem.h>
 
 
 static void *sgBufGet(PRTSGBUF pSgBuf, size_t *pcbData)
@@ -277,6 +279,33 @@ RTDECL(size_t) RTSgBufSet(PRTSGBUF pSgBuf, uint8_t ubFill, size_t cbSet)
 }
 
 
+RTDECL(bool) RTSgBufIsZero(PCRTSGBUF pSgBuf, size_t cbCheck)
+{
+    AssertPtrReturn(pSgBuf, false);
+
+    size_t cbLeft = cbCheck;
+    RTSGBUF SgBufTmp;
+
+    RTSgBufClone(&SgBufTmp, pSgBuf);
+
+    while (cbLeft)
+    {
+        size_t cbThisCheck = cbLeft;
+        void *pvBuf = sgBufGet(&SgBufTmp, &cbThisCheck);
+
+        if (!cbThisCheck)
+            break;
+
+        if (!RTMemIsZero(pvBuf, cbThisCheck))
+            return false;
+
+        cbLeft -= cbThisCheck;
+    }
+
+    return true;
+}
+
+
 RTDECL(size_t) RTSgBufCopyToBuf(PRTSGBUF pSgBuf, void *pvBuf, size_t cbCopy)
 {
     AssertPtrReturn(pSgBuf, 0);
@@ -28,6 +28,10 @@
 #define ___internal_fileaio_h
 
 #include <iprt/file.h>
+#ifdef RT_OS_LINUX
+# include <iprt/env.h>
+# include <iprt/string.h>
+#endif
 #include "internal/magics.h"
 
 /*******************************************************************************
@@ -111,9 +115,46 @@ typedef enum RTFILEAIOREQSTATE
         pReq->enmState = RTFILEAIOREQSTATE_##State; \
     } while (0)
 
+#ifdef RT_OS_LINUX
+/** Environment variable selecting the Linux async I/O backend.
+ * "io_uring" selects the io_uring backend if the host kernel supports it,
+ * anything else the native kernel async I/O API (io_submit). */
+# define RTFILEAIO_LNX_BACKEND_ENV_VAR     "IPRT_FILE_AIO_BACKEND"
+/** Number of entries of the ring set up to check for io_uring support.
+ * Large enough that the ring accounts for about as much locked memory as
+ * a context created by the PDM async completion manager. */
+# define RTFILEAIO_LNX_IOURING_PROBE_ENTRIES 512
+
+# ifndef __NR_io_uring_setup
+/** The syscall numbers are the same for all architectures since 5.1. */
+#  define __NR_io_uring_setup    425
+#  define __NR_io_uring_enter    426
+#  define __NR_io_uring_register 427
+# endif
+#endif
+
 
 RT_C_DECLS_BEGIN
 
+#ifdef RT_OS_LINUX
+/**
+ * Checks whether the io_uring backend was requested for async file I/O.
+ *
+ * This doesn't check whether the host supports it, see
+ * rtFileAioLnxUseIoUring for that.
+ *
+ * @returns true if io_uring was requested, false otherwise.
+ */
+DECLINLINE(bool) rtFileAioLnxIsIoUringRequested(void)
+{
+    const char *pszBackend = RTEnvGet(RTFILEAIO_LNX_BACKEND_ENV_VAR);
+    return pszBackend
+        && !RTStrICmp(pszBackend, "io_uring");
+}
+
+DECLHIDDEN(bool) rtFileAioLnxUseIoUring(void);
+#endif
+
 RT_C_DECLS_END
 
 #endif
@@ -40,6 +40,25 @@
  * compensated if the user of this API implements caching itself. The next
  * limitation is that data buffers must be aligned at a 512 byte boundary or the
  * request will fail.
+ *
+ * Newer kernels (5.1+) provide io_uring as an alternative which is used if the
+ * IPRT_FILE_AIO_BACKEND environment variable is set to "io_uring" when a
+ * context is created. Submission and completion happen through two rings
+ * shared with the kernel so a batch of requests costs a single syscall and
+ * reaping completions none at all if they are already there. io_uring
+ * processes requests for files without O_DIRECT asynchronously too (the
+ * kernel punts them to worker threads if they would block), so
+ * RTFILE_O_ASYNC_IO doesn't imply O_DIRECT when it is selected.
+ * Buffers registered with RTFileAioCtxRegisterBuffer() are pinned once and
+ * used with the fixed buffer opcodes, saving the page pinning for every
+ * request. If io_uring is not available the io_submit interface is used.
+ * Whether it is available is decided once for the process, a context failing
+ * to set up its ring doesn't fall back to io_submit because the files it is
+ * meant for were opened without O_DIRECT.
+ *
+ * Requests are prepared the same way for both backends, the iocb is converted
+ * to a submission queue entry when the request is submitted to an io_uring
+ * context.
  */
 /** @todo r=bird: What's this about "must be opened with O_DIRECT"? An
  *        explanation would be nice, esp. seeing what Linus is quoted saying
@@ -56,10 +75,15 @@
 #include <iprt/err.h>
 #include <iprt/log.h>
 #include <iprt/thread.h>
+#include <iprt/semaphore.h>
+#include <iprt/time.h>
 #include "internal/fileaio.h"
 
 #include <unistd.h>
 #include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <poll.h>
 #include <errno.h>
 
 #include <iprt/file.h>
@@ -166,6 +190,190 @@ typedef struct LNXKAIOIOEVENT
 } LNXKAIOIOEVENT, *PLNXKAIOIOEVENT;
 
 
+/**
+ * io_uring submission queue ring offsets, filled in by io_uring_setup.
+ */
+typedef struct LNXIOURINGSQOFFSETS
+{
+    /** Offset of the head index (consumer, kernel). */
+    uint32_t        u32OffHead;
+    /** Offset of the tail index (producer, us). */
+    uint32_t        u32OffTail;
+    /** Offset of the ring mask. */
+    uint32_t        u32OffRingMask;
+    /** Offset of the number of ring entries. */
+    uint32_t        u32OffRingEntries;
+    /** Offset of the ring flags. */
+    uint32_t        u32OffFlags;
+    /** Offset of the dropped entries counter. */
+    uint32_t        u32OffDropped;
+    /** Offset of the index array into the submission queue entries. */
+    uint32_t        u32OffArray;
+    /** Reserved. */
+    uint32_t        u32Rsvd0;
+    /** Reserved. */
+    uint64_t        u64Rsvd1;
+} LNXIOURINGSQOFFSETS;
+AssertCompileSize(LNXIOURINGSQOFFSETS, 40);
+
+/**
+ * io_uring completion queue ring offsets, filled in by io_uring_setup.
+ */
+typedef struct LNXIOURINGCQOFFSETS
+{
+    /** Offset of the head index (consumer, us). */
+    uint32_t        u32OffHead;
+    /** Offset of the tail index (producer, kernel). */
+    uint32_t        u32OffTail;
+    /** Offset of the ring mask. */
+    uint32_t        u32OffRingMask;
+    /** Offset of the number of ring entries. */
+    uint32_t        u32OffRingEntries;
+    /** Offset of the overflow counter. */
+    uint32_t        u32OffOverflow;
+    /** Offset of the completion queue entry array. */
+    uint32_t        u32OffCqes;
+    /** Offset of the ring flags. */
+    uint32_t        u32OffFlags;
+    /** Reserved. */
+    uint32_t        u32Rsvd0;
+    /** Reserved. */
+    uint64_t        u64Rsvd1;
+} LNXIOURINGCQOFFSETS;
+AssertCompileSize(LNXIOURINGCQOFFSETS, 40);
+
+/**
+ * The parameter structure passed to io_uring_setup.
+ *
+ * Redefined here so we don't depend on the kernel headers of the build host.
+ */
+typedef struct LNXIOURINGPARAMS
+{
+    /** Number of submission queue entries, set by the kernel. */
+    uint32_t            cSqEntries;
+    /** Number of completion queue entries, set by the kernel. */
+    uint32_t            cCqEntries;
+    /** Setup flags. */
+    uint32_t            fFlags;
+    /** CPU of the submission queue polling thread. */
+    uint32_t            u32SqThreadCpu;
+    /** Idle time of the submission queue polling thread. */
+    uint32_t            u32SqThreadIdle;
+    /** Features supported by the kernel (LNXIOURING_FEAT_XXX). */
+    uint32_t            fFeatures;
+    /** Work queue file descriptor to share. */
+    uint32_t            u32WqFd;
+    /** Reserved. */
+    uint32_t            au32Rsvd[3];
+    /** Submission queue ring offsets. */
+    LNXIOURINGSQOFFSETS SqOffsets;
+    /** Completion queue ring offsets. */
+    LNXIOURINGCQOFFSETS CqOffsets;
+} LNXIOURINGPARAMS;
+AssertCompileSize(LNXIOURINGPARAMS, 120);
+
+/**
+ * io_uring submission queue entry.
+ */
+typedef struct LNXIOURINGSQE
+{
+    /** The opcode (LNXIOURING_OP_XXX). */
+    uint8_t         u8Opc;
+    /** Entry flags. */
+    uint8_t         fFlags;
+    /** Request priority. */
+    uint16_t        u16IoPrio;
+    /** The file descriptor. */
+    int32_t         i32Fd;
+    /** The file offset. */
+    uint64_t        u64OffFile;
+    /** Buffer or iovec array address. */
+    uint64_t        u64AddrBuf;
+    /** Buffer size or number of iovecs. */
+    uint32_t        u32BufLen;
+    /** Operation specific flags (RW flags, fsync flags, ...). */
+    uint32_t        fOpc;
+    /** Opaque user data returned in the completion queue entry. */
+    uint64_t        u64User;
+    /** Index of the registered buffer for the fixed buffer opcodes. */
+    uint16_t        u16BufIdx;
+    /** Personality to use. */
+    uint16_t        u16Personality;
+    /** Splice input descriptor. */
+    int32_t         i32SpliceFdIn;
+    /** Reserved. */
+    uint64_t        au64Rsvd[2];
+} LNXIOURINGSQE;
+AssertCompileSize(LNXIOURINGSQE, 64);
+/** Pointer to an io_uring submission queue entry. */
+typedef LNXIOURINGSQE *PLNXIOURINGSQE;
+
+/**
+ * io_uring completion queue entry.
+ */
+typedef struct LNXIOURINGCQE
+{
+    /** The user data from the submission queue entry. */
+    uint64_t        u64User;
+    /** The result, negative errno on failure. */
+    int32_t         rcLnx;
+    /** Flags. */
+    uint32_t        fFlags;
+} LNXIOURINGCQE;
+AssertCompileSize(LNXIOURINGCQE, 16);
+/** Pointer to an io_uring completion queue entry. */
+typedef LNXIOURINGCQE *PLNXIOURINGCQE;
+
+/**
+ * io_uring state of a context.
+ */
+typedef struct LNXIOURING
+{
+    /** The ring file descriptor. */
+    int                 iFdRing;
+    /** The mapping of the submission queue ring. */
+    void               *pvSqRing;
+    /** Size of the submission queue ring mapping. */
+    size_t              cbSqRing;
+    /** The mapping of the completion queue ring, equals pvSqRing if the kernel
+     * uses a single mapping for both. */
+    void               *pvCqRing;
+    /** Size of the completion queue ring mapping. */
+    size_t              cbCqRing;
+    /** The submission queue entries. */
+    PLNXIOURINGSQE      paSqes;
+    /** Size of the submission queue entry mapping. */
+    size_t              cbSqes;
+    /** Number of submission queue entries. */
+    uint32_t            cSqEntries;
+    /** The submission queue index mask. */
+    uint32_t            fSqMask;
+    /** Pointer to the submission queue head index. */
+    volatile uint32_t  *pidxSqHead;
+    /** Pointer to the submission queue tail index. */
+    volatile uint32_t  *pidxSqTail;
+    /** Pointer to the submission queue index array. */
+    uint32_t           *paidxSqArray;
+    /** The completion queue index mask. */
+    uint32_t            fCqMask;
+    /** Pointer to the completion queue head index. */
+    volatile uint32_t  *pidxCqHead;
+    /** Pointer to the completion queue tail index. */
+    volatile uint32_t  *pidxCqTail;
+    /** The completion queue entries. */
+    PLNXIOURINGCQE      paCqes;
+    /** Serializes submissions, the kernel only reads the submission queue
+     * during io_uring_enter. */
+    RTSEMFASTMUTEX      hMtxSubmit;
+    /** Number of registered buffers. */
+    uint32_t            cBufsReg;
+    /** The registered buffers. */
+    struct iovec        aBufsReg[16];
+} LNXIOURING;
+/** Pointer to the io_uring state. */
+typedef LNXIOURING *PLNXIOURING;
+
+
 /**
  * Async I/O completion context state.
  */
@@ -183,8 +391,12 @@ typedef struct RTFILEAIOCTXINTERNAL
     volatile bool       fWokenUp;
     /** Flag whether the thread is currently waiting in the syscall. */
     volatile bool       fWaiting;
+    /** Flag whether the context uses io_uring instead of io_submit. */
+    bool                fIoUring;
     /** Magic value (RTFILEAIOCTX_MAGIC). */
     uint32_t            u32Magic;
+    /** The io_uring state if fIoUring is set. */
+    LNXIOURING          IoUring;
 } RTFILEAIOCTXINTERNAL;
 /** Pointer to an internal context structure. */
 typedef RTFILEAIOCTXINTERNAL *PRTFILEAIOCTXINTERNAL;
@@ -207,6 +419,8 @@ typedef struct RTFILEAIOREQINTERNAL
     size_t                cbTransfered;
     /** Completion context we are assigned to. */
     PRTFILEAIOCTXINTERNAL pCtxInt;
+    /** The I/O vector for the io_uring vectored opcodes. */
+    struct iovec          IoVec;
     /** Magic value  (RTFILEAIOREQ_MAGIC). */
     uint32_t              u32Magic;
 } RTFILEAIOREQINTERNAL;
@@ -220,6 +434,36 @@ typedef RTFILEAIOREQINTERNAL *PRTFILEAIOREQINTERNAL;
 /** The max number of events to get in one call. */
 #define AIO_MAXIMUM_REQUESTS_PER_CONTEXT 64
 
+/** @name io_uring opcodes.
+ * @{ */
+#define LNXIOURING_OP_READV                 1
+#define LNXIOURING_OP_WRITEV                2
+#define LNXIOURING_OP_FSYNC                 3
+#define LNXIOURING_OP_READ_FIXED            4
+#define LNXIOURING_OP_WRITE_FIXED           5
+/** @} */
+
+/** Kernel maps the submission and completion rings with a single mmap. */
+#define LNXIOURING_FEAT_SINGLE_MMAP         RT_BIT_32(0)
+/** io_uring_enter flag: wait for completions. */
+#define LNXIOURING_ENTER_GETEVENTS          RT_BIT_32(0)
+/** io_uring_register opcode: register buffers. */
+#define LNXIOURING_REGISTER_BUFFERS         0
+/** io_uring_register opcode: unregister all buffers. */
+#define LNXIOURING_UNREGISTER_BUFFERS       1
+
+/** @name mmap offsets of the different io_uring regions.
+ * @{ */
+#define LNXIOURING_OFF_SQ_RING              UINT64_C(0)
+#define LNXIOURING_OFF_CQ_RING              UINT64_C(0x8000000)
+#define LNXIOURING_OFF_SQES                 UINT64_C(0x10000000)
+/** @} */
+
+/** Maximum number of ring entries the kernel supports. */
+#define LNXIOURING_ENTRIES_MAX              32768
+/** Maximum size of a registered buffer. */
+#define LNXIOURING_BUF_REG_SIZE_MAX         _1G
+
 
 /**
  * Creates a new async I/O context.
@@ -285,11 +529,154 @@ DECLINLINE(int) rtFileAsyncIoLinuxGetEvents(LNXKAIOCONTEXT AioContext, long cReq
     return rc;
 }
 
+/**
+ * Creates a new io_uring instance.
+ */
+DECLINLINE(int) rtFileAsyncIoLinuxIoUringSetup(uint32_t cEntries, LNXIOURINGPARAMS *pParams, int *piFdRing)
+{
+    int rc = syscall(__NR_io_uring_setup, cEntries, pParams);
+    if (RT_UNLIKELY(rc == -1))
+        return RTErrConvertFromErrno(errno);
+
+    *piFdRing = rc;
+    return VINF_SUCCESS;
+}
+
+/**
+ * Submits entries from the submission queue and/or waits for completions.
+ * @returns Number of consumed submission queue entries (natural number w/ 0),
+ *          IPRT error code (negative).
+ */
+DECLINLINE(int) rtFileAsyncIoLinuxIoUringEnter(int iFdRing, uint32_t cToSubmit, uint32_t cMinComplete, uint32_t fFlags)
+{
+    int rc = syscall(__NR_io_uring_enter, iFdRing, cToSubmit, cMinComplete, fFlags, NULL, 0);
+    if (RT_UNLIKELY(rc == -1))
+        return RTErrConvertFromErrno(errno);
+
+    return rc;
+}
+
+/**
+ * Registers or unregisters resources with an io_uring instance.
+ */
+DECLINLINE(int) rtFileAsyncIoLinuxIoUringRegister(int iFdRing, uint32_t uOpc, void *pvArg, uint32_t cArgs)
+{
+    int rc = syscall(__NR_io_uring_register, iFdRing, uOpc, pvArg, cArgs);
+    if (RT_UNLIKELY(rc == -1))
+        return RTErrConvertFromErrno(errno);
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Sets up the io_uring state of a context.
+ *
+ * @returns IPRT status code.
+ * @param   pIoUring    The io_uring state to initialize.
+ * @param   cEntries    Number of submission queue entries.
+ */
+static int rtFileAioLinuxIoUringCreate(PLNXIOURING pIoUring, uint32_t cEntries)
+{
+    LNXIOURINGPARAMS Params;
+    RT_ZERO(Params);
+    int rc = rtFileAsyncIoLinuxIoUringSetup(cEntries, &Params, &pIoUring->iFdRing);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    pIoUring->cbSqRing = Params.SqOffsets.u32OffArray + Params.cSqEntries * sizeof(uint32_t);
+    pIoUring->cbCqRing = Params.CqOffsets.u32OffCqes  + Params.cCqEntries * sizeof(LNXIOURINGCQE);
+    pIoUring->cbSqes   = Params.cSqEntries * sizeof(LNXIOURINGSQE);
+    if (Params.fFeatures & LNXIOURING_FEAT_SINGLE_MMAP)
+        pIoUring->cbSqRing = pIoUring->cbCqRing = RT_MAX(pIoUring->cbSqRing, pIoUring->cbCqRing);
+
+    pIoUring->pvSqRing = mmap(NULL, pIoUring->cbSqRing, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                              pIoUring->iFdRing, LNXIOURING_OFF_SQ_RING);
+    if (pIoUring->pvSqRing != MAP_FAILED)
+    {
+        if (Params.fFeatures & LNXIOURING_FEAT_SINGLE_MMAP)
+            pIoUring->pvCqRing = pIoUring->pvSqRing;
+        else
+            pIoUring->pvCqRing = mmap(NULL, pIoUring->cbCqRing, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                      pIoUring->iFdRing, LNXIOURING_OFF_CQ_RING);
+        if (pIoUring->pvCqRing != MAP_FAILED)
+        {
+            pIoUring->paSqes = (PLNXIOURINGSQE)mmap(NULL, pIoUring->cbSqes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                                    pIoUring->iFdRing, LNXIOURING_OFF_SQES);
+            if ((void *)pIoUring->paSqes != MAP_FAILED)
+            {
+                rc = RTSemFastMutexCreate(&pIoUring->hMtxSubmit);
+                if (RT_SUCCESS(rc))
+                {
+                    uint8_t *pbSqRing = (uint8_t *)pIoUring->pvSqRing;
+                    uint8_t *pbCqRing = (uint8_t *)pIoUring->pvCqRing;
+
+                    pIoUring->cSqEntries   = Params.cSqEntries;
+                    pIoUring->fSqMask      = *(uint32_t *)(pbSqRing + Params.SqOffsets.u32OffRingMask);
+                    pIoUring->pidxSqHead   = (volatile uint32_t *)(pbSqRing + Params.SqOffsets.u32OffHead);
+                    pIoUring->pidxSqTail   = (volatile uint32_t *)(pbSqRing + Params.SqOffsets.u32OffTail);
+                    pIoUring->paidxSqArray = (uint32_t *)(pbSqRing + Params.SqOffsets.u32OffArray);
+                    pIoUring->fCqMask      = *(uint32_t *)(pbCqRing + Params.CqOffsets.u32OffRingMask);
+                    pIoUring->pidxCqHead   = (volatile uint32_t *)(pbCqRing + Params.CqOffsets.u32OffHead);
+                    pIoUring->pidxCqTail   = (volatile uint32_t *)(pbCqRing + Params.CqOffsets.u32OffTail);
+                    pIoUring->paCqes       = (PLNXIOURINGCQE)(pbCqRing + Params.CqOffsets.u32OffCqes);
+                    pIoUring->cBufsReg     = 0;
+                    return VINF_SUCCESS;
+                }
+
+                munmap(pIoUring->paSqes, pIoUring->cbSqes);
+            }
+            else
+                rc = RTErrConvertFromErrno(errno);
+
+            if (pIoUring->pvCqRing != pIoUring->pvSqRing)
+                munmap(pIoUring->pvCqRing, pIoUring->cbCqRing);
+        }
+        else
+            rc = RTErrConvertFromErrno(errno);
+
+        munmap(pIoUring->pvSqRing, pIoUring->cbSqRing);
+    }
+    else
+        rc = RTErrConvertFromErrno(errno);
+
+    close(pIoUring->iFdRing);
+    pIoUring->iFdRing = -1;
+    return rc;
+}
+
+/**
+ * Tears down the io_uring state of a context.
+ *
+ * @param   pIoUring    The io_uring state to destroy.
+ */
+static void rtFileAioLinuxIoUringDestroy(PLNXIOURING pIoUring)
+{
+    RTSemFastMutexDestroy(pIoUring->hMtxSubmit);
+    pIoUring->hMtxSubmit = NIL_RTSEMFASTMUTEX;
+    munmap(pIoUring->paSqes, pIoUring->cbSqes);
+    if (pIoUring->pvCqRing != pIoUring->pvSqRing)
+        munmap(pIoUring->pvCqRing, pIoUring->cbCqRing);
+    munmap(pIoUring->pvSqRing, pIoUring->cbSqRing);
+    close(pIoUring->iFdRing);
+    pIoUring->iFdRing = -1;
+}
+
 RTR3DECL(int) RTFileAioGetLimits(PRTFILEAIOLIMITS pAioLimits)
 {
     int rc = VINF_SUCCESS;
     AssertPtrReturn(pAioLimits, VERR_INVALID_POINTER);
 
+    /*
+     * io_uring takes care of buffered files as well.
+     */
+    if (rtFileAioLnxUseIoUring())
+    {
+        pAioLimits->cReqsOutstandingMax = LNXIOURING_ENTRIES_MAX;
+        pAioLimits->cbBufferAlignment   = 512; /* For files opened with RTFILE_O_NO_CACHE. */
+        pAioLimits->fBufferedIo         = true;
+        return VINF_SUCCESS;
+    }
+
     /*
      * Check if the API is implemented by creating a
      * completion port.
@@ -306,6 +693,7 @@ RTR3DECL(int) RTFileAioGetLimits(PRTFILEAIOLIMITS pAioLimits)
     /* Supported - fill in the limits. The alignment is the only restriction. */
     pAioLimits->cReqsOutstandingMax = RTFILEAIO_UNLIMITED_REQS;
     pAioLimits->cbBufferAlignment   = 512;
+    pAioLimits->fBufferedIo         = false;
 
     return VINF_SUCCESS;
 }
@@ -434,6 +822,10 @@ RTDECL(int) RTFileAioReqCancel(RTFILEAIOREQ hReq)
     RTFILEAIOREQ_VALID_RETURN(pReqInt);
     RTFILEAIOREQ_STATE_RETURN_RC(pReqInt, SUBMITTED, VERR_FILE_AIO_NOT_SUBMITTED);
 
+    /* Requests on an io_uring are always considered to be in progress. */
+    if (pReqInt->pCtxInt->fIoUring)
+        return VERR_FILE_AIO_IN_PROGRESS;
+
     LNXKAIOIOEVENT AioEvent;
     int rc = rtFileAsyncIoLinuxCancel(pReqInt->AioContext, &pReqInt->AioCB, &AioEvent);
     if (RT_SUCCESS(rc))
@@ -485,8 +877,27 @@ RTDECL(int) RTFileAioCtxCreate(PRTFILEAIOCTX phAioCtx, uint32_t cAioReqsMax)
     if (RT_UNLIKELY(!pCtxInt))
         return VERR_NO_MEMORY;
 
-    /* Init the event handle. */
-    int rc = rtFileAsyncIoLinuxCreate(cAioReqsMax, &pCtxInt->AioContext);
+    /*
+     * Init the io_uring or the event handle.  Files are opened without O_DIRECT
+     * when io_uring is usable, so never fall back to io_submit in that case:
+     * requests on those files would silently be executed synchronously.
+     */
+    int rc;
+    if (rtFileAioLnxUseIoUring())
+    {
+        if (cAioReqsMax <= LNXIOURING_ENTRIES_MAX)
+        {
+            rc = rtFileAioLinuxIoUringCreate(&pCtxInt->IoUring, cAioReqsMax);
+            if (RT_SUCCESS(rc))
+                pCtxInt->fIoUring = true;
+            else
+                LogRel(("RTFileAioCtxCreate: Setting up the io_uring with %u entries failed with %Rrc\n", cAioReqsMax, rc));
+        }
+        else
+            rc = VERR_OUT_OF_RANGE;
+    }
+    else
+        rc = rtFileAsyncIoLinuxCreate(cAioReqsMax, &pCtxInt->AioContext);
     if (RT_SUCCESS(rc))
     {
         pCtxInt->fWokenUp     = false;
@@ -516,9 +927,14 @@ RTDECL(int) RTFileAioCtxDestroy(RTFILEAIOCTX hAioCtx)
         return VERR_FILE_AIO_BUSY;
 
     /* The native bit first, then mark it as dead and free it. */
-    int rc = rtFileAsyncIoLinuxDestroy(pCtxInt->AioContext);
-    if (RT_FAILURE(rc))
-        return rc;
+    if (pCtxInt->fIoUring)
+        rtFileAioLinuxIoUringDestroy(&pCtxInt->IoUring);
+    else
+    {
+        int rc = rtFileAsyncIoLinuxDestroy(pCtxInt->AioContext);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
     ASMAtomicUoWriteU32(&pCtxInt->u32Magic, RTFILEAIOCTX_MAGIC_DEAD);
     RTMemFree(pCtxInt);
 
@@ -546,6 +962,322 @@ RTDECL(int) RTFileAioCtxAssociateWithFile(RTFILEAIOCTX hAioCtx, RTFILE hFile)
     return VINF_SUCCESS;
 }
 
+RTDECL(int) RTFileAioCtxRegisterBuffer(RTFILEAIOCTX hAioCtx, void *pvBuf, size_t cbBuf)
+{
+    PRTFILEAIOCTXINTERNAL pCtxInt = hAioCtx;
+    RTFILEAIOCTX_VALID_RETURN(pCtxInt);
+    AssertPtrReturn(pvBuf, VERR_INVALID_POINTER);
+    AssertReturn(cbBuf > 0 && cbBuf <= LNXIOURING_BUF_REG_SIZE_MAX, VERR_INVALID_PARAMETER);
+
+    /* io_submit has no concept of registered buffers. */
+    if (!pCtxInt->fIoUring)
+        return VERR_NOT_SUPPORTED;
+
+    PLNXIOURING pIoUring = &pCtxInt->IoUring;
+    int rc = VINF_SUCCESS;
+
+    RTSemFastMutexRequest(pIoUring->hMtxSubmit);
+    if (ASMAtomicReadS32(&pCtxInt->cRequests))
+        rc = VERR_FILE_AIO_BUSY;
+    else if (pIoUring->cBufsReg == RT_ELEMENTS(pIoUring->aBufsReg))
+        rc = VERR_FILE_AIO_LIMIT_EXCEEDED;
+    else
+    {
+        /* The kernel can only replace the whole set. */
+        if (pIoUring->cBufsReg)
+            rc = rtFileAsyncIoLinuxIoUringRegister(pIoUring->iFdRing, LNXIOURING_UNREGISTER_BUFFERS, NULL, 0);
+        if (RT_SUCCESS(rc))
+        {
+            pIoUring->aBufsReg[pIoUring->cBufsReg].iov_base = pvBuf;
+            pIoUring->aBufsReg[pIoUring->cBufsReg].iov_len  = cbBuf;
+            rc = rtFileAsyncIoLinuxIoUringRegister(pIoUring->iFdRing, LNXIOURING_REGISTER_BUFFERS,
+                                                   &pIoUring->aBufsReg[0], pIoUring->cBufsReg + 1);
+            if (RT_SUCCESS(rc))
+                pIoUring->cBufsReg++;
+            else if (pIoUring->cBufsReg)
+            {
+                /* Try to restore the old set, requests fall back to the normal opcodes if that fails. */
+                int rc2 = rtFileAsyncIoLinuxIoUringRegister(pIoUring->iFdRing, LNXIOURING_REGISTER_BUFFERS,
+                                                            &pIoUring->aBufsReg[0], pIoUring->cBufsReg);
+                if (RT_FAILURE(rc2))
+                    pIoUring->cBufsReg = 0;
+            }
+        }
+    }
+    RTSemFastMutexRelease(pIoUring->hMtxSubmit);
+
+    return rc;
+}
+
+/**
+ * Reverts the given requests into the prepared state after they couldn't be
+ * submitted.
+ */
+static void rtFileAioLinuxReqsRevert(PRTFILEAIOREQ pahReqs, size_t cReqs)
+{
+    for (size_t i = 0; i < cReqs; i++)
+    {
+        PRTFILEAIOREQINTERNAL pReqInt = pahReqs[i];
+        pReqInt->pCtxInt = NULL;
+        RTFILEAIOREQ_SET_STATE(pReqInt, PREPARED);
+    }
+}
+
+/**
+ * Converts a prepared request into an io_uring submission queue entry.
+ *
+ * @param   pIoUring    The io_uring state.
+ * @param   pSqe        The submission queue entry to fill in.
+ * @param   pReqInt     The request.
+ */
+static void rtFileAioLinuxIoUringSqeInit(PLNXIOURING pIoUring, PLNXIOURINGSQE pSqe, PRTFILEAIOREQINTERNAL pReqInt)
+{
+    RT_ZERO(*pSqe);
+    pSqe->i32Fd   = pReqInt->AioCB.uFileDesc;
+    pSqe->u64User = (uintptr_t)pReqInt;
+
+    if (pReqInt->AioCB.u16IoOpCode == LNXKAIO_IOCB_CMD_FSYNC)
+    {
+        pSqe->u8Opc = LNXIOURING_OP_FSYNC;
+        return;
+    }
+
+    bool const     fWrite     = pReqInt->AioCB.u16IoOpCode == LNXKAIO_IOCB_CMD_WRITE;
+    uint8_t const *pbBuf      = (uint8_t const *)pReqInt->AioCB.pvBuf;
+    size_t const   cbTransfer = pReqInt->AioCB.cbTransfer;
+
+    pSqe->u64OffFile = pReqInt->AioCB.off;
+
+    /* Use the fixed buffer variants if the buffer is inside a registered one. */
+    for (uint32_t i = 0; i < pIoUring->cBufsReg; i++)
+    {
+        uint8_t const *pbBufReg = (uint8_t const *)pIoUring->aBufsReg[i].iov_base;
+        size_t const   cbBufReg = pIoUring->aBufsReg[i].iov_len;
+        if (   pbBuf >= pbBufReg
+            && cbTransfer <= cbBufReg
+            && (size_t)(pbBuf - pbBufReg) <= cbBufReg - cbTransfer)
+        {
+            pSqe->u8Opc      = fWrite ? LNXIOURING_OP_WRITE_FIXED : LNXIOURING_OP_READ_FIXED;
+            pSqe->u64AddrBuf = (uintptr_t)pbBuf;
+            pSqe->u32BufLen  = (uint32_t)cbTransfer;
+            pSqe->u16BufIdx  = (uint16_t)i;
+            return;
+        }
+    }
+
+    /* The vectored opcodes are available from the start unlike the plain read/write ones. */
+    pReqInt->IoVec.iov_base = (void *)pbBuf;
+    pReqInt->IoVec.iov_len  = cbTransfer;
+    pSqe->u8Opc      = fWrite ? LNXIOURING_OP_WRITEV : LNXIOURING_OP_READV;
+    pSqe->u64AddrBuf = (uintptr_t)&pReqInt->IoVec;
+    pSqe->u32BufLen  = 1;
+}
+
+/**
+ * Submits the given requests to an io_uring context.
+ *
+ * @returns IPRT status code.
+ * @param   pCtxInt     The context, io_uring based.
+ * @param   pahReqs     The requests, already validated and in the submitted state.
+ * @param   cReqs       Number of requests.
+ */
+static int rtFileAioLinuxIoUringSubmit(PRTFILEAIOCTXINTERNAL pCtxInt, PRTFILEAIOREQ pahReqs, size_t cReqs)
+{
+    PLNXIOURING pIoUring = &pCtxInt->IoUring;
+    int rc = VINF_SUCCESS;
+
+    RTSemFastMutexRequest(pIoUring->hMtxSubmit);
+
+    /*
+     * The completion queue has room for twice the number of submission queue
+     * entries, stick to the limit given at creation time so it can't overflow.
+     */
+    if ((size_t)ASMAtomicReadS32(&pCtxInt->cRequests) + cReqs > (size_t)pCtxInt->cRequestsMax)
+    {
+        rtFileAioLinuxReqsRevert(pahReqs, cReqs);
+        RTSemFastMutexRelease(pIoUring->hMtxSubmit);
+        return VERR_FILE_AIO_INSUFFICIENT_RESSOURCES;
+    }
+
+    while (cReqs)
+    {
+        /*
+         * Fill the submission queue, we're the only producer so the tail can
+         * be read without synchronization.
+         */
+        uint32_t const idxTailStart = *pIoUring->pidxSqTail;
+        uint32_t const cBatch       = (uint32_t)RT_MIN(cReqs, pIoUring->cSqEntries);
+        for (uint32_t i = 0; i < cBatch; i++)
+        {
+            uint32_t const idxSqe = (idxTailStart + i) & pIoUring->fSqMask;
+            rtFileAioLinuxIoUringSqeInit(pIoUring, &pIoUring->paSqes[idxSqe], pahReqs[i]);
+            pIoUring->paidxSqArray[idxSqe] = idxSqe;
+        }
+        ASMAtomicWriteU32(pIoUring->pidxSqTail, idxTailStart + cBatch);
+
+        /*
+         * Hand them to the kernel. Entries with bad parameters are consumed
+         * and complete with an error, so only resource shortage stops it early.
+         */
+        uint32_t cSubmitted = 0;
+        int rcEnter;
+        do
+        {
+            rcEnter = rtFileAsyncIoLinuxIoUringEnter(pIoUring->iFdRing, cBatch - cSubmitted, 0, 0);
+            cSubmitted = ASMAtomicReadU32(pIoUring->pidxSqHead) - idxTailStart;
+        } while (   cSubmitted < cBatch
+                 && (rcEnter > 0 || rcEnter == VERR_INTERRUPTED));
+
+        ASMAtomicAddS32(&pCtxInt->cRequests, cSubmitted);
+
+        if (cSubmitted < cBatch)
+        {
+            /*
+             * Take back the entries the kernel didn't consume. This is safe
+             * because it only looks at the queue in io_uring_enter() which is
+             * serialized by the mutex.
+             */
+            ASMAtomicWriteU32(pIoUring->pidxSqTail, idxTailStart + cSubmitted);
+            rtFileAioLinuxReqsRevert(&pahReqs[cSubmitted], cReqs - cSubmitted);
+
+            if (   rcEnter >= 0
+                || rcEnter == VERR_TRY_AGAIN
+                || rcEnter == VERR_RESOURCE_BUSY)
+                rc = VERR_FILE_AIO_INSUFFICIENT_RESSOURCES;
+            else
+            {
+                /* The first unsubmitted request failed. */
+                PRTFILEAIOREQINTERNAL pReqInt = pahReqs[cSubmitted];
+                RTFILEAIOREQ_SET_STATE(pReqInt, COMPLETED);
+                pReqInt->Rc = rcEnter;
+                pReqInt->cbTransfered = 0;
+                rc = rcEnter;
+            }
+            break;
+        }
+
+        /* Advance. */
+        cReqs   -= cBatch;
+        pahReqs += cBatch;
+    }
+
+    RTSemFastMutexRelease(pIoUring->hMtxSubmit);
+    return rc;
+}
+
+/**
+ * RTFileAioCtxWait worker for io_uring contexts.
+ *
+ * Completions are reaped directly from the completion queue, the kernel is
+ * only entered if not enough are there yet.
+ */
+static int rtFileAioLinuxIoUringWait(PRTFILEAIOCTXINTERNAL pCtxInt, size_t cMinReqs, RTMSINTERVAL cMillies,
+                                     PRTFILEAIOREQ pahReqs, size_t cReqs, uint32_t *pcReqs)
+{
+    PLNXIOURING pIoUring = &pCtxInt->IoUring;
+    uint64_t const MilliTSStart = cMillies != RT_INDEFINITE_WAIT ? RTTimeMilliTS() : 0;
+
+    /* Wait for at least one. */
+    if (!cMinReqs)
+        cMinReqs = 1;
+
+    /* For the wakeup call. */
+    Assert(pCtxInt->hThreadWait == NIL_RTTHREAD);
+    ASMAtomicWriteHandle(&pCtxInt->hThreadWait, RTThreadSelf());
+
+    int      rc = VINF_SUCCESS;
+    uint32_t cRequestsCompleted = 0;
+    while (!pCtxInt->fWokenUp)
+    {
+        /*
+         * Reap what is there, we're the only consumer.
+         */
+        uint32_t       idxHead = *pIoUring->pidxCqHead;
+        uint32_t const idxTail = ASMAtomicReadU32(pIoUring->pidxCqTail);
+        while (   idxHead != idxTail
+               && cRequestsCompleted < cReqs)
+        {
+            PLNXIOURINGCQE        pCqe    = &pIoUring->paCqes[idxHead & pIoUring->fCqMask];
+            PRTFILEAIOREQINTERNAL pReqInt = (PRTFILEAIOREQINTERNAL)(uintptr_t)pCqe->u64User;
+            AssertPtr(pReqInt);
+            Assert(pReqInt->u32Magic == RTFILEAIOREQ_MAGIC);
+
+            if (RT_UNLIKELY(pCqe->rcLnx < 0))
+                pReqInt->Rc = RTErrConvertFromErrno(-pCqe->rcLnx);
+            else
+            {
+                pReqInt->Rc = VINF_SUCCESS;
+                pReqInt->cbTransfered = pCqe->rcLnx;
+            }
+
+            /* Mark the request as finished. */
+            RTFILEAIOREQ_SET_STATE(pReqInt, COMPLETED);
+
+            pahReqs[cRequestsCompleted++] = (RTFILEAIOREQ)pReqInt;
+            idxHead++;
+        }
+        ASMAtomicWriteU32(pIoUring->pidxCqHead, idxHead);
+
+        if (cRequestsCompleted >= cMinReqs)
+            break;
+
+        /*
+         * Wait for more. io_uring_enter() only got a timeout with 5.11,
+         * so poll on the ring for the timed case.
+         */
+        int rcWait;
+        ASMAtomicXchgBool(&pCtxInt->fWaiting, true);
+        if (cMillies == RT_INDEFINITE_WAIT)
+            rcWait = rtFileAsyncIoLinuxIoUringEnter(pIoUring->iFdRing, 0, (uint32_t)(cMinReqs - cRequestsCompleted),
+                                                    LNXIOURING_ENTER_GETEVENTS);
+        else
+        {
+            uint64_t const cMilliesElapsed = RTTimeMilliTS() - MilliTSStart;
+            if (cMilliesElapsed >= cMillies)
+                rcWait = VERR_TIMEOUT;
+            else
+            {
+                struct pollfd PollFd;
+                PollFd.fd      = pIoUring->iFdRing;
+                PollFd.events  = POLLIN;
+                PollFd.revents = 0;
+                rcWait = poll(&PollFd, 1, (int)(cMillies - cMilliesElapsed));
+                if (rcWait == -1)
+                    rcWait = RTErrConvertFromErrno(errno);
+            }
+        }
+        ASMAtomicXchgBool(&pCtxInt->fWaiting, false);
+
+        /* Signals (RTFileAioCtxWakeup) just get us to check the wakeup flag again. */
+        if (    RT_FAILURE(rcWait)
+            &&  rcWait != VERR_INTERRUPTED)
+        {
+            rc = rcWait;
+            break;
+        }
+    }
+
+    /*
+     * Update the context state and set the return value.
+     */
+    *pcReqs = cRequestsCompleted;
+    ASMAtomicSubS32(&pCtxInt->cRequests, cRequestsCompleted);
+    Assert(pCtxInt->hThreadWait == RTThreadSelf());
+    ASMAtomicWriteHandle(&pCtxInt->hThreadWait, NIL_RTTHREAD);
+
+    /*
+     * Clear the wakeup flag and set rc.
+     */
+    if (    pCtxInt->fWokenUp
+        &&  RT_SUCCESS(rc))
+    {
+        ASMAtomicXchgBool(&pCtxInt->fWokenUp, false);
+        rc = VERR_INTERRUPTED;
+    }
+
+    return rc;
+}
+
 RTDECL(int) RTFileAioCtxSubmit(RTFILEAIOCTX hAioCtx, PRTFILEAIOREQ pahReqs, size_t cReqs)
 {
     int rc = VINF_SUCCESS;
@@ -584,6 +1316,9 @@ RTDECL(int) RTFileAioCtxSubmit(RTFILEAIOCTX hAioCtx, PRTFILEAIOREQ pahReqs, size
         RTFILEAIOREQ_SET_STATE(pReqInt, SUBMITTED);
     }
 
+    if (pCtxInt->fIoUring)
+        return rtFileAioLinuxIoUringSubmit(pCtxInt, pahReqs, cReqs);
+
     do
     {
         /*
@@ -660,6 +1395,9 @@ RTDECL(int) RTFileAioCtxWait(RTFILEAIOCTX hAioCtx, size_t cMinReqs, RTMSINTERVAL
     if (RT_UNLIKELY(ASMAtomicUoReadS32(&pCtxInt->cRequests) == 0))
         return VERR_FILE_AIO_NO_REQUEST;
 
+    if (pCtxInt->fIoUring)
+        return rtFileAioLinuxIoUringWait(pCtxInt, cMinReqs, cMillies, pahReqs, cReqs, pcReqs);
+
     /*
      * Convert the timeout if specified.
      */
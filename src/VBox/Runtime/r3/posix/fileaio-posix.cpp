@@ -313,6 +313,7 @@ RTR3DECL(int) RTFileAioGetLimits(PRTFILEAIOLIMITS pAioLimits)
 
     pAioLimits->cReqsOutstandingMax = cReqsOutstandingMax;
     pAioLimits->cbBufferAlignment   = 0;
+    pAioLimits->fBufferedIo         = true;
 #elif defined(RT_OS_FREEBSD)
     /*
      * The AIO API is implemented in a kernel module which is not
@@ -338,9 +339,11 @@ RTR3DECL(int) RTFileAioGetLimits(PRTFILEAIOLIMITS pAioLimits)
 
     pAioLimits->cReqsOutstandingMax = cReqsOutstandingMax;
     pAioLimits->cbBufferAlignment   = 0;
+    pAioLimits->fBufferedIo         = true;
 #else
     pAioLimits->cReqsOutstandingMax = RTFILEAIO_UNLIMITED_REQS;
     pAioLimits->cbBufferAlignment   = 0;
+    pAioLimits->fBufferedIo         = true;
 #endif
 
     return VINF_SUCCESS;
@@ -587,6 +590,17 @@ RTDECL(int) RTFileAioCtxAssociateWithFile(RTFILEAIOCTX hAioCtx, RTFILE hFile)
     return VINF_SUCCESS;
 }
 
+RTDECL(int) RTFileAioCtxRegisterBuffer(RTFILEAIOCTX hAioCtx, void *pvBuf, size_t cbBuf)
+{
+    PRTFILEAIOCTXINTERNAL pCtxInt = hAioCtx;
+    RTFILEAIOCTX_VALID_RETURN(pCtxInt);
+    AssertPtrReturn(pvBuf, VERR_INVALID_POINTER);
+    AssertReturn(cbBuf > 0, VERR_INVALID_PARAMETER);
+
+    /* Not supported, requests work without it. */
+    return VERR_NOT_SUPPORTED;
+}
+
 #ifdef LOG_ENABLED
 /**
  * Dumps the state of a async I/O context.
@@ -45,6 +45,7 @@
 #endif
 #ifdef RT_OS_LINUX
 # include <sys/file.h>
+# include <sys/syscall.h>
 #endif
 #if defined(RT_OS_OS2) && (!defined(__INNOTEK_LIBC__) || __INNOTEK_LIBC__ < 0x006)
 # include <io.h>
@@ -52,6 +53,7 @@
 
 #include <iprt/file.h>
 #include <iprt/path.h>
+#include <iprt/asm.h>
 #include <iprt/assert.h>
 #include <iprt/string.h>
 #include <iprt/err.h>
@@ -59,6 +61,9 @@
 #include "internal/file.h"
 #include "internal/fs.h"
 #include "internal/path.h"
+#ifdef RT_OS_LINUX
+# include "internal/fileaio.h"
+#endif
 
 
 
@@ -73,6 +78,49 @@
 #endif
 
 
+#ifdef RT_OS_LINUX
+/*******************************************************************************
+*   Global Variables                                                           *
+*******************************************************************************/
+/** Whether the host supports io_uring, -1 if not checked yet. */
+static int volatile g_fIoUringSupported = -1;
+
+
+/**
+ * Checks whether io_uring should be used for async file I/O, i.e. it was
+ * requested and the host kernel supports it.
+ *
+ * This lives here rather than with the async I/O code because RTFileOpen
+ * needs it to decide whether RTFILE_O_ASYNC_IO implies O_DIRECT.
+ *
+ * @returns true if io_uring should be used, false for io_submit.
+ */
+DECLHIDDEN(bool) rtFileAioLnxUseIoUring(void)
+{
+    if (!rtFileAioLnxIsIoUringRequested())
+        return false;
+
+    int32_t fSupported = ASMAtomicReadS32(&g_fIoUringSupported);
+    if (fSupported == -1)
+    {
+        uint32_t au32Params[30]; /* struct io_uring_params, 120 bytes. */
+        RT_ZERO(au32Params);
+        /* Older kernels charge the rings against RLIMIT_MEMLOCK on setup,
+           so probe with a ring of realistic size and not just a single entry. */
+        int iFdRing = syscall(__NR_io_uring_setup, RTFILEAIO_LNX_IOURING_PROBE_ENTRIES, &au32Params[0]);
+        if (iFdRing >= 0)
+            close(iFdRing);
+        else
+            LogRel(("RTFileAio: io_uring requested but not usable on the host (errno=%d), using io_submit\n", errno));
+        fSupported = iFdRing >= 0 ? 1 : 0;
+        ASMAtomicWriteS32(&g_fIoUringSupported, fSupported);
+    }
+
+    return fSupported == 1;
+}
+#endif
+
+
 RTDECL(bool) RTFileExists(const char *pszPath)
 {
     bool fRc = false;
@@ -143,8 +191,11 @@ RTR3DECL(int) RTFileOpen(PRTFILE pFile, const char *pszFilename, uint64_t fOpen)
         fOpenMode |= O_SYNC;
 #endif
 #if defined(O_DIRECT) && defined(RT_OS_LINUX)
-    /* O_DIRECT is mandatory to get async I/O working on Linux. */
-    if (fOpen & RTFILE_O_ASYNC_IO)
+    /* O_DIRECT is mandatory to get async I/O working with io_submit on Linux.
+       The io_uring backend handles buffered files as well, but only if the
+       host actually has it; otherwise we end up with io_submit. */
+    if (    (fOpen & RTFILE_O_ASYNC_IO)
+        &&  !rtFileAioLnxUseIoUring())
         fOpenMode |= O_DIRECT;
 #endif
 #if defined(O_DIRECT) && (defined(RT_OS_LINUX) || defined(RT_OS_FREEBSD))
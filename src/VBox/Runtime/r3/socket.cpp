@@ -45,6 +45,9 @@
 # include <unistd.h>
 # include <fcntl.h>
 # include <sys/uio.h>
+# ifdef RT_OS_LINUX
+#  include <sys/syscall.h>
+# endif
 #endif /* !RT_OS_WINDOWS */
 #include <limits.h>
 
@@ -107,6 +110,30 @@
 /** How many pending connection. */
 #define RTTCP_SERVER_BACKLOG    10
 
+/* recvmmsg and sendmmsg, invoked directly as older headers lack them. */
+#ifdef RT_OS_LINUX
+# ifndef __NR_recvmmsg
+#  if defined(RT_ARCH_AMD64)
+#   define __NR_recvmmsg        299
+#  elif defined(RT_ARCH_X86)
+#   define __NR_recvmmsg        337
+#  endif
+# endif
+# ifndef __NR_sendmmsg
+#  if defined(RT_ARCH_AMD64)
+#   define __NR_sendmmsg        307
+#  elif defined(RT_ARCH_X86)
+#   define __NR_sendmmsg        345
+#  endif
+# endif
+# if defined(__NR_recvmmsg) && defined(__NR_sendmmsg)
+#  define RTSOCKET_WITH_MMSG
+# endif
+#endif
+
+/** The max number of datagrams passed to one recvmmsg/sendmmsg call. */
+#define RTSOCKET_MMSG_BATCH     32
+
 
 /*******************************************************************************
 *   Structures and Typedefs                                                    *
@@ -150,6 +177,20 @@ typedef struct RTSOCKETINT
 } RTSOCKETINT;
 
 
+#ifdef RTSOCKET_WITH_MMSG
+/**
+ * The Linux struct mmsghdr.
+ */
+typedef struct RTSOCKETMMSGHDR
+{
+    /** The message header. */
+    struct msghdr       Hdr;
+    /** Number of bytes transmitted. */
+    unsigned int        cbXferred;
+} RTSOCKETMMSGHDR;
+#endif
+
+
 /**
  * Address union used internally for things like getpeername and getsockname.
  */
@@ -163,6 +204,12 @@ typedef union RTSOCKADDRUNION
 } RTSOCKADDRUNION;
 
 
+#ifdef RTSOCKET_WITH_MMSG
+/** Set if the kernel lacks recvmmsg/sendmmsg (ENOSYS). */
+static bool volatile g_fSocketNoMMsg = false;
+#endif
+
+
 /**
  * Get the last error as an iprt status code.
  *
@@ -885,6 +932,238 @@ RTDECL(int) RTSocketWriteTo(RTSOCKET hSocket, const void *pvBuffer, size_t cbBuf
 }
 
 
+RTDECL(int) RTSocketWriteToMulti(RTSOCKET hSocket, PCRTSGBUF paDatagrams, size_t cDatagrams, PCRTNETADDR pAddr,
+                                 size_t *pcSent)
+{
+    /*
+     * Validate input.
+     */
+    RTSOCKETINT *pThis = hSocket;
+    AssertPtrReturn(pThis, VERR_INVALID_HANDLE);
+    AssertReturn(pThis->u32Magic == RTSOCKET_MAGIC, VERR_INVALID_HANDLE);
+    AssertPtrReturn(paDatagrams, VERR_INVALID_POINTER);
+    AssertPtrNullReturn(pcSent, VERR_INVALID_POINTER);
+    if (pcSent)
+        *pcSent = 0;
+
+    /* no locking, same as RTSocketWriteTo. */
+
+    int rc = rtSocketSwitchBlockingMode(pThis, true /* fBlocking */);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    /* Figure out destination address. */
+    struct sockaddr *pSA = NULL;
+#ifdef RT_OS_WINDOWS
+    int cbSA = 0;
+#else
+    socklen_t cbSA = 0;
+#endif
+    RTSOCKADDRUNION u;
+    if (pAddr)
+    {
+        rc = rtSocketAddrFromNetAddr(pAddr, &u, sizeof(u));
+        if (RT_FAILURE(rc))
+            return rc;
+        pSA = &u.Addr;
+        cbSA = sizeof(u);
+    }
+
+    size_t cSent = 0;
+#ifdef RTSOCKET_WITH_MMSG
+    /*
+     * Hand the datagrams to the kernel in batches.  The segment arrays are
+     * passed thru as iovecs.
+     */
+    AssertCompileSize(struct iovec, sizeof(RTSGSEG));
+    AssertCompileMembersAtSameOffset(struct iovec, iov_base, RTSGSEG, pvSeg);
+    AssertCompileMembersAtSameOffset(struct iovec, iov_len,  RTSGSEG, cbSeg);
+    while (cSent < cDatagrams && !g_fSocketNoMMsg)
+    {
+        RTSOCKETMMSGHDR aMsgs[RTSOCKET_MMSG_BATCH];
+        unsigned const  cNow = (unsigned)RT_MIN(cDatagrams - cSent, RT_ELEMENTS(aMsgs));
+        for (unsigned i = 0; i < cNow; i++)
+        {
+            RT_ZERO(aMsgs[i]);
+            aMsgs[i].Hdr.msg_name    = pSA;
+            aMsgs[i].Hdr.msg_namelen = cbSA;
+            aMsgs[i].Hdr.msg_iov     = (struct iovec *)paDatagrams[cSent + i].paSegs;
+            aMsgs[i].Hdr.msg_iovlen  = paDatagrams[cSent + i].cSegs;
+        }
+        int cDone = syscall(__NR_sendmmsg, pThis->hNative, &aMsgs[0], cNow, MSG_NOSIGNAL);
+        if (cDone < 0)
+        {
+            if (errno == ENOSYS)
+                ASMAtomicWriteBool(&g_fSocketNoMMsg, true);
+            else
+                rc = rtSocketError();
+            break;
+        }
+        cSent += cDone;
+    }
+#endif
+
+    /*
+     * One datagram at a time.
+     */
+    while (RT_SUCCESS(rc) && cSent < cDatagrams)
+    {
+        PCRTSGBUF pSgBuf = &paDatagrams[cSent];
+#ifdef RT_OS_WINDOWS
+        /* Flatten multi-segment datagrams, they are rare here. */
+        size_t cbDatagram = 0;
+        for (unsigned i = 0; i < pSgBuf->cSegs; i++)
+            cbDatagram += pSgBuf->paSegs[i].cbSeg;
+        uint8_t *pbTmp = NULL;
+        const char *pchDatagram = (const char *)pSgBuf->paSegs[0].pvSeg;
+        if (pSgBuf->cSegs > 1)
+        {
+            pbTmp = (uint8_t *)RTMemTmpAlloc(cbDatagram);
+            if (!pbTmp)
+            {
+                rc = VERR_NO_TMP_MEMORY;
+                break;
+            }
+            size_t off = 0;
+            for (unsigned i = 0; i < pSgBuf->cSegs; i++)
+            {
+                memcpy(&pbTmp[off], pSgBuf->paSegs[i].pvSeg, pSgBuf->paSegs[i].cbSeg);
+                off += pSgBuf->paSegs[i].cbSeg;
+            }
+            pchDatagram = (const char *)pbTmp;
+        }
+        int cbWritten = sendto(pThis->hNative, pchDatagram, (int)cbDatagram, MSG_NOSIGNAL, pSA, cbSA);
+        RTMemTmpFree(pbTmp);
+        if (cbWritten < 0)
+            rc = rtSocketError();
+#else
+        struct msghdr MsgHdr;
+        RT_ZERO(MsgHdr);
+        MsgHdr.msg_name    = pSA;
+        MsgHdr.msg_namelen = cbSA;
+        MsgHdr.msg_iov     = (struct iovec *)pSgBuf->paSegs;
+        MsgHdr.msg_iovlen  = pSgBuf->cSegs;
+        if (sendmsg(pThis->hNative, &MsgHdr, MSG_NOSIGNAL) < 0)
+            rc = rtSocketError();
+#endif
+        else
+            cSent++;
+    }
+
+    if (pcSent)
+        *pcSent = cSent;
+    return rc;
+}
+
+
+RTDECL(int) RTSocketReadFromMulti(RTSOCKET hSocket, PCRTSGSEG paBuffers, size_t cBuffers, size_t *pacbRead, size_t *pcRead)
+{
+    /*
+     * Validate input.
+     */
+    RTSOCKETINT *pThis = hSocket;
+    AssertPtrReturn(pThis, VERR_INVALID_HANDLE);
+    AssertReturn(pThis->u32Magic == RTSOCKET_MAGIC, VERR_INVALID_HANDLE);
+    AssertReturn(cBuffers > 0, VERR_INVALID_PARAMETER);
+    AssertPtr(paBuffers);
+    AssertPtr(pacbRead);
+    AssertPtrReturn(pcRead, VERR_INVALID_POINTER);
+    *pcRead = 0;
+    AssertReturn(rtSocketTryLock(pThis), VERR_CONCURRENT_ACCESS);
+
+    /* The socket stays in blocking mode as it is shared with the writers,
+       MSG_DONTWAIT keeps us from blocking. */
+    int rc = rtSocketSwitchBlockingMode(pThis, true /* fBlocking */);
+    if (RT_FAILURE(rc))
+    {
+        rtSocketUnlock(pThis);
+        return rc;
+    }
+
+    size_t cRead = 0;
+    bool   fDone = false;
+#ifdef RTSOCKET_WITH_MMSG
+    if (!g_fSocketNoMMsg)
+    {
+        RTSOCKETMMSGHDR aMsgs[RTSOCKET_MMSG_BATCH];
+        struct iovec    aIovs[RTSOCKET_MMSG_BATCH];
+        fDone = true;
+        while (cRead < cBuffers)
+        {
+            unsigned const cNow = (unsigned)RT_MIN(cBuffers - cRead, RT_ELEMENTS(aMsgs));
+            for (unsigned i = 0; i < cNow; i++)
+            {
+                aIovs[i].iov_base = paBuffers[cRead + i].pvSeg;
+                aIovs[i].iov_len  = paBuffers[cRead + i].cbSeg;
+                RT_ZERO(aMsgs[i]);
+                aMsgs[i].Hdr.msg_iov    = &aIovs[i];
+                aMsgs[i].Hdr.msg_iovlen = 1;
+            }
+            rtSocketErrorReset();
+            int cGot = syscall(__NR_recvmmsg, pThis->hNative, &aMsgs[0], cNow, MSG_DONTWAIT, NULL);
+            if (cGot <= 0)
+            {
+                if (cGot < 0 && errno == ENOSYS && !cRead)
+                {
+                    ASMAtomicWriteBool(&g_fSocketNoMMsg, true);
+                    fDone = false;
+                }
+                else if (!cRead)
+                    rc = cGot < 0 ? rtSocketError() : VERR_TRY_AGAIN;
+                break;
+            }
+            for (int i = 0; i < cGot; i++)
+                pacbRead[cRead + i] = aMsgs[i].cbXferred;
+            cRead += cGot;
+            if ((unsigned)cGot < cNow)
+                break;
+        }
+    }
+#endif
+
+    /*
+     * One datagram at a time until we run dry.
+     */
+    while (!fDone && cRead < cBuffers)
+    {
+#ifdef MSG_DONTWAIT
+        int const fFlags = MSG_NOSIGNAL | MSG_DONTWAIT;
+#else
+        /* No per-call non-blocking flag (Windows), check that there is something first. */
+        int const fFlags = MSG_NOSIGNAL;
+        fd_set fdsetR;
+        FD_ZERO(&fdsetR);
+        FD_SET(pThis->hNative, &fdsetR);
+        struct timeval Timeout = { 0, 0 };
+        if (select((int)pThis->hNative + 1, &fdsetR, NULL, NULL, &Timeout) <= 0)
+        {
+            if (!cRead)
+                rc = VERR_TRY_AGAIN;
+            break;
+        }
+#endif
+        rtSocketErrorReset();
+#ifdef RT_OS_WINDOWS
+        int     cbNow  = paBuffers[cRead].cbSeg >= INT_MAX/2 ? INT_MAX/2 : (int)paBuffers[cRead].cbSeg;
+#else
+        size_t  cbNow  = paBuffers[cRead].cbSeg;
+#endif
+        ssize_t cbBytesRead = recvfrom(pThis->hNative, (char *)paBuffers[cRead].pvSeg, cbNow, fFlags, NULL, NULL);
+        if (cbBytesRead < 0)
+        {
+            if (!cRead)
+                rc = rtSocketError();
+            break;
+        }
+        pacbRead[cRead++] = cbBytesRead;
+    }
+
+    *pcRead = cRead;
+    rtSocketUnlock(pThis);
+    return rc;
+}
+
+
 RTDECL(int) RTSocketSgWrite(RTSOCKET hSocket, PCRTSGBUF pSgBuf)
 {
     /*
@@ -688,6 +688,72 @@ RTR3DECL(int) RTTcpServerListen2(PRTTCPSERVER pServer, PRTSOCKET phClientSocket)
 }
 
 
+/**
+ * Accepts an additional incoming connection while serving a client.
+ *
+ * @returns IPRT status code.
+ * @retval  VERR_TIMEOUT if no connection came in within @a cMillies.
+ * @retval  VERR_INVALID_STATE if not serving or the server was shut down.
+ *
+ * @param   pServer         The server handle as returned from RTTcpServerCreateEx().
+ * @param   cMillies        How long to wait for the connection.
+ * @param   phClientSocket  Where to return the socket handle to the client
+ *                          connection (on success only).  This must be closed
+ *                          by calling RTTcpServerDisconnectClient2().
+ */
+RTR3DECL(int) RTTcpServerAcceptExtra(PRTTCPSERVER pServer, RTMSINTERVAL cMillies, PRTSOCKET phClientSocket)
+{
+    /*
+     * Validate input and retain the instance.
+     */
+    AssertPtrReturn(phClientSocket, VERR_INVALID_HANDLE);
+    *phClientSocket = NIL_RTSOCKET;
+    AssertPtrReturn(pServer, VERR_INVALID_HANDLE);
+    AssertReturn(pServer->u32Magic == RTTCPSERVER_MAGIC, VERR_INVALID_HANDLE);
+    AssertReturn(RTMemPoolRetain(pServer) != UINT32_MAX, VERR_INVALID_HANDLE);
+
+    /*
+     * Get an extra reference to the server socket so RTTcpServerShutdown can
+     * close it while we're waiting.  The state is left alone, we're serving.
+     */
+    RTSOCKET hServerSocket;
+    ASMAtomicXchgHandle(&pServer->hServerSocket, NIL_RTSOCKET, &hServerSocket);
+    if (hServerSocket != NIL_RTSOCKET)
+    {
+        RTSocketRetain(hServerSocket);
+        ASMAtomicWriteHandle(&pServer->hServerSocket, hServerSocket);
+    }
+
+    int rc = VERR_INVALID_STATE;
+    if (   hServerSocket != NIL_RTSOCKET
+        && pServer->enmState == RTTCPSERVERSTATE_SERVING)
+    {
+        rc = RTSocketSelectOne(hServerSocket, cMillies);
+        if (RT_SUCCESS(rc))
+        {
+            struct sockaddr_in  RemoteAddr;
+            size_t              cbRemoteAddr = sizeof(RemoteAddr);
+            RTSOCKET            hClientSocket;
+            RT_ZERO(RemoteAddr);
+            rc = rtSocketAccept(hServerSocket, &hClientSocket, (struct sockaddr *)&RemoteAddr, &cbRemoteAddr);
+            if (RT_SUCCESS(rc))
+            {
+                RTSocketSetInheritance(hClientSocket, false /*fInheritable*/);
+                *phClientSocket = hClientSocket;
+            }
+        }
+        else if (   rc != VERR_TIMEOUT
+                 && pServer->enmState != RTTCPSERVERSTATE_SERVING)
+            rc = VERR_INVALID_STATE;
+    }
+    if (hServerSocket != NIL_RTSOCKET)
+        RTSocketRelease(hServerSocket);
+
+    RTMemPoolRelease(RTMEMPOOL_DEFAULT, pServer);
+    return rc;
+}
+
+
 /**
  * Terminate the open connection to the server.
  *
@@ -724,3 +724,51 @@ RTR3DECL(int)  RTUdpWrite(PRTUDPSERVER pServer, const void *pvBuffer, size_t cbB
     return rc;
 }
 
+
+RTR3DECL(int) RTUdpReadMulti(RTSOCKET Sock, PCRTSGSEG paBuffers, size_t cBuffers, size_t *pacbRead, size_t *pcRead)
+{
+    if (!RT_VALID_PTR(pacbRead) || !RT_VALID_PTR(pcRead))
+        return VERR_INVALID_POINTER;
+    return RTSocketReadFromMulti(Sock, paBuffers, cBuffers, pacbRead, pcRead);
+}
+
+
+RTR3DECL(int)  RTUdpWriteMulti(PRTUDPSERVER pServer, PCRTSGBUF paDatagrams, size_t cDatagrams,
+                               PCRTNETADDR pDstAddr, size_t *pcSent)
+{
+    /*
+     * Validate input and retain the instance.
+     */
+    AssertPtrReturn(pServer, VERR_INVALID_HANDLE);
+    AssertReturn(pServer->u32Magic == RTUDPSERVER_MAGIC, VERR_INVALID_HANDLE);
+    AssertReturn(RTMemPoolRetain(pServer) != UINT32_MAX, VERR_INVALID_HANDLE);
+    if (pcSent)
+        *pcSent = 0;
+
+    RTSOCKET hSocket;
+    ASMAtomicReadHandle(&pServer->hSocket, &hSocket);
+    if (hSocket == NIL_RTSOCKET)
+    {
+        RTMemPoolRelease(RTMEMPOOL_DEFAULT, pServer);
+        return VERR_INVALID_HANDLE;
+    }
+    RTSocketRetain(hSocket);
+
+    int rc = VINF_SUCCESS;
+    RTUDPSERVERSTATE enmState = pServer->enmState;
+    if (    enmState != RTUDPSERVERSTATE_CREATED
+        &&  enmState != RTUDPSERVERSTATE_STARTING
+        &&  enmState != RTUDPSERVERSTATE_WAITING
+        &&  enmState != RTUDPSERVERSTATE_RECEIVING
+        &&  enmState != RTUDPSERVERSTATE_STOPPING)
+        rc = VERR_INVALID_STATE;
+
+    if (RT_SUCCESS(rc))
+        rc = RTSocketWriteToMulti(hSocket, paDatagrams, cDatagrams, pDstAddr, pcSent);
+
+    RTSocketRelease(hSocket);
+    RTMemPoolRelease(RTMEMPOOL_DEFAULT, pServer);
+
+    return rc;
+}
+
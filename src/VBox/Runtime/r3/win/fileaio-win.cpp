@@ -127,6 +127,7 @@ RTR3DECL(int) RTFileAioGetLimits(PRTFILEAIOLIMITS pAioLimits)
     /* No limits known. */
     pAioLimits->cReqsOutstandingMax = RTFILEAIO_UNLIMITED_REQS;
     pAioLimits->cbBufferAlignment   = 0;
+    pAioLimits->fBufferedIo         = true;
 
     return VINF_SUCCESS;
 }
@@ -324,6 +325,17 @@ RTDECL(int) RTFileAioCtxAssociateWithFile(RTFILEAIOCTX hAioCtx, RTFILE hFile)
     return rc;
 }
 
+RTDECL(int) RTFileAioCtxRegisterBuffer(RTFILEAIOCTX hAioCtx, void *pvBuf, size_t cbBuf)
+{
+    PRTFILEAIOCTXINTERNAL pCtxInt = hAioCtx;
+    RTFILEAIOCTX_VALID_RETURN(pCtxInt);
+    AssertPtrReturn(pvBuf, VERR_INVALID_POINTER);
+    AssertReturn(cbBuf > 0, VERR_INVALID_PARAMETER);
+
+    /* Not supported, requests work without it. */
+    return VERR_NOT_SUPPORTED;
+}
+
 RTDECL(uint32_t) RTFileAioCtxGetMaxReqCount(RTFILEAIOCTX hAioCtx)
 {
     return RTFILEAIO_UNLIMITED_REQS;
@@ -30,6 +30,7 @@
 *******************************************************************************/
 #include <iprt/file.h>
 
+#include <iprt/env.h>
 #include <iprt/err.h>
 #include <iprt/mem.h>
 #include <iprt/param.h>
@@ -52,7 +53,8 @@ static RTTEST g_hTest = NIL_RTTEST;
 
 
 void tstFileAioTestReadWriteBasic(RTFILE File, bool fWrite, void *pvTestBuf,
-                                  size_t cbTestBuf, size_t cbTestFile, uint32_t cMaxReqsInFlight)
+                                  size_t cbTestBuf, size_t cbTestFile, uint32_t cMaxReqsInFlight,
+                                  bool fRegisterBuffers)
 {
     /* Allocate request array. */
     RTFILEAIOREQ *paReqs;
@@ -64,10 +66,17 @@ void tstFileAioTestReadWriteBasic(RTFILE File, bool fWrite, void *pvTestBuf,
     void **papvBuf = (void **)RTTestGuardedAllocHead(g_hTest, cMaxReqsInFlight * sizeof(void *));
     RTTESTI_CHECK_RETV(papvBuf);
 
-    /* Allocate the buffers*/
+    /* Allocate the buffers, one chunk if they should be registered with the context. */
+    uint8_t *pbBufReg = NULL;
+    if (fRegisterBuffers)
+        RTTESTI_CHECK_RC_OK_RETV(RTTestGuardedAlloc(g_hTest, cMaxReqsInFlight * cbTestBuf, PAGE_SIZE, true /*fHead*/,
+                                                    (void **)&pbBufReg));
     for (unsigned i = 0; i < cMaxReqsInFlight; i++)
     {
-        RTTESTI_CHECK_RC_OK_RETV(RTTestGuardedAlloc(g_hTest, cbTestBuf, PAGE_SIZE, true /*fHead*/, &papvBuf[i]));
+        if (pbBufReg)
+            papvBuf[i] = pbBufReg + i * cbTestBuf;
+        else
+            RTTESTI_CHECK_RC_OK_RETV(RTTestGuardedAlloc(g_hTest, cbTestBuf, PAGE_SIZE, true /*fHead*/, &papvBuf[i]));
         if (fWrite)
             memcpy(papvBuf[i], pvTestBuf, cbTestBuf);
         if (fWrite)
@@ -86,6 +95,13 @@ void tstFileAioTestReadWriteBasic(RTFILE File, bool fWrite, void *pvTestBuf,
     RTFILEAIOCTX hAioContext;
     RTTESTI_CHECK_RC_RETV(RTFileAioCtxCreate(&hAioContext, cMaxReqsInFlight), VINF_SUCCESS);
     RTTESTI_CHECK_RC_RETV(RTFileAioCtxAssociateWithFile(hAioContext, File), VINF_SUCCESS);
+    if (pbBufReg)
+    {
+        /* Not being able to register them (e.g. because of the locked memory limit) isn't fatal. */
+        int rc = RTFileAioCtxRegisterBuffer(hAioContext, pbBufReg, cMaxReqsInFlight * cbTestBuf);
+        if (RT_FAILURE(rc))
+            RTTestIPrintf(RTTESTLVL_ALWAYS, "RTFileAioCtxRegisterBuffer failed with %Rrc, continuing without\n", rc);
+    }
 
     /* Initialize requests. */
     for (unsigned i = 0; i < cMaxReqsInFlight; i++)
@@ -160,8 +176,11 @@ void tstFileAioTestReadWriteBasic(RTFILE File, bool fWrite, void *pvTestBuf,
     RTTestValue(g_hTest, "Throughput", SpeedKBs, RTTESTUNIT_KILOBYTES_PER_SEC);
 
     /* cleanup */
-    for (unsigned i = 0; i < cMaxReqsInFlight; i++)
-        RTTestGuardedFree(g_hTest, papvBuf[i]);
+    if (pbBufReg)
+        RTTestGuardedFree(g_hTest, pbBufReg);
+    else
+        for (unsigned i = 0; i < cMaxReqsInFlight; i++)
+            RTTestGuardedFree(g_hTest, papvBuf[i]);
     RTTestGuardedFree(g_hTest, papvBuf);
     for (unsigned i = 0; i < cMaxReqsInFlight; i++)
         RTTESTI_CHECK_RC(RTFileAioReqDestroy(paReqs[i]), VINF_SUCCESS);
@@ -169,6 +188,62 @@ void tstFileAioTestReadWriteBasic(RTFILE File, bool fWrite, void *pvTestBuf,
     RTTestGuardedFree(g_hTest, paReqs);
 }
 
+#ifdef RT_OS_LINUX
+/**
+ * Compares the io_submit and io_uring backends reading the test file.
+ */
+void tstFileAioBenchmarkLinux(const char *pszFile, void *pvTestBuf, size_t cbTestBuf, size_t cbTestFile,
+                              uint32_t cMaxReqsInFlight)
+{
+    static const struct
+    {
+        const char *pszName;
+        const char *pszBackend;
+        uint32_t    fOpen;
+        bool        fRegisterBuffers;
+    } s_aBackends[] =
+    {
+        { "io_submit",                      "kaio",     RTFILE_O_NO_CACHE, false },
+        { "io_uring",                       "io_uring", RTFILE_O_NO_CACHE, false },
+        { "io_uring, registered buffers",   "io_uring", RTFILE_O_NO_CACHE, true  },
+        { "io_uring, buffered",             "io_uring", 0,                 false },
+        { "io_uring, buffered, registered", "io_uring", 0,                 true  },
+    };
+
+    for (unsigned i = 0; i < RT_ELEMENTS(s_aBackends); i++)
+    {
+        RTTestSubF(g_hTest, "Benchmark: %s", s_aBackends[i].pszName);
+
+        /* The backend is selected when opening the file and creating the context. */
+        RTTESTI_CHECK_RC_OK(RTEnvSet("IPRT_FILE_AIO_BACKEND", s_aBackends[i].pszBackend));
+        RTFILEAIOLIMITS AioLimits;
+        RT_ZERO(AioLimits);
+        int rc = RTFileAioGetLimits(&AioLimits);
+        /* Only io_uring handles buffered files, so this tells whether it is available. */
+        if (   RT_FAILURE(rc)
+            || (!strcmp(s_aBackends[i].pszBackend, "io_uring") && !AioLimits.fBufferedIo))
+        {
+            RTTestIPrintf(RTTESTLVL_ALWAYS, "Backend not supported by the host, skipping\n");
+            continue;
+        }
+
+        RTFILE hFile;
+        RTTESTI_CHECK_RC(rc = RTFileOpen(&hFile, pszFile,
+                                         RTFILE_O_READ | RTFILE_O_OPEN | RTFILE_O_DENY_NONE | RTFILE_O_ASYNC_IO
+                                         | s_aBackends[i].fOpen),
+                         VINF_SUCCESS);
+        if (RT_SUCCESS(rc))
+        {
+            tstFileAioTestReadWriteBasic(hFile, false /*fWrite*/, pvTestBuf, cbTestBuf, cbTestFile, cMaxReqsInFlight,
+                                         s_aBackends[i].fRegisterBuffers);
+            RTFileClose(hFile);
+        }
+    }
+
+    RTEnvUnset("IPRT_FILE_AIO_BACKEND");
+}
+#endif
+
 int main()
 {
     int rc = RTTestInitAndCreate("tstRTFileAio", &g_hTest);
@@ -199,7 +274,8 @@ int main()
 
             /* Basic write test. */
             RTTestIPrintf(RTTESTLVL_ALWAYS, "Preparing test file, this can take some time and needs quite a bit of harddisk space...\n");
-            tstFileAioTestReadWriteBasic(hFile, true /*fWrite*/, pbTestBuf, TSTFILEAIO_BUFFER_SIZE, 100*_1M, cReqsMax);
+            tstFileAioTestReadWriteBasic(hFile, true /*fWrite*/, pbTestBuf, TSTFILEAIO_BUFFER_SIZE, 100*_1M, cReqsMax,
+                                         false /*fRegisterBuffers*/);
 
             /* Reopen the file before doing the next test. */
             RTTESTI_CHECK_RC(RTFileClose(hFile), VINF_SUCCESS);
@@ -211,11 +287,17 @@ int main()
                                  VINF_SUCCESS);
                 if (RT_SUCCESS(rc))
                 {
-                    tstFileAioTestReadWriteBasic(hFile, false /*fWrite*/, pbTestBuf, TSTFILEAIO_BUFFER_SIZE, 100*_1M, cReqsMax);
+                    tstFileAioTestReadWriteBasic(hFile, false /*fWrite*/, pbTestBuf, TSTFILEAIO_BUFFER_SIZE, 100*_1M, cReqsMax,
+                                                 false /*fRegisterBuffers*/);
                     RTFileClose(hFile);
                 }
             }
 
+#ifdef RT_OS_LINUX
+            if (RTTestErrorCount(g_hTest) == 0)
+                tstFileAioBenchmarkLinux("tstFileAio#1.tst", pbTestBuf, TSTFILEAIO_BUFFER_SIZE, 100*_1M, cReqsMax);
+#endif
+
             /* Cleanup */
             RTFileDelete("tstFileAio#1.tst");
         }
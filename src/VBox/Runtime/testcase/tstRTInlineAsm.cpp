@@ -44,6 +44,7 @@
 #else
 # include <iprt/time.h>
 #endif
+#include <iprt/mem.h>
 #include <iprt/stream.h>
 #include <iprt/string.h>
 #include <iprt/param.h>
@@ -1162,6 +1163,72 @@ void tstASMMemIsZeroPage(RTTEST hTest)
 }
 
 
+static DECLCALLBACK(bool) tstASMMemIsZeroWrapper(void const *pv, size_t cb)
+{
+    return ASMMemIsZero(pv, cb);
+}
+
+
+static DECLCALLBACK(bool) tstRTMemIsZeroWrapper(void const *pv, size_t cb)
+{
+    return RTMemIsZero(pv, cb);
+}
+
+
+void tstASMMemIsZero(RTTEST hTest)
+{
+    static struct
+    {
+        const char *pszName;
+        DECLCALLBACKMEMBER(bool, pfnIsZero)(void const *pv, size_t cb);
+    } const s_aFunctions[] =
+    {
+        { "ASMMemIsZero",   tstASMMemIsZeroWrapper },
+        { "RTMemIsZero",    tstRTMemIsZeroWrapper },
+    };
+
+    /* Use a guarded tail allocation so reading beyond the block faults. */
+    uint8_t *pbPage = (uint8_t *)RTTestGuardedAllocTail(hTest, PAGE_SIZE);
+    RTTESTI_CHECK_RETV(pbPage);
+    memset(pbPage, 0, PAGE_SIZE);
+
+    static const size_t s_acbBlocks[] = { 0, 1, 15, 16, 17, 63, 64, 65, 127, 128, 129, 512, 1000, PAGE_SIZE };
+    for (unsigned iFn = 0; iFn < RT_ELEMENTS(s_aFunctions); iFn++)
+    {
+        RTTestSub(hTest, s_aFunctions[iFn].pszName);
+        for (unsigned i = 0; i < RT_ELEMENTS(s_acbBlocks); i++)
+            for (unsigned offAlign = 0; offAlign < 16 && offAlign + s_acbBlocks[i] <= PAGE_SIZE; offAlign++)
+            {
+                size_t const   cb = s_acbBlocks[i];
+                uint8_t       *pb = &pbPage[PAGE_SIZE - cb - offAlign];
+
+                RTTESTI_CHECK(s_aFunctions[iFn].pfnIsZero(pb, cb));
+                for (size_t off = 0; off < cb; off++)
+                {
+                    pb[off] = 0x80;
+                    RTTESTI_CHECK(!s_aFunctions[iFn].pfnIsZero(pb, cb));
+                    pb[off] = 0;
+                }
+
+                /* Data outside the block must not be looked at. */
+                if (pb > pbPage)
+                {
+                    pb[-1] = 1;
+                    RTTESTI_CHECK(s_aFunctions[iFn].pfnIsZero(pb, cb));
+                    pb[-1] = 0;
+                }
+                if (offAlign)
+                {
+                    pb[cb] = 1;
+                    RTTESTI_CHECK(s_aFunctions[iFn].pfnIsZero(pb, cb));
+                    pb[cb] = 0;
+                }
+            }
+        RTTestSubDone(hTest);
+    }
+}
+
+
 void tstASMMemZero32(void)
 {
     RTTestSub(g_hTest, "ASMMemFill32");
@@ -1541,6 +1608,7 @@ int main(int argc, char *argv[])
 
     tstASMMemZeroPage();
     tstASMMemIsZeroPage(g_hTest);
+    tstASMMemIsZero(g_hTest);
     tstASMMemZero32();
     tstASMMemFill32();
 
@@ -0,0 +1,170 @@
+/* $Id: tstRTNetIPv4-1.cpp $ */
+/** @file
+ * IPRT Testcase - IPv4 data checksum.
+ */
+
+/*
+ * Copyright (C) 2012 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ *
+ * The contents of this file may alternatively be used under the terms
+ * of the Common Development and Distribution License Version 1.0
+ * (CDDL) only, as it comes in the "COPYING.CDDL" file of the
+ * VirtualBox OSE distribution, in which case the provisions of the
+ * CDDL are applicable instead of those of the GPL.
+ *
+ * You may elect to license modified versions of this file under the
+ * terms and conditions of either the GPL or the CDDL or both.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include <iprt/net.h>
+
+#include <iprt/rand.h>
+#include <iprt/string.h>
+#include <iprt/test.h>
+#include <iprt/time.h>
+
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** The largest block checksummed, the maximum size of an IPv4 packet. */
+#define TST_CB_MAX              _64K
+/** The number of bytes checksummed by each benchmark run. */
+#define TST_CB_BENCH            (_1G / 4)
+
+
+/*******************************************************************************
+*   Global Variables                                                           *
+*******************************************************************************/
+static RTTEST   g_hTest;
+/** The test data, with some slack for misaligning it. */
+static uint8_t  g_abData[TST_CB_MAX + 64];
+
+
+/**
+ * The plain word by word reference implementation.
+ */
+static uint16_t tstRefChecksum(uint8_t const *pb, size_t cb)
+{
+    uint32_t u32Sum = 0;
+    while (cb > 1)
+    {
+        u32Sum += RT_MAKE_U16(pb[0], pb[1]);
+        pb += 2;
+        cb -= 2;
+    }
+    if (cb)
+        u32Sum += pb[0];
+    while (u32Sum >> 16)
+        u32Sum = (u32Sum >> 16) + (u32Sum & 0xffff);
+    return (uint16_t)~u32Sum;
+}
+
+
+/**
+ * Checksums a block in two pieces split at @a offSplit.
+ */
+static uint16_t tstSplitChecksum(uint8_t const *pb, size_t cb, size_t offSplit)
+{
+    bool     fOdd   = false;
+    uint32_t u32Sum = RTNetIPv4AddDataChecksum(pb, offSplit, 0, &fOdd);
+    u32Sum = RTNetIPv4AddDataChecksum(pb + offSplit, cb - offSplit, u32Sum, &fOdd);
+    return RTNetIPv4FinalizeChecksum(u32Sum);
+}
+
+
+static void tstCorrectness(void)
+{
+    RTTestSub(g_hTest, "Correctness");
+
+    /* Random lengths, alignments and split points. */
+    for (unsigned i = 0; i < _64K; i++)
+    {
+        size_t const off      = RTRandU32Ex(0, 15);
+        size_t const cb       = i < 256 ? RTRandU32Ex(0, TST_CB_MAX) : RTRandU32Ex(0, 2048);
+        size_t const offSplit = RTRandU32Ex(0, (uint32_t)cb);
+        uint16_t const u16Ref = tstRefChecksum(&g_abData[off], cb);
+        uint16_t const u16Sum = tstSplitChecksum(&g_abData[off], cb, offSplit);
+        if (u16Sum != u16Ref)
+        {
+            RTTestFailed(g_hTest, "off=%zu cb=%zu offSplit=%zu: %#06x, expected %#06x", off, cb, offSplit, u16Sum, u16Ref);
+            break;
+        }
+    }
+
+    /* All ones must not wrap to zero (carry propagation). */
+    uint8_t *pbOnes = (uint8_t *)RTTestGuardedAllocTail(g_hTest, TST_CB_MAX);
+    RTTESTI_CHECK_RETV(pbOnes);
+    memset(pbOnes, 0xff, TST_CB_MAX);
+    RTTESTI_CHECK(tstSplitChecksum(pbOnes, TST_CB_MAX, 0) == tstRefChecksum(pbOnes, TST_CB_MAX));
+    RTTESTI_CHECK(tstSplitChecksum(pbOnes, TST_CB_MAX - 1, 1) == tstRefChecksum(pbOnes, TST_CB_MAX - 1));
+    RTTESTI_CHECK(tstSplitChecksum(pbOnes + 1, TST_CB_MAX - 1, 333) == tstRefChecksum(pbOnes + 1, TST_CB_MAX - 1));
+    RTTestGuardedFree(g_hTest, pbOnes);
+
+    /* The empty block leaves the odd state alone. */
+    bool fOdd = true;
+    RTTESTI_CHECK(RTNetIPv4AddDataChecksum(g_abData, 0, 0x1234, &fOdd) == 0x1234);
+    RTTESTI_CHECK(fOdd);
+}
+
+
+static void tstBenchmark(void)
+{
+    RTTestSub(g_hTest, "Benchmark");
+
+    static size_t const s_acbSizes[] = { 64, 256, 1514, 4096, 16384, TST_CB_MAX };
+    for (unsigned i = 0; i < RT_ELEMENTS(s_acbSizes); i++)
+    {
+        size_t const   cb     = s_acbSizes[i];
+        uint32_t const cIters = (uint32_t)(TST_CB_BENCH / cb);
+        uint32_t       uDummy = 0;
+
+        uint64_t nsStart = RTTimeNanoTS();
+        for (uint32_t iIter = 0; iIter < cIters; iIter++)
+        {
+            bool fOdd = false;
+            uDummy += RTNetIPv4AddDataChecksum(&g_abData[iIter & 1], cb, 0, &fOdd);
+        }
+        uint64_t nsElapsed = RT_MAX(RTTimeNanoTS() - nsStart, 1);
+        RTTestValueF(g_hTest, (uint64_t)cIters * cb * RT_NS_1SEC / nsElapsed / _1M, RTTESTUNIT_MEGABYTES_PER_SEC,
+                     "%zu bytes", cb);
+
+        nsStart = RTTimeNanoTS();
+        for (uint32_t iIter = 0; iIter < cIters; iIter++)
+            uDummy += tstRefChecksum(&g_abData[iIter & 1], cb);
+        nsElapsed = RT_MAX(RTTimeNanoTS() - nsStart, 1);
+        RTTestValueF(g_hTest, (uint64_t)cIters * cb * RT_NS_1SEC / nsElapsed / _1M, RTTESTUNIT_MEGABYTES_PER_SEC,
+                     "%zu bytes, reference", cb);
+
+        RTTestPrintf(g_hTest, RTTESTLVL_DEBUG, "dummy=%#x\n", uDummy);
+    }
+}
+
+
+int main()
+{
+    RTEXITCODE rcExit = RTTestInitAndCreate("tstRTNetIPv4-1", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+    RTRandBytes(g_abData, sizeof(g_abData));
+
+    tstCorrectness();
+    tstBenchmark();
+
+    return RTTestSummaryAndDestroy(g_hTest);
+}
+
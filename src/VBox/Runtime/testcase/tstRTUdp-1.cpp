@@ -0,0 +1,273 @@
+/* $Id: tstRTUdp-1.cpp $ */
+/** @file
+ * IPRT Testcase - UDP batched send and receive.
+ */
+
+/*
+ * Copyright (C) 2012 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ *
+ * The contents of this file may alternatively be used under the terms
+ * of the Common Development and Distribution License Version 1.0
+ * (CDDL) only, as it comes in the "COPYING.CDDL" file of the
+ * VirtualBox OSE distribution, in which case the provisions of the
+ * CDDL are applicable instead of those of the GPL.
+ *
+ * You may elect to license modified versions of this file under the
+ * terms and conditions of either the GPL or the CDDL or both.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include <iprt/udp.h>
+
+#include <iprt/asm.h>
+#include <iprt/err.h>
+#include <iprt/string.h>
+#include <iprt/test.h>
+#include <iprt/thread.h>
+#include <iprt/time.h>
+
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** The port the receiver listens on. */
+#define TST_PORT_RECV           52110
+/** The port the sender is bound to. */
+#define TST_PORT_SEND           52111
+/** The datagram size used for the benchmark. */
+#define TST_CB_DATAGRAM         1400
+/** The number of datagrams sent by each benchmark run. */
+#define TST_BENCH_DATAGRAMS     100000
+/** Datagrams per batch. */
+#define TST_BATCH               32
+
+
+/*******************************************************************************
+*   Global Variables                                                           *
+*******************************************************************************/
+static RTTEST               g_hTest;
+/** Number of datagrams received. */
+static uint32_t volatile    g_cReceived;
+/** Number of bad datagrams received. */
+static uint32_t volatile    g_cBad;
+
+
+/**
+ * Fills a datagram with a pattern derived from its sequence number.
+ */
+static void tstFill(uint8_t *pb, size_t cb, uint32_t uSeq)
+{
+    memcpy(pb, &uSeq, sizeof(uSeq));
+    memset(pb + sizeof(uSeq), (uint8_t)uSeq, cb - sizeof(uSeq));
+}
+
+
+/**
+ * Checks a received datagram against the pattern.
+ */
+static bool tstCheck(uint8_t const *pb, size_t cb)
+{
+    if (cb < sizeof(uint32_t))
+        return false;
+    uint32_t uSeq;
+    memcpy(&uSeq, pb, sizeof(uSeq));
+    for (size_t off = sizeof(uSeq); off < cb; off++)
+        if (pb[off] != (uint8_t)uSeq)
+            return false;
+    return true;
+}
+
+
+static DECLCALLBACK(int) tstReceiver(RTSOCKET hSocket, void *pvUser)
+{
+    static uint8_t s_abBufs[TST_BATCH][2048];
+    RTSGSEG aSegs[TST_BATCH];
+    size_t  acbRead[TST_BATCH];
+    for (unsigned i = 0; i < TST_BATCH; i++)
+    {
+        aSegs[i].pvSeg = &s_abBufs[i][0];
+        aSegs[i].cbSeg = sizeof(s_abBufs[i]);
+    }
+
+    size_t cRead = 0;
+    int rc = RTUdpReadMulti(hSocket, aSegs, TST_BATCH, acbRead, &cRead);
+    if (rc == VERR_INVALID_HANDLE)
+        return VERR_UDP_SERVER_STOP;
+    if (RT_SUCCESS(rc))
+    {
+        for (size_t i = 0; i < cRead; i++)
+            if (!tstCheck(&s_abBufs[i][0], acbRead[i]))
+                ASMAtomicIncU32(&g_cBad);
+        ASMAtomicAddU32(&g_cReceived, (uint32_t)cRead);
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Waits for the receiver to see @a cExpected datagrams or to go quiet.
+ */
+static uint32_t tstWaitForReceiver(uint32_t cExpected)
+{
+    uint32_t cPrev  = UINT32_MAX;
+    uint64_t msLast = RTTimeMilliTS();
+    for (;;)
+    {
+        uint32_t cNow = ASMAtomicReadU32(&g_cReceived);
+        if (cNow >= cExpected)
+            return cNow;
+        if (cNow != cPrev)
+        {
+            cPrev  = cNow;
+            msLast = RTTimeMilliTS();
+        }
+        else if (RTTimeMilliTS() - msLast > 1000)
+            return cNow;
+        RTThreadSleep(10);
+    }
+}
+
+
+/* * * * * * * *   Test 2    * * * * * * * */
+
+static void test2(PRTUDPSERVER pSender, PCRTNETADDR pDstAddr)
+{
+    RTTestSub(g_hTest, "Loopback throughput");
+
+    static uint8_t s_abDatagrams[TST_BATCH][TST_CB_DATAGRAM];
+    RTSGSEG aSegs[TST_BATCH];
+    RTSGBUF aDatagrams[TST_BATCH];
+    for (unsigned i = 0; i < TST_BATCH; i++)
+    {
+        tstFill(&s_abDatagrams[i][0], TST_CB_DATAGRAM, i);
+        aSegs[i].pvSeg = &s_abDatagrams[i][0];
+        aSegs[i].cbSeg = TST_CB_DATAGRAM;
+        RTSgBufInit(&aDatagrams[i], &aSegs[i], 1);
+    }
+
+    /*
+     * One datagram per call.
+     */
+    ASMAtomicWriteU32(&g_cReceived, 0);
+    uint64_t nsStart = RTTimeNanoTS();
+    for (uint32_t i = 0; i < TST_BENCH_DATAGRAMS; i++)
+        RTTESTI_CHECK_RC_BREAK(RTUdpWrite(pSender, &s_abDatagrams[i % TST_BATCH][0], TST_CB_DATAGRAM, pDstAddr), VINF_SUCCESS);
+    uint64_t nsElapsed = RTTimeNanoTS() - nsStart;
+    RTTestValue(g_hTest, "Single sent", (uint64_t)TST_BENCH_DATAGRAMS * RT_NS_1SEC / RT_MAX(nsElapsed, 1),
+                RTTESTUNIT_PACKETS_PER_SEC);
+    RTTestValue(g_hTest, "Single received", tstWaitForReceiver(TST_BENCH_DATAGRAMS), RTTESTUNIT_PACKETS);
+
+    /*
+     * Batches.
+     */
+    ASMAtomicWriteU32(&g_cReceived, 0);
+    nsStart = RTTimeNanoTS();
+    for (uint32_t i = 0; i < TST_BENCH_DATAGRAMS; i += TST_BATCH)
+    {
+        size_t cSent = 0;
+        RTTESTI_CHECK_RC_BREAK(RTUdpWriteMulti(pSender, aDatagrams, RT_MIN(TST_BATCH, TST_BENCH_DATAGRAMS - i), pDstAddr, &cSent),
+                               VINF_SUCCESS);
+        RTTESTI_CHECK_BREAK(cSent == RT_MIN(TST_BATCH, TST_BENCH_DATAGRAMS - i));
+    }
+    nsElapsed = RTTimeNanoTS() - nsStart;
+    RTTestValue(g_hTest, "Batched sent", (uint64_t)TST_BENCH_DATAGRAMS * RT_NS_1SEC / RT_MAX(nsElapsed, 1),
+                RTTESTUNIT_PACKETS_PER_SEC);
+    RTTestValue(g_hTest, "Batched received", tstWaitForReceiver(TST_BENCH_DATAGRAMS), RTTESTUNIT_PACKETS);
+
+    RTTESTI_CHECK(ASMAtomicReadU32(&g_cBad) == 0);
+}
+
+
+/* * * * * * * *   Test 1    * * * * * * * */
+
+static void test1(PRTUDPSERVER pSender, PCRTNETADDR pDstAddr)
+{
+    RTTestSub(g_hTest, "Batched send and receive");
+
+    /*
+     * Send two batches, with every other datagram in two pieces.
+     */
+    static uint8_t s_abDatagrams[2 * TST_BATCH][512];
+    RTSGSEG aSegs[TST_BATCH][2];
+    RTSGBUF aDatagrams[TST_BATCH];
+
+    ASMAtomicWriteU32(&g_cReceived, 0);
+    for (unsigned iBatch = 0; iBatch < 2; iBatch++)
+    {
+        for (unsigned i = 0; i < TST_BATCH; i++)
+        {
+            unsigned const iDatagram = iBatch * TST_BATCH + i;
+            size_t   const cb        = 64 + iDatagram * 7;
+            uint8_t       *pb        = &s_abDatagrams[iDatagram][0];
+            tstFill(pb, cb, iDatagram);
+            if (i & 1)
+            {
+                aSegs[i][0].pvSeg = pb;
+                aSegs[i][0].cbSeg = 20;
+                aSegs[i][1].pvSeg = pb + 20;
+                aSegs[i][1].cbSeg = cb - 20;
+                RTSgBufInit(&aDatagrams[i], &aSegs[i][0], 2);
+            }
+            else
+            {
+                aSegs[i][0].pvSeg = pb;
+                aSegs[i][0].cbSeg = cb;
+                RTSgBufInit(&aDatagrams[i], &aSegs[i][0], 1);
+            }
+        }
+
+        size_t cSent = 0;
+        RTTESTI_CHECK_RC_RETV(RTUdpWriteMulti(pSender, aDatagrams, TST_BATCH, pDstAddr, &cSent), VINF_SUCCESS);
+        RTTESTI_CHECK_RETV(cSent == TST_BATCH);
+    }
+
+    RTTESTI_CHECK(tstWaitForReceiver(2 * TST_BATCH) == 2 * TST_BATCH);
+    RTTESTI_CHECK(ASMAtomicReadU32(&g_cBad) == 0);
+}
+
+
+int main()
+{
+    RTEXITCODE rcExit = RTTestInitAndCreate("tstRTUdp-1", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+    PRTUDPSERVER pReceiver;
+    int rc = RTUdpServerCreate("127.0.0.1", TST_PORT_RECV, RTTHREADTYPE_IO, "receiver", tstReceiver, NULL, &pReceiver);
+    if (RT_SUCCESS(rc))
+    {
+        PRTUDPSERVER pSender;
+        rc = RTUdpServerCreateEx("127.0.0.1", TST_PORT_SEND, &pSender);
+        if (RT_SUCCESS(rc))
+        {
+            RTNETADDR DstAddr;
+            RTTESTI_CHECK_RC(rc = RTSocketParseInetAddress("127.0.0.1", TST_PORT_RECV, &DstAddr), VINF_SUCCESS);
+            if (RT_SUCCESS(rc))
+            {
+                test1(pSender, &DstAddr);
+                test2(pSender, &DstAddr);
+            }
+            RTTESTI_CHECK_RC(RTUdpServerDestroy(pSender), VINF_SUCCESS);
+        }
+        else
+            RTTestFailed(g_hTest, "RTUdpServerCreateEx -> %Rrc", rc);
+        RTTESTI_CHECK_RC(RTUdpServerDestroy(pReceiver), VINF_SUCCESS);
+    }
+    else
+        RTTestFailed(g_hTest, "RTUdpServerCreate -> %Rrc", rc);
+
+    return RTTestSummaryAndDestroy(g_hTest);
+}
+
@@ -1439,5 +1439,9 @@ VBOXHDDBACKEND g_RawBackend =
     /* pfnCompact */
     NULL,
     /* pfnResize */
+    NULL,
+    /* pfnDiscard */
+    NULL,
+    /* pfnAsyncDiscard */
     NULL
 };
@@ -27,6 +27,11 @@
 #include <iprt/alloc.h>
 #include <iprt/file.h>
 #include <iprt/asm.h>
+#include <iprt/avl.h>
+#include <iprt/critsect.h>
+#include <iprt/list.h>
+#include <iprt/string.h>
+#include <iprt/uuid.h>
 
 /*******************************************************************************
 * On disk data structures                                                      *
@@ -103,11 +108,13 @@ AssertCompileSize(VciHdr, 2 * VCI_BLOCK_SIZE);
 #pragma pack(1)
 typedef struct VciCacheExtent
 {
-    /** Block address of the previous extent in the LRU list. */
+    /** First block of cached data of the previous extent in the LRU list
+     * (more recently used), VCI_CACHE_EXTENT_NIL if there is none. */
     uint64_t    u64ExtentPrev;
-    /** Block address of the next extent in the LRU list. */
+    /** First block of cached data of the next extent in the LRU list
+     * (less recently used), VCI_CACHE_EXTENT_NIL if there is none. */
     uint64_t    u64ExtentNext;
-    /** Flags (for compression, encryption etc.) - currently unused and should be always 0. */
+    /** Flags, see VCI_CACHE_EXTENT_FLAGS_*. */
     uint8_t     u8Flags;
     /** Reserved */
     uint8_t     u8Reserved;
@@ -121,6 +128,14 @@ typedef struct VciCacheExtent
 #pragma pack()
 AssertCompileSize(VciCacheExtent, 38);
 
+/** Marks the end of the LRU list. */
+#define VCI_CACHE_EXTENT_NIL          UINT64_MAX
+/** Extent flag: The cached data is newer than the data in the image and
+ * must be written back before the extent can be evicted. */
+#define VCI_CACHE_EXTENT_FLAGS_DIRTY  UINT8_C(0x01)
+/** Maximum number of blocks an extent can represent. */
+#define VCI_CACHE_EXTENT_BLOCKS_MAX   UINT32_MAX
+
 /**
  * On disk representation of an internal node.
  *
@@ -131,7 +146,7 @@ typedef struct VciTreeNodeInternal
 {
     /** First block of cached data the internal node represents. */
     uint64_t    u64BlockOffset;
-    /** Number of blocks the internal node represents. */
+    /** Number of blocks the internal node represents, clipped to UINT32_MAX. */
     uint32_t    u32Blocks;
     /** Block address in the image where the next node in the tree is stored. */
     uint64_t    u64ChildAddr;
@@ -164,6 +179,10 @@ AssertCompileSize(VciTreeNode, 8 * VCI_BLOCK_SIZE);
 #define VCI_TREE_EXTENTS_PER_NODE        ((sizeof(VciTreeNode)-1) / sizeof(VciCacheExtent))
 /** Number of internal nodes managed by one tree node. */
 #define VCI_TREE_INTERNAL_NODES_PER_NODE ((sizeof(VciTreeNode)-1) / sizeof(VciTreeNodeInternal))
+/** Size of a tree node in blocks. */
+#define VCI_TREE_NODE_BLOCKS             VCI_BYTE2BLOCK(sizeof(VciTreeNode))
+/** Maximum depth of the tree accepted when loading it. */
+#define VCI_TREE_DEPTH_MAX               16
 
 /**
  * VCI block bitmap header.
@@ -199,6 +218,12 @@ AssertCompileSize(VciBlkMap, VCI_BLOCK_SIZE);
 /** Block bitmap entry */
 typedef uint8_t VciBlkMapEnt;
 
+/** Size of the block map on the disk in blocks for the given number of blocks,
+ * including the header. */
+#define VCI_BLKMAP_BLOCKS(cBlocks) \
+    ((uint32_t)(  VCI_BYTE2BLOCK(RT_ALIGN_64(((cBlocks) + 7) / 8, VCI_BLOCK_SIZE)) \
+                + VCI_BYTE2BLOCK(sizeof(VciBlkMap))))
+
 /*******************************************************************************
 *   Constants And Macros, Structures and Typedefs                              *
 *******************************************************************************/
@@ -208,6 +233,8 @@ typedef uint8_t VciBlkMapEnt;
  */
 typedef struct VCIBLKRANGEDESC
 {
+    /** AVL tree node, the key range covers the blocks of the range. */
+    AVLRU64NODECORE            Core;
     /** Previous entry in the list. */
     struct VCIBLKRANGEDESC    *pPrev;
     /** Next entry in the list. */
@@ -233,97 +260,66 @@ typedef struct VCIBLKMAP
     uint64_t     cBlocksAllocData;
     /** Number of free blocks. */
     uint64_t     cBlocksFree;
+    /** Number of B+-Tree nodes which fit into the free ranges. */
+    uint64_t     cNodesFree;
 
     /** Pointer to the head of the block range list. */
     PVCIBLKRANGEDESC pRangesHead;
     /** Pointer to the tail of the block range list. */
     PVCIBLKRANGEDESC pRangesTail;
+    /** Range descriptors for quick lookups by block address. */
+    AVLRU64TREE      TreeRanges;
+    /** The range the next allocation starts searching at (next fit). */
+    PVCIBLKRANGEDESC pRangeNextFit;
 
 } VCIBLKMAP;
 /** Pointer to a block map. */
 typedef VCIBLKMAP *PVCIBLKMAP;
 
-/**
- * B+-Tree node header.
- */
-typedef struct VCITREENODE
-{
-    /** Type of the node (VCI_TREE_NODE_TYPE_*). */
-    uint8_t             u8Type;
-    /** Block address where the node is stored. */
-    uint64_t            u64BlockAddr;
-    /** Pointer to the parent. */
-    struct VCITREENODE *pParent;
-} VCITREENODE, *PVCITREENODE;
-
-/**
- * B+-Tree node pointer.
- */
-typedef struct VCITREENODEPTR
-{
-    /** Flag whether the node is in memory or still on the disk. */
-    bool         fInMemory;
-    /** Type dependent data. */
-    union
-    {
-        /** Pointer to a in memory node. */
-        PVCITREENODE pNode;
-        /** Start block address of the node. */
-        uint64_t     offAddrBlockNode;
-    } u;
-} VCITREENODEPTR, *PVCITREENODEPTR;
+/** Number of B+-Tree nodes which fit into the given block range. */
+#define VCI_BLKRANGE_NODES(pRange) ((pRange)->fFree ? (pRange)->cBlocks / VCI_TREE_NODE_BLOCKS : 0)
 
 /**
- * Internal node.
+ * Block range.
  */
-typedef struct VCINODEINTERNAL
+typedef struct VCIBLKRANGE
 {
-    /** First block of cached data the internal node represents. */
-    uint64_t       u64BlockOffset;
-    /** Number of blocks the internal node represents. */
-    uint32_t       u32Blocks;
-    /** Pointer to the child node. */
-    VCITREENODEPTR PtrChild;
-} VCINODEINTERNAL, *PVCINODEINTERNAL;
+    /** Start address of the range. */
+    uint64_t    offAddrStart;
+    /** Number of blocks in the range. */
+    uint64_t    cBlocks;
+} VCIBLKRANGE, *PVCIBLKRANGE;
 
 /**
- * A in memory internal B+-tree node.
+ * List of block ranges which are released together.
  */
-typedef struct VCITREENODEINT
+typedef struct VCIBLKLIST
 {
-    /** Node core. */
-    VCITREENODE     Core;
-    /** Number of used nodes. */
-    unsigned        cUsedNodes;
-    /** Array of internal nodes. */
-    VCINODEINTERNAL aIntNodes[VCI_TREE_INTERNAL_NODES_PER_NODE];
-} VCITREENODEINT, *PVCITREENODEINT;
+    /** Number of ranges in the list. */
+    unsigned     cRanges;
+    /** Number of ranges the array has room for. */
+    unsigned     cRangesMax;
+    /** Array of ranges. */
+    PVCIBLKRANGE paRanges;
+} VCIBLKLIST, *PVCIBLKLIST;
 
 /**
  * A in memory cache extent.
  */
 typedef struct VCICACHEEXTENT
 {
-    /** First block of cached data the extent represents. */
-    uint64_t    u64BlockOffset;
-    /** Number of blocks the extent represents. */
-    uint32_t    u32Blocks;
+    /** AVL tree node, the key range covers the cached blocks. */
+    AVLRU64NODECORE Core;
+    /** Node in the LRU list. */
+    RTLISTNODE      NodeLru;
     /** First block in the image where the data is stored. */
-    uint64_t    u64BlockAddr;
+    uint64_t        u64BlockAddr;
+    /** Flags, see VCI_CACHE_EXTENT_FLAGS_*. */
+    uint8_t         fFlags;
 } VCICACHEEXTENT, *PVCICACHEEXTENT;
 
-/**
- * A in memory leaf B+-tree node.
- */
-typedef struct VCITREENODELEAF
-{
-    /** Node core. */
-    VCITREENODE    Core;
-    /** Number of used nodes. */
-    unsigned       cUsedNodes;
-    /** The extents in the node. */
-    VCICACHEEXTENT aExtents[VCI_TREE_EXTENTS_PER_NODE];
-} VCITREENODELEAF, *PVCITREENODELEAF;
+/** Returns the number of blocks an in memory extent represents. */
+#define VCI_EXTENT_BLOCKS(pExtent) ((pExtent)->Core.KeyLast - (pExtent)->Core.Key + 1)
 
 /**
  * VCI image data structure.
@@ -355,19 +351,116 @@ typedef struct VCICACHE
     unsigned          uImageFlags;
     /** Total size of the image. */
     uint64_t          cbSize;
+    /** Size of the image in blocks, including all metadata. */
+    uint64_t          cBlocksCache;
+    /** UUID of the image. */
+    RTUUID            uuidImage;
+    /** Modification UUID of the image. */
+    RTUUID            uuidModification;
 
-    /** Offset of the B+-Tree in the image in bytes. */
+    /** Offset of the B+-Tree root in the image in blocks. */
     uint64_t          offTreeRoot;
-    /** Pointer to the root node of the B+-Tree. */
-    PVCITREENODE      pRoot;
-    /** Offset to the block allocation bitmap in bytes. */
+    /** Offset to the block allocation bitmap in blocks. */
     uint64_t          offBlksBitmap;
+    /** Size of the block allocation bitmap in blocks. */
+    uint32_t          cBlkMap;
     /** Block map. */
     PVCIBLKMAP        pBlkMap;
+
+    /** Critical section serializing access to the in memory state. */
+    RTCRITSECT        CritSect;
+    /** Cached extents, keyed by the blocks of the disk they hold data for.
+     * The on disk B+-Tree is a snapshot of this tree written during a commit. */
+    AVLRU64TREE       TreeExtents;
+    /** LRU list of extents, the most recently used one is at the head. */
+    RTLISTNODE        ListLru;
+    /** Number of extents. */
+    uint64_t          cExtents;
+    /** Number of blocks holding cached data. */
+    uint64_t          cBlocksData;
+    /** Number of blocks holding dirty data. */
+    uint64_t          cBlocksDirty;
+    /** Blocks occupied by the B+-Tree the header on disk references. */
+    VCIBLKLIST        NodesTree;
+    /** Blocks freed since the last commit. The tree on disk may still reference
+     * them so they can't be reused before the next commit. */
+    VCIBLKLIST        BlksFreePending;
+    /** Flag whether the extents changed since the last commit. */
+    bool              fTreeDirty;
+    /** Flag whether the header needs to be updated. */
+    bool              fHdrDirty;
+    /** Flag whether the header on disk marks the cache as not closed cleanly. */
+    bool              fUncleanOnDisk;
 } VCICACHE, *PVCICACHE;
 
-/** No block free in bitmap error code. */
-#define VERR_VCI_NO_BLOCKS_FREE (-65536)
+/**
+ * Child node collected while writing the B+-Tree bottom up.
+ */
+typedef struct VCITREECHILD
+{
+    /** First block of cached data the child represents. */
+    uint64_t    u64BlockFirst;
+    /** Last block of cached data the child represents. */
+    uint64_t    u64BlockLast;
+    /** Block address of the child node in the image. */
+    uint64_t    offNode;
+} VCITREECHILD, *PVCITREECHILD;
+
+/**
+ * State for writing the B+-Tree.
+ */
+typedef struct VCITREESAVE
+{
+    /** The cache image instance. */
+    PVCICACHE       pCache;
+    /** Where the block addresses of the new nodes are recorded. */
+    PVCIBLKLIST     pNodes;
+    /** Nodes of the level written last. */
+    PVCITREECHILD   paChildren;
+    /** Number of entries in paChildren. */
+    unsigned        cChildren;
+    /** Number of entries in the leaf being assembled. */
+    unsigned        cEntries;
+    /** First block of cached data of the leaf being assembled. */
+    uint64_t        u64BlockFirst;
+    /** Last block of cached data of the leaf being assembled. */
+    uint64_t        u64BlockLast;
+    /** The node being assembled. */
+    VciTreeNode     Node;
+} VCITREESAVE, *PVCITREESAVE;
+
+/**
+ * Extent loaded from the B+-Tree with its LRU links.
+ */
+typedef struct VCITREELOADEXTENT
+{
+    /** The in memory extent. */
+    PVCICACHEEXTENT pExtent;
+    /** First block of the previous extent in the LRU list. */
+    uint64_t        u64ExtentPrev;
+    /** First block of the next extent in the LRU list. */
+    uint64_t        u64ExtentNext;
+} VCITREELOADEXTENT, *PVCITREELOADEXTENT;
+
+/**
+ * State for loading the B+-Tree.
+ */
+typedef struct VCITREELOAD
+{
+    /** Loaded extents in the order they appear in the tree. */
+    PVCITREELOADEXTENT paExtents;
+    /** Number of entries in paExtents. */
+    size_t             cExtents;
+    /** Number of entries paExtents has room for. */
+    size_t             cExtentsMax;
+    /** Flag whether the extents were not in ascending order. */
+    bool               fUnsorted;
+} VCITREELOAD, *PVCITREELOAD;
+
+/** Shift applied to the cache size to get the minimum number of blocks
+ * evicted at once, so the tree isn't rewritten for every cache miss
+ * once the cache is full. */
+#define VCI_EVICT_BATCH_SHIFT   5
 
 /*******************************************************************************
 *   Static Variables                                                           *
@@ -515,50 +608,6 @@ DECLINLINE(int) vciFileFlushAsync(PVCICACHE pCache, PVDIOCTX pIoCtx,
                                                         pvCompleteUser);
 }
 
-/**
- * Internal. Flush image data to disk.
- */
-static int vciFlushImage(PVCICACHE pCache)
-{
-    int rc = VINF_SUCCESS;
-
-    if (   pCache->pStorage
-        && !(pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY))
-        rc = vciFileFlushSync(pCache);
-
-    return rc;
-}
-
-/**
- * Internal. Free all allocated space for representing an image except pCache,
- * and optionally delete the image from disk.
- */
-static int vciFreeImage(PVCICACHE pCache, bool fDelete)
-{
-    int rc = VINF_SUCCESS;
-
-    /* Freeing a never allocated image (e.g. because the open failed) is
-     * not signalled as an error. After all nothing bad happens. */
-    if (pCache)
-    {
-        if (pCache->pStorage)
-        {
-            /* No point updating the file that is deleted anyway. */
-            if (!fDelete)
-                vciFlushImage(pCache);
-
-            vciFileClose(pCache);
-            pCache->pStorage = NULL;
-        }
-
-        if (fDelete && pCache->pszFilename)
-            vciFileDelete(pCache, pCache->pszFilename);
-    }
-
-    LogFlowFunc(("returns %Rrc\n", rc));
-    return rc;
-}
-
 /**
  * Creates a new block map which can manage the given number of blocks.
  *
@@ -573,11 +622,10 @@ static int vciFreeImage(PVCICACHE pCache, bool fDelete)
 static int vciBlkMapCreate(uint64_t cBlocks, PVCIBLKMAP *ppBlkMap, uint32_t *pcBlkMap)
 {
     int rc = VINF_SUCCESS;
-    uint32_t cbBlkMap = RT_ALIGN_Z(cBlocks / sizeof(VciBlkMapEnt) / 8, VCI_BLOCK_SIZE);
     PVCIBLKMAP pBlkMap = (PVCIBLKMAP)RTMemAllocZ(sizeof(VCIBLKMAP));
     PVCIBLKRANGEDESC pFree   = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
 
-    LogFlowFunc(("cBlocks=%u ppBlkMap=%#p pcBlkMap=%#p\n", cBlocks, ppBlkMap, pcBlkMap));
+    LogFlowFunc(("cBlocks=%llu ppBlkMap=%#p pcBlkMap=%#p\n", cBlocks, ppBlkMap, pcBlkMap));
 
     if (pBlkMap && pFree)
     {
@@ -585,19 +633,23 @@ static int vciBlkMapCreate(uint64_t cBlocks, PVCIBLKMAP *ppBlkMap, uint32_t *pcB
         pBlkMap->cBlocksAllocMeta = 0;
         pBlkMap->cBlocksAllocData = 0;
         pBlkMap->cBlocksFree      = cBlocks;
+        pBlkMap->cNodesFree       = cBlocks / VCI_TREE_NODE_BLOCKS;
 
         pFree->pPrev = NULL;
         pFree->pNext = NULL;
         pFree->offAddrStart = 0;
         pFree->cBlocks      = cBlocks;
         pFree->fFree        = true;
+        pFree->Core.Key     = 0;
+        pFree->Core.KeyLast = cBlocks - 1;
 
         pBlkMap->pRangesHead = pFree;
         pBlkMap->pRangesTail = pFree;
+        pBlkMap->TreeRanges  = NULL;
+        RTAvlrU64Insert(&pBlkMap->TreeRanges, &pFree->Core);
 
-        Assert(!((cbBlkMap + sizeof(VciBlkMap)) % VCI_BLOCK_SIZE));
         *ppBlkMap = pBlkMap;
-        *pcBlkMap = VCI_BYTE2BLOCK(cbBlkMap + sizeof(VciBlkMap));
+        *pcBlkMap = VCI_BLKMAP_BLOCKS(cBlocks);
     }
     else
     {
@@ -609,7 +661,7 @@ static int vciBlkMapCreate(uint64_t cBlocks, PVCIBLKMAP *ppBlkMap, uint32_t *pcB
         rc = VERR_NO_MEMORY;
     }
 
-    LogFlowFunc(("returns rc=%Rrc cBlkMap=%u\n", rc, *pcBlkMap));
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
     return rc;
 }
 
@@ -629,9 +681,9 @@ static void vciBlkMapDestroy(PVCIBLKMAP pBlkMap)
     {
         PVCIBLKRANGEDESC pTmp = pRangeCur;
 
-        RTMemFree(pTmp);
-
         pRangeCur = pRangeCur->pNext;
+
+        RTMemFree(pTmp);
     }
 
     RTMemFree(pBlkMap);
@@ -639,6 +691,52 @@ static void vciBlkMapDestroy(PVCIBLKMAP pBlkMap)
     LogFlowFunc(("returns\n"));
 }
 
+/**
+ * Appends a range with the given state to the end of the block map,
+ * used while constructing the range list from the bitmap.
+ *
+ * @returns VBox status code.
+ * @param   pBlkMap         The block bitmap.
+ * @param   fFree           Whether the blocks are free.
+ * @param   cBlocks         Number of blocks to append.
+ */
+static int vciBlkMapAppend(PVCIBLKMAP pBlkMap, bool fFree, uint64_t cBlocks)
+{
+    PVCIBLKRANGEDESC pTail = pBlkMap->pRangesTail;
+
+    if (   pTail
+        && pTail->fFree == fFree)
+    {
+        pBlkMap->cNodesFree -= VCI_BLKRANGE_NODES(pTail);
+        pTail->cBlocks      += cBlocks;
+        pTail->Core.KeyLast += cBlocks;
+        pBlkMap->cNodesFree += VCI_BLKRANGE_NODES(pTail);
+    }
+    else
+    {
+        PVCIBLKRANGEDESC pRangeNew = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
+        if (!pRangeNew)
+            return VERR_NO_MEMORY;
+
+        pRangeNew->fFree        = fFree;
+        pRangeNew->offAddrStart = pTail ? pTail->offAddrStart + pTail->cBlocks : 0;
+        pRangeNew->cBlocks      = cBlocks;
+        pRangeNew->Core.Key     = pRangeNew->offAddrStart;
+        pRangeNew->Core.KeyLast = pRangeNew->offAddrStart + cBlocks - 1;
+        pRangeNew->pPrev        = pTail;
+        pRangeNew->pNext        = NULL;
+        if (pTail)
+            pTail->pNext = pRangeNew;
+        else
+            pBlkMap->pRangesHead = pRangeNew;
+        pBlkMap->pRangesTail = pRangeNew;
+        pBlkMap->cNodesFree += VCI_BLKRANGE_NODES(pRangeNew);
+        RTAvlrU64Insert(&pBlkMap->TreeRanges, &pRangeNew->Core);
+    }
+
+    return VINF_SUCCESS;
+}
+
 /**
  * Loads the block map from the specified medium and creates all necessary
  * in memory structures to manage used and free blocks.
@@ -659,8 +757,6 @@ static int vciBlkMapLoad(PVCICACHE pStorage, uint64_t offBlkMap, uint32_t cBlkMa
 
     if (cBlkMap >= VCI_BYTE2BLOCK(sizeof(VciBlkMap)))
     {
-        cBlkMap -= VCI_BYTE2BLOCK(sizeof(VciBlkMap));
-
         rc = vciFileReadSync(pStorage, offBlkMap, &BlkMap, VCI_BYTE2BLOCK(sizeof(VciBlkMap)));
         if (RT_SUCCESS(rc))
         {
@@ -668,115 +764,73 @@ static int vciBlkMapLoad(PVCICACHE pStorage, uint64_t offBlkMap, uint32_t cBlkMa
 
             BlkMap.u32Magic         = RT_LE2H_U32(BlkMap.u32Magic);
             BlkMap.u32Version       = RT_LE2H_U32(BlkMap.u32Version);
-            BlkMap.cBlocks          = RT_LE2H_U32(BlkMap.cBlocks);
-            BlkMap.cBlocksFree      = RT_LE2H_U32(BlkMap.cBlocksFree);
-            BlkMap.cBlocksAllocMeta = RT_LE2H_U32(BlkMap.cBlocksAllocMeta);
-            BlkMap.cBlocksAllocData = RT_LE2H_U32(BlkMap.cBlocksAllocData);
+            BlkMap.cBlocks          = RT_LE2H_U64(BlkMap.cBlocks);
+            BlkMap.cBlocksFree      = RT_LE2H_U64(BlkMap.cBlocksFree);
+            BlkMap.cBlocksAllocMeta = RT_LE2H_U64(BlkMap.cBlocksAllocMeta);
+            BlkMap.cBlocksAllocData = RT_LE2H_U64(BlkMap.cBlocksAllocData);
 
             if (   BlkMap.u32Magic == VCI_BLKMAP_MAGIC
                 && BlkMap.u32Version == VCI_BLKMAP_VERSION
+                && BlkMap.cBlocks
                 && BlkMap.cBlocks == BlkMap.cBlocksFree + BlkMap.cBlocksAllocMeta + BlkMap.cBlocksAllocData
-                && VCI_BYTE2BLOCK(BlkMap.cBlocks / 8) == cBlkMap)
+                && VCI_BLKMAP_BLOCKS(BlkMap.cBlocks) == cBlkMap)
             {
                 PVCIBLKMAP pBlkMap = (PVCIBLKMAP)RTMemAllocZ(sizeof(VCIBLKMAP));
                 if (pBlkMap)
                 {
+                    uint8_t abBitmapBuffer[16 * _1K];
+                    uint64_t iBlock = 0;
+                    uint64_t cBlocksFree = 0;
+
                     pBlkMap->cBlocks          = BlkMap.cBlocks;
                     pBlkMap->cBlocksFree      = BlkMap.cBlocksFree;
                     pBlkMap->cBlocksAllocMeta = BlkMap.cBlocksAllocMeta;
                     pBlkMap->cBlocksAllocData = BlkMap.cBlocksAllocData;
 
                     /* Load the bitmap and construct the range list. */
-                    uint32_t cBlocksFree = 0;
-                    uint32_t cBlocksAllocated = 0;
-                    PVCIBLKRANGEDESC pRangeCur = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
-
-                    if (pRangeCur)
+                    while (   RT_SUCCESS(rc)
+                           && iBlock < pBlkMap->cBlocks)
                     {
-                        uint8_t abBitmapBuffer[16 * _1K];
-                        uint32_t cBlocksRead = 0;
-                        uint64_t cBlocksLeft = VCI_BYTE2BLOCK(pBlkMap->cBlocks / 8);
-
-                        cBlocksRead = RT_MIN(VCI_BYTE2BLOCK(sizeof(abBitmapBuffer)), cBlocksLeft);
-                        rc = vciFileReadSync(pStorage, offBlkMap, abBitmapBuffer,
-                                             cBlocksRead);
+                        uint32_t cBits = (uint32_t)RT_MIN(sizeof(abBitmapBuffer) * 8, pBlkMap->cBlocks - iBlock);
+                        uint32_t cBlocksRead = (uint32_t)VCI_BYTE2BLOCK(RT_ALIGN_32((cBits + 7) / 8, VCI_BLOCK_SIZE));
+                        uint32_t iBit = 0;
 
-                        if (RT_SUCCESS(rc))
-                        {
-                            pRangeCur->fFree        = !(abBitmapBuffer[0] & 0x01);
-                            pRangeCur->offAddrStart = 0;
-                            pRangeCur->cBlocks      = 0;
-                            pRangeCur->pNext        = NULL;
-                            pRangeCur->pPrev        = NULL;
-                            pBlkMap->pRangesHead = pRangeCur;
-                            pBlkMap->pRangesTail = pRangeCur;
-                        }
+                        rc = vciFileReadSync(pStorage, offBlkMap, abBitmapBuffer, cBlocksRead);
+                        if (RT_FAILURE(rc))
+                            break;
 
+                        /* Convert runs of equal bits into ranges, skipping whole bytes where possible. */
                         while (   RT_SUCCESS(rc)
-                               && cBlocksLeft)
+                               && iBit < cBits)
                         {
-                            int iBit = 0;
-                            uint32_t cBits = VCI_BLOCK2BYTE(cBlocksRead) * 8;
-                            uint32_t iBitPrev = 0xffffffff;
+                            bool fFree = !ASMBitTest(abBitmapBuffer, iBit);
+                            uint32_t iBitEnd = iBit + 1;
 
-                            while (cBits)
+                            while (iBitEnd < cBits)
                             {
-                                if (pRangeCur->fFree)
-                                {
-                                    /* Check for the first set bit. */
-                                    iBit = ASMBitNextSet(abBitmapBuffer, cBits, iBitPrev);
-                                }
+                                if (   !(iBitEnd % 8)
+                                    && iBitEnd + 8 <= cBits
+                                    && abBitmapBuffer[iBitEnd / 8] == (fFree ? 0x00 : 0xff))
+                                    iBitEnd += 8;
+                                else if (!ASMBitTest(abBitmapBuffer, iBitEnd) == fFree)
+                                    iBitEnd++;
                                 else
-                                {
-                                    /* Check for the first free bit. */
-                                    iBit = ASMBitNextClear(abBitmapBuffer, cBits, iBitPrev);
-                                }
-
-                                if (iBit == -1)
-                                {
-                                    /* No change. */
-                                    pRangeCur->cBlocks += cBits;
-                                    cBits = 0;
-                                }
-                                else
-                                {
-                                    Assert((uint32_t)iBit < cBits);
-                                    pRangeCur->cBlocks += iBit;
-
-                                    /* Create a new range descriptor. */
-                                    PVCIBLKRANGEDESC pRangeNew = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
-                                    if (!pRangeNew)
-                                    {
-                                        rc = VERR_NO_MEMORY;
-                                        break;
-                                    }
-
-                                    pRangeNew->fFree = !pRangeCur->fFree;
-                                    pRangeNew->offAddrStart = pRangeCur->offAddrStart + pRangeCur->cBlocks;
-                                    pRangeNew->cBlocks = 0;
-                                    pRangeNew->pPrev = pRangeCur;
-                                    pRangeCur->pNext = pRangeNew;
-                                    pBlkMap->pRangesTail = pRangeNew;
-                                    pRangeCur = pRangeNew;
-                                    cBits -= iBit;
-                                    iBitPrev = iBit;
-                                }
+                                    break;
                             }
 
-                            cBlocksLeft -= cBlocksRead;
-                            offBlkMap   += cBlocksRead;
-
-                            if (   RT_SUCCESS(rc)
-                                && cBlocksLeft)
-                            {
-                                /* Read next chunk. */
-                                cBlocksRead = RT_MIN(VCI_BYTE2BLOCK(sizeof(abBitmapBuffer)), cBlocksLeft);
-                                rc = vciFileReadSync(pStorage, offBlkMap, abBitmapBuffer, cBlocksRead);
-                            }
+                            rc = vciBlkMapAppend(pBlkMap, fFree, iBitEnd - iBit);
+                            if (fFree)
+                                cBlocksFree += iBitEnd - iBit;
+                            iBit = iBitEnd;
                         }
+
+                        iBlock    += cBits;
+                        offBlkMap += cBlocksRead;
                     }
-                    else
-                        rc = VERR_NO_MEMORY;
+
+                    if (   RT_SUCCESS(rc)
+                        && cBlocksFree != pBlkMap->cBlocksFree)
+                        rc = VERR_VD_GEN_INVALID_HEADER;
 
                     if (RT_SUCCESS(rc))
                     {
@@ -785,7 +839,7 @@ static int vciBlkMapLoad(PVCICACHE pStorage, uint64_t offBlkMap, uint32_t cBlkMa
                         return VINF_SUCCESS;
                     }
                     else
-                        RTMemFree(pBlkMap);
+                        vciBlkMapDestroy(pBlkMap);
                 }
                 else
                     rc = VERR_NO_MEMORY;
@@ -822,40 +876,54 @@ static int vciBlkMapSave(PVCIBLKMAP pBlkMap, PVCICACHE pStorage, uint64_t offBlk
                  pBlkMap, pStorage, offBlkMap, cBlkMap));
 
     /* Make sure the number of blocks allocated for us match our expectations. */
-    if (VCI_BYTE2BLOCK(pBlkMap->cBlocks / 8) + VCI_BYTE2BLOCK(sizeof(VciBlkMap)) == cBlkMap)
+    if (VCI_BLKMAP_BLOCKS(pBlkMap->cBlocks) == cBlkMap)
     {
         /* Setup the header */
         memset(&BlkMap, 0, sizeof(VciBlkMap));
 
         BlkMap.u32Magic         = RT_H2LE_U32(VCI_BLKMAP_MAGIC);
         BlkMap.u32Version       = RT_H2LE_U32(VCI_BLKMAP_VERSION);
-        BlkMap.cBlocks          = RT_H2LE_U32(pBlkMap->cBlocks);
-        BlkMap.cBlocksFree      = RT_H2LE_U32(pBlkMap->cBlocksFree);
-        BlkMap.cBlocksAllocMeta = RT_H2LE_U32(pBlkMap->cBlocksAllocMeta);
-        BlkMap.cBlocksAllocData = RT_H2LE_U32(pBlkMap->cBlocksAllocData);
+        BlkMap.cBlocks          = RT_H2LE_U64(pBlkMap->cBlocks);
+        BlkMap.cBlocksFree      = RT_H2LE_U64(pBlkMap->cBlocksFree);
+        BlkMap.cBlocksAllocMeta = RT_H2LE_U64(pBlkMap->cBlocksAllocMeta);
+        BlkMap.cBlocksAllocData = RT_H2LE_U64(pBlkMap->cBlocksAllocData);
 
         rc = vciFileWriteSync(pStorage, offBlkMap, &BlkMap, VCI_BYTE2BLOCK(sizeof(VciBlkMap)));
         if (RT_SUCCESS(rc))
         {
             uint8_t abBitmapBuffer[16*_1K];
-            unsigned iBit = 0;
+            uint32_t iBit = 0;
             PVCIBLKRANGEDESC pCur = pBlkMap->pRangesHead;
 
             offBlkMap += VCI_BYTE2BLOCK(sizeof(VciBlkMap));
+            memset(abBitmapBuffer, 0, sizeof(abBitmapBuffer));
 
             /* Write the descriptor ranges. */
-            while (pCur)
+            while (   pCur
+                   && RT_SUCCESS(rc))
             {
                 uint64_t cBlocks = pCur->cBlocks;
 
                 while (cBlocks)
                 {
-                    uint64_t cBlocksMax = RT_MIN(cBlocks, sizeof(abBitmapBuffer) * 8 - iBit);
+                    uint32_t cBlocksMax = (uint32_t)RT_MIN(cBlocks, sizeof(abBitmapBuffer) * 8 - iBit);
 
-                    if (pCur->fFree)
-                        ASMBitClearRange(abBitmapBuffer, iBit, iBit + cBlocksMax);
-                    else
-                        ASMBitSetRange(abBitmapBuffer, iBit, iBit + cBlocksMax);
+                    /* Free blocks stay clear. */
+                    if (!pCur->fFree)
+                    {
+                        uint32_t iBitSet = iBit;
+                        uint32_t iBitEnd = iBit + cBlocksMax;
+
+                        while (iBitSet < iBitEnd && (iBitSet % 8))
+                            ASMBitSet(abBitmapBuffer, iBitSet++);
+                        if (iBitEnd - iBitSet >= 8)
+                        {
+                            memset(&abBitmapBuffer[iBitSet / 8], 0xff, (iBitEnd - iBitSet) / 8);
+                            iBitSet += (iBitEnd - iBitSet) & ~7U;
+                        }
+                        while (iBitSet < iBitEnd)
+                            ASMBitSet(abBitmapBuffer, iBitSet++);
+                    }
 
                     iBit    += cBlocksMax;
                     cBlocks -= cBlocksMax;
@@ -869,16 +937,16 @@ static int vciBlkMapSave(PVCIBLKMAP pBlkMap, PVCICACHE pStorage, uint64_t offBlk
 
                         offBlkMap += VCI_BYTE2BLOCK(sizeof(abBitmapBuffer));
                         iBit = 0;
+                        memset(abBitmapBuffer, 0, sizeof(abBitmapBuffer));
                     }
                 }
 
                 pCur = pCur->pNext;
             }
 
-            Assert(iBit % 8 == 0);
-
             if (RT_SUCCESS(rc) && iBit)
-                rc = vciFileWriteSync(pStorage, offBlkMap, abBitmapBuffer, VCI_BYTE2BLOCK(iBit / 8));
+                rc = vciFileWriteSync(pStorage, offBlkMap, abBitmapBuffer,
+                                      VCI_BYTE2BLOCK(RT_ALIGN_32((iBit + 7) / 8, VCI_BLOCK_SIZE)));
         }
     }
     else
@@ -897,113 +965,169 @@ static int vciBlkMapSave(PVCIBLKMAP pBlkMap, PVCICACHE pStorage, uint64_t offBlk
  */
 static PVCIBLKRANGEDESC vciBlkMapFindByBlock(PVCIBLKMAP pBlkMap, uint64_t offBlockAddr)
 {
-    PVCIBLKRANGEDESC pBlk = pBlkMap->pRangesHead;
+    return (PVCIBLKRANGEDESC)RTAvlrU64RangeGet(&pBlkMap->TreeRanges, offBlockAddr);
+}
+
+/**
+ * Splits a range descriptor in two.
+ *
+ * @returns Pointer to the new descriptor starting at the given block address
+ *          or NULL if out of memory.
+ * @param   pBlkMap          The block bitmap.
+ * @param   pBlk             The range to split.
+ * @param   offBlockAddr     Block address the second part starts at.
+ */
+static PVCIBLKRANGEDESC vciBlkMapSplit(PVCIBLKMAP pBlkMap, PVCIBLKRANGEDESC pBlk, uint64_t offBlockAddr)
+{
+    PVCIBLKRANGEDESC pBlkNew = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
+
+    Assert(   offBlockAddr > pBlk->offAddrStart
+           && offBlockAddr < pBlk->offAddrStart + pBlk->cBlocks);
+
+    if (pBlkNew)
+    {
+        pBlkMap->cNodesFree  -= VCI_BLKRANGE_NODES(pBlk);
+        pBlkNew->fFree        = pBlk->fFree;
+        pBlkNew->offAddrStart = offBlockAddr;
+        pBlkNew->cBlocks      = pBlk->offAddrStart + pBlk->cBlocks - offBlockAddr;
+        pBlkNew->Core.Key     = offBlockAddr;
+        pBlkNew->Core.KeyLast = pBlk->Core.KeyLast;
+        pBlk->cBlocks        -= pBlkNew->cBlocks;
+        pBlk->Core.KeyLast    = offBlockAddr - 1;
+        pBlkMap->cNodesFree  += VCI_BLKRANGE_NODES(pBlk) + VCI_BLKRANGE_NODES(pBlkNew);
+
+        /* Link into the list. */
+        pBlkNew->pPrev = pBlk;
+        pBlkNew->pNext = pBlk->pNext;
+        if (pBlk->pNext)
+            pBlk->pNext->pPrev = pBlkNew;
+        else
+            pBlkMap->pRangesTail = pBlkNew;
+        pBlk->pNext = pBlkNew;
 
-    while (   pBlk
-           && pBlk->offAddrStart < offBlockAddr)
-        pBlk = pBlk->pNext;
+        RTAvlrU64Insert(&pBlkMap->TreeRanges, &pBlkNew->Core);
+    }
 
-    return pBlk;
+    return pBlkNew;
 }
 
 /**
  * Allocates the given number of blocks in the bitmap and returns the start block address.
  *
+ * The search starts where the previous allocation left off (next fit) so
+ * allocations from a fragmented map don't have to scan all ranges.
+ *
  * @returns VBox status code.
- * @param   pBlkMap          The block bitmap to allocate the blocks from.
- * @param   cBlocks          How many blocks to allocate.
- * @param   poffBlockAddr    Where to store the start address of the allocated region.
+ * @retval  VERR_VD_CACHE_FULL if there is no suitable free range.
+ * @param   pBlkMap            The block bitmap to allocate the blocks from.
+ * @param   cBlocks            How many blocks to allocate.
+ * @param   poffBlockAddr      Where to store the start address of the allocated region.
+ * @param   pcBlocksAllocated  Where to store the number of blocks allocated.
+ *                             If not NULL the largest free range is used when
+ *                             there is none with at least cBlocks blocks.
  */
-static int vciBlkMapAllocate(PVCIBLKMAP pBlkMap, uint32_t cBlocks, uint64_t *poffBlockAddr)
+static int vciBlkMapAllocate(PVCIBLKMAP pBlkMap, uint64_t cBlocks, uint64_t *poffBlockAddr,
+                             uint64_t *pcBlocksAllocated)
 {
-    PVCIBLKRANGEDESC pBestFit = NULL;
-    PVCIBLKRANGEDESC pCur = NULL;
+    PVCIBLKRANGEDESC pFit = NULL;
+    PVCIBLKRANGEDESC pLargest = NULL;
+    PVCIBLKRANGEDESC pStart = pBlkMap->pRangeNextFit ? pBlkMap->pRangeNextFit : pBlkMap->pRangesHead;
+    PVCIBLKRANGEDESC pCur = pStart;
     int rc = VINF_SUCCESS;
 
-    LogFlowFunc(("pBlkMap=%#p cBlocks=%u poffBlockAddr=%#p\n",
+    LogFlowFunc(("pBlkMap=%#p cBlocks=%llu poffBlockAddr=%#p\n",
                  pBlkMap, cBlocks, poffBlockAddr));
 
-    pCur = pBlkMap->pRangesHead;
-
-    while (pCur)
+    if (   pBlkMap->cBlocksFree
+        && cBlocks)
     {
-        if (   pCur->fFree
-            && pCur->cBlocks >= cBlocks)
+        do
         {
-            if (   !pBestFit
-                || pCur->cBlocks < pBestFit->cBlocks)
+            if (pCur->fFree)
             {
-                pBestFit = pCur;
-                /* Stop searching if the size is matching exactly. */
-                if (pBestFit->cBlocks == cBlocks)
+                if (pCur->cBlocks >= cBlocks)
+                {
+                    pFit = pCur;
                     break;
+                }
+                if (   !pLargest
+                    || pCur->cBlocks > pLargest->cBlocks)
+                    pLargest = pCur;
             }
-        }
-        pCur = pCur->pNext;
+            pCur = pCur->pNext ? pCur->pNext : pBlkMap->pRangesHead;
+        } while (pCur != pStart);
     }
 
-    Assert(!pBestFit || pBestFit->fFree);
+    if (   !pFit
+        && pcBlocksAllocated
+        && pLargest)
+    {
+        pFit    = pLargest;
+        cBlocks = pLargest->cBlocks;
+    }
 
-    if (pBestFit)
+    if (pFit)
     {
-        pBestFit->fFree = false;
+        Assert(pFit->fFree);
 
-        if (pBestFit->cBlocks > cBlocks)
-        {
-            /* Create a new free block. */
-            PVCIBLKRANGEDESC pFree = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
+        if (   pFit->cBlocks > cBlocks
+            && !vciBlkMapSplit(pBlkMap, pFit, pFit->offAddrStart + cBlocks))
+            rc = VERR_NO_MEMORY;
 
-            if (pFree)
-            {
-                pFree->fFree = true;
-                pFree->cBlocks = pBestFit->cBlocks - cBlocks;
-                pBestFit->cBlocks -= pFree->cBlocks;
-                pFree->offAddrStart = pBestFit->offAddrStart + cBlocks;
-
-                /* Link into the list. */
-                pFree->pNext = pBestFit->pNext;
-                pBestFit->pNext = pFree;
-                pFree->pPrev    = pBestFit;
-                if (!pFree->pNext)
-                    pBlkMap->pRangesTail = pFree;
-
-                *poffBlockAddr = pBestFit->offAddrStart;
-            }
-            else
-            {
-                rc = VERR_NO_MEMORY;
-                pBestFit->fFree = true;
-            }
+        if (RT_SUCCESS(rc))
+        {
+            pBlkMap->cNodesFree   -= VCI_BLKRANGE_NODES(pFit);
+            pFit->fFree = false;
+            pBlkMap->cBlocksFree  -= cBlocks;
+            pBlkMap->pRangeNextFit = pFit->pNext;
+            *poffBlockAddr = pFit->offAddrStart;
+            if (pcBlocksAllocated)
+                *pcBlocksAllocated = cBlocks;
         }
     }
     else
-        rc = VERR_VCI_NO_BLOCKS_FREE;
+        rc = VERR_VD_CACHE_FULL;
 
-    LogFlowFunc(("returns rc=%Rrc offBlockAddr=%llu\n", rc, *poffBlockAddr));
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
     return rc;
 }
 
 /**
- * Try to extend the space of an already allocated block.
+ * Marks the given range as allocated, used when rebuilding the block map
+ * from the B+-Tree.
  *
  * @returns VBox status code.
- * @param   pBlkMap          The block bitmap to allocate the blocks from.
- * @param   cBlocksNew       How many blocks the extended block should have.
- * @param   offBlockAddrOld  The start address of the block to reallocate.
- * @param   poffBlockAddr    Where to store the start address of the allocated region.
+ * @retval  VERR_VD_GEN_INVALID_HEADER if the range is not free, which means
+ *          the metadata references a block twice.
+ * @param   pBlkMap          The block bitmap.
+ * @param   offBlockAddr     Address of the first block.
+ * @param   cBlocks          Number of blocks.
  */
-static int vciBlkMapRealloc(PVCIBLKMAP pBlkMap, uint32_t cBlocksNew, uint64_t offBlockAddrOld,
-                            uint64_t *poffBlockAddr)
+static int vciBlkMapSetAllocated(PVCIBLKMAP pBlkMap, uint64_t offBlockAddr, uint64_t cBlocks)
 {
-    int rc = VINF_SUCCESS;
+    PVCIBLKRANGEDESC pBlk = vciBlkMapFindByBlock(pBlkMap, offBlockAddr);
 
-    LogFlowFunc(("pBlkMap=%#p cBlocksNew=%u offBlockAddrOld=%llu poffBlockAddr=%#p\n",
-                 pBlkMap, cBlocksNew, offBlockAddrOld, poffBlockAddr));
+    if (   !pBlk
+        || !pBlk->fFree
+        || !cBlocks
+        || cBlocks > pBlk->offAddrStart + pBlk->cBlocks - offBlockAddr)
+        return VERR_VD_GEN_INVALID_HEADER;
 
-    AssertMsgFailed(("Implement\n"));
+    if (pBlk->offAddrStart < offBlockAddr)
+    {
+        pBlk = vciBlkMapSplit(pBlkMap, pBlk, offBlockAddr);
+        if (!pBlk)
+            return VERR_NO_MEMORY;
+    }
 
-    LogFlowFunc(("returns rc=%Rrc offBlockAddr=%llu\n", rc, *poffBlockAddr));
-    return rc;
+    if (   pBlk->cBlocks > cBlocks
+        && !vciBlkMapSplit(pBlkMap, pBlk, offBlockAddr + cBlocks))
+        return VERR_NO_MEMORY;
+
+    pBlkMap->cNodesFree -= VCI_BLKRANGE_NODES(pBlk);
+    pBlk->fFree = false;
+    pBlkMap->cBlocksFree -= cBlocks;
+    return VINF_SUCCESS;
 }
 
 /**
@@ -1014,65 +1138,82 @@ static int vciBlkMapRealloc(PVCIBLKMAP pBlkMap, uint32_t cBlocksNew, uint64_t of
  * @param   offBlockAddr     Address of the first block to free.
  * @param   cBlocks          How many blocks to free.
  */
-static void vciBlkMapFree(PVCIBLKMAP pBlkMap, uint64_t offBlockAddr, uint32_t cBlocks)
+static void vciBlkMapFree(PVCIBLKMAP pBlkMap, uint64_t offBlockAddr, uint64_t cBlocks)
 {
     PVCIBLKRANGEDESC pBlk;
 
-    LogFlowFunc(("pBlkMap=%#p offBlockAddr=%llu cBlocks=%u\n",
+    LogFlowFunc(("pBlkMap=%#p offBlockAddr=%llu cBlocks=%llu\n",
                  pBlkMap, offBlockAddr, cBlocks));
 
     while (cBlocks)
     {
         pBlk = vciBlkMapFindByBlock(pBlkMap, offBlockAddr);
-        AssertPtr(pBlk);
+        AssertPtrBreak(pBlk);
+        AssertBreak(!pBlk->fFree);
 
-        /* Easy case, the whole block is freed. */
-        if (   pBlk->offAddrStart == offBlockAddr
-            && pBlk->cBlocks <= cBlocks)
+        /* Cut the part which is freed out of the range first. */
+        if (pBlk->offAddrStart < offBlockAddr)
         {
-            pBlk->fFree = true;
-            cBlocks      -= pBlk->cBlocks;
-            offBlockAddr += pBlk->cBlocks;
-
-            /* Check if it is possible to merge free blocks. */
-            if (   pBlk->pPrev
-                && pBlk->pPrev->fFree)
-            {
-                PVCIBLKRANGEDESC pBlkPrev = pBlk->pPrev;
-
-                Assert(pBlkPrev->offAddrStart + pBlkPrev->cBlocks == pBlk->offAddrStart);
-                pBlkPrev->cBlocks += pBlk->cBlocks;
-                pBlkPrev->pNext = pBlk->pNext;
-                if (pBlk->pNext)
-                    pBlk->pNext->pPrev = pBlkPrev;
-                else
-                    pBlkMap->pRangesTail = pBlkPrev;
+            pBlk = vciBlkMapSplit(pBlkMap, pBlk, offBlockAddr);
+            if (!pBlk)
+                break; /* The blocks are leaked until the block map is rebuilt. */
+        }
 
-                RTMemFree(pBlk);
-                pBlk = pBlkPrev;
-            }
+        if (   pBlk->cBlocks > cBlocks
+            && !vciBlkMapSplit(pBlkMap, pBlk, offBlockAddr + cBlocks))
+            break;
 
-            /* Now the one to the right. */
-            if (   pBlk->pNext
-                && pBlk->pNext->fFree)
-            {
-                PVCIBLKRANGEDESC pBlkNext = pBlk->pNext;
+        pBlk->fFree = true;
+        pBlkMap->cBlocksFree += pBlk->cBlocks;
+        pBlkMap->cNodesFree  += VCI_BLKRANGE_NODES(pBlk);
+        cBlocks      -= pBlk->cBlocks;
+        offBlockAddr += pBlk->cBlocks;
 
-                Assert(pBlk->offAddrStart + pBlk->cBlocks == pBlkNext->offAddrStart);
-                pBlk->cBlocks += pBlkNext->cBlocks;
-                pBlk->pNext = pBlkNext->pNext;
-                if (pBlkNext->pNext)
-                    pBlkNext->pNext->pPrev = pBlk;
-                else
-                    pBlkMap->pRangesTail = pBlk;
+        /* Check if it is possible to merge free blocks. */
+        if (   pBlk->pPrev
+            && pBlk->pPrev->fFree)
+        {
+            PVCIBLKRANGEDESC pBlkPrev = pBlk->pPrev;
+
+            Assert(pBlkPrev->offAddrStart + pBlkPrev->cBlocks == pBlk->offAddrStart);
+            RTAvlrU64Remove(&pBlkMap->TreeRanges, pBlk->Core.Key);
+            pBlkMap->cNodesFree   -= VCI_BLKRANGE_NODES(pBlkPrev) + VCI_BLKRANGE_NODES(pBlk);
+            pBlkPrev->cBlocks     += pBlk->cBlocks;
+            pBlkPrev->Core.KeyLast = pBlk->Core.KeyLast;
+            pBlkPrev->pNext = pBlk->pNext;
+            if (pBlk->pNext)
+                pBlk->pNext->pPrev = pBlkPrev;
+            else
+                pBlkMap->pRangesTail = pBlkPrev;
+            if (pBlkMap->pRangeNextFit == pBlk)
+                pBlkMap->pRangeNextFit = pBlkPrev;
+            pBlkMap->cNodesFree   += VCI_BLKRANGE_NODES(pBlkPrev);
 
-                RTMemFree(pBlkNext);
-            }
+            RTMemFree(pBlk);
+            pBlk = pBlkPrev;
         }
-        else
+
+        /* Now the one to the right. */
+        if (   pBlk->pNext
+            && pBlk->pNext->fFree)
         {
-            /* The block is intersecting. */
-            AssertMsgFailed(("TODO\n"));
+            PVCIBLKRANGEDESC pBlkNext = pBlk->pNext;
+
+            Assert(pBlk->offAddrStart + pBlk->cBlocks == pBlkNext->offAddrStart);
+            RTAvlrU64Remove(&pBlkMap->TreeRanges, pBlkNext->Core.Key);
+            pBlkMap->cNodesFree -= VCI_BLKRANGE_NODES(pBlk) + VCI_BLKRANGE_NODES(pBlkNext);
+            pBlk->cBlocks     += pBlkNext->cBlocks;
+            pBlk->Core.KeyLast = pBlkNext->Core.KeyLast;
+            pBlk->pNext = pBlkNext->pNext;
+            if (pBlkNext->pNext)
+                pBlkNext->pNext->pPrev = pBlk;
+            else
+                pBlkMap->pRangesTail = pBlk;
+            if (pBlkMap->pRangeNextFit == pBlkNext)
+                pBlkMap->pRangeNextFit = pBlk;
+            pBlkMap->cNodesFree += VCI_BLKRANGE_NODES(pBlk);
+
+            RTMemFree(pBlkNext);
         }
     }
 
@@ -1080,189 +1221,1120 @@ static void vciBlkMapFree(PVCIBLKMAP pBlkMap, uint64_t offBlockAddr, uint32_t cB
 }
 
 /**
- * Converts a tree node from the image to the in memory structure.
+ * Adds a range to a block list.
+ *
+ * @returns VBox status code.
+ * @param   pList            The block list.
+ * @param   offAddrStart     Address of the first block.
+ * @param   cBlocks          Number of blocks.
+ */
+static int vciBlkListAdd(PVCIBLKLIST pList, uint64_t offAddrStart, uint64_t cBlocks)
+{
+    if (pList->cRanges == pList->cRangesMax)
+    {
+        unsigned cRangesNew = pList->cRangesMax ? pList->cRangesMax * 2 : 64;
+        PVCIBLKRANGE paRangesNew = (PVCIBLKRANGE)RTMemRealloc(pList->paRanges, cRangesNew * sizeof(VCIBLKRANGE));
+        if (!paRangesNew)
+            return VERR_NO_MEMORY;
+
+        pList->paRanges   = paRangesNew;
+        pList->cRangesMax = cRangesNew;
+    }
+
+    pList->paRanges[pList->cRanges].offAddrStart = offAddrStart;
+    pList->paRanges[pList->cRanges].cBlocks      = cBlocks;
+    pList->cRanges++;
+    return VINF_SUCCESS;
+}
+
+/**
+ * Returns all ranges of a block list to the block map and empties the list.
+ *
+ * @returns nothing.
+ * @param   pList            The block list.
+ * @param   pBlkMap          The block bitmap.
+ */
+static void vciBlkListRelease(PVCIBLKLIST pList, PVCIBLKMAP pBlkMap)
+{
+    for (unsigned i = 0; i < pList->cRanges; i++)
+        vciBlkMapFree(pBlkMap, pList->paRanges[i].offAddrStart, pList->paRanges[i].cBlocks);
+    pList->cRanges = 0;
+}
+
+/**
+ * Frees the memory of a block list.
  *
- * @returns Pointer to the in memory tree node.
- * @param   offBlockAddrNode    Block address of the node.
- * @param   pNodeImage          Pointer to the image representation of the node.
+ * @returns nothing.
+ * @param   pList            The block list.
+ */
+static void vciBlkListDestroy(PVCIBLKLIST pList)
+{
+    if (pList->paRanges)
+        RTMemFree(pList->paRanges);
+    pList->paRanges   = NULL;
+    pList->cRanges    = 0;
+    pList->cRangesMax = 0;
+}
+
+/**
+ * Returns the number of blocks needed to write a B+-Tree for the given
+ * number of extents.
+ *
+ * @returns Number of blocks.
+ * @param   cExtents         Number of extents.
+ */
+static uint64_t vciTreeBlocksNeeded(uint64_t cExtents)
+{
+    uint64_t cNodes = RT_MAX(1, (cExtents + VCI_TREE_EXTENTS_PER_NODE - 1) / VCI_TREE_EXTENTS_PER_NODE);
+    uint64_t cNodesTotal = cNodes;
+
+    while (cNodes > 1)
+    {
+        cNodes = (cNodes + VCI_TREE_INTERNAL_NODES_PER_NODE - 1) / VCI_TREE_INTERNAL_NODES_PER_NODE;
+        cNodesTotal += cNodes;
+    }
+
+    return cNodesTotal * VCI_TREE_NODE_BLOCKS;
+}
+
+/**
+ * Allocates space for a tree node and writes it.
+ *
+ * @returns VBox status code.
+ * @param   pCache           The cache image instance.
+ * @param   pNodes           Where to record the blocks of the node.
+ * @param   pNode            The node to write.
+ * @param   poffNode         Where to store the block address of the node.
+ */
+static int vciTreeNodeWrite(PVCICACHE pCache, PVCIBLKLIST pNodes, PVciTreeNode pNode, uint64_t *poffNode)
+{
+    uint64_t offNode = 0;
+    int rc = vciBlkMapAllocate(pCache->pBlkMap, VCI_TREE_NODE_BLOCKS, &offNode, NULL);
+    if (RT_SUCCESS(rc))
+    {
+        rc = vciBlkListAdd(pNodes, offNode, VCI_TREE_NODE_BLOCKS);
+        if (RT_SUCCESS(rc))
+            rc = vciFileWriteSync(pCache, offNode, pNode, VCI_TREE_NODE_BLOCKS);
+        else
+            vciBlkMapFree(pCache->pBlkMap, offNode, VCI_TREE_NODE_BLOCKS);
+    }
+
+    *poffNode = offNode;
+    return rc;
+}
+
+/**
+ * Writes the leaf being assembled and records it for the next level.
+ *
+ * @returns VBox status code.
+ * @param   pSave            The tree save state.
  */
-static PVCITREENODE vciTreeNodeImage2Host(uint64_t offBlockAddrNode, PVciTreeNode pNodeImage)
+static int vciTreeSaveLeaf(PVCITREESAVE pSave)
 {
-    PVCITREENODE pNode = NULL;
+    PVCITREECHILD pChild = &pSave->paChildren[pSave->cChildren];
+    int rc = vciTreeNodeWrite(pSave->pCache, pSave->pNodes, &pSave->Node, &pChild->offNode);
+    if (RT_SUCCESS(rc))
+    {
+        pChild->u64BlockFirst = pSave->u64BlockFirst;
+        pChild->u64BlockLast  = pSave->u64BlockLast;
+        pSave->cChildren++;
+        pSave->cEntries = 0;
+        memset(&pSave->Node, 0, sizeof(VciTreeNode));
+        pSave->Node.u8Type = VCI_TREE_NODE_TYPE_LEAF;
+    }
+
+    return rc;
+}
+
+/**
+ * @callback_method_impl{AVLRU64CALLBACK, Adds an extent to the leaf being assembled.}
+ */
+static DECLCALLBACK(int) vciTreeSaveExtent(PAVLRU64NODECORE pCore, void *pvUser)
+{
+    PVCITREESAVE pSave = (PVCITREESAVE)pvUser;
+    PVCICACHE pCache = pSave->pCache;
+    PVCICACHEEXTENT pExtent = (PVCICACHEEXTENT)pCore;
+    PVciCacheExtent pExtentImage = (PVciCacheExtent)&pSave->Node.au8Data[0] + pSave->cEntries;
+    uint64_t u64ExtentPrev = VCI_CACHE_EXTENT_NIL;
+    uint64_t u64ExtentNext = VCI_CACHE_EXTENT_NIL;
+
+    if (!RTListNodeIsFirst(&pCache->ListLru, &pExtent->NodeLru))
+        u64ExtentPrev = RTListNodeGetPrev(&pExtent->NodeLru, VCICACHEEXTENT, NodeLru)->Core.Key;
+    if (!RTListNodeIsLast(&pCache->ListLru, &pExtent->NodeLru))
+        u64ExtentNext = RTListNodeGetNext(&pExtent->NodeLru, VCICACHEEXTENT, NodeLru)->Core.Key;
+
+    pExtentImage->u64ExtentPrev  = RT_H2LE_U64(u64ExtentPrev);
+    pExtentImage->u64ExtentNext  = RT_H2LE_U64(u64ExtentNext);
+    pExtentImage->u8Flags        = pExtent->fFlags;
+    pExtentImage->u8Reserved     = 0;
+    pExtentImage->u64BlockOffset = RT_H2LE_U64(pExtent->Core.Key);
+    pExtentImage->u32Blocks      = RT_H2LE_U32((uint32_t)VCI_EXTENT_BLOCKS(pExtent));
+    pExtentImage->u64BlockAddr   = RT_H2LE_U64(pExtent->u64BlockAddr);
+
+    if (!pSave->cEntries)
+        pSave->u64BlockFirst = pExtent->Core.Key;
+    pSave->u64BlockLast = pExtent->Core.KeyLast;
+    pSave->cEntries++;
+
+    if (pSave->cEntries == VCI_TREE_EXTENTS_PER_NODE)
+        return vciTreeSaveLeaf(pSave);
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Writes the B+-Tree for the current set of extents to newly allocated
+ * blocks. The leaves are written in key order, the internal levels are
+ * built bottom up.
+ *
+ * @returns VBox status code.
+ * @param   pCache           The cache image instance.
+ * @param   pNodes           Where to record the blocks of the new nodes.
+ * @param   poffRoot         Where to store the block address of the new root.
+ */
+static int vciTreeSave(PVCICACHE pCache, PVCIBLKLIST pNodes, uint64_t *poffRoot)
+{
+    int rc = VINF_SUCCESS;
+    size_t cLeaves = (size_t)RT_MAX(1, (pCache->cExtents + VCI_TREE_EXTENTS_PER_NODE - 1) / VCI_TREE_EXTENTS_PER_NODE);
+    PVCITREESAVE pSave = (PVCITREESAVE)RTMemAllocZ(sizeof(VCITREESAVE));
+
+    if (!pSave)
+        return VERR_NO_MEMORY;
+
+    pSave->pCache      = pCache;
+    pSave->pNodes      = pNodes;
+    pSave->Node.u8Type = VCI_TREE_NODE_TYPE_LEAF;
+    pSave->paChildren  = (PVCITREECHILD)RTMemAlloc(cLeaves * sizeof(VCITREECHILD));
+    if (!pSave->paChildren)
+    {
+        RTMemFree(pSave);
+        return VERR_NO_MEMORY;
+    }
+
+    rc = RTAvlrU64DoWithAll(&pCache->TreeExtents, true /* fFromLeft */, vciTreeSaveExtent, pSave);
+
+    /* Write the last partially filled leaf, or an empty root for an empty cache. */
+    if (   RT_SUCCESS(rc)
+        && (pSave->cEntries || !pSave->cChildren))
+        rc = vciTreeSaveLeaf(pSave);
 
-    if (pNodeImage->u8Type == VCI_TREE_NODE_TYPE_LEAF)
+    /* Build the internal levels until only the root is left. The parents
+     * replace their children in the array as it is walked. */
+    while (   RT_SUCCESS(rc)
+           && pSave->cChildren > 1)
     {
-        PVCITREENODELEAF pLeaf = (PVCITREENODELEAF)RTMemAllocZ(sizeof(VCITREENODELEAF));
+        unsigned cParents = 0;
 
-        if (pLeaf)
+        for (unsigned i = 0; i < pSave->cChildren && RT_SUCCESS(rc); i += VCI_TREE_INTERNAL_NODES_PER_NODE)
         {
-            PVciCacheExtent pExtent = (PVciCacheExtent)&pNodeImage->au8Data[0];
+            unsigned cEntries = RT_MIN(VCI_TREE_INTERNAL_NODES_PER_NODE, pSave->cChildren - i);
+            PVciTreeNodeInternal pIntImage = (PVciTreeNodeInternal)&pSave->Node.au8Data[0];
+            uint64_t u64BlockFirst = pSave->paChildren[i].u64BlockFirst;
+            uint64_t u64BlockLast  = pSave->paChildren[i + cEntries - 1].u64BlockLast;
+            uint64_t offNode = 0;
 
-            pLeaf->Core.u8Type = VCI_TREE_NODE_TYPE_LEAF;
+            memset(&pSave->Node, 0, sizeof(VciTreeNode));
+            pSave->Node.u8Type = VCI_TREE_NODE_TYPE_INTERNAL;
 
-            for (unsigned idx = 0; idx < RT_ELEMENTS(pLeaf->aExtents); idx++)
+            for (unsigned j = 0; j < cEntries; j++, pIntImage++)
             {
-                pLeaf->aExtents[idx].u64BlockOffset = RT_LE2H_U64(pExtent->u64BlockOffset);
-                pLeaf->aExtents[idx].u32Blocks      = RT_LE2H_U32(pExtent->u32Blocks);
-                pLeaf->aExtents[idx].u64BlockAddr   = RT_LE2H_U64(pExtent->u64BlockAddr);
-                pExtent++;
-
-                if (   pLeaf->aExtents[idx].u32Blocks
-                    && pLeaf->aExtents[idx].u64BlockAddr)
-                    pLeaf->cUsedNodes++;
+                PVCITREECHILD pChild = &pSave->paChildren[i + j];
+
+                pIntImage->u64BlockOffset = RT_H2LE_U64(pChild->u64BlockFirst);
+                pIntImage->u32Blocks      = RT_H2LE_U32((uint32_t)RT_MIN(pChild->u64BlockLast - pChild->u64BlockFirst + 1, UINT32_MAX));
+                pIntImage->u64ChildAddr   = RT_H2LE_U64(pChild->offNode);
             }
 
-            pNode = &pLeaf->Core;
+            rc = vciTreeNodeWrite(pCache, pNodes, &pSave->Node, &offNode);
+            if (RT_SUCCESS(rc))
+            {
+                pSave->paChildren[cParents].u64BlockFirst = u64BlockFirst;
+                pSave->paChildren[cParents].u64BlockLast  = u64BlockLast;
+                pSave->paChildren[cParents].offNode       = offNode;
+                cParents++;
+            }
         }
+
+        pSave->cChildren = cParents;
     }
-    else if (pNodeImage->u8Type == VCI_TREE_NODE_TYPE_INTERNAL)
-    {
-        PVCITREENODEINT pInt = (PVCITREENODEINT)RTMemAllocZ(sizeof(VCITREENODEINT));
 
-        if (pInt)
+    if (RT_SUCCESS(rc))
+        *poffRoot = pSave->paChildren[0].offNode;
+
+    RTMemFree(pSave->paChildren);
+    RTMemFree(pSave);
+    return rc;
+}
+
+/**
+ * Loads a node of the B+-Tree and all its children.
+ *
+ * @returns VBox status code.
+ * @param   pCache           The cache image instance.
+ * @param   pLoad            The tree load state.
+ * @param   pNode            Buffer for the node.
+ * @param   offNode          Block address of the node.
+ * @param   cDepth           Depth of the node in the tree.
+ */
+static int vciTreeLoadNode(PVCICACHE pCache, PVCITREELOAD pLoad, uint64_t offNode, unsigned cDepth)
+{
+    int rc = VINF_SUCCESS;
+    PVciTreeNode pNode;
+
+    if (   cDepth > VCI_TREE_DEPTH_MAX
+        || !offNode
+        || offNode >= pCache->cBlocksCache
+        || pCache->cBlocksCache - offNode < VCI_TREE_NODE_BLOCKS)
+        return VERR_VD_GEN_INVALID_HEADER;
+
+    pNode = (PVciTreeNode)RTMemTmpAlloc(sizeof(VciTreeNode));
+    if (!pNode)
+        return VERR_NO_MEMORY;
+
+    rc = vciFileReadSync(pCache, offNode, pNode, VCI_TREE_NODE_BLOCKS);
+    if (RT_SUCCESS(rc))
+        rc = vciBlkListAdd(&pCache->NodesTree, offNode, VCI_TREE_NODE_BLOCKS);
+
+    if (RT_SUCCESS(rc))
+    {
+        if (pNode->u8Type == VCI_TREE_NODE_TYPE_LEAF)
+        {
+            PVciCacheExtent pExtentImage = (PVciCacheExtent)&pNode->au8Data[0];
+
+            for (unsigned idx = 0; idx < VCI_TREE_EXTENTS_PER_NODE && RT_SUCCESS(rc); idx++, pExtentImage++)
+            {
+                uint32_t cBlocks        = RT_LE2H_U32(pExtentImage->u32Blocks);
+                uint64_t u64BlockOffset = RT_LE2H_U64(pExtentImage->u64BlockOffset);
+                uint64_t u64BlockAddr   = RT_LE2H_U64(pExtentImage->u64BlockAddr);
+
+                /* Unused entries are zeroed. */
+                if (!cBlocks)
+                    continue;
+
+                if (   u64BlockAddr >= pCache->cBlocksCache
+                    || pCache->cBlocksCache - u64BlockAddr < cBlocks
+                    || u64BlockOffset + cBlocks < u64BlockOffset)
+                {
+                    rc = VERR_VD_GEN_INVALID_HEADER;
+                    break;
+                }
+
+                if (pLoad->cExtents == pLoad->cExtentsMax)
+                {
+                    size_t cExtentsNew = pLoad->cExtentsMax ? pLoad->cExtentsMax * 2 : 256;
+                    PVCITREELOADEXTENT paExtentsNew = (PVCITREELOADEXTENT)RTMemRealloc(pLoad->paExtents,
+                                                                                       cExtentsNew * sizeof(VCITREELOADEXTENT));
+                    if (!paExtentsNew)
+                    {
+                        rc = VERR_NO_MEMORY;
+                        break;
+                    }
+                    pLoad->paExtents   = paExtentsNew;
+                    pLoad->cExtentsMax = cExtentsNew;
+                }
+
+                PVCICACHEEXTENT pExtent = (PVCICACHEEXTENT)RTMemAllocZ(sizeof(VCICACHEEXTENT));
+                if (!pExtent)
+                {
+                    rc = VERR_NO_MEMORY;
+                    break;
+                }
+
+                pExtent->Core.Key     = u64BlockOffset;
+                pExtent->Core.KeyLast = u64BlockOffset + cBlocks - 1;
+                pExtent->u64BlockAddr = u64BlockAddr;
+                pExtent->fFlags       = pExtentImage->u8Flags & VCI_CACHE_EXTENT_FLAGS_DIRTY;
+                if (!RTAvlrU64Insert(&pCache->TreeExtents, &pExtent->Core))
+                {
+                    /* Overlapping extents. */
+                    RTMemFree(pExtent);
+                    rc = VERR_VD_GEN_INVALID_HEADER;
+                    break;
+                }
+
+                RTListAppend(&pCache->ListLru, &pExtent->NodeLru);
+                pCache->cExtents++;
+                pCache->cBlocksData += cBlocks;
+                if (pExtent->fFlags & VCI_CACHE_EXTENT_FLAGS_DIRTY)
+                    pCache->cBlocksDirty += cBlocks;
+
+                if (   pLoad->cExtents
+                    && pLoad->paExtents[pLoad->cExtents - 1].pExtent->Core.Key > u64BlockOffset)
+                    pLoad->fUnsorted = true;
+
+                pLoad->paExtents[pLoad->cExtents].pExtent       = pExtent;
+                pLoad->paExtents[pLoad->cExtents].u64ExtentPrev = RT_LE2H_U64(pExtentImage->u64ExtentPrev);
+                pLoad->paExtents[pLoad->cExtents].u64ExtentNext = RT_LE2H_U64(pExtentImage->u64ExtentNext);
+                pLoad->cExtents++;
+            }
+        }
+        else if (pNode->u8Type == VCI_TREE_NODE_TYPE_INTERNAL)
+        {
+            /* Copy the child addresses first so the buffer can be freed before descending. */
+            uint64_t aoffChildren[VCI_TREE_INTERNAL_NODES_PER_NODE];
+            PVciTreeNodeInternal pIntImage = (PVciTreeNodeInternal)&pNode->au8Data[0];
+            unsigned cChildren = 0;
+
+            for (unsigned idx = 0; idx < VCI_TREE_INTERNAL_NODES_PER_NODE; idx++, pIntImage++)
+            {
+                uint64_t offChild = RT_LE2H_U64(pIntImage->u64ChildAddr);
+                if (offChild)
+                    aoffChildren[cChildren++] = offChild;
+            }
+
+            RTMemTmpFree(pNode);
+            pNode = NULL;
+
+            for (unsigned idx = 0; idx < cChildren && RT_SUCCESS(rc); idx++)
+                rc = vciTreeLoadNode(pCache, pLoad, aoffChildren[idx], cDepth + 1);
+        }
+        else
+            rc = VERR_VD_GEN_INVALID_HEADER;
+    }
+
+    if (pNode)
+        RTMemTmpFree(pNode);
+    return rc;
+}
+
+/**
+ * Looks up a loaded extent by its first block.
+ *
+ * @returns Index of the extent or pLoad->cExtents if not found.
+ * @param   pLoad            The tree load state, sorted by key.
+ * @param   u64BlockOffset   First block of the extent.
+ */
+static size_t vciTreeLoadFind(PVCITREELOAD pLoad, uint64_t u64BlockOffset)
+{
+    size_t idxMin = 0;
+    size_t idxMax = pLoad->cExtents;
+
+    while (idxMin < idxMax)
+    {
+        size_t idxCur = idxMin + (idxMax - idxMin) / 2;
+        uint64_t u64Key = pLoad->paExtents[idxCur].pExtent->Core.Key;
+
+        if (u64BlockOffset < u64Key)
+            idxMax = idxCur;
+        else if (u64BlockOffset > u64Key)
+            idxMin = idxCur + 1;
+        else
+            return idxCur;
+    }
+
+    return pLoad->cExtents;
+}
+
+/**
+ * Loads the B+-Tree into the in memory extent tree and restores the LRU
+ * order from the links stored in the extents.
+ *
+ * @returns VBox status code.
+ * @param   pCache           The cache image instance.
+ */
+static int vciTreeLoad(PVCICACHE pCache)
+{
+    VCITREELOAD Load;
+    int rc;
+
+    RT_ZERO(Load);
+    rc = vciTreeLoadNode(pCache, &Load, pCache->offTreeRoot, 0);
+    if (   RT_SUCCESS(rc)
+        && Load.cExtents
+        && !Load.fUnsorted)
+    {
+        /* The extents are in key order in the list. Rebuild it in LRU order if
+         * the links are usable, anything not reachable goes to the tail. */
+        bool *pafVisited = (bool *)RTMemAllocZ(Load.cExtents * sizeof(bool));
+        if (pafVisited)
+        {
+            size_t idx = 0;
+
+            while (   idx < Load.cExtents
+                   && Load.paExtents[idx].u64ExtentPrev != VCI_CACHE_EXTENT_NIL)
+                idx++;
+
+            RTListInit(&pCache->ListLru);
+            while (   idx < Load.cExtents
+                   && !pafVisited[idx])
+            {
+                pafVisited[idx] = true;
+                RTListAppend(&pCache->ListLru, &Load.paExtents[idx].pExtent->NodeLru);
+                idx = vciTreeLoadFind(&Load, Load.paExtents[idx].u64ExtentNext);
+            }
+
+            for (idx = 0; idx < Load.cExtents; idx++)
+                if (!pafVisited[idx])
+                    RTListAppend(&pCache->ListLru, &Load.paExtents[idx].pExtent->NodeLru);
+
+            RTMemFree(pafVisited);
+        }
+    }
+
+    if (Load.paExtents)
+        RTMemFree(Load.paExtents);
+    return rc;
+}
+
+/**
+ * @callback_method_impl{AVLRU64CALLBACK, Marks the blocks of an extent as allocated.}
+ */
+static DECLCALLBACK(int) vciBlkMapRebuildExtent(PAVLRU64NODECORE pCore, void *pvUser)
+{
+    PVCICACHEEXTENT pExtent = (PVCICACHEEXTENT)pCore;
+
+    return vciBlkMapSetAllocated((PVCIBLKMAP)pvUser, pExtent->u64BlockAddr, VCI_EXTENT_BLOCKS(pExtent));
+}
+
+/**
+ * Rebuilds the block map from the loaded B+-Tree. Used when the cache was not
+ * closed cleanly because the block map on disk might not match the tree.
+ *
+ * @returns VBox status code.
+ * @param   pCache           The cache image instance.
+ * @param   ppBlkMap         Where to store the block map on success.
+ */
+static int vciBlkMapRebuild(PVCICACHE pCache, PVCIBLKMAP *ppBlkMap)
+{
+    PVCIBLKMAP pBlkMap = NULL;
+    uint32_t cBlkMap = 0;
+    int rc = vciBlkMapCreate(pCache->cBlocksCache, &pBlkMap, &cBlkMap);
+
+    if (RT_SUCCESS(rc))
+    {
+        rc = vciBlkMapSetAllocated(pBlkMap, 0, VCI_BYTE2BLOCK(sizeof(VciHdr)));
+        if (RT_SUCCESS(rc))
+            rc = vciBlkMapSetAllocated(pBlkMap, pCache->offBlksBitmap, cBlkMap);
+        for (unsigned i = 0; i < pCache->NodesTree.cRanges && RT_SUCCESS(rc); i++)
+            rc = vciBlkMapSetAllocated(pBlkMap, pCache->NodesTree.paRanges[i].offAddrStart,
+                                       pCache->NodesTree.paRanges[i].cBlocks);
+        if (RT_SUCCESS(rc))
+            rc = RTAvlrU64DoWithAll(&pCache->TreeExtents, true /* fFromLeft */, vciBlkMapRebuildExtent, pBlkMap);
+
+        if (RT_SUCCESS(rc))
+            *ppBlkMap = pBlkMap;
+        else
+            vciBlkMapDestroy(pBlkMap);
+    }
+
+    return rc;
+}
+
+/**
+ * Writes the header.
+ *
+ * @returns VBox status code.
+ * @param   pCache           The cache image instance.
+ * @param   offTreeRoot      Block address of the tree root to reference.
+ * @param   fUnclean         Whether to mark the cache as in use.
+ */
+static int vciHdrWrite(PVCICACHE pCache, uint64_t offTreeRoot, bool fUnclean)
+{
+    VciHdr Hdr;
+
+    memset(&Hdr, 0, sizeof(VciHdr));
+    Hdr.u32Signature     = RT_H2LE_U32(VCI_HDR_SIGNATURE);
+    Hdr.u32Version       = RT_H2LE_U32(VCI_HDR_VERSION);
+    Hdr.cBlocksCache     = RT_H2LE_U64(pCache->cBlocksCache);
+    Hdr.fUncleanShutdown = fUnclean ? VCI_HDR_UNCLEAN_SHUTDOWN : VCI_HDR_CLEAN_SHUTDOWN;
+    Hdr.u32CacheType     = pCache->uImageFlags & VD_IMAGE_FLAGS_FIXED
+                           ? RT_H2LE_U32(VCI_HDR_CACHE_TYPE_FIXED)
+                           : RT_H2LE_U32(VCI_HDR_CACHE_TYPE_DYNAMIC);
+    Hdr.offTreeRoot      = RT_H2LE_U64(offTreeRoot);
+    Hdr.offBlkMap        = RT_H2LE_U64(pCache->offBlksBitmap);
+    Hdr.cBlkMap          = RT_H2LE_U32(pCache->cBlkMap);
+    memcpy(&Hdr.uuidImage, &pCache->uuidImage, sizeof(RTUUID));
+    memcpy(&Hdr.uuidModification, &pCache->uuidModification, sizeof(RTUUID));
+
+    return vciFileWriteSync(pCache, 0, &Hdr, VCI_BYTE2BLOCK(sizeof(VciHdr)));
+}
+
+/**
+ * Writes the block map with up to date counters.
+ *
+ * @returns VBox status code.
+ * @param   pCache           The cache image instance.
+ */
+static int vciCacheBlkMapSave(PVCICACHE pCache)
+{
+    PVCIBLKMAP pBlkMap = pCache->pBlkMap;
+
+    pBlkMap->cBlocksAllocData = pCache->cBlocksData;
+    pBlkMap->cBlocksAllocMeta = pBlkMap->cBlocks - pBlkMap->cBlocksFree - pCache->cBlocksData;
+    return vciBlkMapSave(pBlkMap, pCache, pCache->offBlksBitmap, pCache->cBlkMap);
+}
+
+/**
+ * Writes the state of the cache to the image.
+ *
+ * The new B+-Tree goes to free blocks and the block map is written before the
+ * header is switched to the new root, so the header always references a
+ * complete tree and a block map covering it. The blocks of the previous tree
+ * and the data blocks freed since the last commit are reused only afterwards.
+ * The header is marked unclean while the block map on disk might not be
+ * exact, the next open rebuilds the block map from the tree in that case.
+ *
+ * @returns VBox status code.
+ * @param   pCache           The cache image instance.
+ * @param   fClose           Whether the cache is closed, marks it clean.
+ */
+static int vciCacheCommit(PVCICACHE pCache, bool fClose)
+{
+    int rc = VINF_SUCCESS;
+    bool fFlushed = false;
+
+    if (pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+        return VINF_SUCCESS;
+
+    if (pCache->fTreeDirty)
+    {
+        VCIBLKLIST NodesNew;
+        uint64_t offTreeRoot = 0;
+
+        RT_ZERO(NodesNew);
+
+        /* Mark the cache as in use before the block map is overwritten. */
+        if (!pCache->fUncleanOnDisk)
+        {
+            rc = vciHdrWrite(pCache, pCache->offTreeRoot, true);
+            if (RT_SUCCESS(rc))
+                rc = vciFileFlushSync(pCache);
+            if (RT_SUCCESS(rc))
+                pCache->fUncleanOnDisk = true;
+        }
+
+        if (RT_SUCCESS(rc))
+            rc = vciTreeSave(pCache, &NodesNew, &offTreeRoot);
+        if (RT_SUCCESS(rc))
+            rc = vciCacheBlkMapSave(pCache);
+        if (RT_SUCCESS(rc))
+            rc = vciFileFlushSync(pCache);
+        if (RT_SUCCESS(rc))
+            rc = vciHdrWrite(pCache, offTreeRoot, true);
+        if (RT_SUCCESS(rc))
+            rc = vciFileFlushSync(pCache);
+
+        if (RT_SUCCESS(rc))
+        {
+            /* The new tree is active, release what the old one referenced. */
+            vciBlkListRelease(&pCache->NodesTree, pCache->pBlkMap);
+            vciBlkListRelease(&pCache->BlksFreePending, pCache->pBlkMap);
+            vciBlkListDestroy(&pCache->NodesTree);
+            pCache->NodesTree   = NodesNew;
+            pCache->offTreeRoot = offTreeRoot;
+            pCache->fTreeDirty  = false;
+            pCache->fHdrDirty   = false;
+            fFlushed = true;
+        }
+        else
+        {
+            vciBlkListRelease(&NodesNew, pCache->pBlkMap);
+            vciBlkListDestroy(&NodesNew);
+        }
+    }
+
+    if (   RT_SUCCESS(rc)
+        && (   pCache->fHdrDirty
+            || (fClose && pCache->fUncleanOnDisk)))
+    {
+        /* The block map written with the tree still has the blocks released
+         * afterwards allocated, write the exact one before marking the cache clean. */
+        if (fClose && pCache->fUncleanOnDisk)
+        {
+            rc = vciCacheBlkMapSave(pCache);
+            if (RT_SUCCESS(rc))
+                rc = vciFileFlushSync(pCache);
+        }
+
+        if (RT_SUCCESS(rc))
+            rc = vciHdrWrite(pCache, pCache->offTreeRoot, !fClose && pCache->fUncleanOnDisk);
+        if (RT_SUCCESS(rc))
+            rc = vciFileFlushSync(pCache);
+        if (RT_SUCCESS(rc))
+        {
+            pCache->fHdrDirty = false;
+            if (fClose)
+                pCache->fUncleanOnDisk = false;
+            fFlushed = true;
+        }
+    }
+
+    if (   RT_SUCCESS(rc)
+        && !fFlushed)
+        rc = vciFileFlushSync(pCache);
+
+    return rc;
+}
+
+/**
+ * Moves an extent to the head of the LRU list.
+ *
+ * @returns nothing.
+ * @param   pCache           The cache image instance.
+ * @param   pExtent          The extent which was accessed.
+ */
+DECLINLINE(void) vciCacheExtentTouch(PVCICACHE pCache, PVCICACHEEXTENT pExtent)
+{
+    RTListNodeRemove(&pExtent->NodeLru);
+    RTListPrepend(&pCache->ListLru, &pExtent->NodeLru);
+}
+
+/**
+ * Splits an extent in two.
+ *
+ * @returns Pointer to the new extent starting at the given block or NULL if
+ *          out of memory.
+ * @param   pCache           The cache image instance.
+ * @param   pExtent          The extent to split.
+ * @param   uBlock           First block of the second part.
+ */
+static PVCICACHEEXTENT vciCacheExtentSplit(PVCICACHE pCache, PVCICACHEEXTENT pExtent, uint64_t uBlock)
+{
+    PVCICACHEEXTENT pExtentNew = (PVCICACHEEXTENT)RTMemAllocZ(sizeof(VCICACHEEXTENT));
+
+    Assert(   uBlock > pExtent->Core.Key
+           && uBlock <= pExtent->Core.KeyLast);
+
+    if (pExtentNew)
+    {
+        pExtentNew->Core.Key     = uBlock;
+        pExtentNew->Core.KeyLast = pExtent->Core.KeyLast;
+        pExtentNew->u64BlockAddr = pExtent->u64BlockAddr + (uBlock - pExtent->Core.Key);
+        pExtentNew->fFlags       = pExtent->fFlags;
+        pExtent->Core.KeyLast    = uBlock - 1;
+
+        RTAvlrU64Insert(&pCache->TreeExtents, &pExtentNew->Core);
+        RTListNodeInsertAfter(&pExtent->NodeLru, &pExtentNew->NodeLru);
+        pCache->cExtents++;
+        pCache->fTreeDirty = true;
+    }
+
+    return pExtentNew;
+}
+
+/**
+ * Splits the extents at the boundaries of the given range so every extent
+ * overlapping the range lies completely inside it.
+ *
+ * @returns VBox status code.
+ * @param   pCache           The cache image instance.
+ * @param   uBlockFirst      First block of the range.
+ * @param   uBlockLast       Last block of the range.
+ */
+static int vciCacheExtentsIsolate(PVCICACHE pCache, uint64_t uBlockFirst, uint64_t uBlockLast)
+{
+    PVCICACHEEXTENT pExtent = (PVCICACHEEXTENT)RTAvlrU64RangeGet(&pCache->TreeExtents, uBlockFirst);
+
+    if (   pExtent
+        && pExtent->Core.Key < uBlockFirst
+        && !vciCacheExtentSplit(pCache, pExtent, uBlockFirst))
+        return VERR_NO_MEMORY;
+
+    pExtent = (PVCICACHEEXTENT)RTAvlrU64RangeGet(&pCache->TreeExtents, uBlockLast);
+    if (   pExtent
+        && pExtent->Core.KeyLast > uBlockLast
+        && !vciCacheExtentSplit(pCache, pExtent, uBlockLast + 1))
+        return VERR_NO_MEMORY;
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Returns the first extent containing or following the given block.
+ *
+ * @returns Pointer to the extent or NULL if there is none.
+ * @param   pCache           The cache image instance.
+ * @param   uBlock           The block to start at.
+ */
+DECLINLINE(PVCICACHEEXTENT) vciCacheExtentGetFrom(PVCICACHE pCache, uint64_t uBlock)
+{
+    PVCICACHEEXTENT pExtent = (PVCICACHEEXTENT)RTAvlrU64RangeGet(&pCache->TreeExtents, uBlock);
+
+    if (!pExtent)
+        pExtent = (PVCICACHEEXTENT)RTAvlrU64GetBestFit(&pCache->TreeExtents, uBlock, true /* fAbove */);
+    return pExtent;
+}
+
+/**
+ * Removes an extent from the cache. The data blocks become reusable after
+ * the next commit.
+ *
+ * @returns nothing.
+ * @param   pCache           The cache image instance.
+ * @param   pExtent          The extent to remove.
+ */
+static void vciCacheExtentDestroy(PVCICACHE pCache, PVCICACHEEXTENT pExtent)
+{
+    uint64_t cBlocks = VCI_EXTENT_BLOCKS(pExtent);
+
+    RTAvlrU64Remove(&pCache->TreeExtents, pExtent->Core.Key);
+    RTListNodeRemove(&pExtent->NodeLru);
+
+    /* If this fails the blocks are leaked until the block map is rebuilt. */
+    vciBlkListAdd(&pCache->BlksFreePending, pExtent->u64BlockAddr, cBlocks);
+
+    pCache->cBlocksData -= cBlocks;
+    if (pExtent->fFlags & VCI_CACHE_EXTENT_FLAGS_DIRTY)
+        pCache->cBlocksDirty -= cBlocks;
+    pCache->cExtents--;
+    pCache->fTreeDirty = true;
+    RTMemFree(pExtent);
+}
+
+/**
+ * Adds a new extent to the cache, merging it with the preceding one if the
+ * data is stored contiguously.
+ *
+ * @returns VBox status code.
+ * @param   pCache           The cache image instance.
+ * @param   uBlock           First block of cached data.
+ * @param   cBlocks          Number of blocks.
+ * @param   u64BlockAddr     Where the data is stored in the image.
+ * @param   fFlags           Extent flags.
+ */
+static int vciCacheExtentInsert(PVCICACHE pCache, uint64_t uBlock, uint64_t cBlocks,
+                                uint64_t u64BlockAddr, uint8_t fFlags)
+{
+    PVCICACHEEXTENT pExtent = uBlock
+                            ? (PVCICACHEEXTENT)RTAvlrU64RangeGet(&pCache->TreeExtents, uBlock - 1)
+                            : NULL;
+
+    if (   pExtent
+        && pExtent->fFlags == fFlags
+        && pExtent->u64BlockAddr + VCI_EXTENT_BLOCKS(pExtent) == u64BlockAddr
+        && VCI_EXTENT_BLOCKS(pExtent) + cBlocks <= VCI_CACHE_EXTENT_BLOCKS_MAX)
+        pExtent->Core.KeyLast += cBlocks;
+    else
+    {
+        pExtent = (PVCICACHEEXTENT)RTMemAllocZ(sizeof(VCICACHEEXTENT));
+        if (!pExtent)
+            return VERR_NO_MEMORY;
+
+        pExtent->Core.Key     = uBlock;
+        pExtent->Core.KeyLast = uBlock + cBlocks - 1;
+        pExtent->u64BlockAddr = u64BlockAddr;
+        pExtent->fFlags       = fFlags;
+        RTAvlrU64Insert(&pCache->TreeExtents, &pExtent->Core);
+        RTListInit(&pExtent->NodeLru);
+        pCache->cExtents++;
+    }
+
+    vciCacheExtentTouch(pCache, pExtent);
+    pCache->cBlocksData += cBlocks;
+    if (fFlags & VCI_CACHE_EXTENT_FLAGS_DIRTY)
+        pCache->cBlocksDirty += cBlocks;
+    pCache->fTreeDirty = true;
+    return VINF_SUCCESS;
+}
+
+/**
+ * Evicts clean extents from the tail of the LRU list and commits the cache
+ * so the space can be reused.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_CACHE_FULL if nothing could be evicted.
+ * @param   pCache           The cache image instance.
+ * @param   cBlocks          Minimum number of blocks to make available.
+ */
+static int vciCacheEvict(PVCICACHE pCache, uint64_t cBlocks)
+{
+    uint64_t cBlocksEvict = RT_MAX(cBlocks, pCache->cBlocksCache >> VCI_EVICT_BATCH_SHIFT);
+    uint64_t cBlocksEvicted = 0;
+    PVCICACHEEXTENT pExtent, pExtentPrev;
+
+    RTListForEachReverseSafe(&pCache->ListLru, pExtent, pExtentPrev, VCICACHEEXTENT, NodeLru)
+    {
+        if (cBlocksEvicted >= cBlocksEvict)
+            break;
+
+        /* Dirty data must be written back first. */
+        if (pExtent->fFlags & VCI_CACHE_EXTENT_FLAGS_DIRTY)
+            continue;
+
+        cBlocksEvicted += VCI_EXTENT_BLOCKS(pExtent);
+        vciCacheExtentDestroy(pCache, pExtent);
+    }
+
+    if (   !cBlocksEvicted
+        && !pCache->BlksFreePending.cRanges)
+        return VERR_VD_CACHE_FULL;
+
+    LogFlowFunc(("Evicted %llu blocks\n", cBlocksEvicted));
+    return vciCacheCommit(pCache, false /* fClose */);
+}
+
+/**
+ * Makes sure the B+-Tree can still be written during the next commit after
+ * the given number of extents was added by splitting existing ones,
+ * evicting data if required.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_CACHE_FULL if there is no space left.
+ * @param   pCache           The cache image instance.
+ * @param   cExtentsNew      Number of extents which will be added.
+ */
+static int vciCacheReserveNodes(PVCICACHE pCache, uint64_t cExtentsNew)
+{
+    uint64_t cBlocksTree = vciTreeBlocksNeeded(pCache->cExtents + cExtentsNew);
+    int rc = VINF_SUCCESS;
+
+    if (pCache->pBlkMap->cNodesFree < cBlocksTree / VCI_TREE_NODE_BLOCKS)
+    {
+        rc = vciCacheEvict(pCache, cBlocksTree);
+        if (   RT_SUCCESS(rc)
+            && pCache->pBlkMap->cNodesFree < vciTreeBlocksNeeded(pCache->cExtents + cExtentsNew) / VCI_TREE_NODE_BLOCKS)
+            rc = VERR_VD_CACHE_FULL;
+    }
+
+    return rc;
+}
+
+/**
+ * Allocates blocks for cached data, evicting other data if the cache is full.
+ * Enough free ranges are kept to write the B+-Tree during the next commit,
+ * the tree nodes need contiguous blocks so free blocks alone are not enough.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_CACHE_FULL if there is no space left.
+ * @param   pCache             The cache image instance.
+ * @param   cBlocks            Number of blocks wanted.
+ * @param   poffBlockAddr      Where to store the start address of the allocated range.
+ * @param   pcBlocksAllocated  Where to store the number of blocks allocated,
+ *                             may be less than requested.
+ */
+static int vciCacheAllocData(PVCICACHE pCache, uint64_t cBlocks, uint64_t *poffBlockAddr,
+                             uint64_t *pcBlocksAllocated)
+{
+    int rc = VINF_SUCCESS;
+    bool fEvicted = false;
+
+    for (;;)
+    {
+        /* The new extent might need a new node. Allocating a range from the
+         * start of a free range takes at most one node slot per node sized
+         * chunk of the allocation. */
+        uint64_t cBlocksReserve = vciTreeBlocksNeeded(pCache->cExtents + 1);
+        uint64_t cNodesReserve = cBlocksReserve / VCI_TREE_NODE_BLOCKS;
+        PVCIBLKMAP pBlkMap = pCache->pBlkMap;
+
+        if (pBlkMap->cNodesFree > cNodesReserve)
+        {
+            uint64_t cBlocksMax = (pBlkMap->cNodesFree - cNodesReserve) * VCI_TREE_NODE_BLOCKS;
+
+            rc = vciBlkMapAllocate(pBlkMap, RT_MIN(cBlocks, cBlocksMax),
+                                   poffBlockAddr, pcBlocksAllocated);
+            if (rc != VERR_VD_CACHE_FULL)
+                break;
+        }
+
+        if (fEvicted)
+        {
+            rc = VERR_VD_CACHE_FULL;
+            break;
+        }
+
+        rc = vciCacheEvict(pCache, cBlocks + cBlocksReserve);
+        if (RT_FAILURE(rc))
+            break;
+        fEvicted = true;
+    }
+
+    return rc;
+}
+
+/**
+ * Writes data to the cache, common code for the clean and dirty write paths.
+ *
+ * Cached blocks are updated in place, uncached ones get new space.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_DISK_FULL if there is no space for dirty data,
+ *          *pcbWriteProcess holds the amount written.
+ * @param   pCache           The cache image instance.
+ * @param   uOffset          Offset of the data on the disk.
+ * @param   pvBuf            The data.
+ * @param   cbToWrite        Number of bytes to write.
+ * @param   fDirty           Whether the data is not yet in the image.
+ * @param   pcbWriteProcess  Where to store the number of bytes processed.
+ */
+static int vciCacheWrite(PVCICACHE pCache, uint64_t uOffset, const void *pvBuf,
+                         size_t cbToWrite, bool fDirty, size_t *pcbWriteProcess)
+{
+    int rc = VINF_SUCCESS;
+    uint64_t uBlock = VCI_BYTE2BLOCK(uOffset);
+    uint64_t cBlocksLeft = VCI_BYTE2BLOCK(cbToWrite);
+    const uint8_t *pbBuf = (const uint8_t *)pvBuf;
+
+    while (   RT_SUCCESS(rc)
+           && cBlocksLeft)
+    {
+        PVCICACHEEXTENT pExtent = (PVCICACHEEXTENT)RTAvlrU64RangeGet(&pCache->TreeExtents, uBlock);
+        uint64_t cBlocksThis;
+
+        if (   pExtent
+            && fDirty
+            && !(pExtent->fFlags & VCI_CACHE_EXTENT_FLAGS_DIRTY))
+        {
+            /* Marking part of the extent dirty below splits it. */
+            rc = vciCacheReserveNodes(pCache, 2);
+            if (RT_FAILURE(rc))
+            {
+                if (rc == VERR_VD_CACHE_FULL)
+                    rc = VERR_DISK_FULL;
+                break;
+            }
+
+            /* The extent might have been evicted. */
+            pExtent = (PVCICACHEEXTENT)RTAvlrU64RangeGet(&pCache->TreeExtents, uBlock);
+        }
+
+        if (pExtent)
+        {
+            /* Update the cached data in place. */
+            cBlocksThis = RT_MIN(cBlocksLeft, pExtent->Core.KeyLast - uBlock + 1);
+            rc = vciFileWriteSync(pCache, pExtent->u64BlockAddr + (uBlock - pExtent->Core.Key),
+                                  pbBuf, cBlocksThis);
+            if (RT_FAILURE(rc))
+                break;
+
+            if (   fDirty
+                && !(pExtent->fFlags & VCI_CACHE_EXTENT_FLAGS_DIRTY))
+            {
+                /* Only the part written becomes dirty. */
+                rc = vciCacheExtentsIsolate(pCache, uBlock, uBlock + cBlocksThis - 1);
+                if (RT_FAILURE(rc))
+                    break;
+
+                pExtent = (PVCICACHEEXTENT)RTAvlrU64RangeGet(&pCache->TreeExtents, uBlock);
+                pExtent->fFlags |= VCI_CACHE_EXTENT_FLAGS_DIRTY;
+                pCache->cBlocksDirty += cBlocksThis;
+                pCache->fTreeDirty = true;
+            }
+
+            vciCacheExtentTouch(pCache, pExtent);
+        }
+        else
         {
-            PVciTreeNodeInternal pIntImage = (PVciTreeNodeInternal)&pNodeImage->au8Data[0];
+            /* Not cached yet, allocate space up to the next extent. */
+            PVCICACHEEXTENT pExtentNext = (PVCICACHEEXTENT)RTAvlrU64GetBestFit(&pCache->TreeExtents, uBlock, true /* fAbove */);
+            uint64_t cBlocksGap = cBlocksLeft;
+            uint64_t offBlockAddr = 0;
 
-            pInt->Core.u8Type = VCI_TREE_NODE_TYPE_INTERNAL;
+            if (pExtentNext)
+                cBlocksGap = RT_MIN(cBlocksGap, pExtentNext->Core.Key - uBlock);
+            cBlocksGap = RT_MIN(cBlocksGap, VCI_CACHE_EXTENT_BLOCKS_MAX);
 
-            for (unsigned idx = 0; idx < RT_ELEMENTS(pInt->aIntNodes); idx++)
+            rc = vciCacheAllocData(pCache, cBlocksGap, &offBlockAddr, &cBlocksThis);
+            if (RT_SUCCESS(rc))
             {
-                pInt->aIntNodes[idx].u64BlockOffset              = RT_LE2H_U64(pIntImage->u64BlockOffset);
-                pInt->aIntNodes[idx].u32Blocks                   = RT_LE2H_U32(pIntImage->u32Blocks);
-                pInt->aIntNodes[idx].PtrChild.fInMemory          = false;
-                pInt->aIntNodes[idx].PtrChild.u.offAddrBlockNode = RT_LE2H_U64(pIntImage->u64ChildAddr);
-                pIntImage++;
-
-                if (   pInt->aIntNodes[idx].u32Blocks
-                    && pInt->aIntNodes[idx].PtrChild.u.offAddrBlockNode)
-                    pInt->cUsedNodes++;
+                rc = vciFileWriteSync(pCache, offBlockAddr, pbBuf, cBlocksThis);
+                if (RT_SUCCESS(rc))
+                    rc = vciCacheExtentInsert(pCache, uBlock, cBlocksThis, offBlockAddr,
+                                              fDirty ? VCI_CACHE_EXTENT_FLAGS_DIRTY : 0);
+                if (RT_FAILURE(rc))
+                    vciBlkMapFree(pCache->pBlkMap, offBlockAddr, cBlocksThis);
+            }
+            else if (rc == VERR_VD_CACHE_FULL)
+            {
+                if (fDirty)
+                {
+                    rc = VERR_DISK_FULL;
+                    break;
+                }
+
+                /* Clean data doesn't have to be cached. */
+                cBlocksThis = cBlocksGap;
+                rc = VINF_SUCCESS;
             }
 
-            pNode = &pInt->Core;
+            if (RT_FAILURE(rc))
+                break;
         }
+
+        uBlock      += cBlocksThis;
+        cBlocksLeft -= cBlocksThis;
+        pbBuf       += VCI_BLOCK2BYTE(cBlocksThis);
     }
-    else
-        AssertMsgFailed(("Invalid node type %d\n", pNodeImage->u8Type));
 
-    if (pNode)
-        pNode->u64BlockAddr = offBlockAddrNode;
+    *pcbWriteProcess = cbToWrite - (size_t)VCI_BLOCK2BYTE(cBlocksLeft);
+    return rc;
+}
 
-    return pNode;
+/**
+ * @callback_method_impl{AVLRU64CALLBACK, Frees an in memory extent.}
+ */
+static DECLCALLBACK(int) vciCacheExtentFree(PAVLRU64NODECORE pCore, void *pvUser)
+{
+    NOREF(pvUser);
+    RTMemFree(pCore);
+    return VINF_SUCCESS;
 }
 
 /**
- * Looks up the cache extent for the given virtual block address.
- *
- * @returns Pointer to the cache extent or NULL if none could be found.
- * @param   pCache         The cache image instance.
- * @param   offBlockOffset The block offset to search for.
+ * Internal. Flush image data to disk.
  */
-static PVCICACHEEXTENT vciCacheExtentLookup(PVCICACHE pCache, uint64_t offBlockOffset)
+static int vciFlushImage(PVCICACHE pCache)
 {
     int rc = VINF_SUCCESS;
-    PVCICACHEEXTENT pExtent = NULL;
-    PVCITREENODE pNodeCur = pCache->pRoot;
 
-    while (   RT_SUCCESS(rc)
-           && pNodeCur
-           && pNodeCur->u8Type != VCI_TREE_NODE_TYPE_LEAF)
-    {
-        PVCITREENODEINT pNodeInt = (PVCITREENODEINT)pNodeCur;
+    if (   pCache->pStorage
+        && !(pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY))
+        rc = vciCacheCommit(pCache, false /* fClose */);
 
-        Assert(pNodeCur->u8Type == VCI_TREE_NODE_TYPE_INTERNAL);
+    return rc;
+}
 
-        /* Search for the correct internal node. */
-        unsigned idxMin = 0;
-        unsigned idxMax = pNodeInt->cUsedNodes;
-        unsigned idxCur = pNodeInt->cUsedNodes / 2;
+/**
+ * Internal. Free all allocated space for representing an image except pCache,
+ * and optionally delete the image from disk.
+ */
+static int vciFreeImage(PVCICACHE pCache, bool fDelete)
+{
+    int rc = VINF_SUCCESS;
 
-        while (idxMin < idxMax)
+    /* Freeing a never allocated image (e.g. because the open failed) is
+     * not signalled as an error. After all nothing bad happens. */
+    if (pCache)
+    {
+        if (pCache->pStorage)
         {
-            PVCINODEINTERNAL pInt = &pNodeInt->aIntNodes[idxCur];
-
-            /* Determine the search direction. */
-            if (offBlockOffset < pInt->u64BlockOffset)
-            {
-                /* Search left from the current extent. */
-                idxMax = idxCur;
-            }
-            else if (offBlockOffset >= pInt->u64BlockOffset + pInt->u32Blocks)
-            {
-                /* Search right from the current extent. */
-                idxMin = idxCur;
-            }
-            else
-            {
-                /* The block lies in the node, stop searching. */
-                if (pInt->PtrChild.fInMemory)
-                    pNodeCur = pInt->PtrChild.u.pNode;
-                else
-                {
-                    PVCITREENODE pNodeNew;
-                    VciTreeNode NodeTree;
-
-                    /* Read from disk and add to the tree. */
-                    rc = vciFileReadSync(pCache, VCI_BLOCK2BYTE(pInt->PtrChild.u.offAddrBlockNode),
-                                         &NodeTree, sizeof(NodeTree));
-                    AssertRC(rc);
-
-                    pNodeNew = vciTreeNodeImage2Host(pInt->PtrChild.u.offAddrBlockNode, &NodeTree);
-                    if (pNodeNew)
-                    {
-                        /* Link to the parent. */
-                        pInt->PtrChild.fInMemory = true;
-                        pInt->PtrChild.u.pNode = pNodeNew;
-                        pNodeNew->pParent = pNodeCur;
-                        pNodeCur = pNodeNew;
-                    }
-                    else
-                        rc = VERR_NO_MEMORY;
-                }
-                break;
-            }
+            /* No point updating the file that is deleted anyway. The state is
+             * only written if the image was opened completely. */
+            if (   !fDelete
+                && pCache->pBlkMap
+                && !(pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY))
+                rc = vciCacheCommit(pCache, true /* fClose */);
 
-            idxCur = idxMin + (idxMax - idxMin) / 2;
+            vciFileClose(pCache);
+            pCache->pStorage = NULL;
         }
-    }
-
-    if (   RT_SUCCESS(rc)
-        && pNodeCur)
-    {
-        PVCITREENODELEAF pLeaf = (PVCITREENODELEAF)pNodeCur;
-        Assert(pNodeCur->u8Type == VCI_TREE_NODE_TYPE_LEAF);
 
-        /* Search the range. */
-        unsigned idxMin = 0;
-        unsigned idxMax = pLeaf->cUsedNodes;
-        unsigned idxCur = pLeaf->cUsedNodes / 2;
+        RTAvlrU64Destroy(&pCache->TreeExtents, vciCacheExtentFree, NULL);
+        RTListInit(&pCache->ListLru);
+        pCache->cExtents     = 0;
+        pCache->cBlocksData  = 0;
+        pCache->cBlocksDirty = 0;
+        pCache->fTreeDirty   = false;
+        pCache->fHdrDirty    = false;
 
-        while (idxMin < idxMax)
+        if (pCache->pBlkMap)
         {
-            PVCICACHEEXTENT pExtentCur = &pLeaf->aExtents[idxCur];
+            vciBlkMapDestroy(pCache->pBlkMap);
+            pCache->pBlkMap = NULL;
+        }
 
-            /* Determine the search direction. */
-            if (offBlockOffset < pExtentCur->u64BlockOffset)
-            {
-                /* Search left from the current extent. */
-                idxMax = idxCur;
-            }
-            else if (offBlockOffset >= pExtentCur->u64BlockOffset + pExtentCur->u32Blocks)
-            {
-                /* Search right from the current extent. */
-                idxMin = idxCur;
-            }
-            else
-            {
-                /* We found the extent, stop searching. */
-                pExtent = pExtentCur;
-                break;
-            }
+        vciBlkListDestroy(&pCache->NodesTree);
+        vciBlkListDestroy(&pCache->BlksFreePending);
 
-            idxCur = idxMin + (idxMax - idxMin) / 2;
-        }
+        if (RTCritSectIsInitialized(&pCache->CritSect))
+            RTCritSectDelete(&pCache->CritSect);
+
+        if (fDelete && pCache->pszFilename)
+            vciFileDelete(pCache, pCache->pszFilename);
     }
 
-    return pExtent;
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
 }
 
 /**
@@ -1272,6 +2344,7 @@ static int vciOpenImage(PVCICACHE pCache, unsigned uOpenFlags)
 {
     VciHdr Hdr;
     uint64_t cbFile;
+    PVCIBLKMAP pBlkMap = NULL;
     int rc;
 
     pCache->uOpenFlags = uOpenFlags;
@@ -1286,6 +2359,12 @@ static int vciOpenImage(PVCICACHE pCache, unsigned uOpenFlags)
     pCache->pInterfaceIOCallbacks = VDGetInterfaceIOInt(pCache->pInterfaceIO);
     AssertPtrReturn(pCache->pInterfaceIOCallbacks, VERR_INVALID_PARAMETER);
 
+    pCache->TreeExtents = NULL;
+    RTListInit(&pCache->ListLru);
+    rc = RTCritSectInit(&pCache->CritSect);
+    if (RT_FAILURE(rc))
+        return rc;
+
     /*
      * Open the image.
      */
@@ -1319,28 +2398,66 @@ static int vciOpenImage(PVCICACHE pCache, unsigned uOpenFlags)
     Hdr.u32CacheType = RT_LE2H_U32(Hdr.u32CacheType);
     Hdr.offTreeRoot  = RT_LE2H_U64(Hdr.offTreeRoot);
     Hdr.offBlkMap    = RT_LE2H_U64(Hdr.offBlkMap);
-    Hdr.cBlkMap      = RT_LE2H_U64(Hdr.cBlkMap);
+    Hdr.cBlkMap      = RT_LE2H_U32(Hdr.cBlkMap);
 
     if (   Hdr.u32Signature == VCI_HDR_SIGNATURE
-        && Hdr.u32Version == VCI_HDR_VERSION)
+        && Hdr.u32Version == VCI_HDR_VERSION
+        && Hdr.cBlocksCache
+        && Hdr.cBlkMap == VCI_BLKMAP_BLOCKS(Hdr.cBlocksCache)
+        && Hdr.offBlkMap < Hdr.cBlocksCache
+        && Hdr.cBlocksCache - Hdr.offBlkMap >= Hdr.cBlkMap)
     {
-        pCache->offTreeRoot   = Hdr.offTreeRoot;
-        pCache->offBlksBitmap = Hdr.offBlkMap;
-
-        /* Load the block map. */
-        rc = vciBlkMapLoad(pCache, pCache->offBlksBitmap, Hdr.cBlkMap, &pCache->pBlkMap);
+        pCache->cBlocksCache     = Hdr.cBlocksCache;
+        pCache->cbSize           = VCI_BLOCK2BYTE(Hdr.cBlocksCache);
+        pCache->uImageFlags      = Hdr.u32CacheType == VCI_HDR_CACHE_TYPE_FIXED ? VD_IMAGE_FLAGS_FIXED : 0;
+        pCache->offTreeRoot      = Hdr.offTreeRoot;
+        pCache->offBlksBitmap    = Hdr.offBlkMap;
+        pCache->cBlkMap          = Hdr.cBlkMap;
+        memcpy(&pCache->uuidImage, &Hdr.uuidImage, sizeof(RTUUID));
+        memcpy(&pCache->uuidModification, &Hdr.uuidModification, sizeof(RTUUID));
+        pCache->fUncleanOnDisk   = Hdr.fUncleanShutdown != VCI_HDR_CLEAN_SHUTDOWN;
+
+        /* Load all extents. */
+        rc = vciTreeLoad(pCache);
         if (RT_SUCCESS(rc))
         {
-            /* Load the first tree node. */
-            VciTreeNode RootNode;
+            /*
+             * The block map is only exact if the cache was closed cleanly,
+             * rebuild it from the tree otherwise.
+             */
+            if (!pCache->fUncleanOnDisk)
+            {
+                rc = vciBlkMapLoad(pCache, pCache->offBlksBitmap, pCache->cBlkMap, &pBlkMap);
+                if (   RT_SUCCESS(rc)
+                    && pBlkMap->cBlocks != pCache->cBlocksCache)
+                {
+                    vciBlkMapDestroy(pBlkMap);
+                    pBlkMap = NULL;
+                    rc = VERR_VD_GEN_INVALID_HEADER;
+                }
+                if (RT_FAILURE(rc))
+                    LogRel(("VCI: Block map of '%s' is invalid (%Rrc), rebuilding it\n", pCache->pszFilename, rc));
+            }
 
-            rc = vciFileReadSync(pCache, pCache->offTreeRoot, &RootNode, VCI_BYTE2BLOCK(sizeof(VciTreeNode)));
-            if (RT_SUCCESS(rc))
+            if (!pBlkMap)
             {
-                pCache->pRoot = vciTreeNodeImage2Host(pCache->offTreeRoot, &RootNode);
-                if (!pCache->pRoot)
-                    rc = VERR_NO_MEMORY;
+                rc = vciBlkMapRebuild(pCache, &pBlkMap);
+
+                /* Make sure the rebuilt block map is written before the cache is considered clean again. */
+                if (   RT_SUCCESS(rc)
+                    && !pCache->fUncleanOnDisk
+                    && !(uOpenFlags & VD_OPEN_FLAGS_READONLY))
+                {
+                    rc = vciHdrWrite(pCache, pCache->offTreeRoot, true);
+                    if (RT_SUCCESS(rc))
+                        pCache->fUncleanOnDisk = true;
+                    else
+                        vciBlkMapDestroy(pBlkMap);
+                }
             }
+
+            if (RT_SUCCESS(rc))
+                pCache->pBlkMap = pBlkMap;
         }
     }
     else
@@ -1357,11 +2474,10 @@ out:
  */
 static int vciCreateImage(PVCICACHE pCache, uint64_t cbSize,
                           unsigned uImageFlags, const char *pszComment,
-                          unsigned uOpenFlags, PFNVDPROGRESS pfnProgress,
-                          void *pvUser, unsigned uPercentStart,
-                          unsigned uPercentSpan)
+                          PCRTUUID pUuid, unsigned uOpenFlags,
+                          PFNVDPROGRESS pfnProgress, void *pvUser,
+                          unsigned uPercentStart, unsigned uPercentSpan)
 {
-    VciHdr Hdr;
     VciTreeNode NodeRoot;
     int rc;
     uint64_t cBlocks = cbSize / VCI_BLOCK_SIZE; /* Size of the cache in blocks. */
@@ -1385,6 +2501,20 @@ static int vciCreateImage(PVCICACHE pCache, uint64_t cbSize,
     pCache->pInterfaceIOCallbacks = VDGetInterfaceIOInt(pCache->pInterfaceIO);
     AssertPtrReturn(pCache->pInterfaceIOCallbacks, VERR_INVALID_PARAMETER);
 
+    /* The cache must hold the metadata and two trees during a commit. */
+    uint32_t cBlkMap = VCI_BLKMAP_BLOCKS(cBlocks);
+    if (cBlocks < VCI_BYTE2BLOCK(sizeof(VciHdr)) + cBlkMap + 4 * VCI_TREE_NODE_BLOCKS)
+    {
+        rc = vciError(pCache, VERR_VD_INVALID_SIZE, RT_SRC_POS, N_("VCI: cache '%s' is too small"), pCache->pszFilename);
+        return rc;
+    }
+
+    pCache->TreeExtents = NULL;
+    RTListInit(&pCache->ListLru);
+    rc = RTCritSectInit(&pCache->CritSect);
+    if (RT_FAILURE(rc))
+        return rc;
+
     do
     {
         /* Create image file. */
@@ -1398,7 +2528,6 @@ static int vciCreateImage(PVCICACHE pCache, uint64_t cbSize,
         }
 
         /* Allocate block bitmap. */
-        uint32_t cBlkMap = 0;
         rc = vciBlkMapCreate(cBlocks, &pCache->pBlkMap, &cBlkMap);
         if (RT_FAILURE(rc))
         {
@@ -1411,7 +2540,7 @@ static int vciCreateImage(PVCICACHE pCache, uint64_t cbSize,
          * Because the block map is empty the header has to start at block 0
          */
         uint64_t offHdr = 0;
-        rc = vciBlkMapAllocate(pCache->pBlkMap, VCI_BYTE2BLOCK(sizeof(VciHdr)), &offHdr);
+        rc = vciBlkMapAllocate(pCache->pBlkMap, VCI_BYTE2BLOCK(sizeof(VciHdr)), &offHdr, NULL);
         if (RT_FAILURE(rc))
         {
             rc = vciError(pCache, rc, RT_SRC_POS, N_("VCI: cannot allocate space for header in block bitmap '%s'"), pCache->pszFilename);
@@ -1424,89 +2553,67 @@ static int vciCreateImage(PVCICACHE pCache, uint64_t cbSize,
          * Allocate space for the block map itself.
          */
         uint64_t offBlkMap = 0;
-        rc = vciBlkMapAllocate(pCache->pBlkMap, cBlkMap, &offBlkMap);
+        rc = vciBlkMapAllocate(pCache->pBlkMap, cBlkMap, &offBlkMap, NULL);
         if (RT_FAILURE(rc))
         {
             rc = vciError(pCache, rc, RT_SRC_POS, N_("VCI: cannot allocate space for block map in block map '%s'"), pCache->pszFilename);
             break;
         }
 
-        /*
-         * Allocate space for the tree root node.
-         */
-        uint64_t offTreeRoot = 0;
-        rc = vciBlkMapAllocate(pCache->pBlkMap, VCI_BYTE2BLOCK(sizeof(VciTreeNode)), &offTreeRoot);
-        if (RT_FAILURE(rc))
-        {
-            rc = vciError(pCache, rc, RT_SRC_POS, N_("VCI: cannot allocate space for block map in block map '%s'"), pCache->pszFilename);
-            break;
-        }
+        pCache->cBlocksCache  = cBlocks;
+        pCache->cbSize        = VCI_BLOCK2BYTE(cBlocks);
+        pCache->offBlksBitmap = offBlkMap;
+        pCache->cBlkMap       = cBlkMap;
+        if (pUuid)
+            pCache->uuidImage = *pUuid;
+        else
+            RTUuidClear(&pCache->uuidImage);
+        RTUuidClear(&pCache->uuidModification);
 
-        /*
-         * Allocate the in memory root node.
-         */
-        pCache->pRoot = (PVCITREENODE)RTMemAllocZ(sizeof(VCITREENODELEAF));
-        if (!pCache->pRoot)
+        if (uImageFlags & VD_IMAGE_FLAGS_FIXED)
         {
-            rc = vciError(pCache, rc, RT_SRC_POS, N_("VCI: cannot allocate B+-Tree root pointer '%s'"), pCache->pszFilename);
-            break;
+            rc = vciFileSetSize(pCache, pCache->cbSize);
+            if (RT_FAILURE(rc))
+            {
+                rc = vciError(pCache, rc, RT_SRC_POS, N_("VCI: cannot set size of '%s'"), pCache->pszFilename);
+                break;
+            }
         }
 
-        pCache->pRoot->u8Type = VCI_TREE_NODE_TYPE_LEAF;
-        /* Rest remains 0 as the tree is still empty. */
-
         /*
          * Now that we are here we have all the basic structures and know where to place them in the image.
-         * It's time to write it now.
+         * It's time to write it now, starting with the empty root node.
          */
+        memset(&NodeRoot, 0, sizeof(VciTreeNode));
+        NodeRoot.u8Type = VCI_TREE_NODE_TYPE_LEAF;
 
-        /* Setup the header. */
-        memset(&Hdr, 0, sizeof(VciHdr));
-        Hdr.u32Signature     = RT_H2LE_U32(VCI_HDR_SIGNATURE);
-        Hdr.u32Version       = RT_H2LE_U32(VCI_HDR_VERSION);
-        Hdr.cBlocksCache     = RT_H2LE_U64(cBlocks);
-        Hdr.fUncleanShutdown = VCI_HDR_UNCLEAN_SHUTDOWN;
-        Hdr.u32CacheType     = uImageFlags & VD_IMAGE_FLAGS_FIXED
-                               ? RT_H2LE_U32(VCI_HDR_CACHE_TYPE_FIXED)
-                               : RT_H2LE_U32(VCI_HDR_CACHE_TYPE_DYNAMIC);
-        Hdr.offTreeRoot      = RT_H2LE_U64(offTreeRoot);
-        Hdr.offBlkMap        = RT_H2LE_U64(offBlkMap);
-        Hdr.cBlkMap          = RT_H2LE_U64(cBlkMap);
-
-        rc = vciFileWriteSync(pCache, offHdr, &Hdr, VCI_BYTE2BLOCK(sizeof(VciHdr)));
+        rc = vciTreeNodeWrite(pCache, &pCache->NodesTree, &NodeRoot, &pCache->offTreeRoot);
         if (RT_FAILURE(rc))
         {
-            rc = vciError(pCache, rc, RT_SRC_POS, N_("VCI: cannot write header '%s'"), pCache->pszFilename);
+            rc = vciError(pCache, rc, RT_SRC_POS, N_("VCI: cannot write root node '%s'"), pCache->pszFilename);
             break;
         }
 
-        rc = vciBlkMapSave(pCache->pBlkMap, pCache, offBlkMap, cBlkMap);
+        rc = vciCacheBlkMapSave(pCache);
         if (RT_FAILURE(rc))
         {
             rc = vciError(pCache, rc, RT_SRC_POS, N_("VCI: cannot write block map '%s'"), pCache->pszFilename);
             break;
         }
 
-        /* Setup the root tree. */
-        memset(&NodeRoot, 0, sizeof(VciTreeNode));
-        NodeRoot.u8Type = RT_H2LE_U32(VCI_TREE_NODE_TYPE_LEAF);
-
-        rc = vciFileWriteSync(pCache, offTreeRoot, &NodeRoot, VCI_BYTE2BLOCK(sizeof(VciTreeNode)));
+        rc = vciHdrWrite(pCache, pCache->offTreeRoot, false /* fUnclean */);
         if (RT_FAILURE(rc))
         {
-            rc = vciError(pCache, rc, RT_SRC_POS, N_("VCI: cannot write root node '%s'"), pCache->pszFilename);
+            rc = vciError(pCache, rc, RT_SRC_POS, N_("VCI: cannot write header '%s'"), pCache->pszFilename);
             break;
         }
 
-        rc = vciFlushImage(pCache);
+        rc = vciFileFlushSync(pCache);
         if (RT_FAILURE(rc))
         {
             rc = vciError(pCache, rc, RT_SRC_POS, N_("VCI: cannot flush '%s'"), pCache->pszFilename);
             break;
         }
-
-        pCache->cbSize = cbSize;
-
     } while (0);
 
     if (RT_SUCCESS(rc) && pfnProgress)
@@ -1677,7 +2784,7 @@ static int vciCreate(const char *pszFilename, uint64_t cbSize,
     pCache->pVDIfsDisk = pVDIfsDisk;
     pCache->pVDIfsImage = pVDIfsImage;
 
-    rc = vciCreateImage(pCache, cbSize, uImageFlags, pszComment, uOpenFlags,
+    rc = vciCreateImage(pCache, cbSize, uImageFlags, pszComment, pUuid, uOpenFlags,
                         pfnProgress, pvUser, uPercentStart, uPercentSpan);
     if (RT_SUCCESS(rc))
     {
@@ -1724,33 +2831,40 @@ static int vciRead(void *pBackendData, uint64_t uOffset, void *pvBuf,
     LogFlowFunc(("pBackendData=%#p uOffset=%llu pvBuf=%#p cbToRead=%zu pcbActuallyRead=%#p\n", pBackendData, uOffset, pvBuf, cbToRead, pcbActuallyRead));
     PVCICACHE pCache = (PVCICACHE)pBackendData;
     int rc = VINF_SUCCESS;
+    uint64_t uBlock = VCI_BYTE2BLOCK(uOffset);
     PVCICACHEEXTENT pExtent;
 
     AssertPtr(pCache);
     Assert(uOffset % 512 == 0);
     Assert(cbToRead % 512 == 0);
 
+    RTCritSectEnter(&pCache->CritSect);
 
-    pExtent = vciCacheExtentLookup(pCache, VCI_BYTE2BLOCK(uOffset));
+    pExtent = (PVCICACHEEXTENT)RTAvlrU64RangeGet(&pCache->TreeExtents, uBlock);
     if (pExtent)
     {
-        uint64_t offRead = uOffset - VCI_BLOCK2BYTE(pExtent->u64BlockOffset);
-        cbToRead = RT_MIN(cbToRead, VCI_BLOCK2BYTE(pExtent->u32Blocks) - offRead);
+        uint64_t cBlocks = RT_MIN(VCI_BYTE2BLOCK(cbToRead), pExtent->Core.KeyLast - uBlock + 1);
 
-        rc = vciFileReadSync(pCache, VCI_BLOCK2BYTE(pExtent->u64BlockAddr) + offRead,
-                             pvBuf, cbToRead);
+        cbToRead = (size_t)VCI_BLOCK2BYTE(cBlocks);
+        rc = vciFileReadSync(pCache, pExtent->u64BlockAddr + (uBlock - pExtent->Core.Key),
+                             pvBuf, cBlocks);
+        if (RT_SUCCESS(rc))
+            vciCacheExtentTouch(pCache, pExtent);
     }
     else
     {
-        /** @todo Best fit to check whether we have cached data later and set
-         * pcbActuallyRead accordingly. */
+        /* Tell the caller where the next cached data starts. */
+        pExtent = (PVCICACHEEXTENT)RTAvlrU64GetBestFit(&pCache->TreeExtents, uBlock, true /* fAbove */);
+        if (pExtent)
+            cbToRead = (size_t)RT_MIN((uint64_t)cbToRead, VCI_BLOCK2BYTE(pExtent->Core.Key - uBlock));
         rc = VERR_VD_BLOCK_FREE;
     }
 
+    RTCritSectLeave(&pCache->CritSect);
+
     if (pcbActuallyRead)
         *pcbActuallyRead = cbToRead;
 
-out:
     LogFlowFunc(("returns %Rrc\n", rc));
     return rc;
 }
@@ -1768,7 +2882,16 @@ static int vciWrite(void *pBackendData, uint64_t uOffset, const void *pvBuf,
     Assert(uOffset % 512 == 0);
     Assert(cbToWrite % 512 == 0);
 
-    *pcbWriteProcess = cbToWrite; /** @todo: Implement. */
+    if (pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+    {
+        rc = VERR_VD_IMAGE_READ_ONLY;
+        goto out;
+    }
+
+    RTCritSectEnter(&pCache->CritSect);
+    rc = vciCacheWrite(pCache, uOffset, pvBuf, cbToWrite, false /* fDirty */, pcbWriteProcess);
+    RTCritSectLeave(&pCache->CritSect);
+
 out:
     LogFlowFunc(("returns %Rrc\n", rc));
     return rc;
@@ -1781,7 +2904,9 @@ static int vciFlush(void *pBackendData)
     PVCICACHE pCache = (PVCICACHE)pBackendData;
     int rc = VINF_SUCCESS;
 
+    RTCritSectEnter(&pCache->CritSect);
     rc = vciFlushImage(pCache);
+    RTCritSectLeave(&pCache->CritSect);
     LogFlowFunc(("returns %Rrc\n", rc));
     return rc;
 }
@@ -1955,7 +3080,10 @@ static int vciGetUuid(void *pBackendData, PRTUUID pUuid)
     AssertPtr(pCache);
 
     if (pCache)
-        rc = VERR_NOT_SUPPORTED;
+    {
+        *pUuid = pCache->uuidImage;
+        rc = VINF_SUCCESS;
+    }
     else
         rc = VERR_VD_NOT_OPENED;
 
@@ -1976,7 +3104,13 @@ static int vciSetUuid(void *pBackendData, PCRTUUID pUuid)
     if (pCache)
     {
         if (!(pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY))
-            rc = VERR_NOT_SUPPORTED;
+        {
+            RTCritSectEnter(&pCache->CritSect);
+            pCache->uuidImage = *pUuid;
+            pCache->fHdrDirty = true;
+            RTCritSectLeave(&pCache->CritSect);
+            rc = VINF_SUCCESS;
+        }
         else
             rc = VERR_VD_IMAGE_READ_ONLY;
     }
@@ -1997,7 +3131,10 @@ static int vciGetModificationUuid(void *pBackendData, PRTUUID pUuid)
     AssertPtr(pCache);
 
     if (pCache)
-        rc = VERR_NOT_SUPPORTED;
+    {
+        *pUuid = pCache->uuidModification;
+        rc = VINF_SUCCESS;
+    }
     else
         rc = VERR_VD_NOT_OPENED;
 
@@ -2017,7 +3154,13 @@ static int vciSetModificationUuid(void *pBackendData, PCRTUUID pUuid)
     if (pCache)
     {
         if (!(pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY))
-            rc = VERR_NOT_SUPPORTED;
+        {
+            RTCritSectEnter(&pCache->CritSect);
+            pCache->uuidModification = *pUuid;
+            pCache->fHdrDirty = true;
+            RTCritSectLeave(&pCache->CritSect);
+            rc = VINF_SUCCESS;
+        }
         else
             rc = VERR_VD_IMAGE_READ_ONLY;
     }
@@ -2031,7 +3174,23 @@ static int vciSetModificationUuid(void *pBackendData, PCRTUUID pUuid)
 /** @copydoc VDCACHEBACKEND::pfnDump */
 static void vciDump(void *pBackendData)
 {
-    NOREF(pBackendData);
+    PVCICACHE pCache = (PVCICACHE)pBackendData;
+
+    AssertPtr(pCache);
+    if (!pCache)
+        return;
+
+    RTCritSectEnter(&pCache->CritSect);
+    vciMessage(pCache, "Header: Blocks=%llu Type=%s TreeRoot=%llu BlkMap=%llu/%u Unclean=%RTbool\n",
+               pCache->cBlocksCache, pCache->uImageFlags & VD_IMAGE_FLAGS_FIXED ? "fixed" : "dynamic",
+               pCache->offTreeRoot, pCache->offBlksBitmap, pCache->cBlkMap, pCache->fUncleanOnDisk);
+    vciMessage(pCache, "Extents: Count=%llu Data=%llu Dirty=%llu TreeNodes=%u PendingFree=%u\n",
+               pCache->cExtents, pCache->cBlocksData, pCache->cBlocksDirty,
+               pCache->NodesTree.cRanges, pCache->BlksFreePending.cRanges);
+    if (pCache->pBlkMap)
+        vciMessage(pCache, "BlkMap: Free=%llu Meta=%llu\n", pCache->pBlkMap->cBlocksFree,
+                   pCache->pBlkMap->cBlocks - pCache->pBlkMap->cBlocksFree - pCache->cBlocksData);
+    RTCritSectLeave(&pCache->CritSect);
 }
 
 /** @copydoc VDCACHEBACKEND::pfnAsyncRead */
@@ -2063,6 +3222,165 @@ static int vciAsyncFlush(void *pBackendData, PVDIOCTX pIoCtx)
     return rc;
 }
 
+/** @copydoc VDCACHEBACKEND::pfnWriteDirty */
+static int vciWriteDirty(void *pBackendData, uint64_t uOffset, const void *pvBuf,
+                         size_t cbToWrite, size_t *pcbWriteProcess)
+{
+    LogFlowFunc(("pBackendData=%#p uOffset=%llu pvBuf=%#p cbToWrite=%zu pcbWriteProcess=%#p\n",
+                 pBackendData, uOffset, pvBuf, cbToWrite, pcbWriteProcess));
+    PVCICACHE pCache = (PVCICACHE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    AssertPtr(pCache);
+    Assert(uOffset % 512 == 0);
+    Assert(cbToWrite % 512 == 0);
+
+    if (pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+    {
+        rc = VERR_VD_IMAGE_READ_ONLY;
+        goto out;
+    }
+
+    RTCritSectEnter(&pCache->CritSect);
+    rc = vciCacheWrite(pCache, uOffset, pvBuf, cbToWrite, true /* fDirty */, pcbWriteProcess);
+    RTCritSectLeave(&pCache->CritSect);
+
+out:
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VDCACHEBACKEND::pfnQueryDirty */
+static int vciQueryDirty(void *pBackendData, uint64_t uOffset, uint64_t *puOffsetDirty,
+                         size_t *pcbDirty)
+{
+    LogFlowFunc(("pBackendData=%#p uOffset=%llu puOffsetDirty=%#p pcbDirty=%#p\n",
+                 pBackendData, uOffset, puOffsetDirty, pcbDirty));
+    PVCICACHE pCache = (PVCICACHE)pBackendData;
+    int rc = VERR_NOT_FOUND;
+
+    AssertPtr(pCache);
+
+    RTCritSectEnter(&pCache->CritSect);
+    if (pCache->cBlocksDirty)
+    {
+        uint64_t uBlock = VCI_BYTE2BLOCK(uOffset);
+        PVCICACHEEXTENT pExtent = vciCacheExtentGetFrom(pCache, uBlock);
+
+        while (   pExtent
+               && !(pExtent->fFlags & VCI_CACHE_EXTENT_FLAGS_DIRTY))
+            pExtent = (PVCICACHEEXTENT)RTAvlrU64GetBestFit(&pCache->TreeExtents, pExtent->Core.KeyLast + 1, true /* fAbove */);
+
+        if (pExtent)
+        {
+            uint64_t uBlockFirst = RT_MAX(uBlock, pExtent->Core.Key);
+
+            *puOffsetDirty = VCI_BLOCK2BYTE(uBlockFirst);
+            *pcbDirty      = (size_t)RT_MIN(VCI_BLOCK2BYTE(pExtent->Core.KeyLast - uBlockFirst + 1), _1G);
+            rc = VINF_SUCCESS;
+        }
+    }
+    RTCritSectLeave(&pCache->CritSect);
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VDCACHEBACKEND::pfnMarkClean */
+static int vciMarkClean(void *pBackendData, uint64_t uOffset, size_t cbClean)
+{
+    LogFlowFunc(("pBackendData=%#p uOffset=%llu cbClean=%zu\n", pBackendData, uOffset, cbClean));
+    PVCICACHE pCache = (PVCICACHE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    AssertPtr(pCache);
+    Assert(uOffset % 512 == 0);
+    Assert(cbClean % 512 == 0);
+
+    if (!cbClean)
+        goto out;
+
+    RTCritSectEnter(&pCache->CritSect);
+    if (pCache->cBlocksDirty)
+    {
+        uint64_t uBlockFirst = VCI_BYTE2BLOCK(uOffset);
+        uint64_t uBlockLast  = VCI_BYTE2BLOCK(uOffset + cbClean - 1);
+
+        rc = vciCacheReserveNodes(pCache, 2);
+        if (RT_SUCCESS(rc))
+            rc = vciCacheExtentsIsolate(pCache, uBlockFirst, uBlockLast);
+        if (RT_SUCCESS(rc))
+        {
+            PVCICACHEEXTENT pExtent = vciCacheExtentGetFrom(pCache, uBlockFirst);
+
+            while (   pExtent
+                   && pExtent->Core.Key <= uBlockLast)
+            {
+                if (pExtent->fFlags & VCI_CACHE_EXTENT_FLAGS_DIRTY)
+                {
+                    pExtent->fFlags &= ~VCI_CACHE_EXTENT_FLAGS_DIRTY;
+                    pCache->cBlocksDirty -= VCI_EXTENT_BLOCKS(pExtent);
+                    pCache->fTreeDirty = true;
+                }
+                pExtent = (PVCICACHEEXTENT)RTAvlrU64GetBestFit(&pCache->TreeExtents, pExtent->Core.KeyLast + 1, true /* fAbove */);
+            }
+        }
+    }
+    RTCritSectLeave(&pCache->CritSect);
+
+out:
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VDCACHEBACKEND::pfnDiscard */
+static int vciDiscard(void *pBackendData, uint64_t uOffset, size_t cbDiscard)
+{
+    LogFlowFunc(("pBackendData=%#p uOffset=%llu cbDiscard=%zu\n", pBackendData, uOffset, cbDiscard));
+    PVCICACHE pCache = (PVCICACHE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    AssertPtr(pCache);
+
+    if (!cbDiscard)
+        goto out;
+
+    if (pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+    {
+        rc = VERR_VD_IMAGE_READ_ONLY;
+        goto out;
+    }
+
+    RTCritSectEnter(&pCache->CritSect);
+    {
+        /* Every block touched by the range is dropped. */
+        uint64_t uBlockFirst = VCI_BYTE2BLOCK(uOffset);
+        uint64_t uBlockLast  = VCI_BYTE2BLOCK(uOffset + cbDiscard - 1);
+
+        rc = vciCacheReserveNodes(pCache, 2);
+        if (RT_SUCCESS(rc))
+            rc = vciCacheExtentsIsolate(pCache, uBlockFirst, uBlockLast);
+        if (RT_SUCCESS(rc))
+        {
+            PVCICACHEEXTENT pExtent = vciCacheExtentGetFrom(pCache, uBlockFirst);
+
+            while (   pExtent
+                   && pExtent->Core.Key <= uBlockLast)
+            {
+                uint64_t uBlockNext = pExtent->Core.KeyLast + 1;
+
+                vciCacheExtentDestroy(pCache, pExtent);
+                pExtent = (PVCICACHEEXTENT)RTAvlrU64GetBestFit(&pCache->TreeExtents, uBlockNext, true /* fAbove */);
+            }
+        }
+    }
+    RTCritSectLeave(&pCache->CritSect);
+
+out:
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
 
 VDCACHEBACKEND g_VciCacheBackend =
 {
@@ -2127,6 +3445,14 @@ VDCACHEBACKEND g_VciCacheBackend =
     /* pfnComposeLocation */
     NULL,
     /* pfnComposeName */
-    NULL
+    NULL,
+    /* pfnWriteDirty */
+    vciWriteDirty,
+    /* pfnQueryDirty */
+    vciQueryDirty,
+    /* pfnMarkClean */
+    vciMarkClean,
+    /* pfnDiscard */
+    vciDiscard
 };
 
@@ -39,6 +39,9 @@
 #include <iprt/critsect.h>
 #include <iprt/list.h>
 #include <iprt/avl.h>
+#include <iprt/semaphore.h>
+#include <iprt/thread.h>
+#include <iprt/time.h>
 
 #include <VBox/vd-plugin.h>
 #include <VBox/vd-cache-plugin.h>
@@ -51,6 +54,23 @@
 /** Maximum number of segments in one I/O task. */
 #define VD_IO_TASK_SEGMENTS_MAX 64
 
+/** Number of buffers in flight for a pipelined copy or merge. */
+#define VD_PIPE_BUFFERS             8
+/** Size of one buffer of a pipelined copy or merge. */
+#define VD_PIPE_BUFFER_SIZE         (4 * _1M)
+
+/** Maximum number of extents the chain index keeps before it is dropped. */
+#define VD_CHAIN_INDEX_EXTENTS_MAX _64K
+
+/** Largest chunk of dirty data written back from the cache at once. */
+#define VD_CACHE_WRITEBACK_CHUNK    _1M
+/** Number of dirty ranges written to the image before it is flushed and
+ * the ranges are marked clean in the cache. */
+#define VD_CACHE_WRITEBACK_RANGES   64
+
+/** Maximum number of partially discarded blocks which are tracked. */
+#define VD_DISCARD_BLOCKS_MAX       256
+
 /**
  * VD async I/O interface storage descriptor.
  */
@@ -116,6 +136,140 @@ typedef struct VDIMAGE
     VDIO                VDIo;
 } VDIMAGE, *PVDIMAGE;
 
+/**
+ * Chain index extent, maps a range of the virtual disk to the image
+ * in the chain which holds the data for it.
+ */
+typedef struct VDCHAINEXTENT
+{
+    /** AVL core, the range of the virtual disk covered by this extent. */
+    AVLRU64NODECORE Core;
+    /** Image holding the data, NULL if the range is unallocated in
+     * all images of the chain. */
+    PVDIMAGE        pImage;
+} VDCHAINEXTENT, *PVDCHAINEXTENT;
+
+/**
+ * Partially discarded block of the last image.
+ */
+typedef struct VDDISCARDBLOCK
+{
+    /** AVL core, the range of the virtual disk covered by the block. */
+    AVLRU64NODECORE Core;
+    /** Node in the LRU list. */
+    RTLISTNODE      NodeLru;
+    /** Number of sectors in the block. */
+    uint32_t        cSectors;
+    /** Bitmap of sectors which were not discarded yet, one bit per sector. */
+    uint32_t        abmAllocated[1];
+} VDDISCARDBLOCK, *PVDDISCARDBLOCK;
+
+/**
+ * Discard state of the disk, keeps track of blocks which were discarded
+ * partially so they can be freed once the guest discarded the rest.
+ */
+typedef struct VDDISCARDSTATE
+{
+    /** Tree of partially discarded blocks. */
+    AVLRU64TREE     TreeBlocks;
+    /** LRU list of the blocks, the least recently discarded block is at the end. */
+    RTLISTNODE      ListLru;
+    /** Number of blocks tracked. */
+    unsigned        cBlocks;
+} VDDISCARDSTATE, *PVDDISCARDSTATE;
+
+/** Pointer to the pipeline state. */
+typedef struct VDPIPE *PVDPIPE;
+
+/**
+ * Pipeline buffer.
+ */
+typedef struct VDPIPEBUF
+{
+    /** Flag whether the buffer is filled and owned by the writer. */
+    volatile bool       fFilled;
+    /** Flag whether this is the last buffer, either because the end of the
+     * disk was reached or the read failed. */
+    bool                fLast;
+    /** Flag whether the buffer contains only zeroes. */
+    bool                fZero;
+    /** Status code of the read. */
+    int                 rcRead;
+    /** Write generation of the disk when the data was read. */
+    uint32_t            uWriteGen;
+    /** Offset of the data in the disk. */
+    uint64_t            uOffset;
+    /** Number of bytes of data in the buffer. */
+    size_t              cbData;
+    /** The buffer. */
+    void               *pvBuf;
+} VDPIPEBUF, *PVDPIPEBUF;
+
+/**
+ * Reads the data for the given buffer, called on the reader thread.
+ *
+ * @returns VBox status code, VERR_VD_BLOCK_FREE if there is nothing to write
+ *          for the range.
+ * @param   pPipe       The pipeline state.
+ * @param   pBuf        The buffer to fill, uOffset and cbData (maximum, updated
+ *                      with the amount read) are set.
+ */
+typedef DECLCALLBACK(int) FNVDPIPEREAD(PVDPIPE pPipe, PVDPIPEBUF pBuf);
+/** Pointer to a pipeline read callback. */
+typedef FNVDPIPEREAD *PFNVDPIPEREAD;
+
+/**
+ * Writes the data of the given buffer, called on the thread running the
+ * pipeline in disk order.
+ *
+ * @returns VBox status code.
+ * @param   pPipe       The pipeline state.
+ * @param   pBuf        The buffer to write.
+ */
+typedef DECLCALLBACK(int) FNVDPIPEWRITE(PVDPIPE pPipe, PVDPIPEBUF pBuf);
+/** Pointer to a pipeline write callback. */
+typedef FNVDPIPEWRITE *PFNVDPIPEWRITE;
+
+/**
+ * Pipeline state shared between the reader thread and the writer, used for
+ * copying and merging images.
+ */
+typedef struct VDPIPE
+{
+    /** Callback reading the next chunk. */
+    PFNVDPIPEREAD       pfnRead;
+    /** Callback writing a chunk. */
+    PFNVDPIPEWRITE      pfnWrite;
+    /** Disk to read from. */
+    PVBOXHDD            pDiskFrom;
+    /** Disk to write to. */
+    PVBOXHDD            pDiskTo;
+    /** Image to start reading from. */
+    PVDIMAGE            pImageFrom;
+    /** Image to write to, merge only. */
+    PVDIMAGE            pImageTo;
+    /** Number of bytes to process. */
+    uint64_t            cbSize;
+    /** Number of images in the source chain to read, 0 for all (copy only). */
+    unsigned            cImagesFromRead;
+    /** Number of images in the destination chain to read (copy only). */
+    unsigned            cImagesToRead;
+    /** Flag whether unallocated blocks are skipped (copy only). */
+    bool                fBlockwiseCopy;
+    /** Flag whether to detect buffers containing only zeroes. */
+    bool                fSkipZeroes;
+    /** Flag whether a parent is merged into a child (merge only). */
+    bool                fMergeIntoChild;
+    /** Flag whether the writer stopped and the reader should exit. */
+    volatile bool       fCancelled;
+    /** Event signalled by the reader when a buffer was filled. */
+    RTSEMEVENT          hEvtFilled;
+    /** Event signalled by the writer when a buffer was freed. */
+    RTSEMEVENT          hEvtFree;
+    /** The buffer ring. */
+    VDPIPEBUF           aBufs[VD_PIPE_BUFFERS];
+} VDPIPE;
+
 /**
  * uModified bit flags.
  */
@@ -172,6 +326,10 @@ struct VBOXHDD
     /** If a merge to one of the parents is running this may be non-NULL
      * to indicate to what image the writes should be additionally relayed. */
     PVDIMAGE            pImageRelay;
+    /** Incremented for every write request from the outside while holding
+     * the write lock. Used by VDMerge to detect writes racing with the data
+     * it read ahead. */
+    uint32_t            uWriteGen;
 
     /** Flags representing the modification state. */
     unsigned            uModified;
@@ -219,6 +377,28 @@ struct VBOXHDD
 
     /** Pointer to the L2 disk cache if any. */
     PVDCACHE            pCache;
+    /** Statistics for the cache, optional. */
+    PVDCACHESTATS       pCacheStats;
+
+    /** Flag whether the chain index is enabled. */
+    bool                fChainIdx;
+    /** Critical section protecting the chain index. */
+    RTCRITSECT          CritSectChainIdx;
+    /** Extents of the chain index, maps disk ranges to the owning image. */
+    AVLRU64TREE         TreeChainIdx;
+    /** Number of extents in the chain index. */
+    uint32_t            cChainIdxExtents;
+    /** Generation of the chain index, incremented whenever entries are
+     * invalidated to prevent readers from adding stale entries. */
+    uint32_t            uChainIdxGen;
+    /** Number of reads satisfied through the chain index. */
+    uint64_t            cChainIdxHits;
+    /** Number of reads which had to walk the image chain. */
+    uint64_t            cChainIdxMisses;
+
+    /** Discard state, allocated on the first discard request.
+     * Protected by the critical section. */
+    PVDDISCARDSTATE     pDiscard;
 };
 
 # define VD_THREAD_IS_CRITSECT_OWNER(Disk) \
@@ -250,6 +430,8 @@ typedef enum VDIOCTXTXDIR
     VDIOCTXTXDIR_WRITE,
     /** Flush */
     VDIOCTXTXDIR_FLUSH,
+    /** Discard */
+    VDIOCTXTXDIR_DISCARD,
     /** 32bit hack */
     VDIOCTXTXDIR_32BIT_HACK = 0x7fffffff
 } VDIOCTXTXDIR, *PVDIOCTXTXDIR;
@@ -312,6 +494,16 @@ typedef struct VDIOCTX
             void                        *pvUser1;
             /** User argument 1 passed on completion. */
             void                        *pvUser2;
+            /** Start offset of the request. */
+            uint64_t                     uOffsetStart;
+            /** Size of the request. */
+            size_t                       cbTransferStart;
+            /** Ranges to discard for a discard request. */
+            PCRTRANGE                    paRanges;
+            /** Number of ranges in the array. */
+            unsigned                     cRanges;
+            /** Index of the next range to process. */
+            unsigned                     idxRange;
         } Root;
         /** Child data */
         struct
@@ -625,6 +817,501 @@ static int vdFindCacheBackend(const char *pszBackend, PCVDCACHEBACKEND *ppBacken
     return rc;
 }
 
+/**
+ * internal: destroy callback for the chain index extents.
+ */
+static DECLCALLBACK(int) vdChainIdxExtentDestroy(PAVLRU64NODECORE pNode, void *pvUser)
+{
+    RTMemFree(pNode);
+    return VINF_SUCCESS;
+}
+
+/**
+ * internal: removes all entries from the chain index.
+ *
+ * @param   pDisk    The disk.
+ */
+static void vdChainIdxClear(PVBOXHDD pDisk)
+{
+    RTCritSectEnter(&pDisk->CritSectChainIdx);
+    RTAvlrU64Destroy(&pDisk->TreeChainIdx, vdChainIdxExtentDestroy, NULL);
+    pDisk->cChainIdxExtents = 0;
+    pDisk->uChainIdxGen++;
+    RTCritSectLeave(&pDisk->CritSectChainIdx);
+}
+
+/**
+ * internal: removes the given range from the chain index, trimming or splitting
+ * extents which are only partly covered. The caller must own the chain index
+ * critical section.
+ *
+ * @param   pDisk       The disk.
+ * @param   offFirst    First byte of the range.
+ * @param   offLast     Last byte of the range (inclusive).
+ */
+static void vdChainIdxRemoveRange(PVBOXHDD pDisk, uint64_t offFirst, uint64_t offLast)
+{
+    PVDCHAINEXTENT pExtent = (PVDCHAINEXTENT)RTAvlrU64RangeGet(&pDisk->TreeChainIdx, offFirst);
+    if (!pExtent)
+        pExtent = (PVDCHAINEXTENT)RTAvlrU64GetBestFit(&pDisk->TreeChainIdx, offFirst, true /* fAbove */);
+
+    while (   pExtent
+           && pExtent->Core.Key <= offLast)
+    {
+        uint64_t offExtentLast = pExtent->Core.KeyLast;
+        bool     fKeepHead     = pExtent->Core.Key < offFirst;
+
+        RTAvlrU64Remove(&pDisk->TreeChainIdx, pExtent->Core.Key);
+
+        if (offExtentLast > offLast)
+        {
+            /* Keep the part behind the range. */
+            if (fKeepHead)
+            {
+                PVDCHAINEXTENT pTail = (PVDCHAINEXTENT)RTMemAllocZ(sizeof(VDCHAINEXTENT));
+                if (pTail)
+                {
+                    pTail->Core.Key     = offLast + 1;
+                    pTail->Core.KeyLast = offExtentLast;
+                    pTail->pImage       = pExtent->pImage;
+                    RTAvlrU64Insert(&pDisk->TreeChainIdx, &pTail->Core);
+                    pDisk->cChainIdxExtents++;
+                }
+            }
+            else
+            {
+                pExtent->Core.Key = offLast + 1;
+                RTAvlrU64Insert(&pDisk->TreeChainIdx, &pExtent->Core);
+                break;
+            }
+        }
+
+        if (fKeepHead)
+        {
+            pExtent->Core.KeyLast = offFirst - 1;
+            RTAvlrU64Insert(&pDisk->TreeChainIdx, &pExtent->Core);
+        }
+        else
+        {
+            RTMemFree(pExtent);
+            pDisk->cChainIdxExtents--;
+        }
+
+        pExtent = (PVDCHAINEXTENT)RTAvlrU64GetBestFit(&pDisk->TreeChainIdx, offFirst, true /* fAbove */);
+    }
+}
+
+/**
+ * internal: invalidates the given range of the chain index.
+ *
+ * @param   pDisk       The disk.
+ * @param   uOffset     Start offset of the range.
+ * @param   cbRange     Size of the range.
+ */
+static void vdChainIdxInvalidate(PVBOXHDD pDisk, uint64_t uOffset, size_t cbRange)
+{
+    if (!cbRange)
+        return;
+
+    RTCritSectEnter(&pDisk->CritSectChainIdx);
+    vdChainIdxRemoveRange(pDisk, uOffset, uOffset + cbRange - 1);
+    pDisk->uChainIdxGen++;
+    RTCritSectLeave(&pDisk->CritSectChainIdx);
+}
+
+/**
+ * internal: looks up the image holding the data for the given offset in the
+ * chain index.
+ *
+ * @returns true if the index has an entry for the offset, false otherwise.
+ * @param   pDisk       The disk.
+ * @param   uOffset     The offset to look up.
+ * @param   pcbRange    On input the number of bytes to read. On output the
+ *                      number of bytes starting at uOffset which are described
+ *                      by the same entry (or are not in the index if there is none).
+ * @param   ppImage     Where to store the image holding the data, NULL if the
+ *                      range is unallocated in the whole chain.
+ * @param   puGen       Where to store the index generation to pass to
+ *                      vdChainIdxRecord() after walking the chain.
+ */
+static bool vdChainIdxLookup(PVBOXHDD pDisk, uint64_t uOffset, size_t *pcbRange,
+                             PVDIMAGE *ppImage, uint32_t *puGen)
+{
+    bool fFound = false;
+
+    RTCritSectEnter(&pDisk->CritSectChainIdx);
+    PVDCHAINEXTENT pExtent = (PVDCHAINEXTENT)RTAvlrU64RangeGet(&pDisk->TreeChainIdx, uOffset);
+    if (pExtent)
+    {
+        *pcbRange = (size_t)RT_MIN((uint64_t)*pcbRange, pExtent->Core.KeyLast - uOffset + 1);
+        *ppImage  = pExtent->pImage;
+        pDisk->cChainIdxHits++;
+        fFound = true;
+    }
+    else
+    {
+        /* Don't read beyond the next known extent. */
+        pExtent = (PVDCHAINEXTENT)RTAvlrU64GetBestFit(&pDisk->TreeChainIdx, uOffset, true /* fAbove */);
+        if (pExtent)
+            *pcbRange = (size_t)RT_MIN((uint64_t)*pcbRange, pExtent->Core.Key - uOffset);
+        pDisk->cChainIdxMisses++;
+    }
+    *puGen = pDisk->uChainIdxGen;
+    RTCritSectLeave(&pDisk->CritSectChainIdx);
+
+    return fFound;
+}
+
+/**
+ * internal: records the image holding the data for the given range in the
+ * chain index after walking the chain.
+ *
+ * @param   pDisk       The disk.
+ * @param   uGen        The index generation returned by vdChainIdxLookup()
+ *                      before the chain was walked. Nothing is recorded if the
+ *                      index was invalidated in the meantime.
+ * @param   uOffset     Start offset of the range.
+ * @param   cbRange     Size of the range.
+ * @param   pImage      The image holding the data, NULL if the range is
+ *                      unallocated in the whole chain.
+ */
+static void vdChainIdxRecord(PVBOXHDD pDisk, uint32_t uGen, uint64_t uOffset,
+                             size_t cbRange, PVDIMAGE pImage)
+{
+    if (!cbRange)
+        return;
+
+    RTCritSectEnter(&pDisk->CritSectChainIdx);
+    if (uGen == pDisk->uChainIdxGen)
+    {
+        uint64_t offLast = uOffset + cbRange - 1;
+        PVDCHAINEXTENT pExtent = NULL;
+
+        vdChainIdxRemoveRange(pDisk, uOffset, offLast);
+
+        /* Try to extend the preceding extent first. */
+        if (uOffset > 0)
+        {
+            pExtent = (PVDCHAINEXTENT)RTAvlrU64RangeGet(&pDisk->TreeChainIdx, uOffset - 1);
+            if (pExtent && pExtent->pImage == pImage)
+                pExtent->Core.KeyLast = offLast;
+            else
+                pExtent = NULL;
+        }
+
+        if (!pExtent)
+        {
+            pExtent = (PVDCHAINEXTENT)RTMemAllocZ(sizeof(VDCHAINEXTENT));
+            if (pExtent)
+            {
+                pExtent->Core.Key     = uOffset;
+                pExtent->Core.KeyLast = offLast;
+                pExtent->pImage       = pImage;
+                RTAvlrU64Insert(&pDisk->TreeChainIdx, &pExtent->Core);
+                pDisk->cChainIdxExtents++;
+            }
+        }
+
+        /* Merge with the following extent if it belongs to the same image. */
+        if (pExtent)
+        {
+            PVDCHAINEXTENT pNext = (PVDCHAINEXTENT)RTAvlrU64RangeGet(&pDisk->TreeChainIdx, offLast + 1);
+            if (pNext && pNext->pImage == pImage)
+            {
+                RTAvlrU64Remove(&pDisk->TreeChainIdx, pNext->Core.Key);
+                pExtent->Core.KeyLast = pNext->Core.KeyLast;
+                RTMemFree(pNext);
+                pDisk->cChainIdxExtents--;
+            }
+        }
+
+        /* Start over if the index grew too large. */
+        if (pDisk->cChainIdxExtents > VD_CHAIN_INDEX_EXTENTS_MAX)
+        {
+            RTAvlrU64Destroy(&pDisk->TreeChainIdx, vdChainIdxExtentDestroy, NULL);
+            pDisk->cChainIdxExtents = 0;
+            pDisk->uChainIdxGen++;
+        }
+    }
+    RTCritSectLeave(&pDisk->CritSectChainIdx);
+}
+
+/**
+ * internal: destroy callback for the partially discarded blocks.
+ */
+static DECLCALLBACK(int) vdDiscardBlockDestroy(PAVLRU64NODECORE pNode, void *pvUser)
+{
+    RTMemFree(pNode);
+    return VINF_SUCCESS;
+}
+
+/**
+ * internal: forgets about all partially discarded blocks, used when the
+ * image the blocks belong to changes.
+ *
+ * @param   pDisk    The disk.
+ */
+static void vdDiscardStateDestroy(PVBOXHDD pDisk)
+{
+    PVDDISCARDSTATE pDiscard = pDisk->pDiscard;
+
+    if (pDiscard)
+    {
+        RTAvlrU64Destroy(&pDiscard->TreeBlocks, vdDiscardBlockDestroy, NULL);
+        RTMemFree(pDiscard);
+        pDisk->pDiscard = NULL;
+    }
+}
+
+/**
+ * internal: removes the tracked block containing the given offset, if any.
+ */
+static void vdDiscardBlockRemove(PVDDISCARDSTATE pDiscard, uint64_t uOffset)
+{
+    PVDDISCARDBLOCK pBlock = (PVDDISCARDBLOCK)RTAvlrU64RangeRemove(&pDiscard->TreeBlocks, uOffset);
+
+    if (pBlock)
+    {
+        RTListNodeRemove(&pBlock->NodeLru);
+        RTMemFree(pBlock);
+        pDiscard->cBlocks--;
+    }
+}
+
+/**
+ * internal: checks whether the last image can discard blocks.
+ */
+DECLINLINE(bool) vdDiscardIsSupported(PVDIMAGE pImage)
+{
+    return    (pImage->uOpenFlags & VD_OPEN_FLAGS_DISCARD)
+           && !(pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+           && pImage->Backend->pfnDiscard
+           && pImage->Backend->pfnAsyncDiscard;
+}
+
+/**
+ * internal: calls the backend of the last image to discard the given range.
+ *
+ * @returns VBox status code as returned by the backend.
+ * @param   pDisk            The disk.
+ * @param   pIoCtx           The I/O context for an async request, NULL for
+ *                           a synchronous one.
+ * @param   uOffset          Start of the range.
+ * @param   cbDiscard        Size of the range.
+ * @param   pcbPreAllocated  Where to store the amount of data in the block
+ *                           in front of the range.
+ * @param   pcbPostAllocated Where to store the amount of data in the block
+ *                           after the range.
+ * @param   pcbDiscarded     Where to store the amount of data processed.
+ */
+static int vdDiscardBackend(PVBOXHDD pDisk, PVDIOCTX pIoCtx, uint64_t uOffset,
+                            size_t cbDiscard, size_t *pcbPreAllocated,
+                            size_t *pcbPostAllocated, size_t *pcbDiscarded)
+{
+    PVDIMAGE pImage = pDisk->pLast;
+    int rc;
+
+    *pcbDiscarded = cbDiscard;
+    if (pIoCtx)
+        rc = pImage->Backend->pfnAsyncDiscard(pImage->pBackendData, pIoCtx,
+                                              uOffset, cbDiscard, pcbPreAllocated,
+                                              pcbPostAllocated, pcbDiscarded);
+    else
+        rc = pImage->Backend->pfnDiscard(pImage->pBackendData, uOffset,
+                                         cbDiscard, pcbPreAllocated,
+                                         pcbPostAllocated, pcbDiscarded);
+
+    if (   RT_SUCCESS(rc)
+        || rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+    {
+        /* The block is gone, so is any knowledge about partial discards. */
+        if (pDisk->pDiscard)
+            vdDiscardBlockRemove(pDisk->pDiscard, uOffset);
+
+        if (pDisk->fChainIdx)
+            vdChainIdxInvalidate(pDisk, uOffset, *pcbDiscarded);
+    }
+
+    return rc;
+}
+
+/**
+ * internal: records a discard which doesn't cover a complete block and
+ * discards the block once all of it was discarded.
+ *
+ * @returns VBox status code.
+ * @param   pDisk           The disk.
+ * @param   pIoCtx          The I/O context for an async request, NULL for
+ *                          a synchronous one.
+ * @param   offBlock        Start of the block.
+ * @param   cbBlock         Size of the block.
+ * @param   uOffset         Start of the discarded range inside the block.
+ * @param   cbDiscard       Size of the discarded range.
+ */
+static int vdDiscardBlockTrack(PVBOXHDD pDisk, PVDIOCTX pIoCtx, uint64_t offBlock,
+                               size_t cbBlock, uint64_t uOffset, size_t cbDiscard)
+{
+    PVDDISCARDSTATE pDiscard = pDisk->pDiscard;
+    PVDDISCARDBLOCK pBlock;
+    int rc = VINF_SUCCESS;
+
+    if (!pDiscard)
+    {
+        pDiscard = (PVDDISCARDSTATE)RTMemAllocZ(sizeof(VDDISCARDSTATE));
+        if (!pDiscard)
+            return VERR_NO_MEMORY;
+        RTListInit(&pDiscard->ListLru);
+        pDisk->pDiscard = pDiscard;
+    }
+
+    pBlock = (PVDDISCARDBLOCK)RTAvlrU64Get(&pDiscard->TreeBlocks, offBlock);
+    if (!pBlock)
+    {
+        uint32_t cSectors = (uint32_t)(cbBlock / 512);
+        uint32_t cbBitmap = RT_ALIGN_32(cSectors, 32) / 8;
+
+        /* Forget the least recently used block, it just won't be freed. */
+        if (pDiscard->cBlocks >= VD_DISCARD_BLOCKS_MAX)
+        {
+            PVDDISCARDBLOCK pBlockLru = RTListGetLast(&pDiscard->ListLru, VDDISCARDBLOCK, NodeLru);
+            vdDiscardBlockRemove(pDiscard, pBlockLru->Core.Key);
+        }
+
+        pBlock = (PVDDISCARDBLOCK)RTMemAllocZ(RT_OFFSETOF(VDDISCARDBLOCK, abmAllocated) + cbBitmap);
+        if (!pBlock)
+            return VERR_NO_MEMORY;
+
+        pBlock->Core.Key     = offBlock;
+        pBlock->Core.KeyLast = offBlock + cbBlock - 1;
+        pBlock->cSectors     = cSectors;
+        for (uint32_t iSector = 0; iSector < cSectors; iSector++)
+            ASMBitSet(pBlock->abmAllocated, iSector);
+        RTAvlrU64Insert(&pDiscard->TreeBlocks, &pBlock->Core);
+        pDiscard->cBlocks++;
+    }
+    else
+        RTListNodeRemove(&pBlock->NodeLru);
+
+    RTListPrepend(&pDiscard->ListLru, &pBlock->NodeLru);
+
+    /* Only sectors which are covered completely are discarded. */
+    uint32_t iSectorStart = (uint32_t)((uOffset - offBlock + 511) / 512);
+    uint32_t iSectorEnd   = (uint32_t)((uOffset - offBlock + cbDiscard) / 512);
+    for (uint32_t iSector = iSectorStart; iSector < iSectorEnd; iSector++)
+        ASMBitClear(pBlock->abmAllocated, iSector);
+
+    if (ASMBitFirstSet(pBlock->abmAllocated, RT_ALIGN_32(pBlock->cSectors, 32)) == -1)
+    {
+        size_t cbPreAllocated, cbPostAllocated, cbDiscarded;
+
+        LogFlowFunc(("Block %llu is discarded completely now\n", offBlock));
+        rc = vdDiscardBackend(pDisk, pIoCtx, offBlock, cbBlock, &cbPreAllocated,
+                              &cbPostAllocated, &cbDiscarded);
+        AssertMsg(   rc != VERR_VD_DISCARD_ALIGNMENT_NOT_MET
+                  && cbDiscarded == cbBlock,
+                  ("Backend changed the block size\n"));
+        if (rc == VERR_VD_DISCARD_ALIGNMENT_NOT_MET)
+        {
+            vdDiscardBlockRemove(pDiscard, offBlock);
+            rc = VINF_SUCCESS;
+        }
+    }
+
+    return rc;
+}
+
+/**
+ * internal: discards the given range from the last image.
+ *
+ * @returns VBox status code.
+ * @returns VERR_VD_ASYNC_IO_IN_PROGRESS if metadata updates are pending.
+ * @param   pDisk           The disk.
+ * @param   pIoCtx          The I/O context for an async request, NULL for
+ *                          a synchronous one.
+ * @param   uOffset         Start of the range.
+ * @param   cbDiscard       Size of the range.
+ */
+static int vdDiscardHelper(PVBOXHDD pDisk, PVDIOCTX pIoCtx, uint64_t uOffset,
+                           size_t cbDiscard)
+{
+    bool fInProgress = false;
+    int rc = VINF_SUCCESS;
+
+    VD_THREAD_IS_CRITSECT_OWNER(pDisk);
+
+    while (cbDiscard)
+    {
+        size_t cbPreAllocated = 0, cbPostAllocated = 0, cbThisDiscard = 0;
+
+        rc = vdDiscardBackend(pDisk, pIoCtx, uOffset, cbDiscard, &cbPreAllocated,
+                              &cbPostAllocated, &cbThisDiscard);
+        if (rc == VERR_VD_DISCARD_ALIGNMENT_NOT_MET)
+            rc = vdDiscardBlockTrack(pDisk, pIoCtx, uOffset - cbPreAllocated,
+                                     cbPreAllocated + cbThisDiscard + cbPostAllocated,
+                                     uOffset, cbThisDiscard);
+        if (rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+        {
+            fInProgress = true;
+            rc = VINF_SUCCESS;
+        }
+        if (RT_FAILURE(rc))
+            break;
+
+        Assert(cbThisDiscard && cbThisDiscard <= cbDiscard);
+        uOffset   += cbThisDiscard;
+        cbDiscard -= cbThisDiscard;
+    }
+
+    if (RT_SUCCESS(rc) && fInProgress)
+        rc = VERR_VD_ASYNC_IO_IN_PROGRESS;
+
+    return rc;
+}
+
+/**
+ * internal: marks the written range as allocated again in the partially
+ * discarded blocks.
+ *
+ * @param   pDisk           The disk.
+ * @param   uOffset         Start of the written range.
+ * @param   cbWrite         Size of the written range.
+ */
+static void vdDiscardWriteNotify(PVBOXHDD pDisk, uint64_t uOffset, size_t cbWrite)
+{
+    RTCritSectEnter(&pDisk->CritSect);
+
+    PVDDISCARDSTATE pDiscard = pDisk->pDiscard;
+    if (pDiscard && pDiscard->cBlocks)
+    {
+        uint64_t offLast = uOffset + cbWrite - 1;
+
+        while (uOffset <= offLast)
+        {
+            PVDDISCARDBLOCK pBlock = (PVDDISCARDBLOCK)RTAvlrU64RangeGet(&pDiscard->TreeBlocks, uOffset);
+            if (!pBlock)
+            {
+                /* Skip to the next tracked block. */
+                pBlock = (PVDDISCARDBLOCK)RTAvlrU64GetBestFit(&pDiscard->TreeBlocks, uOffset, true /* fAbove */);
+                if (!pBlock || pBlock->Core.Key > offLast)
+                    break;
+                uOffset = pBlock->Core.Key;
+            }
+
+            uint64_t offEnd = RT_MIN(offLast, pBlock->Core.KeyLast);
+            uint32_t iSectorStart = (uint32_t)((uOffset - pBlock->Core.Key) / 512);
+            uint32_t iSectorEnd   = (uint32_t)((offEnd - pBlock->Core.Key) / 512);
+            for (uint32_t iSector = iSectorStart; iSector <= iSectorEnd; iSector++)
+                ASMBitSet(pBlock->abmAllocated, iSector);
+
+            if (pBlock->Core.KeyLast >= offLast)
+                break;
+            uOffset = pBlock->Core.KeyLast + 1;
+        }
+    }
+
+    RTCritSectLeave(&pDisk->CritSect);
+}
+
 /**
  * internal: add image structure to the end of images list.
  */
@@ -648,6 +1335,13 @@ static void vdAddImageToList(PVBOXHDD pDisk, PVDIMAGE pImage)
     }
 
     pDisk->cImages++;
+
+    /* The index describes the old chain. */
+    if (pDisk->fChainIdx)
+        vdChainIdxClear(pDisk);
+
+    /* Partially discarded blocks belong to the previous last image. */
+    vdDiscardStateDestroy(pDisk);
 }
 
 /**
@@ -671,6 +1365,12 @@ static void vdRemoveImageFromList(PVBOXHDD pDisk, PVDIMAGE pImage)
     pImage->pNext = NULL;
 
     pDisk->cImages--;
+
+    /* The index might reference the removed image. */
+    if (pDisk->fChainIdx)
+        vdChainIdxClear(pDisk);
+
+    vdDiscardStateDestroy(pDisk);
 }
 
 /**
@@ -771,18 +1471,86 @@ static int vdCacheWriteHelper(PVDCACHE pCache, uint64_t uOffset, const void *pcv
 }
 
 /**
- * Internal: Reads a given amount of data from the image chain of the disk.
- **/
-static int vdDiskReadHelper(PVBOXHDD pDisk, PVDIMAGE pImage, PVDIMAGE pImageParentOverride,
-                            uint64_t uOffset, void *pvBuf, size_t cbRead, size_t *pcbThisRead)
+ * Internal: Returns whether the cache of the disk is operated in write-back mode.
+ *
+ * @returns true if dirty data might be in the cache, false otherwise.
+ * @param   pDisk      The disk.
+ */
+DECLINLINE(bool) vdCacheIsWriteBack(PVBOXHDD pDisk)
 {
-    int rc = VINF_SUCCESS;
-    size_t cbThisRead = cbRead;
+    return    pDisk->pCache
+           && (pDisk->pCache->uOpenFlags & VD_OPEN_FLAGS_CACHE_WRITEBACK);
+}
 
-    AssertPtr(pcbThisRead);
+/**
+ * Internal: Accounts a cache read in the statistics.
+ *
+ * @param   pStats     The statistics to update.
+ * @param   rc         Status code of the cache read.
+ * @param   cbRead     Number of bytes read from the cache or not found in it.
+ */
+static void vdCacheStatsRead(PVDCACHESTATS pStats, int rc, size_t cbRead)
+{
+    if (RT_SUCCESS(rc))
+    {
+        ASMAtomicIncU64(&pStats->cReadHits);
+        ASMAtomicAddU64(&pStats->cbReadHit, cbRead);
+    }
+    else if (rc == VERR_VD_BLOCK_FREE)
+    {
+        ASMAtomicIncU64(&pStats->cReadMisses);
+        ASMAtomicAddU64(&pStats->cbReadMiss, cbRead);
+    }
+}
+
+/**
+ * Internal: Reads a given amount of data from the image chain of the disk.
+ **/
+static int vdDiskReadHelper(PVBOXHDD pDisk, PVDIMAGE pImage, PVDIMAGE pImageParentOverride,
+                            uint64_t uOffset, void *pvBuf, size_t cbRead, size_t *pcbThisRead)
+{
+    int rc = VINF_SUCCESS;
+    size_t cbThisRead = cbRead;
+    PVDIMAGE pImageRead = pImage;
+    bool fChainIdx =    pDisk->fChainIdx
+                     && !pImageParentOverride
+                     && pImage == pDisk->pLast;
+    uint32_t uChainIdxGen = 0;
+
+    AssertPtr(pcbThisRead);
 
     *pcbThisRead = 0;
 
+    /*
+     * Go directly to the image holding the data if the chain index knows it.
+     */
+    if (fChainIdx)
+    {
+        PVDIMAGE pImageOwner = NULL;
+
+        if (vdChainIdxLookup(pDisk, uOffset, &cbThisRead, &pImageOwner, &uChainIdxGen))
+        {
+            if (!pImageOwner)
+                rc = VERR_VD_BLOCK_FREE;
+            else
+                rc = pImageOwner->Backend->pfnRead(pImageOwner->pBackendData,
+                                                   uOffset, pvBuf, cbThisRead,
+                                                   &cbThisRead);
+
+            if (   rc != VERR_VD_BLOCK_FREE
+                || !pImageOwner)
+            {
+                if (RT_SUCCESS(rc) || rc == VERR_VD_BLOCK_FREE)
+                    *pcbThisRead = cbThisRead;
+                return rc;
+            }
+
+            /* The entry is stale, drop it and walk the chain. */
+            vdChainIdxInvalidate(pDisk, uOffset, cbThisRead);
+            fChainIdx = false;
+        }
+    }
+
     /*
      * Try to read from the given image.
      * If the block is not allocated read from override chain if present.
@@ -800,12 +1568,19 @@ static int vdDiskReadHelper(PVBOXHDD pDisk, PVDIMAGE pImage, PVDIMAGE pImagePare
             rc = pCurrImage->Backend->pfnRead(pCurrImage->pBackendData,
                                               uOffset, pvBuf, cbThisRead,
                                               &cbThisRead);
+            pImageRead = pCurrImage;
         }
     }
 
     if (RT_SUCCESS(rc) || rc == VERR_VD_BLOCK_FREE)
+    {
         *pcbThisRead = cbThisRead;
 
+        if (fChainIdx)
+            vdChainIdxRecord(pDisk, uChainIdxGen, uOffset, cbThisRead,
+                             rc == VERR_VD_BLOCK_FREE ? NULL : pImageRead);
+    }
+
     return rc;
 }
 
@@ -852,10 +1627,13 @@ static int vdReadHelperEx(PVBOXHDD pDisk, PVDIMAGE pImage, PVDIMAGE pImageParent
         cbThisRead = cbRead;
 
         if (   pDisk->pCache
-            && !pImageParentOverride)
+            && !pImageParentOverride
+            && pImage == pDisk->pLast)
         {
             rc = vdCacheReadHelper(pDisk->pCache, uOffset, pvBuf,
                                    cbThisRead, &cbThisRead);
+            if (pDisk->pCacheStats)
+                vdCacheStatsRead(pDisk->pCacheStats, rc, cbThisRead);
 
             if (rc == VERR_VD_BLOCK_FREE)
             {
@@ -871,6 +1649,12 @@ static int vdReadHelperEx(PVBOXHDD pDisk, PVDIMAGE pImage, PVDIMAGE pImageParent
                 }
             }
         }
+        else if (   pDisk->fChainIdx
+                 && !pImageParentOverride
+                 && !cImagesRead
+                 && pImage == pDisk->pLast)
+            rc = vdDiskReadHelper(pDisk, pImage, NULL, uOffset, pvBuf, cbThisRead,
+                                  &cbThisRead);
         else
         {
             /** @todo can be be replaced by vdDiskReadHelper if it proves to be reliable,
@@ -973,8 +1757,9 @@ DECLINLINE(PVDIOCTX) vdIoCtxAlloc(PVBOXHDD pDisk, VDIOCTXTXDIR enmTxDir,
         pIoCtx->pfnIoCtxTransferNext  = NULL;
         pIoCtx->rcReq                 = VINF_SUCCESS;
 
-        /* There is no S/G list for a flush request. */
-        if (enmTxDir != VDIOCTXTXDIR_FLUSH)
+        /* There is no S/G list for a flush or discard request. */
+        if (   enmTxDir != VDIOCTXTXDIR_FLUSH
+            && enmTxDir != VDIOCTXTXDIR_DISCARD)
             RTSgBufClone(&pIoCtx->SgBuf, pcSgBuf);
         else
             memset(&pIoCtx->SgBuf, 0, sizeof(RTSGBUF));
@@ -1000,6 +1785,11 @@ DECLINLINE(PVDIOCTX) vdIoCtxRootAlloc(PVBOXHDD pDisk, VDIOCTXTXDIR enmTxDir,
         pIoCtx->Type.Root.pfnComplete = pfnComplete;
         pIoCtx->Type.Root.pvUser1     = pvUser1;
         pIoCtx->Type.Root.pvUser2     = pvUser2;
+        pIoCtx->Type.Root.uOffsetStart    = uOffset;
+        pIoCtx->Type.Root.cbTransferStart = cbTransfer;
+        pIoCtx->Type.Root.paRanges        = NULL;
+        pIoCtx->Type.Root.cRanges         = 0;
+        pIoCtx->Type.Root.idxRange        = 0;
     }
 
     LogFlow(("Allocated root I/O context %#p\n", pIoCtx));
@@ -1070,6 +1860,17 @@ DECLINLINE(PVDIOTASK) vdIoTaskMetaAlloc(PVDIOSTORAGE pIoStorage, PFNVDXFERCOMPLE
 DECLINLINE(void) vdIoCtxFree(PVBOXHDD pDisk, PVDIOCTX pIoCtx)
 {
     LogFlow(("Freeing I/O context %#p\n", pIoCtx));
+
+    /*
+     * Invalidate the chain index once the write finished, readers which walked
+     * the chain while the write was in progress might have recorded stale entries.
+     */
+    if (   pDisk->fChainIdx
+        && !pIoCtx->pIoCtxParent
+        && pIoCtx->enmTxDir == VDIOCTXTXDIR_WRITE)
+        vdChainIdxInvalidate(pDisk, pIoCtx->Type.Root.uOffsetStart,
+                             pIoCtx->Type.Root.cbTransferStart);
+
     if (pIoCtx->pvAllocation)
         RTMemFree(pIoCtx->pvAllocation);
 #ifdef DEBUG
@@ -1347,28 +2148,75 @@ static int vdReadHelperAsync(PVDIOCTX pIoCtx)
     /* Loop until all reads started or we have a backend which needs to read metadata. */
     do
     {
+        PVBOXHDD pDisk = pIoCtx->pDisk;
+        bool fChainIdx = pDisk->fChainIdx && pCurrImage == pDisk->pLast;
+        bool fWalkChain = true;
+        uint32_t uChainIdxGen = 0;
+
         /* Search for image with allocated block. Do not attempt to read more
          * than the previous reads marked as valid. Otherwise this would return
          * stale data when different block sizes are used for the images. */
         cbThisRead = cbToRead;
 
         /*
-         * Try to read from the given image.
-         * If the block is not allocated read from override chain if present.
+         * Go directly to the image holding the data if the chain index knows it.
          */
-        rc = pCurrImage->Backend->pfnAsyncRead(pCurrImage->pBackendData,
-                                               uOffset, cbThisRead,
-                                               pIoCtx, &cbThisRead);
+        if (fChainIdx)
+        {
+            PVDIMAGE pImageOwner = NULL;
 
-        if (rc == VERR_VD_BLOCK_FREE)
+            if (vdChainIdxLookup(pDisk, uOffset, &cbThisRead, &pImageOwner, &uChainIdxGen))
+            {
+                fChainIdx = false;
+                rc = VERR_VD_BLOCK_FREE;
+
+                if (!pImageOwner)
+                    fWalkChain = false;
+                else
+                {
+                    rc = pImageOwner->Backend->pfnAsyncRead(pImageOwner->pBackendData,
+                                                            uOffset, cbThisRead,
+                                                            pIoCtx, &cbThisRead);
+                    if (rc != VERR_VD_BLOCK_FREE)
+                    {
+                        pCurrImage = pImageOwner;
+                        fWalkChain = false;
+                    }
+                    else /* The entry is stale, drop it and walk the chain. */
+                        vdChainIdxInvalidate(pDisk, uOffset, cbThisRead);
+                }
+            }
+        }
+
+        if (fWalkChain)
         {
-            while (   pCurrImage->pPrev != NULL
-                   && rc == VERR_VD_BLOCK_FREE)
+            /*
+             * Try to read from the given image.
+             * If the block is not allocated read from override chain if present.
+             */
+            rc = pCurrImage->Backend->pfnAsyncRead(pCurrImage->pBackendData,
+                                                   uOffset, cbThisRead,
+                                                   pIoCtx, &cbThisRead);
+
+            if (rc == VERR_VD_BLOCK_FREE)
             {
-                pCurrImage =  pCurrImage->pPrev;
-                rc = pCurrImage->Backend->pfnAsyncRead(pCurrImage->pBackendData,
-                                                       uOffset, cbThisRead,
-                                                       pIoCtx, &cbThisRead);
+                while (   pCurrImage->pPrev != NULL
+                       && rc == VERR_VD_BLOCK_FREE)
+                {
+                    pCurrImage =  pCurrImage->pPrev;
+                    rc = pCurrImage->Backend->pfnAsyncRead(pCurrImage->pBackendData,
+                                                           uOffset, cbThisRead,
+                                                           pIoCtx, &cbThisRead);
+                }
+            }
+
+            if (fChainIdx)
+            {
+                if (rc == VERR_VD_BLOCK_FREE)
+                    vdChainIdxRecord(pDisk, uChainIdxGen, uOffset, cbThisRead, NULL);
+                else if (   rc == VINF_SUCCESS
+                         || rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+                    vdChainIdxRecord(pDisk, uChainIdxGen, uOffset, cbThisRead, pCurrImage);
             }
         }
 
@@ -1630,6 +2478,34 @@ static int vdWriteHelperOptimized(PVBOXHDD pDisk, PVDIMAGE pImage,
     return rc;
 }
 
+/**
+ * internal: checks whether a write to a block which is not allocated in the
+ * image can be skipped because the data consists of zeroes only and the
+ * parent images don't have other data for the range.
+ */
+static bool vdWriteHelperIsZeroNop(PVBOXHDD pDisk, PVDIMAGE pImage,
+                                   PVDIMAGE pImageParentOverride, uint64_t uOffset,
+                                   const void *pvBuf, size_t cbWrite)
+{
+    if (!RTMemIsZero(pvBuf, cbWrite))
+        return false;
+
+    /* Unallocated blocks of a base image read as zeroes. */
+    if (!pImageParentOverride && !pImage->pPrev)
+        return true;
+
+    void *pvTmp = RTMemTmpAlloc(cbWrite);
+    if (!pvTmp)
+        return false;
+
+    int rc = vdReadHelperEx(pDisk, pImage, pImageParentOverride, uOffset, pvTmp,
+                            cbWrite, true /* fZeroFreeBlocks */,
+                            false /* fUpdateCache */, 0);
+    bool fNop = RT_SUCCESS(rc) && RTMemIsZero(pvTmp, cbWrite);
+    RTMemTmpFree(pvTmp);
+    return fNop;
+}
+
 /**
  * internal: write buffer to the image, taking care of block boundaries and
  * write optimizations.
@@ -1647,6 +2523,9 @@ static int vdWriteHelperEx(PVBOXHDD pDisk, PVDIMAGE pImage,
     size_t cbWriteCur = cbWrite;
     const void *pcvBufCur = pvBuf;
 
+    if (pDisk->fChainIdx)
+        vdChainIdxInvalidate(pDisk, uOffset, cbWrite);
+
     /* Loop until all written. */
     do
     {
@@ -1662,7 +2541,15 @@ static int vdWriteHelperEx(PVBOXHDD pDisk, PVDIMAGE pImage,
         rc = pImage->Backend->pfnWrite(pImage->pBackendData, uOffsetCur, pcvBufCur,
                                        cbThisWrite, &cbThisWrite, &cbPreRead,
                                        &cbPostRead, fWrite);
-        if (rc == VERR_VD_BLOCK_FREE)
+        if (   rc == VERR_VD_BLOCK_FREE
+            && (pImage->uOpenFlags & VD_OPEN_FLAGS_SKIP_ZEROES)
+            && vdWriteHelperIsZeroNop(pDisk, pImage, pImageParentOverride,
+                                      uOffsetCur, pcvBufCur, cbThisWrite))
+        {
+            /* Nothing would change, leave the block unallocated. */
+            rc = VINF_SUCCESS;
+        }
+        else if (rc == VERR_VD_BLOCK_FREE)
         {
             void *pvTmp = RTMemTmpAlloc(cbPreRead + cbThisWrite + cbPostRead);
             AssertBreakStmt(VALID_PTR(pvTmp), rc = VERR_NO_MEMORY);
@@ -1697,6 +2584,10 @@ static int vdWriteHelperEx(PVBOXHDD pDisk, PVDIMAGE pImage,
         pcvBufCur = (char *)pcvBufCur + cbThisWrite;
     } while (cbWriteCur != 0 && RT_SUCCESS(rc));
 
+    /* Drop entries concurrent readers added while the write was in progress. */
+    if (pDisk->fChainIdx)
+        vdChainIdxInvalidate(pDisk, uOffset, cbWrite);
+
     /* Update the cache on success */
     if (   RT_SUCCESS(rc)
         && pDisk->pCache
@@ -1718,141 +2609,567 @@ static int vdWriteHelper(PVBOXHDD pDisk, PVDIMAGE pImage, uint64_t uOffset,
 }
 
 /**
- * Internal: Copies the content of one disk to another one applying optimizations
- * to speed up the copy process if possible.
+ * Internal: Writes dirty data from the cache to the last image.
+ *
+ * The ranges are marked clean only after the image was flushed so a crash
+ * in between writes the data again when the cache is opened the next time.
+ *
+ * @returns VBox status code.
+ * @param   pDisk      The disk.
+ * @param   cbMax      Stop after writing back at least this many bytes,
+ *                     UINT64_MAX to write back everything.
  */
-static int vdCopyHelper(PVBOXHDD pDiskFrom, PVDIMAGE pImageFrom, PVBOXHDD pDiskTo,
-                        uint64_t cbSize, unsigned cImagesFromRead, unsigned cImagesToRead,
-                        bool fSuppressRedundantIo,
-                        PVDINTERFACE pIfProgress, PVDINTERFACEPROGRESS pCbProgress,
-                        PVDINTERFACE pDstIfProgress, PVDINTERFACEPROGRESS pDstCbProgress)
+static int vdCacheWriteBack(PVBOXHDD pDisk, uint64_t cbMax)
 {
     int rc = VINF_SUCCESS;
-    int rc2;
+    PVDCACHE pCache = pDisk->pCache;
+    PVDIMAGE pImage = pDisk->pLast;
     uint64_t uOffset = 0;
-    uint64_t cbRemaining = cbSize;
-    void *pvBuf = NULL;
-    bool fLockReadFrom = false;
-    bool fLockWriteTo = false;
-    bool fBlockwiseCopy = fSuppressRedundantIo || (cImagesFromRead > 0);
-    unsigned uProgressOld = 0;
+    uint64_t cbWrittenBack = 0;
+    bool fDone = false;
+    void *pvBuf;
 
-    LogFlowFunc(("pDiskFrom=%#p pImageFrom=%#p pDiskTo=%#p cbSize=%llu cImagesFromRead=%u cImagesToRead=%u fSuppressRedundantIo=%RTbool pIfProgress=%#p pCbProgress=%#p pDstIfProgress=%#p pDstCbProgress=%#p\n",
-                 pDiskFrom, pImageFrom, pDiskTo, cbSize, cImagesFromRead, cImagesToRead, fSuppressRedundantIo, pIfProgress, pCbProgress, pDstIfProgress, pDstCbProgress));
+    LogFlowFunc(("pDisk=%#p cbMax=%llu\n", pDisk, cbMax));
 
-    /* Allocate tmp buffer. */
-    pvBuf = RTMemTmpAlloc(VD_MERGE_BUFFER_SIZE);
+    if (   !pCache
+        || !pCache->Backend->pfnQueryDirty)
+        return VINF_SUCCESS;
+
+    AssertPtrReturn(pImage, VERR_VD_NOT_OPENED);
+
+    pvBuf = RTMemTmpAlloc(VD_CACHE_WRITEBACK_CHUNK);
     if (!pvBuf)
-        return rc;
+        return VERR_NO_MEMORY;
 
-    do
+    while (   !fDone
+           && RT_SUCCESS(rc))
     {
-        size_t cbThisRead = RT_MIN(VD_MERGE_BUFFER_SIZE, cbRemaining);
+        uint64_t auOffsets[VD_CACHE_WRITEBACK_RANGES];
+        size_t   acbRanges[VD_CACHE_WRITEBACK_RANGES];
+        unsigned cRanges = 0;
 
-        /* Note that we don't attempt to synchronize cross-disk accesses.
-         * It wouldn't be very difficult to do, just the lock order would
-         * need to be defined somehow to prevent deadlocks. Postpone such
-         * magic as there is no use case for this. */
+        while (cRanges < VD_CACHE_WRITEBACK_RANGES)
+        {
+            uint64_t uOffsetDirty = 0;
+            size_t cbDirty = 0;
 
-        rc2 = vdThreadStartRead(pDiskFrom);
-        AssertRC(rc2);
-        fLockReadFrom = true;
+            if (cbWrittenBack >= cbMax)
+            {
+                fDone = true;
+                break;
+            }
 
-        if (fBlockwiseCopy)
+            rc = pCache->Backend->pfnQueryDirty(pCache->pBackendData, uOffset,
+                                                &uOffsetDirty, &cbDirty);
+            if (rc == VERR_NOT_FOUND)
+            {
+                rc = VINF_SUCCESS;
+                fDone = true;
+                break;
+            }
+            if (RT_FAILURE(rc))
+                break;
+
+            cbDirty = RT_MIN(cbDirty, VD_CACHE_WRITEBACK_CHUNK);
+            rc = vdCacheReadHelper(pCache, uOffsetDirty, pvBuf, cbDirty, &cbDirty);
+            AssertMsgStmt(rc != VERR_VD_BLOCK_FREE,
+                          ("Dirty range %llu is not in the cache\n", uOffsetDirty),
+                          rc = VERR_INTERNAL_ERROR);
+            if (RT_SUCCESS(rc))
+                rc = vdWriteHelper(pDisk, pImage, uOffsetDirty, pvBuf, cbDirty,
+                                   false /* fUpdateCache */);
+            /* Relay to the merge destination like VDWrite does. */
+            if (   RT_SUCCESS(rc)
+                && pDisk->pImageRelay)
+                rc = vdWriteHelper(pDisk, pDisk->pImageRelay, uOffsetDirty, pvBuf,
+                                   cbDirty, false /* fUpdateCache */);
+            if (RT_FAILURE(rc))
+                break;
+
+            auOffsets[cRanges] = uOffsetDirty;
+            acbRanges[cRanges] = cbDirty;
+            cRanges++;
+            uOffset        = uOffsetDirty + cbDirty;
+            cbWrittenBack += cbDirty;
+        }
+
+        if (   RT_SUCCESS(rc)
+            && cRanges)
         {
-            /* Read the source data. */
-            rc = pImageFrom->Backend->pfnRead(pImageFrom->pBackendData,
-                                              uOffset, pvBuf, cbThisRead,
-                                              &cbThisRead);
+            rc = pImage->Backend->pfnFlush(pImage->pBackendData);
+            if (   RT_SUCCESS(rc)
+                && pDisk->pImageRelay)
+                rc = pDisk->pImageRelay->Backend->pfnFlush(pDisk->pImageRelay->pBackendData);
+            for (unsigned i = 0; i < cRanges && RT_SUCCESS(rc); i++)
+            {
+                rc = pCache->Backend->pfnMarkClean(pCache->pBackendData, auOffsets[i],
+                                                   acbRanges[i]);
+                if (   RT_SUCCESS(rc)
+                    && pDisk->pCacheStats)
+                    ASMAtomicAddU64(&pDisk->pCacheStats->cbWrittenBack, acbRanges[i]);
+            }
+        }
+    }
 
-            if (   rc == VERR_VD_BLOCK_FREE
-                && cImagesFromRead != 1)
+    RTMemTmpFree(pvBuf);
+
+    LogFlowFunc(("returns rc=%Rrc cbWrittenBack=%llu\n", rc, cbWrittenBack));
+    return rc;
+}
+
+/**
+ * Internal: Writes back all dirty data of a write-back cache before an
+ * operation which works on the images directly, taking the write lock.
+ *
+ * @returns VBox status code.
+ * @param   pDisk      The disk.
+ */
+static int vdCacheWriteBackAll(PVBOXHDD pDisk)
+{
+    int rc = VINF_SUCCESS;
+    int rc2;
+
+    rc2 = vdThreadStartWrite(pDisk);
+    AssertRC(rc2);
+
+    if (vdCacheIsWriteBack(pDisk))
+        rc = vdCacheWriteBack(pDisk, UINT64_MAX);
+
+    rc2 = vdThreadFinishWrite(pDisk);
+    AssertRC(rc2);
+
+    return rc;
+}
+
+/**
+ * Internal: Writes data to a write-back cache. If the cache runs out of space
+ * part of the dirty data is written back to make room.
+ *
+ * @returns VBox status code.
+ * @param   pDisk      The disk.
+ * @param   uOffset    Offset of the virtual disk to write to.
+ * @param   pvBuf      The data to write.
+ * @param   cbWrite    How much to write.
+ */
+static int vdCacheWriteDirty(PVBOXHDD pDisk, uint64_t uOffset, const void *pvBuf,
+                             size_t cbWrite)
+{
+    int rc = VINF_SUCCESS;
+    PVDCACHE pCache = pDisk->pCache;
+    bool fWrittenBack = false;
+
+    while (   cbWrite
+           && RT_SUCCESS(rc))
+    {
+        size_t cbWritten = 0;
+
+        rc = pCache->Backend->pfnWriteDirty(pCache->pBackendData, uOffset, pvBuf,
+                                            cbWrite, &cbWritten);
+        if (pDisk->pCacheStats)
+            ASMAtomicAddU64(&pDisk->pCacheStats->cbWriteBackDeferred, cbWritten);
+        uOffset += cbWritten;
+        pvBuf    = (const uint8_t *)pvBuf + cbWritten;
+        cbWrite -= cbWritten;
+
+        if (rc == VERR_DISK_FULL)
+        {
+            if (!fWrittenBack)
             {
-                unsigned cImagesToProcess = cImagesFromRead;
+                /* Clean data can be evicted, write back an eighth of the cache. */
+                uint64_t cbCache = pCache->Backend->pfnGetSize(pCache->pBackendData);
 
-                for (PVDIMAGE pCurrImage = pImageFrom->pPrev;
-                     pCurrImage != NULL && rc == VERR_VD_BLOCK_FREE;
-                     pCurrImage = pCurrImage->pPrev)
-                {
-                    rc = pCurrImage->Backend->pfnRead(pCurrImage->pBackendData,
-                                                      uOffset, pvBuf, cbThisRead,
-                                                      &cbThisRead);
-                    if (cImagesToProcess == 1)
-                        break;
-                    else if (cImagesToProcess > 0)
-                        cImagesToProcess--;
-                }
+                rc = vdCacheWriteBack(pDisk, RT_MAX(cbWrite, cbCache / 8));
+                fWrittenBack = true;
+            }
+            else
+            {
+                /* The cache can't keep up, write the rest to the image directly
+                 * and drop what the cache has for the range afterwards. */
+                rc = vdWriteHelper(pDisk, pDisk->pLast, uOffset, pvBuf, cbWrite,
+                                   false /* fUpdateCache */);
+                if (RT_SUCCESS(rc))
+                    rc = pCache->Backend->pfnDiscard(pCache->pBackendData, uOffset, cbWrite);
+                break;
             }
         }
-        else
-            rc = vdReadHelper(pDiskFrom, pImageFrom, uOffset, pvBuf, cbThisRead,
-                              false /* fUpdateCache */);
+    }
 
-        if (RT_FAILURE(rc) && rc != VERR_VD_BLOCK_FREE)
+    return rc;
+}
+
+/**
+ * Internal: Reads the next chunk of data for copying.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_BLOCK_FREE if the chunk is not allocated in the images to copy
+ *          from and can be skipped, only for blockwise copies.
+ * @param   pDiskFrom       The disk to read from.
+ * @param   pImageFrom      The image to start reading from.
+ * @param   uOffset         Offset to start reading from.
+ * @param   pvBuf           Where to store the data.
+ * @param   pcbRead         On input the maximum number of bytes to read,
+ *                          on output the number of bytes the chunk consists of.
+ * @param   cImagesFromRead Number of images in the chain to read until the read
+ *                          is cut off. A value of 0 disables the cut off.
+ * @param   fBlockwiseCopy  Flag whether to copy blockwise, leaving out
+ *                          unallocated blocks.
+ */
+static int vdCopyReadChunk(PVBOXHDD pDiskFrom, PVDIMAGE pImageFrom, uint64_t uOffset,
+                           void *pvBuf, size_t *pcbRead, unsigned cImagesFromRead,
+                           bool fBlockwiseCopy)
+{
+    int rc = VINF_SUCCESS;
+    int rc2;
+    size_t cbThisRead = *pcbRead;
+
+    /* Note that we don't attempt to synchronize cross-disk accesses.
+     * It wouldn't be very difficult to do, just the lock order would
+     * need to be defined somehow to prevent deadlocks. Postpone such
+     * magic as there is no use case for this. */
+
+    rc2 = vdThreadStartRead(pDiskFrom);
+    AssertRC(rc2);
+
+    if (fBlockwiseCopy)
+    {
+        /* Read the source data. */
+        rc = pImageFrom->Backend->pfnRead(pImageFrom->pBackendData,
+                                          uOffset, pvBuf, cbThisRead,
+                                          &cbThisRead);
+
+        if (   rc == VERR_VD_BLOCK_FREE
+            && cImagesFromRead != 1)
+        {
+            unsigned cImagesToProcess = cImagesFromRead;
+
+            for (PVDIMAGE pCurrImage = pImageFrom->pPrev;
+                 pCurrImage != NULL && rc == VERR_VD_BLOCK_FREE;
+                 pCurrImage = pCurrImage->pPrev)
+            {
+                rc = pCurrImage->Backend->pfnRead(pCurrImage->pBackendData,
+                                                  uOffset, pvBuf, cbThisRead,
+                                                  &cbThisRead);
+                if (cImagesToProcess == 1)
+                    break;
+                else if (cImagesToProcess > 0)
+                    cImagesToProcess--;
+            }
+        }
+    }
+    else
+        rc = vdReadHelper(pDiskFrom, pImageFrom, uOffset, pvBuf, cbThisRead,
+                          false /* fUpdateCache */);
+
+    rc2 = vdThreadFinishRead(pDiskFrom);
+    AssertRC(rc2);
+
+    *pcbRead = cbThisRead;
+    return rc;
+}
+
+/**
+ * Internal: Writes a chunk of data to the destination of a copy.
+ *
+ * @returns VBox status code.
+ * @param   pDiskTo         The disk to write to.
+ * @param   uOffset         Offset to write to.
+ * @param   pvBuf           The data to write.
+ * @param   cbWrite         Number of bytes to write.
+ * @param   cImagesToRead   Number of images in the destination chain to read
+ *                          for collapsed I/O, only used for blockwise copies.
+ * @param   fBlockwiseCopy  Flag whether the data is copied blockwise.
+ */
+static int vdCopyWriteChunk(PVBOXHDD pDiskTo, uint64_t uOffset, const void *pvBuf,
+                            size_t cbWrite, unsigned cImagesToRead, bool fBlockwiseCopy)
+{
+    int rc;
+    int rc2;
+
+    rc2 = vdThreadStartWrite(pDiskTo);
+    AssertRC(rc2);
+
+    /* Only do collapsed I/O if we are copying the data blockwise. */
+    rc = vdWriteHelperEx(pDiskTo, pDiskTo->pLast, NULL, uOffset, pvBuf,
+                         cbWrite, false /* fUpdateCache */,
+                         fBlockwiseCopy ? cImagesToRead : 0);
+
+    rc2 = vdThreadFinishWrite(pDiskTo);
+    AssertRC(rc2);
+
+    return rc;
+}
+
+/**
+ * Internal: Reports the progress of a copy or merge if it changed.
+ *
+ * @returns VBox status code, failure if the operation was cancelled.
+ */
+static int vdReportProgress(uint64_t uOffset, uint64_t cbSize, unsigned *puProgressOld,
+                            PVDINTERFACE pIfProgress, PVDINTERFACEPROGRESS pCbProgress,
+                            PVDINTERFACE pDstIfProgress, PVDINTERFACEPROGRESS pDstCbProgress)
+{
+    int rc = VINF_SUCCESS;
+    unsigned uProgressNew = uOffset * 99 / cbSize;
+
+    if (uProgressNew != *puProgressOld)
+    {
+        *puProgressOld = uProgressNew;
+
+        if (pCbProgress && pCbProgress->pfnProgress)
+            rc = pCbProgress->pfnProgress(pIfProgress->pvUser, uProgressNew);
+        if (   RT_SUCCESS(rc)
+            && pDstCbProgress && pDstCbProgress->pfnProgress)
+            rc = pDstCbProgress->pfnProgress(pDstIfProgress->pvUser, uProgressNew);
+    }
+
+    return rc;
+}
+
+/**
+ * Internal: Pipeline reader thread, reads ahead of the writer into the free
+ * buffers of the pipeline.
+ */
+static DECLCALLBACK(int) vdPipeReaderThread(RTTHREAD hThread, void *pvUser)
+{
+    PVDPIPE pPipe = (PVDPIPE)pvUser;
+    uint64_t uOffset = 0;
+    unsigned iBuf = 0;
+
+    while (!ASMAtomicReadBool(&pPipe->fCancelled))
+    {
+        PVDPIPEBUF pBuf = &pPipe->aBufs[iBuf];
+
+        /* Wait for the writer to hand the buffer back. */
+        if (ASMAtomicReadBool(&pBuf->fFilled))
+        {
+            RTSemEventWait(pPipe->hEvtFree, RT_INDEFINITE_WAIT);
+            continue;
+        }
+
+        pBuf->uOffset = uOffset;
+        pBuf->cbData  = (size_t)RT_MIN(VD_PIPE_BUFFER_SIZE, pPipe->cbSize - uOffset);
+        pBuf->fZero   = false;
+        pBuf->rcRead  = pPipe->pfnRead(pPipe, pBuf);
+        if (   RT_SUCCESS(pBuf->rcRead)
+            && pPipe->fSkipZeroes)
+            pBuf->fZero = RTMemIsZero(pBuf->pvBuf, pBuf->cbData);
+
+        uOffset += pBuf->cbData;
+        pBuf->fLast = uOffset >= pPipe->cbSize
+                      || (RT_FAILURE(pBuf->rcRead) && pBuf->rcRead != VERR_VD_BLOCK_FREE);
+
+        ASMAtomicWriteBool(&pBuf->fFilled, true);
+        RTSemEventSignal(pPipe->hEvtFilled);
+
+        if (pBuf->fLast)
+            break;
+
+        iBuf = (iBuf + 1) % RT_ELEMENTS(pPipe->aBufs);
+    }
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Internal: Runs a pipeline, the data is read on a separate thread while the
+ * calling thread writes it in disk order.
+ *
+ * @returns VBox status code.
+ * @param   pPipe           The pipeline state, the callbacks and the parameters
+ *                          they use must be set, the rest is initialized here.
+ * @param   pIfProgress     Progress interface, optional.
+ * @param   pCbProgress     Progress callbacks, optional.
+ * @param   pDstIfProgress  Second progress interface, optional.
+ * @param   pDstCbProgress  Second progress callbacks, optional.
+ */
+static int vdPipeRun(PVDPIPE pPipe,
+                     PVDINTERFACE pIfProgress, PVDINTERFACEPROGRESS pCbProgress,
+                     PVDINTERFACE pDstIfProgress, PVDINTERFACEPROGRESS pDstCbProgress)
+{
+    int rc = VINF_SUCCESS;
+    unsigned uProgressOld = 0;
+    unsigned iBuf = 0;
+    RTTHREAD hThreadReader = NIL_RTTHREAD;
+
+    pPipe->fCancelled = false;
+    pPipe->hEvtFilled = NIL_RTSEMEVENT;
+    pPipe->hEvtFree   = NIL_RTSEMEVENT;
+
+    for (unsigned i = 0; i < RT_ELEMENTS(pPipe->aBufs); i++)
+    {
+        pPipe->aBufs[i].fFilled = false;
+        pPipe->aBufs[i].pvBuf   = NULL;
+    }
+
+    for (unsigned i = 0; i < RT_ELEMENTS(pPipe->aBufs) && RT_SUCCESS(rc); i++)
+    {
+        pPipe->aBufs[i].pvBuf = RTMemTmpAlloc(VD_PIPE_BUFFER_SIZE);
+        if (!pPipe->aBufs[i].pvBuf)
+            rc = VERR_NO_MEMORY;
+    }
+
+    if (RT_SUCCESS(rc))
+        rc = RTSemEventCreate(&pPipe->hEvtFilled);
+    if (RT_SUCCESS(rc))
+        rc = RTSemEventCreate(&pPipe->hEvtFree);
+    if (RT_SUCCESS(rc))
+        rc = RTThreadCreate(&hThreadReader, vdPipeReaderThread, pPipe, 0,
+                            RTTHREADTYPE_IO, RTTHREADFLAGS_WAITABLE, "VDPipeRd");
+
+    while (RT_SUCCESS(rc))
+    {
+        PVDPIPEBUF pBuf = &pPipe->aBufs[iBuf];
+
+        /* Wait for the reader to fill the next buffer. */
+        if (!ASMAtomicReadBool(&pBuf->fFilled))
+        {
+            RTSemEventWait(pPipe->hEvtFilled, RT_INDEFINITE_WAIT);
+            continue;
+        }
+
+        bool fLast = pBuf->fLast;
+
+        rc = pBuf->rcRead;
+        if (RT_SUCCESS(rc))
+        {
+            if (!pBuf->fZero)
+                rc = pPipe->pfnWrite(pPipe, pBuf);
+        }
+        else if (rc == VERR_VD_BLOCK_FREE) /* Don't propagate the error to the outside */
+            rc = VINF_SUCCESS;
+
+        if (RT_SUCCESS(rc))
+            rc = vdReportProgress(pBuf->uOffset + pBuf->cbData, pPipe->cbSize, &uProgressOld,
+                                  pIfProgress, pCbProgress, pDstIfProgress, pDstCbProgress);
+
+        /* Hand the buffer back to the reader. */
+        ASMAtomicWriteBool(&pBuf->fFilled, false);
+        RTSemEventSignal(pPipe->hEvtFree);
+
+        if (fLast)
             break;
 
-        rc2 = vdThreadFinishRead(pDiskFrom);
-        AssertRC(rc2);
-        fLockReadFrom = false;
+        iBuf = (iBuf + 1) % RT_ELEMENTS(pPipe->aBufs);
+    }
+
+    /* Stop the reader if we bailed out early. */
+    if (hThreadReader != NIL_RTTHREAD)
+    {
+        ASMAtomicWriteBool(&pPipe->fCancelled, true);
+        RTSemEventSignal(pPipe->hEvtFree);
+        int rc2 = RTThreadWait(hThreadReader, RT_INDEFINITE_WAIT, NULL);
+        AssertRC(rc2);
+    }
+
+    if (pPipe->hEvtFilled != NIL_RTSEMEVENT)
+        RTSemEventDestroy(pPipe->hEvtFilled);
+    if (pPipe->hEvtFree != NIL_RTSEMEVENT)
+        RTSemEventDestroy(pPipe->hEvtFree);
+    for (unsigned i = 0; i < RT_ELEMENTS(pPipe->aBufs); i++)
+        if (pPipe->aBufs[i].pvBuf)
+            RTMemTmpFree(pPipe->aBufs[i].pvBuf);
+
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Internal: Pipeline read callback for copying.
+ */
+static DECLCALLBACK(int) vdCopyPipeRead(PVDPIPE pPipe, PVDPIPEBUF pBuf)
+{
+    return vdCopyReadChunk(pPipe->pDiskFrom, pPipe->pImageFrom, pBuf->uOffset,
+                           pBuf->pvBuf, &pBuf->cbData, pPipe->cImagesFromRead,
+                           pPipe->fBlockwiseCopy);
+}
+
+/**
+ * Internal: Pipeline write callback for copying.
+ */
+static DECLCALLBACK(int) vdCopyPipeWrite(PVDPIPE pPipe, PVDPIPEBUF pBuf)
+{
+    return vdCopyWriteChunk(pPipe->pDiskTo, pBuf->uOffset, pBuf->pvBuf, pBuf->cbData,
+                            pPipe->cImagesToRead, pPipe->fBlockwiseCopy);
+}
+
+/**
+ * Internal: Copies the content of one disk to another one applying optimizations
+ * to speed up the copy process if possible.
+ */
+static int vdCopyHelper(PVBOXHDD pDiskFrom, PVDIMAGE pImageFrom, PVBOXHDD pDiskTo,
+                        uint64_t cbSize, unsigned cImagesFromRead, unsigned cImagesToRead,
+                        bool fSuppressRedundantIo, bool fSkipZeroes, bool fPipeline,
+                        PVDINTERFACE pIfProgress, PVDINTERFACEPROGRESS pCbProgress,
+                        PVDINTERFACE pDstIfProgress, PVDINTERFACEPROGRESS pDstCbProgress)
+{
+    int rc = VINF_SUCCESS;
+    uint64_t uOffset = 0;
+    void *pvBuf = NULL;
+    bool fBlockwiseCopy = fSuppressRedundantIo || (cImagesFromRead > 0);
+    unsigned uProgressOld = 0;
+
+    LogFlowFunc(("pDiskFrom=%#p pImageFrom=%#p pDiskTo=%#p cbSize=%llu cImagesFromRead=%u cImagesToRead=%u fSuppressRedundantIo=%RTbool fSkipZeroes=%RTbool fPipeline=%RTbool pIfProgress=%#p pCbProgress=%#p pDstIfProgress=%#p pDstCbProgress=%#p\n",
+                 pDiskFrom, pImageFrom, pDiskTo, cbSize, cImagesFromRead, cImagesToRead, fSuppressRedundantIo, fSkipZeroes, fPipeline, pIfProgress, pCbProgress, pDstIfProgress, pDstCbProgress));
+
+    if (fPipeline)
+    {
+        PVDPIPE pPipe = (PVDPIPE)RTMemAllocZ(sizeof(VDPIPE));
+        if (!pPipe)
+            return VERR_NO_MEMORY;
 
-        if (rc != VERR_VD_BLOCK_FREE)
-        {
-            rc2 = vdThreadStartWrite(pDiskTo);
-            AssertRC(rc2);
-            fLockWriteTo = true;
+        pPipe->pfnRead         = vdCopyPipeRead;
+        pPipe->pfnWrite        = vdCopyPipeWrite;
+        pPipe->pDiskFrom       = pDiskFrom;
+        pPipe->pDiskTo         = pDiskTo;
+        pPipe->pImageFrom      = pImageFrom;
+        pPipe->cbSize          = cbSize;
+        pPipe->cImagesFromRead = cImagesFromRead;
+        pPipe->cImagesToRead   = cImagesToRead;
+        pPipe->fBlockwiseCopy  = fBlockwiseCopy;
+        pPipe->fSkipZeroes     = fSkipZeroes;
+
+        rc = vdPipeRun(pPipe, pIfProgress, pCbProgress, pDstIfProgress, pDstCbProgress);
+        RTMemFree(pPipe);
+        return rc;
+    }
 
-            /* Only do collapsed I/O if we are copying the data blockwise. */
-            rc = vdWriteHelperEx(pDiskTo, pDiskTo->pLast, NULL, uOffset, pvBuf,
-                                 cbThisRead, false /* fUpdateCache */,
-                                 fBlockwiseCopy ? cImagesToRead : 0);
-            if (RT_FAILURE(rc))
-                break;
+    /* Allocate tmp buffer. */
+    pvBuf = RTMemTmpAlloc(VD_MERGE_BUFFER_SIZE);
+    if (!pvBuf)
+        return rc;
 
-            rc2 = vdThreadFinishWrite(pDiskTo);
-            AssertRC(rc2);
-            fLockWriteTo = false;
-        }
-        else /* Don't propagate the error to the outside */
-            rc = VINF_SUCCESS;
+    do
+    {
+        size_t cbThisRead = RT_MIN(VD_MERGE_BUFFER_SIZE, cbSize - uOffset);
 
-        uOffset += cbThisRead;
-        cbRemaining -= cbThisRead;
+        rc = vdCopyReadChunk(pDiskFrom, pImageFrom, uOffset, pvBuf, &cbThisRead,
+                             cImagesFromRead, fBlockwiseCopy);
+        if (RT_FAILURE(rc) && rc != VERR_VD_BLOCK_FREE)
+            break;
 
-        unsigned uProgressNew = uOffset * 99 / cbSize;
-        if (uProgressNew != uProgressOld)
+        if (rc != VERR_VD_BLOCK_FREE)
         {
-            uProgressOld = uProgressNew;
-
-            if (pCbProgress && pCbProgress->pfnProgress)
-            {
-                rc = pCbProgress->pfnProgress(pIfProgress->pvUser,
-                                              uProgressOld);
-                if (RT_FAILURE(rc))
-                    break;
-            }
-            if (pDstCbProgress && pDstCbProgress->pfnProgress)
+            if (   !fSkipZeroes
+                || !RTMemIsZero(pvBuf, cbThisRead))
             {
-                rc = pDstCbProgress->pfnProgress(pDstIfProgress->pvUser,
-                                                 uProgressOld);
+                rc = vdCopyWriteChunk(pDiskTo, uOffset, pvBuf, cbThisRead,
+                                      cImagesToRead, fBlockwiseCopy);
                 if (RT_FAILURE(rc))
                     break;
             }
         }
-    } while (uOffset < cbSize);
+        else /* Don't propagate the error to the outside */
+            rc = VINF_SUCCESS;
 
-    RTMemFree(pvBuf);
+        uOffset += cbThisRead;
 
-    if (fLockReadFrom)
-    {
-        rc2 = vdThreadFinishRead(pDiskFrom);
-        AssertRC(rc2);
-    }
+        rc = vdReportProgress(uOffset, cbSize, &uProgressOld, pIfProgress, pCbProgress,
+                              pDstIfProgress, pDstCbProgress);
+        if (RT_FAILURE(rc))
+            break;
+    } while (uOffset < cbSize);
 
-    if (fLockWriteTo)
-    {
-        rc2 = vdThreadFinishWrite(pDiskTo);
-        AssertRC(rc2);
-    }
+    RTMemFree(pvBuf);
 
     LogFlowFunc(("returns rc=%Rrc\n", rc));
     return rc;
@@ -2232,7 +3549,20 @@ static int vdWriteHelperAsync(PVDIOCTX pIoCtx)
                                             cbThisWrite, pIoCtx,
                                             &cbThisWrite, &cbPreRead,
                                             &cbPostRead, fWrite);
-        if (rc == VERR_VD_BLOCK_FREE)
+        if (   rc == VERR_VD_BLOCK_FREE
+            && (pImage->uOpenFlags & VD_OPEN_FLAGS_SKIP_ZEROES)
+            && !pImage->pPrev
+            && RTSgBufIsZero(&pIoCtx->SgBuf, cbThisWrite))
+        {
+            /* Unallocated blocks of a base image read as zeroes, nothing
+             * would change. Diff images take the normal path as checking
+             * the parents would need another round of async reads. */
+            RTSgBufAdvance(&pIoCtx->SgBuf, cbThisWrite);
+            Assert(pIoCtx->cbTransferLeft >= cbThisWrite);
+            ASMAtomicSubU32(&pIoCtx->cbTransferLeft, cbThisWrite);
+            rc = VINF_SUCCESS;
+        }
+        else if (rc == VERR_VD_BLOCK_FREE)
         {
             /* Lock the disk .*/
             rc = vdIoCtxLockDisk(pDisk, pIoCtx);
@@ -2363,6 +3693,40 @@ static int vdFlushHelperAsync(PVDIOCTX pIoCtx)
     return rc;
 }
 
+/**
+ * Discard helper async version.
+ */
+static int vdDiscardHelperAsync(PVDIOCTX pIoCtx)
+{
+    int rc = VINF_SUCCESS;
+    PVBOXHDD pDisk = pIoCtx->pDisk;
+
+    rc = vdIoCtxLockDisk(pDisk, pIoCtx);
+    if (RT_FAILURE(rc)) /* Deferred until the disk is unlocked. */
+        return rc;
+
+    /* The modification UUID is updated with the next flush. */
+    pDisk->uModified |= VD_IMAGE_MODIFIED_FLAG;
+
+    while (   pIoCtx->Type.Root.idxRange < pIoCtx->Type.Root.cRanges
+           && RT_SUCCESS(rc))
+    {
+        PCRTRANGE pRange = &pIoCtx->Type.Root.paRanges[pIoCtx->Type.Root.idxRange];
+
+        rc = vdDiscardHelper(pDisk, pIoCtx, pRange->offStart, pRange->cbRange);
+        if (rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+            rc = VINF_SUCCESS;
+        pIoCtx->Type.Root.idxRange++;
+    }
+
+    /* Without pending metadata updates the request is done here,
+     * otherwise the disk is unlocked when the request completes. */
+    if (!pIoCtx->cMetaTransfersPending)
+        vdIoCtxUnlockDisk(pDisk, pIoCtx, true /* fProcessDeferredReqs */);
+
+    return rc;
+}
+
 /**
  * internal: scans plugin directory and loads the backends have been found.
  */
@@ -2873,7 +4237,8 @@ static int vdIoCtxContinue(PVDIOCTX pIoCtx, int rcReq)
             {
                 RTCritSectLeave(&pDisk->CritSect);
 
-                if (pIoCtx->enmTxDir == VDIOCTXTXDIR_FLUSH)
+                if (   pIoCtx->enmTxDir == VDIOCTXTXDIR_FLUSH
+                    || pIoCtx->enmTxDir == VDIOCTXTXDIR_DISCARD)
                 {
                     vdIoCtxUnlockDisk(pDisk, pIoCtx, true /* fProcessDerredReqs */);
                     vdThreadFinishWrite(pDisk);
@@ -4100,6 +5465,22 @@ VBOXDDU_DECL(int) VDCreate(PVDINTERFACE pVDIfsDisk, VDTYPE enmType, PVBOXHDD *pp
                 break;
             }
 
+            /* Create the critical section for the chain index. */
+            rc = RTCritSectInit(&pDisk->CritSectChainIdx);
+            if (RT_FAILURE(rc))
+            {
+                RTCritSectDelete(&pDisk->CritSect);
+                RTMemCacheDestroy(pDisk->hMemCacheIoCtx);
+                RTMemCacheDestroy(pDisk->hMemCacheIoTask);
+                RTMemFree(pDisk);
+                break;
+            }
+            pDisk->fChainIdx        = false;
+            pDisk->TreeChainIdx     = NULL;
+            pDisk->pDiscard         = NULL;
+            pDisk->cChainIdxExtents = 0;
+            pDisk->uChainIdxGen     = 0;
+
             pDisk->pInterfaceError = VDInterfaceGet(pVDIfsDisk, VDINTERFACETYPE_ERROR);
             if (pDisk->pInterfaceError)
                 pDisk->pInterfaceErrorCallbacks = VDGetInterfaceError(pDisk->pInterfaceError);
@@ -4184,6 +5565,9 @@ VBOXDDU_DECL(void) VDDestroy(PVBOXHDD pDisk)
         AssertPtrBreak(pDisk);
         AssertMsg(pDisk->u32Signature == VBOXHDDDISK_SIGNATURE, ("u32Signature=%08x\n", pDisk->u32Signature));
         VDCloseAll(pDisk);
+        vdChainIdxClear(pDisk);
+        vdDiscardStateDestroy(pDisk);
+        RTCritSectDelete(&pDisk->CritSectChainIdx);
         RTCritSectDelete(&pDisk->CritSect);
         RTMemCacheDestroy(pDisk->hMemCacheIoCtx);
         RTMemCacheDestroy(pDisk->hMemCacheIoTask);
@@ -4455,9 +5839,11 @@ VBOXDDU_DECL(int) VDOpen(PVBOXHDD pDisk, const char *pszBackend,
                             &pDisk->VDIIOIntCallbacks, &pImage->VDIo, &pImage->pVDIfsImage);
         AssertRC(rc);
 
-        pImage->uOpenFlags = uOpenFlags & (VD_OPEN_FLAGS_HONOR_SAME | VD_OPEN_FLAGS_IGNORE_FLUSH);
+        pImage->uOpenFlags = uOpenFlags & (VD_OPEN_FLAGS_HONOR_SAME | VD_OPEN_FLAGS_IGNORE_FLUSH | VD_OPEN_FLAGS_SKIP_ZEROES);
+        if (uOpenFlags & VD_OPEN_FLAGS_HONOR_ZEROES)
+            pImage->uOpenFlags &= ~VD_OPEN_FLAGS_SKIP_ZEROES;
         rc = pImage->Backend->pfnOpen(pImage->pszFilename,
-                                      uOpenFlags & ~(VD_OPEN_FLAGS_HONOR_SAME | VD_OPEN_FLAGS_IGNORE_FLUSH),
+                                      uOpenFlags & ~(VD_OPEN_FLAGS_HONOR_SAME | VD_OPEN_FLAGS_IGNORE_FLUSH | VD_OPEN_FLAGS_SKIP_ZEROES),
                                       pDisk->pVDIfsDisk,
                                       pImage->pVDIfsImage,
                                       pDisk->enmType,
@@ -4472,7 +5858,7 @@ VBOXDDU_DECL(int) VDOpen(PVBOXHDD pDisk, const char *pszBackend,
                      || rc == VERR_SHARING_VIOLATION
                      || rc == VERR_FILE_LOCK_FAILED))
                 rc = pImage->Backend->pfnOpen(pImage->pszFilename,
-                                                (uOpenFlags & ~VD_OPEN_FLAGS_HONOR_SAME)
+                                                (uOpenFlags & ~(VD_OPEN_FLAGS_HONOR_SAME | VD_OPEN_FLAGS_SKIP_ZEROES))
                                                | VD_OPEN_FLAGS_READONLY,
                                                pDisk->pVDIfsDisk,
                                                pImage->pVDIfsImage,
@@ -4664,6 +6050,11 @@ VBOXDDU_DECL(int) VDCacheOpen(PVBOXHDD pDisk, const char *pszBackend,
         AssertMsgBreakStmt((uOpenFlags & ~VD_OPEN_FLAGS_MASK) == 0,
                            ("uOpenFlags=%#x\n", uOpenFlags),
                            rc = VERR_INVALID_PARAMETER);
+        /* Write-back needs a writable cache and works with synchronous I/O only. */
+        AssertMsgBreakStmt(   !(uOpenFlags & VD_OPEN_FLAGS_CACHE_WRITEBACK)
+                           || !(uOpenFlags & (VD_OPEN_FLAGS_READONLY | VD_OPEN_FLAGS_ASYNC_IO)),
+                           ("uOpenFlags=%#x\n", uOpenFlags),
+                           rc = VERR_INVALID_PARAMETER);
 
         /* Set up image descriptor. */
         pCache = (PVDCACHE)RTMemAllocZ(sizeof(VDCACHE));
@@ -4691,6 +6082,16 @@ VBOXDDU_DECL(int) VDCacheOpen(PVBOXHDD pDisk, const char *pszBackend,
                          N_("VD: unknown backend name '%s'"), pszBackend);
             break;
         }
+        if (   (uOpenFlags & VD_OPEN_FLAGS_CACHE_WRITEBACK)
+            && (   !pCache->Backend->pfnWriteDirty
+                || !pCache->Backend->pfnQueryDirty
+                || !pCache->Backend->pfnMarkClean
+                || !pCache->Backend->pfnDiscard))
+        {
+            rc = vdError(pDisk, VERR_NOT_SUPPORTED, RT_SRC_POS,
+                         N_("VD: cache backend '%s' doesn't support write-back mode"), pszBackend);
+            break;
+        }
 
         /* Set up the I/O interface. */
         pCache->VDIo.pInterfaceIO = VDInterfaceGet(pVDIfsCache, VDINTERFACETYPE_IO);
@@ -4711,9 +6112,9 @@ VBOXDDU_DECL(int) VDCacheOpen(PVBOXHDD pDisk, const char *pszBackend,
                             &pDisk->VDIIOIntCallbacks, &pCache->VDIo, &pCache->pVDIfsCache);
         AssertRC(rc);
 
-        pCache->uOpenFlags = uOpenFlags & VD_OPEN_FLAGS_HONOR_SAME;
+        pCache->uOpenFlags = uOpenFlags & (VD_OPEN_FLAGS_HONOR_SAME | VD_OPEN_FLAGS_CACHE_WRITEBACK);
         rc = pCache->Backend->pfnOpen(pCache->pszFilename,
-                                      uOpenFlags & ~VD_OPEN_FLAGS_HONOR_SAME,
+                                      uOpenFlags & ~(VD_OPEN_FLAGS_HONOR_SAME | VD_OPEN_FLAGS_CACHE_WRITEBACK),
                                       pDisk->pVDIfsDisk,
                                       pCache->pVDIfsCache,
                                       &pCache->pBackendData);
@@ -4726,12 +6127,16 @@ VBOXDDU_DECL(int) VDCacheOpen(PVBOXHDD pDisk, const char *pszBackend,
                      || rc == VERR_WRITE_PROTECT
                      || rc == VERR_SHARING_VIOLATION
                      || rc == VERR_FILE_LOCK_FAILED))
+            {
                 rc = pCache->Backend->pfnOpen(pCache->pszFilename,
-                                                (uOpenFlags & ~VD_OPEN_FLAGS_HONOR_SAME)
+                                                (uOpenFlags & ~(VD_OPEN_FLAGS_HONOR_SAME | VD_OPEN_FLAGS_CACHE_WRITEBACK))
                                                | VD_OPEN_FLAGS_READONLY,
                                                pDisk->pVDIfsDisk,
                                                pCache->pVDIfsCache,
                                                &pCache->pBackendData);
+                /* A read-only cache can't take dirty data. */
+                pCache->uOpenFlags &= ~VD_OPEN_FLAGS_CACHE_WRITEBACK;
+            }
             if (RT_FAILURE(rc))
             {
                 rc = vdError(pDisk, rc, RT_SRC_POS,
@@ -4740,11 +6145,24 @@ VBOXDDU_DECL(int) VDCacheOpen(PVBOXHDD pDisk, const char *pszBackend,
             }
         }
 
+        pCache->VDIo.pBackendData = pCache->pBackendData;
+
         /* Lock disk for writing, as we modify pDisk information below. */
         rc2 = vdThreadStartWrite(pDisk);
         AssertRC(rc2);
         fLockWrite = true;
 
+        /* Check whether the cache holds data which is not in the image yet. */
+        bool fDirty = false;
+        if (pCache->Backend->pfnQueryDirty)
+        {
+            uint64_t uOffsetDirty = 0;
+            size_t cbDirty = 0;
+
+            fDirty = RT_SUCCESS(pCache->Backend->pfnQueryDirty(pCache->pBackendData, 0,
+                                                               &uOffsetDirty, &cbDirty));
+        }
+
         /*
          * Check that the modification UUID of the cache and last image
          * match. If not the image was modified in-between without the cache.
@@ -4761,7 +6179,20 @@ VBOXDDU_DECL(int) VDCacheOpen(PVBOXHDD pDisk, const char *pszBackend,
             if (RT_SUCCESS(rc))
             {
                 if (RTUuidCompare(&UuidImage, &UuidCache))
-                    rc = VERR_VD_CACHE_NOT_UP_TO_DATE;
+                {
+                    /* The UUIDs are updated one after the other, a crash in
+                     * between leaves them different. Dirty data in the cache is
+                     * newer than the image in any case. */
+                    if (fDirty)
+                    {
+                        LogRel(("VD: Cache '%s' is not up to date but holds data which is not in the image, keeping it\n",
+                                pszFilename));
+                        rc = pCache->Backend->pfnSetModificationUuid(pCache->pBackendData,
+                                                                     &UuidImage);
+                    }
+                    else
+                        rc = VERR_VD_CACHE_NOT_UP_TO_DATE;
+                }
             }
         }
 
@@ -4781,6 +6212,21 @@ VBOXDDU_DECL(int) VDCacheOpen(PVBOXHDD pDisk, const char *pszBackend,
                 rc = VERR_VD_CACHE_ALREADY_EXISTS;
         }
 
+        /* A cache which is not opened in write-back mode must not keep
+         * dirty data. */
+        if (   RT_SUCCESS(rc)
+            && fDirty
+            && !vdCacheIsWriteBack(pDisk))
+        {
+            rc = vdCacheWriteBack(pDisk, UINT64_MAX);
+            if (RT_FAILURE(rc))
+            {
+                pDisk->pCache = NULL;
+                rc = vdError(pDisk, rc, RT_SRC_POS,
+                             N_("VD: error %Rrc writing back the data of cache '%s'"), rc, pszFilename);
+            }
+        }
+
         if (RT_FAILURE(rc))
         {
             /* Error detected, but image opened. Close image. */
@@ -4977,12 +6423,14 @@ VBOXDDU_DECL(int) VDCreateBase(PVBOXHDD pDisk, const char *pszBackend,
             pUuid = &uuid;
         }
 
-        pImage->uOpenFlags = uOpenFlags & VD_OPEN_FLAGS_HONOR_SAME;
+        pImage->uOpenFlags = uOpenFlags & (VD_OPEN_FLAGS_HONOR_SAME | VD_OPEN_FLAGS_SKIP_ZEROES);
+        if (uOpenFlags & VD_OPEN_FLAGS_HONOR_ZEROES)
+            pImage->uOpenFlags &= ~VD_OPEN_FLAGS_SKIP_ZEROES;
         uImageFlags &= ~VD_IMAGE_FLAGS_DIFF;
         rc = pImage->Backend->pfnCreate(pImage->pszFilename, cbSize,
                                         uImageFlags, pszComment, pPCHSGeometry,
                                         pLCHSGeometry, pUuid,
-                                        uOpenFlags & ~VD_OPEN_FLAGS_HONOR_SAME,
+                                        uOpenFlags & ~(VD_OPEN_FLAGS_HONOR_SAME | VD_OPEN_FLAGS_SKIP_ZEROES),
                                         0, 99,
                                         pDisk->pVDIfsDisk,
                                         pImage->pVDIfsImage,
@@ -5244,13 +6692,15 @@ VBOXDDU_DECL(int) VDCreateDiff(PVBOXHDD pDisk, const char *pszBackend,
             pUuid = &uuid;
         }
 
-        pImage->uOpenFlags = uOpenFlags & VD_OPEN_FLAGS_HONOR_SAME;
+        pImage->uOpenFlags = uOpenFlags & (VD_OPEN_FLAGS_HONOR_SAME | VD_OPEN_FLAGS_SKIP_ZEROES);
+        if (uOpenFlags & VD_OPEN_FLAGS_HONOR_ZEROES)
+            pImage->uOpenFlags &= ~VD_OPEN_FLAGS_SKIP_ZEROES;
         uImageFlags |= VD_IMAGE_FLAGS_DIFF;
         rc = pImage->Backend->pfnCreate(pImage->pszFilename, pDisk->cbSize,
                                         uImageFlags | VD_IMAGE_FLAGS_DIFF,
                                         pszComment, &pDisk->PCHSGeometry,
                                         &pDisk->LCHSGeometry, pUuid,
-                                        uOpenFlags & ~VD_OPEN_FLAGS_HONOR_SAME,
+                                        uOpenFlags & ~(VD_OPEN_FLAGS_HONOR_SAME | VD_OPEN_FLAGS_SKIP_ZEROES),
                                         0, 99,
                                         pDisk->pVDIfsDisk,
                                         pImage->pVDIfsImage,
@@ -5426,6 +6876,11 @@ VBOXDDU_DECL(int) VDCreateCache(PVBOXHDD pDisk, const char *pszBackend,
         AssertMsgBreakStmt((uOpenFlags & ~VD_OPEN_FLAGS_MASK) == 0,
                            ("uOpenFlags=%#x\n", uOpenFlags),
                            rc = VERR_INVALID_PARAMETER);
+        /* Write-back needs a writable cache and works with synchronous I/O only. */
+        AssertMsgBreakStmt(   !(uOpenFlags & VD_OPEN_FLAGS_CACHE_WRITEBACK)
+                           || !(uOpenFlags & (VD_OPEN_FLAGS_READONLY | VD_OPEN_FLAGS_ASYNC_IO)),
+                           ("uOpenFlags=%#x\n", uOpenFlags),
+                           rc = VERR_INVALID_PARAMETER);
 
         /* Check state. Needs a temporary read lock. Holding the write lock
          * all the time would be blocking other activities for too long. */
@@ -5462,6 +6917,16 @@ VBOXDDU_DECL(int) VDCreateCache(PVBOXHDD pDisk, const char *pszBackend,
                          N_("VD: unknown backend name '%s'"), pszBackend);
             break;
         }
+        if (   (uOpenFlags & VD_OPEN_FLAGS_CACHE_WRITEBACK)
+            && (   !pCache->Backend->pfnWriteDirty
+                || !pCache->Backend->pfnQueryDirty
+                || !pCache->Backend->pfnMarkClean
+                || !pCache->Backend->pfnDiscard))
+        {
+            rc = vdError(pDisk, VERR_NOT_SUPPORTED, RT_SRC_POS,
+                         N_("VD: cache backend '%s' doesn't support write-back mode"), pszBackend);
+            break;
+        }
 
         pCache->VDIo.pDisk        = pDisk;
         pCache->pVDIfsCache       = pVDIfsCache;
@@ -5499,11 +6964,11 @@ VBOXDDU_DECL(int) VDCreateCache(PVBOXHDD pDisk, const char *pszBackend,
             pUuid = &uuid;
         }
 
-        pCache->uOpenFlags = uOpenFlags & VD_OPEN_FLAGS_HONOR_SAME;
+        pCache->uOpenFlags = uOpenFlags & (VD_OPEN_FLAGS_HONOR_SAME | VD_OPEN_FLAGS_CACHE_WRITEBACK);
         rc = pCache->Backend->pfnCreate(pCache->pszFilename, cbSize,
                                         uImageFlags,
                                         pszComment, pUuid,
-                                        uOpenFlags & ~VD_OPEN_FLAGS_HONOR_SAME,
+                                        uOpenFlags & ~(VD_OPEN_FLAGS_HONOR_SAME | VD_OPEN_FLAGS_CACHE_WRITEBACK),
                                         0, 99,
                                         pDisk->pVDIfsDisk,
                                         pCache->pVDIfsCache,
@@ -5587,12 +7052,156 @@ VBOXDDU_DECL(int) VDCreateCache(PVBOXHDD pDisk, const char *pszBackend,
     return rc;
 }
 
+/**
+ * Internal: Reads the data to merge for the given range. The caller must hold
+ * the write lock, the backends don't serialize concurrent reads themselves.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_BLOCK_FREE if there is nothing to merge for the range.
+ * @param   pPipe       The merge pipeline state.
+ * @param   uOffset     Offset to start reading from.
+ * @param   pvBuf       Where to store the data.
+ * @param   pcbRead     On input the maximum number of bytes to read,
+ *                      on output the number of bytes the chunk consists of.
+ */
+static int vdMergeReadChunk(PVDPIPE pPipe, uint64_t uOffset, void *pvBuf, size_t *pcbRead)
+{
+    PVDIMAGE pImageFrom = pPipe->pImageFrom;
+    PVDIMAGE pImageTo = pPipe->pImageTo;
+    size_t cbThisRead = *pcbRead;
+    int rc;
+
+    /* Search for image with allocated block. Do not attempt to read more
+     * than the previous reads marked as valid. Otherwise this would return
+     * stale data when different block sizes are used for the images. */
+    if (pPipe->fMergeIntoChild)
+    {
+        /* Only blocks not allocated in the destination are written. */
+        rc = pImageTo->Backend->pfnRead(pImageTo->pBackendData, uOffset, pvBuf,
+                                        cbThisRead, &cbThisRead);
+        if (rc == VERR_VD_BLOCK_FREE)
+        {
+            for (PVDIMAGE pCurrImage = pImageTo->pPrev;
+                 pCurrImage != NULL && pCurrImage != pImageFrom->pPrev && rc == VERR_VD_BLOCK_FREE;
+                 pCurrImage = pCurrImage->pPrev)
+            {
+                rc = pCurrImage->Backend->pfnRead(pCurrImage->pBackendData,
+                                                  uOffset, pvBuf, cbThisRead,
+                                                  &cbThisRead);
+            }
+        }
+        else if (RT_SUCCESS(rc))
+            rc = VERR_VD_BLOCK_FREE;
+    }
+    else
+    {
+        rc = VERR_VD_BLOCK_FREE;
+        for (PVDIMAGE pCurrImage = pImageFrom;
+             pCurrImage != NULL && pCurrImage != pImageTo && rc == VERR_VD_BLOCK_FREE;
+             pCurrImage = pCurrImage->pPrev)
+        {
+            rc = pCurrImage->Backend->pfnRead(pCurrImage->pBackendData,
+                                              uOffset, pvBuf,
+                                              cbThisRead, &cbThisRead);
+        }
+    }
+
+    *pcbRead = cbThisRead;
+    return rc;
+}
+
+/**
+ * Internal: Writes merged data to the destination image. The caller must hold
+ * the write lock.
+ */
+static int vdMergeWriteChunk(PVDPIPE pPipe, uint64_t uOffset, const void *pvBuf, size_t cbWrite)
+{
+    /* Updating the cache is required because this might be a live merge. */
+    if (pPipe->fMergeIntoChild)
+        return vdWriteHelperEx(pPipe->pDiskTo, pPipe->pImageTo, pPipe->pImageFrom->pPrev,
+                               uOffset, pvBuf, cbWrite, true /* fUpdateCache */, 0);
+    return vdWriteHelper(pPipe->pDiskTo, pPipe->pImageTo, uOffset, pvBuf,
+                         cbWrite, true /* fUpdateCache */);
+}
+
+/**
+ * Internal: Pipeline read callback for merging.
+ *
+ * Takes the write lock because the reader thread would otherwise race with
+ * reads from the outside on the backend state (grain table caches etc.).
+ */
+static DECLCALLBACK(int) vdMergePipeRead(PVDPIPE pPipe, PVDPIPEBUF pBuf)
+{
+    PVBOXHDD pDisk = pPipe->pDiskFrom;
+    int rc, rc2;
+
+    rc2 = vdThreadStartWrite(pDisk);
+    AssertRC(rc2);
+
+    pBuf->uWriteGen = pDisk->uWriteGen;
+    rc = vdMergeReadChunk(pPipe, pBuf->uOffset, pBuf->pvBuf, &pBuf->cbData);
+
+    rc2 = vdThreadFinishWrite(pDisk);
+    AssertRC(rc2);
+
+    return rc;
+}
+
+/**
+ * Internal: Pipeline write callback for merging.
+ *
+ * If the disk was written since the data was read ahead the range is read
+ * again while holding the write lock, the data in the buffer might be stale.
+ */
+static DECLCALLBACK(int) vdMergePipeWrite(PVDPIPE pPipe, PVDPIPEBUF pBuf)
+{
+    PVBOXHDD pDisk = pPipe->pDiskTo;
+    int rc = VINF_SUCCESS;
+    int rc2;
+
+    rc2 = vdThreadStartWrite(pDisk);
+    AssertRC(rc2);
+
+    if (pBuf->uWriteGen == pDisk->uWriteGen)
+        rc = vdMergeWriteChunk(pPipe, pBuf->uOffset, pBuf->pvBuf, pBuf->cbData);
+    else
+    {
+        uint64_t uOffset = pBuf->uOffset;
+        size_t cbLeft = pBuf->cbData;
+
+        while (cbLeft)
+        {
+            size_t cbThisRead = cbLeft;
+
+            rc = vdMergeReadChunk(pPipe, uOffset, pBuf->pvBuf, &cbThisRead);
+            if (RT_SUCCESS(rc))
+                rc = vdMergeWriteChunk(pPipe, uOffset, pBuf->pvBuf, cbThisRead);
+            else if (rc == VERR_VD_BLOCK_FREE)
+                rc = VINF_SUCCESS;
+            if (RT_FAILURE(rc))
+                break;
+
+            uOffset += cbThisRead;
+            cbLeft  -= cbThisRead;
+        }
+    }
+
+    rc2 = vdThreadFinishWrite(pDisk);
+    AssertRC(rc2);
+
+    return rc;
+}
+
 /**
  * Merges two images (not necessarily with direct parent/child relationship).
  * As a side effect the source image and potentially the other images which
  * are also merged to the destination are deleted from both the disk and the
  * images in the HDD container.
  *
+ * The data to merge is read ahead on a separate thread. The container is
+ * locked for writing for each chunk read or written but not in between, so
+ * I/O from the outside can make progress during the merge.
+ *
  * @returns VBox status code.
  * @returns VERR_VD_IMAGE_NOT_FOUND if image with specified number was not opened.
  * @param   pDisk           Pointer to HDD container.
@@ -5606,7 +7215,8 @@ VBOXDDU_DECL(int) VDMerge(PVBOXHDD pDisk, unsigned nImageFrom,
     int rc = VINF_SUCCESS;
     int rc2;
     bool fLockWrite = false, fLockRead = false;
-    void *pvBuf = NULL;
+    PVDPIPE pPipe = NULL;
+    uint64_t u64MergeTS = RTTimeMilliTS();
 
     LogFlowFunc(("pDisk=%#p nImageFrom=%u nImageTo=%u pVDIfsOperation=%#p\n",
                  pDisk, nImageFrom, nImageTo, pVDIfsOperation));
@@ -5628,6 +7238,15 @@ VBOXDDU_DECL(int) VDMerge(PVBOXHDD pDisk, unsigned nImageFrom,
         rc2 = vdThreadStartWrite(pDisk);
         AssertRC(rc2);
         fLockWrite = true;
+
+        /* The images have to contain the data held back by the cache. */
+        if (vdCacheIsWriteBack(pDisk))
+        {
+            rc = vdCacheWriteBack(pDisk, UINT64_MAX);
+            if (RT_FAILURE(rc))
+                break;
+        }
+
         PVDIMAGE pImageFrom = vdGetImageByNumber(pDisk, nImageFrom);
         PVDIMAGE pImageTo = vdGetImageByNumber(pDisk, nImageTo);
         if (!pImageFrom || !pImageTo)
@@ -5654,14 +7273,24 @@ VBOXDDU_DECL(int) VDMerge(PVBOXHDD pDisk, unsigned nImageFrom,
         AssertRC(rc2);
         fLockWrite = false;
 
-        /* Allocate tmp buffer. */
-        pvBuf = RTMemTmpAlloc(VD_MERGE_BUFFER_SIZE);
-        if (!pvBuf)
+        pPipe = (PVDPIPE)RTMemAllocZ(sizeof(VDPIPE));
+        if (!pPipe)
         {
             rc = VERR_NO_MEMORY;
             break;
         }
 
+        /* The blocks to merge are read ahead on a separate thread, the write
+         * lock is only held while a single chunk is read or written. */
+        pPipe->pfnRead         = vdMergePipeRead;
+        pPipe->pfnWrite        = vdMergePipeWrite;
+        pPipe->pDiskFrom       = pDisk;
+        pPipe->pDiskTo         = pDisk;
+        pPipe->pImageFrom      = pImageFrom;
+        pPipe->pImageTo        = pImageTo;
+        pPipe->cbSize          = cbSize;
+        pPipe->fMergeIntoChild = nImageFrom < nImageTo;
+
         /* Merging is done directly on the images itself. This potentially
          * causes trouble if the disk is full in the middle of operation. */
         if (nImageFrom < nImageTo)
@@ -5669,71 +7298,7 @@ VBOXDDU_DECL(int) VDMerge(PVBOXHDD pDisk, unsigned nImageFrom,
             /* Merge parent state into child. This means writing all not
              * allocated blocks in the destination image which are allocated in
              * the images to be merged. */
-            uint64_t uOffset = 0;
-            uint64_t cbRemaining = cbSize;
-            do
-            {
-                size_t cbThisRead = RT_MIN(VD_MERGE_BUFFER_SIZE, cbRemaining);
-
-                /* Need to hold the write lock during a read-write operation. */
-                rc2 = vdThreadStartWrite(pDisk);
-                AssertRC(rc2);
-                fLockWrite = true;
-
-                rc = pImageTo->Backend->pfnRead(pImageTo->pBackendData,
-                                                uOffset, pvBuf, cbThisRead,
-                                                &cbThisRead);
-                if (rc == VERR_VD_BLOCK_FREE)
-                {
-                    /* Search for image with allocated block. Do not attempt to
-                     * read more than the previous reads marked as valid.
-                     * Otherwise this would return stale data when different
-                     * block sizes are used for the images. */
-                    for (PVDIMAGE pCurrImage = pImageTo->pPrev;
-                         pCurrImage != NULL && pCurrImage != pImageFrom->pPrev && rc == VERR_VD_BLOCK_FREE;
-                         pCurrImage = pCurrImage->pPrev)
-                    {
-                        rc = pCurrImage->Backend->pfnRead(pCurrImage->pBackendData,
-                                                          uOffset, pvBuf,
-                                                          cbThisRead,
-                                                          &cbThisRead);
-                    }
-
-                    if (rc != VERR_VD_BLOCK_FREE)
-                    {
-                        if (RT_FAILURE(rc))
-                            break;
-                        /* Updating the cache is required because this might be a live merge. */
-                        rc = vdWriteHelperEx(pDisk, pImageTo, pImageFrom->pPrev,
-                                             uOffset, pvBuf, cbThisRead,
-                                             true /* fUpdateCache */, 0);
-                        if (RT_FAILURE(rc))
-                            break;
-                    }
-                    else
-                        rc = VINF_SUCCESS;
-                }
-                else if (RT_FAILURE(rc))
-                    break;
-
-                rc2 = vdThreadFinishWrite(pDisk);
-                AssertRC(rc2);
-                fLockWrite = false;
-
-                uOffset += cbThisRead;
-                cbRemaining -= cbThisRead;
-
-                if (pCbProgress && pCbProgress->pfnProgress)
-                {
-                    /** @todo r=klaus: this can update the progress to the same
-                     * percentage over and over again if the image format makes
-                     * relatively small increments. */
-                    rc = pCbProgress->pfnProgress(pIfProgress->pvUser,
-                                                  uOffset * 99 / cbSize);
-                    if (RT_FAILURE(rc))
-                        break;
-                }
-            } while (uOffset < cbSize);
+            rc = vdPipeRun(pPipe, pIfProgress, pCbProgress, NULL, NULL);
         }
         else
         {
@@ -5790,61 +7355,7 @@ VBOXDDU_DECL(int) VDMerge(PVBOXHDD pDisk, unsigned nImageFrom,
             /* Merge child state into parent. This means writing all blocks
              * which are allocated in the image up to the source image to the
              * destination image. */
-            uint64_t uOffset = 0;
-            uint64_t cbRemaining = cbSize;
-            do
-            {
-                size_t cbThisRead = RT_MIN(VD_MERGE_BUFFER_SIZE, cbRemaining);
-                rc = VERR_VD_BLOCK_FREE;
-
-                /* Need to hold the write lock during a read-write operation. */
-                rc2 = vdThreadStartWrite(pDisk);
-                AssertRC(rc2);
-                fLockWrite = true;
-
-                /* Search for image with allocated block. Do not attempt to
-                 * read more than the previous reads marked as valid. Otherwise
-                 * this would return stale data when different block sizes are
-                 * used for the images. */
-                for (PVDIMAGE pCurrImage = pImageFrom;
-                     pCurrImage != NULL && pCurrImage != pImageTo && rc == VERR_VD_BLOCK_FREE;
-                     pCurrImage = pCurrImage->pPrev)
-                {
-                    rc = pCurrImage->Backend->pfnRead(pCurrImage->pBackendData,
-                                                      uOffset, pvBuf,
-                                                      cbThisRead, &cbThisRead);
-                }
-
-                if (rc != VERR_VD_BLOCK_FREE)
-                {
-                    if (RT_FAILURE(rc))
-                        break;
-                    rc = vdWriteHelper(pDisk, pImageTo, uOffset, pvBuf,
-                                       cbThisRead, true /* fUpdateCache */);
-                    if (RT_FAILURE(rc))
-                        break;
-                }
-                else
-                    rc = VINF_SUCCESS;
-
-                rc2 = vdThreadFinishWrite(pDisk);
-                AssertRC(rc2);
-                fLockWrite = false;
-
-                uOffset += cbThisRead;
-                cbRemaining -= cbThisRead;
-
-                if (pCbProgress && pCbProgress->pfnProgress)
-                {
-                    /** @todo r=klaus: this can update the progress to the same
-                     * percentage over and over again if the image format makes
-                     * relatively small increments. */
-                    rc = pCbProgress->pfnProgress(pIfProgress->pvUser,
-                                                  uOffset * 99 / cbSize);
-                    if (RT_FAILURE(rc))
-                        break;
-                }
-            } while (uOffset < cbSize);
+            rc = vdPipeRun(pPipe, pIfProgress, pCbProgress, NULL, NULL);
 
             /* In case we set up a "write proxy" image above we must clear
              * this again now to prevent stray writes. Failure or not. */
@@ -5870,6 +7381,11 @@ VBOXDDU_DECL(int) VDMerge(PVBOXHDD pDisk, unsigned nImageFrom,
         if (RT_FAILURE(rc))
             break;
 
+        u64MergeTS = RTTimeMilliTS() - u64MergeTS;
+        LogRel(("VD: Merged %llu MB from '%s' into '%s' in %llu ms (%llu KB/s)\n",
+                cbSize / _1M, pImageFrom->pszFilename, pImageTo->pszFilename, u64MergeTS,
+                u64MergeTS ? cbSize / _1K * 1000 / u64MergeTS : 0));
+
         /* Need to hold the write lock while finishing the merge. */
         rc2 = vdThreadStartWrite(pDisk);
         AssertRC(rc2);
@@ -5964,8 +7480,8 @@ VBOXDDU_DECL(int) VDMerge(PVBOXHDD pDisk, unsigned nImageFrom,
         AssertRC(rc2);
     }
 
-    if (pvBuf)
-        RTMemTmpFree(pvBuf);
+    if (pPipe)
+        RTMemFree(pPipe);
 
     if (RT_SUCCESS(rc) && pCbProgress && pCbProgress->pfnProgress)
         pCbProgress->pfnProgress(pIfProgress->pvUser, 100);
@@ -6007,6 +7523,7 @@ VBOXDDU_DECL(int) VDMerge(PVBOXHDD pDisk, unsigned nImageFrom,
  *                          In all rename/move cases or copy to existing image cases the modification UUIDs are copied over.
  * @param   uOpenFlags      Image file open mode, see VD_OPEN_FLAGS_* constants.
  *                          Only used if the destination image is created.
+ * @param   uCopyFlags      Copy options, see VD_COPY_FLAGS_* constants.
  * @param   pVDIfsOperation Pointer to the per-operation VD interface list.
  * @param   pDstVDIfsImage  Pointer to the per-image VD interface list, for the
  *                          destination image.
@@ -6018,7 +7535,8 @@ VBOXDDU_DECL(int) VDCopyEx(PVBOXHDD pDiskFrom, unsigned nImage, PVBOXHDD pDiskTo
                            bool fMoveByRename, uint64_t cbSize,
                            unsigned nImageFromSame, unsigned nImageToSame,
                            unsigned uImageFlags, PCRTUUID pDstUuid,
-                           unsigned uOpenFlags, PVDINTERFACE pVDIfsOperation,
+                           unsigned uOpenFlags, unsigned uCopyFlags,
+                           PVDINTERFACE pVDIfsOperation,
                            PVDINTERFACE pDstVDIfsImage,
                            PVDINTERFACE pDstVDIfsOperation)
 {
@@ -6027,8 +7545,8 @@ VBOXDDU_DECL(int) VDCopyEx(PVBOXHDD pDiskFrom, unsigned nImage, PVBOXHDD pDiskTo
     bool fLockReadFrom = false, fLockWriteFrom = false, fLockWriteTo = false;
     PVDIMAGE pImageTo = NULL;
 
-    LogFlowFunc(("pDiskFrom=%#p nImage=%u pDiskTo=%#p pszBackend=\"%s\" pszFilename=\"%s\" fMoveByRename=%d cbSize=%llu nImageFromSame=%u nImageToSame=%u uImageFlags=%#x pDstUuid=%#p uOpenFlags=%#x pVDIfsOperation=%#p pDstVDIfsImage=%#p pDstVDIfsOperation=%#p\n",
-                 pDiskFrom, nImage, pDiskTo, pszBackend, pszFilename, fMoveByRename, cbSize, nImageFromSame, nImageToSame, uImageFlags, pDstUuid, uOpenFlags, pVDIfsOperation, pDstVDIfsImage, pDstVDIfsOperation));
+    LogFlowFunc(("pDiskFrom=%#p nImage=%u pDiskTo=%#p pszBackend=\"%s\" pszFilename=\"%s\" fMoveByRename=%d cbSize=%llu nImageFromSame=%u nImageToSame=%u uImageFlags=%#x pDstUuid=%#p uOpenFlags=%#x uCopyFlags=%#x pVDIfsOperation=%#p pDstVDIfsImage=%#p pDstVDIfsOperation=%#p\n",
+                 pDiskFrom, nImage, pDiskTo, pszBackend, pszFilename, fMoveByRename, cbSize, nImageFromSame, nImageToSame, uImageFlags, pDstUuid, uOpenFlags, uCopyFlags, pVDIfsOperation, pDstVDIfsImage, pDstVDIfsOperation));
 
     PVDINTERFACE pIfProgress = VDInterfaceGet(pVDIfsOperation,
                                               VDINTERFACETYPE_PROGRESS);
@@ -6049,6 +7567,10 @@ VBOXDDU_DECL(int) VDCopyEx(PVBOXHDD pDiskFrom, unsigned nImage, PVBOXHDD pDiskTo
         AssertMsg(pDiskFrom->u32Signature == VBOXHDDDISK_SIGNATURE,
                   ("u32Signature=%08x\n", pDiskFrom->u32Signature));
 
+        rc = vdCacheWriteBackAll(pDiskFrom);
+        if (RT_FAILURE(rc))
+            break;
+
         rc2 = vdThreadStartRead(pDiskFrom);
         AssertRC(rc2);
         fLockReadFrom = true;
@@ -6064,6 +7586,9 @@ VBOXDDU_DECL(int) VDCopyEx(PVBOXHDD pDiskFrom, unsigned nImage, PVBOXHDD pDiskTo
                                || (nImageFromSame != VD_IMAGE_CONTENT_UNKNOWN && nImageToSame != VD_IMAGE_CONTENT_UNKNOWN)),
                            ("nImageFromSame=%u nImageToSame=%u\n", nImageFromSame, nImageToSame),
                            rc = VERR_INVALID_PARAMETER);
+        AssertMsgBreakStmt(!(uCopyFlags & ~VD_COPY_FLAGS_MASK),
+                           ("uCopyFlags=%#x\n", uCopyFlags),
+                           rc = VERR_INVALID_PARAMETER);
 
         /* Move the image. */
         if (pDiskFrom == pDiskTo)
@@ -6244,10 +7769,20 @@ VBOXDDU_DECL(int) VDCopyEx(PVBOXHDD pDiskFrom, unsigned nImage, PVBOXHDD pDiskTo
         else
             cImagesToReadBack = pDiskTo->cImages - nImageToSame - 1;
 
+        /* Blocks containing only zeroes can be left out only if the destination
+         * is a newly created base image, they might hide data otherwise. Fixed
+         * images are preallocated anyway, nothing to gain there. */
+        bool fSkipZeroes =    (uCopyFlags & VD_COPY_FLAGS_SKIP_ZEROES)
+                           && pszFilename != NULL
+                           && cImagesTo == 0
+                           && !(uImageFlags & VD_IMAGE_FLAGS_FIXED);
+
         /* Copy the data. */
         rc = vdCopyHelper(pDiskFrom, pImageFrom, pDiskTo, cbSize,
                           cImagesFromReadBack, cImagesToReadBack,
-                          fSuppressRedundantIo, pIfProgress, pCbProgress,
+                          fSuppressRedundantIo, fSkipZeroes,
+                          RT_BOOL(uCopyFlags & VD_COPY_FLAGS_PIPELINE),
+                          pIfProgress, pCbProgress,
                           pDstIfProgress, pDstCbProgress);
 
         if (RT_SUCCESS(rc))
@@ -6364,7 +7899,8 @@ VBOXDDU_DECL(int) VDCopy(PVBOXHDD pDiskFrom, unsigned nImage, PVBOXHDD pDiskTo,
 {
     return VDCopyEx(pDiskFrom, nImage, pDiskTo, pszBackend, pszFilename, fMoveByRename,
                     cbSize, VD_IMAGE_CONTENT_UNKNOWN, VD_IMAGE_CONTENT_UNKNOWN,
-                    uImageFlags, pDstUuid, uOpenFlags, pVDIfsOperation,
+                    uImageFlags, pDstUuid, uOpenFlags, VD_COPY_FLAGS_NONE,
+                    pVDIfsOperation,
                     pDstVDIfsImage, pDstVDIfsOperation);
 }
 
@@ -6409,6 +7945,10 @@ VBOXDDU_DECL(int) VDCompact(PVBOXHDD pDisk, unsigned nImage,
         AssertMsg(pDisk->u32Signature == VBOXHDDDISK_SIGNATURE,
                   ("u32Signature=%08x\n", pDisk->u32Signature));
 
+        rc = vdCacheWriteBackAll(pDisk);
+        if (RT_FAILURE(rc))
+            break;
+
         rc2 = vdThreadStartRead(pDisk);
         AssertRC(rc2);
         fLockRead = true;
@@ -6458,6 +7998,10 @@ VBOXDDU_DECL(int) VDCompact(PVBOXHDD pDisk, unsigned nImage,
                                          pDisk->pVDIfsDisk,
                                          pImage->pVDIfsImage,
                                          pVDIfsOperation);
+
+        /* Compacting frees blocks, the index might be wrong now. */
+        if (pDisk->fChainIdx)
+            vdChainIdxClear(pDisk);
     } while (0);
 
     if (RT_UNLIKELY(fLockWrite))
@@ -6525,6 +8069,10 @@ VBOXDDU_DECL(int) VDResize(PVBOXHDD pDisk, uint64_t cbSize,
         AssertMsg(pDisk->u32Signature == VBOXHDDDISK_SIGNATURE,
                   ("u32Signature=%08x\n", pDisk->u32Signature));
 
+        rc = vdCacheWriteBackAll(pDisk);
+        if (RT_FAILURE(rc))
+            break;
+
         rc2 = vdThreadStartRead(pDisk);
         AssertRC(rc2);
         fLockRead = true;
@@ -6597,6 +8145,9 @@ VBOXDDU_DECL(int) VDResize(PVBOXHDD pDisk, uint64_t cbSize,
                                             pDisk->pVDIfsDisk,
                                             pImage->pVDIfsImage,
                                             pVDIfsOperation);
+
+        if (pDisk->fChainIdx)
+            vdChainIdxClear(pDisk);
     } while (0);
 
     if (RT_UNLIKELY(fLockWrite))
@@ -6657,6 +8208,15 @@ VBOXDDU_DECL(int) VDClose(PVBOXHDD pDisk, bool fDelete)
             rc = VERR_VD_NOT_OPENED;
             break;
         }
+
+        /* The data held back by the cache belongs to this image. */
+        if (vdCacheIsWriteBack(pDisk))
+        {
+            rc = vdCacheWriteBack(pDisk, UINT64_MAX);
+            if (RT_FAILURE(rc))
+                break;
+        }
+
         unsigned uOpenFlags = pImage->Backend->pfnGetOpenFlags(pImage->pBackendData);
         /* Remove image from list of opened images. */
         vdRemoveImageFromList(pDisk, pImage);
@@ -6756,6 +8316,15 @@ VBOXDDU_DECL(int) VDCacheClose(PVBOXHDD pDisk, bool fDelete)
 
         AssertPtrBreakStmt(pDisk->pCache, rc = VERR_VD_CACHE_NOT_FOUND);
 
+        /* Dirty data must be in the image before the cache goes away. */
+        if (   vdCacheIsWriteBack(pDisk)
+            && pDisk->pLast)
+        {
+            rc = vdCacheWriteBack(pDisk, UINT64_MAX);
+            if (RT_FAILURE(rc))
+                break;
+        }
+
         pCache = pDisk->pCache;
         pDisk->pCache = NULL;
 
@@ -6802,6 +8371,13 @@ VBOXDDU_DECL(int) VDCloseAll(PVBOXHDD pDisk)
         PVDCACHE pCache = pDisk->pCache;
         if (pCache)
         {
+            /* Data which can't be written back stays in the cache and is
+             * written back when it is opened the next time. */
+            if (   vdCacheIsWriteBack(pDisk)
+                && pDisk->pLast)
+                rc = vdCacheWriteBack(pDisk, UINT64_MAX);
+
+            pDisk->pCache = NULL;
             rc2 = pCache->Backend->pfnClose(pCache->pBackendData, false);
             if (RT_FAILURE(rc2) && RT_SUCCESS(rc))
                 rc = rc2;
@@ -6944,7 +8520,20 @@ VBOXDDU_DECL(int) VDWrite(PVBOXHDD pDisk, uint64_t uOffset, const void *pvBuf,
         PVDIMAGE pImage = pDisk->pLast;
         AssertPtrBreakStmt(pImage, rc = VERR_VD_NOT_OPENED);
 
+        pDisk->uWriteGen++;
         vdSetModifiedFlag(pDisk);
+        vdDiscardWriteNotify(pDisk, uOffset, cbWrite);
+
+        /* A write-back cache takes the data, the image is updated when the
+         * cache is written back. While a merge is running the writes go to
+         * the image directly because they have to be relayed. */
+        if (   vdCacheIsWriteBack(pDisk)
+            && !pDisk->pImageRelay)
+        {
+            rc = vdCacheWriteDirty(pDisk, uOffset, pvBuf, cbWrite);
+            break;
+        }
+
         rc = vdWriteHelper(pDisk, pImage, uOffset, pvBuf, cbWrite,
                            true /* fUpdateCache */);
         if (RT_FAILURE(rc))
@@ -7018,6 +8607,102 @@ VBOXDDU_DECL(int) VDFlush(PVBOXHDD pDisk)
     return rc;
 }
 
+/**
+ * Discards unused ranges given as a list.
+ *
+ * @returns VBox status code.
+ * @returns VERR_VD_NOT_OPENED if no image is opened in HDD container.
+ * @returns VERR_NOT_SUPPORTED if the last image can't discard.
+ * @param   pDisk           Pointer to HDD container.
+ * @param   paRanges        The array of ranges to discard.
+ * @param   cRanges         Number of entries in the array.
+ */
+VBOXDDU_DECL(int) VDDiscardRanges(PVBOXHDD pDisk, PCRTRANGE paRanges,
+                                  unsigned cRanges)
+{
+    int rc = VINF_SUCCESS;
+    int rc2;
+    bool fLockWrite = false;
+
+    LogFlowFunc(("pDisk=%#p paRanges=%#p cRanges=%u\n",
+                 pDisk, paRanges, cRanges));
+    do
+    {
+        /* sanity check */
+        AssertPtrBreakStmt(pDisk, rc = VERR_INVALID_PARAMETER);
+        AssertMsg(pDisk->u32Signature == VBOXHDDDISK_SIGNATURE, ("u32Signature=%08x\n", pDisk->u32Signature));
+
+        /* Check arguments. */
+        AssertMsgBreakStmt(cRanges,
+                           ("cRanges=%u\n", cRanges),
+                           rc = VERR_INVALID_PARAMETER);
+        AssertMsgBreakStmt(VALID_PTR(paRanges),
+                           ("paRanges=%#p\n", paRanges),
+                           rc = VERR_INVALID_PARAMETER);
+
+        rc2 = vdThreadStartWrite(pDisk);
+        AssertRC(rc2);
+        fLockWrite = true;
+
+        PVDIMAGE pImage = pDisk->pLast;
+        AssertPtrBreakStmt(pImage, rc = VERR_VD_NOT_OPENED);
+
+        if (!vdDiscardIsSupported(pImage))
+        {
+            rc = VERR_NOT_SUPPORTED;
+            break;
+        }
+
+        /* Discarding is only a hint, skip it while a merge relays writes
+         * to a parent which would need to discard the range as well. */
+        if (pDisk->pImageRelay)
+            break;
+
+        vdSetModifiedFlag(pDisk);
+
+        RTCritSectEnter(&pDisk->CritSect);
+        for (unsigned i = 0; i < cRanges; i++)
+        {
+            uint64_t offStart  = paRanges[i].offStart;
+            size_t   cbDiscard = paRanges[i].cbRange;
+
+            if (   !cbDiscard
+                || offStart + cbDiscard > pDisk->cbSize
+                || (offStart % 512)
+                || (cbDiscard % 512))
+            {
+                AssertMsgFailed(("offStart=%llu cbDiscard=%zu pDisk->cbSize=%llu\n",
+                                 offStart, cbDiscard, pDisk->cbSize));
+                rc = VERR_INVALID_PARAMETER;
+                break;
+            }
+
+            if (   pDisk->pCache
+                && pDisk->pCache->Backend->pfnDiscard)
+            {
+                rc = pDisk->pCache->Backend->pfnDiscard(pDisk->pCache->pBackendData,
+                                                        offStart, cbDiscard);
+                if (RT_FAILURE(rc))
+                    break;
+            }
+
+            rc = vdDiscardHelper(pDisk, NULL, offStart, cbDiscard);
+            if (RT_FAILURE(rc))
+                break;
+        }
+        RTCritSectLeave(&pDisk->CritSect);
+    } while (0);
+
+    if (RT_UNLIKELY(fLockWrite))
+    {
+        rc2 = vdThreadFinishWrite(pDisk);
+        AssertRC(rc2);
+    }
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
 /**
  * Get number of opened images in HDD container.
  *
@@ -8239,6 +9924,85 @@ VBOXDDU_DECL(int) VDSetParentUuid(PVBOXHDD pDisk, unsigned nImage,
     return rc;
 }
 
+/**
+ * Enables or disables the chain index of the HDD container.
+ *
+ * @returns VBox status code.
+ * @param   pDisk           Pointer to HDD container.
+ * @param   fEnable         Flag whether to enable or disable the index.
+ */
+VBOXDDU_DECL(int) VDSetChainIndex(PVBOXHDD pDisk, bool fEnable)
+{
+    int rc = VINF_SUCCESS;
+    int rc2;
+    bool fLockWrite = false;
+
+    LogFlowFunc(("pDisk=%#p fEnable=%RTbool\n", pDisk, fEnable));
+    do
+    {
+        /* sanity check */
+        AssertPtrBreakStmt(pDisk, rc = VERR_INVALID_PARAMETER);
+        AssertMsg(pDisk->u32Signature == VBOXHDDDISK_SIGNATURE, ("u32Signature=%08x\n", pDisk->u32Signature));
+
+        rc2 = vdThreadStartWrite(pDisk);
+        AssertRC(rc2);
+        fLockWrite = true;
+
+        vdChainIdxClear(pDisk);
+        pDisk->fChainIdx       = fEnable;
+        pDisk->cChainIdxHits   = 0;
+        pDisk->cChainIdxMisses = 0;
+    } while (0);
+
+    if (RT_UNLIKELY(fLockWrite))
+    {
+        rc2 = vdThreadFinishWrite(pDisk);
+        AssertRC(rc2);
+    }
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Sets the statistics structure the HDD container updates for the cache.
+ *
+ * @returns VBox status code.
+ * @param   pDisk           Pointer to HDD container.
+ * @param   pStats          The statistics to update, NULL to stop updating them.
+ */
+VBOXDDU_DECL(int) VDCacheSetStatistics(PVBOXHDD pDisk, PVDCACHESTATS pStats)
+{
+    int rc = VINF_SUCCESS;
+    int rc2;
+    bool fLockWrite = false;
+
+    LogFlowFunc(("pDisk=%#p pStats=%#p\n", pDisk, pStats));
+    do
+    {
+        /* sanity check */
+        AssertPtrBreakStmt(pDisk, rc = VERR_INVALID_PARAMETER);
+        AssertMsg(pDisk->u32Signature == VBOXHDDDISK_SIGNATURE, ("u32Signature=%08x\n", pDisk->u32Signature));
+        AssertMsgBreakStmt(pStats == NULL || VALID_PTR(pStats),
+                           ("pStats=%#p\n", pStats),
+                           rc = VERR_INVALID_PARAMETER);
+
+        rc2 = vdThreadStartWrite(pDisk);
+        AssertRC(rc2);
+        fLockWrite = true;
+
+        pDisk->pCacheStats = pStats;
+    } while (0);
+
+    if (RT_UNLIKELY(fLockWrite))
+    {
+        rc2 = vdThreadFinishWrite(pDisk);
+        AssertRC(rc2);
+    }
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
 
 /**
  * Debug helper - dumps all opened images in HDD container into the log file.
@@ -8270,6 +10034,11 @@ VBOXDDU_DECL(void) VDDumpImages(PVBOXHDD pDisk)
                              pImage->pszFilename, pImage->Backend->pszBackendName);
             pImage->Backend->pfnDump(pImage->pBackendData);
         }
+
+        if (pDisk->fChainIdx)
+            vdMessageWrapper(pDisk, "Chain index: Extents=%u Hits=%llu Misses=%llu\n",
+                             pDisk->cChainIdxExtents, pDisk->cChainIdxHits,
+                             pDisk->cChainIdxMisses);
     } while (0);
 
     if (RT_UNLIKELY(fLockRead))
@@ -8317,6 +10086,13 @@ VBOXDDU_DECL(int) VDAsyncRead(PVBOXHDD pDisk, uint64_t uOffset, size_t cbRead,
                            rc = VERR_INVALID_PARAMETER);
         AssertPtrBreakStmt(pDisk->pLast, rc = VERR_VD_NOT_OPENED);
 
+        /* The asynchronous path doesn't know about data held back by the cache. */
+        if (vdCacheIsWriteBack(pDisk))
+        {
+            rc = VERR_NOT_SUPPORTED;
+            break;
+        }
+
         pIoCtx = vdIoCtxRootAlloc(pDisk, VDIOCTXTXDIR_READ, uOffset,
                                   cbRead, pDisk->pLast, pcSgBuf,
                                   pfnComplete, pvUser1, pvUser2,
@@ -8388,6 +10164,27 @@ VBOXDDU_DECL(int) VDAsyncWrite(PVBOXHDD pDisk, uint64_t uOffset, size_t cbWrite,
                            rc = VERR_INVALID_PARAMETER);
         AssertPtrBreakStmt(pDisk->pLast, rc = VERR_VD_NOT_OPENED);
 
+        if (vdCacheIsWriteBack(pDisk))
+        {
+            rc = VERR_NOT_SUPPORTED;
+            break;
+        }
+
+        pDisk->uWriteGen++;
+        if (pDisk->fChainIdx)
+            vdChainIdxInvalidate(pDisk, uOffset, cbWrite);
+        vdDiscardWriteNotify(pDisk, uOffset, cbWrite);
+
+        /* The asynchronous path bypasses the cache, drop the stale data. */
+        if (   pDisk->pCache
+            && pDisk->pCache->Backend->pfnDiscard)
+        {
+            rc = pDisk->pCache->Backend->pfnDiscard(pDisk->pCache->pBackendData,
+                                                    uOffset, cbWrite);
+            if (RT_FAILURE(rc))
+                break;
+        }
+
         pIoCtx = vdIoCtxRootAlloc(pDisk, VDIOCTXTXDIR_WRITE, uOffset,
                                   cbWrite, pDisk->pLast, pcSgBuf,
                                   pfnComplete, pvUser1, pvUser2,
@@ -8477,3 +10274,117 @@ VBOXDDU_DECL(int) VDAsyncFlush(PVBOXHDD pDisk, PFNVDASYNCTRANSFERCOMPLETE pfnCom
     return rc;
 }
 
+
+VBOXDDU_DECL(int) VDAsyncDiscardRanges(PVBOXHDD pDisk, PCRTRANGE paRanges, unsigned cRanges,
+                                       PFNVDASYNCTRANSFERCOMPLETE pfnComplete,
+                                       void *pvUser1, void *pvUser2)
+{
+    int rc;
+    int rc2;
+    bool fLockWrite = false;
+    PVDIOCTX pIoCtx = NULL;
+
+    LogFlowFunc(("pDisk=%#p paRanges=%#p cRanges=%u\n", pDisk, paRanges, cRanges));
+
+    do
+    {
+        /* sanity check */
+        AssertPtrBreakStmt(pDisk, rc = VERR_INVALID_PARAMETER);
+        AssertMsg(pDisk->u32Signature == VBOXHDDDISK_SIGNATURE, ("u32Signature=%08x\n", pDisk->u32Signature));
+
+        /* Check arguments. */
+        AssertMsgBreakStmt(cRanges,
+                           ("cRanges=%u\n", cRanges),
+                           rc = VERR_INVALID_PARAMETER);
+        AssertMsgBreakStmt(VALID_PTR(paRanges),
+                           ("paRanges=%#p\n", paRanges),
+                           rc = VERR_INVALID_PARAMETER);
+
+        rc2 = vdThreadStartWrite(pDisk);
+        AssertRC(rc2);
+        fLockWrite = true;
+
+        AssertPtrBreakStmt(pDisk->pLast, rc = VERR_VD_NOT_OPENED);
+
+        if (!vdDiscardIsSupported(pDisk->pLast))
+        {
+            rc = VERR_NOT_SUPPORTED;
+            break;
+        }
+
+        /* See VDDiscardRanges. */
+        if (pDisk->pImageRelay)
+        {
+            rc = VINF_VD_ASYNC_IO_FINISHED;
+            break;
+        }
+
+        rc = VINF_SUCCESS;
+        for (unsigned i = 0; i < cRanges; i++)
+        {
+            if (   !paRanges[i].cbRange
+                || paRanges[i].offStart + paRanges[i].cbRange > pDisk->cbSize
+                || (paRanges[i].offStart % 512)
+                || (paRanges[i].cbRange % 512))
+            {
+                AssertMsgFailed(("offStart=%llu cbRange=%zu pDisk->cbSize=%llu\n",
+                                 paRanges[i].offStart, paRanges[i].cbRange, pDisk->cbSize));
+                rc = VERR_INVALID_PARAMETER;
+                break;
+            }
+
+            /* The asynchronous path bypasses the cache, drop the stale data. */
+            if (   pDisk->pCache
+                && pDisk->pCache->Backend->pfnDiscard)
+            {
+                rc = pDisk->pCache->Backend->pfnDiscard(pDisk->pCache->pBackendData,
+                                                        paRanges[i].offStart,
+                                                        paRanges[i].cbRange);
+                if (RT_FAILURE(rc))
+                    break;
+            }
+        }
+        if (RT_FAILURE(rc))
+            break;
+
+        pIoCtx = vdIoCtxRootAlloc(pDisk, VDIOCTXTXDIR_DISCARD, 0,
+                                  0, pDisk->pLast, NULL,
+                                  pfnComplete, pvUser1, pvUser2,
+                                  NULL, vdDiscardHelperAsync);
+        if (!pIoCtx)
+        {
+            rc = VERR_NO_MEMORY;
+            break;
+        }
+
+        pIoCtx->Type.Root.paRanges = paRanges;
+        pIoCtx->Type.Root.cRanges  = cRanges;
+
+        rc = vdIoCtxProcess(pIoCtx);
+        if (rc == VINF_VD_ASYNC_IO_FINISHED)
+        {
+            if (ASMAtomicCmpXchgBool(&pIoCtx->fComplete, true, false))
+            {
+                /* Pass errors of the backend on to the caller. */
+                if (RT_FAILURE(pIoCtx->rcReq))
+                    rc = pIoCtx->rcReq;
+                vdIoCtxFree(pDisk, pIoCtx);
+            }
+            else
+                rc = VERR_VD_ASYNC_IO_IN_PROGRESS; /* Let the other handler complete the request. */
+        }
+        else if (rc != VERR_VD_ASYNC_IO_IN_PROGRESS) /* Another error */
+            vdIoCtxFree(pDisk, pIoCtx);
+    } while (0);
+
+    if (RT_UNLIKELY(fLockWrite) && (   rc == VINF_VD_ASYNC_IO_FINISHED
+                                    || rc != VERR_VD_ASYNC_IO_IN_PROGRESS))
+    {
+        rc2 = vdThreadFinishWrite(pDisk);
+        AssertRC(rc2);
+    }
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
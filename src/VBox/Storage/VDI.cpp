@@ -58,6 +58,7 @@ static int  vdiUpdateHeader(PVDIIMAGEDESC pImage);
 static int  vdiUpdateBlockInfo(PVDIIMAGEDESC pImage, unsigned uBlock);
 static int  vdiUpdateHeaderAsync(PVDIIMAGEDESC pImage, PVDIOCTX pIoCtx);
 static int  vdiUpdateBlockInfoAsync(PVDIIMAGEDESC pImage, unsigned uBlock, PVDIOCTX pIoCtx);
+static void vdiSlotsFreeDrop(PVDIIMAGEDESC pImage);
 
 /**
  * Internal: signal an error to the frontend.
@@ -257,6 +258,8 @@ static int vdiFreeImage(PVDIIMAGEDESC pImage, bool fDelete)
             pImage->paBlocks = NULL;
         }
 
+        vdiSlotsFreeDrop(pImage);
+
         if (fDelete && pImage->pszFilename)
             vdiFileDelete(pImage, pImage->pszFilename);
     }
@@ -996,6 +999,169 @@ static int vdiFlushImageAsync(PVDIIMAGEDESC pImage, PVDIOCTX pIoCtx)
     return rc;
 }
 
+/**
+ * Internal: Forget about the unused block slots, they are recreated from the
+ * block array when needed again.
+ */
+static void vdiSlotsFreeDrop(PVDIIMAGEDESC pImage)
+{
+    if (pImage->pbmSlotsFree)
+    {
+        RTMemFree(pImage->pbmSlotsFree);
+        pImage->pbmSlotsFree = NULL;
+        pImage->cSlotsFree = 0;
+    }
+}
+
+/**
+ * Internal: Create the bitmap of unused block slots from the block array.
+ */
+static int vdiSlotsFreeInit(PVDIIMAGEDESC pImage)
+{
+    unsigned cBlocks = getImageBlocks(&pImage->Header);
+    unsigned cBlocksAllocated = getImageBlocksAllocated(&pImage->Header);
+    unsigned cBits = RT_ALIGN_32(RT_MAX(cBlocks, cBlocksAllocated), 32);
+
+    pImage->pbmSlotsFree = (uint32_t *)RTMemAllocZ(cBits / 8);
+    if (!pImage->pbmSlotsFree)
+        return VERR_NO_MEMORY;
+
+    for (unsigned i = 0; i < cBlocksAllocated; i++)
+        ASMBitSet(pImage->pbmSlotsFree, i);
+    pImage->cSlotsFree = cBlocksAllocated;
+
+    for (unsigned i = 0; i < cBlocks; i++)
+    {
+        VDIIMAGEBLOCKPOINTER ptrBlock = pImage->paBlocks[i];
+        if (   IS_VDI_IMAGE_BLOCK_ALLOCATED(ptrBlock)
+            && ptrBlock < cBlocksAllocated
+            && ASMBitTestAndClear(pImage->pbmSlotsFree, ptrBlock))
+            pImage->cSlotsFree--;
+    }
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Internal: Return the slot in the image file for a new block, unused slots
+ * are reused before the image grows.
+ */
+static unsigned vdiSlotAllocGet(PVDIIMAGEDESC pImage)
+{
+    if (pImage->cSlotsFree)
+    {
+        int iSlot = ASMBitFirstSet(pImage->pbmSlotsFree,
+                                   RT_ALIGN_32(getImageBlocksAllocated(&pImage->Header), 32));
+        Assert(iSlot >= 0);
+        return (unsigned)iSlot;
+    }
+
+    return getImageBlocksAllocated(&pImage->Header);
+}
+
+/**
+ * Internal: Mark the slot returned by vdiSlotAllocGet() as used.
+ */
+static void vdiSlotAllocCommit(PVDIIMAGEDESC pImage, unsigned uSlot)
+{
+    unsigned cBlocksAllocated = getImageBlocksAllocated(&pImage->Header);
+
+    if (uSlot < cBlocksAllocated)
+    {
+        Assert(pImage->cSlotsFree);
+        ASMBitClear(pImage->pbmSlotsFree, uSlot);
+        pImage->cSlotsFree--;
+    }
+    else
+    {
+        Assert(uSlot == cBlocksAllocated);
+        setImageBlocksAllocated(&pImage->Header, cBlocksAllocated + 1);
+    }
+}
+
+/**
+ * Internal: Release the slot of a discarded block. The image is truncated if
+ * the slot is at the end, otherwise the slot is reused by the next new block.
+ *
+ * @returns true if the image needs to be truncated, false otherwise.
+ */
+static bool vdiSlotFree(PVDIIMAGEDESC pImage, unsigned uSlot)
+{
+    unsigned cBlocksAllocated = getImageBlocksAllocated(&pImage->Header);
+
+    if (uSlot + 1 == cBlocksAllocated)
+    {
+        /* Drop the trailing unused slots as well. */
+        cBlocksAllocated--;
+        while (   cBlocksAllocated
+               && ASMBitTestAndClear(pImage->pbmSlotsFree, cBlocksAllocated - 1))
+        {
+            pImage->cSlotsFree--;
+            cBlocksAllocated--;
+        }
+        setImageBlocksAllocated(&pImage->Header, cBlocksAllocated);
+        return true;
+    }
+
+    ASMBitSet(pImage->pbmSlotsFree, uSlot);
+    pImage->cSlotsFree++;
+    return false;
+}
+
+/**
+ * Internal: Check the discard request and clip it to the containing block.
+ *
+ * @returns VBox status code.
+ * @param   pfDiscardBlock    Where to store whether the block is allocated and
+ *                            covered completely by the request.
+ */
+static int vdiDiscardPrepare(PVDIIMAGEDESC pImage, uint64_t uOffset, size_t cbDiscard,
+                             unsigned *puBlock, bool *pfDiscardBlock, size_t *pcbPreAllocated,
+                             size_t *pcbPostAllocated, size_t *pcbDiscarded)
+{
+    uint64_t cbDisk = getImageDiskSize(&pImage->Header);
+    unsigned cbImgBlock = getImageBlockSize(&pImage->Header);
+
+    if (pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+        return VERR_VD_IMAGE_READ_ONLY;
+    if (pImage->uImageFlags & VD_IMAGE_FLAGS_FIXED)
+        return VERR_NOT_SUPPORTED;
+    if (!cbDiscard || uOffset + cbDiscard > cbDisk)
+        return VERR_INVALID_PARAMETER;
+
+    /* Calculate block number and offset inside it, the last block might
+     * extend beyond the end of the disk. */
+    unsigned uBlock = (unsigned)(uOffset >> pImage->uShiftOffset2Index);
+    unsigned offDiscard = (unsigned)uOffset & pImage->uBlockMask;
+    size_t cbBlock = (size_t)RT_MIN(cbImgBlock, cbDisk - ((uint64_t)uBlock << pImage->uShiftOffset2Index));
+
+    cbDiscard = RT_MIN(cbDiscard, cbBlock - offDiscard);
+    *puBlock        = uBlock;
+    *pfDiscardBlock = false;
+    *pcbDiscarded   = cbDiscard;
+
+    /* Nothing to do for unallocated blocks. */
+    if (!IS_VDI_IMAGE_BLOCK_ALLOCATED(pImage->paBlocks[uBlock]))
+        return VINF_SUCCESS;
+
+    if (cbDiscard < cbBlock)
+    {
+        *pcbPreAllocated  = offDiscard;
+        *pcbPostAllocated = cbBlock - cbDiscard - offDiscard;
+        return VERR_VD_DISCARD_ALIGNMENT_NOT_MET;
+    }
+
+    if (!pImage->pbmSlotsFree)
+    {
+        int rc = vdiSlotsFreeInit(pImage);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
+    *pfDiscardBlock = true;
+    return VINF_SUCCESS;
+}
+
 
 /** @copydoc VBOXHDDBACKEND::pfnCheckIfValid */
 static int vdiCheckIfValid(const char *pszFilename, PVDINTERFACE pVDIfsDisk,
@@ -1345,9 +1511,7 @@ static int vdiWrite(void *pBackendData, uint64_t uOffset, const void *pvBuf,
                  * either a zero block or a block which hasn't been used so far
                  * (which also means that it's a zero block. Don't need to write
                  * anything to this block  if the data consists of just zeroes. */
-                Assert(!(cbToWrite % 4));
-                Assert(cbToWrite * 8 <= UINT32_MAX);
-                if (ASMBitFirstSet((volatile void *)pvBuf, (uint32_t)cbToWrite * 8) == -1)
+                if (RTMemIsZero(pvBuf, cbToWrite))
                 {
                     pImage->paBlocks[uBlock] = VDI_IMAGE_BLOCK_ZERO;
                     *pcbPreRead = 0;
@@ -1362,14 +1526,14 @@ static int vdiWrite(void *pBackendData, uint64_t uOffset, const void *pvBuf,
                 /* Full block write to previously unallocated block.
                  * Allocate block and write data. */
                 Assert(!offWrite);
-                unsigned cBlocksAllocated = getImageBlocksAllocated(&pImage->Header);
-                uint64_t u64Offset = (uint64_t)cBlocksAllocated * pImage->cbTotalBlockData
+                unsigned uSlot = vdiSlotAllocGet(pImage);
+                uint64_t u64Offset = (uint64_t)uSlot * pImage->cbTotalBlockData
                                    + (pImage->offStartData + pImage->offStartBlockData);
                 rc = vdiFileWriteSync(pImage, u64Offset, pvBuf, cbToWrite, NULL);
                 if (RT_FAILURE(rc))
                     goto out;
-                pImage->paBlocks[uBlock] = cBlocksAllocated;
-                setImageBlocksAllocated(&pImage->Header, cBlocksAllocated + 1);
+                pImage->paBlocks[uBlock] = uSlot;
+                vdiSlotAllocCommit(pImage, uSlot);
 
                 rc = vdiUpdateBlockInfo(pImage, uBlock);
                 if (RT_FAILURE(rc))
@@ -1651,7 +1815,7 @@ static int vdiSetOpenFlags(void *pBackendData, unsigned uOpenFlags)
     const char *pszFilename;
 
     /* Image must be opened and the new flags must be valid. */
-    if (!pImage || (uOpenFlags & ~(VD_OPEN_FLAGS_READONLY | VD_OPEN_FLAGS_INFO | VD_OPEN_FLAGS_ASYNC_IO | VD_OPEN_FLAGS_SHAREABLE | VD_OPEN_FLAGS_SEQUENTIAL)))
+    if (!pImage || (uOpenFlags & ~(VD_OPEN_FLAGS_READONLY | VD_OPEN_FLAGS_INFO | VD_OPEN_FLAGS_ASYNC_IO | VD_OPEN_FLAGS_SHAREABLE | VD_OPEN_FLAGS_SEQUENTIAL | VD_OPEN_FLAGS_DISCARD)))
     {
         rc = VERR_INVALID_PARAMETER;
         goto out;
@@ -2142,9 +2306,7 @@ static int vdiAsyncWrite(void *pBackendData, uint64_t uOffset, size_t cbToWrite,
                  * either a zero block or a block which hasn't been used so far
                  * (which also means that it's a zero block. Don't need to write
                  * anything to this block  if the data consists of just zeroes. */
-                Assert(!(cbToWrite % 4));
-                Assert(cbToWrite * 8 <= UINT32_MAX);
-                if (ASMBitFirstSet((volatile void *)pvBuf, (uint32_t)cbToWrite * 8) == -1)
+                if (RTMemIsZero(pvBuf, cbToWrite))
                 {
                     pImage->paBlocks[uBlock] = VDI_IMAGE_BLOCK_ZERO;
                     break;
@@ -2158,14 +2320,14 @@ static int vdiAsyncWrite(void *pBackendData, uint64_t uOffset, size_t cbToWrite,
                 /* Full block write to previously unallocated block.
                  * Allocate block and write data. */
                 Assert(!offWrite);
-                unsigned cBlocksAllocated = getImageBlocksAllocated(&pImage->Header);
-                uint64_t u64Offset = (uint64_t)cBlocksAllocated * pImage->cbTotalBlockData
+                unsigned uSlot = vdiSlotAllocGet(pImage);
+                uint64_t u64Offset = (uint64_t)uSlot * pImage->cbTotalBlockData
                                    + (pImage->offStartData + pImage->offStartBlockData);
                 rc = vdiFileWriteUserAsync(pImage, u64Offset, pIoCtx, cbToWrite, NULL, NULL);
                 if (RT_UNLIKELY(RT_FAILURE_NP(rc) && (rc != VERR_VD_ASYNC_IO_IN_PROGRESS)))
                     goto out;
-                pImage->paBlocks[uBlock] = cBlocksAllocated;
-                setImageBlocksAllocated(&pImage->Header, cBlocksAllocated + 1);
+                pImage->paBlocks[uBlock] = uSlot;
+                vdiSlotAllocCommit(pImage, uSlot);
 
                 rc = vdiUpdateBlockInfoAsync(pImage, uBlock, pIoCtx);
                 if (RT_FAILURE(rc) && (rc != VERR_VD_ASYNC_IO_IN_PROGRESS))
@@ -2336,7 +2498,7 @@ static int vdiCompact(void *pBackendData, unsigned uPercentStart,
                 if (RT_FAILURE(rc))
                     break;
 
-                if (ASMBitFirstSet((volatile void *)pvTmp, (uint32_t)cbBlock * 8) == -1)
+                if (RTMemIsZero(pvTmp, cbBlock))
                 {
                     pImage->paBlocks[i] = VDI_IMAGE_BLOCK_ZERO;
                     rc = vdiUpdateBlockInfo(pImage, i);
@@ -2423,6 +2585,7 @@ static int vdiCompact(void *pBackendData, unsigned uPercentStart,
         /* Update image header. */
         setImageBlocksAllocated(&pImage->Header, uBlockUsedPos);
         vdiUpdateHeader(pImage);
+        vdiSlotsFreeDrop(pImage);
 
         /* Truncate the image to the proper size to finish compacting. */
         rc = vdiFileSetSize(pImage,
@@ -2484,11 +2647,14 @@ static int vdiResize(void *pBackendData, uint64_t cbSize,
         rc = VERR_NOT_SUPPORTED;
     else if (cbSize > getImageDiskSize(&pImage->Header))
     {
-        unsigned cBlocksAllocated = getImageBlocksAllocated(&pImage->Header); /** < Blocks currently allocated, doesn't change during resize */
+        unsigned cBlocksAllocated = getImageBlocksAllocated(&pImage->Header); /** < Blocks currently allocated, only unused slots are dropped during resize */
         uint32_t cBlocksNew = cbSize / getImageBlockSize(&pImage->Header);    /** < New number of blocks in the image after the resize */
         if (cbSize % getImageBlockSize(&pImage->Header))
             cBlocksNew++;
 
+        /* The slots move, the bitmap is recreated on the next discard. */
+        vdiSlotsFreeDrop(pImage);
+
         uint32_t cBlocksOld      = getImageBlocks(&pImage->Header);           /** < Number of blocks before the resize. */
         uint64_t cbBlockspaceNew = cBlocksNew * sizeof(VDIIMAGEBLOCKPOINTER); /** < Required space for the block array after the resize. */
         uint64_t offStartDataNew = RT_ALIGN_32(pImage->offStartBlocks + cbBlockspaceNew, VDI_DATA_ALIGN); /** < New start offset for block data after the resize */
@@ -2517,8 +2683,6 @@ static int vdiResize(void *pBackendData, uint64_t cbSize,
             void *pvBuf = NULL, *pvZero = NULL;
             do
             {
-                VDIIMAGEBLOCKPOINTER uBlock = 0;
-
                 /* Allocate data buffer. */
                 pvBuf = RTMemAllocZ(pImage->cbTotalBlockData);
                 if (!pvBuf)
@@ -2537,11 +2701,19 @@ static int vdiResize(void *pBackendData, uint64_t cbSize,
 
                 for (unsigned i = 0; i < cBlocksReloc; i++)
                 {
-                    /* Search the index in the block table. */
+                    bool fFound = false;
+
+                    /*
+                     * Search the index in the block table. The pointers are
+                     * rebased after every step, so the block at the current
+                     * data start is always 0.
+                     */
                     for (unsigned idxBlock = 0; idxBlock < cBlocksOld; idxBlock++)
                     {
-                        if (pImage->paBlocks[idxBlock] == uBlock)
+                        if (pImage->paBlocks[idxBlock] == 0)
                         {
+                            fFound = true;
+
                             /* Read data and append to the end of the image. */
                             rc = vdiFileReadSync(pImage, offStartDataNew, pvBuf, pImage->cbTotalBlockData, NULL);
                             if (RT_FAILURE(rc))
@@ -2586,7 +2758,18 @@ static int vdiResize(void *pBackendData, uint64_t cbSize,
                     if (RT_FAILURE(rc))
                         break;
 
-                    uBlock++;
+                    if (!fFound)
+                    {
+                        /* Slot left unused by a discard, just move the data start over it. */
+                        for (unsigned idxBlock = 0; idxBlock < cBlocksOld; idxBlock++)
+                        {
+                            if (IS_VDI_IMAGE_BLOCK_ALLOCATED(pImage->paBlocks[idxBlock]))
+                                pImage->paBlocks[idxBlock]--;
+                        }
+                        cBlocksAllocated--;
+                        setImageBlocksAllocated(&pImage->Header, cBlocksAllocated);
+                    }
+
                     offStartDataNew += pImage->cbTotalBlockData;
                 }
             } while (0);
@@ -2654,6 +2837,91 @@ static int vdiResize(void *pBackendData, uint64_t cbSize,
     return rc;
 }
 
+/** @copydoc VBOXHDDBACKEND::pfnDiscard */
+static int vdiDiscard(void *pBackendData, uint64_t uOffset, size_t cbDiscard,
+                      size_t *pcbPreAllocated, size_t *pcbPostAllocated,
+                      size_t *pcbDiscarded)
+{
+    LogFlowFunc(("pBackendData=%#p uOffset=%llu cbDiscard=%zu\n", pBackendData, uOffset, cbDiscard));
+    PVDIIMAGEDESC pImage = (PVDIIMAGEDESC)pBackendData;
+    unsigned uBlock;
+    bool fDiscardBlock;
+    int rc;
+
+    AssertPtr(pImage);
+    Assert(!(uOffset % 512));
+    Assert(!(cbDiscard % 512));
+
+    rc = vdiDiscardPrepare(pImage, uOffset, cbDiscard, &uBlock, &fDiscardBlock,
+                           pcbPreAllocated, pcbPostAllocated, pcbDiscarded);
+    if (RT_SUCCESS(rc) && fDiscardBlock)
+    {
+        VDIIMAGEBLOCKPOINTER uSlot = pImage->paBlocks[uBlock];
+
+        /* Update the block pointer first, the slot must not be referenced
+         * anymore when it is reused or cut off. */
+        pImage->paBlocks[uBlock] = VDI_IMAGE_BLOCK_ZERO;
+        rc = vdiUpdateBlockInfo(pImage, uBlock);
+        if (   RT_SUCCESS(rc)
+            && vdiSlotFree(pImage, uSlot))
+        {
+            rc = vdiUpdateHeader(pImage);
+            if (RT_SUCCESS(rc))
+                rc = vdiFileSetSize(pImage,
+                                      (uint64_t)getImageBlocksAllocated(&pImage->Header) * pImage->cbTotalBlockData
+                                    + pImage->offStartData + pImage->offStartBlockData);
+        }
+    }
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnAsyncDiscard */
+static int vdiAsyncDiscard(void *pBackendData, PVDIOCTX pIoCtx,
+                           uint64_t uOffset, size_t cbDiscard,
+                           size_t *pcbPreAllocated, size_t *pcbPostAllocated,
+                           size_t *pcbDiscarded)
+{
+    LogFlowFunc(("pBackendData=%#p pIoCtx=%#p uOffset=%llu cbDiscard=%zu\n", pBackendData, pIoCtx, uOffset, cbDiscard));
+    PVDIIMAGEDESC pImage = (PVDIIMAGEDESC)pBackendData;
+    unsigned uBlock;
+    bool fDiscardBlock;
+    int rc;
+
+    AssertPtr(pImage);
+    Assert(!(uOffset % 512));
+    Assert(!(cbDiscard % 512));
+
+    rc = vdiDiscardPrepare(pImage, uOffset, cbDiscard, &uBlock, &fDiscardBlock,
+                           pcbPreAllocated, pcbPostAllocated, pcbDiscarded);
+    if (RT_SUCCESS(rc) && fDiscardBlock)
+    {
+        VDIIMAGEBLOCKPOINTER uSlot = pImage->paBlocks[uBlock];
+
+        /* See vdiDiscard(). The metadata writes are ordered, the header
+         * with the new block count is written after the block pointer. */
+        pImage->paBlocks[uBlock] = VDI_IMAGE_BLOCK_ZERO;
+        rc = vdiUpdateBlockInfoAsync(pImage, uBlock, pIoCtx);
+        if (   (RT_SUCCESS(rc) || rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+            && vdiSlotFree(pImage, uSlot))
+        {
+            rc = vdiUpdateHeaderAsync(pImage, pIoCtx);
+            if (RT_SUCCESS(rc) || rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+            {
+                int rc2 = vdiFileSetSize(pImage,
+                                           (uint64_t)getImageBlocksAllocated(&pImage->Header) * pImage->cbTotalBlockData
+                                         + pImage->offStartData + pImage->offStartBlockData);
+                if (RT_FAILURE(rc2))
+                    rc = rc2;
+            }
+        }
+    }
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
 
 VBOXHDDBACKEND g_VDIBackend =
 {
@@ -2663,7 +2931,7 @@ VBOXHDDBACKEND g_VDIBackend =
     sizeof(VBOXHDDBACKEND),
     /* uBackendCaps */
       VD_CAP_UUID | VD_CAP_CREATE_FIXED | VD_CAP_CREATE_DYNAMIC
-    | VD_CAP_DIFF | VD_CAP_FILE | VD_CAP_ASYNC | VD_CAP_VFS,
+    | VD_CAP_DIFF | VD_CAP_FILE | VD_CAP_ASYNC | VD_CAP_VFS | VD_CAP_DISCARD,
     /* paFileExtensions */
     s_aVdiFileExtensions,
     /* paConfigInfo */
@@ -2751,5 +3019,9 @@ VBOXHDDBACKEND g_VDIBackend =
     /* pfnCompact */
     vdiCompact,
     /* pfnResize */
-    vdiResize
+    vdiResize,
+    /* pfnDiscard */
+    vdiDiscard,
+    /* pfnAsyncDiscard */
+    vdiAsyncDiscard
 };
@@ -604,6 +604,11 @@ typedef struct VDIIMAGEDESC
 #else /* VBOX_VDICORE_VD */
     /** Total size of image block (including the extra data). */
     unsigned                cbTotalBlockData;
+    /** Bitmap of unused block slots below the allocated block count, left
+     * behind by discarded blocks. Built on the first discard. */
+    uint32_t               *pbmSlotsFree;
+    /** Number of bits set in pbmSlotsFree. */
+    unsigned                cSlotsFree;
     /** Container filename. (UTF-8) */
     const char             *pszFilename;
     /** Physical geometry of this image (never actually stored). */
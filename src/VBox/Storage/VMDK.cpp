@@ -5124,7 +5124,7 @@ static int vmdkStreamAllocGrain(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
     /* Zero byte write optimization. Since we don't tell VBoxHDD that we need
      * to allocate something, we also need to detect the situation ourself. */
     if (   !(pImage->uOpenFlags & VD_OPEN_FLAGS_HONOR_ZEROES)
-        && ASMBitFirstSet((volatile void *)pvBuf, (uint32_t)cbWrite * 8) == -1)
+        && RTMemIsZero(pvBuf, cbWrite))
         return VINF_SUCCESS;
 
     if (uGDEntry != uLastGDEntry)
@@ -7398,5 +7398,9 @@ VBOXHDDBACKEND g_VmdkBackend =
     /* pfnCompact */
     NULL,
     /* pfnResize */
+    NULL,
+    /* pfnDiscard */
+    NULL,
+    /* pfnAsyncDiscard */
     NULL
 };
@@ -136,7 +136,8 @@ typedef enum VDIOREQTXDIR
 {
     VDIOREQTXDIR_READ = 0,
     VDIOREQTXDIR_WRITE,
-    VDIOREQTXDIR_FLUSH
+    VDIOREQTXDIR_FLUSH,
+    VDIOREQTXDIR_DISCARD
 } VDIOREQTXDIR;
 
 /**
@@ -297,8 +298,10 @@ static DECLCALLBACK(int) vdScriptHandlerCreate(PVDTESTGLOB pGlob, PVDSCRIPTARG p
 static DECLCALLBACK(int) vdScriptHandlerOpen(PVDTESTGLOB pGlob, PVDSCRIPTARG paScriptArgs, unsigned cScriptArgs);
 static DECLCALLBACK(int) vdScriptHandlerIo(PVDTESTGLOB pGlob, PVDSCRIPTARG paScriptArgs, unsigned cScriptArgs);
 static DECLCALLBACK(int) vdScriptHandlerFlush(PVDTESTGLOB pGlob, PVDSCRIPTARG paScriptArgs, unsigned cScriptArgs);
+static DECLCALLBACK(int) vdScriptHandlerDiscard(PVDTESTGLOB pGlob, PVDSCRIPTARG paScriptArgs, unsigned cScriptArgs);
 static DECLCALLBACK(int) vdScriptHandlerMerge(PVDTESTGLOB pGlob, PVDSCRIPTARG paScriptArgs, unsigned cScriptArgs);
 static DECLCALLBACK(int) vdScriptHandlerCompact(PVDTESTGLOB pGlob, PVDSCRIPTARG paScriptArgs, unsigned cScriptArgs);
+static DECLCALLBACK(int) vdScriptHandlerResize(PVDTESTGLOB pGlob, PVDSCRIPTARG paScriptArgs, unsigned cScriptArgs);
 static DECLCALLBACK(int) vdScriptHandlerCopy(PVDTESTGLOB pGlob, PVDSCRIPTARG paScriptArgs, unsigned cScriptArgs);
 static DECLCALLBACK(int) vdScriptHandlerClose(PVDTESTGLOB pGlob, PVDSCRIPTARG paScriptArgs, unsigned cScriptArgs);
 static DECLCALLBACK(int) vdScriptHandlerIoRngCreate(PVDTESTGLOB pGlob, PVDSCRIPTARG paScriptArgs, unsigned cScriptArgs);
@@ -323,7 +326,10 @@ const VDSCRIPTARGDESC g_aArgCreate[] =
     {"name",       'n', VDSCRIPTARGTYPE_STRING,          VDSCRIPTARGDESC_FLAG_MANDATORY},
     {"type",       't', VDSCRIPTARGTYPE_STRING,          0},
     {"backend",    'b', VDSCRIPTARGTYPE_STRING,          VDSCRIPTARGDESC_FLAG_MANDATORY},
-    {"size",       's', VDSCRIPTARGTYPE_UNSIGNED_NUMBER, VDSCRIPTARGDESC_FLAG_MANDATORY | VDSCRIPTARGDESC_FLAG_SIZE_SUFFIX}
+    {"size",       's', VDSCRIPTARGTYPE_UNSIGNED_NUMBER, VDSCRIPTARGDESC_FLAG_MANDATORY | VDSCRIPTARGDESC_FLAG_SIZE_SUFFIX},
+    {"skipzeroes", 'z', VDSCRIPTARGTYPE_BOOL,            0},
+    {"writeback",  'w', VDSCRIPTARGTYPE_BOOL,            0},
+    {"discard",    'c', VDSCRIPTARGTYPE_BOOL,            0}
 };
 
 /* open action */
@@ -334,7 +340,9 @@ const VDSCRIPTARGDESC g_aArgOpen[] =
     {"name",       'n', VDSCRIPTARGTYPE_STRING,          VDSCRIPTARGDESC_FLAG_MANDATORY},
     {"backend",    'b', VDSCRIPTARGTYPE_STRING,          VDSCRIPTARGDESC_FLAG_MANDATORY},
     {"shareable",  's', VDSCRIPTARGTYPE_BOOL,            0},
-    {"readonly",   'r', VDSCRIPTARGTYPE_BOOL,            0}
+    {"readonly",   'r', VDSCRIPTARGTYPE_BOOL,            0},
+    {"skipzeroes", 'z', VDSCRIPTARGTYPE_BOOL,            0},
+    {"discard",    'c', VDSCRIPTARGTYPE_BOOL,            0}
 };
 
 /* I/O action */
@@ -360,6 +368,16 @@ const VDSCRIPTARGDESC g_aArgFlush[] =
     {"async",      'a', VDSCRIPTARGTYPE_BOOL,            0}
 };
 
+/* discard action */
+const VDSCRIPTARGDESC g_aArgDiscard[] =
+{
+    /* pcszName    chId enmType                          fFlags */
+    {"disk",       'd', VDSCRIPTARGTYPE_STRING,          VDSCRIPTARGDESC_FLAG_MANDATORY},
+    {"async",      'a', VDSCRIPTARGTYPE_BOOL,            0},
+    {"off",        'o', VDSCRIPTARGTYPE_UNSIGNED_NUMBER, VDSCRIPTARGDESC_FLAG_MANDATORY | VDSCRIPTARGDESC_FLAG_SIZE_SUFFIX},
+    {"size",       's', VDSCRIPTARGTYPE_UNSIGNED_NUMBER, VDSCRIPTARGDESC_FLAG_MANDATORY | VDSCRIPTARGDESC_FLAG_SIZE_SUFFIX}
+};
+
 /* merge action */
 const VDSCRIPTARGDESC g_aArgMerge[] =
 {
@@ -377,6 +395,14 @@ const VDSCRIPTARGDESC g_aArgCompact[] =
     {"image",      'i', VDSCRIPTARGTYPE_UNSIGNED_NUMBER, VDSCRIPTARGDESC_FLAG_MANDATORY},
 };
 
+/* Resize a disk */
+const VDSCRIPTARGDESC g_aArgResize[] =
+{
+    /* pcszName    chId enmType                          fFlags */
+    {"disk",       'd', VDSCRIPTARGTYPE_STRING,          VDSCRIPTARGDESC_FLAG_MANDATORY},
+    {"size",       's', VDSCRIPTARGTYPE_UNSIGNED_NUMBER, VDSCRIPTARGDESC_FLAG_MANDATORY | VDSCRIPTARGDESC_FLAG_SIZE_SUFFIX}
+};
+
 /* Compact a disk */
 const VDSCRIPTARGDESC g_aArgCopy[] =
 {
@@ -389,7 +415,9 @@ const VDSCRIPTARGDESC g_aArgCopy[] =
     {"movebyrename", 'm', VDSCRIPTARGTYPE_BOOL,          0},
     {"size",       'z', VDSCRIPTARGTYPE_UNSIGNED_NUMBER, 0},
     {"fromsame",   'o', VDSCRIPTARGTYPE_UNSIGNED_NUMBER, 0},
-    {"tosame",     't', VDSCRIPTARGTYPE_UNSIGNED_NUMBER, 0}
+    {"tosame",     't', VDSCRIPTARGTYPE_UNSIGNED_NUMBER, 0},
+    {"pipeline",   'p', VDSCRIPTARGTYPE_BOOL,            0},
+    {"skipzeroes", 'e', VDSCRIPTARGTYPE_BOOL,            0}
 };
 
 /* close action */
@@ -454,7 +482,8 @@ const VDSCRIPTARGDESC g_aArgCreateDisk[] =
 {
     /* pcszName    chId enmType                          fFlags */
     {"name",       'n', VDSCRIPTARGTYPE_STRING,          VDSCRIPTARGDESC_FLAG_MANDATORY},
-    {"verify",     'v', VDSCRIPTARGTYPE_BOOL,            0}
+    {"verify",     'v', VDSCRIPTARGTYPE_BOOL,            0},
+    {"chainindex", 'c', VDSCRIPTARGTYPE_BOOL,            0}
 };
 
 /* Create virtual disk handle */
@@ -493,9 +522,11 @@ const VDSCRIPTACTION g_aScriptActions[] =
     {"open",                       g_aArgOpen,                        RT_ELEMENTS(g_aArgOpen),                       vdScriptHandlerOpen},
     {"io",                         g_aArgIo,                          RT_ELEMENTS(g_aArgIo),                         vdScriptHandlerIo},
     {"flush",                      g_aArgFlush,                       RT_ELEMENTS(g_aArgFlush),                      vdScriptHandlerFlush},
+    {"discard",                    g_aArgDiscard,                     RT_ELEMENTS(g_aArgDiscard),                    vdScriptHandlerDiscard},
     {"close",                      g_aArgClose,                       RT_ELEMENTS(g_aArgClose),                      vdScriptHandlerClose},
     {"merge",                      g_aArgMerge,                       RT_ELEMENTS(g_aArgMerge),                      vdScriptHandlerMerge},
     {"compact",                    g_aArgCompact,                     RT_ELEMENTS(g_aArgCompact),                    vdScriptHandlerCompact},
+    {"resize",                     g_aArgResize,                      RT_ELEMENTS(g_aArgResize),                     vdScriptHandlerResize},
     {"copy",                       g_aArgCopy,                        RT_ELEMENTS(g_aArgCopy),                       vdScriptHandlerCopy},
     {"iorngcreate",                g_aArgIoRngCreate,                 RT_ELEMENTS(g_aArgIoRngCreate),                vdScriptHandlerIoRngCreate},
     {"iorngdestroy",               NULL,                              0,                                             vdScriptHandlerIoRngDestroy},
@@ -552,6 +583,10 @@ static DECLCALLBACK(int) vdScriptHandlerCreate(PVDTESTGLOB pGlob, PVDSCRIPTARG p
     PVDDISK pDisk = NULL;
     bool fBase = false;
     bool fDynamic = true;
+    bool fCache = false;
+    bool fSkipZeroes = false;
+    bool fWriteBack = false;
+    bool fDiscard = false;
 
     for (unsigned i = 0; i < cScriptArgs; i++)
     {
@@ -568,6 +603,8 @@ static DECLCALLBACK(int) vdScriptHandlerCreate(PVDTESTGLOB pGlob, PVDSCRIPTARG p
                     fBase = true;
                 else if (!RTStrICmp(paScriptArgs[i].u.pcszString, "diff"))
                     fBase = false;
+                else if (!RTStrICmp(paScriptArgs[i].u.pcszString, "cache"))
+                    fCache = true;
                 else
                 {
                     RTPrintf("Invalid image mode '%s' given\n", paScriptArgs[i].u.pcszString);
@@ -603,6 +640,21 @@ static DECLCALLBACK(int) vdScriptHandlerCreate(PVDTESTGLOB pGlob, PVDSCRIPTARG p
                 }
                 break;
             }
+            case 'z':
+            {
+                fSkipZeroes = paScriptArgs[i].u.fFlag;
+                break;
+            }
+            case 'w':
+            {
+                fWriteBack = paScriptArgs[i].u.fFlag;
+                break;
+            }
+            case 'c':
+            {
+                fDiscard = paScriptArgs[i].u.fFlag;
+                break;
+            }
             default:
                 AssertMsgFailed(("Invalid argument given!\n"));
         }
@@ -611,22 +663,42 @@ static DECLCALLBACK(int) vdScriptHandlerCreate(PVDTESTGLOB pGlob, PVDSCRIPTARG p
             break;
     }
 
+    if (   RT_SUCCESS(rc)
+        && fWriteBack
+        && !fCache)
+    {
+        RTPrintf("writeback=yes works only with mode=cache\n");
+        rc = VERR_INVALID_PARAMETER;
+    }
+
     if (RT_SUCCESS(rc))
     {
         pDisk = tstVDIoGetDiskByName(pGlob, pcszDisk);
         if (pDisk)
         {
             unsigned fImageFlags = VD_IMAGE_FLAGS_NONE;
+            unsigned fOpenFlags = VD_OPEN_FLAGS_ASYNC_IO;
 
             if (!fDynamic)
                 fImageFlags |= VD_IMAGE_FLAGS_FIXED;
+            if (fSkipZeroes)
+                fOpenFlags |= VD_OPEN_FLAGS_SKIP_ZEROES;
+            if (fDiscard)
+                fOpenFlags |= VD_OPEN_FLAGS_DISCARD;
 
-            if (fBase)
+            if (fCache)
+            {
+                /* The write-back cache doesn't support async I/O. */
+                fOpenFlags = fWriteBack ? VD_OPEN_FLAGS_CACHE_WRITEBACK : VD_OPEN_FLAGS_NORMAL;
+                rc = VDCreateCache(pDisk->pVD, pcszBackend, pcszImage, cbSize, VD_IMAGE_FLAGS_NONE,
+                                   NULL, NULL, fOpenFlags, pGlob->pInterfacesImages, NULL);
+            }
+            else if (fBase)
                 rc = VDCreateBase(pDisk->pVD, pcszBackend, pcszImage, cbSize, fImageFlags, NULL,
                                   &pDisk->PhysGeom, &pDisk->LogicalGeom,
-                                  NULL, VD_OPEN_FLAGS_ASYNC_IO, pGlob->pInterfacesImages, NULL);
+                                  NULL, fOpenFlags, pGlob->pInterfacesImages, NULL);
             else
-                rc = VDCreateDiff(pDisk->pVD, pcszBackend, pcszImage, fImageFlags, NULL, NULL, NULL, VD_OPEN_FLAGS_ASYNC_IO,
+                rc = VDCreateDiff(pDisk->pVD, pcszBackend, pcszImage, fImageFlags, NULL, NULL, NULL, fOpenFlags,
                                   pGlob->pInterfacesImages, NULL);
         }
         else
@@ -645,6 +717,8 @@ static DECLCALLBACK(int) vdScriptHandlerOpen(PVDTESTGLOB pGlob, PVDSCRIPTARG paS
     PVDDISK pDisk = NULL;
     bool fShareable = false;
     bool fReadonly = false;
+    bool fSkipZeroes = false;
+    bool fDiscard = false;
 
     for (unsigned i = 0; i < cScriptArgs; i++)
     {
@@ -675,6 +749,16 @@ static DECLCALLBACK(int) vdScriptHandlerOpen(PVDTESTGLOB pGlob, PVDSCRIPTARG paS
                 fReadonly = paScriptArgs[i].u.fFlag;
                 break;
             }
+            case 'z':
+            {
+                fSkipZeroes = paScriptArgs[i].u.fFlag;
+                break;
+            }
+            case 'c':
+            {
+                fDiscard = paScriptArgs[i].u.fFlag;
+                break;
+            }
             default:
                 AssertMsgFailed(("Invalid argument given!\n"));
         }
@@ -694,6 +778,10 @@ static DECLCALLBACK(int) vdScriptHandlerOpen(PVDTESTGLOB pGlob, PVDSCRIPTARG paS
                 fOpenFlags |= VD_OPEN_FLAGS_SHAREABLE;
             if (fReadonly)
                 fOpenFlags |= VD_OPEN_FLAGS_READONLY;
+            if (fSkipZeroes)
+                fOpenFlags |= VD_OPEN_FLAGS_SKIP_ZEROES;
+            if (fDiscard)
+                fOpenFlags |= VD_OPEN_FLAGS_DISCARD;
 
             rc = VDOpen(pDisk->pVD, pcszBackend, pcszImage, fOpenFlags, pGlob->pInterfacesImages);
         }
@@ -903,6 +991,9 @@ static DECLCALLBACK(int) vdScriptHandlerIo(PVDTESTGLOB pGlob, PVDSCRIPTARG paScr
                                             rc = VDFlush(pDisk->pVD);
                                             break;
                                         }
+                                        case VDIOREQTXDIR_DISCARD:
+                                            AssertMsgFailed(("Invalid transfer direction\n"));
+                                            break;
                                     }
 
                                     ASMAtomicXchgBool(&paIoReq[idx].fOutstanding, false);
@@ -931,6 +1022,9 @@ static DECLCALLBACK(int) vdScriptHandlerIo(PVDTESTGLOB pGlob, PVDSCRIPTARG paScr
                                             rc = VDAsyncFlush(pDisk->pVD, tstVDIoTestReqComplete, &paIoReq[idx], EventSem);
                                             break;
                                         }
+                                        case VDIOREQTXDIR_DISCARD:
+                                            AssertMsgFailed(("Invalid transfer direction\n"));
+                                            break;
                                     }
 
                                     if (rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
@@ -975,6 +1069,7 @@ static DECLCALLBACK(int) vdScriptHandlerIo(PVDTESTGLOB pGlob, PVDSCRIPTARG paScr
                                                 break;
                                             }
                                             case VDIOREQTXDIR_FLUSH:
+                                            case VDIOREQTXDIR_DISCARD:
                                                 break;
                                         }
 
@@ -1107,6 +1202,123 @@ static DECLCALLBACK(int) vdScriptHandlerFlush(PVDTESTGLOB pGlob, PVDSCRIPTARG pa
     return rc;
 }
 
+static DECLCALLBACK(int) vdScriptHandlerDiscard(PVDTESTGLOB pGlob, PVDSCRIPTARG paScriptArgs, unsigned cScriptArgs)
+{
+    int rc = VINF_SUCCESS;
+    bool fAsync = false;
+    const char *pcszDisk = NULL;
+    PVDDISK pDisk = NULL;
+    RTRANGE Range;
+
+    Range.offStart = 0;
+    Range.cbRange  = 0;
+
+    for (unsigned i = 0; i < cScriptArgs; i++)
+    {
+        switch (paScriptArgs[i].chId)
+        {
+            case 'd':
+            {
+                pcszDisk = paScriptArgs[i].u.pcszString;
+                break;
+            }
+            case 'a':
+            {
+                fAsync = paScriptArgs[i].u.fFlag;
+                break;
+            }
+            case 'o':
+            {
+                Range.offStart = paScriptArgs[i].u.u64;
+                break;
+            }
+            case 's':
+            {
+                Range.cbRange = (size_t)paScriptArgs[i].u.u64;
+                break;
+            }
+            default:
+                AssertMsgFailed(("Invalid argument given!\n"));
+        }
+
+        if (RT_FAILURE(rc))
+            break;
+    }
+
+    if (RT_SUCCESS(rc))
+    {
+        pDisk = tstVDIoGetDiskByName(pGlob, pcszDisk);
+        if (!pDisk)
+            rc = VERR_NOT_FOUND;
+        else if (fAsync)
+        {
+            VDIOREQ IoReq;
+            RTSEMEVENT EventSem;
+
+            rc = RTSemEventCreate(&EventSem);
+            if (RT_SUCCESS(rc))
+            {
+                memset(&IoReq, 0, sizeof(VDIOREQ));
+                IoReq.enmTxDir = VDIOREQTXDIR_DISCARD;
+                IoReq.pvUser   = pDisk;
+                IoReq.idx      = 0;
+                rc = VDAsyncDiscardRanges(pDisk->pVD, &Range, 1, tstVDIoTestReqComplete, &IoReq, EventSem);
+                if (rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+                {
+                    rc = RTSemEventWait(EventSem, RT_INDEFINITE_WAIT);
+                    AssertRC(rc);
+                }
+                else if (rc == VINF_VD_ASYNC_IO_FINISHED)
+                    rc = VINF_SUCCESS;
+
+                RTSemEventDestroy(EventSem);
+            }
+        }
+        else
+            rc = VDDiscardRanges(pDisk->pVD, &Range, 1);
+
+        /*
+         * Discarded ranges read back as zeroes once the whole block was
+         * discarded. Scripts must not read a partially discarded block before
+         * the rest of it was discarded too.
+         */
+        if (   RT_SUCCESS(rc)
+            && pDisk
+            && pDisk->pMemDiskVerify)
+        {
+            void *pvZero = RTMemAllocZ(_64K);
+
+            if (pvZero)
+            {
+                uint64_t off = Range.offStart;
+                size_t cbLeft = Range.cbRange;
+
+                RTCritSectEnter(&pDisk->CritSectVerify);
+                while (   cbLeft
+                       && RT_SUCCESS(rc))
+                {
+                    size_t cbThisWrite = RT_MIN(cbLeft, _64K);
+                    RTSGSEG Seg;
+                    RTSGBUF SgBuf;
+
+                    Seg.pvSeg = pvZero;
+                    Seg.cbSeg = cbThisWrite;
+                    RTSgBufInit(&SgBuf, &Seg, 1);
+                    rc = VDMemDiskWrite(pDisk->pMemDiskVerify, off, cbThisWrite, &SgBuf);
+                    off    += cbThisWrite;
+                    cbLeft -= cbThisWrite;
+                }
+                RTCritSectLeave(&pDisk->CritSectVerify);
+                RTMemFree(pvZero);
+            }
+            else
+                rc = VERR_NO_MEMORY;
+        }
+    }
+
+    return rc;
+}
+
 static DECLCALLBACK(int) vdScriptHandlerMerge(PVDTESTGLOB pGlob, PVDSCRIPTARG paScriptArgs, unsigned cScriptArgs)
 {
     int rc = VINF_SUCCESS;
@@ -1207,6 +1419,53 @@ static DECLCALLBACK(int) vdScriptHandlerCompact(PVDTESTGLOB pGlob, PVDSCRIPTARG
     return rc;
 }
 
+static DECLCALLBACK(int) vdScriptHandlerResize(PVDTESTGLOB pGlob, PVDSCRIPTARG paScriptArgs, unsigned cScriptArgs)
+{
+    int rc = VINF_SUCCESS;
+    const char *pcszDisk = NULL;
+    PVDDISK pDisk = NULL;
+    uint64_t cbSize = 0;
+
+    for (unsigned i = 0; i < cScriptArgs; i++)
+    {
+        switch (paScriptArgs[i].chId)
+        {
+            case 'd':
+            {
+                pcszDisk = paScriptArgs[i].u.pcszString;
+                break;
+            }
+            case 's':
+            {
+                cbSize = paScriptArgs[i].u.u64;
+                break;
+            }
+
+            default:
+                AssertMsgFailed(("Invalid argument given!\n"));
+        }
+
+        if (RT_FAILURE(rc))
+            break;
+    }
+
+    if (RT_SUCCESS(rc))
+    {
+        pDisk = tstVDIoGetDiskByName(pGlob, pcszDisk);
+        if (!pDisk)
+            rc = VERR_NOT_FOUND;
+        else
+        {
+            /* Keep the current geometry. */
+            VDGEOMETRY Geometry;
+            RT_ZERO(Geometry);
+            rc = VDResize(pDisk->pVD, cbSize, &Geometry, &Geometry, NULL);
+        }
+    }
+
+    return rc;
+}
+
 static DECLCALLBACK(int) vdScriptHandlerCopy(PVDTESTGLOB pGlob, PVDSCRIPTARG paScriptArgs, unsigned cScriptArgs)
 {
     int rc = VINF_SUCCESS;
@@ -1221,6 +1480,7 @@ static DECLCALLBACK(int) vdScriptHandlerCopy(PVDTESTGLOB pGlob, PVDSCRIPTARG paS
     uint64_t cbSize = 0;
     unsigned nImageFromSame = VD_IMAGE_CONTENT_UNKNOWN;
     unsigned nImageToSame = VD_IMAGE_CONTENT_UNKNOWN;
+    unsigned uCopyFlags = VD_COPY_FLAGS_NONE;
 
     for (unsigned i = 0; i < cScriptArgs; i++)
     {
@@ -1271,6 +1531,18 @@ static DECLCALLBACK(int) vdScriptHandlerCopy(PVDTESTGLOB pGlob, PVDSCRIPTARG paS
                 nImageToSame = (unsigned)paScriptArgs[i].u.u64;
                 break;
             }
+            case 'p':
+            {
+                if (paScriptArgs[i].u.fFlag)
+                    uCopyFlags |= VD_COPY_FLAGS_PIPELINE;
+                break;
+            }
+            case 'e':
+            {
+                if (paScriptArgs[i].u.fFlag)
+                    uCopyFlags |= VD_COPY_FLAGS_SKIP_ZEROES;
+                break;
+            }
 
             default:
                 AssertMsgFailed(("Invalid argument given!\n"));
@@ -1291,10 +1563,17 @@ static DECLCALLBACK(int) vdScriptHandlerCopy(PVDTESTGLOB pGlob, PVDSCRIPTARG paS
             /** @todo: Provide progress interface to test that cancelation
              * works as intended.
              */
+            uint64_t NanoTS = RTTimeNanoTS();
+
             rc = VDCopyEx(pDiskFrom->pVD, nImageFrom, pDiskTo->pVD, pcszBackend, pcszFilename,
                           fMoveByRename, cbSize, nImageFromSame, nImageToSame,
-                          VD_IMAGE_FLAGS_NONE, NULL, VD_OPEN_FLAGS_ASYNC_IO,
+                          VD_IMAGE_FLAGS_NONE, NULL, VD_OPEN_FLAGS_ASYNC_IO, uCopyFlags,
                           NULL, pGlob->pInterfacesImages, NULL);
+            if (RT_SUCCESS(rc))
+            {
+                NanoTS = RTTimeNanoTS() - NanoTS;
+                RTPrintf("Copy: %llu ms\n", NanoTS / 1000000);
+            }
         }
     }
 
@@ -1305,6 +1584,7 @@ static DECLCALLBACK(int) vdScriptHandlerClose(PVDTESTGLOB pGlob, PVDSCRIPTARG pa
 {
     int rc = VINF_SUCCESS;
     bool fAll = false;
+    bool fCache = false;
     bool fDelete = false;
     const char *pcszDisk = NULL;
     PVDDISK pDisk = NULL;
@@ -1324,6 +1604,8 @@ static DECLCALLBACK(int) vdScriptHandlerClose(PVDTESTGLOB pGlob, PVDSCRIPTARG pa
                     fAll = true;
                 else if (!RTStrICmp(paScriptArgs[i].u.pcszString, "single"))
                     fAll = false;
+                else if (!RTStrICmp(paScriptArgs[i].u.pcszString, "cache"))
+                    fCache = true;
                 else
                 {
                     RTPrintf("Invalid mode '%s' given\n", paScriptArgs[i].u.pcszString);
@@ -1359,6 +1641,8 @@ static DECLCALLBACK(int) vdScriptHandlerClose(PVDTESTGLOB pGlob, PVDSCRIPTARG pa
         {
             if (fAll)
                 rc = VDCloseAll(pDisk->pVD);
+            else if (fCache)
+                rc = VDCacheClose(pDisk->pVD, fDelete);
             else
                 rc = VDClose(pDisk->pVD, fDelete);
         }
@@ -1675,6 +1959,7 @@ static DECLCALLBACK(int) vdScriptHandlerCreateDisk(PVDTESTGLOB pGlob, PVDSCRIPTA
     const char *pcszDisk = NULL;
     PVDDISK pDisk = NULL;
     bool fVerify = false;
+    bool fChainIdx = false;
 
     for (unsigned i = 0; i < cScriptArgs; i++)
     {
@@ -1690,6 +1975,11 @@ static DECLCALLBACK(int) vdScriptHandlerCreateDisk(PVDTESTGLOB pGlob, PVDSCRIPTA
                 fVerify = paScriptArgs[i].u.fFlag;
                 break;
             }
+            case 'c':
+            {
+                fChainIdx = paScriptArgs[i].u.fFlag;
+                break;
+            }
             default:
                 AssertMsgFailed(("Invalid argument given!\n"));
         }
@@ -1723,6 +2013,14 @@ static DECLCALLBACK(int) vdScriptHandlerCreateDisk(PVDTESTGLOB pGlob, PVDSCRIPTA
                 {
                     rc = VDCreate(pGlob->pInterfacesDisk, VDTYPE_HDD, &pDisk->pVD);
 
+                    if (   RT_SUCCESS(rc)
+                        && fChainIdx)
+                    {
+                        rc = VDSetChainIndex(pDisk->pVD, true);
+                        if (RT_FAILURE(rc))
+                            VDDestroy(pDisk->pVD);
+                    }
+
                     if (RT_SUCCESS(rc))
                         RTListAppend(&pGlob->ListDisks, &pDisk->ListNode);
                     else
@@ -2398,6 +2696,7 @@ static void tstVDIoTestReqComplete(void *pvUser1, void *pvUser2, int rcReq)
                 break;
             }
             case VDIOREQTXDIR_FLUSH:
+            case VDIOREQTXDIR_DISCARD:
                 break;
         }
     }
@@ -26,6 +26,7 @@
 #include <iprt/mem.h>
 #include <iprt/initterm.h>
 #include <iprt/rand.h>
+#include <iprt/time.h>
 
 /**
  * A VD snapshot test.
@@ -330,11 +331,13 @@ static int tstVDOpenCreateWriteMerge(PVDSNAPTEST pTest)
                      uEndMerge - uStartMerge,
                      uStartMerge,
                      uEndMerge);
+            uint64_t tsMerge = RTTimeMilliTS();
             if (pTest->fForward)
                 rc = VDMerge(pVD, uStartMerge, uEndMerge, NULL);
             else
                 rc = VDMerge(pVD, uEndMerge, uStartMerge, NULL);
             CHECK("VDMerge()");
+            RTPrintf("Merging took %llu ms\n", RTTimeMilliTS() - tsMerge);
 
             cDiffs -= uEndMerge - uStartMerge;
 
@@ -1305,6 +1305,10 @@ int pgmPhysGCPhys2CCPtrInternalDepr(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys, vo
     AssertReturn(pPage, VERR_PGM_PHYS_NULL_PAGE_PARAM);
     PGM_LOCK_ASSERT_OWNER(pVM);
     pVM->pgm.s.cDeprecatedPageLocks++;
+#ifdef IN_RING3
+    if (RT_UNLIKELY(pVM->pgm.s.fLazyRestoreActive))
+        pgmR3LazyRestoreTouch(pVM, GCPhys);
+#endif
 
     /*
      * Make sure the page is writable.
@@ -1562,6 +1566,10 @@ int pgmPhysGCPhys2CCPtrInternalReadOnly(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys
  */
 VMMDECL(int) PGMPhysGCPhys2CCPtr(PVM pVM, RTGCPHYS GCPhys, void **ppv, PPGMPAGEMAPLOCK pLock)
 {
+#ifdef IN_RING3
+    if (RT_UNLIKELY(pVM->pgm.s.fLazyRestoreActive))
+        pgmR3LazyRestoreTouch(pVM, GCPhys);
+#endif
     int rc = pgmLock(pVM);
     AssertRCReturn(rc, rc);
 
@@ -1665,6 +1673,10 @@ VMMDECL(int) PGMPhysGCPhys2CCPtr(PVM pVM, RTGCPHYS GCPhys, void **ppv, PPGMPAGEM
  */
 VMMDECL(int) PGMPhysGCPhys2CCPtrReadOnly(PVM pVM, RTGCPHYS GCPhys, void const **ppv, PPGMPAGEMAPLOCK pLock)
 {
+#ifdef IN_RING3
+    if (RT_UNLIKELY(pVM->pgm.s.fLazyRestoreActive))
+        pgmR3LazyRestoreTouch(pVM, GCPhys);
+#endif
     int rc = pgmLock(pVM);
     AssertRCReturn(rc, rc);
 
@@ -1750,8 +1750,12 @@ int emR3ForcedActions(PVM pVM, PVMCPU pVCpu, int rc)
 VMMR3DECL(bool) EMR3IsExecutionAllowed(PVM pVM, PVMCPU pVCpu)
 {
     uint64_t u64UserTime, u64KernelTime;
+    uint32_t uCap       = pVM->uCpuExecutionCap;
+    uint32_t uThrottle  = ASMAtomicUoReadU32(&pVM->em.s.uExecutionThrottle);
+    if (uThrottle)
+        uCap = RT_MAX(uCap * (100 - uThrottle) / 100, 1);
 
-    if (    pVM->uCpuExecutionCap != 100
+    if (    uCap != 100
         &&  RT_SUCCESS(RTThreadGetExecutionTimeMilli(&u64KernelTime, &u64UserTime)))
     {
         uint64_t u64TimeNow = RTTimeMilliTS();
@@ -1764,14 +1768,52 @@ VMMR3DECL(bool) EMR3IsExecutionAllowed(PVM pVM, PVMCPU pVCpu)
         }
         pVCpu->em.s.u64TimeSliceExec = u64KernelTime + u64UserTime - pVCpu->em.s.u64TimeSliceStartExec;
 
-        Log2(("emR3IsExecutionAllowed: start=%RX64 startexec=%RX64 exec=%RX64 (cap=%x)\n", pVCpu->em.s.u64TimeSliceStart, pVCpu->em.s.u64TimeSliceStartExec, pVCpu->em.s.u64TimeSliceExec, (EM_TIME_SLICE * pVM->uCpuExecutionCap) / 100));
-        if (pVCpu->em.s.u64TimeSliceExec >= (EM_TIME_SLICE * pVM->uCpuExecutionCap) / 100)
+        Log2(("emR3IsExecutionAllowed: start=%RX64 startexec=%RX64 exec=%RX64 (cap=%x)\n", pVCpu->em.s.u64TimeSliceStart, pVCpu->em.s.u64TimeSliceStartExec, pVCpu->em.s.u64TimeSliceExec, (EM_TIME_SLICE * uCap) / 100));
+        if (pVCpu->em.s.u64TimeSliceExec >= (EM_TIME_SLICE * uCap) / 100)
             return false;
     }
     return true;
 }
 
 
+/**
+ * Changes the execution throttle.
+ *
+ * The throttle scales down the time the virtual CPUs are allowed to execute
+ * on top of the CPU execution cap.  Used by live save to slow down guests
+ * dirtying memory faster than it can be transferred.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The VM to operate on.
+ * @param   uThrottle           The throttle in percent, 0-99.  0 means no
+ *                              throttling (default).
+ * @thread  Any.
+ */
+VMMR3DECL(int) EMR3SetExecutionThrottle(PVM pVM, uint32_t uThrottle)
+{
+    VM_ASSERT_VALID_EXT_RETURN(pVM, VERR_INVALID_VM_HANDLE);
+    AssertReturn(uThrottle < 100, VERR_INVALID_PARAMETER);
+
+    Log(("EMR3SetExecutionThrottle: %u%%\n", uThrottle));
+    ASMAtomicWriteU32(&pVM->em.s.uExecutionThrottle, uThrottle);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Gets the current execution throttle.
+ *
+ * @returns The throttle in percent, 0 if not throttled.
+ * @param   pVM                 The VM to operate on.
+ * @thread  Any.
+ */
+VMMR3DECL(uint32_t) EMR3GetExecutionThrottle(PVM pVM)
+{
+    VM_ASSERT_VALID_EXT_RETURN(pVM, 0);
+    return ASMAtomicReadU32(&pVM->em.s.uExecutionThrottle);
+}
+
+
 /**
  * Execute VM.
  *
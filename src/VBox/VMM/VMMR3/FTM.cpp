@@ -29,6 +29,7 @@
 #include <VBox/log.h>
 #include <VBox/vmm/pgm.h>
 #include <VBox/vmm/pdm.h>
+#include <VBox/vmm/cfgm.h>
 
 #include <iprt/assert.h>
 #include <iprt/thread.h>
@@ -93,6 +94,7 @@ typedef struct FTMTCPHDRMEM
 static const char g_szWelcome[] = "VirtualBox-Fault-Tolerance-Sync-1.0\n";
 
 static DECLCALLBACK(int) ftmR3PageTreeDestroyCallback(PAVLGCPHYSNODECORE pBaseNode, void *pvUser);
+static void ftmR3TcpCloseStreams(PVM pVM);
 
 /**
  * Initializes the FTM.
@@ -116,11 +118,23 @@ VMMR3DECL(int) FTMR3Init(PVM pVM)
     pVM->ftm.s.standby.hServer          = NIL_RTTCPSERVER;
     pVM->ftm.s.hShutdownEvent           = NIL_RTSEMEVENT;
     pVM->ftm.s.hSocket                  = NIL_RTSOCKET;
+    pVM->ftm.s.pahStreams               = NULL;
+    pVM->ftm.s.pStripe                  = NULL;
+
+    /** @cfgm{/FTM/Streams, uint32_t, 0, 0, 16}
+     * The number of additional TCP connections the master stripes the state
+     * stream over.  0 or 1 sends it over the control connection.  The standby
+     * goes along with whatever the master asks for. */
+    uint32_t cStreams;
+    int rc = CFGMR3QueryU32Def(CFGMR3GetChild(CFGMR3GetRoot(pVM), "/FTM"), "Streams", &cStreams, 0);
+    AssertLogRelRCReturn(rc, rc);
+    AssertLogRelMsgReturn(cStreams <= SSM_TCP_STRIPE_MAX_STREAMS, ("Streams=%u\n", cStreams), VERR_OUT_OF_RANGE);
+    pVM->ftm.s.cStreams                 = cStreams > 1 ? cStreams : 0;
 
     /*
      * Initialize the PGM critical section.
      */
-    int rc = PDMR3CritSectInit(pVM, &pVM->ftm.s.CritSect, RT_SRC_POS, "FTM");
+    rc = PDMR3CritSectInit(pVM, &pVM->ftm.s.CritSect, RT_SRC_POS, "FTM");
     AssertRCReturn(rc, rc);
 
     /*
@@ -163,6 +177,7 @@ VMMR3DECL(int) FTMR3Term(PVM pVM)
         RTSemEventDestroy(pVM->ftm.s.hShutdownEvent);
         pVM->ftm.s.hShutdownEvent = NIL_RTSEMEVENT;
     }
+    ftmR3TcpCloseStreams(pVM);
     if (pVM->ftm.s.hSocket != NIL_RTSOCKET)
     {
         RTTcpClientClose(pVM->ftm.s.hSocket);
@@ -351,6 +366,19 @@ static DECLCALLBACK(int) ftmR3TcpOpWrite(void *pvUser, uint64_t offStream, const
     AssertReturn(pVM->fFaultTolerantMaster, VERR_INVALID_HANDLE);
 
     STAM_COUNTER_INC(&pVM->ftm.s.StatSentStateWrite);
+    if (pVM->ftm.s.pStripe)
+    {
+        int rc = SSMR3TcpStripeWrite(pVM->ftm.s.pStripe, pvBuf, cbToWrite);
+        if (RT_FAILURE(rc))
+        {
+            LogRel(("FTSync/TCP: Striped write error: %Rrc (cb=%#zx)\n", rc, cbToWrite));
+            return rc;
+        }
+        pVM->ftm.s.StatSentState.c      += cbToWrite;
+        pVM->ftm.s.syncstate.uOffStream += cbToWrite;
+        return VINF_SUCCESS;
+    }
+
     for (;;)
     {
         FTMTCPHDR Hdr;
@@ -407,6 +435,45 @@ static int ftmR3TcpReadSelect(PVM pVM)
 }
 
 
+/**
+ * Worker for ftmR3TcpOpRead that reads from the data connections.
+ *
+ * @returns VBox status code.
+ * @param   pVM             The VM handle.
+ * @param   pvBuf           Where to return the data.
+ * @param   cbToRead        How much to read.
+ * @param   pcbRead         Where to return the amount read, optional.
+ */
+static int ftmR3TcpStripeRead(PVM pVM, void *pvBuf, size_t cbToRead, size_t *pcbRead)
+{
+    if (pVM->ftm.s.syncstate.fEndOfStream)
+        return VERR_EOF;
+    if (pVM->ftm.s.syncstate.fStopReading)
+        return VERR_EOF;
+    if (pVM->ftm.s.syncstate.fIOError)
+        return VERR_IO_GEN_FAILURE;
+
+    int rc = SSMR3TcpStripeRead(pVM->ftm.s.pStripe, pvBuf, cbToRead, pcbRead);
+    if (RT_SUCCESS(rc))
+    {
+        size_t cb = pcbRead ? *pcbRead : cbToRead;
+        pVM->ftm.s.StatReceivedState.c  += cb;
+        pVM->ftm.s.syncstate.uOffStream += cb;
+        return rc;
+    }
+    if (rc == VERR_INTERRUPTED)
+        return VERR_EOF;        /* fStopReading */
+    if (rc == VERR_EOF || rc == VERR_SSM_CANCELLED)
+        pVM->ftm.s.syncstate.fEndOfStream = true;
+    else
+    {
+        pVM->ftm.s.syncstate.fIOError = true;
+        LogRel(("FTSync/TCP: Striped read error: %Rrc (cb=%#zx)\n", rc, cbToRead));
+    }
+    return rc;
+}
+
+
 /**
  * @copydoc SSMSTRMOPS::pfnRead
  */
@@ -415,6 +482,9 @@ static DECLCALLBACK(int) ftmR3TcpOpRead(void *pvUser, uint64_t offStream, void *
     PVM pVM = (PVM)pvUser;
     AssertReturn(!pVM->fFaultTolerantMaster, VERR_INVALID_HANDLE);
 
+    if (pVM->ftm.s.pStripe)
+        return ftmR3TcpStripeRead(pVM, pvBuf, cbToRead, pcbRead);
+
     for (;;)
     {
         int rc;
@@ -572,6 +642,17 @@ static DECLCALLBACK(int) ftmR3TcpOpClose(void *pvUser, bool fCanceled)
 
     if (pVM->fFaultTolerantMaster)
     {
+        if (pVM->ftm.s.pStripe)
+        {
+            int rc = SSMR3TcpStripeClose(pVM->ftm.s.pStripe, fCanceled);
+            if (RT_FAILURE(rc))
+            {
+                LogRel(("FTSync/TCP: Striped stream close error: %Rrc\n", rc));
+                return rc;
+            }
+            return VINF_SUCCESS;
+        }
+
         FTMTCPHDR EofHdr;
         EofHdr.u32Magic = FTMTCPHDR_MAGIC;
         EofHdr.cb       = fCanceled ? UINT32_MAX : 0;
@@ -585,6 +666,8 @@ static DECLCALLBACK(int) ftmR3TcpOpClose(void *pvUser, bool fCanceled)
     else
     {
         ASMAtomicWriteBool(&pVM->ftm.s.syncstate.fStopReading, true);
+        if (pVM->ftm.s.pStripe)
+            SSMR3TcpStripeSetStopReading(pVM->ftm.s.pStripe, true);
     }
 
     return VINF_SUCCESS;
@@ -608,6 +691,224 @@ static SSMSTRMOPS const g_ftmR3TcpOps =
 };
 
 
+/**
+ * Sets up the stripe for transferring a state stream over the data
+ * connections, if there are any.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The VM handle.
+ */
+static int ftmR3TcpStripeCreate(PVM pVM)
+{
+    Assert(!pVM->ftm.s.pStripe);
+    if (!pVM->ftm.s.pahStreams)
+        return VINF_SUCCESS;
+    int rc = SSMR3TcpStripeCreate(pVM->ftm.s.pahStreams, pVM->ftm.s.cStreams, pVM->fFaultTolerantMaster, &pVM->ftm.s.pStripe);
+    if (RT_FAILURE(rc))
+        LogRel(("FTSync/TCP: SSMR3TcpStripeCreate -> %Rrc\n", rc));
+    return rc;
+}
+
+
+/**
+ * Destroys the stripe after a state stream has been transferred.
+ *
+ * The data connections are reused for the next state stream only if this one
+ * went thru them completely.  Otherwise there may be stale chunks left in
+ * them, so they are closed and the following transfers fall back on the
+ * control connection.  The other side does the same, either because its
+ * stripe ended badly as well or because of the NACK it sent or received.
+ *
+ * @returns VINF_SUCCESS if the data connections can be reused,
+ *          VERR_SSM_STREAM_ERROR if they were closed.
+ * @param   pVM         The VM handle.
+ * @param   fAborted    Set if the transfer failed, which always closes the
+ *                      data connections.
+ */
+static int ftmR3TcpStripeDestroy(PVM pVM, bool fAborted)
+{
+    if (!pVM->ftm.s.pStripe)
+        return VINF_SUCCESS;
+
+    bool const fReuse = !fAborted && SSMR3TcpStripeCanReuseSockets(pVM->ftm.s.pStripe);
+    SSMR3TcpStripeDestroy(pVM->ftm.s.pStripe);
+    pVM->ftm.s.pStripe = NULL;
+    if (fReuse)
+        return VINF_SUCCESS;
+
+    LogRel(("FTSync/TCP: State transfer aborted, closing the data connections\n"));
+    ftmR3TcpCloseStreams(pVM);
+    return VERR_SSM_STREAM_ERROR;
+}
+
+
+/**
+ * Destroys the stripe and closes the data connections.
+ *
+ * @param   pVM         The VM handle.
+ */
+static void ftmR3TcpCloseStreams(PVM pVM)
+{
+    ftmR3TcpStripeDestroy(pVM, true /*fAborted*/);
+    if (pVM->ftm.s.pahStreams)
+    {
+        for (uint32_t i = 0; i < SSM_TCP_STRIPE_MAX_STREAMS; i++)
+            if (pVM->ftm.s.pahStreams[i] != NIL_RTSOCKET)
+            {
+                if (pVM->fFaultTolerantMaster)
+                    RTTcpClientClose(pVM->ftm.s.pahStreams[i]);
+                else
+                    RTSocketClose(pVM->ftm.s.pahStreams[i]);
+                pVM->ftm.s.pahStreams[i] = NIL_RTSOCKET;
+            }
+        RTMemFree(pVM->ftm.s.pahStreams);
+        pVM->ftm.s.pahStreams = NULL;
+    }
+}
+
+
+/**
+ * Allocates the data connection table.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The VM handle.
+ */
+static int ftmR3TcpAllocStreams(PVM pVM)
+{
+    Assert(!pVM->ftm.s.pahStreams);
+    pVM->ftm.s.pahStreams = (PRTSOCKET)RTMemAlloc(SSM_TCP_STRIPE_MAX_STREAMS * sizeof(RTSOCKET));
+    if (!pVM->ftm.s.pahStreams)
+        return VERR_NO_MEMORY;
+    for (uint32_t i = 0; i < SSM_TCP_STRIPE_MAX_STREAMS; i++)
+        pVM->ftm.s.pahStreams[i] = NIL_RTSOCKET;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Opens and authenticates the data connections to the standby node.
+ *
+ * The connections are made one by one with the same welcome, password and
+ * ACK sequence as the control connection, so the order is the same on both
+ * ends.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The VM handle.
+ */
+static int ftmR3MasterConnectStreams(PVM pVM)
+{
+    char szCmd[32];
+    RTStrPrintf(szCmd, sizeof(szCmd), "streams=%u", pVM->ftm.s.cStreams);
+    /* The standby ACKs when it is ready to accept the connections. */
+    int rc = ftmR3TcpSubmitCommand(pVM, szCmd);
+    if (RT_FAILURE(rc))
+        LogRel(("FTSync: The standby refused the data connections (/FTM/Streams not supported?): %Rrc\n", rc));
+    else
+        rc = ftmR3TcpAllocStreams(pVM);
+    for (uint32_t i = 0; i < pVM->ftm.s.cStreams && RT_SUCCESS(rc); i++)
+    {
+        RTSOCKET hSocket;
+        rc = RTTcpClientConnect(pVM->ftm.s.pszAddress, pVM->ftm.s.uPort, &hSocket);
+        if (RT_FAILURE(rc))
+            break;
+        pVM->ftm.s.pahStreams[i] = hSocket;
+
+        char szLine[RT_MAX(128, sizeof(g_szWelcome))];
+        RT_ZERO(szLine);
+        rc = RTTcpRead(hSocket, szLine, sizeof(g_szWelcome) - 1, NULL);
+        if (RT_SUCCESS(rc) && strcmp(szLine, g_szWelcome))
+            rc = VERR_INVALID_MAGIC;
+        if (RT_SUCCESS(rc) && pVM->ftm.s.pszPassword)
+            rc = RTTcpWrite(hSocket, pVM->ftm.s.pszPassword, strlen(pVM->ftm.s.pszPassword));
+        if (RT_SUCCESS(rc))
+        {
+            RT_ZERO(szLine);
+            rc = RTTcpRead(hSocket, szLine, sizeof("ACK\n") - 1, NULL);
+            if (RT_SUCCESS(rc) && strcmp(szLine, "ACK\n"))
+                rc = VERR_AUTHENTICATION_FAILURE;
+        }
+        if (RT_FAILURE(rc))
+            LogRel(("FTSync: Data connection #%u handshake failed: %Rrc\n", i, rc));
+    }
+    if (RT_FAILURE(rc))
+    {
+        LogRel(("FTSync: Failed to set up %u data connections: %Rrc\n", pVM->ftm.s.cStreams, rc));
+        ftmR3TcpCloseStreams(pVM);
+        return rc;
+    }
+    LogRel(("FTSync: Striping the state over %u connections\n", pVM->ftm.s.cStreams));
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Accepts and authenticates the data connections announced by the master
+ * with a "streams=N" command.
+ *
+ * The command is ACKed (or NACKed) before accepting anything, the master
+ * waits for this before connecting.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The VM handle.
+ * @param   pszCount    The stream count from the command.
+ */
+static int ftmR3StandbyAcceptStreams(PVM pVM, const char *pszCount)
+{
+    uint32_t cStreams;
+    int rc = RTStrToUInt32Full(pszCount, 10, &cStreams);
+    if (   rc != VINF_SUCCESS
+        || cStreams < 2
+        || cStreams > SSM_TCP_STRIPE_MAX_STREAMS)
+    {
+        LogRel(("FTSync: Invalid stream count '%s'\n", pszCount));
+        ftmR3TcpWriteNACK(pVM, VERR_OUT_OF_RANGE, "Invalid data connection count");
+        return VERR_OUT_OF_RANGE;
+    }
+
+    rc = ftmR3TcpAllocStreams(pVM);
+    if (RT_FAILURE(rc))
+    {
+        ftmR3TcpWriteNACK(pVM, rc);
+        return rc;
+    }
+    rc = ftmR3TcpWriteACK(pVM);
+    if (RT_FAILURE(rc))
+        return rc;
+    const char *pszPassword = pVM->ftm.s.pszPassword ? pVM->ftm.s.pszPassword : "";
+    for (uint32_t i = 0; i < cStreams; i++)
+    {
+        RTSOCKET hSocket;
+        rc = RTTcpServerAcceptExtra(pVM->ftm.s.standby.hServer, 30000, &hSocket);
+        if (RT_FAILURE(rc))
+        {
+            LogRel(("FTSync: Failed to accept data connection #%u: %Rrc\n", i, rc));
+            return rc;
+        }
+        pVM->ftm.s.pahStreams[i] = hSocket;
+
+        rc = RTTcpWrite(hSocket, g_szWelcome, sizeof(g_szWelcome) - 1);
+        for (unsigned off = 0; RT_SUCCESS(rc) && pszPassword[off]; off++)
+        {
+            char ch;
+            rc = RTTcpRead(hSocket, &ch, sizeof(ch), NULL);
+            if (RT_SUCCESS(rc) && pszPassword[off] != ch)
+                rc = VERR_AUTHENTICATION_FAILURE;
+        }
+        if (RT_SUCCESS(rc))
+            rc = RTTcpWrite(hSocket, "ACK\n", sizeof("ACK\n") - 1);
+        if (RT_FAILURE(rc))
+        {
+            LogRel(("FTSync: Data connection #%u handshake failed: %Rrc\n", i, rc));
+            return rc;
+        }
+    }
+
+    pVM->ftm.s.cStreams = cStreams;
+    LogRel(("FTSync: Receiving the state over %u connections\n", cStreams));
+    return VINF_SUCCESS;
+}
+
+
 /**
  * VMR3ReqCallWait callback
  *
@@ -645,15 +946,33 @@ static int ftmR3PerformFullSync(PVM pVM)
     pVM->ftm.s.syncstate.fIOError     = false;
     pVM->ftm.s.syncstate.fEndOfStream = false;
 
-    rc = ftmR3TcpSubmitCommand(pVM, "full-sync");
-    AssertRC(rc);
+    /* Set up the stripe before announcing the sync, there is no way of
+       telling the standby to stop waiting for the state afterwards. */
+    rc = ftmR3TcpStripeCreate(pVM);
+    if (RT_SUCCESS(rc))
+    {
+        rc = ftmR3TcpSubmitCommand(pVM, "full-sync");
+        if (RT_FAILURE(rc))
+            ftmR3TcpStripeDestroy(pVM, true /*fAborted*/);
+    }
+    if (RT_FAILURE(rc))
+    {
+        LogRel(("FTSync: Failed to start the full sync: %Rrc\n", rc));
+        RTSocketRelease(pVM->ftm.s.hSocket);
+        int rc2 = VMR3Resume(pVM);
+        AssertRC(rc2);
+        return rc;
+    }
 
     pVM->ftm.s.fDeltaLoadSaveActive = false;
     rc = VMR3SaveFT(pVM, &g_ftmR3TcpOps, pVM, &fSuspended, false /* fSkipStateChanges */);
     AssertRC(rc);
+    ftmR3TcpStripeDestroy(pVM, RT_FAILURE(rc));
 
     rc = ftmR3TcpReadACK(pVM, "full-sync-complete");
     AssertRC(rc);
+    if (RT_FAILURE(rc))
+        ftmR3TcpCloseStreams(pVM); /* The standby does the same when NACKing. */
 
     RTSocketRelease(pVM->ftm.s.hSocket);
 
@@ -767,7 +1086,12 @@ static DECLCALLBACK(int) ftmR3MasterThread(RTTHREAD Thread, void *pvUser)
                     if (RT_SUCCESS(rc))
                     {
                         /** todo: verify VM config. */
-                        break;
+
+                        /* Data connections for striping the state stream. */
+                        if (pVM->ftm.s.cStreams)
+                            rc = ftmR3MasterConnectStreams(pVM);
+                        if (RT_SUCCESS(rc))
+                            break;
                     }
                 }
             }
@@ -1019,6 +1343,28 @@ static DECLCALLBACK(int) ftmR3StandbyServeConnection(RTSOCKET Sock, void *pvUser
 
     /** todo: verify VM config. */
 
+    /*
+     * The master announces data connections with its first command; they
+     * have to be accepted before the server is stopped.
+     */
+    char szCmd[128];
+    rc = ftmR3TcpReadLine(pVM, szCmd, sizeof(szCmd));
+    if (RT_FAILURE(rc))
+        return VINF_SUCCESS;
+    bool fHaveCmd = true;
+    pVM->ftm.s.cStreams = 0;
+    if (!strncmp(szCmd, "streams=", sizeof("streams=") - 1))
+    {
+        rc = ftmR3StandbyAcceptStreams(pVM, &szCmd[sizeof("streams=") - 1]);
+        if (RT_FAILURE(rc))
+        {
+            ftmR3TcpCloseStreams(pVM);
+            pVM->ftm.s.cStreams = 0;
+            return VINF_SUCCESS;
+        }
+        fHaveCmd = false;
+    }
+
     /*
      * Stop the server.
      *
@@ -1034,11 +1380,14 @@ static DECLCALLBACK(int) ftmR3StandbyServeConnection(RTSOCKET Sock, void *pvUser
     for (;;)
     {
         bool fFullSync = false;
-        char szCmd[128];
 
-        rc = ftmR3TcpReadLine(pVM, szCmd, sizeof(szCmd));
-        if (RT_FAILURE(rc))
-            break;
+        if (!fHaveCmd)
+        {
+            rc = ftmR3TcpReadLine(pVM, szCmd, sizeof(szCmd));
+            if (RT_FAILURE(rc))
+                break;
+        }
+        fHaveCmd = false;
 
         pVM->ftm.s.standby.u64LastHeartbeat = RTTimeMilliTS();
         if (!strcmp(szCmd, "mem-sync"))
@@ -1059,10 +1408,23 @@ static DECLCALLBACK(int) ftmR3StandbyServeConnection(RTSOCKET Sock, void *pvUser
             ||  !strcmp(szCmd, "full-sync")
             ||  (fFullSync = true))  /* intended assignment */
         {
+            /* Set up the stripe before acknowledging the command, the master
+               starts sending the state as soon as it gets the ACK. */
+            rc = ftmR3TcpStripeCreate(pVM);
+            if (RT_FAILURE(rc))
+            {
+                ftmR3TcpCloseStreams(pVM); /* The master does the same on the NACK. */
+                ftmR3TcpWriteNACK(pVM, rc);
+                continue;
+            }
+
             rc = ftmR3TcpWriteACK(pVM);
             AssertRC(rc);
             if (RT_FAILURE(rc))
+            {
+                ftmR3TcpStripeDestroy(pVM, true /*fAborted*/);
                 continue;
+            }
 
             /* Flush all pending memory updates. */
             if (pVM->ftm.s.standby.pPhysPageTree)
@@ -1088,14 +1450,20 @@ static DECLCALLBACK(int) ftmR3StandbyServeConnection(RTSOCKET Sock, void *pvUser
             if (RT_FAILURE(rc))
             {
                 LogRel(("FTSync: VMR3LoadFromStream -> %Rrc\n", rc));
+                ftmR3TcpStripeDestroy(pVM, true /*fAborted*/);
                 ftmR3TcpWriteNACK(pVM, rc);
                 continue;
             }
 
             /* The EOS might not have been read, make sure it is. */
             pVM->ftm.s.syncstate.fStopReading = false;
+            if (pVM->ftm.s.pStripe)
+                SSMR3TcpStripeSetStopReading(pVM->ftm.s.pStripe, false);
             size_t cbRead;
             rc = ftmR3TcpOpRead(pVM, pVM->ftm.s.syncstate.uOffStream, szCmd, 1, &cbRead);
+            int rc2 = ftmR3TcpStripeDestroy(pVM, rc != VERR_EOF);
+            if (rc == VERR_EOF && RT_FAILURE(rc2))
+                rc = rc2;   /* Closed the data connections, the master must do the same. */
             if (rc != VERR_EOF)
             {
                 LogRel(("FTSync: Draining teleporterTcpOpRead -> %Rrc\n", rc));
@@ -1253,22 +1621,39 @@ static DECLCALLBACK(VBOXSTRICTRC) ftmR3SetCheckpointRendezvous(PVM pVM, PVMCPU p
     pVM->ftm.s.syncstate.fIOError     = false;
     pVM->ftm.s.syncstate.fEndOfStream = false;
 
-    rc = ftmR3TcpSubmitCommand(pVM, "checkpoint");
-    AssertRC(rc);
-
-    pVM->ftm.s.fDeltaLoadSaveActive = true;
-    rc = VMR3SaveFT(pVM, &g_ftmR3TcpOps, pVM, &fSuspended, true /* fSkipStateChanges */);
-    pVM->ftm.s.fDeltaLoadSaveActive = false;
-    AssertRC(rc);
+    /* Set up the stripe before announcing the checkpoint, see ftmR3PerformFullSync. */
+    rc = ftmR3TcpStripeCreate(pVM);
+    if (RT_SUCCESS(rc))
+    {
+        rc = ftmR3TcpSubmitCommand(pVM, "checkpoint");
+        if (RT_FAILURE(rc))
+            ftmR3TcpStripeDestroy(pVM, true /*fAborted*/);
+    }
+    if (RT_SUCCESS(rc))
+    {
+        pVM->ftm.s.fDeltaLoadSaveActive = true;
+        rc = VMR3SaveFT(pVM, &g_ftmR3TcpOps, pVM, &fSuspended, true /* fSkipStateChanges */);
+        pVM->ftm.s.fDeltaLoadSaveActive = false;
+        AssertRC(rc);
+        ftmR3TcpStripeDestroy(pVM, RT_FAILURE(rc));
 
-    rc = ftmR3TcpReadACK(pVM, "checkpoint-complete");
-    AssertRC(rc);
+        rc = ftmR3TcpReadACK(pVM, "checkpoint-complete");
+        AssertRC(rc);
+        if (RT_FAILURE(rc))
+            ftmR3TcpCloseStreams(pVM); /* The standby does the same when NACKing. */
 
-    RTSocketRelease(pVM->ftm.s.hSocket);
+        RTSocketRelease(pVM->ftm.s.hSocket);
 
-    /* Write protect all memory. */
-    rc = PGMR3PhysWriteProtectRAM(pVM);
-    AssertRC(rc);
+        /* Write protect all memory. */
+        rc = PGMR3PhysWriteProtectRAM(pVM);
+        AssertRC(rc);
+    }
+    else
+    {
+        /* Nothing was sent, so keep tracking the dirty pages. */
+        LogRel(("FTSync: Failed to start the checkpoint: %Rrc\n", rc));
+        RTSocketRelease(pVM->ftm.s.hSocket);
+    }
 
     /** We don't call VMR3Resume here to avoid the overhead of state changes and notifications. This
      *  is only a short suspend.
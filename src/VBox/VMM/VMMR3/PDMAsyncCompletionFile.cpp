@@ -36,6 +36,7 @@
 #include <iprt/env.h>
 #include <iprt/file.h>
 #include <iprt/mem.h>
+#include <iprt/mp.h>
 #include <iprt/semaphore.h>
 #include <iprt/string.h>
 #include <iprt/thread.h>
@@ -442,6 +443,37 @@ int pdmacFileEpTaskInitiate(PPDMASYNCCOMPLETIONTASK pTask,
     return VINF_AIO_TASK_PENDING;
 }
 
+/**
+ * Returns the host CPU the next async I/O manager thread should be bound to.
+ * The managers are distributed round robin over the online CPUs.
+ *
+ * @returns Id of the CPU or NIL_RTCPUID if the thread should not be bound.
+ * @param   pEpClass    Pointer to the endpoint class data.
+ */
+static RTCPUID pdmacFileAioMgrPickCpu(PPDMASYNCCOMPLETIONEPCLASSFILE pEpClass)
+{
+    RTCPUSET OnlineSet;
+    int      cCpus;
+
+    if (!pEpClass->fAioMgrAffinity)
+        return NIL_RTCPUID;
+
+    RTMpGetOnlineSet(&OnlineSet);
+    cCpus = RTCpuSetCount(&OnlineSet);
+    if (cCpus <= 1)
+        return NIL_RTCPUID;
+
+    int iCpuWanted = (int)(ASMAtomicIncU32(&pEpClass->iAioMgrCpuNext) - 1) % cCpus;
+    for (int iCpu = 0; iCpu < RTCPUSET_MAX_CPUS; iCpu++)
+    {
+        if (   RTCpuSetIsMemberByIndex(&OnlineSet, iCpu)
+            && !iCpuWanted--)
+            return RTMpCpuIdFromSetIndex(iCpu);
+    }
+
+    return NIL_RTCPUID;
+}
+
 /**
  * Creates a new async I/O manager.
  *
@@ -467,6 +499,10 @@ int pdmacFileAioMgrCreate(PPDMASYNCCOMPLETIONEPCLASSFILE pEpClass, PPPDMACEPFILE
             pAioMgrNew->enmMgrType = pEpClass->enmMgrTypeOverride;
 
         pAioMgrNew->msBwLimitExpired = RT_INDEFINITE_WAIT;
+        pAioMgrNew->id               = ASMAtomicIncU32(&pEpClass->idAioMgrNext) - 1;
+        pAioMgrNew->idCpu            =   pAioMgrNew->enmMgrType == PDMACEPFILEMGRTYPE_SIMPLE
+                                       ? NIL_RTCPUID
+                                       : pdmacFileAioMgrPickCpu(pEpClass);
 
         rc = RTSemEventCreate(&pAioMgrNew->EventSem);
         if (RT_SUCCESS(rc))
@@ -493,7 +529,7 @@ int pdmacFileAioMgrCreate(PPDMASYNCCOMPLETIONEPCLASSFILE pEpClass, PPPDMACEPFILE
                                              0,
                                              RTTHREADTYPE_IO,
                                              0,
-                                             "AioMgr%d-%s", pEpClass->cAioMgrs,
+                                             "AioMgr%u-%s", pAioMgrNew->id,
                                              pAioMgrNew->enmMgrType == PDMACEPFILEMGRTYPE_SIMPLE
                                              ? "F"
                                              : "N");
@@ -506,8 +542,33 @@ int pdmacFileAioMgrCreate(PPDMASYNCCOMPLETIONEPCLASSFILE pEpClass, PPPDMACEPFILE
                                 pEpClass->pAioMgrHead->pPrev = pAioMgrNew;
                             pEpClass->pAioMgrHead = pAioMgrNew;
                             pEpClass->cAioMgrs++;
+                            if (pAioMgrNew->enmMgrType != PDMACEPFILEMGRTYPE_SIMPLE)
+                                pEpClass->cAioMgrsAsync++;
                             RTCritSectLeave(&pEpClass->CritSect);
 
+#ifdef VBOX_WITH_STATISTICS
+                            if (pAioMgrNew->enmMgrType != PDMACEPFILEMGRTYPE_SIMPLE)
+                            {
+                                PVM pVM = pEpClass->Core.pVM;
+
+                                STAMR3RegisterF(pVM, &pAioMgrNew->cEndpoints, STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
+                                                STAMUNIT_OCCURENCES, "Number of endpoints assigned to the manager",
+                                                "/PDM/AsyncCompletion/File/AioMgr%u/Endpoints", pAioMgrNew->id);
+                                STAMR3RegisterF(pVM, &pAioMgrNew->cRequestsActive, STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
+                                                STAMUNIT_OCCURENCES, "Number of requests currently active",
+                                                "/PDM/AsyncCompletion/File/AioMgr%u/RequestsActive", pAioMgrNew->id);
+                                STAMR3RegisterF(pVM, &pAioMgrNew->cReqsPerSec, STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
+                                                STAMUNIT_OCCURENCES, "Requests per second during the last load update period",
+                                                "/PDM/AsyncCompletion/File/AioMgr%u/ReqsPerSec", pAioMgrNew->id);
+                                STAMR3RegisterF(pVM, &pAioMgrNew->StatReqsProcessed, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                                                STAMUNIT_OCCURENCES, "Number of requests processed",
+                                                "/PDM/AsyncCompletion/File/AioMgr%u/ReqsProcessed", pAioMgrNew->id);
+                                STAMR3RegisterF(pVM, &pAioMgrNew->StatEndpointsMigrated, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                                                STAMUNIT_OCCURENCES, "Number of endpoints migrated to another manager",
+                                                "/PDM/AsyncCompletion/File/AioMgr%u/EndpointsMigrated", pAioMgrNew->id);
+                            }
+#endif
+
                             *ppAioMgr = pAioMgrNew;
 
                             Log(("PDMAC: Successfully created new file AIO Mgr {%s}\n", RTThreadGetName(pAioMgrNew->Thread)));
@@ -556,9 +617,22 @@ static void pdmacFileAioMgrDestroy(PPDMASYNCCOMPLETIONEPCLASSFILE pEpClassFile,
         pNext->pPrev = pPrev;
 
     pEpClassFile->cAioMgrs--;
+    if (pAioMgr->enmMgrType != PDMACEPFILEMGRTYPE_SIMPLE)
+        pEpClassFile->cAioMgrsAsync--;
     rc = RTCritSectLeave(&pEpClassFile->CritSect);
     AssertRC(rc);
 
+#ifdef VBOX_WITH_STATISTICS
+    if (pAioMgr->enmMgrType != PDMACEPFILEMGRTYPE_SIMPLE)
+    {
+        STAMR3Deregister(pEpClassFile->Core.pVM, &pAioMgr->cEndpoints);
+        STAMR3Deregister(pEpClassFile->Core.pVM, &pAioMgr->cRequestsActive);
+        STAMR3Deregister(pEpClassFile->Core.pVM, &pAioMgr->cReqsPerSec);
+        STAMR3Deregister(pEpClassFile->Core.pVM, &pAioMgr->StatReqsProcessed);
+        STAMR3Deregister(pEpClassFile->Core.pVM, &pAioMgr->StatEndpointsMigrated);
+    }
+#endif
+
     /* Free the resources. */
     RTCritSectDelete(&pAioMgr->CritSectBlockingEvent);
     RTSemEventDestroy(pAioMgr->EventSem);
@@ -871,6 +945,11 @@ static int pdmacFileInitialize(PPDMASYNCCOMPLETIONEPCLASS pClassGlobals, PCFGMNO
 
     PPDMASYNCCOMPLETIONEPCLASSFILE pEpClassFile = (PPDMASYNCCOMPLETIONEPCLASSFILE)pClassGlobals;
 
+    /* All endpoints share one async I/O manager by default. */
+    pEpClassFile->cEndpointsPerAioMgrMax = 0;
+    pEpClassFile->cAioMgrsAsyncMax       = RT_MAX(RTMpGetOnlineCount(), 1);
+    pEpClassFile->fAioMgrAffinity        = false;
+
     rc = RTFileAioGetLimits(&AioLimits);
 #ifdef DEBUG
     if (RT_SUCCESS(rc) && RTEnvExist("VBOX_ASYNC_IO_FAILBACK"))
@@ -887,6 +966,9 @@ static int pdmacFileInitialize(PPDMASYNCCOMPLETIONEPCLASS pClassGlobals, PCFGMNO
     {
         pEpClassFile->uBitmaskAlignment   = AioLimits.cbBufferAlignment ? ~((RTR3UINTPTR)AioLimits.cbBufferAlignment - 1) : RTR3UINTPTR_MAX;
         pEpClassFile->cReqsOutstandingMax = AioLimits.cReqsOutstandingMax;
+        pEpClassFile->fAioBufferedIo      = AioLimits.fBufferedIo;
+        if (pEpClassFile->fAioBufferedIo)
+            LogRel(("AIO: Host handles buffered files asynchronously\n"));
 
         if (pCfgNode)
         {
@@ -913,11 +995,29 @@ static int pdmacFileInitialize(PPDMASYNCCOMPLETIONEPCLASS pClassGlobals, PCFGMNO
 
             LogRel(("AIOMgr: Default file backend is \"%s\"\n", pdmacFileBackendTypeToName(pEpClassFile->enmEpBackendDefault)));
 
+            /* Query how the endpoints are spread over multiple async I/O managers. */
+            rc = CFGMR3QueryU32Def(pCfgNode, "EndpointsPerIoMgr", &pEpClassFile->cEndpointsPerAioMgrMax, 0);
+            AssertLogRelRCReturn(rc, rc);
+
+            rc = CFGMR3QueryU32Def(pCfgNode, "IoMgrMax", &pEpClassFile->cAioMgrsAsyncMax, pEpClassFile->cAioMgrsAsyncMax);
+            AssertLogRelRCReturn(rc, rc);
+            if (!pEpClassFile->cAioMgrsAsyncMax)
+                pEpClassFile->cAioMgrsAsyncMax = 1;
+
+            rc = CFGMR3QueryBoolDef(pCfgNode, "IoMgrAffinity", &pEpClassFile->fAioMgrAffinity, false);
+            AssertLogRelRCReturn(rc, rc);
+
+            if (pEpClassFile->cEndpointsPerAioMgrMax)
+                LogRel(("AIOMgr: Up to %u endpoints per I/O manager, at most %u I/O managers%s\n",
+                        pEpClassFile->cEndpointsPerAioMgrMax, pEpClassFile->cAioMgrsAsyncMax,
+                        pEpClassFile->fAioMgrAffinity ? ", bound to host CPUs" : ""));
+
 #ifdef RT_OS_LINUX
             if (   pEpClassFile->enmMgrTypeOverride == PDMACEPFILEMGRTYPE_ASYNC
-                && pEpClassFile->enmEpBackendDefault == PDMACFILEEPBACKEND_BUFFERED)
+                && pEpClassFile->enmEpBackendDefault == PDMACFILEEPBACKEND_BUFFERED
+                && !pEpClassFile->fAioBufferedIo)
             {
-                LogRel(("AIOMgr: Linux does not support buffered async I/O, changing to non buffered\n"));
+                LogRel(("AIOMgr: Linux io_submit does not support buffered async I/O, changing to non buffered\n"));
                 pEpClassFile->enmEpBackendDefault = PDMACFILEEPBACKEND_NON_BUFFERED;
             }
 #endif
@@ -974,12 +1074,14 @@ static int pdmacFileEpInitialize(PPDMASYNCCOMPLETIONENDPOINT pEndpoint,
     unsigned fFileFlags = RTFILE_O_OPEN;
 
     /*
-     * Revert to the simple manager and the buffered backend if
-     * the host cache should be enabled.
+     * Revert to the buffered backend if the host cache should be enabled.
+     * The simple manager is only required if the host can't do async I/O
+     * for buffered files.
      */
     if (fFlags & PDMACEP_FILE_FLAGS_HOST_CACHE_ENABLED)
     {
-        enmMgrType   = PDMACEPFILEMGRTYPE_SIMPLE;
+        if (!pEpClassFile->fAioBufferedIo)
+            enmMgrType = PDMACEPFILEMGRTYPE_SIMPLE;
         enmEpBackend = PDMACFILEEPBACKEND_BUFFERED;
     }
 
@@ -1030,8 +1132,11 @@ static int pdmacFileEpInitialize(PPDMASYNCCOMPLETIONENDPOINT pEndpoint,
                 enmEpBackend = PDMACFILEEPBACKEND_BUFFERED;
 
 #ifdef RT_OS_LINUX
-                fFileFlags &= ~RTFILE_O_ASYNC_IO;
-                enmMgrType   = PDMACEPFILEMGRTYPE_SIMPLE;
+                if (!pEpClassFile->fAioBufferedIo)
+                {
+                    fFileFlags &= ~RTFILE_O_ASYNC_IO;
+                    enmMgrType   = PDMACEPFILEMGRTYPE_SIMPLE;
+                }
 #endif
             }
             RTFileClose(hFile);
@@ -1059,8 +1164,11 @@ static int pdmacFileEpInitialize(PPDMASYNCCOMPLETIONENDPOINT pEndpoint,
         enmEpBackend = PDMACFILEEPBACKEND_BUFFERED;
 
 #ifdef RT_OS_LINUX
-        fFileFlags &= ~RTFILE_O_ASYNC_IO;
-        enmMgrType   = PDMACEPFILEMGRTYPE_SIMPLE;
+        if (!pEpClassFile->fAioBufferedIo)
+        {
+            fFileFlags &= ~RTFILE_O_ASYNC_IO;
+            enmMgrType   = PDMACEPFILEMGRTYPE_SIMPLE;
+        }
 #endif
 
         /* Open again. */
@@ -1111,14 +1219,19 @@ static int pdmacFileEpInitialize(PPDMASYNCCOMPLETIONENDPOINT pEndpoint,
                 }
                 else
                 {
-                    pAioMgr = pEpClassFile->pAioMgrHead;
+                    unsigned cEndpointsMin = ~0U;
+
+                    RTCritSectEnter(&pEpClassFile->CritSect);
 
-                    /* Check for an idling manager of the same type */
-                    while (pAioMgr)
+                    /* Check for the manager of the same type with the least endpoints assigned. */
+                    for (PPDMACEPFILEMGR pAioMgrCur = pEpClassFile->pAioMgrHead; pAioMgrCur; pAioMgrCur = pAioMgrCur->pNext)
                     {
-                        if (pAioMgr->enmMgrType == enmMgrType)
-                            break;
-                        pAioMgr = pAioMgr->pNext;
+                        if (   pAioMgrCur->enmMgrType == enmMgrType
+                            && pAioMgrCur->cEndpoints < cEndpointsMin)
+                        {
+                            pAioMgr       = pAioMgrCur;
+                            cEndpointsMin = pAioMgrCur->cEndpoints;
+                        }
                     }
 
                     if (!pAioMgr)
@@ -1126,6 +1239,21 @@ static int pdmacFileEpInitialize(PPDMASYNCCOMPLETIONENDPOINT pEndpoint,
                         rc = pdmacFileAioMgrCreate(pEpClassFile, &pAioMgr, enmMgrType);
                         AssertRC(rc);
                     }
+                    else if (   pEpClassFile->cEndpointsPerAioMgrMax
+                             && cEndpointsMin >= pEpClassFile->cEndpointsPerAioMgrMax
+                             && pEpClassFile->cAioMgrsAsync < pEpClassFile->cAioMgrsAsyncMax)
+                    {
+                        /* All managers are full, start another one but keep using the old ones if that fails. */
+                        PPDMACEPFILEMGR pAioMgrNew = NULL;
+
+                        int rc2 = pdmacFileAioMgrCreate(pEpClassFile, &pAioMgrNew, enmMgrType);
+                        if (RT_SUCCESS(rc2))
+                            pAioMgr = pAioMgrNew;
+                        else
+                            LogRel(("AIOMgr: Could not create new I/O manager (rc=%Rrc). Expect reduced performance\n", rc2));
+                    }
+
+                    RTCritSectLeave(&pEpClassFile->CritSect);
                 }
 
                 pEpFile->AioMgr.pTreeRangesLocked = (PAVLRFOFFTREE)RTMemAllocZ(sizeof(AVLRFOFFTREE));
@@ -1183,9 +1311,19 @@ static int pdmacFileEpClose(PPDMASYNCCOMPLETIONENDPOINT pEndpoint)
     PPDMASYNCCOMPLETIONENDPOINTFILE pEpFile = (PPDMASYNCCOMPLETIONENDPOINTFILE)pEndpoint;
     PPDMASYNCCOMPLETIONEPCLASSFILE pEpClassFile = (PPDMASYNCCOMPLETIONEPCLASSFILE)pEndpoint->pEpClass;
 
-    /* Make sure that all tasks finished for this endpoint. */
-    rc = pdmacFileAioMgrCloseEndpoint(pEpFile->pAioMgr, pEpFile);
-    AssertRC(rc);
+    /*
+     * Make sure that all tasks finished for this endpoint.
+     * The endpoint might get migrated to another manager to balance the load
+     * while the request is on the way, retry with the new one in that case.
+     */
+    PPDMACEPFILEMGR pAioMgr;
+    do
+    {
+        pAioMgr = ASMAtomicReadPtrT(&pEpFile->pAioMgr, PPDMACEPFILEMGR);
+        rc = pdmacFileAioMgrCloseEndpoint(pAioMgr, pEpFile);
+        AssertRC(rc);
+    } while (   RT_SUCCESS(rc)
+             && pAioMgr != ASMAtomicReadPtrT(&pEpFile->pAioMgr, PPDMACEPFILEMGR));
 
     /*
      * If the async I/O manager is in failsafe mode this is the only endpoint
@@ -31,6 +31,9 @@
 #define PDMACEPFILEMGR_LOAD_UPDATE_PERIOD 1000
 /** Maximum number of requests a manager will handle. */
 #define PDMACEPFILEMGR_REQS_STEP 512
+/** Minimum load difference in requests per second between two managers
+ * before endpoints are migrated to balance the load. */
+#define PDMACEPFILEMGR_BALANCE_THRESHOLD 100
 
 /*******************************************************************************
 *   Internal functions                                                         *
@@ -216,7 +219,7 @@ static bool pdmacFileAioMgrNormalRemoveEndpoint(PPDMASYNCCOMPLETIONENDPOINTFILE
 static bool pdmacFileAioMgrNormalIsBalancePossible(PPDMACEPFILEMGR pAioMgr)
 {
     /* Balancing doesn't make sense with only one endpoint. */
-    if (pAioMgr->cEndpoints == 1)
+    if (pAioMgr->cEndpoints <= 1)
         return false;
 
     /* Doesn't make sens to move endpoints if only one produces the whole load */
@@ -236,82 +239,161 @@ static bool pdmacFileAioMgrNormalIsBalancePossible(PPDMACEPFILEMGR pAioMgr)
 }
 
 /**
- * Creates a new I/O manager and spreads the I/O load of the endpoints
- * between the given I/O manager and the new one.
+ * Migrates an endpoint without any active requests to the destination manager
+ * set in the endpoint.
  *
- * @returns nothing.
+ * @returns VBox status code.
+ * @param   pAioMgr      The I/O manager the endpoint is currently assigned to.
+ * @param   pEndpoint    The endpoint to migrate.
+ */
+static int pdmacFileAioMgrNormalEndpointMigrate(PPDMACEPFILEMGR pAioMgr, PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint)
+{
+    PPDMASYNCCOMPLETIONEPCLASSFILE pEpClassFile = (PPDMASYNCCOMPLETIONEPCLASSFILE)pEndpoint->Core.pEpClass;
+    PPDMACEPFILEMGR pAioMgrDst = pEndpoint->AioMgr.pAioMgrDst;
+
+    AssertPtr(pAioMgrDst);
+    Assert(pEndpoint->pAioMgr == pAioMgr);
+
+    bool fReqsPending = pdmacFileAioMgrNormalRemoveEndpoint(pEndpoint);
+    Assert(!fReqsPending);
+
+    pEndpoint->AioMgr.fMoving     = false;
+    pEndpoint->AioMgr.pAioMgrDst  = NULL;
+    pEndpoint->AioMgr.cReqsPerSec = 0;
+
+    /* Reopen the file so that the new manager can associate it with its context. */
+    RTFileClose(pEndpoint->hFile);
+    int rc = RTFileOpen(&pEndpoint->hFile, pEndpoint->Core.pszUri, pEndpoint->fFlags);
+    if (RT_SUCCESS(rc))
+        rc = pdmacFileAioMgrAddEndpoint(pAioMgrDst, pEndpoint);
+
+    /*
+     * Allow the next endpoint to be moved if this one was migrated to balance the load.
+     * This must not happen before the destination took over or two managers
+     * could wait for each other adding an endpoint.
+     */
+    if (pAioMgrDst->enmMgrType != PDMACEPFILEMGRTYPE_SIMPLE)
+    {
+        STAM_COUNTER_INC(&pAioMgr->StatEndpointsMigrated);
+        ASMAtomicWriteBool(&pEpClassFile->fAioMgrBalancing, false);
+    }
+
+    return rc;
+}
+
+/**
+ * Moves one endpoint of the given I/O manager to the least loaded other async
+ * I/O manager if the load difference is big enough. The endpoint is migrated
+ * immediately if there is no request active for it, otherwise it is not
+ * serviced anymore and migrated after the last request completed.
+ *
+ * @returns VBox status code.
  * @param   pAioMgr    The I/O manager with high I/O load.
  */
-static void pdmacFileAioMgrNormalBalanceLoad(PPDMACEPFILEMGR pAioMgr)
+static int pdmacFileAioMgrNormalBalanceLoad(PPDMACEPFILEMGR pAioMgr)
 {
-    PPDMACEPFILEMGR pAioMgrNew = NULL;
+    PPDMACEPFILEMGR pAioMgrDst = NULL;
     int rc = VINF_SUCCESS;
 
     /*
      * Check if balancing would improve the situation.
      */
-    if (pdmacFileAioMgrNormalIsBalancePossible(pAioMgr))
-    {
-        PPDMASYNCCOMPLETIONEPCLASSFILE pEpClassFile = (PPDMASYNCCOMPLETIONEPCLASSFILE)pAioMgr->pEndpointsHead->Core.pEpClass;
+    if (!pdmacFileAioMgrNormalIsBalancePossible(pAioMgr))
+        return VINF_SUCCESS;
 
-        rc = pdmacFileAioMgrCreate(pEpClassFile, &pAioMgrNew, PDMACEPFILEMGRTYPE_ASYNC);
-        if (RT_SUCCESS(rc))
-        {
-            /* We will sort the list by request count per second. */
-            pdmacFileAioMgrNormalEndpointsSortByLoad(pAioMgr);
+    PPDMASYNCCOMPLETIONEPCLASSFILE pEpClassFile = (PPDMASYNCCOMPLETIONEPCLASSFILE)pAioMgr->pEndpointsHead->Core.pEpClass;
 
-            /* Now move some endpoints to the new manager. */
-            unsigned cReqsHere  = pAioMgr->pEndpointsHead->AioMgr.cReqsPerSec;
-            unsigned cReqsOther = 0;
-            PPDMASYNCCOMPLETIONENDPOINTFILE pCurr = pAioMgr->pEndpointsHead->AioMgr.pEndpointNext;
+    if (pEpClassFile->cAioMgrsAsync <= 1)
+        return VINF_SUCCESS;
 
-            while (pCurr)
-            {
-                if (cReqsHere <= cReqsOther)
-                {
-                    /*
-                     * The other manager has more requests to handle now.
-                     * We will keep the current endpoint.
-                     */
-                    Log(("Keeping endpoint %#p{%s} with %u reqs/s\n", pCurr->Core.pszUri, pCurr->AioMgr.cReqsPerSec));
-                    cReqsHere += pCurr->AioMgr.cReqsPerSec;
-                    pCurr = pCurr->AioMgr.pEndpointNext;
-                }
-                else
-                {
-                    /* Move to other endpoint. */
-                    Log(("Moving endpoint %#p{%s} with %u reqs/s to other manager\n", pCurr, pCurr->Core.pszUri, pCurr->AioMgr.cReqsPerSec));
-                    cReqsOther += pCurr->AioMgr.cReqsPerSec;
+    /* Only one endpoint is moved at a time. */
+    if (!ASMAtomicCmpXchgBool(&pEpClassFile->fAioMgrBalancing, true, false))
+        return VINF_SUCCESS;
 
-                    PPDMASYNCCOMPLETIONENDPOINTFILE pMove = pCurr;
+    /* Look for the least loaded manager which has room for another endpoint. */
+    RTCritSectEnter(&pEpClassFile->CritSect);
+    for (PPDMACEPFILEMGR pAioMgrCur = pEpClassFile->pAioMgrHead; pAioMgrCur; pAioMgrCur = pAioMgrCur->pNext)
+    {
+        if (   pAioMgrCur != pAioMgr
+            && pAioMgrCur->enmMgrType != PDMACEPFILEMGRTYPE_SIMPLE
+            && pAioMgrCur->enmState == PDMACEPFILEMGRSTATE_RUNNING
+            && (   !pEpClassFile->cEndpointsPerAioMgrMax
+                || pAioMgrCur->cEndpoints < pEpClassFile->cEndpointsPerAioMgrMax)
+            && (   !pAioMgrDst
+                || ASMAtomicReadU32(&pAioMgrCur->cReqsPerSec) < ASMAtomicReadU32(&pAioMgrDst->cReqsPerSec)))
+            pAioMgrDst = pAioMgrCur;
+    }
+    RTCritSectLeave(&pEpClassFile->CritSect);
 
-                    pCurr = pCurr->AioMgr.pEndpointNext;
+    uint32_t cReqsPerSecDst = pAioMgrDst ? ASMAtomicReadU32(&pAioMgrDst->cReqsPerSec) : 0;
+    if (   !pAioMgrDst
+        || pAioMgr->cReqsPerSec < cReqsPerSecDst + PDMACEPFILEMGR_BALANCE_THRESHOLD
+        || pAioMgr->cReqsPerSec < 2 * cReqsPerSecDst)
+    {
+        Log(("AIOMgr: Load balancing would not improve anything\n"));
+        ASMAtomicWriteBool(&pEpClassFile->fAioMgrBalancing, false);
+        return VINF_SUCCESS;
+    }
 
-                    bool fReqsPending = pdmacFileAioMgrNormalRemoveEndpoint(pMove);
+    /*
+     * Pick the endpoint which gets both managers closest to half of the
+     * combined load. Moving an endpoint with a load equal or higher than
+     * the difference doesn't improve anything.
+     */
+    pdmacFileAioMgrNormalEndpointsSortByLoad(pAioMgr);
 
-                    if (fReqsPending)
-                    {
-                        pMove->enmState          = PDMASYNCCOMPLETIONENDPOINTFILESTATE_REMOVING;
-                        pMove->AioMgr.fMoving    = true;
-                        pMove->AioMgr.pAioMgrDst = pAioMgrNew;
-                    }
-                    else
-                    {
-                        pMove->AioMgr.fMoving    = false;
-                        pMove->AioMgr.pAioMgrDst = NULL;
-                        pdmacFileAioMgrAddEndpoint(pAioMgrNew, pMove);
-                    }
-                }
-            }
-        }
-        else
+    uint32_t cReqsPerSecDiff = pAioMgr->cReqsPerSec - cReqsPerSecDst;
+    PPDMASYNCCOMPLETIONENDPOINTFILE pMove = NULL;
+    uint32_t cReqsPerSecMoveDelta = cReqsPerSecDiff;
+
+    for (PPDMASYNCCOMPLETIONENDPOINTFILE pCurr = pAioMgr->pEndpointsHead;
+         pCurr;
+         pCurr = pCurr->AioMgr.pEndpointNext)
+    {
+        uint32_t cReqsPerSec = pCurr->AioMgr.cReqsPerSec;
+
+        if (   !cReqsPerSec
+            || cReqsPerSec >= cReqsPerSecDiff
+            || pCurr->AioMgr.fMoving
+            || pCurr->pFlushReq
+            || pCurr->enmState != PDMASYNCCOMPLETIONENDPOINTFILESTATE_ACTIVE)
+            continue;
+
+        /* The load difference after the endpoint was moved. */
+        uint32_t cReqsPerSecDelta =   2 * cReqsPerSec > cReqsPerSecDiff
+                                    ? 2 * cReqsPerSec - cReqsPerSecDiff
+                                    : cReqsPerSecDiff - 2 * cReqsPerSec;
+        if (cReqsPerSecDelta < cReqsPerSecMoveDelta)
         {
-            /* Don't process further but leave a log entry about reduced performance. */
-            LogRel(("AIOMgr: Could not create new I/O manager (rc=%Rrc). Expect reduced performance\n", rc));
+            pMove                = pCurr;
+            cReqsPerSecMoveDelta = cReqsPerSecDelta;
         }
     }
-    else
-        Log(("AIOMgr: Load balancing would not improve anything\n"));
+
+    if (!pMove)
+    {
+        ASMAtomicWriteBool(&pEpClassFile->fAioMgrBalancing, false);
+        return VINF_SUCCESS;
+    }
+
+    Log(("AIOMgr: Moving endpoint %#p{%s} with %u reqs/s from %s (%u reqs/s) to %s (%u reqs/s)\n",
+         pMove, pMove->Core.pszUri, pMove->AioMgr.cReqsPerSec,
+         RTThreadGetName(pAioMgr->Thread), pAioMgr->cReqsPerSec,
+         RTThreadGetName(pAioMgrDst->Thread), cReqsPerSecDst));
+
+    pAioMgr->cReqsPerSec    -= pMove->AioMgr.cReqsPerSec;
+    pMove->AioMgr.fMoving    = true;
+    pMove->AioMgr.pAioMgrDst = pAioMgrDst;
+
+    /*
+     * Migrate now if there is nothing in flight, the endpoint isn't serviced
+     * anymore otherwise and the migration happens when the last active
+     * request completed.
+     */
+    if (!pMove->AioMgr.cRequestsActive)
+        rc = pdmacFileAioMgrNormalEndpointMigrate(pAioMgr, pMove);
+
+    return rc;
 }
 
 /**
@@ -1092,17 +1174,8 @@ static int pdmacFileAioMgrNormalProcessTaskList(PPDMACTASKFILE pTaskHead,
         if (RT_UNLIKELY(   pAioMgr->cRequestsActiveMax == pAioMgr->cRequestsActive
                         && !pEndpoint->pFlushReq))
         {
-#if 0
-            /*
-             * The I/O manager has no room left for more requests
-             * but there are still requests to process.
-             * Create a new I/O manager and let it handle some endpoints.
-             */
-            pdmacFileAioMgrNormalBalanceLoad(pAioMgr);
-#else
-            /* Grow the I/O manager */
+            /* Grow the I/O manager, the load is spread over the other managers periodically. */
             pAioMgr->enmState = PDMACEPFILEMGRSTATE_GROWING;
-#endif
         }
     }
 
@@ -1207,8 +1280,24 @@ static int pdmacFileAioMgrNormalProcessBlockingEvent(PPDMACEPFILEMGR pAioMgr)
             PPDMASYNCCOMPLETIONENDPOINTFILE pEndpointClose = ASMAtomicReadPtrT(&pAioMgr->BlockingEventData.CloseEndpoint.pEndpoint, PPDMASYNCCOMPLETIONENDPOINTFILE);
             AssertMsg(VALID_PTR(pEndpointClose), ("Close endpoint event without a endpoint to close\n"));
 
-            if (pEndpointClose->enmState == PDMASYNCCOMPLETIONENDPOINTFILESTATE_ACTIVE)
+            if (pEndpointClose->pAioMgr != pAioMgr)
             {
+                /* The endpoint was migrated to another manager in the meantime, the caller retries there. */
+                fNotifyWaiter = true;
+            }
+            else if (pEndpointClose->enmState == PDMASYNCCOMPLETIONENDPOINTFILESTATE_ACTIVE)
+            {
+                /* Cancel a pending migration, the endpoint goes away. */
+                if (pEndpointClose->AioMgr.fMoving)
+                {
+                    PPDMACEPFILEMGR pAioMgrDst = pEndpointClose->AioMgr.pAioMgrDst;
+
+                    pEndpointClose->AioMgr.fMoving    = false;
+                    pEndpointClose->AioMgr.pAioMgrDst = NULL;
+                    if (pAioMgrDst && pAioMgrDst->enmMgrType != PDMACEPFILEMGRTYPE_SIMPLE)
+                        ASMAtomicWriteBool(&((PPDMASYNCCOMPLETIONEPCLASSFILE)pEndpointClose->Core.pEpClass)->fAioMgrBalancing, false);
+                }
+
                 LogFlowFunc((": Closing endpoint %#p{%s}\n", pEndpointClose, pEndpointClose->Core.pszUri));
 
                 /* Make sure all tasks finished. Process the queues a last time first. */
@@ -1343,6 +1432,7 @@ static void pdmacFileAioMgrNormalReqCompleteRc(PPDMACEPFILEMGR pAioMgr, RTFILEAI
     pAioMgr->cRequestsActive--;
     pEndpoint->AioMgr.cRequestsActive--;
     pEndpoint->AioMgr.cReqsProcessed++;
+    STAM_COUNTER_INC(&pAioMgr->StatReqsProcessed);
 
     /*
      * It is possible that the request failed on Linux with kernels < 2.6.23
@@ -1384,10 +1474,15 @@ static void pdmacFileAioMgrNormalReqCompleteRc(PPDMACEPFILEMGR pAioMgr, RTFILEAI
                 pEndpoint->AioMgr.pReqsPendingHead = pTask;
 
                 /* Create a new failsafe manager if necessary. */
-                if (!pEndpoint->AioMgr.fMoving)
+                if (   !pEndpoint->AioMgr.fMoving
+                    || pEndpoint->AioMgr.pAioMgrDst->enmMgrType != PDMACEPFILEMGRTYPE_SIMPLE)
                 {
                     PPDMACEPFILEMGR pAioMgrFailsafe;
 
+                    /* The failsafe manager supersedes a pending migration to balance the load. */
+                    if (pEndpoint->AioMgr.fMoving)
+                        ASMAtomicWriteBool(&((PPDMASYNCCOMPLETIONEPCLASSFILE)pEndpoint->Core.pEpClass)->fAioMgrBalancing, false);
+
                     LogRel(("%s: Request %#p failed with rc=%Rrc, migrating endpoint %s to failsafe manager.\n",
                             RTThreadGetName(pAioMgr->Thread), pTask, rcReq, pEndpoint->Core.pszUri));
 
@@ -1406,11 +1501,9 @@ static void pdmacFileAioMgrNormalReqCompleteRc(PPDMACEPFILEMGR pAioMgr, RTFILEAI
                 /* If this was the last request for the endpoint migrate it to the new manager. */
                 if (!pEndpoint->AioMgr.cRequestsActive)
                 {
-                    bool fReqsPending = pdmacFileAioMgrNormalRemoveEndpoint(pEndpoint);
-                    Assert(!fReqsPending);
-
-                    rc = pdmacFileAioMgrAddEndpoint(pEndpoint->AioMgr.pAioMgrDst, pEndpoint);
-                    AssertRC(rc);
+                    rc = pdmacFileAioMgrNormalEndpointMigrate(pAioMgr, pEndpoint);
+                    if (RT_FAILURE(rc))
+                        pdmacFileAioMgrNormalErrorHandler(pAioMgr, rc, RT_SRC_POS);
                 }
             }
             else
@@ -1563,11 +1656,9 @@ static void pdmacFileAioMgrNormalReqCompleteRc(PPDMACEPFILEMGR pAioMgr, RTFILEAI
                 else if (RT_UNLIKELY(!pEndpoint->AioMgr.cRequestsActive && pEndpoint->AioMgr.fMoving))
                 {
                     /* If the endpoint is about to be migrated do it now. */
-                    bool fReqsPending = pdmacFileAioMgrNormalRemoveEndpoint(pEndpoint);
-                    Assert(!fReqsPending);
-
-                    rc = pdmacFileAioMgrAddEndpoint(pEndpoint->AioMgr.pAioMgrDst, pEndpoint);
-                    AssertRC(rc);
+                    rc = pdmacFileAioMgrNormalEndpointMigrate(pAioMgr, pEndpoint);
+                    if (RT_FAILURE(rc))
+                        pdmacFileAioMgrNormalErrorHandler(pAioMgr, rc, RT_SRC_POS);
                 }
             }
         } /* Not a flush request */
@@ -1595,6 +1686,15 @@ int pdmacFileAioMgrNormal(RTTHREAD ThreadSelf, void *pvUser)
     PPDMACEPFILEMGR pAioMgr = (PPDMACEPFILEMGR)pvUser;
     uint64_t uMillisEnd     = RTTimeMilliTS() + PDMACEPFILEMGR_LOAD_UPDATE_PERIOD;
 
+    if (pAioMgr->idCpu != NIL_RTCPUID)
+    {
+        rc = RTThreadSetAffinityToCpu(pAioMgr->idCpu);
+        if (RT_FAILURE(rc))
+            LogRel(("AIOMgr: Failed to bind %s to CPU %u (rc=%Rrc)\n",
+                    RTThreadGetName(ThreadSelf), pAioMgr->idCpu, rc));
+        rc = VINF_SUCCESS;
+    }
+
     while (   (pAioMgr->enmState == PDMACEPFILEMGRSTATE_RUNNING)
            || (pAioMgr->enmState == PDMACEPFILEMGRSTATE_SUSPENDING)
            || (pAioMgr->enmState == PDMACEPFILEMGRSTATE_GROWING))
@@ -1662,17 +1762,26 @@ int pdmacFileAioMgrNormal(RTTHREAD ThreadSelf, void *pvUser)
                 if (uMillisCurr > uMillisEnd)
                 {
                     PPDMASYNCCOMPLETIONENDPOINTFILE pEndpointCurr = pAioMgr->pEndpointsHead;
+                    uint32_t cReqsPerSec = 0;
 
                     /* Calculate timespan. */
                     uMillisCurr -= uMillisEnd;
+                    uMillisCurr += PDMACEPFILEMGR_LOAD_UPDATE_PERIOD;
 
                     while (pEndpointCurr)
                     {
-                        pEndpointCurr->AioMgr.cReqsPerSec    = pEndpointCurr->AioMgr.cReqsProcessed / (uMillisCurr + PDMACEPFILEMGR_LOAD_UPDATE_PERIOD);
+                        pEndpointCurr->AioMgr.cReqsPerSec    = (unsigned)((uint64_t)pEndpointCurr->AioMgr.cReqsProcessed * 1000 / uMillisCurr);
                         pEndpointCurr->AioMgr.cReqsProcessed = 0;
+                        cReqsPerSec += pEndpointCurr->AioMgr.cReqsPerSec;
                         pEndpointCurr = pEndpointCurr->AioMgr.pEndpointNext;
                     }
 
+                    ASMAtomicWriteU32(&pAioMgr->cReqsPerSec, cReqsPerSec);
+
+                    /* Move some load to another manager if this one is much busier. */
+                    rc = pdmacFileAioMgrNormalBalanceLoad(pAioMgr);
+                    CHECK_RC(pAioMgr, rc);
+
                     /* Set new update interval */
                     uMillisEnd = RTTimeMilliTS() + PDMACEPFILEMGR_LOAD_UPDATE_PERIOD;
                 }
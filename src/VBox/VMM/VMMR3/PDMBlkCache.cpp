@@ -16,7 +16,24 @@
  */
 
 /** @page pg_pdm_block_cache     PDM Block Cache - The I/O cache
- * This component implements an I/O cache based on the 2Q cache algorithm.
+ * This component implements an I/O cache based on the ARC (adaptive
+ * replacement cache) algorithm.
+ *
+ * Entries accessed once are kept in the recently used list, entries accessed
+ * more than once in the frequently used list. Evicted entries are kept without
+ * data in a ghost list per resident list. A hit in one of the ghost lists
+ * shifts the target size of the recently used list towards the list the entry
+ * was evicted from.
+ *
+ * The cache is shared between all users of a VM. Each user has a minimum
+ * amount of cached data other users can't evict and a maximum it can occupy.
+ * Sequential read streams are detected per user. If the user told the cache
+ * the size of the medium, data ahead of a stream is prefetched in a window
+ * which grows when prefetched data gets accessed and shrinks when it is
+ * evicted unused. Entries read as part of a stream are not promoted to the
+ * frequently used list. Without read-ahead, reads which are part of a long
+ * sequential run and miss the cache are passed through to keep streaming
+ * access from flushing the working set.
  */
 
 /*******************************************************************************
@@ -72,6 +89,7 @@
 static PPDMBLKCACHEENTRY pdmBlkCacheEntryAlloc(PPDMBLKCACHE pBlkCache,
                                                uint64_t off, size_t cbData, uint8_t *pbBuffer);
 static bool pdmBlkCacheAddDirtyEntry(PPDMBLKCACHE pBlkCache, PPDMBLKCACHEENTRY pEntry);
+static void pdmBlkCacheReadAheadWasted(PPDMBLKCACHEGLOBAL pCache, PPDMBLKCACHEENTRY pEntry);
 
 /**
  * Decrement the reference counter of the given cache entry.
@@ -109,6 +127,9 @@ static void pdmBlkCacheValidate(PPDMBLKCACHEGLOBAL pCache)
 
     AssertMsg(pCache->LruRecentlyUsedOut.cbCached <= pCache->cbRecentlyUsedOutMax,
               ("Paged out list exceeds maximum\n"));
+
+    AssertMsg(pCache->LruFrequentlyUsedOut.cbCached <= pCache->cbFrequentlyUsedOutMax,
+              ("Frequently used paged out list exceeds maximum\n"));
 }
 #endif
 
@@ -128,16 +149,18 @@ DECLINLINE(void) pdmBlkCacheLockLeave(PPDMBLKCACHEGLOBAL pCache)
     RTCritSectLeave(&pCache->CritSect);
 }
 
-DECLINLINE(void) pdmBlkCacheSub(PPDMBLKCACHEGLOBAL pCache, uint32_t cbAmount)
+DECLINLINE(void) pdmBlkCacheSub(PPDMBLKCACHEGLOBAL pCache, PPDMBLKCACHE pBlkCache, uint32_t cbAmount)
 {
     PDMACFILECACHE_IS_CRITSECT_OWNER(pCache);
     pCache->cbCached -= cbAmount;
+    pBlkCache->cbCached -= cbAmount;
 }
 
-DECLINLINE(void) pdmBlkCacheAdd(PPDMBLKCACHEGLOBAL pCache, uint32_t cbAmount)
+DECLINLINE(void) pdmBlkCacheAdd(PPDMBLKCACHEGLOBAL pCache, PPDMBLKCACHE pBlkCache, uint32_t cbAmount)
 {
     PDMACFILECACHE_IS_CRITSECT_OWNER(pCache);
     pCache->cbCached += cbAmount;
+    pBlkCache->cbCached += cbAmount;
 }
 
 DECLINLINE(void) pdmBlkCacheListAdd(PPDMBLKLRULIST pList, uint32_t cbAmount)
@@ -300,6 +323,26 @@ static void pdmBlkCacheDestroyList(PPDMBLKLRULIST pList)
     }
 }
 
+/**
+ * Checks whether the given entry may be evicted on behalf of the given user
+ * honoring the minimum quota of the owner.
+ *
+ * @returns true if the entry may be evicted, false otherwise.
+ * @param   pEntry        The entry to check.
+ * @param   pBlkCacheReq  The user requesting the space.
+ * @param   fOwnOnly      Flag whether only entries of the requesting user may be evicted.
+ */
+DECLINLINE(bool) pdmBlkCacheEntryIsEvictableBy(PPDMBLKCACHEENTRY pEntry, PPDMBLKCACHE pBlkCacheReq, bool fOwnOnly)
+{
+    PPDMBLKCACHE pBlkCacheOwner = pEntry->pBlkCache;
+
+    if (pBlkCacheOwner == pBlkCacheReq)
+        return true;
+
+    return    !fOwnOnly
+           && (uint64_t)pBlkCacheOwner->cbCached >= (uint64_t)pBlkCacheOwner->cbMin + pEntry->cbData;
+}
+
 /**
  * Tries to remove the given amount of bytes from a given list in the cache
  * moving the entries to one of the given ghosts lists
@@ -310,26 +353,36 @@ static void pdmBlkCacheDestroyList(PPDMBLKLRULIST pList)
  * @param    pListSrc         The source list to evict data from.
  * @param    pGhostListSrc    The ghost list removed entries should be moved to
  *                            NULL if the entry should be freed.
+ * @param    pBlkCacheReq     The user the space is freed for.
+ * @param    fOwnOnly         Flag whether to evict only entries of pBlkCacheReq.
  * @param    fReuseBuffer     Flag whether a buffer should be reused if it has the same size
  * @param    ppbBuf           Where to store the address of the buffer if an entry with the
  *                            same size was found and fReuseBuffer is true.
  *
  * @note    This function may return fewer bytes than requested because entries
  *          may be marked as non evictable if they are used for I/O at the
- *          moment.
+ *          moment or belong to a user which is at its minimum quota.
  */
 static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData,
                                         PPDMBLKLRULIST pListSrc, PPDMBLKLRULIST pGhostListDst,
+                                        PPDMBLKCACHE pBlkCacheReq, bool fOwnOnly,
                                         bool fReuseBuffer, uint8_t **ppbBuffer)
 {
     size_t cbEvicted = 0;
+    uint32_t cbGhostMax = 0;
 
     PDMACFILECACHE_IS_CRITSECT_OWNER(pCache);
 
     AssertMsg(cbData > 0, ("Evicting 0 bytes not possible\n"));
     AssertMsg(   !pGhostListDst
-              || (pGhostListDst == &pCache->LruRecentlyUsedOut),
-              ("Destination list must be NULL or the recently used but paged out list\n"));
+              || (pGhostListDst == &pCache->LruRecentlyUsedOut)
+              || (pGhostListDst == &pCache->LruFrequentlyUsedOut),
+              ("Destination list must be NULL or one of the paged out lists\n"));
+
+    if (pGhostListDst == &pCache->LruRecentlyUsedOut)
+        cbGhostMax = pCache->cbRecentlyUsedOutMax;
+    else if (pGhostListDst == &pCache->LruFrequentlyUsedOut)
+        cbGhostMax = pCache->cbFrequentlyUsedOutMax;
 
     if (fReuseBuffer)
     {
@@ -348,7 +401,8 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
 
         /* We can't evict pages which are currently in progress or dirty but not in progress */
         if (   !(pCurr->fFlags & PDMBLKCACHE_NOT_EVICTABLE)
-            && (ASMAtomicReadU32(&pCurr->cRefs) == 0))
+            && (ASMAtomicReadU32(&pCurr->cRefs) == 0)
+            && pdmBlkCacheEntryIsEvictableBy(pCurr, pBlkCacheReq, fOwnOnly))
         {
             /* Ok eviction candidate. Grab the endpoint semaphore and check again
              * because somebody else might have raced us. */
@@ -360,6 +414,9 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
             {
                 LogFlow(("Evicting entry %#p (%u bytes)\n", pCurr, pCurr->cbData));
 
+                if (pCurr->fFlags & PDMBLKCACHE_ENTRY_PREFETCHED)
+                    pdmBlkCacheReadAheadWasted(pCache, pCurr);
+
                 if (fReuseBuffer && (pCurr->cbData == cbData))
                 {
                     STAM_COUNTER_INC(&pCache->StatBuffersReused);
@@ -372,7 +429,7 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
                 cbEvicted += pCurr->cbData;
 
                 pdmBlkCacheEntryRemoveFromList(pCurr);
-                pdmBlkCacheSub(pCache, pCurr->cbData);
+                pdmBlkCacheSub(pCache, pBlkCache, pCurr->cbData);
 
                 if (pGhostListDst)
                 {
@@ -381,7 +438,7 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
                     PPDMBLKCACHEENTRY pGhostEntFree = pGhostListDst->pTail;
 
                     /* We have to remove the last entries from the paged out list. */
-                    while (   ((pGhostListDst->cbCached + pCurr->cbData) > pCache->cbRecentlyUsedOutMax)
+                    while (   ((pGhostListDst->cbCached + pCurr->cbData) > cbGhostMax)
                            && pGhostEntFree)
                     {
                         PPDMBLKCACHEENTRY pFree = pGhostEntFree;
@@ -405,7 +462,7 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
                         RTSemRWReleaseWrite(pBlkCacheFree->SemRWEntries);
                     }
 
-                    if (pGhostListDst->cbCached + pCurr->cbData > pCache->cbRecentlyUsedOutMax)
+                    if (pGhostListDst->cbCached + pCurr->cbData > cbGhostMax)
                     {
                         /* Couldn't remove enough entries. Delete */
                         STAM_PROFILE_ADV_START(&pCache->StatTreeRemove, Cache);
@@ -437,47 +494,234 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
     return cbEvicted;
 }
 
-static bool pdmBlkCacheReclaim(PPDMBLKCACHEGLOBAL pCache, size_t cbData, bool fReuseBuffer, uint8_t **ppbBuffer)
+/**
+ * Evicts the given amount of data from the resident lists moving the entries
+ * to the matching ghost list.
+ *
+ * @returns Amount of data which could be freed.
+ * @param   pCache        Pointer to the global cache data.
+ * @param   pBlkCacheReq  The user the space is freed for.
+ * @param   cbData        The amount of data to free.
+ * @param   fOwnOnly      Flag whether to evict only entries of pBlkCacheReq.
+ * @param   fReuseBuffer  Flag whether a buffer should be reused if it has the same size.
+ * @param   ppbBuffer     Where to store the address of the buffer to reuse.
+ */
+static size_t pdmBlkCacheEvict(PPDMBLKCACHEGLOBAL pCache, PPDMBLKCACHE pBlkCacheReq, size_t cbData,
+                               bool fOwnOnly, bool fReuseBuffer, uint8_t **ppbBuffer)
 {
+    PPDMBLKLRULIST pListFirst       = &pCache->LruFrequentlyUsed;
+    PPDMBLKLRULIST pGhostListFirst  = &pCache->LruFrequentlyUsedOut;
+    PPDMBLKLRULIST pListSecond      = &pCache->LruRecentlyUsedIn;
+    PPDMBLKLRULIST pGhostListSecond = &pCache->LruRecentlyUsedOut;
     size_t cbRemoved = 0;
 
-    if ((pCache->cbCached + cbData) < pCache->cbMax)
-        return true;
-    else if ((pCache->LruRecentlyUsedIn.cbCached + cbData) > pCache->cbRecentlyUsedInMax)
+    /* Evict from the recently used list if it exceeds its target size. */
+    if (   pCache->LruRecentlyUsedIn.cbCached > pCache->cbRecentlyUsedInTarget
+        || !pCache->LruFrequentlyUsed.cbCached)
     {
-        /* Try to evict as many bytes as possible from A1in */
-        cbRemoved = pdmBlkCacheEvictPagesFrom(pCache, cbData, &pCache->LruRecentlyUsedIn,
-                                                 &pCache->LruRecentlyUsedOut, fReuseBuffer, ppbBuffer);
+        pListFirst       = &pCache->LruRecentlyUsedIn;
+        pGhostListFirst  = &pCache->LruRecentlyUsedOut;
+        pListSecond      = &pCache->LruFrequentlyUsed;
+        pGhostListSecond = &pCache->LruFrequentlyUsedOut;
+    }
+
+    cbRemoved = pdmBlkCacheEvictPagesFrom(pCache, cbData, pListFirst, pGhostListFirst,
+                                          pBlkCacheReq, fOwnOnly, fReuseBuffer, ppbBuffer);
+
+    /*
+     * If it was not possible to remove enough entries
+     * try the other list.
+     */
+    if (cbRemoved < cbData)
+    {
+        Assert(!fReuseBuffer || !*ppbBuffer); /* It is not possible that we got a buffer with the correct size but we didn't freed enough data. */
 
         /*
-         * If it was not possible to remove enough entries
-         * try the frequently accessed cache.
+         * If we removed something we can't pass the reuse buffer flag anymore because
+         * we don't need to evict that much data
          */
-        if (cbRemoved < cbData)
+        if (!cbRemoved)
+            cbRemoved += pdmBlkCacheEvictPagesFrom(pCache, cbData, pListSecond, pGhostListSecond,
+                                                   pBlkCacheReq, fOwnOnly, fReuseBuffer, ppbBuffer);
+        else
+            cbRemoved += pdmBlkCacheEvictPagesFrom(pCache, cbData - cbRemoved, pListSecond, pGhostListSecond,
+                                                   pBlkCacheReq, fOwnOnly, false, NULL);
+    }
+
+    return cbRemoved;
+}
+
+/**
+ * Makes room for a new entry of the given size for the given user.
+ *
+ * @returns Flag whether enough data could be evicted.
+ * @param   pCache        Pointer to the global cache data.
+ * @param   pBlkCache     The user the space is required for.
+ * @param   cbData        The amount of data required.
+ * @param   fReuseBuffer  Flag whether a buffer should be reused if it has the same size.
+ * @param   ppbBuffer     Where to store the address of the buffer to reuse.
+ */
+static bool pdmBlkCacheReclaim(PPDMBLKCACHEGLOBAL pCache, PPDMBLKCACHE pBlkCache, size_t cbData,
+                               bool fReuseBuffer, uint8_t **ppbBuffer)
+{
+    size_t cbRemoved = 0;
+
+    if (fReuseBuffer)
+        *ppbBuffer = NULL;
+
+    /* The user has to make room in its own share first if it would exceed its quota. */
+    if ((uint64_t)pBlkCache->cbCached + cbData > pBlkCache->cbMax)
+    {
+        size_t cbOverQuota = (size_t)((uint64_t)pBlkCache->cbCached + cbData - pBlkCache->cbMax);
+
+        cbRemoved = pdmBlkCacheEvict(pCache, pBlkCache, cbOverQuota, true /* fOwnOnly */,
+                                     fReuseBuffer, ppbBuffer);
+        if (cbRemoved < cbOverQuota)
         {
-            Assert(!fReuseBuffer || !*ppbBuffer); /* It is not possible that we got a buffer with the correct size but we didn't freed enough data. */
+            if (fReuseBuffer && *ppbBuffer)
+            {
+                RTMemPageFree(*ppbBuffer, cbData);
+                *ppbBuffer = NULL;
+            }
 
-            /*
-             * If we removed something we can't pass the reuse buffer flag anymore because
-             * we don't need to evict that much data
-             */
-            if (!cbRemoved)
-                cbRemoved += pdmBlkCacheEvictPagesFrom(pCache, cbData, &pCache->LruFrequentlyUsed,
-                                                          NULL, fReuseBuffer, ppbBuffer);
-            else
-                cbRemoved += pdmBlkCacheEvictPagesFrom(pCache, cbData - cbRemoved, &pCache->LruFrequentlyUsed,
-                                                          NULL, false, NULL);
+            LogFlowFunc((": user %s exceeds its quota, removed %u bytes, requested %u\n",
+                         pBlkCache->pszId, cbRemoved, cbOverQuota));
+            return false;
         }
+
+        if (fReuseBuffer && *ppbBuffer)
+            fReuseBuffer = false;
+    }
+
+    if ((pCache->cbCached + cbData) < pCache->cbMax)
+        return true;
+
+    cbRemoved = pdmBlkCacheEvict(pCache, pBlkCache, cbData, false /* fOwnOnly */,
+                                 fReuseBuffer, fReuseBuffer ? ppbBuffer : NULL);
+
+    LogFlowFunc((": removed %u bytes, requested %u\n", cbRemoved, cbData));
+    return (cbRemoved >= cbData);
+}
+
+/**
+ * Adapts the target size of the recently used list after a hit in one of the
+ * ghost lists.
+ *
+ * @returns nothing.
+ * @param   pCache    Pointer to the global cache data.
+ * @param   pEntry    The entry which was hit, still linked into the ghost list.
+ *
+ * @note The caller must own the critical section of the cache.
+ */
+static void pdmBlkCacheGhostHit(PPDMBLKCACHEGLOBAL pCache, PPDMBLKCACHEENTRY pEntry)
+{
+    uint64_t cbDelta = pEntry->cbData;
+
+    PDMACFILECACHE_IS_CRITSECT_OWNER(pCache);
+
+    if (pEntry->pList == &pCache->LruRecentlyUsedOut)
+    {
+        /* The entry was evicted from the recently used list too early, grow it. */
+        if (pCache->LruFrequentlyUsedOut.cbCached > pCache->LruRecentlyUsedOut.cbCached)
+            cbDelta = cbDelta * pCache->LruFrequentlyUsedOut.cbCached / pCache->LruRecentlyUsedOut.cbCached;
+
+        pCache->cbRecentlyUsedInTarget = (uint32_t)RT_MIN(pCache->cbRecentlyUsedInTarget + cbDelta, pCache->cbMax);
+        STAM_COUNTER_INC(&pCache->StatGhostHitsRecentlyUsed);
     }
     else
     {
-        /* We have to remove entries from frequently access list. */
-        cbRemoved = pdmBlkCacheEvictPagesFrom(pCache, cbData, &pCache->LruFrequentlyUsed,
-                                                 NULL, fReuseBuffer, ppbBuffer);
+        AssertMsg(pEntry->pList == &pCache->LruFrequentlyUsedOut, ("Entry is not in a ghost list\n"));
+
+        /* The entry was evicted from the frequently used list too early, shrink the other one. */
+        if (pCache->LruRecentlyUsedOut.cbCached > pCache->LruFrequentlyUsedOut.cbCached)
+            cbDelta = cbDelta * pCache->LruRecentlyUsedOut.cbCached / pCache->LruFrequentlyUsedOut.cbCached;
+
+        if (pCache->cbRecentlyUsedInTarget > cbDelta)
+            pCache->cbRecentlyUsedInTarget -= (uint32_t)cbDelta;
+        else
+            pCache->cbRecentlyUsedInTarget = 0;
+        STAM_COUNTER_INC(&pCache->StatGhostHitsFrequentlyUsed);
     }
+}
 
-    LogFlowFunc((": removed %u bytes, requested %u\n", cbRemoved, cbData));
-    return (cbRemoved >= cbData);
+/**
+ * Accounts for the first access of a prefetched entry and grows the read-ahead
+ * window of the owner.
+ *
+ * @returns nothing.
+ * @param   pCache    Pointer to the global cache data.
+ * @param   pEntry    The accessed entry.
+ *
+ * @note The caller must own the critical section of the cache.
+ */
+static void pdmBlkCacheReadAheadHit(PPDMBLKCACHEGLOBAL pCache, PPDMBLKCACHEENTRY pEntry)
+{
+    PPDMBLKCACHE pBlkCache = pEntry->pBlkCache;
+    bool fPrefetched;
+
+    PDMACFILECACHE_IS_CRITSECT_OWNER(pCache);
+
+    RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
+    fPrefetched = RT_BOOL(pEntry->fFlags & PDMBLKCACHE_ENTRY_PREFETCHED);
+    pEntry->fFlags &= ~PDMBLKCACHE_ENTRY_PREFETCHED;
+    RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
+
+    if (fPrefetched)
+    {
+        ASMAtomicSubU32(&pBlkCache->cbReadAheadUnused, pEntry->cbData);
+        pBlkCache->cbReadAhead = RT_MIN(pBlkCache->cbReadAhead * 2, pCache->cbReadAheadMax);
+        STAM_COUNTER_ADD(&pBlkCache->StatReadAheadHits, pEntry->cbData);
+    }
+}
+
+/**
+ * Accounts for a prefetched entry which gets evicted without being accessed
+ * and shrinks the read-ahead window of the owner.
+ *
+ * @returns nothing.
+ * @param   pCache    Pointer to the global cache data.
+ * @param   pEntry    The evicted entry.
+ *
+ * @note The caller must own the critical section of the cache and the R/W
+ *       semaphore of the owner in exclusive mode.
+ */
+static void pdmBlkCacheReadAheadWasted(PPDMBLKCACHEGLOBAL pCache, PPDMBLKCACHEENTRY pEntry)
+{
+    PPDMBLKCACHE pBlkCache = pEntry->pBlkCache;
+
+    PDMACFILECACHE_IS_CRITSECT_OWNER(pCache);
+    PDMACFILECACHE_EP_IS_SEMRW_WRITE_OWNER(pBlkCache);
+
+    pEntry->fFlags &= ~PDMBLKCACHE_ENTRY_PREFETCHED;
+    ASMAtomicSubU32(&pBlkCache->cbReadAheadUnused, pEntry->cbData);
+    pBlkCache->cbReadAhead = RT_MAX(pBlkCache->cbReadAhead / 2, pCache->cbReadAheadMin);
+    STAM_COUNTER_ADD(&pBlkCache->StatReadAheadWasted, pEntry->cbData);
+}
+
+/**
+ * Updates the sequential access tracking of the given user.
+ *
+ * @returns Flag whether the read is part of a sequential scan exceeding the threshold.
+ * @param   pBlkCache    The user.
+ * @param   off          Start offset of the read.
+ * @param   cbRead       Size of the read.
+ *
+ * @note Unsynchronized, concurrent readers can only disturb the heuristic.
+ */
+static bool pdmBlkCacheSeqScanUpdate(PPDMBLKCACHE pBlkCache, uint64_t off, size_t cbRead)
+{
+    if (off == pBlkCache->offSeqNext)
+        pBlkCache->cbSeqRun += cbRead;
+    else
+    {
+        /* A new stream starts, forget what was prefetched for the old one. */
+        pBlkCache->cbSeqRun         = cbRead;
+        pBlkCache->offReadAheadNext = 0;
+    }
+    pBlkCache->offSeqNext = off + cbRead;
+
+    return    pBlkCache->pCache->cbSeqScanThreshold
+           && pBlkCache->cbSeqRun > pBlkCache->pCache->cbSeqScanThreshold;
 }
 
 DECLINLINE(int) pdmBlkCacheEnqueue(PPDMBLKCACHE pBlkCache, uint64_t off, size_t cbXfer, PPDMBLKCACHEIOXFER pIoXfer)
@@ -957,7 +1201,7 @@ static DECLCALLBACK(int) pdmR3BlkCacheLoadExec(PVM pVM, PSSMHANDLE pSSM, uint32_
                 /* Add to the dirty list. */
                 pdmBlkCacheAddDirtyEntry(pBlkCache, pEntry);
                 pdmBlkCacheEntryAddToList(&pBlkCacheGlobal->LruRecentlyUsedIn, pEntry);
-                pdmBlkCacheAdd(pBlkCacheGlobal, cbEntry);
+                pdmBlkCacheAdd(pBlkCacheGlobal, pBlkCache, cbEntry);
                 pdmBlkCacheEntryRelease(pEntry);
                 cEntries--;
             }
@@ -1021,16 +1265,45 @@ int pdmR3BlkCacheInit(PVM pVM)
     pBlkCacheGlobal->LruFrequentlyUsed.pTail    = NULL;
     pBlkCacheGlobal->LruFrequentlyUsed.cbCached = 0;
 
+    pBlkCacheGlobal->LruFrequentlyUsedOut.pHead    = NULL;
+    pBlkCacheGlobal->LruFrequentlyUsedOut.pTail    = NULL;
+    pBlkCacheGlobal->LruFrequentlyUsedOut.cbCached = 0;
+
     do
     {
         rc = CFGMR3QueryU32Def(pCfgBlkCache, "CacheSize", &pBlkCacheGlobal->cbMax, 5 * _1M);
         AssertLogRelRCBreak(rc);
         LogFlowFunc(("Maximum number of bytes cached %u\n", pBlkCacheGlobal->cbMax));
 
-        pBlkCacheGlobal->cbRecentlyUsedInMax  = (pBlkCacheGlobal->cbMax / 100) * 25; /* 25% of the buffer size */
-        pBlkCacheGlobal->cbRecentlyUsedOutMax = (pBlkCacheGlobal->cbMax / 100) * 50; /* 50% of the buffer size */
-        LogFlowFunc(("cbRecentlyUsedInMax=%u cbRecentlyUsedOutMax=%u\n",
-                     pBlkCacheGlobal->cbRecentlyUsedInMax, pBlkCacheGlobal->cbRecentlyUsedOutMax));
+        /* Initial target, adapted at runtime. */
+        pBlkCacheGlobal->cbRecentlyUsedInTarget = (pBlkCacheGlobal->cbMax / 100) * 25; /* 25% of the buffer size */
+        pBlkCacheGlobal->cbRecentlyUsedOutMax   = (pBlkCacheGlobal->cbMax / 100) * 50; /* 50% of the buffer size */
+        pBlkCacheGlobal->cbFrequentlyUsedOutMax = (pBlkCacheGlobal->cbMax / 100) * 50; /* 50% of the buffer size */
+        LogFlowFunc(("cbRecentlyUsedInTarget=%u cbRecentlyUsedOutMax=%u cbFrequentlyUsedOutMax=%u\n",
+                     pBlkCacheGlobal->cbRecentlyUsedInTarget, pBlkCacheGlobal->cbRecentlyUsedOutMax,
+                     pBlkCacheGlobal->cbFrequentlyUsedOutMax));
+
+        rc = CFGMR3QueryU32Def(pCfgBlkCache, "UserMinSize", &pBlkCacheGlobal->cbUserMinDef, 0);
+        AssertLogRelRCBreak(rc);
+        rc = CFGMR3QueryU32Def(pCfgBlkCache, "UserMaxSize", &pBlkCacheGlobal->cbUserMaxDef, pBlkCacheGlobal->cbMax);
+        AssertLogRelRCBreak(rc);
+        AssertLogRelMsgBreakStmt(pBlkCacheGlobal->cbUserMinDef <= pBlkCacheGlobal->cbUserMaxDef,
+                                 ("BlkCache: UserMinSize=%u exceeds UserMaxSize=%u\n",
+                                  pBlkCacheGlobal->cbUserMinDef, pBlkCacheGlobal->cbUserMaxDef),
+                                 rc = VERR_INVALID_PARAMETER);
+        rc = CFGMR3QueryU32Def(pCfgBlkCache, "SeqScanThreshold", &pBlkCacheGlobal->cbSeqScanThreshold, pBlkCacheGlobal->cbMax / 4);
+        AssertLogRelRCBreak(rc);
+        rc = CFGMR3QueryU32Def(pCfgBlkCache, "ReadAheadMin", &pBlkCacheGlobal->cbReadAheadMin, _64K);
+        AssertLogRelRCBreak(rc);
+        rc = CFGMR3QueryU32Def(pCfgBlkCache, "ReadAheadMax", &pBlkCacheGlobal->cbReadAheadMax, _1M);
+        AssertLogRelRCBreak(rc);
+
+        /* Read-ahead must not take more than a quarter of the cache. */
+        pBlkCacheGlobal->cbReadAheadMax = RT_MIN(pBlkCacheGlobal->cbReadAheadMax, pBlkCacheGlobal->cbMax / 4);
+        pBlkCacheGlobal->cbReadAheadMin = RT_ALIGN_32(pBlkCacheGlobal->cbReadAheadMin, PAGE_SIZE);
+        if (   !pBlkCacheGlobal->cbReadAheadMin
+            || pBlkCacheGlobal->cbReadAheadMin > pBlkCacheGlobal->cbReadAheadMax)
+            pBlkCacheGlobal->cbReadAheadMax = 0;
 
         /** @todo r=aeichner: Experiment to find optimal default values */
         rc = CFGMR3QueryU32Def(pCfgBlkCache, "CacheCommitIntervalMs", &pBlkCacheGlobal->u32CommitTimeoutMs, 10000 /* 10sec */);
@@ -1066,6 +1339,16 @@ int pdmR3BlkCacheInit(PVM pVM)
                        "/PDM/BlkCache/cbCachedFru",
                        STAMUNIT_BYTES,
                        "Number of bytes cached in FRU ghost list");
+        STAMR3Register(pVM, &pBlkCacheGlobal->LruFrequentlyUsedOut.cbCached,
+                       STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
+                       "/PDM/BlkCache/cbCachedFruOut",
+                       STAMUNIT_BYTES,
+                       "Number of bytes in the frequently used ghost list");
+        STAMR3Register(pVM, &pBlkCacheGlobal->cbRecentlyUsedInTarget,
+                       STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
+                       "/PDM/BlkCache/cbMruInTarget",
+                       STAMUNIT_BYTES,
+                       "Current target size of the recently used list");
 
 #ifdef VBOX_WITH_STATISTICS
         STAMR3Register(pVM, &pBlkCacheGlobal->cHits,
@@ -1104,6 +1387,14 @@ int pdmR3BlkCacheInit(PVM pVM)
                        STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
                        "/PDM/BlkCache/CacheBuffersReused",
                        STAMUNIT_COUNT, "Number of times a buffer could be reused");
+        STAMR3Register(pVM, &pBlkCacheGlobal->StatGhostHitsRecentlyUsed,
+                       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                       "/PDM/BlkCache/CacheGhostHitsMru",
+                       STAMUNIT_COUNT, "Number of hits in the recently used ghost list");
+        STAMR3Register(pVM, &pBlkCacheGlobal->StatGhostHitsFrequentlyUsed,
+                       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                       "/PDM/BlkCache/CacheGhostHitsFru",
+                       STAMUNIT_COUNT, "Number of hits in the frequently used ghost list");
 #endif
 
         /* Initialize the critical section */
@@ -1132,6 +1423,13 @@ int pdmR3BlkCacheInit(PVM pVM)
                 LogRel(("BlkCache: Cache successfully initialised. Cache size is %u bytes\n", pBlkCacheGlobal->cbMax));
                 LogRel(("BlkCache: Cache commit interval is %u ms\n", pBlkCacheGlobal->u32CommitTimeoutMs));
                 LogRel(("BlkCache: Cache commit threshold is %u bytes\n", pBlkCacheGlobal->cbCommitDirtyThreshold));
+                LogRel(("BlkCache: Default user quota is %u-%u bytes, sequential scan threshold is %u bytes\n",
+                        pBlkCacheGlobal->cbUserMinDef, pBlkCacheGlobal->cbUserMaxDef, pBlkCacheGlobal->cbSeqScanThreshold));
+                if (pBlkCacheGlobal->cbReadAheadMax)
+                    LogRel(("BlkCache: Read-ahead window is %u-%u bytes\n",
+                            pBlkCacheGlobal->cbReadAheadMin, pBlkCacheGlobal->cbReadAheadMax));
+                else
+                    LogRel(("BlkCache: Read-ahead is disabled\n"));
                 pUVM->pdm.s.pBlkCacheGlobal = pBlkCacheGlobal;
                 return VINF_SUCCESS;
             }
@@ -1160,6 +1458,7 @@ void pdmR3BlkCacheTerm(PVM pVM)
         pdmBlkCacheDestroyList(&pBlkCacheGlobal->LruRecentlyUsedIn);
         pdmBlkCacheDestroyList(&pBlkCacheGlobal->LruRecentlyUsedOut);
         pdmBlkCacheDestroyList(&pBlkCacheGlobal->LruFrequentlyUsed);
+        pdmBlkCacheDestroyList(&pBlkCacheGlobal->LruFrequentlyUsedOut);
 
         pdmBlkCacheLockLeave(pBlkCacheGlobal);
 
@@ -1214,6 +1513,9 @@ static int pdmR3BlkCacheRetain(PVM pVM, PPPDMBLKCACHE ppBlkCache, const char *pc
         {
             pBlkCache->fSuspended = false;
             pBlkCache->pCache = pBlkCacheGlobal;
+            pBlkCache->cbMin  = pBlkCacheGlobal->cbUserMinDef;
+            pBlkCache->cbMax  = pBlkCacheGlobal->cbUserMaxDef;
+            pBlkCache->cbReadAhead = pBlkCacheGlobal->cbReadAheadMin;
             RTListInit(&pBlkCache->ListDirtyNotCommitted);
 
             rc = RTSpinlockCreate(&pBlkCache->LockList);
@@ -1230,7 +1532,31 @@ static int pdmR3BlkCacheRetain(PVM pVM, PPPDMBLKCACHE ppBlkCache, const char *pc
                                         STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
                                         STAMUNIT_COUNT, "Number of deferred writes",
                                         "/PDM/BlkCache/%s/Cache/DeferredWrites", pBlkCache->pszId);
+                        STAMR3RegisterF(pBlkCacheGlobal->pVM, &pBlkCache->StatSeqScanBypassed,
+                                        STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                                        STAMUNIT_COUNT, "Number of reads passed through because of a sequential scan",
+                                        "/PDM/BlkCache/%s/Cache/SeqScanBypassed", pBlkCache->pszId);
+                        STAMR3RegisterF(pBlkCacheGlobal->pVM, &pBlkCache->StatReadAheadIssued,
+                                        STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                                        STAMUNIT_BYTES, "Number of bytes read ahead",
+                                        "/PDM/BlkCache/%s/Cache/ReadAheadIssued", pBlkCache->pszId);
+                        STAMR3RegisterF(pBlkCacheGlobal->pVM, &pBlkCache->StatReadAheadHits,
+                                        STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                                        STAMUNIT_BYTES, "Number of bytes read ahead which were accessed afterwards",
+                                        "/PDM/BlkCache/%s/Cache/ReadAheadHits", pBlkCache->pszId);
+                        STAMR3RegisterF(pBlkCacheGlobal->pVM, &pBlkCache->StatReadAheadWasted,
+                                        STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                                        STAMUNIT_BYTES, "Number of bytes read ahead which were evicted unused",
+                                        "/PDM/BlkCache/%s/Cache/ReadAheadWasted", pBlkCache->pszId);
 #endif
+                        STAMR3RegisterF(pBlkCacheGlobal->pVM, &pBlkCache->cbReadAhead,
+                                        STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
+                                        STAMUNIT_BYTES, "Current read-ahead window",
+                                        "/PDM/BlkCache/%s/Cache/cbReadAhead", pBlkCache->pszId);
+                        STAMR3RegisterF(pBlkCacheGlobal->pVM, &pBlkCache->cbCached,
+                                        STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
+                                        STAMUNIT_BYTES, "Number of bytes cached for this user",
+                                        "/PDM/BlkCache/%s/Cache/cbCached", pBlkCache->pszId);
 
                         /* Add to the list of users. */
                         pBlkCacheGlobal->cRefs++;
@@ -1392,10 +1718,13 @@ static int pdmBlkCacheEntryDestroy(PAVLRU64NODECORE pNode, void *pvUser)
     bool fUpdateCache =    pEntry->pList == &pCache->LruFrequentlyUsed
                         || pEntry->pList == &pCache->LruRecentlyUsedIn;
 
+    if (pEntry->fFlags & PDMBLKCACHE_ENTRY_PREFETCHED)
+        ASMAtomicSubU32(&pBlkCache->cbReadAheadUnused, pEntry->cbData);
+
     pdmBlkCacheEntryRemoveFromList(pEntry);
 
     if (fUpdateCache)
-        pdmBlkCacheSub(pCache, pEntry->cbData);
+        pdmBlkCacheSub(pCache, pBlkCache, pEntry->cbData);
 
     RTMemPageFree(pEntry->pbData, pEntry->cbData);
     RTMemFree(pEntry);
@@ -1438,7 +1767,13 @@ VMMR3DECL(void) PDMR3BlkCacheRelease(PPDMBLKCACHE pBlkCache)
 
 #ifdef VBOX_WITH_STATISTICS
     STAMR3Deregister(pCache->pVM, &pBlkCache->StatWriteDeferred);
+    STAMR3Deregister(pCache->pVM, &pBlkCache->StatSeqScanBypassed);
+    STAMR3Deregister(pCache->pVM, &pBlkCache->StatReadAheadIssued);
+    STAMR3Deregister(pCache->pVM, &pBlkCache->StatReadAheadHits);
+    STAMR3Deregister(pCache->pVM, &pBlkCache->StatReadAheadWasted);
 #endif
+    STAMR3Deregister(pCache->pVM, &pBlkCache->cbCached);
+    STAMR3Deregister(pCache->pVM, &pBlkCache->cbReadAhead);
 
     RTStrFree(pBlkCache->pszId);
     RTMemFree(pBlkCache);
@@ -1832,7 +2167,7 @@ static PPDMBLKCACHEENTRY pdmBlkCacheEntryCreate(PPDMBLKCACHE pBlkCache,
                                               &offStart, &cbEntry);
 
     pdmBlkCacheLockEnter(pCache);
-    bool fEnough = pdmBlkCacheReclaim(pCache, cbEntry, true, &pbBuffer);
+    bool fEnough = pdmBlkCacheReclaim(pCache, pBlkCache, cbEntry, true, &pbBuffer);
 
     if (fEnough)
     {
@@ -1842,7 +2177,7 @@ static PPDMBLKCACHEENTRY pdmBlkCacheEntryCreate(PPDMBLKCACHE pBlkCache,
         if (RT_LIKELY(pEntryNew))
         {
             pdmBlkCacheEntryAddToList(&pCache->LruRecentlyUsedIn, pEntryNew);
-            pdmBlkCacheAdd(pCache, cbEntry);
+            pdmBlkCacheAdd(pCache, pBlkCache, cbEntry);
             pdmBlkCacheLockLeave(pCache);
 
             pdmBlkCacheInsertEntry(pBlkCache, pEntryNew);
@@ -1932,6 +2267,75 @@ static bool pdmBlkCacheReqUpdate(PPDMBLKCACHE pBlkCache, PPDMBLKCACHEREQ pReq,
     return false;
 }
 
+/**
+ * Checks whether read-ahead is enabled for the given user.
+ *
+ * @returns true if read-ahead is enabled, false otherwise.
+ * @param   pBlkCache    The user.
+ */
+DECLINLINE(bool) pdmBlkCacheReadAheadIsEnabled(PPDMBLKCACHE pBlkCache)
+{
+    return    pBlkCache->cbMedium
+           && pBlkCache->pCache->cbReadAheadMax;
+}
+
+/**
+ * Prefetches the data ahead of a sequential stream into the cache.
+ *
+ * @returns nothing.
+ * @param   pBlkCache    The user.
+ * @param   off          The offset the stream continues at.
+ */
+static void pdmBlkCacheReadAhead(PPDMBLKCACHE pBlkCache, uint64_t off)
+{
+    PPDMBLKCACHEGLOBAL pCache = pBlkCache->pCache;
+    uint32_t cbWindow = ASMAtomicReadU32(&pBlkCache->cbReadAhead);
+    uint64_t offStart = RT_MAX(off, pBlkCache->offReadAheadNext);
+    uint64_t offEnd   = RT_MIN(off + cbWindow, pBlkCache->cbMedium);
+
+    /* Wait until half of the window is consumed to issue fewer but larger prefetches. */
+    if (   offStart >= offEnd
+        || offStart - off >= cbWindow / 2)
+        return;
+
+    LogFlowFunc(("pBlkCache=%#p{%s} offStart=%llu offEnd=%llu\n",
+                 pBlkCache, pBlkCache->pszId, offStart, offEnd));
+
+    while (offStart < offEnd)
+    {
+        size_t cbPrefetch = (size_t)RT_MIN(offEnd - offStart, pCache->cbReadAheadMin);
+        size_t cbInEntry = 0;
+
+        /* Bound the amount of memory used for data nobody asked for yet. */
+        if (ASMAtomicReadU32(&pBlkCache->cbReadAheadUnused) + cbPrefetch > pCache->cbReadAheadMax)
+            break;
+
+        PPDMBLKCACHEENTRY pEntry = pdmBlkCacheGetCacheEntryByOffset(pBlkCache, offStart);
+        if (pEntry)
+        {
+            /* Cached already (maybe only in a ghost list, which is fetched on access). */
+            offStart = pEntry->Core.KeyLast + 1;
+            pdmBlkCacheEntryRelease(pEntry);
+            continue;
+        }
+
+        pEntry = pdmBlkCacheEntryCreate(pBlkCache, offStart, cbPrefetch, PAGE_SIZE, &cbInEntry);
+        if (!pEntry)
+            break;
+
+        pEntry->fFlags |= PDMBLKCACHE_ENTRY_PREFETCHED;
+        ASMAtomicAddU32(&pBlkCache->cbReadAheadUnused, (uint32_t)pEntry->cbData);
+        STAM_COUNTER_ADD(&pBlkCache->StatReadAheadIssued, pEntry->cbData);
+
+        pdmBlkCacheEntryReadFromMedium(pEntry);
+        pdmBlkCacheEntryRelease(pEntry); /* it is protected by the I/O in progress flag now. */
+
+        offStart += cbInEntry;
+    }
+
+    pBlkCache->offReadAheadNext = offStart;
+}
+
 VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
                                  PCRTSGBUF pcSgBuf, size_t cbRead, void *pvUser)
 {
@@ -1957,6 +2361,15 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
     /* Increment data transfer counter to keep the request valid while we access it. */
     ASMAtomicIncU32(&pReq->cXfersPending);
 
+#ifdef VBOX_WITH_IO_READ_CACHE
+    bool fSeqScan = pdmBlkCacheSeqScanUpdate(pBlkCache, off, cbRead);
+#else
+    pdmBlkCacheSeqScanUpdate(pBlkCache, off, cbRead);
+#endif
+    /* The read continues the previous one. */
+    bool fStream = pBlkCache->cbSeqRun > cbRead;
+    bool fReadAhead = pdmBlkCacheReadAheadIsEnabled(pBlkCache);
+
     while (cbRead)
     {
         size_t cbToRead;
@@ -2019,13 +2432,16 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
                     RTSgBufCopyFromBuf(&SgBuf, pEntry->pbData + offDiff, cbToRead);
                 }
 
-                /* Move this entry to the top position */
-                if (pEntry->pList == &pCache->LruFrequentlyUsed)
-                {
-                    pdmBlkCacheLockEnter(pCache);
+                /*
+                 * Move this entry to the top position of the frequently used list
+                 * unless it is accessed as part of a stream which reads it only once.
+                 */
+                pdmBlkCacheLockEnter(pCache);
+                if (ASMAtomicReadU32(&pEntry->fFlags) & PDMBLKCACHE_ENTRY_PREFETCHED)
+                    pdmBlkCacheReadAheadHit(pCache, pEntry);
+                if (!fStream)
                     pdmBlkCacheEntryAddToList(&pCache->LruFrequentlyUsed, pEntry);
-                    pdmBlkCacheLockLeave(pCache);
-                }
+                pdmBlkCacheLockLeave(pCache);
                 /* Release the entry */
                 pdmBlkCacheEntryRelease(pEntry);
             }
@@ -2036,14 +2452,15 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
                 LogFlow(("Fetching data for ghost entry %#p from file\n", pEntry));
 
                 pdmBlkCacheLockEnter(pCache);
+                pdmBlkCacheGhostHit(pCache, pEntry);
                 pdmBlkCacheEntryRemoveFromList(pEntry); /* Remove it before we remove data, otherwise it may get freed when evicting data. */
-                bool fEnough = pdmBlkCacheReclaim(pCache, pEntry->cbData, true, &pbBuffer);
+                bool fEnough = pdmBlkCacheReclaim(pCache, pBlkCache, pEntry->cbData, true, &pbBuffer);
 
                 /* Move the entry to Am and fetch it to the cache. */
                 if (fEnough)
                 {
                     pdmBlkCacheEntryAddToList(&pCache->LruFrequentlyUsed, pEntry);
-                    pdmBlkCacheAdd(pCache, pEntry->cbData);
+                    pdmBlkCacheAdd(pCache, pBlkCache, pEntry->cbData);
                     pdmBlkCacheLockLeave(pCache);
 
                     if (pbBuffer)
@@ -2080,11 +2497,29 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
         else
         {
 #ifdef VBOX_WITH_IO_READ_CACHE
-            /* No entry found for this offset. Create a new entry and fetch the data to the cache. */
-            PPDMBLKCACHEENTRY pEntryNew = pdmBlkCacheEntryCreate(pBlkCache,
-                                                                 off, cbRead,
-                                                                 PAGE_SIZE,
-                                                                 &cbToRead);
+            PPDMBLKCACHEENTRY pEntryNew = NULL;
+
+            if (!fSeqScan || fReadAhead)
+            {
+                /* No entry found for this offset. Create a new entry and fetch the data to the cache. */
+                pEntryNew = pdmBlkCacheEntryCreate(pBlkCache,
+                                                   off, cbRead,
+                                                   PAGE_SIZE,
+                                                   &cbToRead);
+            }
+            else
+            {
+                /*
+                 * Without read-ahead don't let a sequential scan evict the working set,
+                 * read up to the next entry directly.
+                 */
+                uint64_t offAligned;
+                size_t   cbAligned;
+
+                cbToRead = pdmBlkCacheEntryBoundariesCalc(pBlkCache, off, cbRead, PAGE_SIZE,
+                                                          &offAligned, &cbAligned);
+                STAM_COUNTER_INC(&pBlkCache->StatSeqScanBypassed);
+            }
 
             cbRead -= cbToRead;
 
@@ -2141,6 +2576,10 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
         off += cbToRead;
     }
 
+    /* Fetch the data ahead of a stream before it is requested. */
+    if (fStream && fReadAhead)
+        pdmBlkCacheReadAhead(pBlkCache, off);
+
     if (!pdmBlkCacheReqUpdate(pBlkCache, pReq, rc, false))
         rc = VINF_AIO_TASK_PENDING;
 
@@ -2254,13 +2693,10 @@ VMMR3DECL(int) PDMR3BlkCacheWrite(PPDMBLKCACHE pBlkCache, uint64_t off,
                     }
                 } /* Dirty bit not set */
 
-                /* Move this entry to the top position */
-                if (pEntry->pList == &pCache->LruFrequentlyUsed)
-                {
-                    pdmBlkCacheLockEnter(pCache);
-                    pdmBlkCacheEntryAddToList(&pCache->LruFrequentlyUsed, pEntry);
-                    pdmBlkCacheLockLeave(pCache);
-                }
+                /* Move this entry to the top position of the frequently used list. */
+                pdmBlkCacheLockEnter(pCache);
+                pdmBlkCacheEntryAddToList(&pCache->LruFrequentlyUsed, pEntry);
+                pdmBlkCacheLockLeave(pCache);
 
                 pdmBlkCacheEntryRelease(pEntry);
             }
@@ -2269,14 +2705,15 @@ VMMR3DECL(int) PDMR3BlkCacheWrite(PPDMBLKCACHE pBlkCache, uint64_t off,
                 uint8_t *pbBuffer = NULL;
 
                 pdmBlkCacheLockEnter(pCache);
+                pdmBlkCacheGhostHit(pCache, pEntry);
                 pdmBlkCacheEntryRemoveFromList(pEntry); /* Remove it before we remove data, otherwise it may get freed when evicting data. */
-                bool fEnough = pdmBlkCacheReclaim(pCache, pEntry->cbData, true, &pbBuffer);
+                bool fEnough = pdmBlkCacheReclaim(pCache, pBlkCache, pEntry->cbData, true, &pbBuffer);
 
                 if (fEnough)
                 {
                     /* Move the entry to Am and fetch it to the cache. */
                     pdmBlkCacheEntryAddToList(&pCache->LruFrequentlyUsed, pEntry);
-                    pdmBlkCacheAdd(pCache, pEntry->cbData);
+                    pdmBlkCacheAdd(pCache, pBlkCache, pEntry->cbData);
                     pdmBlkCacheLockLeave(pCache);
 
                     if (pbBuffer)
@@ -2429,6 +2866,51 @@ static PPDMBLKCACHEWAITER pdmBlkCacheWaiterComplete(PPDMBLKCACHE pBlkCache,
     return pNext;
 }
 
+/**
+ * Removes a prefetched entry whose read failed from the cache.
+ *
+ * @returns Flag whether the entry was removed and freed.
+ * @param   pBlkCache    The endpoint cache the entry belongs to.
+ * @param   pEntry       The entry to remove, referenced once by the caller.
+ */
+static bool pdmBlkCacheEntryDropPrefetched(PPDMBLKCACHE pBlkCache, PPDMBLKCACHEENTRY pEntry)
+{
+    PPDMBLKCACHEGLOBAL pCache = pBlkCache->pCache;
+    bool fFree = false;
+
+    pdmBlkCacheLockEnter(pCache);
+    RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
+
+    /* Leave it alone if somebody else got hold of it in the meantime. */
+    if (   ASMAtomicReadU32(&pEntry->cRefs) == 1
+        && !(pEntry->fFlags & PDMBLKCACHE_NOT_EVICTABLE)
+        && (   pEntry->pList == &pCache->LruRecentlyUsedIn
+            || pEntry->pList == &pCache->LruFrequentlyUsed))
+    {
+        if (pEntry->fFlags & PDMBLKCACHE_ENTRY_PREFETCHED)
+            ASMAtomicSubU32(&pBlkCache->cbReadAheadUnused, pEntry->cbData);
+
+        STAM_PROFILE_ADV_START(&pCache->StatTreeRemove, Cache);
+        RTAvlrU64Remove(pBlkCache->pTree, pEntry->Core.Key);
+        STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
+
+        pdmBlkCacheEntryRemoveFromList(pEntry);
+        pdmBlkCacheSub(pCache, pBlkCache, pEntry->cbData);
+        fFree = true;
+    }
+
+    RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
+    pdmBlkCacheLockLeave(pCache);
+
+    if (fFree)
+    {
+        RTMemPageFree(pEntry->pbData, pEntry->cbData);
+        RTMemFree(pEntry);
+    }
+
+    return fFree;
+}
+
 static void pdmBlkCacheIoXferCompleteEntry(PPDMBLKCACHE pBlkCache, PPDMBLKCACHEIOXFER hIoXfer, int rcIoXfer)
 {
     PPDMBLKCACHEENTRY  pEntry    = hIoXfer->pEntry;
@@ -2443,6 +2925,7 @@ static void pdmBlkCacheIoXferCompleteEntry(PPDMBLKCACHE pBlkCache, PPDMBLKCACHEI
 
     /* Process waiting segment list. The data in entry might have changed in-between. */
     bool fDirty = false;
+    bool fDrop  = false;
     PPDMBLKCACHEWAITER pComplete = pEntry->pWaitingHead;
     PPDMBLKCACHEWAITER pCurr     = pComplete;
 
@@ -2507,6 +2990,11 @@ static void pdmBlkCacheIoXferCompleteEntry(PPDMBLKCACHE pBlkCache, PPDMBLKCACHEI
 
             pCurr = pCurr->pNext;
         }
+
+        /* The entry doesn't contain valid data if read ahead failed, remove it. */
+        fDrop =    RT_FAILURE(rcIoXfer)
+                && !fDirty
+                && (pEntry->fFlags & PDMBLKCACHE_ENTRY_PREFETCHED);
     }
 
     bool fCommit = false;
@@ -2516,7 +3004,9 @@ static void pdmBlkCacheIoXferCompleteEntry(PPDMBLKCACHE pBlkCache, PPDMBLKCACHEI
     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
 
     /* Dereference so that it isn't protected anymore except we issued anyother write for it. */
-    pdmBlkCacheEntryRelease(pEntry);
+    if (   !fDrop
+        || !pdmBlkCacheEntryDropPrefetched(pBlkCache, pEntry))
+        pdmBlkCacheEntryRelease(pEntry);
 
     if (fCommit)
         pdmBlkCacheCommitDirtyEntries(pCache);
@@ -2622,3 +3112,30 @@ VMMR3DECL(int) PDMR3BlkCacheClear(PPDMBLKCACHE pBlkCache)
     return rc;
 }
 
+VMMR3DECL(int) PDMR3BlkCacheSetQuota(PPDMBLKCACHE pBlkCache, uint32_t cbMin, uint32_t cbMax)
+{
+    LogFlowFunc(("pBlkCache=%#p cbMin=%u cbMax=%u\n", pBlkCache, cbMin, cbMax));
+
+    AssertPtrReturn(pBlkCache, VERR_INVALID_POINTER);
+    AssertReturn(cbMin <= cbMax, VERR_INVALID_PARAMETER);
+
+    PPDMBLKCACHEGLOBAL pCache = pBlkCache->pCache;
+
+    /* Entries above the new maximum are evicted on the next allocation of the user. */
+    pdmBlkCacheLockEnter(pCache);
+    pBlkCache->cbMin = RT_MIN(cbMin, pCache->cbMax);
+    pBlkCache->cbMax = RT_MIN(cbMax, pCache->cbMax);
+    pdmBlkCacheLockLeave(pCache);
+
+    return VINF_SUCCESS;
+}
+
+VMMR3DECL(int) PDMR3BlkCacheSetMediumSize(PPDMBLKCACHE pBlkCache, uint64_t cbMedium)
+{
+    LogFlowFunc(("pBlkCache=%#p cbMedium=%llu\n", pBlkCache, cbMedium));
+
+    AssertPtrReturn(pBlkCache, VERR_INVALID_POINTER);
+
+    ASMAtomicWriteU64(&pBlkCache->cbMedium, cbMedium);
+    return VINF_SUCCESS;
+}
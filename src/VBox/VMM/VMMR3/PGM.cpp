@@ -1675,6 +1675,11 @@ static int pgmR3InitStats(PVM pVM)
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.cDirtyPagesShort,     STAMTYPE_U32,     "/PGM/LiveSave/cDirtyPagesShort",     STAMUNIT_COUNT,     "Short term dirty page average.");
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.cPagesPerSecond,      STAMTYPE_U32,     "/PGM/LiveSave/cPagesPerSecond",      STAMUNIT_COUNT,     "Pages per second.");
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.cSavedPages,          STAMTYPE_U64,     "/PGM/LiveSave/cSavedPages",          STAMUNIT_COUNT,     "The total number of saved pages.");
+    STAM_REL_REG_USED(pVM, &pPGM->LiveSave.uThrottle,            STAMTYPE_U32,     "/PGM/LiveSave/uThrottle",            STAMUNIT_PCT,       "The guest execution throttle applied to make the live save converge.");
+    STAM_REL_REG_USED(pVM, &pPGM->LiveSave.cbDeltaSavedLastPass, STAMTYPE_U64,     "/PGM/LiveSave/Delta/cbSavedLastPass", STAMUNIT_BYTES,     "Bytes the delta encoding saved in the last RAM pass.");
+    STAM_REL_REG(pVM, &pPGM->LiveSave.StatDeltaPages,            STAMTYPE_COUNTER, "/PGM/LiveSave/Delta/Pages",          STAMUNIT_OCCURENCES, "RAM pages sent as XOR deltas.");
+    STAM_REL_REG(pVM, &pPGM->LiveSave.StatDeltaMisses,           STAMTYPE_COUNTER, "/PGM/LiveSave/Delta/Misses",         STAMUNIT_OCCURENCES, "RAM pages sent raw because they were not cached or differed too much.");
+    STAM_REL_REG(pVM, &pPGM->LiveSave.StatDeltaBytesSaved,       STAMTYPE_COUNTER, "/PGM/LiveSave/Delta/BytesSaved",     STAMUNIT_BYTES,     "Bytes saved by the delta encoding.");
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.Ram.cReadyPages,      STAMTYPE_U32,     "/PGM/LiveSave/Ram/cReadPages",       STAMUNIT_COUNT,     "RAM: Ready pages.");
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.Ram.cDirtyPages,      STAMTYPE_U32,     "/PGM/LiveSave/Ram/cDirtyPages",      STAMUNIT_COUNT,     "RAM: Dirty pages.");
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.Ram.cZeroPages,       STAMTYPE_U32,     "/PGM/LiveSave/Ram/cZeroPages",       STAMUNIT_COUNT,     "RAM: Ready zero pages.");
@@ -2471,6 +2476,9 @@ VMMR3DECL(void) PGMR3Reset(PVM pVM)
     LogFlow(("PGMR3Reset:\n"));
     VM_ASSERT_EMT(pVM);
 
+    /* The RAM still in a saved state file is of no interest any longer. */
+    pgmR3LazyRestoreReset(pVM);
+
     pgmLock(pVM);
 
     /*
@@ -2572,6 +2580,8 @@ VMMR3DECL(void) PGMR3ResetNoMorePhysWritesFlag(PVM pVM)
  */
 VMMR3DECL(int) PGMR3Term(PVM pVM)
 {
+    pgmR3LazyRestoreTerm(pVM);
+
     /* Must free shared pages here. */
     pgmLock(pVM);
     pgmR3PhysRamTerm(pVM);
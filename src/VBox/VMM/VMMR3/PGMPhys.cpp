@@ -431,6 +431,9 @@ VMMR3DECL(int) PGMR3PhysGCPhys2CCPtrExternal(PVM pVM, RTGCPHYS GCPhys, void **pp
 
     Assert(VM_IS_EMT(pVM) || !PGMIsLockOwner(pVM));
 
+    if (RT_UNLIKELY(pVM->pgm.s.fLazyRestoreActive))
+        pgmR3LazyRestoreTouch(pVM, GCPhys);
+
     int rc = pgmLock(pVM);
     AssertRCReturn(rc, rc);
 
@@ -532,6 +535,9 @@ VMMR3DECL(int) PGMR3PhysGCPhys2CCPtrExternal(PVM pVM, RTGCPHYS GCPhys, void **pp
  */
 VMMR3DECL(int) PGMR3PhysGCPhys2CCPtrReadOnlyExternal(PVM pVM, RTGCPHYS GCPhys, void const **ppv, PPGMPAGEMAPLOCK pLock)
 {
+    if (RT_UNLIKELY(pVM->pgm.s.fLazyRestoreActive))
+        pgmR3LazyRestoreTouch(pVM, GCPhys);
+
     int rc = pgmLock(pVM);
     AssertRCReturn(rc, rc);
 
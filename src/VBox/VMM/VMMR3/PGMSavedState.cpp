@@ -21,6 +21,9 @@
 *******************************************************************************/
 #define LOG_GROUP LOG_GROUP_PGM
 #include <VBox/vmm/pgm.h>
+#include <VBox/vmm/cfgm.h>
+#include <VBox/vmm/mm.h>
+#include <VBox/vmm/em.h>
 #include <VBox/vmm/stam.h>
 #include <VBox/vmm/ssm.h>
 #include <VBox/vmm/pdmdrv.h>
@@ -28,6 +31,7 @@
 #include "PGMInternal.h"
 #include <VBox/vmm/vm.h>
 #include "PGMInline.h"
+#include "PGMSavedStateDelta.h"
 
 #include <VBox/param.h>
 #include <VBox/err.h>
@@ -36,17 +40,22 @@
 #include <iprt/asm.h>
 #include <iprt/assert.h>
 #include <iprt/crc.h>
+#include <iprt/critsect.h>
 #include <iprt/mem.h>
+#include <iprt/semaphore.h>
 #include <iprt/sha.h>
 #include <iprt/string.h>
 #include <iprt/thread.h>
+#include <iprt/time.h>
 
 
 /*******************************************************************************
 *   Defined Constants And Macros                                               *
 *******************************************************************************/
 /** Saved state data unit version.  */
-#define PGM_SAVED_STATE_VERSION                 14
+#define PGM_SAVED_STATE_VERSION                 15
+/** Saved state data unit version before the XOR delta page records. */
+#define PGM_SAVED_STATE_VERSION_PRE_XOR         14
 /** Saved state data unit version before the PAE PDPE registers. */
 #define PGM_SAVED_STATE_VERSION_PRE_PAE         13
 /** Saved state data unit version after this includes ballooned page flags in
@@ -87,8 +96,11 @@
 #define PGM_STATE_REC_ROM_PROT          UINT8_C(0x07)
 /** Ballooned page. No data. */
 #define PGM_STATE_REC_RAM_BALLOONED     UINT8_C(0x08)
+/** Re-sent RAM page, XORed against the previous copy.  Followed by the size
+ *  of the encoded data (16-bit) and the data, see pgmR3DeltaEncode. */
+#define PGM_STATE_REC_RAM_XOR           UINT8_C(0x09)
 /** The last record type. */
-#define PGM_STATE_REC_LAST              PGM_STATE_REC_RAM_BALLOONED
+#define PGM_STATE_REC_LAST              PGM_STATE_REC_RAM_XOR
 /** End marker. */
 #define PGM_STATE_REC_END               UINT8_C(0xff)
 /** Flag indicating that the data is preceded by the page address.
@@ -103,6 +115,34 @@
 /** The CRC-32 for a zero half page. */
 #define PGM_STATE_CRC32_ZERO_HALF_PAGE  UINT32_C(0xf1e8ba9e)
 
+/** @name Live save auto-converge parameters.
+ * @{ */
+/** The first pass which may throttle the guest. */
+#define PGM_LIVE_THROTTLE_FIRST_PASS    10
+/** The min interval between throttle adjustments (ns). */
+#define PGM_LIVE_THROTTLE_INTERVAL_NS   RT_NS_1SEC
+/** The initial throttle (percent). */
+#define PGM_LIVE_THROTTLE_INITIAL       20
+/** The throttle increment (percent). */
+#define PGM_LIVE_THROTTLE_STEP          10
+/** @} */
+
+/** RAM chunk index unit (pgmidx) version. */
+#define PGM_SAVED_STATE_IDX_VERSION     1
+
+/** @name Demand paged restore
+ * @{ */
+/** The RAM chunk shift, the chunks in the index never cross a boundary of
+ *  this size. */
+#define PGM_LAZY_CHUNK_SHIFT            20
+/** The max number of pages in a RAM chunk. */
+#define PGM_LAZY_CHUNK_PAGES            RT_BIT_32(PGM_LAZY_CHUNK_SHIFT - PAGE_SHIFT)
+/** The max number of chunks covered by one access handler region. */
+#define PGM_LAZY_REGION_CHUNKS          256
+/** The max number of prefetched chunks waiting to be installed by an EMT. */
+#define PGM_LAZY_MAX_IN_FLIGHT          2
+/** @} */
+
 
 /*******************************************************************************
 *   Structures and Typedefs                                                    *
@@ -128,6 +168,174 @@ typedef struct
 } PGMOLD;
 
 
+/**
+ * A RAM chunk in the saved state index.
+ *
+ * This is a run of page records for up to PGM_LAZY_CHUNK_PAGES contiguous
+ * pages in the same RAM range and PGM_LAZY_CHUNK_SHIFT sized block.  The first
+ * record of a chunk always carries the page address.
+ */
+typedef struct PGMSSMRAMCHUNK
+{
+    /** The address of the first page. */
+    RTGCPHYS                        GCPhys;
+    /** The stream offset of the first record, see SSMR3TellRecord. */
+    uint64_t                        offStream;
+    /** The number of pages. */
+    uint32_t                        cPages;
+    /** The access handler region (load only), UINT32_MAX if none. */
+    uint32_t                        iRegion;
+    /** Set when the pages have been loaded (load only). */
+    bool                            fResident;
+} PGMSSMRAMCHUNK;
+/** Pointer to a RAM chunk index entry. */
+typedef PGMSSMRAMCHUNK *PPGMSSMRAMCHUNK;
+
+
+/**
+ * The page delta cache used by live save, PGM::LiveSave::pDeltaCacheR3.
+ *
+ * Keeps a copy of what was last sent for a RAM page so that re-sending a
+ * dirty page only needs the bytes which changed.  The cache is direct mapped
+ * on the guest page frame number and of a fixed size.
+ */
+typedef struct PGMLSDELTACACHE
+{
+    /** The number of slots (power of two). */
+    uint32_t                        cSlots;
+    /** The page address cached in each slot, NIL_RTGCPHYS if empty. */
+    PRTGCPHYS                       paGCPhys;
+    /** The page copies, cSlots * PAGE_SIZE bytes. */
+    uint8_t                        *pbPages;
+    /** Scratch buffer for the encoded page. */
+    uint8_t                         abEncoded[PGM_STATE_XOR_MAX];
+} PGMLSDELTACACHE;
+/** Pointer to the page delta cache. */
+typedef PGMLSDELTACACHE *PPGMLSDELTACACHE;
+
+
+/**
+ * The RAM chunk index collected while saving, PGM::pSavedRamIdxR3.
+ */
+typedef struct PGMSSMRAMIDX
+{
+    /** The number of chunks. */
+    uint32_t                        cChunks;
+    /** The number of allocated entries. */
+    uint32_t                        cAllocated;
+    /** The stream offset of the PGM_STATE_REC_END record. */
+    uint64_t                        offEnd;
+    /** The RAM range of the last chunk. */
+    PPGMRAMRANGE                    pRamLast;
+    /** The chunks. */
+    PPGMSSMRAMCHUNK                 paChunks;
+} PGMSSMRAMIDX;
+/** Pointer to the RAM chunk index. */
+typedef PGMSSMRAMIDX *PPGMSSMRAMIDX;
+
+
+/**
+ * A physical access handler region covering RAM chunks not yet loaded.
+ */
+typedef struct PGMLAZYREGION
+{
+    /** The first address. */
+    RTGCPHYS                        GCPhys;
+    /** The last address (inclusive). */
+    RTGCPHYS                        GCPhysLast;
+    /** The number of chunks. */
+    uint32_t                        cChunks;
+    /** The number of loaded chunks. */
+    uint32_t                        cResident;
+    /** Set while the access handler is registered. */
+    bool                            fRegistered;
+} PGMLAZYREGION;
+/** Pointer to a lazy restore region. */
+typedef PGMLAZYREGION *PPGMLAZYREGION;
+
+
+/**
+ * The page records of a RAM chunk read from the saved state.
+ */
+typedef struct PGMLAZYBUF
+{
+    /** The PGMLAZYRESTORE::idGen value when reading it. */
+    uint32_t                        idGen;
+    /** The chunk index. */
+    uint32_t                        iChunk;
+    /** The record types (without PGM_STATE_REC_FLAG_ADDR). */
+    uint8_t                         abTypes[PGM_LAZY_CHUNK_PAGES];
+    /** The page data, only the pages of RAW records are valid. */
+    uint8_t                         abData[1];
+} PGMLAZYBUF;
+/** Pointer to a chunk buffer. */
+typedef PGMLAZYBUF *PPGMLAZYBUF;
+
+
+/**
+ * The demand paged restore state, PGM::pLazyRestoreR3.
+ *
+ * The chunk and region arrays are only changed while owning both the PGM
+ * lock and the critical section (in that order), so either will do for
+ * reading them.
+ */
+typedef struct PGMLAZYRESTORE
+{
+    /** Serializes the access to pSSM and protects the arrays. */
+    RTCRITSECT                      CritSect;
+    /** The second saved state handle the RAM pages are read thru. */
+    PSSMHANDLE                      pSSM;
+    /** The RAM chunks, sorted by address. */
+    PPGMSSMRAMCHUNK                 paChunks;
+    /** The number of chunks. */
+    uint32_t                        cChunks;
+    /** The number of loaded chunks. */
+    uint32_t                        cResident;
+    /** The access handler regions. */
+    PPGMLAZYREGION                  paRegions;
+    /** The number of regions. */
+    uint32_t                        cRegions;
+    /** Generation number, incremented whenever the arrays are freed so that
+     * chunks read before that are dropped. */
+    uint32_t                        idGen;
+    /** The stream offset of the PGM_STATE_REC_END record. */
+    uint64_t                        offEnd;
+
+    /** The prefetcher thread. */
+    RTTHREAD                        hThread;
+    /** Signalled when the prefetcher should re-check things. */
+    RTSEMEVENT                      hEvtPrefetch;
+    /** Tells the prefetcher to quit. */
+    bool volatile                   fTerminate;
+    /** The number of prefetched chunks queued for an EMT. */
+    uint32_t volatile               cInFlight;
+
+    /** The RTTimeNanoTS value when the load started, 0 if not loading. */
+    uint64_t                        u64LoadStartNS;
+    /** Set until the guest runs for the first time after the load. */
+    bool                            fFirstInstrPending;
+    /** Nanoseconds from the start of the load until the guest ran. */
+    uint64_t                        cNsToFirstInstr;
+    /** Nanoseconds from the start of the load until all RAM was loaded. */
+    uint64_t                        cNsToResident;
+    /** The number of chunks left to load (statistics). */
+    uint32_t                        cChunksLeft;
+
+    /** Chunks loaded by guest or device accesses thru the access handler. */
+    STAMCOUNTER                     StatFaults;
+    /** Chunks loaded by ring-3 page mapping requests. */
+    STAMCOUNTER                     StatTouches;
+    /** Chunks loaded by the prefetcher. */
+    STAMCOUNTER                     StatPrefetched;
+    /** Chunks loaded during the restore because no access handler could cover them. */
+    STAMCOUNTER                     StatEager;
+    /** Bytes of page data read. */
+    STAMCOUNTER                     StatBytesRead;
+} PGMLAZYRESTORE;
+/** Pointer to the demand paged restore state. */
+typedef PGMLAZYRESTORE *PPGMLAZYRESTORE;
+
+
 /*******************************************************************************
 *   Global Variables                                                           *
 *******************************************************************************/
@@ -1528,6 +1736,153 @@ static void pgmR3ScanRamPages(PVM pVM, bool fFinalPass)
 }
 
 
+/**
+ * Frees the RAM chunk index collected by pgmR3SaveExec.
+ *
+ * @param   pVM                 The VM handle.
+ */
+static void pgmR3SaveRamIdxFree(PVM pVM)
+{
+    PPGMSSMRAMIDX pIdx = pVM->pgm.s.pSavedRamIdxR3;
+    if (pIdx)
+    {
+        pVM->pgm.s.pSavedRamIdxR3 = NULL;
+        RTMemFree(pIdx->paChunks);
+        RTMemFree(pIdx);
+    }
+}
+
+
+/**
+ * Notes down a RAM page record in the chunk index, starting a new chunk when
+ * the page doesn't fit into the current one.
+ *
+ * @returns VBox status code.
+ * @param   pSSM                The SSM handle.
+ * @param   pIdx                The RAM chunk index.
+ * @param   pRam                The RAM range the page belongs to.
+ * @param   GCPhys              The page address.
+ * @param   pGCPhysLast         The address of the last saved page.  This is
+ *                              set to NIL_RTGCPHYS when starting a new chunk
+ *                              so the record will carry the address.
+ */
+static int pgmR3SaveRamIdxAddPage(PSSMHANDLE pSSM, PPGMSSMRAMIDX pIdx, PPGMRAMRANGE pRam, RTGCPHYS GCPhys,
+                                  PRTGCPHYS pGCPhysLast)
+{
+    if (pIdx->cChunks)
+    {
+        PPGMSSMRAMCHUNK pChunk = &pIdx->paChunks[pIdx->cChunks - 1];
+        if (   pIdx->pRamLast == pRam
+            && pChunk->cPages < PGM_LAZY_CHUNK_PAGES
+            && GCPhys == pChunk->GCPhys + ((RTGCPHYS)pChunk->cPages << PAGE_SHIFT)
+            && GCPhys >> PGM_LAZY_CHUNK_SHIFT == pChunk->GCPhys >> PGM_LAZY_CHUNK_SHIFT)
+        {
+            pChunk->cPages++;
+            return VINF_SUCCESS;
+        }
+    }
+
+    if (pIdx->cChunks >= pIdx->cAllocated)
+    {
+        uint32_t const  cNew  = pIdx->cAllocated ? pIdx->cAllocated * 2 : 256;
+        void           *pvNew = RTMemRealloc(pIdx->paChunks, cNew * sizeof(pIdx->paChunks[0]));
+        if (!pvNew)
+            return VERR_NO_MEMORY;
+        pIdx->paChunks   = (PPGMSSMRAMCHUNK)pvNew;
+        pIdx->cAllocated = cNew;
+    }
+
+    PPGMSSMRAMCHUNK pChunk = &pIdx->paChunks[pIdx->cChunks];
+    int rc = SSMR3TellRecord(pSSM, &pChunk->offStream);
+    if (RT_FAILURE(rc))
+        return rc;
+    pChunk->GCPhys    = GCPhys;
+    pChunk->cPages    = 1;
+    pChunk->iRegion   = UINT32_MAX;
+    pChunk->fResident = false;
+    pIdx->cChunks++;
+    pIdx->pRamLast    = pRam;
+    *pGCPhysLast      = NIL_RTGCPHYS;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Allocates the page delta cache if configured.
+ *
+ * Failing to allocate the cache isn't fatal, the pages are just sent raw.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The VM handle.
+ */
+static int pgmR3DeltaCacheInit(PVM pVM)
+{
+    Assert(!pVM->pgm.s.LiveSave.pDeltaCacheR3);
+
+    uint32_t const cMB = pVM->pgm.s.LiveSave.cDeltaCacheMB;
+    if (!cMB)
+        return VINF_SUCCESS;
+
+    uint32_t cSlots = (uint32_t)(((uint64_t)cMB * _1M) >> PAGE_SHIFT);
+    while (cSlots & (cSlots - 1))
+        cSlots &= cSlots - 1;
+
+    PPGMLSDELTACACHE pDelta = (PPGMLSDELTACACHE)RTMemAllocZ(sizeof(*pDelta));
+    if (pDelta)
+    {
+        pDelta->cSlots   = cSlots;
+        pDelta->paGCPhys = (PRTGCPHYS)RTMemAlloc(cSlots * sizeof(RTGCPHYS));
+        pDelta->pbPages  = (uint8_t *)RTMemPageAlloc((size_t)cSlots << PAGE_SHIFT);
+        if (pDelta->paGCPhys && pDelta->pbPages)
+        {
+            for (uint32_t i = 0; i < cSlots; i++)
+                pDelta->paGCPhys[i] = NIL_RTGCPHYS;
+            pVM->pgm.s.LiveSave.pDeltaCacheR3 = pDelta;
+            LogRel(("PGM: Using a %u MB page delta cache for live save\n", cMB));
+            return VINF_SUCCESS;
+        }
+        RTMemPageFree(pDelta->pbPages, (size_t)cSlots << PAGE_SHIFT);
+        RTMemFree(pDelta->paGCPhys);
+        RTMemFree(pDelta);
+    }
+    LogRel(("PGM: Failed to allocate the %u MB page delta cache, sending pages raw\n", cMB));
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Frees the page delta cache.
+ *
+ * @param   pVM                 The VM handle.
+ */
+static void pgmR3DeltaCacheTerm(PVM pVM)
+{
+    PPGMLSDELTACACHE pDelta = pVM->pgm.s.LiveSave.pDeltaCacheR3;
+    if (pDelta)
+    {
+        pVM->pgm.s.LiveSave.pDeltaCacheR3 = NULL;
+        RTMemPageFree(pDelta->pbPages, (size_t)pDelta->cSlots << PAGE_SHIFT);
+        RTMemFree(pDelta->paGCPhys);
+        RTMemFree(pDelta);
+    }
+}
+
+
+/**
+ * Drops a page from the delta cache, used when it's sent as something the
+ * cached copy doesn't reflect.
+ *
+ * @param   pDelta              The page delta cache.
+ * @param   GCPhys              The page address.
+ */
+DECLINLINE(void) pgmR3DeltaCacheDrop(PPGMLSDELTACACHE pDelta, RTGCPHYS GCPhys)
+{
+    uint32_t const iSlot = (uint32_t)(GCPhys >> PAGE_SHIFT) & (pDelta->cSlots - 1);
+    if (pDelta->paGCPhys[iSlot] == GCPhys)
+        pDelta->paGCPhys[iSlot] = NIL_RTGCPHYS;
+}
+
+
 /**
  * Save quiescent RAM pages.
  *
@@ -1546,6 +1901,9 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
     RTGCPHYS GCPhysCur = 0;
     PPGMRAMRANGE pCur;
     bool fFTMDeltaSaveActive = FTMIsDeltaLoadSaveActive(pVM);
+    PPGMSSMRAMIDX pIdx = !fLiveSave && !fFTMDeltaSaveActive ? pVM->pgm.s.pSavedRamIdxR3 : NULL;
+    PPGMLSDELTACACHE pDelta = fLiveSave && !fFTMDeltaSaveActive ? pVM->pgm.s.LiveSave.pDeltaCacheR3 : NULL;
+    uint64_t cbDeltaSaved = 0;
 
     pgmLock(pVM);
     do
@@ -1623,6 +1981,16 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
                     bool        fBallooned = PGM_PAGE_IS_BALLOONED(pCurPage);
                     bool        fSkipped = false;
 
+                    if (pIdx)
+                    {
+                        rc = pgmR3SaveRamIdxAddPage(pSSM, pIdx, pCur, GCPhys, &GCPhysLast);
+                        if (RT_FAILURE(rc))
+                        {
+                            pgmUnlock(pVM);
+                            return rc;
+                        }
+                    }
+
                     if (!fZero && !fBallooned)
                     {
                         /*
@@ -1668,6 +2036,46 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
                                 else
                                     fSkipped = true;
                             }
+                            else if (pDelta)
+                            {
+                                /*
+                                 * Send it as a delta if we've got the previous copy
+                                 * and it doesn't differ too much, then remember it.
+                                 */
+                                uint32_t const iSlot   = (uint32_t)(GCPhys >> PAGE_SHIFT) & (pDelta->cSlots - 1);
+                                uint8_t       *pbSlot  = &pDelta->pbPages[(size_t)iSlot << PAGE_SHIFT];
+                                uint32_t       cbDelta = 0;
+                                bool const     fXor    = pDelta->paGCPhys[iSlot] == GCPhys
+                                                      && pgmR3DeltaEncode(pbSlot, abPage, pDelta->abEncoded, &cbDelta);
+                                uint8_t const  u8Type  = fXor ? PGM_STATE_REC_RAM_XOR : PGM_STATE_REC_RAM_RAW;
+                                if (GCPhys == GCPhysLast + PAGE_SIZE)
+                                    SSMR3PutU8(pSSM, u8Type);
+                                else
+                                {
+                                    SSMR3PutU8(pSSM, u8Type | PGM_STATE_REC_FLAG_ADDR);
+                                    SSMR3PutGCPhys(pSSM, GCPhys);
+                                }
+                                if (fXor)
+                                {
+                                    SSMR3PutU16(pSSM, (uint16_t)cbDelta);
+                                    rc = SSMR3PutMem(pSSM, pDelta->abEncoded, cbDelta);
+                                    cbDeltaSaved += PAGE_SIZE - sizeof(uint16_t) - cbDelta;
+                                    STAM_REL_COUNTER_INC(&pVM->pgm.s.LiveSave.StatDeltaPages);
+                                }
+                                else
+                                {
+                                    rc = SSMR3PutMem(pSSM, abPage, PAGE_SIZE);
+                                    if (uPass != 0)
+                                        STAM_REL_COUNTER_INC(&pVM->pgm.s.LiveSave.StatDeltaMisses);
+                                }
+
+                                /* No more passes after the final one. */
+                                if (uPass != SSM_PASS_FINAL)
+                                {
+                                    memcpy(pbSlot, abPage, PAGE_SIZE);
+                                    pDelta->paGCPhys[iSlot] = GCPhys;
+                                }
+                            }
                             else
                             {
                                 if (GCPhys == GCPhysLast + PAGE_SIZE)
@@ -1682,6 +2090,8 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
                         }
                         else
                         {
+                            if (pDelta)
+                                pgmR3DeltaCacheDrop(pDelta, GCPhys);
                             if (GCPhys == GCPhysLast + PAGE_SIZE)
                                 rc = SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_ZERO);
                             else
@@ -1702,6 +2112,8 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
 #endif
                         pgmUnlock(pVM);
 
+                        if (pDelta)
+                            pgmR3DeltaCacheDrop(pDelta, GCPhys);
                         uint8_t u8RecType = fBallooned ? PGM_STATE_REC_RAM_BALLOONED : PGM_STATE_REC_RAM_ZERO;
                         if (GCPhys == GCPhysLast + PAGE_SIZE)
                             rc = SSMR3PutU8(pSSM, u8RecType);
@@ -1743,6 +2155,13 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
 
     pgmUnlock(pVM);
 
+    if (pDelta)
+    {
+        pVM->pgm.s.LiveSave.cbDeltaSavedLastPass = cbDeltaSaved;
+        STAM_REL_COUNTER_ADD(&pVM->pgm.s.LiveSave.StatDeltaBytesSaved, cbDeltaSaved);
+        Log(("pgmR3SaveRamPages: pass %#x: the delta encoding saved %RU64 bytes\n", uPass, cbDeltaSaved));
+    }
+
     return VINF_SUCCESS;
 }
 
@@ -1811,6 +2230,8 @@ static void pgmR3DoneRamPages(PVM pVM)
 
     MMR3HeapFree(pvToFree);
     pvToFree = NULL;
+
+    pgmR3DeltaCacheTerm(pVM);
 }
 
 
@@ -1878,6 +2299,57 @@ static DECLCALLBACK(int) pgmR3LiveExec(PVM pVM, PSSMHANDLE pSSM, uint32_t uPass)
 }
 
 
+/**
+ * Adjusts the guest execution throttle for auto-converging live saves.
+ *
+ * The guest is throttled progressively harder while the estimated downtime
+ * doesn't fit the budget and it dirties pages at more than half the rate we
+ * manage to send them.  The throttle is never lowered during the live save,
+ * pgmR3SaveDone removes it.
+ *
+ * @param   pVM                 The VM handle.
+ * @param   pSSM                The SSM handle.
+ * @param   uPass               The data pass.
+ * @param   cDirtyNow           The number of dirty pages now.
+ * @param   cDirtyPagesShort    The short term dirty page average.
+ */
+static void pgmR3LiveAutoConverge(PVM pVM, PSSMHANDLE pSSM, uint32_t uPass, uint32_t cDirtyNow, uint32_t cDirtyPagesShort)
+{
+    /*
+     * The pages still dirty when voting were (more or less) dirtied during
+     * the pass, so summing them up over a period gives the dirty rate.
+     */
+    pVM->pgm.s.LiveSave.cDirtiedSinceCheck += cDirtyNow;
+    uint64_t const uNow       = RTTimeNanoTS();
+    uint64_t const cNsElapsed = uNow - pVM->pgm.s.LiveSave.uThrottleCheckNS;
+    if (   uPass < PGM_LIVE_THROTTLE_FIRST_PASS
+        || cNsElapsed < PGM_LIVE_THROTTLE_INTERVAL_NS)
+        return;
+
+    uint64_t const cDirtyPerSecond = (uint64_t)pVM->pgm.s.LiveSave.cDirtiedSinceCheck * RT_NS_1SEC / cNsElapsed;
+    pVM->pgm.s.LiveSave.cDirtiedSinceCheck = 0;
+    pVM->pgm.s.LiveSave.uThrottleCheckNS   = uNow;
+
+    uint32_t const cPagesPerSecond = RT_MAX(pVM->pgm.s.LiveSave.cPagesPerSecond, 1);
+    uint64_t const cMsLeft         = (uint64_t)cDirtyPagesShort * 1000 / cPagesPerSecond;
+    uint32_t const cMsMaxDowntime  = RT_MAX(SSMR3HandleMaxDowntime(pSSM), 32);
+    if (   cMsLeft <= cMsMaxDowntime
+        || cDirtyPerSecond <= cPagesPerSecond / 2)
+        return;
+
+    uint32_t const uOld = pVM->pgm.s.LiveSave.uThrottle;
+    uint32_t const uNew = RT_MIN(uOld ? uOld + PGM_LIVE_THROTTLE_STEP : PGM_LIVE_THROTTLE_INITIAL,
+                                 pVM->pgm.s.LiveSave.uThrottleMax);
+    if (uNew != uOld)
+    {
+        LogRel(("PGM: Live save not converging (pass %u: %RU64 dirty pages/s, %u pages/s, %RU64 ms left, %u ms allowed), throttling the guest by %u%%\n",
+                uPass, cDirtyPerSecond, cPagesPerSecond, cMsLeft, cMsMaxDowntime, uNew));
+        pVM->pgm.s.LiveSave.uThrottle = uNew;
+        EMR3SetExecutionThrottle(pVM, uNew);
+    }
+}
+
+
 /**
  * Votes on whether the live save phase is done or not.
  *
@@ -1932,6 +2404,9 @@ static DECLCALLBACK(int)  pgmR3LiveVote(PVM pVM, PSSMHANDLE pSSM, uint32_t uPass
                                           / ((long double)cNsElapsed / 1000000000.0) );
     pVM->pgm.s.LiveSave.cPagesPerSecond = cPagesPerSecond;
 
+    if (pVM->pgm.s.LiveSave.fAutoConverge)
+        pgmR3LiveAutoConverge(pVM, pSSM, uPass, cDirtyNow, cDirtyPagesShort);
+
     /*
      * Try make a decision.
      */
@@ -2001,6 +2476,14 @@ static DECLCALLBACK(int)  pgmR3LiveVote(PVM pVM, PSSMHANDLE pSSM, uint32_t uPass
  */
 static DECLCALLBACK(int) pgmR3LivePrep(PVM pVM, PSSMHANDLE pSSM)
 {
+    /*
+     * Pull in any RAM still left in a saved state file, the scanning
+     * doesn't know about it.
+     */
+    int rc = pgmR3LazyRestoreFetchAll(pVM);
+    if (RT_FAILURE(rc))
+        return rc;
+
     /*
      * Indicate that we will be using the write monitoring.
      */
@@ -2031,15 +2514,35 @@ static DECLCALLBACK(int) pgmR3LivePrep(PVM pVM, PSSMHANDLE pSSM)
     pVM->pgm.s.LiveSave.cSavedPages       = 0;
     pVM->pgm.s.LiveSave.uSaveStartNS      = RTTimeNanoTS();
     pVM->pgm.s.LiveSave.cPagesPerSecond   = 8192;
+    pVM->pgm.s.LiveSave.cbDeltaSavedLastPass = 0;
+
+    /** @cfgm{/PGM/LiveSaveAutoConverge, bool, false}
+     * Whether to throttle the virtual CPUs when the guest dirties memory faster
+     * than live save or teleportation can transfer it, so the max downtime can
+     * be met. */
+    PCFGMNODE pCfgPGM = CFGMR3GetChild(CFGMR3GetRoot(pVM), "/PGM");
+    rc = CFGMR3QueryBoolDef(pCfgPGM, "LiveSaveAutoConverge", &pVM->pgm.s.LiveSave.fAutoConverge, false);
+    AssertLogRelRCReturn(rc, rc);
+    /** @cfgm{/PGM/LiveSaveAutoConvergeMax, uint32_t, 90, 1, 99, %}
+     * The max guest execution throttle applied by auto-converge. */
+    rc = CFGMR3QueryU32Def(pCfgPGM, "LiveSaveAutoConvergeMax", &pVM->pgm.s.LiveSave.uThrottleMax, 90);
+    AssertLogRelRCReturn(rc, rc);
+    AssertLogRelMsgReturn(pVM->pgm.s.LiveSave.uThrottleMax >= 1 && pVM->pgm.s.LiveSave.uThrottleMax <= 99,
+                          ("LiveSaveAutoConvergeMax=%u\n", pVM->pgm.s.LiveSave.uThrottleMax), VERR_OUT_OF_RANGE);
+    pVM->pgm.s.LiveSave.uThrottle          = 0;
+    pVM->pgm.s.LiveSave.cDirtiedSinceCheck = 0;
+    pVM->pgm.s.LiveSave.uThrottleCheckNS   = RTTimeNanoTS();
 
     /*
      * Per page type.
      */
-    int rc = pgmR3PrepRomPages(pVM);
+    rc = pgmR3PrepRomPages(pVM);
     if (RT_SUCCESS(rc))
         rc = pgmR3PrepMmio2Pages(pVM);
     if (RT_SUCCESS(rc))
         rc = pgmR3PrepRamPages(pVM);
+    if (RT_SUCCESS(rc))
+        rc = pgmR3DeltaCacheInit(pVM);
     return rc;
 }
 
@@ -2056,6 +2559,13 @@ static DECLCALLBACK(int) pgmR3SaveExec(PVM pVM, PSSMHANDLE pSSM)
     int     rc   = VINF_SUCCESS;
     PPGM    pPGM = &pVM->pgm.s;
 
+    /*
+     * Pull in any RAM still left in a saved state file.
+     */
+    rc = pgmR3LazyRestoreFetchAll(pVM);
+    if (RT_FAILURE(rc))
+        return rc;
+
     /*
      * Lock PGM and set the no-more-writes indicator.
      */
@@ -2104,7 +2614,16 @@ static DECLCALLBACK(int) pgmR3SaveExec(PVM pVM, PSSMHANDLE pSSM)
             if (RT_SUCCESS(rc))
                 rc = pgmR3SaveMmio2Pages(      pVM, pSSM, false /*fLiveSave*/, SSM_PASS_FINAL);
             if (RT_SUCCESS(rc))
+            {
+                /* Index the RAM page records for demand paged restoring, see
+                   the pgmidx unit.  The state is just fine without it. */
+                Assert(!pVM->pgm.s.pSavedRamIdxR3);
+                if (pVM->pgm.s.pLazyRestoreR3 && !FTMIsDeltaLoadSaveActive(pVM))
+                    pVM->pgm.s.pSavedRamIdxR3 = (PPGMSSMRAMIDX)RTMemAllocZ(sizeof(PGMSSMRAMIDX));
                 rc = pgmR3SaveRamPages(        pVM, pSSM, false /*fLiveSave*/, SSM_PASS_FINAL);
+                if (RT_SUCCESS(rc) && pVM->pgm.s.pSavedRamIdxR3)
+                    rc = SSMR3TellRecord(pSSM, &pVM->pgm.s.pSavedRamIdxR3->offEnd);
+            }
         }
         SSMR3PutU8(pSSM, PGM_STATE_REC_END);    /* (Ignore the rc, SSM takes of it.) */
     }
@@ -2132,6 +2651,17 @@ static DECLCALLBACK(int) pgmR3SaveDone(PVM pVM, PSSMHANDLE pSSM)
         pgmR3DoneMmio2Pages(pVM);
         pgmR3DoneRamPages(pVM);
     }
+    pgmR3SaveRamIdxFree(pVM);
+
+    /*
+     * Let the guest run at full speed again if auto-converge throttled it.
+     */
+    if (pVM->pgm.s.LiveSave.uThrottle)
+    {
+        LogRel(("PGM: Removing the %u%% live save guest throttle\n", pVM->pgm.s.LiveSave.uThrottle));
+        pVM->pgm.s.LiveSave.uThrottle = 0;
+        EMR3SetExecutionThrottle(pVM, 0);
+    }
 
     /*
      * Clear the live save indicator and disengage write monitoring.
@@ -2161,6 +2691,15 @@ static DECLCALLBACK(int) pgmR3LoadPrep(PVM pVM, PSSMHANDLE pSSM)
      */
     PGMR3Reset(pVM);
     pVM->pgm.s.LiveSave.fActive = false;
+
+    PPGMLAZYRESTORE pLazy = pVM->pgm.s.pLazyRestoreR3;
+    if (pLazy)
+    {
+        pLazy->u64LoadStartNS     = RTTimeNanoTS();
+        pLazy->fFirstInstrPending = true;
+        pLazy->cNsToFirstInstr    = 0;
+        pLazy->cNsToResident      = 0;
+    }
     NOREF(pSSM);
     return VINF_SUCCESS;
 }
@@ -2586,11 +3125,14 @@ static int pgmR3LoadMemoryOld(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion)
  * @param   pSSM                The SSM handle.
  * @param   uVersion            The PGM saved state unit version.
  * @param   uPass               The pass number.
+ * @param   pfRamDeferred       Where to indicate that we stopped at the first
+ *                              RAM page record because the RAM is to be loaded
+ *                              on demand.  NULL if all records should be loaded.
  *
  * @todo    This needs splitting up if more record types or code twists are
  *          added...
  */
-static int pgmR3LoadMemory(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t uPass)
+static int pgmR3LoadMemory(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t uPass, bool *pfRamDeferred)
 {
     /*
      * Process page records until we hit the terminator.
@@ -2621,8 +3163,16 @@ static int pgmR3LoadMemory(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t
         rc = SSMR3GetU8(pSSM, &u8);
         if (RT_FAILURE(rc))
             return rc;
-        if (u8 == PGM_STATE_REC_END)
+        bool const fDeferRam = pfRamDeferred
+                            && (   (u8 & ~PGM_STATE_REC_FLAG_ADDR) == PGM_STATE_REC_RAM_ZERO
+                                || (u8 & ~PGM_STATE_REC_FLAG_ADDR) == PGM_STATE_REC_RAM_RAW
+                                || (u8 & ~PGM_STATE_REC_FLAG_ADDR) == PGM_STATE_REC_RAM_BALLOONED);
+        if (u8 == PGM_STATE_REC_END || fDeferRam)
         {
+            /* The RAM records come last, pgmR3LazyRestoreArm skips them. */
+            if (fDeferRam)
+                *pfRamDeferred = true;
+
             /*
              * Finish off any pages pending freeing.
              */
@@ -2644,6 +3194,7 @@ static int pgmR3LoadMemory(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t
             case PGM_STATE_REC_RAM_ZERO:
             case PGM_STATE_REC_RAM_RAW:
             case PGM_STATE_REC_RAM_BALLOONED:
+            case PGM_STATE_REC_RAM_XOR:
             {
                 /*
                  * Get the address and resolve it into a page descriptor.
@@ -2746,6 +3297,30 @@ static int pgmR3LoadMemory(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t
                         break;
                     }
 
+                    case PGM_STATE_REC_RAM_XOR:
+                    {
+                        uint16_t cbDelta;
+                        rc = SSMR3GetU16(pSSM, &cbDelta);
+                        if (RT_FAILURE(rc))
+                            return rc;
+                        AssertLogRelMsgReturn(cbDelta < PGM_STATE_XOR_MAX, ("GCPhys=%RGp cbDelta=%#x\n", GCPhys, cbDelta),
+                                              VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+                        uint8_t abDelta[PGM_STATE_XOR_MAX];
+                        rc = SSMR3GetMem(pSSM, abDelta, cbDelta);
+                        if (RT_FAILURE(rc))
+                            return rc;
+
+                        PGMPAGEMAPLOCK PgMpLck;
+                        void          *pvDstPage;
+                        rc = pgmPhysGCPhys2CCPtrInternal(pVM, pPage, GCPhys, &pvDstPage, &PgMpLck);
+                        AssertLogRelMsgRCReturn(rc, ("GCPhys=%RGp %R[pgmpage] rc=%Rrc\n", GCPhys, pPage, rc), rc);
+                        rc = pgmR3DeltaDecode((uint8_t *)pvDstPage, abDelta, cbDelta);
+                        pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+                        if (RT_FAILURE(rc))
+                            return rc;
+                        break;
+                    }
+
                     default:
                         AssertMsgFailedReturn(("%#x\n", u8), VERR_PGM_SAVED_REC_TYPE);
                 }
@@ -2938,58 +3513,1004 @@ static int pgmR3LoadMemory(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t
 
 
 /**
- * Worker for pgmR3Load.
- *
- * @returns VBox status code.
+ * Looks up the RAM chunk containing a page.
  *
- * @param   pVM                 The VM handle.
- * @param   pSSM                The SSM handle.
- * @param   uVersion            The saved state version.
+ * @returns The chunk index, UINT32_MAX if not found.
+ * @param   pLazy               The lazy restore state.
+ * @param   GCPhys              The address.
  */
-static int pgmR3LoadFinalLocked(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion)
+static uint32_t pgmR3LazyRestoreLookup(PPGMLAZYRESTORE pLazy, RTGCPHYS GCPhys)
 {
-    PPGM        pPGM = &pVM->pgm.s;
-    int         rc;
-    uint32_t    u32Sep;
-
-    /*
-     * Load basic data (required / unaffected by relocation).
-     */
-    if (uVersion >= PGM_SAVED_STATE_VERSION_3_0_0)
+    uint32_t iStart = 0;
+    uint32_t iEnd   = pLazy->cChunks;
+    while (iStart < iEnd)
     {
-        if (uVersion > PGM_SAVED_STATE_VERSION_PRE_BALLOON)
-            rc = SSMR3GetStruct(pSSM, pPGM, &s_aPGMFields[0]);
+        uint32_t const  i      = iStart + (iEnd - iStart) / 2;
+        PPGMSSMRAMCHUNK pChunk = &pLazy->paChunks[i];
+        if (GCPhys < pChunk->GCPhys)
+            iEnd = i;
+        else if (GCPhys - pChunk->GCPhys >= ((RTGCPHYS)pChunk->cPages << PAGE_SHIFT))
+            iStart = i + 1;
         else
-            rc = SSMR3GetStruct(pSSM, pPGM, &s_aPGMFieldsPreBalloon[0]);
+            return i;
+    }
+    return UINT32_MAX;
+}
 
-        AssertLogRelRCReturn(rc, rc);
 
-        for (VMCPUID i = 0; i < pVM->cCpus; i++)
+/**
+ * Reads the page records of a RAM chunk from the saved state.
+ *
+ * @returns VBox status code.
+ * @param   pLazy               The lazy restore state.  Caller owns the
+ *                              critical section.
+ * @param   iChunk              The chunk to read.
+ * @param   ppBuf               Where to return the buffer.  Free it with
+ *                              RTMemFree.
+ */
+static int pgmR3LazyRestoreFetch(PPGMLAZYRESTORE pLazy, uint32_t iChunk, PPGMLAZYBUF *ppBuf)
+{
+    Assert(RTCritSectIsOwner(&pLazy->CritSect));
+    PPGMSSMRAMCHUNK pChunk = &pLazy->paChunks[iChunk];
+    PPGMLAZYBUF     pBuf   = (PPGMLAZYBUF)RTMemAlloc(RT_OFFSETOF(PGMLAZYBUF, abData) + ((size_t)pChunk->cPages << PAGE_SHIFT));
+    if (!pBuf)
+        return VERR_NO_MEMORY;
+    pBuf->idGen  = pLazy->idGen;
+    pBuf->iChunk = iChunk;
+
+    PSSMHANDLE  pSSM   = pLazy->pSSM;
+    RTGCPHYS    GCPhys = NIL_RTGCPHYS;
+    uint32_t    cRaw   = 0;
+    int rc = SSMR3SeekRecord(pSSM, pChunk->offStream);
+    for (uint32_t iPage = 0; iPage < pChunk->cPages && RT_SUCCESS(rc); iPage++)
+    {
+        uint8_t u8;
+        rc = SSMR3GetU8(pSSM, &u8);
+        if (RT_FAILURE(rc))
+            break;
+        if (!(u8 & PGM_STATE_REC_FLAG_ADDR))
+            GCPhys += PAGE_SIZE;
+        else
         {
-            if (uVersion <= PGM_SAVED_STATE_VERSION_PRE_PAE)
-                rc = SSMR3GetStruct(pSSM, &pVM->aCpus[i].pgm.s, &s_aPGMCpuFieldsPrePae[0]);
-            else
-                rc = SSMR3GetStruct(pSSM, &pVM->aCpus[i].pgm.s, &s_aPGMCpuFields[0]);
-            AssertLogRelRCReturn(rc, rc);
+            rc = SSMR3GetGCPhys(pSSM, &GCPhys);
+            if (RT_FAILURE(rc))
+                break;
+        }
+        if (GCPhys != pChunk->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT))
+        {
+            rc = VERR_SSM_DATA_UNIT_FORMAT_CHANGED;
+            break;
+        }
+
+        pBuf->abTypes[iPage] = u8 & ~PGM_STATE_REC_FLAG_ADDR;
+        switch (u8 & ~PGM_STATE_REC_FLAG_ADDR)
+        {
+            case PGM_STATE_REC_RAM_RAW:
+                rc = SSMR3GetMem(pSSM, &pBuf->abData[(size_t)iPage << PAGE_SHIFT], PAGE_SIZE);
+                cRaw++;
+                break;
+            case PGM_STATE_REC_RAM_ZERO:
+            case PGM_STATE_REC_RAM_BALLOONED:
+                break;
+            default:
+                rc = VERR_SSM_DATA_UNIT_FORMAT_CHANGED;
+                break;
         }
     }
-    else if (uVersion >= PGM_SAVED_STATE_VERSION_RR_DESC)
+    if (RT_FAILURE(rc))
     {
-        AssertRelease(pVM->cCpus == 1);
+        LogRel(("PGM: Failed to read the RAM at %RGp LB %#x from the saved state (offStream=%#llx): %Rrc\n",
+                pChunk->GCPhys, pChunk->cPages << PAGE_SHIFT, pChunk->offStream, rc));
+        RTMemFree(pBuf);
+        return rc;
+    }
 
-        PGMOLD pgmOld;
-        rc = SSMR3GetStruct(pSSM, &pgmOld, &s_aPGMFields_Old[0]);
-        AssertLogRelRCReturn(rc, rc);
+    STAM_REL_COUNTER_ADD(&pLazy->StatBytesRead, (uint64_t)cRaw << PAGE_SHIFT);
+    *ppBuf = pBuf;
+    return VINF_SUCCESS;
+}
 
-        pPGM->fMappingsFixed    = pgmOld.fMappingsFixed;
-        pPGM->GCPtrMappingFixed = pgmOld.GCPtrMappingFixed;
-        pPGM->cbMappingFixed    = pgmOld.cbMappingFixed;
 
-        pVM->aCpus[0].pgm.s.fA20Enabled   = pgmOld.fA20Enabled;
-        pVM->aCpus[0].pgm.s.GCPhysA20Mask = pgmOld.GCPhysA20Mask;
-        pVM->aCpus[0].pgm.s.enmGuestMode  = pgmOld.enmGuestMode;
-    }
-    else
+/**
+ * Stops the demand paged restore, releasing the second saved state handle and
+ * the access handlers.
+ *
+ * Pages not yet loaded at this point are left as they are, so this should only
+ * be called when all of them have been loaded or when resetting the VM.
+ *
+ * @param   pVM                 The VM handle.
+ * @param   pLazy               The lazy restore state.
+ */
+static void pgmR3LazyRestoreRelease(PVM pVM, PPGMLAZYRESTORE pLazy)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    ASMAtomicWriteBool(&pVM->pgm.s.fLazyRestoreActive, false);
+
+    /*
+     * Stop the prefetcher.  It never waits on the PGM lock.
+     */
+    if (pLazy->hThread != NIL_RTTHREAD)
+    {
+        ASMAtomicWriteBool(&pLazy->fTerminate, true);
+        RTSemEventSignal(pLazy->hEvtPrefetch);
+        int rc = RTThreadWait(pLazy->hThread, RT_INDEFINITE_WAIT, NULL);
+        AssertLogRelRC(rc);
+        pLazy->hThread = NIL_RTTHREAD;
+        ASMAtomicWriteBool(&pLazy->fTerminate, false);
+    }
+
+    /*
+     * Drop the access handlers.
+     */
+    for (uint32_t iRegion = 0; iRegion < pLazy->cRegions; iRegion++)
+        if (pLazy->paRegions[iRegion].fRegistered)
+        {
+            int rc = PGMHandlerPhysicalDeregister(pVM, pLazy->paRegions[iRegion].GCPhys);
+            AssertLogRelRC(rc);
+            pLazy->paRegions[iRegion].fRegistered = false;
+        }
+
+    /*
+     * Close the saved state and free the arrays.
+     */
+    RTCritSectEnter(&pLazy->CritSect);
+    pLazy->idGen++;
+    if (pLazy->pSSM)
+    {
+        SSMR3Close(pLazy->pSSM);
+        pLazy->pSSM = NULL;
+    }
+    RTMemFree(pLazy->paChunks);
+    pLazy->paChunks    = NULL;
+    pLazy->cChunks     = 0;
+    pLazy->cResident   = 0;
+    pLazy->cChunksLeft = 0;
+    RTMemFree(pLazy->paRegions);
+    pLazy->paRegions   = NULL;
+    pLazy->cRegions    = 0;
+    RTCritSectLeave(&pLazy->CritSect);
+}
+
+
+/**
+ * Copies a RAM chunk read by pgmR3LazyRestoreFetch into guest memory.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The VM handle.
+ * @param   pLazy               The lazy restore state.
+ * @param   pBuf                The chunk buffer.
+ *
+ * @thread  EMT, caller owns the PGM lock.
+ */
+static int pgmR3LazyRestoreInstall(PVM pVM, PPGMLAZYRESTORE pLazy, PPGMLAZYBUF pBuf)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    VM_ASSERT_EMT(pVM);
+
+    /* Dropped or already loaded by someone else? */
+    if (pBuf->idGen != pLazy->idGen)
+        return VINF_SUCCESS;
+    PPGMSSMRAMCHUNK pChunk = &pLazy->paChunks[pBuf->iChunk];
+    if (pChunk->fResident)
+        return VINF_SUCCESS;
+    PPGMLAZYREGION  pRegion = pChunk->iRegion != UINT32_MAX ? &pLazy->paRegions[pChunk->iRegion] : NULL;
+
+    PPGMRAMRANGE    pRamHint = NULL;
+    for (uint32_t iPage = 0; iPage < pChunk->cPages; iPage++)
+    {
+        RTGCPHYS const GCPhys = pChunk->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT);
+        PPGMPAGE       pPage;
+        int rc = pgmPhysGetPageWithHintEx(pVM, GCPhys, &pPage, &pRamHint);
+        AssertLogRelMsgRCReturn(rc, ("GCPhys=%RGp %Rrc\n", GCPhys, rc), rc);
+
+        switch (pBuf->abTypes[iPage])
+        {
+            case PGM_STATE_REC_RAM_RAW:
+            {
+                PGMPAGEMAPLOCK  PgMpLck;
+                void           *pvDstPage;
+                rc = pgmPhysGCPhys2CCPtrInternal(pVM, pPage, GCPhys, &pvDstPage, &PgMpLck);
+                AssertLogRelMsgRCReturn(rc, ("GCPhys=%RGp %Rrc\n", GCPhys, rc), rc);
+                memcpy(pvDstPage, &pBuf->abData[(size_t)iPage << PAGE_SHIFT], PAGE_SIZE);
+                pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+                break;
+            }
+
+            case PGM_STATE_REC_RAM_ZERO:
+            case PGM_STATE_REC_RAM_BALLOONED:
+            {
+                if (PGM_PAGE_IS_ZERO(pPage))
+                {
+                    if (pBuf->abTypes[iPage] == PGM_STATE_REC_RAM_BALLOONED)
+                        PGM_PAGE_SET_STATE(pVM, pPage, PGM_PAGE_STATE_BALLOONED);
+                    break;
+                }
+                if (PGM_PAGE_IS_BALLOONED(pPage))
+                    break;
+
+                /* Someone wrote to it already (prealloc, ...), so just clear it. */
+                PGMPAGEMAPLOCK  PgMpLck;
+                void           *pvDstPage;
+                rc = pgmPhysGCPhys2CCPtrInternal(pVM, pPage, GCPhys, &pvDstPage, &PgMpLck);
+                AssertLogRelMsgRCReturn(rc, ("GCPhys=%RGp %Rrc\n", GCPhys, rc), rc);
+                ASMMemZeroPage(pvDstPage);
+                pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+                break;
+            }
+
+            default:
+                AssertLogRelMsgFailedReturn(("%#x\n", pBuf->abTypes[iPage]), VERR_PGM_SAVED_REC_TYPE);
+        }
+
+        if (pRegion)
+            PGMHandlerPhysicalPageTempOff(pVM, pRegion->GCPhys, GCPhys);
+    }
+
+    /*
+     * Update the accounting, dropping the access handler when the whole region
+     * has been loaded.
+     */
+    pChunk->fResident = true;
+    pLazy->cResident++;
+    pLazy->cChunksLeft = pLazy->cChunks - pLazy->cResident;
+    if (pRegion && ++pRegion->cResident == pRegion->cChunks)
+    {
+        int rc = PGMHandlerPhysicalDeregister(pVM, pRegion->GCPhys);
+        AssertLogRelRC(rc);
+        pRegion->fRegistered = false;
+    }
+
+    if (pLazy->cResident == pLazy->cChunks)
+    {
+        if (pLazy->u64LoadStartNS)
+            pLazy->cNsToResident = RTTimeNanoTS() - pLazy->u64LoadStartNS;
+        LogRel(("PGM: Lazy restore: All RAM loaded, %'RU64 ns after starting the restore (%'RU64 ns to first instruction)\n",
+                pLazy->cNsToResident, pLazy->cNsToFirstInstr));
+        pgmR3LazyRestoreRelease(pVM, pLazy);
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * pgmR3LazyRestoreInstall wrapper that takes the PGM lock and frees the buffer.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The VM handle.
+ * @param   pBuf                The chunk buffer.  Freed.
+ *
+ * @thread  EMT.
+ */
+static DECLCALLBACK(int) pgmR3LazyRestoreInstallAndFree(PVM pVM, PPGMLAZYBUF pBuf)
+{
+    pgmLock(pVM);
+    int rc = pgmR3LazyRestoreInstall(pVM, pVM->pgm.s.pLazyRestoreR3, pBuf);
+    pgmUnlock(pVM);
+    RTMemFree(pBuf);
+    return rc;
+}
+
+
+/**
+ * Makes sure the RAM chunk containing the given page has been loaded.
+ *
+ * @returns VBox status code.  Failures have been reported.
+ * @param   pVM                 The VM handle.
+ * @param   GCPhys              The page address.
+ * @param   fFault              Set if called by the access handler, clear if
+ *                              called thru pgmR3LazyRestoreTouch.
+ *
+ * @thread  Any, but non-EMT callers must not own the PGM lock.
+ */
+static int pgmR3LazyRestoreEnsureResident(PVM pVM, RTGCPHYS GCPhys, bool fFault)
+{
+    PPGMLAZYRESTORE pLazy = pVM->pgm.s.pLazyRestoreR3;
+    bool const      fEmt  = VM_IS_EMT(pVM);
+    if (!fEmt && PGMIsLockOwner(pVM))
+    {
+        /* The EMT would need the PGM lock to install it. */
+        AssertMsgFailed(("GCPhys=%RGp\n", GCPhys));
+        return VERR_WRONG_ORDER;
+    }
+
+    /*
+     * Read it.
+     */
+    PPGMLAZYBUF pBuf = NULL;
+    int         rc   = VINF_SUCCESS;
+    RTCritSectEnter(&pLazy->CritSect);
+    uint32_t const iChunk = pLazy->paChunks ? pgmR3LazyRestoreLookup(pLazy, GCPhys) : UINT32_MAX;
+    if (   iChunk != UINT32_MAX
+        && !pLazy->paChunks[iChunk].fResident)
+        rc = pgmR3LazyRestoreFetch(pLazy, iChunk, &pBuf);
+    RTCritSectLeave(&pLazy->CritSect);
+
+    /*
+     * Install it.  Only EMTs can do this because of the access handlers.
+     */
+    if (pBuf)
+    {
+        if (fFault)
+            STAM_REL_COUNTER_INC(&pLazy->StatFaults);
+        else
+            STAM_REL_COUNTER_INC(&pLazy->StatTouches);
+        if (fEmt)
+            rc = pgmR3LazyRestoreInstallAndFree(pVM, pBuf);
+        else
+            rc = VMR3ReqPriorityCallWait(pVM, VMCPUID_ANY, (PFNRT)pgmR3LazyRestoreInstallAndFree, 2, pVM, pBuf);
+    }
+    if (RT_FAILURE(rc))
+        VMSetRuntimeError(pVM, VMSETRTERR_FLAGS_FATAL, "PGMLazyRestoreFailed",
+                          N_("Failed to load the guest RAM at %RGp from the saved state (%Rrc)"), GCPhys, rc);
+    return rc;
+}
+
+
+/**
+ * Called by the ring-3 page mapping APIs before mapping a page while
+ * PGM::fLazyRestoreActive is set.
+ *
+ * @param   pVM                 The VM handle.
+ * @param   GCPhys              The address of the page being mapped.
+ */
+void pgmR3LazyRestoreTouch(PVM pVM, RTGCPHYS GCPhys)
+{
+    /* Non-EMTs owning the PGM lock cannot wait for an EMT to install the
+       chunk.  Guest accesses are still caught by the access handler. */
+    if (!VM_IS_EMT(pVM) && PGMIsLockOwner(pVM))
+        return;
+    pgmR3LazyRestoreEnsureResident(pVM, GCPhys & ~(RTGCPHYS)PAGE_OFFSET_MASK, false /*fFault*/);
+}
+
+
+/**
+ * \#PF Handler callback for RAM not yet loaded from the saved state.
+ *
+ * @returns VINF_SUCCESS if the handler has carried out the operation.
+ * @returns VINF_PGM_HANDLER_DO_DEFAULT if the caller should carry out the access operation.
+ * @param   pVM             VM Handle.
+ * @param   GCPhys          The physical address the guest is writing to.
+ * @param   pvPhys          The HC mapping of that address.
+ * @param   pvBuf           What the guest is reading/writing.
+ * @param   cbBuf           How much it's reading/writing.
+ * @param   enmAccessType   The access type.
+ * @param   pvUser          User argument.
+ */
+static DECLCALLBACK(int) pgmR3LazyRestoreHandler(PVM pVM, RTGCPHYS GCPhys, void *pvPhys, void *pvBuf, size_t cbBuf,
+                                                 PGMACCESSTYPE enmAccessType, void *pvUser)
+{
+    NOREF(pvPhys); NOREF(pvUser);
+    if (!ASMAtomicReadBool(&pVM->pgm.s.fLazyRestoreActive))
+        return VINF_PGM_HANDLER_DO_DEFAULT;
+
+    int rc = pgmR3LazyRestoreEnsureResident(pVM, GCPhys, true /*fFault*/);
+    if (   RT_SUCCESS(rc)
+        && enmAccessType == PGMACCESSTYPE_READ)
+    {
+        /* pvPhys may be the zero page we just replaced, so read it again. */
+        rc = PGMPhysSimpleReadGCPhys(pVM, pvBuf, GCPhys, cbBuf);
+        if (RT_SUCCESS(rc))
+            return VINF_SUCCESS;
+    }
+    return VINF_PGM_HANDLER_DO_DEFAULT;
+}
+
+
+/**
+ * Installs a chunk read by the prefetcher.
+ *
+ * The request may still be queued when pgmR3LazyRestoreTerm runs, so the
+ * state is only looked at while owning the PGM lock and the chunk is dropped
+ * if it is gone.
+ *
+ * @param   pVM                 The VM handle.
+ * @param   pBuf                The chunk buffer.  Freed.
+ *
+ * @thread  EMT.
+ */
+static DECLCALLBACK(void) pgmR3LazyRestorePrefetchDone(PVM pVM, PPGMLAZYBUF pBuf)
+{
+    pgmLock(pVM);
+    PPGMLAZYRESTORE pLazy = pVM->pgm.s.pLazyRestoreR3;
+    if (pLazy)
+    {
+        STAM_REL_COUNTER_INC(&pLazy->StatPrefetched);
+        int rc = pgmR3LazyRestoreInstall(pVM, pLazy, pBuf);
+        AssertLogRelRC(rc);
+        ASMAtomicDecU32(&pLazy->cInFlight);
+        RTSemEventSignal(pLazy->hEvtPrefetch);
+    }
+    pgmUnlock(pVM);
+    RTMemFree(pBuf);
+}
+
+
+/**
+ * The prefetcher thread, reads the remaining RAM chunks in address order and
+ * hands them to an EMT for installing.
+ *
+ * @returns VINF_SUCCESS.
+ * @param   hThreadSelf         The thread handle.
+ * @param   pvUser              The VM handle.
+ */
+static DECLCALLBACK(int) pgmR3LazyRestorePrefetchThread(RTTHREAD hThreadSelf, void *pvUser)
+{
+    PVM             pVM    = (PVM)pvUser;
+    PPGMLAZYRESTORE pLazy  = pVM->pgm.s.pLazyRestoreR3;
+    uint32_t        iChunk = 0;
+    NOREF(hThreadSelf);
+
+    while (!ASMAtomicReadBool(&pLazy->fTerminate))
+    {
+        /* Don't get too far ahead of the EMTs. */
+        if (ASMAtomicReadU32(&pLazy->cInFlight) >= PGM_LAZY_MAX_IN_FLIGHT)
+        {
+            RTSemEventWait(pLazy->hEvtPrefetch, 100);
+            continue;
+        }
+
+        PPGMLAZYBUF pBuf = NULL;
+        int         rc   = VINF_SUCCESS;
+        RTCritSectEnter(&pLazy->CritSect);
+        while (iChunk < pLazy->cChunks && pLazy->paChunks[iChunk].fResident)
+            iChunk++;
+        bool const fDone = iChunk >= pLazy->cChunks;
+        if (!fDone)
+            rc = pgmR3LazyRestoreFetch(pLazy, iChunk++, &pBuf);
+        RTCritSectLeave(&pLazy->CritSect);
+        if (fDone || RT_FAILURE(rc))
+            break; /* Read errors are reported by the access handler. */
+
+        ASMAtomicIncU32(&pLazy->cInFlight);
+        rc = VMR3ReqCallVoidNoWait(pVM, VMCPUID_ANY, (PFNRT)pgmR3LazyRestorePrefetchDone, 2, pVM, pBuf);
+        if (RT_FAILURE(rc))
+        {
+            ASMAtomicDecU32(&pLazy->cInFlight);
+            RTMemFree(pBuf);
+            break;
+        }
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Loads a RAM chunk right away.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The VM handle.
+ * @param   pLazy               The lazy restore state.
+ * @param   iChunk              The chunk.
+ *
+ * @thread  EMT, caller owns the PGM lock.
+ */
+static int pgmR3LazyRestoreLoadChunkNow(PVM pVM, PPGMLAZYRESTORE pLazy, uint32_t iChunk)
+{
+    PPGMLAZYBUF pBuf;
+    RTCritSectEnter(&pLazy->CritSect);
+    int rc = pgmR3LazyRestoreFetch(pLazy, iChunk, &pBuf);
+    RTCritSectLeave(&pLazy->CritSect);
+    if (RT_SUCCESS(rc))
+    {
+        rc = pgmR3LazyRestoreInstall(pVM, pLazy, pBuf);
+        RTMemFree(pBuf);
+    }
+    return rc;
+}
+
+
+/**
+ * Checks whether a RAM chunk can be covered by a lazy restore access handler.
+ *
+ * @returns The RAM range if it can, NULL if the chunk must be loaded up front.
+ * @param   pVM                 The VM handle.
+ * @param   pChunk              The chunk.
+ */
+static PPGMRAMRANGE pgmR3LazyRestoreCheckChunk(PVM pVM, PPGMSSMRAMCHUNK pChunk)
+{
+    PPGMRAMRANGE pRam = pgmPhysGetRange(pVM, pChunk->GCPhys);
+    if (   !pRam
+        || pChunk->GCPhys + ((RTGCPHYS)pChunk->cPages << PAGE_SHIFT) - 1 > pRam->GCPhysLast)
+        return NULL;
+
+    PPGMPAGE pPage = &pRam->aPages[(pChunk->GCPhys - pRam->GCPhys) >> PAGE_SHIFT];
+    for (uint32_t iPage = 0; iPage < pChunk->cPages; iPage++, pPage++)
+        if (   PGM_PAGE_GET_TYPE(pPage) != PGMPAGETYPE_RAM
+            || PGM_PAGE_HAS_ANY_HANDLERS(pPage))
+            return NULL;
+    return pRam;
+}
+
+
+/**
+ * Prepares for loading the RAM of a saved state on demand when configured and
+ * possible.
+ *
+ * This opens a second handle to the saved state file, reads the RAM chunk index
+ * from the pgmidx unit and positions the handle at the pgm unit.  Any trouble
+ * just means the RAM is loaded the normal way.
+ *
+ * @param   pVM                 The VM handle.
+ * @param   pSSM                The SSM handle.
+ * @param   pfLazy              Where to return whether the RAM should be loaded
+ *                              on demand.
+ */
+static void pgmR3LazyRestoreSetup(PVM pVM, PSSMHANDLE pSSM, bool *pfLazy)
+{
+    *pfLazy = false;
+    PPGMLAZYRESTORE pLazy = pVM->pgm.s.pLazyRestoreR3;
+    if (!pLazy)
+        return;
+    Assert(!pLazy->pSSM && !pLazy->paChunks);
+
+    const char *pszFilename = SSMR3HandleGetFilename(pSSM);
+    if (!pszFilename)
+    {
+        LogRel(("PGM: Lazy restore: Not restoring from a file, loading all RAM now.\n"));
+        return;
+    }
+    if (!pVM->pgm.s.fNestedPaging)
+    {
+        LogRel(("PGM: Lazy restore: Requires nested paging, loading all RAM now.\n"));
+        return;
+    }
+    if (FTMIsDeltaLoadSaveActive(pVM))
+        return;
+
+    /*
+     * Read the index.
+     */
+    PSSMHANDLE      pSSMIdx  = NULL;
+    PPGMSSMRAMCHUNK paChunks = NULL;
+    uint32_t        cChunks  = 0;
+    uint64_t        offEnd   = 0;
+    uint32_t        uVersion = 0;
+    int rc = SSMR3Open(pszFilename, 0 /*fFlags*/, &pSSMIdx);
+    if (RT_SUCCESS(rc))
+        rc = SSMR3Seek(pSSMIdx, "pgmidx", 1, &uVersion);
+    if (RT_SUCCESS(rc) && uVersion != PGM_SAVED_STATE_IDX_VERSION)
+        rc = VERR_SSM_UNSUPPORTED_DATA_UNIT_VERSION;
+    if (RT_SUCCESS(rc))
+    {
+        SSMR3GetU32(pSSMIdx, &cChunks);
+        rc = SSMR3GetU64(pSSMIdx, &offEnd);
+    }
+    if (RT_SUCCESS(rc) && (cChunks == 0 || cChunks > _4M))
+        rc = VERR_NOT_FOUND; /* live saves have no index */
+    if (RT_SUCCESS(rc))
+    {
+        paChunks = (PPGMSSMRAMCHUNK)RTMemAllocZ(cChunks * sizeof(paChunks[0]));
+        if (!paChunks)
+            rc = VERR_NO_MEMORY;
+    }
+    for (uint32_t i = 0; i < cChunks && RT_SUCCESS(rc); i++)
+    {
+        PPGMSSMRAMCHUNK pChunk = &paChunks[i];
+        SSMR3GetGCPhys(pSSMIdx, &pChunk->GCPhys);
+        SSMR3GetU64(pSSMIdx, &pChunk->offStream);
+        rc = SSMR3GetU32(pSSMIdx, &pChunk->cPages);
+        pChunk->iRegion = UINT32_MAX;
+        if (   RT_SUCCESS(rc)
+            && (   (pChunk->GCPhys & PAGE_OFFSET_MASK)
+                || pChunk->cPages == 0
+                || pChunk->cPages > PGM_LAZY_CHUNK_PAGES
+                || pChunk->offStream >= offEnd
+                || (   i > 0
+                    && (   pChunk->GCPhys < paChunks[i - 1].GCPhys + ((RTGCPHYS)paChunks[i - 1].cPages << PAGE_SHIFT)
+                        || pChunk->offStream <= paChunks[i - 1].offStream))))
+            rc = VERR_SSM_DATA_UNIT_FORMAT_CHANGED;
+    }
+    if (RT_SUCCESS(rc))
+    {
+        uint32_t u32Terminator;
+        rc = SSMR3GetU32(pSSMIdx, &u32Terminator);
+        if (RT_SUCCESS(rc) && u32Terminator != UINT32_MAX)
+            rc = VERR_SSM_DATA_UNIT_FORMAT_CHANGED;
+    }
+    if (RT_SUCCESS(rc))
+        rc = SSMR3Seek(pSSMIdx, "pgm", 1, NULL);
+    if (RT_FAILURE(rc))
+    {
+        LogRel(("PGM: Lazy restore: No usable RAM index in '%s' (%Rrc), loading all RAM now.\n", pszFilename, rc));
+        RTMemFree(paChunks);
+        if (pSSMIdx)
+            SSMR3Close(pSSMIdx);
+        return;
+    }
+
+    RTCritSectEnter(&pLazy->CritSect);
+    pLazy->pSSM        = pSSMIdx;
+    pLazy->paChunks    = paChunks;
+    pLazy->cChunks     = cChunks;
+    pLazy->cResident   = 0;
+    pLazy->cChunksLeft = cChunks;
+    pLazy->offEnd      = offEnd;
+    pLazy->idGen++;
+    RTCritSectLeave(&pLazy->CritSect);
+    *pfLazy = true;
+}
+
+
+/**
+ * Arms the demand paged restore after the non-RAM records have been loaded.
+ *
+ * This skips the RAM page records in the main stream, loads the chunks that
+ * cannot be covered by an access handler and registers access handlers for
+ * the rest.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The VM handle.
+ * @param   pSSM                The SSM handle.
+ * @param   fRamDeferred        Whether pgmR3LoadMemory stopped at the first
+ *                              RAM page record.
+ *
+ * @thread  EMT, caller owns the PGM lock.
+ */
+static int pgmR3LazyRestoreArm(PVM pVM, PSSMHANDLE pSSM, bool fRamDeferred)
+{
+    PPGMLAZYRESTORE pLazy = pVM->pgm.s.pLazyRestoreR3;
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    if (!fRamDeferred)
+    {
+        pgmR3LazyRestoreRelease(pVM, pLazy);
+        return VINF_SUCCESS;
+    }
+
+    /*
+     * Skip the RAM page records.
+     */
+    uint8_t u8 = 0;
+    int rc = SSMR3SeekRecord(pSSM, pLazy->offEnd);
+    if (RT_SUCCESS(rc))
+        rc = SSMR3GetU8(pSSM, &u8);
+    if (RT_SUCCESS(rc) && u8 != PGM_STATE_REC_END)
+        rc = VERR_SSM_DATA_UNIT_FORMAT_CHANGED;
+    if (RT_SUCCESS(rc))
+    {
+        pLazy->paRegions = (PPGMLAZYREGION)RTMemAllocZ(pLazy->cChunks * sizeof(pLazy->paRegions[0]));
+        if (!pLazy->paRegions)
+            rc = VERR_NO_MEMORY;
+    }
+    if (RT_FAILURE(rc))
+    {
+        LogRel(("PGM: Lazy restore: Failed to skip the RAM pages (offEnd=%#llx u8=%#x): %Rrc\n", pLazy->offEnd, u8, rc));
+        pgmR3LazyRestoreRelease(pVM, pLazy);
+        return rc;
+    }
+
+    /*
+     * Group the chunks into access handler regions.
+     */
+    PPGMLAZYREGION  pRegion  = NULL;
+    PPGMRAMRANGE    pRamPrev = NULL;
+    for (uint32_t iChunk = 0; iChunk < pLazy->cChunks; iChunk++)
+    {
+        PPGMSSMRAMCHUNK pChunk = &pLazy->paChunks[iChunk];
+        PPGMRAMRANGE    pRam   = pgmR3LazyRestoreCheckChunk(pVM, pChunk);
+        if (!pRam)
+        {
+            pRegion = NULL;
+            continue;
+        }
+        if (   !pRegion
+            || pRam != pRamPrev
+            || pChunk->GCPhys != pRegion->GCPhysLast + 1
+            || pRegion->cChunks >= PGM_LAZY_REGION_CHUNKS)
+        {
+            pRegion = &pLazy->paRegions[pLazy->cRegions++];
+            pRegion->GCPhys = pChunk->GCPhys;
+        }
+        pRegion->GCPhysLast = pChunk->GCPhys + ((RTGCPHYS)pChunk->cPages << PAGE_SHIFT) - 1;
+        pRegion->cChunks++;
+        pChunk->iRegion = (uint32_t)(pRegion - pLazy->paRegions);
+        pRamPrev = pRam;
+    }
+
+    for (uint32_t iRegion = 0; iRegion < pLazy->cRegions; iRegion++)
+    {
+        pRegion = &pLazy->paRegions[iRegion];
+        rc = PGMR3HandlerPhysicalRegister(pVM, PGMPHYSHANDLERTYPE_PHYSICAL_ALL, pRegion->GCPhys, pRegion->GCPhysLast,
+                                          pgmR3LazyRestoreHandler, NULL,
+                                          NULL, NULL, NIL_RTR0PTR,
+                                          NULL, NULL, NIL_RTRCPTR, "Lazy restored RAM");
+        if (RT_SUCCESS(rc))
+            pRegion->fRegistered = true;
+        else
+        {
+            LogRel(("PGM: Lazy restore: Failed to register a handler for %RGp-%RGp: %Rrc\n",
+                    pRegion->GCPhys, pRegion->GCPhysLast, rc));
+            for (uint32_t iChunk = 0; iChunk < pLazy->cChunks; iChunk++)
+                if (pLazy->paChunks[iChunk].iRegion == iRegion)
+                    pLazy->paChunks[iChunk].iRegion = UINT32_MAX;
+        }
+    }
+
+    /*
+     * Load the chunks without a handler now.  (The arrays are gone if this
+     * ends up loading everything.)
+     */
+    uint32_t cEager = 0;
+    for (uint32_t iChunk = 0; iChunk < pLazy->cChunks; iChunk++)
+        if (pLazy->paChunks[iChunk].iRegion == UINT32_MAX)
+        {
+            rc = pgmR3LazyRestoreLoadChunkNow(pVM, pLazy, iChunk);
+            if (RT_FAILURE(rc))
+            {
+                pgmR3LazyRestoreRelease(pVM, pLazy);
+                return rc;
+            }
+            cEager++;
+        }
+    STAM_REL_COUNTER_ADD(&pLazy->StatEager, cEager);
+
+    if (pLazy->paChunks)
+    {
+        LogRel(("PGM: Lazy restore: %u of %u RAM chunks left for loading on demand (%u handler regions, %u loaded now)\n",
+                pLazy->cChunks - pLazy->cResident, pLazy->cChunks, pLazy->cRegions, cEager));
+        ASMAtomicWriteBool(&pVM->pgm.s.fLazyRestoreActive, true);
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Called by pgmR3Load when the final pass has been loaded, starts the
+ * prefetcher.
+ *
+ * @param   pVM                 The VM handle.
+ */
+static void pgmR3LazyRestoreLoadDone(PVM pVM)
+{
+    PPGMLAZYRESTORE pLazy = pVM->pgm.s.pLazyRestoreR3;
+    if (!pLazy)
+        return;
+    if (!ASMAtomicReadBool(&pVM->pgm.s.fLazyRestoreActive))
+    {
+        if (pLazy->u64LoadStartNS && !pLazy->cNsToResident)
+            pLazy->cNsToResident = RTTimeNanoTS() - pLazy->u64LoadStartNS;
+        return;
+    }
+
+    Assert(pLazy->hThread == NIL_RTTHREAD);
+    int rc = RTThreadCreate(&pLazy->hThread, pgmR3LazyRestorePrefetchThread, pVM, 0 /*cbStack*/,
+                            RTTHREADTYPE_IO, RTTHREADFLAGS_WAITABLE, "PGMLazyRst");
+    if (RT_FAILURE(rc))
+    {
+        LogRel(("PGM: Lazy restore: Failed to create the prefetcher thread: %Rrc\n", rc));
+        pLazy->hThread = NIL_RTTHREAD;
+    }
+}
+
+
+/**
+ * Loads all RAM still left in the saved state file.
+ *
+ * Used before saving the VM state again.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The VM handle.
+ *
+ * @thread  EMT.
+ */
+int pgmR3LazyRestoreFetchAll(PVM pVM)
+{
+    PPGMLAZYRESTORE pLazy = pVM->pgm.s.pLazyRestoreR3;
+    if (!pLazy || !ASMAtomicReadBool(&pVM->pgm.s.fLazyRestoreActive))
+        return VINF_SUCCESS;
+    VM_ASSERT_EMT(pVM);
+
+    int rc = VINF_SUCCESS;
+    for (uint32_t iChunk = 0; ASMAtomicReadBool(&pVM->pgm.s.fLazyRestoreActive) && RT_SUCCESS(rc); iChunk++)
+    {
+        PPGMLAZYBUF pBuf = NULL;
+        RTCritSectEnter(&pLazy->CritSect);
+        while (iChunk < pLazy->cChunks && pLazy->paChunks[iChunk].fResident)
+            iChunk++;
+        if (iChunk < pLazy->cChunks)
+            rc = pgmR3LazyRestoreFetch(pLazy, iChunk, &pBuf);
+        RTCritSectLeave(&pLazy->CritSect);
+        if (!pBuf)
+            break;
+        rc = pgmR3LazyRestoreInstallAndFree(pVM, pBuf);
+    }
+    return rc;
+}
+
+
+/**
+ * Abandons any demand paged restore in progress, called when resetting the VM.
+ *
+ * @param   pVM                 The VM handle.
+ */
+void pgmR3LazyRestoreReset(PVM pVM)
+{
+    PPGMLAZYRESTORE pLazy = pVM->pgm.s.pLazyRestoreR3;
+    if (!pLazy)
+        return;
+
+    pgmLock(pVM);
+    if (pLazy->paChunks)
+    {
+        LogRel(("PGM: Lazy restore: Abandoned with %u of %u RAM chunks loaded\n", pLazy->cResident, pLazy->cChunks));
+        pgmR3LazyRestoreRelease(pVM, pLazy);
+    }
+    pgmUnlock(pVM);
+}
+
+
+/**
+ * VM state change callback for measuring the time to the first instruction.
+ *
+ * @param   pVM                 The VM handle.
+ * @param   enmState            The new state.
+ * @param   enmOldState         The old state.
+ * @param   pvUser              The lazy restore state.
+ */
+static DECLCALLBACK(void) pgmR3LazyRestoreAtState(PVM pVM, VMSTATE enmState, VMSTATE enmOldState, void *pvUser)
+{
+    PPGMLAZYRESTORE pLazy = (PPGMLAZYRESTORE)pvUser;
+    NOREF(pVM); NOREF(enmOldState);
+    if (   enmState == VMSTATE_RUNNING
+        && pLazy->fFirstInstrPending)
+    {
+        pLazy->fFirstInstrPending = false;
+        pLazy->cNsToFirstInstr    = RTTimeNanoTS() - pLazy->u64LoadStartNS;
+        LogRel(("PGM: Lazy restore: Running %'RU64 ns after starting the restore, %u RAM chunks left to load\n",
+                pLazy->cNsToFirstInstr, pLazy->cChunksLeft));
+    }
+}
+
+
+/**
+ * Initializes the demand paged restore if configured.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The VM handle.
+ */
+static int pgmR3LazyRestoreInit(PVM pVM)
+{
+    /** @cfgm{/PGM/LazyRestore, bool, false}
+     * Whether to make the VM runnable before all the RAM has been read when
+     * restoring a saved state file.  The rest of the RAM is then read on first
+     * access and by a prefetcher thread.  Requires nested paging and a state
+     * that was not saved live.  Saved states of a VM with this set carry the
+     * pgmidx unit, which releases without it refuse to load. */
+    bool fLazyRestore;
+    int rc = CFGMR3QueryBoolDef(CFGMR3GetChild(CFGMR3GetRoot(pVM), "/PGM"), "LazyRestore", &fLazyRestore, false);
+    AssertLogRelRCReturn(rc, rc);
+    if (!fLazyRestore)
+        return VINF_SUCCESS;
+
+    PPGMLAZYRESTORE pLazy = (PPGMLAZYRESTORE)MMR3HeapAllocZ(pVM, MM_TAG_PGM, sizeof(*pLazy));
+    AssertReturn(pLazy, VERR_NO_MEMORY);
+    pLazy->hThread      = NIL_RTTHREAD;
+    pLazy->hEvtPrefetch = NIL_RTSEMEVENT;
+    rc = RTCritSectInit(&pLazy->CritSect);
+    AssertRCReturn(rc, rc);
+    rc = RTSemEventCreate(&pLazy->hEvtPrefetch);
+    AssertRCReturn(rc, rc);
+    rc = VMR3AtStateRegister(pVM, pgmR3LazyRestoreAtState, pLazy);
+    AssertRCReturn(rc, rc);
+
+    STAM_REL_REG(pVM, &pLazy->StatFaults,       STAMTYPE_COUNTER, "/PGM/LazyRestore/Faults",         STAMUNIT_OCCURENCES, "RAM chunks loaded on guest or device access.");
+    STAM_REL_REG(pVM, &pLazy->StatTouches,      STAMTYPE_COUNTER, "/PGM/LazyRestore/Touches",        STAMUNIT_OCCURENCES, "RAM chunks loaded on ring-3 page mapping requests.");
+    STAM_REL_REG(pVM, &pLazy->StatPrefetched,   STAMTYPE_COUNTER, "/PGM/LazyRestore/Prefetched",     STAMUNIT_OCCURENCES, "RAM chunks loaded by the prefetcher.");
+    STAM_REL_REG(pVM, &pLazy->StatEager,        STAMTYPE_COUNTER, "/PGM/LazyRestore/Eager",          STAMUNIT_OCCURENCES, "RAM chunks loaded during the restore.");
+    STAM_REL_REG(pVM, &pLazy->StatBytesRead,    STAMTYPE_COUNTER, "/PGM/LazyRestore/BytesRead",      STAMUNIT_BYTES,      "Bytes of page data read on demand.");
+    STAM_REL_REG(pVM, &pLazy->cChunksLeft,      STAMTYPE_U32,     "/PGM/LazyRestore/cChunksLeft",    STAMUNIT_COUNT,      "RAM chunks still to be loaded.");
+    STAM_REL_REG(pVM, &pLazy->cNsToFirstInstr,  STAMTYPE_U64,     "/PGM/LazyRestore/NsToFirstInstr", STAMUNIT_NS,         "Time from starting the restore until the guest ran.");
+    STAM_REL_REG(pVM, &pLazy->cNsToResident,    STAMTYPE_U64,     "/PGM/LazyRestore/NsToResident",   STAMUNIT_NS,         "Time from starting the restore until all RAM was loaded.");
+
+    pVM->pgm.s.pLazyRestoreR3 = pLazy;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Terminates the demand paged restore.
+ *
+ * @param   pVM                 The VM handle.
+ *
+ * @thread  EMT(0), called by PGMR3Term.
+ */
+void pgmR3LazyRestoreTerm(PVM pVM)
+{
+    PPGMLAZYRESTORE pLazy = pVM->pgm.s.pLazyRestoreR3;
+    if (!pLazy)
+        return;
+    pgmR3LazyRestoreReset(pVM);
+
+    /*
+     * The prefetcher is stopped, so no more chunks get queued.  Process the
+     * ones still queued for an EMT because they take the PGM lock, which goes
+     * away together with PGM.  (They are dropped as the arrays are gone.)
+     */
+    for (unsigned cTries = 0; ASMAtomicReadU32(&pLazy->cInFlight) > 0 && cTries < 100; cTries++)
+    {
+        VMR3ReqProcessU(pVM->pUVM, VMCPUID_ANY, false /*fPriorityOnly*/);
+        if (ASMAtomicReadU32(&pLazy->cInFlight) > 0)
+            RTSemEventWait(pLazy->hEvtPrefetch, 10);
+    }
+    uint32_t const cInFlight = ASMAtomicReadU32(&pLazy->cInFlight);
+    if (cInFlight)
+        LogRel(("PGM: Lazy restore: %u prefetched chunks still queued at termination\n", cInFlight));
+
+    STAM_REL_DEREG(pVM, &pLazy->StatFaults);
+    STAM_REL_DEREG(pVM, &pLazy->StatTouches);
+    STAM_REL_DEREG(pVM, &pLazy->StatPrefetched);
+    STAM_REL_DEREG(pVM, &pLazy->StatEager);
+    STAM_REL_DEREG(pVM, &pLazy->StatBytesRead);
+    STAM_REL_DEREG(pVM, &pLazy->cChunksLeft);
+    STAM_REL_DEREG(pVM, &pLazy->cNsToFirstInstr);
+    STAM_REL_DEREG(pVM, &pLazy->cNsToResident);
+    VMR3AtStateDeregister(pVM, pgmR3LazyRestoreAtState, pLazy);
+
+    /* Requests still queued check the pointer while owning the PGM lock and
+       leave the state alone once it is NULL. */
+    pgmLock(pVM);
+    pVM->pgm.s.pLazyRestoreR3 = NULL;
+    pgmUnlock(pVM);
+
+    RTSemEventDestroy(pLazy->hEvtPrefetch);
+    pLazy->hEvtPrefetch = NIL_RTSEMEVENT;
+    RTCritSectDelete(&pLazy->CritSect);
+    MMR3HeapFree(pLazy);
+}
+
+
+/**
+ * Worker for pgmR3Load.
+ *
+ * @returns VBox status code.
+ *
+ * @param   pVM                 The VM handle.
+ * @param   pSSM                The SSM handle.
+ * @param   uVersion            The saved state version.
+ */
+static int pgmR3LoadFinalLocked(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion)
+{
+    PPGM        pPGM = &pVM->pgm.s;
+    int         rc;
+    uint32_t    u32Sep;
+
+    /*
+     * Load basic data (required / unaffected by relocation).
+     */
+    if (uVersion >= PGM_SAVED_STATE_VERSION_3_0_0)
+    {
+        if (uVersion > PGM_SAVED_STATE_VERSION_PRE_BALLOON)
+            rc = SSMR3GetStruct(pSSM, pPGM, &s_aPGMFields[0]);
+        else
+            rc = SSMR3GetStruct(pSSM, pPGM, &s_aPGMFieldsPreBalloon[0]);
+
+        AssertLogRelRCReturn(rc, rc);
+
+        for (VMCPUID i = 0; i < pVM->cCpus; i++)
+        {
+            if (uVersion <= PGM_SAVED_STATE_VERSION_PRE_PAE)
+                rc = SSMR3GetStruct(pSSM, &pVM->aCpus[i].pgm.s, &s_aPGMCpuFieldsPrePae[0]);
+            else
+                rc = SSMR3GetStruct(pSSM, &pVM->aCpus[i].pgm.s, &s_aPGMCpuFields[0]);
+            AssertLogRelRCReturn(rc, rc);
+        }
+    }
+    else if (uVersion >= PGM_SAVED_STATE_VERSION_RR_DESC)
+    {
+        AssertRelease(pVM->cCpus == 1);
+
+        PGMOLD pgmOld;
+        rc = SSMR3GetStruct(pSSM, &pgmOld, &s_aPGMFields_Old[0]);
+        AssertLogRelRCReturn(rc, rc);
+
+        pPGM->fMappingsFixed    = pgmOld.fMappingsFixed;
+        pPGM->GCPtrMappingFixed = pgmOld.GCPtrMappingFixed;
+        pPGM->cbMappingFixed    = pgmOld.cbMappingFixed;
+
+        pVM->aCpus[0].pgm.s.fA20Enabled   = pgmOld.fA20Enabled;
+        pVM->aCpus[0].pgm.s.GCPhysA20Mask = pgmOld.GCPhysA20Mask;
+        pVM->aCpus[0].pgm.s.enmGuestMode  = pgmOld.enmGuestMode;
+    }
+    else
     {
         AssertRelease(pVM->cCpus == 1);
 
@@ -3069,7 +4590,22 @@ static int pgmR3LoadFinalLocked(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion)
                 return rc;
         }
 
-        rc = pgmR3LoadMemory(pVM, pSSM, uVersion, SSM_PASS_FINAL);
+        /*
+         * Non-live states may have their RAM loaded on demand, see
+         * pgmR3LazyRestoreSetup.
+         */
+        bool fLazy = false;
+        if (!pVM->pgm.s.LiveSave.fActive)
+            pgmR3LazyRestoreSetup(pVM, pSSM, &fLazy);
+        bool fRamDeferred = false;
+        rc = pgmR3LoadMemory(pVM, pSSM, uVersion, SSM_PASS_FINAL, fLazy ? &fRamDeferred : NULL);
+        if (fLazy)
+        {
+            if (RT_SUCCESS(rc))
+                rc = pgmR3LazyRestoreArm(pVM, pSSM, fRamDeferred);
+            else
+                pgmR3LazyRestoreRelease(pVM, pVM->pgm.s.pLazyRestoreR3);
+        }
     }
     else
         rc = pgmR3LoadMemoryOld(pVM, pSSM, uVersion);
@@ -3104,11 +4640,13 @@ static DECLCALLBACK(int) pgmR3Load(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion,
      */
     if (   (   uPass != SSM_PASS_FINAL
             && uVersion != PGM_SAVED_STATE_VERSION
+            && uVersion != PGM_SAVED_STATE_VERSION_PRE_XOR
             && uVersion != PGM_SAVED_STATE_VERSION_PRE_PAE
             && uVersion != PGM_SAVED_STATE_VERSION_BALLOON_BROKEN
             && uVersion != PGM_SAVED_STATE_VERSION_PRE_BALLOON
             && uVersion != PGM_SAVED_STATE_VERSION_NO_RAM_CFG)
         || (   uVersion != PGM_SAVED_STATE_VERSION
+            && uVersion != PGM_SAVED_STATE_VERSION_PRE_XOR
             && uVersion != PGM_SAVED_STATE_VERSION_PRE_PAE
             && uVersion != PGM_SAVED_STATE_VERSION_BALLOON_BROKEN
             && uVersion != PGM_SAVED_STATE_VERSION_PRE_BALLOON
@@ -3131,7 +4669,7 @@ static DECLCALLBACK(int) pgmR3Load(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion,
     {
         pgmLock(pVM);
         if (uPass != 0)
-            rc = pgmR3LoadMemory(pVM, pSSM, uVersion, uPass);
+            rc = pgmR3LoadMemory(pVM, pSSM, uVersion, uPass, NULL /*pfRamDeferred*/);
         else
         {
             pVM->pgm.s.LiveSave.fActive = true;
@@ -3144,7 +4682,7 @@ static DECLCALLBACK(int) pgmR3Load(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion,
             if (RT_SUCCESS(rc))
                 rc = pgmR3LoadMmio2Ranges(pVM, pSSM);
             if (RT_SUCCESS(rc))
-                rc = pgmR3LoadMemory(pVM, pSSM, uVersion, uPass);
+                rc = pgmR3LoadMemory(pVM, pSSM, uVersion, uPass, NULL /*pfRamDeferred*/);
         }
         pgmUnlock(pVM);
     }
@@ -3173,6 +4711,7 @@ static DECLCALLBACK(int) pgmR3Load(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion,
             }
 
             pgmR3HandlerPhysicalUpdateAll(pVM);
+            pgmR3LazyRestoreLoadDone(pVM);
 
             /*
              * Change the paging mode and restore PGMCPU::GCPhysCR3.
@@ -3268,6 +4807,55 @@ static DECLCALLBACK(int) pgmR3Load(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion,
 }
 
 
+/**
+ * Execute state save operation for the RAM chunk index unit.
+ *
+ * The index maps RAM pages to the stream offsets of their records in the pgm
+ * unit, which allows pgmR3LazyRestoreFetch to read them on demand.  Only
+ * called when /PGM/LazyRestore is set, see pgmR3InitSavedState.  Live saves
+ * and FTM deltas have no index, cChunks is then zero.
+ *
+ * @returns VBox status code.
+ * @param   pVM             VM Handle.
+ * @param   pSSM            SSM operation handle.
+ */
+static DECLCALLBACK(int) pgmR3SaveIdxExec(PVM pVM, PSSMHANDLE pSSM)
+{
+    PPGMSSMRAMIDX pIdx    = pVM->pgm.s.pSavedRamIdxR3;
+    uint32_t      cChunks = pIdx ? pIdx->cChunks : 0;
+    SSMR3PutU32(pSSM, cChunks);
+    SSMR3PutU64(pSSM, pIdx ? pIdx->offEnd : 0);
+    for (uint32_t i = 0; i < cChunks; i++)
+    {
+        SSMR3PutGCPhys(pSSM, pIdx->paChunks[i].GCPhys);
+        SSMR3PutU64(pSSM,    pIdx->paChunks[i].offStream);
+        SSMR3PutU32(pSSM,    pIdx->paChunks[i].cPages);
+    }
+    int rc = SSMR3PutU32(pSSM, UINT32_MAX);
+    pgmR3SaveRamIdxFree(pVM);
+    return rc;
+}
+
+
+/**
+ * Execute state load operation for the RAM chunk index unit.
+ *
+ * @returns VBox status code.
+ * @param   pVM             VM Handle.
+ * @param   pSSM            SSM operation handle.
+ * @param   uVersion        Data layout version.
+ * @param   uPass           The data pass.
+ */
+static DECLCALLBACK(int) pgmR3LoadIdx(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t uPass)
+{
+    NOREF(pVM); NOREF(uPass);
+    AssertMsgReturn(uVersion == PGM_SAVED_STATE_IDX_VERSION, ("%u\n", uVersion), VERR_SSM_UNSUPPORTED_DATA_UNIT_VERSION);
+
+    /* Only pgmR3LazyRestoreSetup needs it and it reads it on its own. */
+    return SSMR3SkipToEndOfUnit(pSSM);
+}
+
+
 /**
  * Registers the saved state callbacks with SSM.
  *
@@ -3277,9 +4865,33 @@ static DECLCALLBACK(int) pgmR3Load(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion,
  */
 int pgmR3InitSavedState(PVM pVM, uint64_t cbRam)
 {
-    return SSMR3RegisterInternal(pVM, "pgm", 1, PGM_SAVED_STATE_VERSION, (size_t)cbRam + sizeof(PGM),
-                                 pgmR3LivePrep, pgmR3LiveExec, pgmR3LiveVote,
-                                 NULL,          pgmR3SaveExec, pgmR3SaveDone,
-                                 pgmR3LoadPrep, pgmR3Load,     NULL);
+    /** @cfgm{/PGM/LiveSaveDeltaCache, uint32_t, 0, 0, 4096, MB}
+     * The size of the cache of sent RAM pages used for sending re-dirtied pages
+     * as XOR deltas during live save and teleportation.  0 disables it. */
+    uint32_t cMB;
+    int rc = CFGMR3QueryU32Def(CFGMR3GetChild(CFGMR3GetRoot(pVM), "/PGM"), "LiveSaveDeltaCache", &cMB, 0);
+    AssertLogRelRCReturn(rc, rc);
+    AssertLogRelMsgReturn(cMB <= _4K, ("LiveSaveDeltaCache=%u MB\n", cMB), VERR_OUT_OF_RANGE);
+    pVM->pgm.s.LiveSave.cDeltaCacheMB = cMB;
+
+    /* Without the cache there are no XOR records, so keep writing the previous
+       version which older releases can still load. */
+    uint32_t const uVersion = cMB ? PGM_SAVED_STATE_VERSION : PGM_SAVED_STATE_VERSION_PRE_XOR;
+    rc = SSMR3RegisterInternal(pVM, "pgm", 1, uVersion, (size_t)cbRam + sizeof(PGM),
+                               pgmR3LivePrep, pgmR3LiveExec, pgmR3LiveVote,
+                               NULL,          pgmR3SaveExec, pgmR3SaveDone,
+                               pgmR3LoadPrep, pgmR3Load,     NULL);
+    if (RT_SUCCESS(rc))
+        rc = pgmR3LazyRestoreInit(pVM);
+
+    /* Older releases refuse states with units they don't know, so the index
+       is only written when demand paged restoring is configured.  Loading it
+       must always work. */
+    if (RT_SUCCESS(rc))
+        rc = SSMR3RegisterInternal(pVM, "pgmidx", 1, PGM_SAVED_STATE_IDX_VERSION, _4K,
+                                   NULL, NULL, NULL,
+                                   NULL, pVM->pgm.s.pLazyRestoreR3 ? pgmR3SaveIdxExec : NULL, NULL,
+                                   NULL, pgmR3LoadIdx, NULL);
+    return rc;
 }
 
@@ -145,6 +145,7 @@
 *******************************************************************************/
 #define LOG_GROUP LOG_GROUP_SSM
 #include <VBox/vmm/ssm.h>
+#include <VBox/vmm/cfgm.h>
 #include <VBox/vmm/dbgf.h>
 #include <VBox/vmm/mm.h>
 #include "SSMInternal.h"
@@ -158,6 +159,7 @@
 #include <iprt/crc.h>
 #include <iprt/file.h>
 #include <iprt/mem.h>
+#include <iprt/mp.h>
 #include <iprt/param.h>
 #include <iprt/thread.h>
 #include <iprt/semaphore.h>
@@ -281,6 +283,13 @@
  * Must be a multiple of 1KB.  */
 #define SSM_ZIP_BLOCK_SIZE                      _4K
 AssertCompile(SSM_ZIP_BLOCK_SIZE / _1K * _1K == SSM_ZIP_BLOCK_SIZE);
+/** The max size of a compressed block record: type, 3 byte size, 1KB count
+ * and the data. */
+#define SSM_ZIP_BLOCK_REC_MAX                   (1 + 3 + 1 + SSM_ZIP_BLOCK_SIZE)
+/** The max number of compression threads. */
+#define SSM_ZIP_MAX_THREADS                     16
+/** The number of blocks in flight per compression thread. */
+#define SSM_ZIP_JOBS_PER_THREAD                 64
 
 
 /**
@@ -361,6 +370,44 @@ typedef enum SSMSTATE
 } SSMSTATE;
 
 
+/** @name Compression job states (SSMSTRMZIPJOB::enmState).
+ * @{ */
+/** Free. */
+#define SSMSTRMZIPJOB_FREE                      UINT32_C(0)
+/** Raw stream bytes being added by the producer. */
+#define SSMSTRMZIPJOB_FILLING                   UINT32_C(1)
+/** A block waiting for a compression thread. */
+#define SSMSTRMZIPJOB_QUEUED                    UINT32_C(2)
+/** A block being compressed. */
+#define SSMSTRMZIPJOB_BUSY                      UINT32_C(3)
+/** Ready to be written to the stream. */
+#define SSMSTRMZIPJOB_DONE                      UINT32_C(4)
+/** @} */
+
+/**
+ * A job in the stream compression ring.
+ *
+ * Either a block to be turned into a compressed record by one of the
+ * compression threads, or raw stream bytes written by the producer while
+ * earlier blocks are still in flight.
+ */
+typedef struct SSMSTRMZIPJOB
+{
+    /** The job state, SSMSTRMZIPJOB_XXX. */
+    uint32_t volatile       enmState;
+    /** Whether this is a compression job (as opposed to raw bytes). */
+    bool                    fZip;
+    /** The number of bytes in abOut. */
+    uint32_t                cbOut;
+    /** The uncompressed block (compression jobs only). */
+    uint8_t                 abIn[SSM_ZIP_BLOCK_SIZE];
+    /** The record or the raw bytes. */
+    uint8_t                 abOut[SSM_ZIP_BLOCK_REC_MAX];
+} SSMSTRMZIPJOB;
+/** Pointer to a compression job. */
+typedef SSMSTRMZIPJOB *PSSMSTRMZIPJOB;
+
+
 /** Pointer to a SSM stream buffer. */
 typedef struct SSMSTRMBUF *PSSMSTRMBUF;
 /**
@@ -439,6 +486,45 @@ typedef struct SSMSTRM
      * This may lag behind off as it's desirable to checksum as large blocks as
      * possible.  */
     uint32_t                offStreamCRC;
+
+    /** @name Parallel block compression (write streams only).
+     * Blocks are compressed by a pool of threads and the records are written
+     * to the stream in submission order by the producer.
+     * @{ */
+    /** The compression level, RTZIPLEVEL_STORE for none. */
+    RTZIPLEVEL              enmZipLevel;
+    /** The number of compression threads, 0 if compressing on the producer. */
+    uint32_t                cZipThreads;
+    /** The compression threads. */
+    RTTHREAD                ahZipThreads[SSM_ZIP_MAX_THREADS];
+    /** The job ring (cZipJobs entries, a power of two). */
+    PSSMSTRMZIPJOB          paZipJobs;
+    /** The number of entries in the job ring. */
+    uint32_t                cZipJobs;
+    /** The oldest job not yet written to the stream (producer only). */
+    uint32_t                iZipHead;
+    /** The next job to hand out (producer only). */
+    uint32_t                iZipTail;
+    /** The raw job the producer is adding bytes to, NULL if none. */
+    PSSMSTRMZIPJOB          pZipRaw;
+    /** The compression threads pick up jobs below this index. */
+    uint32_t volatile       iZipSubmitted;
+    /** The next job the compression threads should look at. */
+    uint32_t volatile       iZipNext;
+    /** The number of compression threads waiting for work. */
+    uint32_t volatile       cZipIdle;
+    /** Set when the producer waits for a job to complete. */
+    bool volatile           fZipWaiting;
+    /** Tells the compression threads to quit. */
+    bool volatile           fZipTerminate;
+    /** Signalled when jobs are submitted and a thread is idle. */
+    RTSEMEVENT              hEvtZipWork;
+    /** Signalled when a job completes and fZipWaiting is set. */
+    RTSEMEVENT              hEvtZipDone;
+    /** Bytes of compressed records written to the stream that the data layer
+     * has not yet accounted for, see ssmR3DataWriteSync. */
+    uint64_t                cbZipOut;
+    /** @} */
 } SSMSTRM;
 /** Pointer to a SSM stream. */
 typedef SSMSTRM *PSSMSTRM;
@@ -883,6 +969,9 @@ static int                  ssmR3LiveControlEmit(PSSMHANDLE pSSM, long double lr
 
 static int                  ssmR3StrmWriteBuffers(PSSMSTRM pStrm);
 static int                  ssmR3StrmReadMore(PSSMSTRM pStrm);
+static int                  ssmR3StrmZipWriteRaw(PSSMSTRM pStrm, const void *pvBuf, size_t cbToWrite);
+static int                  ssmR3StrmZipFlush(PSSMSTRM pStrm);
+static void                 ssmR3StrmZipTerm(PSSMSTRM pStrm);
 
 static int                  ssmR3DataFlushBuffer(PSSMHANDLE pSSM);
 static int                  ssmR3DataReadRecHdrV2(PSSMHANDLE pSSM);
@@ -1669,6 +1758,24 @@ static int ssmR3StrmInitInternal(PSSMSTRM pStrm, bool fChecksummed, uint32_t cBu
     pStrm->u32StreamCRC = fChecksummed ? RTCrc32Start() : 0;
     pStrm->offStreamCRC = 0;
 
+    pStrm->enmZipLevel  = RTZIPLEVEL_FAST;
+    pStrm->cZipThreads  = 0;
+    for (uint32_t i = 0; i < RT_ELEMENTS(pStrm->ahZipThreads); i++)
+        pStrm->ahZipThreads[i] = NIL_RTTHREAD;
+    pStrm->paZipJobs    = NULL;
+    pStrm->cZipJobs     = 0;
+    pStrm->iZipHead     = 0;
+    pStrm->iZipTail     = 0;
+    pStrm->pZipRaw      = NULL;
+    pStrm->iZipSubmitted= 0;
+    pStrm->iZipNext     = 0;
+    pStrm->cZipIdle     = 0;
+    pStrm->fZipWaiting  = false;
+    pStrm->fZipTerminate= false;
+    pStrm->hEvtZipWork  = NIL_RTSEMEVENT;
+    pStrm->hEvtZipDone  = NIL_RTSEMEVENT;
+    pStrm->cbZipOut     = 0;
+
     /*
      * Allocate the buffers.  Page align them in case that makes the kernel
      * and/or cpu happier in some way.
@@ -1732,6 +1839,8 @@ static void ssmR3StrmDestroyBufList(PSSMSTRMBUF pHead)
  */
 static void ssmR3StrmDelete(PSSMSTRM pStrm)
 {
+    ssmR3StrmZipTerm(pStrm);
+
     RTMemPageFree(pStrm->pCur, sizeof(*pStrm->pCur));
     pStrm->pCur = NULL;
     ssmR3StrmDestroyBufList(pStrm->pHead);
@@ -2212,6 +2321,7 @@ static int ssmR3StrmClose(PSSMSTRM pStrm, bool fCancelled)
      */
     if (pStrm->fWrite)
     {
+        ssmR3StrmZipFlush(pStrm);
         ssmR3StrmFlushCurBuf(pStrm);
         if (pStrm->hIoThread == NIL_RTTHREAD)
             ssmR3StrmWriteBuffers(pStrm);
@@ -2263,7 +2373,7 @@ static int ssmR3StrmClose(PSSMSTRM pStrm, bool fCancelled)
 
 
 /**
- * Stream output routine.
+ * Stream output routine, bypassing the compression ring.
  *
  * @returns VBox status code.
  * @param   pStrm       The stream handle.
@@ -2272,7 +2382,7 @@ static int ssmR3StrmClose(PSSMSTRM pStrm, bool fCancelled)
  *
  * @thread  The producer in a write stream (never the I/O thread).
  */
-static int ssmR3StrmWrite(PSSMSTRM pStrm, const void *pvBuf, size_t cbToWrite)
+static int ssmR3StrmWriteDirect(PSSMSTRM pStrm, const void *pvBuf, size_t cbToWrite)
 {
     AssertReturn(cbToWrite > 0, VINF_SUCCESS);
     Assert(pStrm->fWrite);
@@ -2332,6 +2442,25 @@ static int ssmR3StrmWrite(PSSMSTRM pStrm, const void *pvBuf, size_t cbToWrite)
 }
 
 
+/**
+ * Stream output routine.
+ *
+ * @returns VBox status code.
+ * @param   pStrm       The stream handle.
+ * @param   pvBuf       What to write.
+ * @param   cbToWrite   How much to write.
+ *
+ * @thread  The producer in a write stream (never the I/O thread).
+ */
+static int ssmR3StrmWrite(PSSMSTRM pStrm, const void *pvBuf, size_t cbToWrite)
+{
+    /* Queue it up behind the blocks that are still being compressed. */
+    if (pStrm->iZipHead != pStrm->iZipTail)
+        return ssmR3StrmZipWriteRaw(pStrm, pvBuf, cbToWrite);
+    return ssmR3StrmWriteDirect(pStrm, pvBuf, cbToWrite);
+}
+
+
 /**
  * Reserves space in the current buffer so the caller can write directly to the
  * buffer instead of doing double buffering.
@@ -2345,6 +2474,7 @@ static int ssmR3StrmReserveWriteBufferSpace(PSSMSTRM pStrm, size_t cb, uint8_t *
 {
     Assert(pStrm->fWrite);
     Assert(RT_SIZEOFMEMB(SSMSTRMBUF, abData) / 4 >= cb);
+    ssmR3StrmZipFlush(pStrm);
 
     /*
      * Check if there is room in the current buffer, it not flush it.
@@ -2406,6 +2536,7 @@ static int ssmR3StrmCommitWriteBufferSpace(PSSMSTRM pStrm, size_t cb)
 static int ssmR3StrmSetEnd(PSSMSTRM pStrm)
 {
     Assert(pStrm->fWrite);
+    ssmR3StrmZipFlush(pStrm);
     PSSMSTRMBUF pBuf = pStrm->pCur;
     if (RT_UNLIKELY(!pStrm->pCur))
     {
@@ -2421,6 +2552,360 @@ static int ssmR3StrmSetEnd(PSSMSTRM pStrm)
 }
 
 
+/**
+ * Encodes a block as a compressed (or raw if it doesn't compress) record.
+ *
+ * @returns The size of the record.
+ * @param   pvBlock     The SSM_ZIP_BLOCK_SIZE bytes to encode.
+ * @param   pb          Where to put the record, SSM_ZIP_BLOCK_REC_MAX bytes.
+ * @param   enmLevel    The compression level.  RTZIPLEVEL_STORE for none.
+ *
+ * @thread  Any.
+ */
+static uint32_t ssmR3StrmZipEncodeBlock(const void *pvBlock, uint8_t *pb, RTZIPLEVEL enmLevel)
+{
+    AssertCompile(SSM_ZIP_BLOCK_REC_MAX < 0x00010000);
+    size_t cbRec = SSM_ZIP_BLOCK_SIZE - (SSM_ZIP_BLOCK_SIZE / 16);
+    int rc = VERR_BUFFER_OVERFLOW;
+    if (enmLevel != RTZIPLEVEL_STORE)
+        rc = RTZipBlockCompress(RTZIPTYPE_LZF, enmLevel, 0 /*fFlags*/,
+                                pvBlock, SSM_ZIP_BLOCK_SIZE,
+                                pb + 1 + 3 + 1, cbRec, &cbRec);
+    if (RT_SUCCESS(rc))
+    {
+        pb[0] = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW_LZF;
+        pb[4] = SSM_ZIP_BLOCK_SIZE / _1K;
+        cbRec += 1;
+    }
+    else
+    {
+        pb[0] = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW;
+        memcpy(&pb[4], pvBlock, SSM_ZIP_BLOCK_SIZE);
+        cbRec = SSM_ZIP_BLOCK_SIZE;
+    }
+    pb[1] = (uint8_t)(0xe0 | ( cbRec >> 12));
+    pb[2] = (uint8_t)(0x80 | ((cbRec >>  6) & 0x3f));
+    pb[3] = (uint8_t)(0x80 | ( cbRec        & 0x3f));
+    return (uint32_t)cbRec + 1 + 3;
+}
+
+
+/**
+ * Compresses a queued job if nobody else has started on it.
+ *
+ * @returns true if we did it, false if someone else got there first.
+ * @param   pStrm       The stream handle.
+ * @param   pJob        The job.
+ *
+ * @thread  A compression thread or the producer.
+ */
+static bool ssmR3StrmZipTryDoJob(PSSMSTRM pStrm, PSSMSTRMZIPJOB pJob)
+{
+    if (!ASMAtomicCmpXchgU32(&pJob->enmState, SSMSTRMZIPJOB_BUSY, SSMSTRMZIPJOB_QUEUED))
+        return false;
+
+    pJob->cbOut = ssmR3StrmZipEncodeBlock(&pJob->abIn[0], &pJob->abOut[0], pStrm->enmZipLevel);
+    ASMAtomicWriteU32(&pJob->enmState, SSMSTRMZIPJOB_DONE);
+
+    if (    ASMAtomicReadBool(&pStrm->fZipWaiting)
+        &&  ASMAtomicXchgBool(&pStrm->fZipWaiting, false))
+        RTSemEventSignal(pStrm->hEvtZipDone);
+    return true;
+}
+
+
+/**
+ * The compression thread.
+ *
+ * @returns VINF_SUCCESS.
+ * @param   hSelf       The thread handle.
+ * @param   pvStrm      The stream handle.
+ */
+static DECLCALLBACK(int) ssmR3StrmZipThread(RTTHREAD hSelf, void *pvStrm)
+{
+    PSSMSTRM pStrm = (PSSMSTRM)pvStrm;
+    NOREF(hSelf);
+
+    while (!ASMAtomicReadBool(&pStrm->fZipTerminate))
+    {
+        /*
+         * Claim the next submitted job.  Jobs the producer has taken care of
+         * itself, and raw ones, are simply skipped.
+         */
+        uint32_t i = ASMAtomicReadU32(&pStrm->iZipNext);
+        if (i != ASMAtomicReadU32(&pStrm->iZipSubmitted))
+        {
+            if (ASMAtomicCmpXchgU32(&pStrm->iZipNext, i + 1, i))
+                ssmR3StrmZipTryDoJob(pStrm, &pStrm->paZipJobs[i & (pStrm->cZipJobs - 1)]);
+            continue;
+        }
+
+        /*
+         * Nothing to do.  The producer checks cZipIdle after submitting, so
+         * check again after announcing ourselves.
+         */
+        ASMAtomicIncU32(&pStrm->cZipIdle);
+        if (    ASMAtomicReadU32(&pStrm->iZipNext) == ASMAtomicReadU32(&pStrm->iZipSubmitted)
+            &&  !ASMAtomicReadBool(&pStrm->fZipTerminate))
+            RTSemEventWait(pStrm->hEvtZipWork, RT_INDEFINITE_WAIT);
+        ASMAtomicDecU32(&pStrm->cZipIdle);
+    }
+
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Sets up parallel compression for a write stream.
+ *
+ * Failing to create the threads is not fatal, the producer will then do the
+ * compressing itself like before.
+ *
+ * @param   pStrm       The stream handle.
+ * @param   cThreads    The number of compression threads.
+ * @param   enmLevel    The compression level.
+ */
+static void ssmR3StrmZipInit(PSSMSTRM pStrm, uint32_t cThreads, RTZIPLEVEL enmLevel)
+{
+    Assert(pStrm->fWrite);
+    pStrm->enmZipLevel = enmLevel;
+    if (!cThreads || enmLevel == RTZIPLEVEL_STORE)
+        return;
+    cThreads = RT_MIN(cThreads, SSM_ZIP_MAX_THREADS);
+
+    uint32_t cJobs = 1;
+    while (cJobs < cThreads * SSM_ZIP_JOBS_PER_THREAD)
+        cJobs <<= 1;
+    pStrm->paZipJobs = (PSSMSTRMZIPJOB)RTMemPageAllocZ(cJobs * sizeof(SSMSTRMZIPJOB));
+    if (!pStrm->paZipJobs)
+        return;
+    pStrm->cZipJobs = cJobs;
+
+    int rc = RTSemEventCreate(&pStrm->hEvtZipWork);
+    if (RT_SUCCESS(rc))
+        rc = RTSemEventCreate(&pStrm->hEvtZipDone);
+    for (uint32_t i = 0; i < cThreads && RT_SUCCESS(rc); i++)
+    {
+        rc = RTThreadCreateF(&pStrm->ahZipThreads[i], ssmR3StrmZipThread, pStrm, 0,
+                             RTTHREADTYPE_DEFAULT, RTTHREADFLAGS_WAITABLE, "SSMZip%u", i);
+        if (RT_SUCCESS(rc))
+            pStrm->cZipThreads = i + 1;
+    }
+    if (!pStrm->cZipThreads)
+    {
+        LogRel(("SSM: Failed to set up the compression threads: %Rrc\n", rc));
+        ssmR3StrmZipTerm(pStrm);
+    }
+    else
+        LogRel(("SSM: Compressing with %u threads\n", pStrm->cZipThreads));
+}
+
+
+/**
+ * Stops the compression threads and frees the job ring.
+ *
+ * The ring must have been flushed (or the stream be failing).
+ *
+ * @param   pStrm       The stream handle.
+ */
+static void ssmR3StrmZipTerm(PSSMSTRM pStrm)
+{
+    ASMAtomicWriteBool(&pStrm->fZipTerminate, true);
+    for (uint32_t i = 0; i < RT_ELEMENTS(pStrm->ahZipThreads); i++)
+        if (pStrm->ahZipThreads[i] != NIL_RTTHREAD)
+        {
+            int rc;
+            do
+            {
+                RTSemEventSignal(pStrm->hEvtZipWork);
+                rc = RTThreadWait(pStrm->ahZipThreads[i], 100, NULL);
+            } while (rc == VERR_TIMEOUT);
+            AssertLogRelRC(rc);
+            pStrm->ahZipThreads[i] = NIL_RTTHREAD;
+        }
+    pStrm->cZipThreads = 0;
+
+    RTSemEventDestroy(pStrm->hEvtZipWork);
+    pStrm->hEvtZipWork = NIL_RTSEMEVENT;
+    RTSemEventDestroy(pStrm->hEvtZipDone);
+    pStrm->hEvtZipDone = NIL_RTSEMEVENT;
+
+    if (pStrm->paZipJobs)
+    {
+        RTMemPageFree(pStrm->paZipJobs, pStrm->cZipJobs * sizeof(SSMSTRMZIPJOB));
+        pStrm->paZipJobs = NULL;
+    }
+    pStrm->cZipJobs = 0;
+    pStrm->iZipHead = pStrm->iZipTail = 0;
+    pStrm->pZipRaw  = NULL;
+}
+
+
+/**
+ * Writes the completed jobs at the head of the ring to the stream.
+ *
+ * @param   pStrm       The stream handle.
+ */
+static void ssmR3StrmZipWriteDone(PSSMSTRM pStrm)
+{
+    while (pStrm->iZipHead != pStrm->iZipTail)
+    {
+        PSSMSTRMZIPJOB pJob = &pStrm->paZipJobs[pStrm->iZipHead & (pStrm->cZipJobs - 1)];
+        if (ASMAtomicReadU32(&pJob->enmState) != SSMSTRMZIPJOB_DONE)
+            break;
+
+        if (pJob->cbOut)
+            ssmR3StrmWriteDirect(pStrm, &pJob->abOut[0], pJob->cbOut);
+        if (pJob->fZip)
+            pStrm->cbZipOut += pJob->cbOut;
+        ASMAtomicWriteU32(&pJob->enmState, SSMSTRMZIPJOB_FREE);
+        pStrm->iZipHead++;
+    }
+}
+
+
+/**
+ * Waits for the job at the head of the ring, compressing it ourselves if no
+ * thread has picked it up yet, and writes it to the stream.
+ *
+ * @param   pStrm       The stream handle.
+ */
+static void ssmR3StrmZipRetireHead(PSSMSTRM pStrm)
+{
+    Assert(pStrm->iZipHead != pStrm->iZipTail);
+    PSSMSTRMZIPJOB pJob = &pStrm->paZipJobs[pStrm->iZipHead & (pStrm->cZipJobs - 1)];
+    if (pJob == pStrm->pZipRaw)
+    {
+        ASMAtomicWriteU32(&pJob->enmState, SSMSTRMZIPJOB_DONE);
+        pStrm->pZipRaw = NULL;
+    }
+
+    if (!ssmR3StrmZipTryDoJob(pStrm, pJob))
+        while (ASMAtomicReadU32(&pJob->enmState) != SSMSTRMZIPJOB_DONE)
+        {
+            ASMAtomicWriteBool(&pStrm->fZipWaiting, true);
+            if (ASMAtomicReadU32(&pJob->enmState) != SSMSTRMZIPJOB_DONE)
+                RTSemEventWait(pStrm->hEvtZipDone, 50);
+            ASMAtomicWriteBool(&pStrm->fZipWaiting, false);
+        }
+
+    ssmR3StrmZipWriteDone(pStrm);
+}
+
+
+/**
+ * Hands out the next job in the ring, making room if necessary.
+ *
+ * @returns Pointer to the job.
+ * @param   pStrm       The stream handle.
+ * @param   fZip        Whether it's for a compression job.
+ */
+static PSSMSTRMZIPJOB ssmR3StrmZipAllocJob(PSSMSTRM pStrm, bool fZip)
+{
+    if (pStrm->iZipTail - pStrm->iZipHead >= pStrm->cZipJobs)
+        ssmR3StrmZipRetireHead(pStrm);
+
+    PSSMSTRMZIPJOB pJob = &pStrm->paZipJobs[pStrm->iZipTail & (pStrm->cZipJobs - 1)];
+    Assert(pJob->enmState == SSMSTRMZIPJOB_FREE);
+    pStrm->iZipTail++;
+    pJob->fZip  = fZip;
+    pJob->cbOut = 0;
+    return pJob;
+}
+
+
+/**
+ * Queues a block for compression.
+ *
+ * The record ends up in the stream after everything written before it.
+ *
+ * @returns VBox status code.
+ * @param   pStrm       The stream handle.
+ * @param   pvBlock     The SSM_ZIP_BLOCK_SIZE bytes to compress.
+ *
+ * @thread  The producer.
+ */
+static int ssmR3StrmZipBlock(PSSMSTRM pStrm, const void *pvBlock)
+{
+    Assert(pStrm->cZipThreads > 0);
+
+    /* Close the raw job so the threads can move past it. */
+    if (pStrm->pZipRaw)
+    {
+        ASMAtomicWriteU32(&pStrm->pZipRaw->enmState, SSMSTRMZIPJOB_DONE);
+        pStrm->pZipRaw = NULL;
+    }
+
+    PSSMSTRMZIPJOB pJob = ssmR3StrmZipAllocJob(pStrm, true /*fZip*/);
+    memcpy(&pJob->abIn[0], pvBlock, SSM_ZIP_BLOCK_SIZE);
+    ASMAtomicWriteU32(&pJob->enmState, SSMSTRMZIPJOB_QUEUED);
+    ASMAtomicWriteU32(&pStrm->iZipSubmitted, pStrm->iZipTail);
+    if (ASMAtomicReadU32(&pStrm->cZipIdle))
+        RTSemEventSignal(pStrm->hEvtZipWork);
+
+    ssmR3StrmZipWriteDone(pStrm);
+    return pStrm->rc;
+}
+
+
+/**
+ * Adds raw bytes behind the blocks in the compression ring.
+ *
+ * @returns VBox status code.
+ * @param   pStrm       The stream handle.
+ * @param   pvBuf       What to write.
+ * @param   cbToWrite   How much to write.
+ *
+ * @thread  The producer.
+ */
+static int ssmR3StrmZipWriteRaw(PSSMSTRM pStrm, const void *pvBuf, size_t cbToWrite)
+{
+    while (cbToWrite > 0)
+    {
+        PSSMSTRMZIPJOB pJob = pStrm->pZipRaw;
+        if (!pJob || pJob->cbOut >= sizeof(pJob->abOut))
+        {
+            if (pJob)
+            {
+                ASMAtomicWriteU32(&pJob->enmState, SSMSTRMZIPJOB_DONE);
+                pStrm->pZipRaw = NULL;
+                ssmR3StrmZipWriteDone(pStrm);
+                if (pStrm->iZipHead == pStrm->iZipTail)
+                    return ssmR3StrmWriteDirect(pStrm, pvBuf, cbToWrite);
+            }
+            pJob = ssmR3StrmZipAllocJob(pStrm, false /*fZip*/);
+            ASMAtomicWriteU32(&pJob->enmState, SSMSTRMZIPJOB_FILLING);
+            pStrm->pZipRaw = pJob;
+        }
+
+        uint32_t cbCopy = (uint32_t)RT_MIN(sizeof(pJob->abOut) - pJob->cbOut, cbToWrite);
+        memcpy(&pJob->abOut[pJob->cbOut], pvBuf, cbCopy);
+        pJob->cbOut += cbCopy;
+        cbToWrite   -= cbCopy;
+        pvBuf        = (uint8_t const *)pvBuf + cbCopy;
+    }
+    return pStrm->rc;
+}
+
+
+/**
+ * Waits for all the jobs in the compression ring and writes them to the
+ * stream.
+ *
+ * @returns VBox status code.
+ * @param   pStrm       The stream handle.
+ *
+ * @thread  The producer.
+ */
+static int ssmR3StrmZipFlush(PSSMSTRM pStrm)
+{
+    while (pStrm->iZipHead != pStrm->iZipTail)
+        ssmR3StrmZipRetireHead(pStrm);
+    Assert(!pStrm->pZipRaw);
+    return pStrm->rc;
+}
+
+
 /**
  * Read more from the stream.
  *
@@ -2652,6 +3137,24 @@ static int ssmR3StrmCheckAndFlush(PSSMSTRM pStrm)
  * @param   pStrm       The stream handle.
  */
 static uint64_t ssmR3StrmTell(PSSMSTRM pStrm)
+{
+    if (pStrm->iZipHead != pStrm->iZipTail)
+        ssmR3StrmZipFlush(pStrm);
+    return pStrm->offCurStream + pStrm->off;
+}
+
+
+/**
+ * Tell the current stream position without draining the compression ring.
+ *
+ * For logging only: this lags behind ssmR3StrmTell by whatever is still
+ * queued for compression, but unlike it, it doesn't change the stream layout
+ * or timing.
+ *
+ * @returns stream position, excluding queued compression jobs.
+ * @param   pStrm       The stream handle.
+ */
+DECLINLINE(uint64_t) ssmR3StrmTellNoFlush(PSSMSTRM pStrm)
 {
     return pStrm->offCurStream + pStrm->off;
 }
@@ -2667,6 +3170,8 @@ static uint32_t ssmR3StrmCurCRC(PSSMSTRM pStrm)
 {
     if (!pStrm->fChecksummed)
         return 0;
+    if (pStrm->iZipHead != pStrm->iZipTail)
+        ssmR3StrmZipFlush(pStrm);
     if (pStrm->offStreamCRC < pStrm->off)
     {
         PSSMSTRMBUF pBuf = pStrm->pCur; Assert(pBuf);
@@ -2734,6 +3239,23 @@ static int ssmR3StrmSeek(PSSMSTRM pStrm, int64_t off, uint32_t uMethod, uint32_t
             ssmR3StrmPutFreeBuf(pStrm, pStrm->pCur);
             pStrm->pCur = NULL;
         }
+
+        /* Drop anything read ahead from the old position. */
+        PSSMSTRMBUF pBuf = ASMAtomicXchgPtrT(&pStrm->pHead, NULL, PSSMSTRMBUF);
+        while (pBuf)
+        {
+            PSSMSTRMBUF pNext = pBuf->pNext;
+            ssmR3StrmPutFreeBuf(pStrm, pBuf);
+            pBuf = pNext;
+        }
+        pBuf = pStrm->pPending;
+        pStrm->pPending = NULL;
+        while (pBuf)
+        {
+            PSSMSTRMBUF pNext = pBuf->pNext;
+            ssmR3StrmPutFreeBuf(pStrm, pBuf);
+            pBuf = pNext;
+        }
     }
     return rc;
 }
@@ -2938,6 +3460,30 @@ static void ssmR3StrmStartIoThread(PSSMSTRM pStrm)
 }
 
 
+/**
+ * Stops the read ahead I/O thread of a read stream, leaving whatever it has
+ * read queued up.
+ *
+ * @returns true if the thread was running, false if not.
+ * @param   pStrm       The stream handle.
+ */
+static bool ssmR3StrmStopIoThread(PSSMSTRM pStrm)
+{
+    Assert(!pStrm->fWrite);
+    if (pStrm->hIoThread == NIL_RTTHREAD)
+        return false;
+
+    ASMAtomicWriteBool(&pStrm->fTerminating, true);
+    int rc = RTSemEventSignal(pStrm->hEvtFree);
+    AssertLogRelRC(rc);
+    rc = RTThreadWait(pStrm->hIoThread, RT_INDEFINITE_WAIT, NULL);
+    AssertLogRelRC(rc);
+    pStrm->hIoThread = NIL_RTTHREAD;
+    ASMAtomicWriteBool(&pStrm->fTerminating, false);
+    return true;
+}
+
+
 /**
  * Works the progress calculation for non-live saves and restores.
  *
@@ -3060,6 +3606,25 @@ static int ssmR3DataWriteFinish(PSSMHANDLE pSSM)
 }
 
 
+/**
+ * Waits for the blocks still being compressed and accounts for their records
+ * in the unit size.
+ *
+ * Must be called before the termination record is written.  Errors are
+ * signalled via pSSM->rc.
+ *
+ * @param   pSSM            The saved state handle.
+ */
+static void ssmR3DataWriteSync(PSSMHANDLE pSSM)
+{
+    int rc = ssmR3StrmZipFlush(&pSSM->Strm);
+    if (RT_FAILURE(rc) && RT_SUCCESS(pSSM->rc))
+        pSSM->rc = rc;
+    pSSM->offUnit        += pSSM->Strm.cbZipOut;
+    pSSM->Strm.cbZipOut   = 0;
+}
+
+
 /**
  * Begins writing the data of a data unit.
  *
@@ -3084,7 +3649,7 @@ static void ssmR3DataWriteBegin(PSSMHANDLE pSSM)
 static int ssmR3DataWriteRaw(PSSMHANDLE pSSM, const void *pvBuf, size_t cbBuf)
 {
     Log2(("ssmR3DataWriteRaw: %08llx|%08llx: pvBuf=%p cbBuf=%#x %.*Rhxs%s\n",
-          ssmR3StrmTell(&pSSM->Strm), pSSM->offUnit, pvBuf, cbBuf, RT_MIN(cbBuf, SSM_LOG_BYTES), pvBuf, cbBuf > SSM_LOG_BYTES ? "..." : ""));
+          ssmR3StrmTellNoFlush(&pSSM->Strm), pSSM->offUnit, pvBuf, cbBuf, RT_MIN(cbBuf, SSM_LOG_BYTES), pvBuf, cbBuf > SSM_LOG_BYTES ? "..." : ""));
 
     /*
      * Check that everything is fine.
@@ -3172,7 +3737,7 @@ static int ssmR3DataWriteRecHdr(PSSMHANDLE pSSM, size_t cb, uint8_t u8TypeAndFla
         AssertLogRelMsgFailedReturn(("cb=%#x\n", cb), pSSM->rc = VERR_SSM_MEM_TOO_BIG);
 
     Log3(("ssmR3DataWriteRecHdr: %08llx|%08llx/%08x: Type=%02x fImportant=%RTbool cbHdr=%u\n",
-          ssmR3StrmTell(&pSSM->Strm) + cbHdr, pSSM->offUnit + cbHdr, cb, u8TypeAndFlags & SSM_REC_TYPE_MASK, !!(u8TypeAndFlags & SSM_REC_FLAGS_IMPORTANT), cbHdr));
+          ssmR3StrmTellNoFlush(&pSSM->Strm) + cbHdr, pSSM->offUnit + cbHdr, cb, u8TypeAndFlags & SSM_REC_TYPE_MASK, !!(u8TypeAndFlags & SSM_REC_FLAGS_IMPORTANT), cbHdr));
 
     return ssmR3DataWriteRaw(pSSM, &abHdr[0], cbHdr);
 }
@@ -3232,38 +3797,27 @@ static int ssmR3DataWriteBig(PSSMHANDLE pSSM, const void *pvBuf, size_t cbBuf)
                )
             {
                 /*
-                 * Compress it.
+                 * Compress it, on one of the compression threads if we've
+                 * got any (pSSM->offUnit is updated by ssmR3DataWriteSync).
                  */
-                AssertCompile(1 + 3 + 1 + SSM_ZIP_BLOCK_SIZE < 0x00010000);
-                uint8_t *pb;
-                rc = ssmR3StrmReserveWriteBufferSpace(&pSSM->Strm, 1 + 3 + 1 + SSM_ZIP_BLOCK_SIZE, &pb);
-                if (RT_FAILURE(rc))
-                    break;
-                size_t cbRec = SSM_ZIP_BLOCK_SIZE - (SSM_ZIP_BLOCK_SIZE / 16);
-                rc = RTZipBlockCompress(RTZIPTYPE_LZF, RTZIPLEVEL_FAST, 0 /*fFlags*/,
-                                        pvBuf, SSM_ZIP_BLOCK_SIZE,
-                                        pb + 1 + 3 + 1, cbRec, &cbRec);
-                if (RT_SUCCESS(rc))
+                if (pSSM->Strm.cZipThreads)
                 {
-                    pb[0] = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW_LZF;
-                    pb[4] = SSM_ZIP_BLOCK_SIZE / _1K;
-                    cbRec += 1;
+                    rc = ssmR3StrmZipBlock(&pSSM->Strm, pvBuf);
+                    if (RT_FAILURE(rc))
+                        break;
                 }
                 else
                 {
-                    pb[0] = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW;
-                    memcpy(&pb[4], pvBuf, SSM_ZIP_BLOCK_SIZE);
-                    cbRec = SSM_ZIP_BLOCK_SIZE;
+                    uint8_t *pb;
+                    rc = ssmR3StrmReserveWriteBufferSpace(&pSSM->Strm, SSM_ZIP_BLOCK_REC_MAX, &pb);
+                    if (RT_FAILURE(rc))
+                        break;
+                    uint32_t cbRec = ssmR3StrmZipEncodeBlock(pvBuf, pb, pSSM->Strm.enmZipLevel);
+                    rc = ssmR3StrmCommitWriteBufferSpace(&pSSM->Strm, cbRec);
+                    if (RT_FAILURE(rc))
+                        break;
+                    pSSM->offUnit += cbRec;
                 }
-                pb[1] = (uint8_t)(0xe0 | ( cbRec >> 12));
-                pb[2] = (uint8_t)(0x80 | ((cbRec >>  6) & 0x3f));
-                pb[3] = (uint8_t)(0x80 | ( cbRec        & 0x3f));
-                cbRec += 1 + 3;
-                rc = ssmR3StrmCommitWriteBufferSpace(&pSSM->Strm, cbRec);
-                if (RT_FAILURE(rc))
-                    break;
-
-                pSSM->offUnit += cbRec;
                 ssmR3ProgressByByte(pSSM, SSM_ZIP_BLOCK_SIZE);
 
                 /* advance */
@@ -3281,7 +3835,7 @@ static int ssmR3DataWriteBig(PSSMHANDLE pSSM, const void *pvBuf, size_t cbBuf)
                 abRec[0] = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW_ZERO;
                 abRec[1] = 1;
                 abRec[2] = SSM_ZIP_BLOCK_SIZE / _1K;
-                Log3(("ssmR3DataWriteBig: %08llx|%08llx/%08x: ZERO\n", ssmR3StrmTell(&pSSM->Strm) + 2, pSSM->offUnit + 2, 1));
+                Log3(("ssmR3DataWriteBig: %08llx|%08llx/%08x: ZERO\n", ssmR3StrmTellNoFlush(&pSSM->Strm) + 2, pSSM->offUnit + 2, 1));
                 rc = ssmR3DataWriteRaw(pSSM, &abRec[0], sizeof(abRec));
                 if (RT_FAILURE(rc))
                     break;
@@ -3361,6 +3915,36 @@ DECLINLINE(int) ssmR3DataWrite(PSSMHANDLE pSSM, const void *pvBuf, size_t cbBuf)
 }
 
 
+/**
+ * Ends the current record and returns the stream offset of the next one.
+ *
+ * The offset can be handed to SSMR3SeekRecord when loading the unit to skip
+ * directly to the data written after this call.  Only meaningful for file
+ * streams.
+ *
+ * @returns VBox status code.
+ * @param   pSSM            The saved state handle.
+ * @param   poffRecord      Where to return the stream offset.
+ */
+VMMR3DECL(int) SSMR3TellRecord(PSSMHANDLE pSSM, uint64_t *poffRecord)
+{
+    SSM_ASSERT_WRITEABLE_RET(pSSM);
+    SSM_CHECK_CANCELLED_RET(pSSM);
+    AssertPtrReturn(poffRecord, VERR_INVALID_POINTER);
+    *poffRecord = UINT64_MAX;
+
+    int rc = ssmR3DataFlushBuffer(pSSM);
+    if (RT_FAILURE(rc))
+        return rc;
+    ssmR3DataWriteSync(pSSM);
+    if (RT_FAILURE(pSSM->rc))
+        return pSSM->rc;
+
+    *poffRecord = ssmR3StrmTell(&pSSM->Strm);
+    return VINF_SUCCESS;
+}
+
+
 /**
  * Puts a structure.
  *
@@ -4167,6 +4751,7 @@ static int ssmR3LiveControlEmit(PSSMHANDLE pSSM, long double lrdPct, uint32_t uP
             /*
              * Write the termination record and flush the compression stream.
              */
+            ssmR3DataWriteSync(pSSM);
             SSMRECTERM TermRec;
             TermRec.u8TypeAndFlags   = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_TERM;
             TermRec.cbRec            = sizeof(TermRec) - 2;
@@ -4603,6 +5188,7 @@ static int ssmR3SaveDoExecRun(PVM pVM, PSSMHANDLE pSSM)
         /*
          * Write the termination record and flush the compression stream.
          */
+        ssmR3DataWriteSync(pSSM);
         SSMRECTERM TermRec;
         TermRec.u8TypeAndFlags   = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_TERM;
         TermRec.cbRec            = sizeof(TermRec) - 2;
@@ -4874,6 +5460,26 @@ static int ssmR3SaveDoCreateFile(PVM pVM, const char *pszFilename, PCSSMSTRMOPS
         return rc;
     }
 
+    /*
+     * Parallel compression.
+     */
+    PCFGMNODE pCfgSSM = CFGMR3GetChild(CFGMR3GetRoot(pVM), "SSM");
+    /** @cfgm{/SSM/ZipThreads, uint32_t, half the host CPUs, at most 4}
+     * The number of threads compressing the saved state data.  0 means the
+     * saving EMT does it itself. */
+    uint32_t cZipThreads;
+    rc = CFGMR3QueryU32Def(pCfgSSM, "ZipThreads", &cZipThreads, RT_MIN(RTMpGetOnlineCount() / 2, 4));
+    AssertLogRelMsgStmt(RT_SUCCESS(rc), ("ZipThreads -> %Rrc\n", rc), cZipThreads = 0);
+    /** @cfgm{/SSM/ZipLevel, uint32_t, 1}
+     * The compression level: 0 stores the data uncompressed, 1 thru 3 select
+     * RTZIPLEVEL_FAST thru RTZIPLEVEL_MAX (LZF, the only codec the loader
+     * knows, doesn't currently make a difference between them). */
+    uint32_t uZipLevel;
+    rc = CFGMR3QueryU32Def(pCfgSSM, "ZipLevel", &uZipLevel, RTZIPLEVEL_FAST);
+    AssertLogRelMsgStmt(RT_SUCCESS(rc), ("ZipLevel -> %Rrc\n", rc), uZipLevel = RTZIPLEVEL_FAST);
+    AssertLogRelMsgStmt(uZipLevel <= RTZIPLEVEL_MAX, ("ZipLevel=%u\n", uZipLevel), uZipLevel = RTZIPLEVEL_MAX);
+    ssmR3StrmZipInit(&pSSM->Strm, cZipThreads, (RTZIPLEVEL)uZipLevel);
+
     *ppSSM = pSSM;
     return VINF_SUCCESS;
 }
@@ -5174,6 +5780,7 @@ static int ssmR3LiveDoExecRun(PVM pVM, PSSMHANDLE pSSM, uint32_t uPass)
         /*
          * Write the termination record and flush the compression stream.
          */
+        ssmR3DataWriteSync(pSSM);
         SSMRECTERM TermRec;
         TermRec.u8TypeAndFlags   = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_TERM;
         TermRec.cbRec            = sizeof(TermRec) - 2;
@@ -7169,6 +7776,55 @@ VMMR3DECL(int) SSMR3SkipToEndOfUnit(PSSMHANDLE pSSM)
 }
 
 
+/**
+ * Repositions the current data unit at a record offset obtained by
+ * SSMR3TellRecord when it was saved.
+ *
+ * Seeking is only supported for file streams in the version 2 format.  The
+ * stream checksum cannot be verified after this call since the data in
+ * between is never read.
+ *
+ * @returns VBox status code.
+ * @param   pSSM            The saved state handle.
+ * @param   offRecord       The stream offset of the record, as returned by
+ *                          SSMR3TellRecord.  Backwards seeking is only
+ *                          permitted on handles returned by SSMR3Open.
+ *
+ * @thread  The caller is responsible for serializing calls per handle.
+ */
+VMMR3DECL(int) SSMR3SeekRecord(PSSMHANDLE pSSM, uint64_t offRecord)
+{
+    SSM_ASSERT_READABLE_RET(pSSM);
+    SSM_CHECK_CANCELLED_RET(pSSM);
+    AssertReturn(pSSM->u.Read.uFmtVerMajor >= 2, VERR_NOT_SUPPORTED);
+    AssertReturn(ssmR3StrmIsFile(&pSSM->Strm), VERR_NOT_SUPPORTED);
+    AssertReturn(!pSSM->u.Read.fEndOfData, VERR_SSM_LOADED_TOO_MUCH);
+
+    uint64_t const offCur = ssmR3StrmTell(&pSSM->Strm);
+    AssertMsgReturn(   offRecord >= offCur
+                    || pSSM->enmOp == SSMSTATE_OPEN_READ,
+                    ("offRecord=%#llx offCur=%#llx\n", offRecord, offCur), VERR_SSM_SKIP_BACKWARDS);
+
+    /*
+     * Stop the read ahead, reposition the stream and restart it.
+     */
+    bool const fIoThread = ssmR3StrmStopIoThread(&pSSM->Strm);
+    ssmR3StrmDisableChecksumming(&pSSM->Strm);
+    int rc = ssmR3StrmSeek(&pSSM->Strm, offRecord, RTFILE_SEEK_BEGIN, 0);
+    if (fIoThread)
+        ssmR3StrmStartIoThread(&pSSM->Strm);
+    if (RT_FAILURE(rc))
+        return pSSM->rc = rc;
+
+    /* The unit size check at the terminator counts the skipped bytes too. */
+    pSSM->offUnit                 += offRecord - offCur;
+    pSSM->u.Read.cbRecLeft         = 0;
+    pSSM->u.Read.cbDataBuffer      = 0;
+    pSSM->u.Read.offDataBuffer     = 0;
+    return VINF_SUCCESS;
+}
+
+
 /**
  * Calculate the checksum of a file portion.
  *
@@ -8022,6 +8678,9 @@ static int ssmR3LoadDirectoryAndFooter(PSSMHANDLE pSSM)
     rc = ssmR3StrmRead(&pSSM->Strm, &Footer, sizeof(Footer));
     if (RT_FAILURE(rc))
         return rc;
+    if (    pSSM->u.Read.fStreamCrc32
+        &&  !pSSM->Strm.fChecksummed)
+        u32StreamCRC = Footer.u32StreamCRC; /* A unit used SSMR3SeekRecord, nothing to verify against. */
     return ssmR3ValidateFooter(&Footer, off, DirHdr.cEntries, pSSM->u.Read.fStreamCrc32, u32StreamCRC);
 }
 
@@ -9062,6 +9721,22 @@ VMMR3DECL(const char *) SSMR3HandleHostOSAndArch(PSSMHANDLE pSSM)
 }
 
 
+/**
+ * Gets the name of the file the saved state handle is operating on.
+ *
+ * @returns Pointer to a read only string, NULL if the handle isn't operating
+ *          on a file (remote stream).
+ * @param   pSSM            The saved state handle.
+ */
+VMMR3DECL(const char *) SSMR3HandleGetFilename(PSSMHANDLE pSSM)
+{
+    SSM_ASSERT_VALID_HANDLE(pSSM);
+    if (!ssmR3StrmIsFile(&pSSM->Strm))
+        return NULL;
+    return pSSM->pszFilename;
+}
+
+
 #ifndef SSM_STANDALONE
 /**
  * Asynchronously cancels the current SSM operation ASAP.
@@ -0,0 +1,800 @@
+/* $Id: SSMTcp.cpp $ */
+/** @file
+ * SSM - Saved State Manager, Striped TCP Stream Transport.
+ */
+
+/*
+ * Copyright (C) 2012 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/** @page pg_ssm_tcp    SSM - Striped TCP Stream Transport
+ *
+ * The teleporter and FTM push a saved state stream thru a TCP connection.  A
+ * single connection is bound by its congestion window and by the one thread
+ * doing all the copying on either end, which leaves a fast link mostly idle.
+ *
+ * A stripe cuts the stream into chunks of up to SSMTCPSTRIPE_CHUNK_SIZE bytes
+ * and deals them out round robin over a set of connected sockets, chunk number
+ * idSeq going to socket idSeq % cStreams.  Each socket has a thread and a
+ * small ring of chunk buffers.  On the sending side the thread writes the
+ * chunks queued by the producer, on the receiving side it reads ahead of the
+ * consumer, which then picks the chunks up in sequence order.  Every chunk
+ * carries its sequence number so a mixed up connection is detected instead of
+ * silently reordering the stream.
+ *
+ * The end of the stream is marked by an end-of-stream (or cancel) chunk on
+ * each of the sockets, so all the threads terminate in an orderly fashion.
+ * The receiving side reads the markers off all the sockets before reporting
+ * the end of the stream.  Only when every marker went thru can the sockets be
+ * used for another stripe, see SSMR3TcpStripeCanReuseSockets; after an abort
+ * there may be stale chunks left in them and they have to be closed.
+ *
+ * Establishing and authenticating the connections is up to the user.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#define LOG_GROUP LOG_GROUP_SSM
+#include <VBox/vmm/ssm.h>
+#include <VBox/err.h>
+#include <VBox/log.h>
+
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/mem.h>
+#include <iprt/semaphore.h>
+#include <iprt/socket.h>
+#include <iprt/string.h>
+#include <iprt/tcp.h>
+#include <iprt/thread.h>
+
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** The max chunk payload size. */
+#define SSMTCPSTRIPE_CHUNK_SIZE         _128K
+/** The number of chunk buffers per socket. */
+#define SSMTCPSTRIPE_RING_SIZE          4
+/** Magic value for SSMTCPSTRIPEHDR::u32Magic. (Robert Allen Zimmerman) */
+#define SSMTCPSTRIPEHDR_MAGIC           UINT32_C(0x19410524)
+/** Magic value for SSMTCPSTRIPE::u32Magic. (Miles Dewey Davis III) */
+#define SSMTCPSTRIPE_MAGIC              UINT32_C(0x19260526)
+/** Magic value for SSMTCPSTRIPE::u32Magic after destruction. */
+#define SSMTCPSTRIPE_MAGIC_DEAD         UINT32_C(0x19910928)
+
+
+/*******************************************************************************
+*   Structures and Typedefs                                                    *
+*******************************************************************************/
+/**
+ * Chunk header.
+ */
+typedef struct SSMTCPSTRIPEHDR
+{
+    /** Magic value (SSMTCPSTRIPEHDR_MAGIC). */
+    uint32_t            u32Magic;
+    /** The size of the data following this header.
+     * 0 indicates the end of the stream, while UINT32_MAX indicates
+     * cancelation. */
+    uint32_t            cb;
+    /** The sequence number of the chunk. */
+    uint64_t            idSeq;
+} SSMTCPSTRIPEHDR;
+AssertCompileSize(SSMTCPSTRIPEHDR, 16);
+
+/**
+ * Chunk buffer, laid out the way it goes over the wire.
+ */
+typedef struct SSMTCPSTRIPECHUNK
+{
+    SSMTCPSTRIPEHDR     Hdr;
+    uint8_t             abData[SSMTCPSTRIPE_CHUNK_SIZE];
+} SSMTCPSTRIPECHUNK;
+/** Pointer to a chunk buffer. */
+typedef SSMTCPSTRIPECHUNK *PSSMTCPSTRIPECHUNK;
+
+/**
+ * Per socket data.
+ */
+typedef struct SSMTCPSTRIPESTREAM
+{
+    /** The socket. */
+    RTSOCKET            hSocket;
+    /** The thread doing the socket I/O. */
+    RTTHREAD            hThread;
+    /** Signalled when a chunk has been added to the ring. */
+    RTSEMEVENT          hEvtFilled;
+    /** Signalled when a chunk has been taken off the ring. */
+    RTSEMEVENT          hEvtEmptied;
+    /** The ring producer index (free running). */
+    uint32_t volatile   iHead;
+    /** The ring consumer index (free running). */
+    uint32_t volatile   iTail;
+    /** The sequence number of the next chunk expected on this socket, only
+     * used by the receiving thread. */
+    uint64_t            idSeqNext;
+    /** The stream index. */
+    uint32_t            iStream;
+    /** Set by the thread once the end-of-stream or cancel marker has been
+     * written to or read from the socket. */
+    bool volatile       fEnded;
+    /** Back pointer to the stripe. */
+    struct SSMTCPSTRIPE *pStripe;
+    /** The chunk buffers. */
+    PSSMTCPSTRIPECHUNK  apChunks[SSMTCPSTRIPE_RING_SIZE];
+} SSMTCPSTRIPESTREAM;
+/** Pointer to the per socket data. */
+typedef SSMTCPSTRIPESTREAM *PSSMTCPSTRIPESTREAM;
+
+/**
+ * Striped TCP stream instance.
+ */
+typedef struct SSMTCPSTRIPE
+{
+    /** Magic value (SSMTCPSTRIPE_MAGIC). */
+    uint32_t            u32Magic;
+    /** The number of sockets. */
+    uint32_t            cStreams;
+    /** Set if this is the sending side. */
+    bool                fWriter;
+    /** Set when the end of the stream has been written or read. */
+    bool                fEndOfStream;
+    /** Tells the threads to quit. */
+    bool volatile       fTerminate;
+    /** Makes the consumer return VERR_INTERRUPTED instead of waiting. */
+    bool volatile       fStopReading;
+    /** The first error hit by any of the threads. */
+    int32_t volatile    rc;
+    /** The sequence number of the current chunk. */
+    uint64_t            idSeq;
+    /** The chunk being filled (sending) or drained (receiving), NULL if none. */
+    PSSMTCPSTRIPECHUNK  pCur;
+    /** The offset into the current chunk. */
+    uint32_t            offCur;
+    /** The sockets (variable size). */
+    SSMTCPSTRIPESTREAM  aStreams[1];
+} SSMTCPSTRIPE;
+
+
+/**
+ * Records the first error and wakes up everyone.
+ *
+ * @param   pStripe         The stripe.
+ * @param   rc              The status code.
+ */
+static void ssmR3TcpStripeSetError(PSSMTCPSTRIPE pStripe, int rc)
+{
+    ASMAtomicCmpXchgS32(&pStripe->rc, rc, VINF_SUCCESS);
+    for (uint32_t i = 0; i < pStripe->cStreams; i++)
+    {
+        RTSemEventSignal(pStripe->aStreams[i].hEvtFilled);
+        RTSemEventSignal(pStripe->aStreams[i].hEvtEmptied);
+    }
+}
+
+
+/**
+ * Waits for a chunk to show up in, or a slot to free up in, the ring of a
+ * socket.
+ *
+ * @returns VINF_SUCCESS when the ring is ready, otherwise the stripe error
+ *          status, VERR_EOF on termination or VERR_INTERRUPTED when told to
+ *          stop reading.
+ * @param   pStripe         The stripe.
+ * @param   pStream         The socket.
+ * @param   fFilled         Whether to wait for a chunk (true) or a free
+ *                          slot (false).
+ */
+static int ssmR3TcpStripeWait(PSSMTCPSTRIPE pStripe, PSSMTCPSTRIPESTREAM pStream, bool fFilled)
+{
+    for (;;)
+    {
+        uint32_t const cUsed = ASMAtomicReadU32(&pStream->iHead) - ASMAtomicReadU32(&pStream->iTail);
+        if (fFilled ? cUsed > 0 : cUsed < SSMTCPSTRIPE_RING_SIZE)
+            return VINF_SUCCESS;
+
+        int rc = ASMAtomicReadS32(&pStripe->rc);
+        if (RT_FAILURE(rc))
+            return rc;
+        if (ASMAtomicReadBool(&pStripe->fTerminate))
+            return VERR_EOF;
+        if (   fFilled
+            && !pStripe->fWriter
+            && ASMAtomicReadBool(&pStripe->fStopReading))
+            return VERR_INTERRUPTED;
+
+        RTSemEventWait(fFilled ? pStream->hEvtFilled : pStream->hEvtEmptied, 1000);
+    }
+}
+
+
+/**
+ * Thread sending the chunks queued for one socket.
+ *
+ * @returns VINF_SUCCESS (ignored).
+ * @param   hThread         The thread handle.
+ * @param   pvUser          The socket data.
+ */
+static DECLCALLBACK(int) ssmR3TcpStripeSendThread(RTTHREAD hThread, void *pvUser)
+{
+    PSSMTCPSTRIPESTREAM pStream = (PSSMTCPSTRIPESTREAM)pvUser;
+    PSSMTCPSTRIPE       pStripe = pStream->pStripe;
+
+    for (;;)
+    {
+        int rc = ssmR3TcpStripeWait(pStripe, pStream, true /*fFilled*/);
+        if (RT_FAILURE(rc))
+            break;
+
+        PSSMTCPSTRIPECHUNK pChunk = pStream->apChunks[pStream->iTail % SSMTCPSTRIPE_RING_SIZE];
+        bool const         fEnd   = pChunk->Hdr.cb == 0 || pChunk->Hdr.cb == UINT32_MAX;
+        rc = RTTcpWrite(pStream->hSocket, pChunk, sizeof(pChunk->Hdr) + (fEnd ? 0 : pChunk->Hdr.cb));
+        if (RT_FAILURE(rc))
+        {
+            LogRel(("SSM/TCP: Stream #%u write error: %Rrc (cb=%#x)\n", pStream->iStream, rc, pChunk->Hdr.cb));
+            ssmR3TcpStripeSetError(pStripe, rc);
+            break;
+        }
+
+        ASMAtomicIncU32(&pStream->iTail);
+        RTSemEventSignal(pStream->hEvtEmptied);
+        if (fEnd)
+        {
+            ASMAtomicWriteBool(&pStream->fEnded, true);
+            break;
+        }
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Thread reading ahead the chunks arriving on one socket.
+ *
+ * @returns VINF_SUCCESS (ignored).
+ * @param   hThread         The thread handle.
+ * @param   pvUser          The socket data.
+ */
+static DECLCALLBACK(int) ssmR3TcpStripeRecvThread(RTTHREAD hThread, void *pvUser)
+{
+    PSSMTCPSTRIPESTREAM pStream = (PSSMTCPSTRIPESTREAM)pvUser;
+    PSSMTCPSTRIPE       pStripe = pStream->pStripe;
+
+    for (;;)
+    {
+        int rc = ssmR3TcpStripeWait(pStripe, pStream, false /*fFilled*/);
+        if (RT_FAILURE(rc))
+            break;
+
+        /*
+         * Wait for the header, polling the terminate flag.  In the normal
+         * course of events we'll get an end-of-stream header.
+         */
+        do
+            rc = RTTcpSelectOne(pStream->hSocket, 1000);
+        while (   rc == VERR_TIMEOUT
+               && !ASMAtomicReadBool(&pStripe->fTerminate));
+        if (ASMAtomicReadBool(&pStripe->fTerminate))
+            break;
+        if (RT_FAILURE(rc))
+        {
+            LogRel(("SSM/TCP: Stream #%u select error: %Rrc\n", pStream->iStream, rc));
+            ssmR3TcpStripeSetError(pStripe, rc);
+            break;
+        }
+
+        PSSMTCPSTRIPECHUNK pChunk = pStream->apChunks[pStream->iHead % SSMTCPSTRIPE_RING_SIZE];
+        rc = RTTcpRead(pStream->hSocket, &pChunk->Hdr, sizeof(pChunk->Hdr), NULL);
+        if (RT_FAILURE(rc))
+        {
+            LogRel(("SSM/TCP: Stream #%u header read error: %Rrc\n", pStream->iStream, rc));
+            ssmR3TcpStripeSetError(pStripe, rc);
+            break;
+        }
+
+        bool const fEnd = pChunk->Hdr.cb == 0 || pChunk->Hdr.cb == UINT32_MAX;
+        if (RT_UNLIKELY(   pChunk->Hdr.u32Magic != SSMTCPSTRIPEHDR_MAGIC
+                        || pChunk->Hdr.idSeq    != pStream->idSeqNext
+                        || (   pChunk->Hdr.cb > SSMTCPSTRIPE_CHUNK_SIZE
+                            && !fEnd)))
+        {
+            LogRel(("SSM/TCP: Stream #%u invalid chunk: u32Magic=%#x cb=%#x idSeq=%#RX64 (expected %#RX64)\n",
+                    pStream->iStream, pChunk->Hdr.u32Magic, pChunk->Hdr.cb, pChunk->Hdr.idSeq, pStream->idSeqNext));
+            ssmR3TcpStripeSetError(pStripe, VERR_IO_GEN_FAILURE);
+            break;
+        }
+
+        if (!fEnd)
+        {
+            rc = RTTcpRead(pStream->hSocket, &pChunk->abData[0], pChunk->Hdr.cb, NULL);
+            if (RT_FAILURE(rc))
+            {
+                LogRel(("SSM/TCP: Stream #%u data read error: %Rrc (cb=%#x)\n", pStream->iStream, rc, pChunk->Hdr.cb));
+                ssmR3TcpStripeSetError(pStripe, rc);
+                break;
+            }
+        }
+
+        pStream->idSeqNext += pStripe->cStreams;
+        if (fEnd)
+            ASMAtomicWriteBool(&pStream->fEnded, true);
+        ASMAtomicIncU32(&pStream->iHead);
+        RTSemEventSignal(pStream->hEvtFilled);
+        if (fEnd)
+            break;
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Creates a striped stream on top of a set of connected sockets.
+ *
+ * The sockets must be connected to the other end in the same order on both
+ * sides.  The caller keeps ownership of the sockets and must not use them for
+ * anything else until the stripe has been destroyed.
+ *
+ * @returns VBox status code.
+ * @param   pahSockets      The sockets.
+ * @param   cSockets        The number of sockets, 1 to SSM_TCP_STRIPE_MAX_STREAMS.
+ * @param   fWriter         Set if this is the sending side, clear if it is
+ *                          the receiving one.
+ * @param   ppStripe        Where to return the stripe handle.
+ */
+VMMR3DECL(int) SSMR3TcpStripeCreate(PRTSOCKET pahSockets, uint32_t cSockets, bool fWriter, PSSMTCPSTRIPE *ppStripe)
+{
+    AssertPtrReturn(ppStripe, VERR_INVALID_POINTER);
+    *ppStripe = NULL;
+    AssertPtrReturn(pahSockets, VERR_INVALID_POINTER);
+    AssertReturn(cSockets > 0 && cSockets <= SSM_TCP_STRIPE_MAX_STREAMS, VERR_OUT_OF_RANGE);
+
+    PSSMTCPSTRIPE pStripe = (PSSMTCPSTRIPE)RTMemAllocZ(RT_OFFSETOF(SSMTCPSTRIPE, aStreams[cSockets]));
+    if (!pStripe)
+        return VERR_NO_MEMORY;
+    pStripe->u32Magic     = SSMTCPSTRIPE_MAGIC;
+    pStripe->cStreams     = cSockets;
+    pStripe->fWriter      = fWriter;
+    pStripe->fEndOfStream = false;
+    pStripe->fTerminate   = false;
+    pStripe->fStopReading = false;
+    pStripe->rc           = VINF_SUCCESS;
+    pStripe->idSeq        = 0;
+    pStripe->pCur         = NULL;
+    pStripe->offCur       = 0;
+    for (uint32_t i = 0; i < cSockets; i++)
+    {
+        PSSMTCPSTRIPESTREAM pStream = &pStripe->aStreams[i];
+        pStream->hSocket     = pahSockets[i];
+        pStream->hThread     = NIL_RTTHREAD;
+        pStream->hEvtFilled  = NIL_RTSEMEVENT;
+        pStream->hEvtEmptied = NIL_RTSEMEVENT;
+        pStream->iHead       = 0;
+        pStream->iTail       = 0;
+        pStream->idSeqNext   = i;
+        pStream->iStream     = i;
+        pStream->fEnded      = false;
+        pStream->pStripe     = pStripe;
+    }
+
+    /*
+     * Allocate the buffers and semaphores before starting any thread.
+     */
+    int rc = VINF_SUCCESS;
+    for (uint32_t i = 0; i < cSockets && RT_SUCCESS(rc); i++)
+    {
+        PSSMTCPSTRIPESTREAM pStream = &pStripe->aStreams[i];
+        rc = RTSemEventCreate(&pStream->hEvtFilled);
+        if (RT_SUCCESS(rc))
+            rc = RTSemEventCreate(&pStream->hEvtEmptied);
+        for (uint32_t iChunk = 0; iChunk < SSMTCPSTRIPE_RING_SIZE && RT_SUCCESS(rc); iChunk++)
+        {
+            pStream->apChunks[iChunk] = (PSSMTCPSTRIPECHUNK)RTMemPageAlloc(sizeof(SSMTCPSTRIPECHUNK));
+            if (!pStream->apChunks[iChunk])
+                rc = VERR_NO_MEMORY;
+        }
+    }
+
+    for (uint32_t i = 0; i < cSockets && RT_SUCCESS(rc); i++)
+    {
+        PSSMTCPSTRIPESTREAM pStream = &pStripe->aStreams[i];
+        rc = RTThreadCreateF(&pStream->hThread, fWriter ? ssmR3TcpStripeSendThread : ssmR3TcpStripeRecvThread, pStream,
+                             0 /*cbStack*/, RTTHREADTYPE_IO, RTTHREADFLAGS_WAITABLE, "SSMTcp%c%u", fWriter ? 'W' : 'R', i);
+        if (RT_FAILURE(rc))
+            pStream->hThread = NIL_RTTHREAD;
+    }
+
+    if (RT_FAILURE(rc))
+    {
+        LogRel(("SSM/TCP: Failed to create a stripe over %u sockets: %Rrc\n", cSockets, rc));
+        SSMR3TcpStripeDestroy(pStripe);
+        return rc;
+    }
+
+    LogFlow(("SSMR3TcpStripeCreate: %u sockets, fWriter=%RTbool -> %p\n", cSockets, fWriter, pStripe));
+    *ppStripe = pStripe;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Destroys a striped stream.
+ *
+ * This stops the threads without waiting for the end of the stream.  Threads
+ * stuck in the middle of a chunk are kicked loose by shutting down their
+ * socket, which leaves the socket unusable.  Use
+ * SSMR3TcpStripeCanReuseSockets before destroying the stripe to find out
+ * whether the sockets can carry another stripe.
+ *
+ * @returns VBox status code.
+ * @param   pStripe         The stripe handle.  NULL is quietly ignored.
+ */
+VMMR3DECL(int) SSMR3TcpStripeDestroy(PSSMTCPSTRIPE pStripe)
+{
+    if (!pStripe)
+        return VINF_SUCCESS;
+    AssertPtrReturn(pStripe, VERR_INVALID_HANDLE);
+    AssertReturn(pStripe->u32Magic == SSMTCPSTRIPE_MAGIC, VERR_INVALID_HANDLE);
+
+    ASMAtomicWriteBool(&pStripe->fTerminate, true);
+    for (uint32_t i = 0; i < pStripe->cStreams; i++)
+    {
+        if (pStripe->aStreams[i].hEvtFilled != NIL_RTSEMEVENT)
+            RTSemEventSignal(pStripe->aStreams[i].hEvtFilled);
+        if (pStripe->aStreams[i].hEvtEmptied != NIL_RTSEMEVENT)
+            RTSemEventSignal(pStripe->aStreams[i].hEvtEmptied);
+    }
+
+    for (uint32_t i = 0; i < pStripe->cStreams; i++)
+    {
+        PSSMTCPSTRIPESTREAM pStream = &pStripe->aStreams[i];
+        if (pStream->hThread != NIL_RTTHREAD)
+        {
+            /* The threads poll the terminate flag every second. */
+            int rc = RTThreadWait(pStream->hThread, 2000, NULL);
+            if (rc == VERR_TIMEOUT)
+            {
+                LogRel(("SSM/TCP: Stream #%u is stuck, shutting down the socket\n", i));
+                RTSocketShutdown(pStream->hSocket, true /*fRead*/, true /*fWrite*/);
+                rc = RTThreadWait(pStream->hThread, RT_INDEFINITE_WAIT, NULL);
+            }
+            AssertRC(rc);
+            pStream->hThread = NIL_RTTHREAD;
+        }
+
+        for (uint32_t iChunk = 0; iChunk < SSMTCPSTRIPE_RING_SIZE; iChunk++)
+            if (pStream->apChunks[iChunk])
+            {
+                RTMemPageFree(pStream->apChunks[iChunk], sizeof(SSMTCPSTRIPECHUNK));
+                pStream->apChunks[iChunk] = NULL;
+            }
+        RTSemEventDestroy(pStream->hEvtFilled);
+        pStream->hEvtFilled = NIL_RTSEMEVENT;
+        RTSemEventDestroy(pStream->hEvtEmptied);
+        pStream->hEvtEmptied = NIL_RTSEMEVENT;
+    }
+
+    pStripe->u32Magic = SSMTCPSTRIPE_MAGIC_DEAD;
+    RTMemFree(pStripe);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Queues the current chunk for sending.
+ *
+ * @param   pStripe         The stripe.
+ * @param   cb              The chunk size, or 0 / UINT32_MAX for an
+ *                          end-of-stream / cancel marker.
+ */
+static void ssmR3TcpStripeSubmit(PSSMTCPSTRIPE pStripe, uint32_t cb)
+{
+    PSSMTCPSTRIPESTREAM pStream = &pStripe->aStreams[pStripe->idSeq % pStripe->cStreams];
+    PSSMTCPSTRIPECHUNK  pChunk  = pStripe->pCur;
+    Assert(pChunk == pStream->apChunks[pStream->iHead % SSMTCPSTRIPE_RING_SIZE]);
+
+    pChunk->Hdr.u32Magic = SSMTCPSTRIPEHDR_MAGIC;
+    pChunk->Hdr.cb       = cb;
+    pChunk->Hdr.idSeq    = pStripe->idSeq;
+    pStripe->pCur        = NULL;
+    pStripe->offCur      = 0;
+    pStripe->idSeq++;
+
+    ASMAtomicIncU32(&pStream->iHead);
+    RTSemEventSignal(pStream->hEvtFilled);
+}
+
+
+/**
+ * Gets a free chunk buffer for the next sequence number (sending side).
+ *
+ * @returns VBox status code.
+ * @param   pStripe         The stripe.
+ */
+static int ssmR3TcpStripeGetFreeChunk(PSSMTCPSTRIPE pStripe)
+{
+    PSSMTCPSTRIPESTREAM pStream = &pStripe->aStreams[pStripe->idSeq % pStripe->cStreams];
+    int rc = ssmR3TcpStripeWait(pStripe, pStream, false /*fFilled*/);
+    if (RT_SUCCESS(rc))
+    {
+        pStripe->pCur   = pStream->apChunks[pStream->iHead % SSMTCPSTRIPE_RING_SIZE];
+        pStripe->offCur = 0;
+    }
+    return rc;
+}
+
+
+/**
+ * Writes to a striped stream.
+ *
+ * The data is buffered up into chunks and sent by the socket threads, so an
+ * error may not be reported until a later call.
+ *
+ * @returns VBox status code.
+ * @param   pStripe         The stripe handle (sending side).
+ * @param   pvBuf           The data to write.
+ * @param   cbToWrite       The number of bytes to write.
+ */
+VMMR3DECL(int) SSMR3TcpStripeWrite(PSSMTCPSTRIPE pStripe, const void *pvBuf, size_t cbToWrite)
+{
+    AssertPtrReturn(pStripe, VERR_INVALID_HANDLE);
+    AssertReturn(pStripe->u32Magic == SSMTCPSTRIPE_MAGIC, VERR_INVALID_HANDLE);
+    AssertReturn(pStripe->fWriter, VERR_INVALID_HANDLE);
+    AssertReturn(!pStripe->fEndOfStream, VERR_WRONG_ORDER);
+
+    int rc = ASMAtomicReadS32(&pStripe->rc);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    while (cbToWrite > 0)
+    {
+        if (!pStripe->pCur)
+        {
+            rc = ssmR3TcpStripeGetFreeChunk(pStripe);
+            if (RT_FAILURE(rc))
+                return rc;
+        }
+
+        uint32_t cb = (uint32_t)RT_MIN(SSMTCPSTRIPE_CHUNK_SIZE - pStripe->offCur, cbToWrite);
+        memcpy(&pStripe->pCur->abData[pStripe->offCur], pvBuf, cb);
+        pStripe->offCur += cb;
+        if (pStripe->offCur == SSMTCPSTRIPE_CHUNK_SIZE)
+            ssmR3TcpStripeSubmit(pStripe, SSMTCPSTRIPE_CHUNK_SIZE);
+
+        /* advance */
+        cbToWrite -= cb;
+        pvBuf = (uint8_t const *)pvBuf + cb;
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Waits for the receive threads to read the end marker off their sockets
+ * after the consumer ran into the first one.
+ *
+ * The sender queues the markers right after the last data chunk, so all that
+ * is left on the other sockets are their markers.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_INTERRUPTED if told to stop reading.
+ * @param   pStripe         The stripe (receiving side).
+ */
+static int ssmR3TcpStripeReadMarkers(PSSMTCPSTRIPE pStripe)
+{
+    for (uint32_t i = 0; i < pStripe->cStreams; i++)
+    {
+        PSSMTCPSTRIPESTREAM pStream = &pStripe->aStreams[i];
+        if (pStream->hThread == NIL_RTTHREAD)
+            continue;
+
+        int rc;
+        while ((rc = RTThreadWait(pStream->hThread, 1000, NULL)) == VERR_TIMEOUT)
+            if (ASMAtomicReadBool(&pStripe->fStopReading))
+                return VERR_INTERRUPTED;
+        AssertRC(rc);
+        pStream->hThread = NIL_RTTHREAD;
+    }
+
+    int rc = ASMAtomicReadS32(&pStripe->rc);
+    if (RT_FAILURE(rc))
+        return rc;
+    for (uint32_t i = 0; i < pStripe->cStreams; i++)
+        AssertReturn(pStripe->aStreams[i].fEnded, VERR_SSM_STREAM_ERROR);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Reads from a striped stream.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_EOF at the end of the stream.
+ * @retval  VERR_SSM_CANCELLED if the sender canceled the stream.
+ * @retval  VERR_INTERRUPTED if told to stop reading.
+ *
+ * @param   pStripe         The stripe handle (receiving side).
+ * @param   pvBuf           Where to return the data.
+ * @param   cbToRead        The number of bytes to read.
+ * @param   pcbRead         Where to return the number of bytes actually read.
+ *                          This may be less than requested.  If NULL, all
+ *                          @a cbToRead bytes will be read.
+ */
+VMMR3DECL(int) SSMR3TcpStripeRead(PSSMTCPSTRIPE pStripe, void *pvBuf, size_t cbToRead, size_t *pcbRead)
+{
+    AssertPtrReturn(pStripe, VERR_INVALID_HANDLE);
+    AssertReturn(pStripe->u32Magic == SSMTCPSTRIPE_MAGIC, VERR_INVALID_HANDLE);
+    AssertReturn(!pStripe->fWriter, VERR_INVALID_HANDLE);
+    if (pcbRead)
+        *pcbRead = 0;
+    if (ASMAtomicReadBool(&pStripe->fStopReading))
+        return VERR_INTERRUPTED;
+
+    while (cbToRead > 0)
+    {
+        /*
+         * Pick up the next chunk in sequence.
+         */
+        PSSMTCPSTRIPESTREAM pStream = &pStripe->aStreams[pStripe->idSeq % pStripe->cStreams];
+        if (!pStripe->pCur)
+        {
+            if (pStripe->fEndOfStream)
+                return VERR_EOF;
+            int rc = ssmR3TcpStripeWait(pStripe, pStream, true /*fFilled*/);
+            if (RT_FAILURE(rc))
+                return rc;
+
+            PSSMTCPSTRIPECHUNK pChunk = pStream->apChunks[pStream->iTail % SSMTCPSTRIPE_RING_SIZE];
+            if (pChunk->Hdr.cb == 0 || pChunk->Hdr.cb == UINT32_MAX)
+            {
+                /* Don't report the end before every socket is done with it. */
+                pStripe->fEndOfStream = true;
+                rc = ssmR3TcpStripeReadMarkers(pStripe);
+                if (RT_FAILURE(rc))
+                    return rc;
+                return pChunk->Hdr.cb ? VERR_SSM_CANCELLED : VERR_EOF;
+            }
+            pStripe->pCur   = pChunk;
+            pStripe->offCur = 0;
+        }
+
+        /*
+         * Copy out the data, handing the chunk back when done with it.
+         */
+        uint32_t cb = (uint32_t)RT_MIN(pStripe->pCur->Hdr.cb - pStripe->offCur, cbToRead);
+        memcpy(pvBuf, &pStripe->pCur->abData[pStripe->offCur], cb);
+        pStripe->offCur += cb;
+        if (pStripe->offCur == pStripe->pCur->Hdr.cb)
+        {
+            pStripe->pCur   = NULL;
+            pStripe->offCur = 0;
+            pStripe->idSeq++;
+            ASMAtomicIncU32(&pStream->iTail);
+            RTSemEventSignal(pStream->hEvtEmptied);
+        }
+
+        if (pcbRead)
+        {
+            *pcbRead = cb;
+            return VINF_SUCCESS;
+        }
+
+        /* advance */
+        cbToRead -= cb;
+        pvBuf = (uint8_t *)pvBuf + cb;
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Ends the stream on the sending side.
+ *
+ * This flushes any partially filled chunk, sends an end-of-stream or cancel
+ * marker on each socket and waits for the threads to finish sending.  The
+ * stripe must still be destroyed afterwards.
+ *
+ * @returns VBox status code, the first I/O error if any.
+ * @param   pStripe         The stripe handle (sending side).
+ * @param   fCanceled       Set if the stream is being canceled.
+ */
+VMMR3DECL(int) SSMR3TcpStripeClose(PSSMTCPSTRIPE pStripe, bool fCanceled)
+{
+    AssertPtrReturn(pStripe, VERR_INVALID_HANDLE);
+    AssertReturn(pStripe->u32Magic == SSMTCPSTRIPE_MAGIC, VERR_INVALID_HANDLE);
+    AssertReturn(pStripe->fWriter, VERR_INVALID_HANDLE);
+
+    int rc = ASMAtomicReadS32(&pStripe->rc);
+    if (RT_SUCCESS(rc) && !pStripe->fEndOfStream)
+    {
+        /* Flush the tail end of the data, unless canceled. */
+        if (pStripe->pCur && !fCanceled)
+            ssmR3TcpStripeSubmit(pStripe, pStripe->offCur);
+
+        /* One marker per socket.  The sequence numbers keep going round robin
+           so each socket gets exactly one. */
+        for (uint32_t i = 0; i < pStripe->cStreams && RT_SUCCESS(rc); i++)
+        {
+            if (!pStripe->pCur)
+                rc = ssmR3TcpStripeGetFreeChunk(pStripe);
+            if (RT_SUCCESS(rc))
+                ssmR3TcpStripeSubmit(pStripe, fCanceled ? UINT32_MAX : 0);
+        }
+        pStripe->fEndOfStream = true;
+
+        /* The threads quit after sending the marker. */
+        for (uint32_t i = 0; i < pStripe->cStreams; i++)
+        {
+            PSSMTCPSTRIPESTREAM pStream = &pStripe->aStreams[i];
+            if (pStream->hThread != NIL_RTTHREAD)
+            {
+                int rc2 = RTThreadWait(pStream->hThread, RT_INDEFINITE_WAIT, NULL);
+                AssertRC(rc2);
+                pStream->hThread = NIL_RTTHREAD;
+            }
+        }
+        if (RT_SUCCESS(rc))
+            rc = ASMAtomicReadS32(&pStripe->rc);
+    }
+    return rc;
+}
+
+
+/**
+ * Makes pending and subsequent reads return VERR_INTERRUPTED, even when
+ * there is data read ahead, or undoes it.
+ *
+ * This is the counterpart of the stop reading flag the TCP stream methods use
+ * for making the reader give up when the load is done or canceled.
+ *
+ * @param   pStripe         The stripe handle (receiving side).
+ * @param   fStop           Whether to stop (true) or resume (false) reading.
+ */
+VMMR3DECL(void) SSMR3TcpStripeSetStopReading(PSSMTCPSTRIPE pStripe, bool fStop)
+{
+    AssertPtrReturnVoid(pStripe);
+    AssertReturnVoid(pStripe->u32Magic == SSMTCPSTRIPE_MAGIC);
+    AssertReturnVoid(!pStripe->fWriter);
+
+    ASMAtomicWriteBool(&pStripe->fStopReading, fStop);
+    if (fStop)
+        for (uint32_t i = 0; i < pStripe->cStreams; i++)
+            RTSemEventSignal(pStripe->aStreams[i].hEvtFilled);
+}
+
+
+/**
+ * Checks whether the end marker has gone thru all the sockets, so they can be
+ * used for another stripe.
+ *
+ * This is the case after a successful SSMR3TcpStripeClose on the sending side
+ * and once SSMR3TcpStripeRead has reported the end of the stream on the
+ * receiving side.  After any kind of abort there may be stale chunks left in
+ * the sockets and they must be closed instead.
+ *
+ * @returns true if the sockets can be reused, false if not.
+ * @param   pStripe         The stripe handle.
+ */
+VMMR3DECL(bool) SSMR3TcpStripeCanReuseSockets(PSSMTCPSTRIPE pStripe)
+{
+    AssertPtrReturn(pStripe, false);
+    AssertReturn(pStripe->u32Magic == SSMTCPSTRIPE_MAGIC, false);
+
+    if (RT_FAILURE(ASMAtomicReadS32(&pStripe->rc)))
+        return false;
+    for (uint32_t i = 0; i < pStripe->cStreams; i++)
+        if (!ASMAtomicReadBool(&pStripe->aStreams[i].fEnded))
+            return false;
+    return true;
+}
@@ -313,6 +313,10 @@ typedef struct EM
      * This protects recompiler usage
      */
     PDMCRITSECT             CritSectREM;
+
+    /** Execution throttle in percent (0-99), applied on top of
+     * VM::uCpuExecutionCap.  Set by live save to make it converge. */
+    uint32_t volatile       uExecutionThrottle;
 } EM;
 /** Pointer to EM VM instance data. */
 typedef EM *PEM;
@@ -21,6 +21,7 @@
 #include <VBox/cdefs.h>
 #include <VBox/types.h>
 #include <VBox/vmm/ftm.h>
+#include <VBox/vmm/ssm.h>
 #include <VBox/vmm/stam.h>
 #include <VBox/vmm/pdmcritsect.h>
 #include <iprt/avl.h>
@@ -62,10 +63,16 @@ typedef struct FTM
     bool                fDeltaLoadSaveActive;
     /** Fallover to the standby VM. */
     bool                fActivateStandby;
-    bool                fAlignment[4];
+    /** The number of data connections the state stream is striped over, 0 if
+     * it goes over hSocket (/FTM/Streams). */
+    uint32_t            cStreams;
 
     /** Current active socket. */
     RTSOCKET            hSocket;
+    /** The data connections (cStreams entries), NULL if not used. */
+    R3PTRTYPE(PRTSOCKET) pahStreams;
+    /** The stripe on top of pahStreams while a state stream is transferred. */
+    R3PTRTYPE(PSSMTCPSTRIPE) pStripe;
 
     /* Shutdown event semaphore. */
     RTSEMEVENT          hShutdownEvent;
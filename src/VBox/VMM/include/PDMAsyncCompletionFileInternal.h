@@ -176,6 +176,19 @@ typedef struct PDMACEPFILEMGR
     /** Number of milliseconds to wait until the bandwidth is refreshed for at least
      * one endpoint and it is possible to process more requests. */
     RTMSINTERVAL                           msBwLimitExpired;
+    /** Id of the manager, used for the thread name and the statistics. */
+    uint32_t                               id;
+    /** The host CPU the manager thread is bound to, NIL_RTCPUID if not bound. */
+    RTCPUID                                idCpu;
+    /** Number of requests per second the assigned endpoints issued
+     * during the last load update period. */
+    uint32_t                               cReqsPerSec;
+#ifdef VBOX_WITH_STATISTICS
+    /** Number of requests processed by this manager. */
+    STAMCOUNTER                            StatReqsProcessed;
+    /** Number of endpoints migrated to another manager to balance the load. */
+    STAMCOUNTER                            StatEndpointsMigrated;
+#endif
     /** Critical section protecting the blocking event handling. */
     RTCRITSECT                             CritSectBlockingEvent;
     /** Event semaphore for blocking external events.
@@ -269,8 +282,27 @@ typedef struct PDMASYNCCOMPLETIONEPCLASSFILE
     uint32_t                            cReqsOutstandingMax;
     /** Bitmask for checking the alignment of a buffer. */
     RTR3UINTPTR                         uBitmaskAlignment;
+    /** Flag whether the async I/O API processes requests for buffered files
+     * asynchronously, no need to fall back to the simple manager then. */
+    bool                                fAioBufferedIo;
     /** Flag whether the out of resources warning was printed already. */
     bool                                fOutOfResourcesWarningPrinted;
+    /** Maximum number of endpoints assigned to one async I/O manager
+     * before a new one is created, 0 for no limit. */
+    uint32_t                            cEndpointsPerAioMgrMax;
+    /** Maximum number of async I/O managers (failsafe managers are not counted). */
+    uint32_t                            cAioMgrsAsyncMax;
+    /** Number of async I/O managers currently running (failsafe managers are not counted). */
+    unsigned                            cAioMgrsAsync;
+    /** Flag whether the async I/O manager threads are bound to host CPUs. */
+    bool                                fAioMgrAffinity;
+    /** Flag whether an endpoint is currently migrated to balance the load.
+     * Only one endpoint is moved at a time. */
+    volatile bool                       fAioMgrBalancing;
+    /** Id of the next I/O manager created. */
+    uint32_t                            idAioMgrNext;
+    /** Index of the host CPU the next async I/O manager is bound to. */
+    uint32_t                            iAioMgrCpuNext;
 } PDMASYNCCOMPLETIONEPCLASSFILE;
 /** Pointer to the endpoint class data. */
 typedef PDMASYNCCOMPLETIONEPCLASSFILE *PPDMASYNCCOMPLETIONEPCLASSFILE;
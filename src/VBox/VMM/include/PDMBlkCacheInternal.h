@@ -80,6 +80,8 @@ typedef struct PDMBLKCACHEENTRY
 #define PDMBLKCACHE_ENTRY_LOCKED         RT_BIT(1)
 /** Entry is dirty */
 #define PDMBLKCACHE_ENTRY_IS_DIRTY       RT_BIT(2)
+/** Entry was read ahead and not accessed yet. */
+#define PDMBLKCACHE_ENTRY_PREFETCHED     RT_BIT(3)
 /** Entry is not evictable. */
 #define PDMBLKCACHE_NOT_EVICTABLE  (PDMBLKCACHE_ENTRY_LOCKED | PDMBLKCACHE_ENTRY_IO_IN_PROGRESS | PDMBLKCACHE_ENTRY_IS_DIRTY)
 
@@ -109,16 +111,34 @@ typedef struct PDMBLKCACHEGLOBAL
     uint32_t            cbCached;
     /** Critical section protecting the cache. */
     RTCRITSECT          CritSect;
-    /** Maximum number of bytes cached. */
-    uint32_t            cbRecentlyUsedInMax;
-    /** Maximum number of bytes in the paged out list .*/
+    /** Target size of the recently used list in bytes.
+     * Adapted on every hit in one of the ghost lists. */
+    uint32_t            cbRecentlyUsedInTarget;
+    /** Maximum number of bytes in the recently used paged out list .*/
     uint32_t            cbRecentlyUsedOutMax;
+    /** Maximum number of bytes in the frequently used paged out list .*/
+    uint32_t            cbFrequentlyUsedOutMax;
+    /** Default minimum number of bytes a single user keeps cached. */
+    uint32_t            cbUserMinDef;
+    /** Default maximum number of bytes a single user can have cached. */
+    uint32_t            cbUserMaxDef;
+    /** Number of bytes read sequentially after which the cache is bypassed
+     * for reads which miss the cache, 0 to disable.
+     * Only used for users without read-ahead. */
+    uint32_t            cbSeqScanThreshold;
+    /** Initial read-ahead window and size of a single prefetch. */
+    uint32_t            cbReadAheadMin;
+    /** Maximum read-ahead window per user, 0 if read-ahead is disabled.
+     * Also bounds the amount of prefetched but not yet accessed data per user. */
+    uint32_t            cbReadAheadMax;
     /** Recently used cache entries list */
     PDMBLKLRULIST       LruRecentlyUsedIn;
     /** Scorecard cache entry list. */
     PDMBLKLRULIST       LruRecentlyUsedOut;
     /** List of frequently used cache entries */
     PDMBLKLRULIST       LruFrequentlyUsed;
+    /** Scorecard list of evicted frequently used entries. */
+    PDMBLKLRULIST       LruFrequentlyUsedOut;
     /** Commit timeout in milli seconds */
     uint32_t            u32CommitTimeoutMs;
     /** Number of dirty bytes needed to start a commit of the data to the disk. */
@@ -154,6 +174,10 @@ typedef struct PDMBLKCACHEGLOBAL
     STAMPROFILEADV      StatTreeRemove;
     /** Number of times a buffer could be reused. */
     STAMCOUNTER         StatBuffersReused;
+    /** Number of hits in the recently used ghost list. */
+    STAMCOUNTER         StatGhostHitsRecentlyUsed;
+    /** Number of hits in the frequently used ghost list. */
+    STAMCOUNTER         StatGhostHitsFrequentlyUsed;
 #endif
 } PDMBLKCACHEGLOBAL;
 #ifdef VBOX_WITH_STATISTICS
@@ -196,6 +220,25 @@ typedef struct PDMBLKCACHE
     RTLISTNODE                    NodeCacheUser;
     /** Block cache type. */
     PDMBLKCACHETYPE               enmType;
+    /** Number of bytes this user has cached (resident entries only),
+     * protected by the global cache lock. */
+    uint32_t                      cbCached;
+    /** Minimum number of bytes other users can't evict. */
+    uint32_t                      cbMin;
+    /** Maximum number of bytes this user can have cached. */
+    uint32_t                      cbMax;
+    /** Offset where the next read has to start to continue a sequential run. */
+    uint64_t                      offSeqNext;
+    /** Number of bytes read sequentially so far. */
+    uint64_t                      cbSeqRun;
+    /** Size of the medium, 0 if unknown which disables read-ahead. */
+    uint64_t                      cbMedium;
+    /** Offset up to which data of the current stream was prefetched already. */
+    uint64_t                      offReadAheadNext;
+    /** Current read-ahead window, protected by the global cache lock. */
+    uint32_t                      cbReadAhead;
+    /** Number of bytes prefetched but not accessed yet. */
+    volatile uint32_t             cbReadAheadUnused;
     /** Type specific data. */
     union
     {
@@ -245,6 +288,14 @@ typedef struct PDMBLKCACHE
     uint32_t    u32Alignment;
     /** Number of times a write was deferred because the cache entry was still in progress */
     STAMCOUNTER StatWriteDeferred;
+    /** Number of reads passed through because of a sequential scan. */
+    STAMCOUNTER StatSeqScanBypassed;
+    /** Number of bytes read ahead. */
+    STAMCOUNTER StatReadAheadIssued;
+    /** Number of bytes read ahead and accessed afterwards. */
+    STAMCOUNTER StatReadAheadHits;
+    /** Number of bytes read ahead and evicted without being accessed. */
+    STAMCOUNTER StatReadAheadWasted;
 #endif
 
     /** Flag whether the cache was suspended. */
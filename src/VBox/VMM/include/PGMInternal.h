@@ -3274,8 +3274,10 @@ typedef struct PGM
         uint32_t                    cIgnoredPages;
         /** Indicates that a live save operation is active.  */
         bool                        fActive;
+        /** Whether to throttle the guest if the live save doesn't converge. */
+        bool                        fAutoConverge;
         /** Padding. */
-        bool                        afReserved[2];
+        bool                        afReserved[1];
         /** The next history index. */
         uint8_t                     iDirtyPagesHistory;
         /** History of the total amount of dirty pages. */
@@ -3293,9 +3295,47 @@ typedef struct PGM
         uint64_t                    uSaveStartNS;
         /** Pages per second (for statistics). */
         uint32_t                    cPagesPerSecond;
-        uint32_t                    cAlignment;
+        /** The current guest execution throttle in percent, see
+         *  EMR3SetExecutionThrottle. */
+        uint32_t                    uThrottle;
+        /** The max guest execution throttle in percent. */
+        uint32_t                    uThrottleMax;
+        /** The number of dirty pages seen by the votes since uThrottleCheckNS. */
+        uint32_t                    cDirtiedSinceCheck;
+        /** The nanosecond timestamp of the last throttle check. */
+        uint64_t                    uThrottleCheckNS;
+        /** Bytes the delta encoding saved in the last RAM pass. */
+        uint64_t                    cbDeltaSavedLastPass;
+        /** RAM pages sent as XOR deltas. */
+        STAMCOUNTER                 StatDeltaPages;
+        /** Re-sent RAM pages that were not cached or differed too much. */
+        STAMCOUNTER                 StatDeltaMisses;
+        /** Bytes saved by the delta encoding. */
+        STAMCOUNTER                 StatDeltaBytesSaved;
+        /** The page delta cache, NULL if not enabled (PGMSavedState.cpp). */
+        R3PTRTYPE(struct PGMLSDELTACACHE *) pDeltaCacheR3;
+        /** The size of the page delta cache in MB, 0 if disabled.  Determines
+         * the saved state version, see pgmR3InitSavedState. */
+        uint32_t                    cDeltaCacheMB;
+#if HC_ARCH_BITS == 64
+        uint32_t                    u32Padding;
+#endif
     } LiveSave;
 
+    /** @name   Demand paged restore.
+     * @{ */
+    /** The RAM chunk index collected by a non-live save for the pgmidx unit. */
+    R3PTRTYPE(struct PGMSSMRAMIDX *) pSavedRamIdxR3;
+    /** The lazy restore state, NULL if not configured (/PGM/LazyRestore). */
+    R3PTRTYPE(struct PGMLAZYRESTORE *) pLazyRestoreR3;
+    /** Set while some RAM pages are still not loaded from the saved state.
+     * The ring-3 page mapping APIs check this before calling
+     * pgmR3LazyRestoreTouch. */
+    bool volatile                   fLazyRestoreActive;
+    /** Padding. */
+    bool                            afLazyRestorePadding[7];
+    /** @} */
+
     /** @name   Error injection.
      * @{ */
     /** Inject handy page allocation errors pretending we're completely out of
@@ -3889,6 +3929,10 @@ void            pgmHandlerVirtualDumpPhysPages(PVM pVM);
 #endif
 DECLCALLBACK(void) pgmR3InfoHandlers(PVM pVM, PCDBGFINFOHLP pHlp, const char *pszArgs);
 int             pgmR3InitSavedState(PVM pVM, uint64_t cbRam);
+int             pgmR3LazyRestoreFetchAll(PVM pVM);
+void            pgmR3LazyRestoreTouch(PVM pVM, RTGCPHYS GCPhys);
+void            pgmR3LazyRestoreReset(PVM pVM);
+void            pgmR3LazyRestoreTerm(PVM pVM);
 
 int             pgmPhysAllocPage(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys);
 int             pgmPhysAllocLargePage(PVM pVM, RTGCPHYS GCPhys);
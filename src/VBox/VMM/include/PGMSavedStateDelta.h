@@ -0,0 +1,121 @@
+/* $Id: PGMSavedStateDelta.h $ */
+/** @file
+ * PGM - XOR delta encoding of re-sent RAM pages in the saved state.
+ */
+
+/*
+ * Copyright (C) 2012 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+#ifndef ___PGMSavedStateDelta_h
+#define ___PGMSavedStateDelta_h
+
+#include <VBox/err.h>
+#include <VBox/log.h>
+#include <VBox/param.h>
+#include <iprt/assert.h>
+
+
+/** The max size of the XOR encoded page data, larger deltas are sent raw. */
+#define PGM_STATE_XOR_MAX               (PAGE_SIZE / 2)
+/** The number of unchanged bytes ending a run of XOR data. */
+#define PGM_STATE_XOR_MIN_SAME          4
+
+/**
+ * XOR encodes a page against the previously sent copy.
+ *
+ * The encoding is a sequence of runs, each consisting of the number of
+ * unchanged bytes to skip (16-bit), the number of XOR bytes following
+ * (16-bit) and the XOR bytes.  A run of XOR bytes is ended by
+ * PGM_STATE_XOR_MIN_SAME unchanged bytes.  Unchanged bytes at the end of the
+ * page are not encoded, so an unchanged page encodes to nothing.
+ *
+ * @returns true if encoded, false if it would take PGM_STATE_XOR_MAX bytes or
+ *          more (send it raw then).
+ * @param   pbOld               The previously sent page.
+ * @param   pbNew               The current page.
+ * @param   pbDst               Where to put the encoded data,
+ *                              PGM_STATE_XOR_MAX bytes.
+ * @param   pcbDst              Where to return the size of the encoded data.
+ */
+DECLINLINE(bool) pgmR3DeltaEncode(uint8_t const *pbOld, uint8_t const *pbNew, uint8_t *pbDst, uint32_t *pcbDst)
+{
+    uint32_t offDst = 0;
+    uint32_t off    = 0;
+    for (;;)
+    {
+        /* Skip the unchanged bytes, a qword at the time when possible. */
+        uint32_t const offSame = off;
+        while (   off + sizeof(uint64_t) <= PAGE_SIZE
+               && *(uint64_t const *)&pbOld[off] == *(uint64_t const *)&pbNew[off])
+            off += sizeof(uint64_t);
+        while (off < PAGE_SIZE && pbOld[off] == pbNew[off])
+            off++;
+        if (off >= PAGE_SIZE)
+            break;
+
+        /* Find the end of the changed bytes. */
+        uint32_t const offData  = off;
+        uint32_t       offLast  = off;
+        for (off++; off < PAGE_SIZE && off - offLast <= PGM_STATE_XOR_MIN_SAME; off++)
+            if (pbOld[off] != pbNew[off])
+                offLast = off;
+        off = offLast + 1;
+
+        uint32_t const cbSame = offData - offSame;
+        uint32_t const cbData = off - offData;
+        if (offDst + 4 + cbData >= PGM_STATE_XOR_MAX)
+            return false;
+        pbDst[offDst++] = RT_BYTE1(cbSame);
+        pbDst[offDst++] = RT_BYTE2(cbSame);
+        pbDst[offDst++] = RT_BYTE1(cbData);
+        pbDst[offDst++] = RT_BYTE2(cbData);
+        for (uint32_t i = offData; i < off; i++)
+            pbDst[offDst++] = pbOld[i] ^ pbNew[i];
+    }
+    *pcbDst = offDst;
+    return true;
+}
+
+
+/**
+ * Applies an XOR encoded page to the previous copy of it.
+ *
+ * @returns VBox status code.
+ * @param   pbPage              The page to update.
+ * @param   pbSrc               The encoded data, see pgmR3DeltaEncode.
+ * @param   cbSrc               The size of the encoded data.
+ */
+DECLINLINE(int) pgmR3DeltaDecode(uint8_t *pbPage, uint8_t const *pbSrc, uint32_t cbSrc)
+{
+    uint32_t off = 0;
+    while (cbSrc > 0)
+    {
+        AssertLogRelMsgReturn(cbSrc >= 4, ("cbSrc=%#x\n", cbSrc), VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+        uint32_t const cbSame = RT_MAKE_U16(pbSrc[0], pbSrc[1]);
+        uint32_t const cbData = RT_MAKE_U16(pbSrc[2], pbSrc[3]);
+        pbSrc += 4;
+        cbSrc -= 4;
+        AssertLogRelMsgReturn(   cbData > 0
+                              && cbData <= cbSrc
+                              && off + cbSame + cbData <= PAGE_SIZE,
+                              ("off=%#x cbSame=%#x cbData=%#x cbSrc=%#x\n", off, cbSame, cbData, cbSrc),
+                              VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+        off += cbSame;
+        for (uint32_t i = 0; i < cbData; i++)
+            pbPage[off++] ^= *pbSrc++;
+        cbSrc -= cbData;
+    }
+    return VINF_SUCCESS;
+}
+
+#endif
+
@@ -0,0 +1,156 @@
+/* $Id: tstPGMSavedStateDelta.cpp $ */
+/** @file
+ * Testcase for the XOR delta encoding of re-sent RAM pages.
+ */
+
+/*
+ * Copyright (C) 2012 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include <VBox/err.h>
+#include <VBox/param.h>
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/rand.h>
+#include <iprt/string.h>
+#include <iprt/test.h>
+
+#include "PGMSavedStateDelta.h"
+
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** The size of the guard zone behind the encoding buffer. */
+#define TST_GUARD_SIZE      64
+/** The guard zone filler. */
+#define TST_GUARD_BYTE      0xa5
+
+
+/*******************************************************************************
+*   Global Variables                                                           *
+*******************************************************************************/
+/** The previously sent page. */
+static uint8_t g_abOld[PAGE_SIZE];
+/** The current page. */
+static uint8_t g_abNew[PAGE_SIZE];
+/** The page the receiver reconstructs. */
+static uint8_t g_abCopy[PAGE_SIZE];
+/** The encoding buffer followed by the guard zone. */
+static uint8_t g_abEncoded[PGM_STATE_XOR_MAX + TST_GUARD_SIZE];
+
+
+/**
+ * Encodes g_abNew against g_abOld and checks that nothing is written past the
+ * PGM_STATE_XOR_MAX bytes the encoder was given.
+ *
+ * @returns The pgmR3DeltaEncode result.
+ * @param   pcbEncoded          Where to return the encoded size.
+ */
+static bool tstEncode(uint32_t *pcbEncoded)
+{
+    memset(g_abEncoded, TST_GUARD_BYTE, sizeof(g_abEncoded));
+    *pcbEncoded = UINT32_MAX;
+    bool fRet = pgmR3DeltaEncode(g_abOld, g_abNew, g_abEncoded, pcbEncoded);
+    RTTESTI_CHECK(ASMMemIsAll8(&g_abEncoded[PGM_STATE_XOR_MAX], TST_GUARD_SIZE, TST_GUARD_BYTE) == NULL);
+    if (fRet)
+        RTTESTI_CHECK_MSG(*pcbEncoded < PGM_STATE_XOR_MAX, ("cbEncoded=%#x\n", *pcbEncoded));
+    return fRet;
+}
+
+
+/**
+ * Encodes g_abNew against g_abOld, decodes it on top of a copy of g_abOld and
+ * checks that the result matches g_abNew.
+ *
+ * @param   cbExpect            The expected encoded size.
+ */
+static void tstRoundTrip(uint32_t cbExpect)
+{
+    uint32_t cbEncoded;
+    RTTESTI_CHECK_RETV(tstEncode(&cbEncoded));
+    RTTESTI_CHECK_MSG(cbEncoded == cbExpect, ("cbEncoded=%#x cbExpect=%#x\n", cbEncoded, cbExpect));
+
+    memcpy(g_abCopy, g_abOld, PAGE_SIZE);
+    RTTESTI_CHECK_RC(pgmR3DeltaDecode(g_abCopy, g_abEncoded, cbEncoded), VINF_SUCCESS);
+    RTTESTI_CHECK(!memcmp(g_abCopy, g_abNew, PAGE_SIZE));
+}
+
+
+int main()
+{
+    RTTEST hTest;
+    int rc = RTTestInitAndCreate("tstPGMSavedStateDelta", &hTest);
+    if (rc)
+        return rc;
+    RTTestBanner(hTest);
+
+    RTRandBytes(g_abOld, PAGE_SIZE);
+
+    RTTestSub(hTest, "Unchanged page");
+    memcpy(g_abNew, g_abOld, PAGE_SIZE);
+    tstRoundTrip(0);
+
+    RTTestSub(hTest, "Every byte changed");
+    for (uint32_t i = 0; i < PAGE_SIZE; i++)
+        g_abNew[i] = (uint8_t)~g_abOld[i];
+    uint32_t cbEncoded;
+    RTTESTI_CHECK(!tstEncode(&cbEncoded));
+
+    RTTestSub(hTest, "Scattered changes");
+    memcpy(g_abNew, g_abOld, PAGE_SIZE);
+    for (uint32_t i = 0; i < PAGE_SIZE; i += 64)
+        g_abNew[i] ^= 0x01;
+    g_abNew[PAGE_SIZE - 1] ^= 0x80;     /* a run ending at the page end */
+    tstRoundTrip((PAGE_SIZE / 64 + 1) * (4 + 1));
+
+    RTTestSub(hTest, "Run splitting");
+    memcpy(g_abNew, g_abOld, PAGE_SIZE);
+    g_abNew[100] ^= 0xff;
+    g_abNew[100 + PGM_STATE_XOR_MIN_SAME] ^= 0xff;     /* joined */
+    tstRoundTrip(4 + PGM_STATE_XOR_MIN_SAME + 1);
+    g_abNew[100 + PGM_STATE_XOR_MIN_SAME] = g_abOld[100 + PGM_STATE_XOR_MIN_SAME];
+    g_abNew[100 + PGM_STATE_XOR_MIN_SAME + 1] ^= 0xff; /* a new run */
+    tstRoundTrip(2 * (4 + 1));
+
+    RTTestSub(hTest, "Single run at the limit");
+    memcpy(g_abNew, g_abOld, PAGE_SIZE);
+    for (uint32_t i = 0; i < PGM_STATE_XOR_MAX - 5; i++)
+        g_abNew[16 + i] = (uint8_t)~g_abOld[16 + i];
+    tstRoundTrip(PGM_STATE_XOR_MAX - 1);
+    g_abNew[16 + PGM_STATE_XOR_MAX - 5] = (uint8_t)~g_abOld[16 + PGM_STATE_XOR_MAX - 5];
+    RTTESTI_CHECK(!tstEncode(&cbEncoded));
+
+    RTTestSub(hTest, "Too many runs");
+    memcpy(g_abNew, g_abOld, PAGE_SIZE);
+    for (uint32_t i = 0; i < PAGE_SIZE; i += PGM_STATE_XOR_MIN_SAME * 2)
+        g_abNew[i] ^= 0x01;
+    RTTESTI_CHECK(!tstEncode(&cbEncoded));
+
+    RTTestSub(hTest, "Malformed input");
+    RTAssertSetQuiet(true);
+    RTAssertSetMayPanic(false);
+    static const uint8_t s_abTruncated[] = { 0x00, 0x00, 0x01 };
+    RTTESTI_CHECK_RC(pgmR3DeltaDecode(g_abCopy, s_abTruncated, sizeof(s_abTruncated)), VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+    static const uint8_t s_abShortData[] = { 0x00, 0x00, 0x02, 0x00, 0xff };
+    RTTESTI_CHECK_RC(pgmR3DeltaDecode(g_abCopy, s_abShortData, sizeof(s_abShortData)), VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+    static const uint8_t s_abPastEnd[] = { RT_BYTE1(PAGE_SIZE - 1), RT_BYTE2(PAGE_SIZE - 1), 0x02, 0x00, 0xff, 0xff };
+    RTTESTI_CHECK_RC(pgmR3DeltaDecode(g_abCopy, s_abPastEnd, sizeof(s_abPastEnd)), VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+    static const uint8_t s_abEmptyRun[] = { 0x10, 0x00, 0x00, 0x00 };
+    RTTESTI_CHECK_RC(pgmR3DeltaDecode(g_abCopy, s_abEmptyRun, sizeof(s_abEmptyRun)), VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+
+    return RTTestSummaryAndDestroy(hTest);
+}
+
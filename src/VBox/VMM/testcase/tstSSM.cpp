@@ -20,9 +20,11 @@
 *   Header Files                                                               *
 *******************************************************************************/
 #include <VBox/vmm/ssm.h>
+#include "CFGMInternal.h" /* tstBenchmark */
 #include "VMInternal.h" /* createFakeVM */
 #include <VBox/vmm/vm.h>
 #include <VBox/vmm/uvm.h>
+#include <VBox/vmm/cfgm.h>
 #include <VBox/vmm/mm.h>
 #include <VBox/vmm/stam.h>
 
@@ -62,6 +64,14 @@ uint8_t         gabBigMem[_1M];
 #else
 uint8_t         gabBigMem[8*_1M];
 #endif
+/** Record offsets noted down by Item03Save for the SSMR3SeekRecord test. */
+struct TSTSSMMARK
+{
+    /** The SSMR3TellRecord offset. */
+    uint64_t        offRecord;
+    /** The page saved there. */
+    const uint8_t  *pbPage;
+}               gaItem03Marks[2];
 
 
 /** initializes gabBigMem with some non zero stuff. */
@@ -426,6 +436,19 @@ DECLCALLBACK(int) Item03Save(PPDMDEVINS pDevIns, PSSMHANDLE pSSM)
     const uint8_t *pu8Org = &gabBigMem[0];
     while (cb > 0)
     {
+        /* Note down the first and the 1000th page for the record seeking test. */
+        if (cb == TSTSSM_ITEM_SIZE || cb == TSTSSM_ITEM_SIZE - 1000 * PAGE_SIZE)
+        {
+            unsigned i = cb == TSTSSM_ITEM_SIZE ? 0 : 1;
+            rc = SSMR3TellRecord(pSSM, &gaItem03Marks[i].offRecord);
+            if (RT_FAILURE(rc))
+            {
+                RTPrintf("Item03: TellRecord -> %Rrc\n", rc);
+                return rc;
+            }
+            gaItem03Marks[i].pbPage = pu8Org;
+        }
+
         rc = SSMR3PutMem(pSSM, pu8Org, PAGE_SIZE);
         if (RT_FAILURE(rc))
         {
@@ -674,6 +697,66 @@ static int createFakeVM(PVM *ppVM)
 }
 
 
+/**
+ * Saves and loads the state with different numbers of compression threads
+ * and reports the throughput.
+ *
+ * @returns 0 on success, 1 on failure.
+ * @param   pVM             The fake VM with the test units registered.
+ * @param   pszFilename     The file to save to.
+ */
+static int tstBenchmark(PVM pVM, const char *pszFilename)
+{
+    /*
+     * SSM takes the compression settings from /SSM in the config tree,
+     * which the fake VM doesn't have.
+     */
+    PCFGMNODE pRoot = CFGMR3CreateTree(pVM);
+    PCFGMNODE pCfgSSM;
+    if (!pRoot || RT_FAILURE(CFGMR3InsertNode(pRoot, "SSM", &pCfgSSM)))
+    {
+        RTPrintf("tstSSM: failed to create the config tree\n");
+        return 1;
+    }
+    pVM->cfgm.s.pRoot = pRoot;
+
+    /* The data the test units save: item 1 is tiny, 2 is 8MB, 3 and 4 are 512MB each. */
+    uint64_t const cbData = (uint64_t)_1M * 8 + TSTSSM_ITEM_SIZE * 2;
+
+    static uint32_t const s_acThreads[] = { 0, 1, 2, 4, 8 };
+    for (unsigned i = 0; i < RT_ELEMENTS(s_acThreads); i++)
+    {
+        CFGMR3RemoveValue(pCfgSSM, "ZipThreads");
+        CFGMR3InsertInteger(pCfgSSM, "ZipThreads", s_acThreads[i]);
+
+        uint64_t u64Start = RTTimeNanoTS();
+        int rc = SSMR3Save(pVM, pszFilename, NULL, NULL, SSMAFTER_DESTROY, NULL, NULL);
+        if (RT_FAILURE(rc))
+        {
+            RTPrintf("SSMR3Save (%u threads) -> %Rrc\n", s_acThreads[i], rc);
+            return 1;
+        }
+        uint64_t const cNsSave = RT_MAX(RTTimeNanoTS() - u64Start, 1);
+
+        u64Start = RTTimeNanoTS();
+        rc = SSMR3Load(pVM, pszFilename, NULL /*pStreamOps*/, NULL /*pStreamOpsUser*/,
+                       SSMAFTER_RESUME, NULL /*pfnProgress*/, NULL /*pvProgressUser*/);
+        if (RT_FAILURE(rc))
+        {
+            RTPrintf("SSMR3Load (%u threads) -> %Rrc\n", s_acThreads[i], rc);
+            return 1;
+        }
+        uint64_t const cNsLoad = RT_MAX(RTTimeNanoTS() - u64Start, 1);
+
+        RTPrintf("tstSSM: %u compression threads: save %'RU64 MB/s, load %'RU64 MB/s\n", s_acThreads[i],
+                 cbData * RT_NS_1SEC / cNsSave / _1M, cbData * RT_NS_1SEC / cNsLoad / _1M);
+    }
+
+    RTPrintf("tstSSM: SUCCESS\n");
+    return 0;
+}
+
+
 int main(int argc, char **argv)
 {
     /*
@@ -740,6 +823,12 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    /*
+     * Throughput benchmark instead of the functional test?
+     */
+    if (argc == 2 && !strcmp(argv[1], "--benchmark"))
+        return tstBenchmark(pVM, pszFilename);
+
     /*
      * Attempt a save.
      */
@@ -874,6 +963,35 @@ int main(int argc, char **argv)
     u64Elapsed = RTTimeNanoTS() - u64Start;
     RTPrintf("tstSSM: Loaded 1st item in %'RI64 ns\n", u64Elapsed);
 
+    /* record seeking within the 3rd unit, forwards and then backwards */
+    rc = SSMR3Seek(pSSM, "SSM Testcase Data Item no.3 (big mem)", 0, NULL);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("SSMR3Seek #2 unit 3 -> %Rrc\n", rc);
+        return 1;
+    }
+    for (int i = RT_ELEMENTS(gaItem03Marks) - 1; i >= 0; i--)
+    {
+        rc = SSMR3SeekRecord(pSSM, gaItem03Marks[i].offRecord);
+        if (RT_FAILURE(rc))
+        {
+            RTPrintf("SSMR3SeekRecord #%d %#llx -> %Rrc\n", i, gaItem03Marks[i].offRecord, rc);
+            return 1;
+        }
+        uint8_t abPage[PAGE_SIZE];
+        rc = SSMR3GetMem(pSSM, abPage, sizeof(abPage));
+        if (RT_FAILURE(rc))
+        {
+            RTPrintf("SSMR3SeekRecord #%d: GetMem -> %Rrc\n", i, rc);
+            return 1;
+        }
+        if (memcmp(abPage, gaItem03Marks[i].pbPage, sizeof(abPage)))
+        {
+            RTPrintf("SSMR3SeekRecord #%d: mismatch\n", i);
+            return 1;
+        }
+    }
+
     /* 3st unit */
     uVersion = 0xbadc0ded;
     rc = SSMR3Seek(pSSM, "SSM Testcase Data Item no.3 (big mem)", 0, &uVersion);
@@ -0,0 +1,467 @@
+/* $Id: tstSSMTcp.cpp $ */
+/** @file
+ * Testcase for the striped TCP stream used by teleportation and FT sync.
+ */
+
+/*
+ * Copyright (C) 2012 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include <VBox/vmm/ssm.h>
+#include <VBox/err.h>
+#include <iprt/assert.h>
+#include <iprt/mem.h>
+#include <iprt/rand.h>
+#include <iprt/string.h>
+#include <iprt/tcp.h>
+#include <iprt/test.h>
+#include <iprt/thread.h>
+
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** The loopback port the test server listens on. */
+#define TST_PORT            9998
+/** The amount of data to push through the stripe.  This is deliberately not
+ * a multiple of the chunk size so the last chunk is a short one. */
+#define TST_DATA_SIZE       (5 * _1M + 4321)
+
+
+/*******************************************************************************
+*   Structures and Typedefs                                                    *
+*******************************************************************************/
+/**
+ * A set of connected socket pairs.
+ */
+typedef struct TSTSOCKETS
+{
+    /** The server the reading ends were accepted by. */
+    PRTTCPSERVER    pServer;
+    /** The number of socket pairs. */
+    uint32_t        cSockets;
+    /** The writing (connecting) ends. */
+    RTSOCKET        ahWriters[SSM_TCP_STRIPE_MAX_STREAMS];
+    /** The reading (accepted) ends, in the same order. */
+    RTSOCKET        ahReaders[SSM_TCP_STRIPE_MAX_STREAMS];
+} TSTSOCKETS;
+
+/**
+ * Writer thread arguments.
+ */
+typedef struct TSTWRITER
+{
+    /** The sending stripe. */
+    PSSMTCPSTRIPE   pStripe;
+    /** The number of bytes of g_pbSrc to write. */
+    size_t          cbToWrite;
+    /** Whether to cancel the stream instead of ending it. */
+    bool            fCancel;
+} TSTWRITER;
+
+
+/*******************************************************************************
+*   Global Variables                                                           *
+*******************************************************************************/
+/** The data to send. */
+static uint8_t *g_pbSrc;
+/** Where the received data goes. */
+static uint8_t *g_pbDst;
+
+
+/**
+ * Connects @a cSockets socket pairs over loopback.
+ *
+ * @returns true on success, false on failure (reported).
+ * @param   pSockets            The socket set to initialize.
+ * @param   cSockets            The number of pairs to connect.
+ */
+static bool tstConnect(TSTSOCKETS *pSockets, uint32_t cSockets)
+{
+    RT_ZERO(*pSockets);
+    for (uint32_t i = 0; i < RT_ELEMENTS(pSockets->ahWriters); i++)
+    {
+        pSockets->ahWriters[i] = NIL_RTSOCKET;
+        pSockets->ahReaders[i] = NIL_RTSOCKET;
+    }
+
+    int rc;
+    RTTESTI_CHECK_RC_RET(rc = RTTcpServerCreateEx("localhost", TST_PORT, &pSockets->pServer), VINF_SUCCESS, false);
+
+    /* Connect first and accept afterwards, the backlog keeps the order. */
+    for (uint32_t i = 0; i < cSockets; i++)
+    {
+        RTTESTI_CHECK_RC_BREAK(rc = RTTcpClientConnect("localhost", TST_PORT, &pSockets->ahWriters[i]), VINF_SUCCESS);
+        if (i == 0)
+            rc = RTTcpServerListen2(pSockets->pServer, &pSockets->ahReaders[i]);
+        else
+            rc = RTTcpServerAcceptExtra(pSockets->pServer, 5000, &pSockets->ahReaders[i]);
+        RTTESTI_CHECK_RC_BREAK(rc, VINF_SUCCESS);
+        pSockets->cSockets = i + 1;
+    }
+    return RT_SUCCESS(rc);
+}
+
+
+/**
+ * Closes all the sockets and the server.
+ *
+ * @param   pSockets            The socket set.
+ */
+static void tstDisconnect(TSTSOCKETS *pSockets)
+{
+    for (uint32_t i = 0; i < RT_ELEMENTS(pSockets->ahWriters); i++)
+    {
+        if (pSockets->ahReaders[i] != NIL_RTSOCKET)
+            RTTcpServerDisconnectClient2(pSockets->ahReaders[i]);
+        pSockets->ahReaders[i] = NIL_RTSOCKET;
+        if (pSockets->ahWriters[i] != NIL_RTSOCKET)
+            RTTcpClientClose(pSockets->ahWriters[i]);
+        pSockets->ahWriters[i] = NIL_RTSOCKET;
+    }
+    if (pSockets->pServer)
+        RTTESTI_CHECK_RC(RTTcpServerDestroy(pSockets->pServer), VINF_SUCCESS);
+    pSockets->pServer = NULL;
+}
+
+
+/**
+ * Writes g_pbSrc in randomly sized pieces and ends or cancels the stream.
+ *
+ * @returns The first write error or the SSMR3TcpStripeClose status.
+ * @param   hThread             The thread handle.
+ * @param   pvUser              The TSTWRITER arguments.
+ */
+static DECLCALLBACK(int) tstWriterThread(RTTHREAD hThread, void *pvUser)
+{
+    TSTWRITER *pArgs = (TSTWRITER *)pvUser;
+    NOREF(hThread);
+
+    size_t off = 0;
+    while (off < pArgs->cbToWrite)
+    {
+        size_t cb = RTRandU32Ex(1, 192 * _1K);
+        cb = RT_MIN(cb, pArgs->cbToWrite - off);
+        int rc = SSMR3TcpStripeWrite(pArgs->pStripe, &g_pbSrc[off], cb);
+        if (RT_FAILURE(rc))
+            return rc;
+        off += cb;
+    }
+    return SSMR3TcpStripeClose(pArgs->pStripe, pArgs->fCancel);
+}
+
+
+/**
+ * Sets up both stripes on connected sockets and starts the writer thread.
+ *
+ * @returns true on success, false on failure (reported, the stripes are
+ *          destroyed but the sockets are left alone).
+ * @param   pSockets            The connected socket set.
+ * @param   pArgs               The writer arguments, cbToWrite and fCancel
+ *                              must be set.
+ * @param   ppReader            Where to return the receiving stripe.
+ * @param   phThread            Where to return the writer thread handle.
+ */
+static bool tstStartStripes(TSTSOCKETS *pSockets, TSTWRITER *pArgs, PSSMTCPSTRIPE *ppReader, PRTTHREAD phThread)
+{
+    uint32_t const cSockets = pSockets->cSockets;
+    *ppReader      = NULL;
+    pArgs->pStripe = NULL;
+
+    int rc;
+    RTTESTI_CHECK_RC(rc = SSMR3TcpStripeCreate(pSockets->ahWriters, cSockets, true /*fWriter*/, &pArgs->pStripe), VINF_SUCCESS);
+    if (RT_SUCCESS(rc))
+    {
+        RTTESTI_CHECK_RC(rc = SSMR3TcpStripeCreate(pSockets->ahReaders, cSockets, false /*fWriter*/, ppReader), VINF_SUCCESS);
+        if (RT_SUCCESS(rc))
+        {
+            RTTESTI_CHECK_RC(rc = RTThreadCreate(phThread, tstWriterThread, pArgs, 0, RTTHREADTYPE_DEFAULT,
+                                                 RTTHREADFLAGS_WAITABLE, "tstWriter"), VINF_SUCCESS);
+            if (RT_SUCCESS(rc))
+                return true;
+            SSMR3TcpStripeDestroy(*ppReader);
+            *ppReader = NULL;
+        }
+        SSMR3TcpStripeDestroy(pArgs->pStripe);
+        pArgs->pStripe = NULL;
+    }
+    return false;
+}
+
+
+/**
+ * Sets up the sockets and both stripes, and starts the writer thread.
+ *
+ * @returns true on success, false on failure (reported and cleaned up).
+ * @param   pSockets            The socket set to connect.
+ * @param   cSockets            The number of socket pairs.
+ * @param   pArgs               The writer arguments, cbToWrite and fCancel
+ *                              must be set.
+ * @param   ppReader            Where to return the receiving stripe.
+ * @param   phThread            Where to return the writer thread handle.
+ */
+static bool tstStart(TSTSOCKETS *pSockets, uint32_t cSockets, TSTWRITER *pArgs, PSSMTCPSTRIPE *ppReader, PRTTHREAD phThread)
+{
+    if (   tstConnect(pSockets, cSockets)
+        && tstStartStripes(pSockets, pArgs, ppReader, phThread))
+        return true;
+    tstDisconnect(pSockets);
+    return false;
+}
+
+
+/**
+ * Reads from the stripe in randomly sized pieces until it fails.
+ *
+ * @returns The status that ended the reading.
+ * @param   pReader             The receiving stripe.
+ * @param   cbMax               The max number of bytes to read, SIZE_MAX
+ *                              for reading till the end.
+ * @param   pcbRead             Where to return the number of bytes read.
+ */
+static int tstReadAll(PSSMTCPSTRIPE pReader, size_t cbMax, size_t *pcbRead)
+{
+    size_t off = 0;
+    int    rc  = VINF_SUCCESS;
+    while (off < cbMax)
+    {
+        size_t cb = RTRandU32Ex(1, 160 * _1K);
+        cb = RT_MIN(cb, RT_MIN(cbMax, (size_t)TST_DATA_SIZE) - off);
+        if (!cb)
+        {
+            /* All the data is in, so this must fail. */
+            uint8_t b;
+            rc = SSMR3TcpStripeRead(pReader, &b, 1, &cb);
+            RTTESTI_CHECK(RT_FAILURE(rc));
+            break;
+        }
+        rc = SSMR3TcpStripeRead(pReader, &g_pbDst[off], cb, &cb);
+        if (RT_FAILURE(rc))
+            break;
+        RTTESTI_CHECK_BREAK(cb > 0);
+        off += cb;
+    }
+    *pcbRead = off;
+    return rc;
+}
+
+
+/**
+ * Sends the whole buffer and checks that it arrives intact and that the end
+ * of the stream is reported as EOF.
+ *
+ * @param   cSockets            The number of socket pairs to stripe over.
+ */
+static void tstReassembly(uint32_t cSockets)
+{
+    RTTestISubF("Reassembly over %u sockets", cSockets);
+
+    TSTSOCKETS      Sockets;
+    TSTWRITER       Args;
+    PSSMTCPSTRIPE   pReader;
+    RTTHREAD        hThread;
+    Args.cbToWrite = TST_DATA_SIZE;
+    Args.fCancel   = false;
+    if (!tstStart(&Sockets, cSockets, &Args, &pReader, &hThread))
+        return;
+
+    memset(g_pbDst, 0xff, TST_DATA_SIZE);
+    size_t cbRead;
+    RTTESTI_CHECK_RC(tstReadAll(pReader, SIZE_MAX, &cbRead), VERR_EOF);
+    RTTESTI_CHECK_MSG(cbRead == TST_DATA_SIZE, ("cbRead=%#zx\n", cbRead));
+    RTTESTI_CHECK(!memcmp(g_pbSrc, g_pbDst, TST_DATA_SIZE));
+
+    /* The end sticks, also for reads without a byte count. */
+    uint8_t b;
+    RTTESTI_CHECK_RC(SSMR3TcpStripeRead(pReader, &b, 1, &cbRead), VERR_EOF);
+    RTTESTI_CHECK_RC(SSMR3TcpStripeRead(pReader, &b, 1, NULL), VERR_EOF);
+
+    int rcThread = VERR_INTERNAL_ERROR;
+    RTTESTI_CHECK_RC(RTThreadWait(hThread, RT_INDEFINITE_WAIT, &rcThread), VINF_SUCCESS);
+    RTTESTI_CHECK_RC(rcThread, VINF_SUCCESS);
+
+    RTTESTI_CHECK_RC(SSMR3TcpStripeDestroy(pReader), VINF_SUCCESS);
+    RTTESTI_CHECK_RC(SSMR3TcpStripeDestroy(Args.pStripe), VINF_SUCCESS);
+    tstDisconnect(&Sockets);
+}
+
+
+/**
+ * Cancels the stream after a while and checks that the reader is told so
+ * after getting what was sent before the cancel.
+ */
+static void tstCancel(void)
+{
+    RTTestISub("Cancel");
+
+    TSTSOCKETS      Sockets;
+    TSTWRITER       Args;
+    PSSMTCPSTRIPE   pReader;
+    RTTHREAD        hThread;
+    Args.cbToWrite = _1M + 1234;
+    Args.fCancel   = true;
+    if (!tstStart(&Sockets, 3, &Args, &pReader, &hThread))
+        return;
+
+    size_t cbRead;
+    RTTESTI_CHECK_RC(tstReadAll(pReader, SIZE_MAX, &cbRead), VERR_SSM_CANCELLED);
+    RTTESTI_CHECK_MSG(cbRead <= Args.cbToWrite, ("cbRead=%#zx\n", cbRead));
+    RTTESTI_CHECK(!memcmp(g_pbSrc, g_pbDst, cbRead));
+
+    uint8_t b;
+    RTTESTI_CHECK_RC(SSMR3TcpStripeRead(pReader, &b, 1, NULL), VERR_EOF);
+
+    int rcThread = VERR_INTERNAL_ERROR;
+    RTTESTI_CHECK_RC(RTThreadWait(hThread, RT_INDEFINITE_WAIT, &rcThread), VINF_SUCCESS);
+    RTTESTI_CHECK_RC(rcThread, VINF_SUCCESS);
+
+    RTTESTI_CHECK_RC(SSMR3TcpStripeDestroy(pReader), VINF_SUCCESS);
+    RTTESTI_CHECK_RC(SSMR3TcpStripeDestroy(Args.pStripe), VINF_SUCCESS);
+    tstDisconnect(&Sockets);
+}
+
+
+/**
+ * Makes the reader give up half way through and destroys it while the writer
+ * is still sending.
+ */
+static void tstStopReading(void)
+{
+    RTTestISub("Stop reading");
+
+    TSTSOCKETS      Sockets;
+    TSTWRITER       Args;
+    PSSMTCPSTRIPE   pReader;
+    RTTHREAD        hThread;
+    Args.cbToWrite = TST_DATA_SIZE;
+    Args.fCancel   = false;
+    if (!tstStart(&Sockets, 4, &Args, &pReader, &hThread))
+        return;
+
+    size_t cbRead;
+    RTTESTI_CHECK_RC(tstReadAll(pReader, _512K, &cbRead), VINF_SUCCESS);
+    RTTESTI_CHECK(!memcmp(g_pbSrc, g_pbDst, cbRead));
+
+    SSMR3TcpStripeSetStopReading(pReader, true);
+    uint8_t b;
+    RTTESTI_CHECK_RC(SSMR3TcpStripeRead(pReader, &b, 1, NULL), VERR_INTERRUPTED);
+    RTTESTI_CHECK(!SSMR3TcpStripeCanReuseSockets(pReader));
+    RTTESTI_CHECK_RC(SSMR3TcpStripeDestroy(pReader), VINF_SUCCESS);
+
+    /* Closing the reading ends fails the writer unless it already managed to
+       stuff everything into the socket buffers. */
+    for (uint32_t i = 0; i < Sockets.cSockets; i++)
+    {
+        RTTcpServerDisconnectClient2(Sockets.ahReaders[i]);
+        Sockets.ahReaders[i] = NIL_RTSOCKET;
+    }
+
+    int rcThread = VERR_INTERNAL_ERROR;
+    RTTESTI_CHECK_RC(RTThreadWait(hThread, RT_INDEFINITE_WAIT, &rcThread), VINF_SUCCESS);
+    RTTestIPrintf(RTTESTLVL_ALWAYS, "writer status: %Rrc\n", rcThread);
+
+    RTTESTI_CHECK_RC(SSMR3TcpStripeDestroy(Args.pStripe), VINF_SUCCESS);
+    tstDisconnect(&Sockets);
+}
+
+
+/**
+ * Runs several stripes one after the other over the same sockets, the way
+ * FTM does for its checkpoints, destroying the reader right after it
+ * reported the end of each stream.
+ */
+static void tstReuse(void)
+{
+    RTTestISub("Reuse");
+
+    static struct { size_t cbToWrite; bool fCancel; } const s_aRounds[] =
+    {
+        { TST_DATA_SIZE,    false },
+        { 3 * _128K,        false },
+        { _1M + 1234,       true  },
+        { 4321,             false },
+        { TST_DATA_SIZE,    false },
+    };
+
+    TSTSOCKETS Sockets;
+    if (!tstConnect(&Sockets, 3))
+    {
+        tstDisconnect(&Sockets);
+        return;
+    }
+
+    for (unsigned iRound = 0; iRound < RT_ELEMENTS(s_aRounds); iRound++)
+    {
+        TSTWRITER       Args;
+        PSSMTCPSTRIPE   pReader;
+        RTTHREAD        hThread;
+        Args.cbToWrite = s_aRounds[iRound].cbToWrite;
+        Args.fCancel   = s_aRounds[iRound].fCancel;
+        if (!tstStartStripes(&Sockets, &Args, &pReader, &hThread))
+            break;
+
+        memset(g_pbDst, 0xff, TST_DATA_SIZE);
+        size_t cbRead;
+        RTTESTI_CHECK_RC(tstReadAll(pReader, SIZE_MAX, &cbRead), Args.fCancel ? VERR_SSM_CANCELLED : VERR_EOF);
+        if (!Args.fCancel)
+            RTTESTI_CHECK_MSG(cbRead == Args.cbToWrite, ("round %u: cbRead=%#zx\n", iRound, cbRead));
+        RTTESTI_CHECK(!memcmp(g_pbSrc, g_pbDst, cbRead));
+
+        /* The end of the stream is only reported once all the markers are in. */
+        RTTESTI_CHECK(SSMR3TcpStripeCanReuseSockets(pReader));
+        RTTESTI_CHECK_RC(SSMR3TcpStripeDestroy(pReader), VINF_SUCCESS);
+
+        int rcThread = VERR_INTERNAL_ERROR;
+        RTTESTI_CHECK_RC(RTThreadWait(hThread, RT_INDEFINITE_WAIT, &rcThread), VINF_SUCCESS);
+        RTTESTI_CHECK_RC(rcThread, VINF_SUCCESS);
+        RTTESTI_CHECK(SSMR3TcpStripeCanReuseSockets(Args.pStripe));
+        RTTESTI_CHECK_RC(SSMR3TcpStripeDestroy(Args.pStripe), VINF_SUCCESS);
+        if (RTTestIErrorCount())
+            break;
+    }
+
+    tstDisconnect(&Sockets);
+}
+
+
+int main()
+{
+    RTTEST hTest;
+    int rc = RTTestInitAndCreate("tstSSMTcp", &hTest);
+    if (rc)
+        return rc;
+    RTTestBanner(hTest);
+
+    g_pbSrc = (uint8_t *)RTMemAlloc(TST_DATA_SIZE);
+    g_pbDst = (uint8_t *)RTMemAlloc(TST_DATA_SIZE);
+    if (g_pbSrc && g_pbDst)
+    {
+        RTRandBytes(g_pbSrc, TST_DATA_SIZE);
+
+        tstReassembly(2);
+        tstReassembly(3);
+        tstReassembly(4);
+        tstCancel();
+        tstStopReading();
+        tstReuse();
+    }
+    else
+        RTTestFailed(hTest, "out of memory");
+    RTMemFree(g_pbSrc);
+    RTMemFree(g_pbDst);
+
+    return RTTestSummaryAndDestroy(hTest);
+}
+